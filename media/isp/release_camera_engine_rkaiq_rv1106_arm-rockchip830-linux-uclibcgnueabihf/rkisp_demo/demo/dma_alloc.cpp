@@ -0,0 +1,125 @@
+/*
+ *  Copyright (c) 2019 Rockchip Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "dma_alloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* the uapi headers of older toolchains lack dma-heap, keep local copies */
+struct dma_heap_allocation_data {
+    uint64_t len;
+    uint32_t fd;
+    uint32_t fd_flags;
+    uint64_t heap_flags;
+};
+
+#define DMA_HEAP_IOC_MAGIC      'H'
+#define DMA_HEAP_IOCTL_ALLOC    _IOWR(DMA_HEAP_IOC_MAGIC, 0x0, \
+                                      struct dma_heap_allocation_data)
+
+#define DMA_BUF_SYNC_READ       (1 << 0)
+#define DMA_BUF_SYNC_START      (0 << 2)
+#define DMA_BUF_SYNC_END        (1 << 2)
+
+struct dma_buf_sync {
+    uint64_t flags;
+};
+
+#define DMA_BUF_BASE            'b'
+#define DMA_BUF_IOCTL_SYNC      _IOW(DMA_BUF_BASE, 0, struct dma_buf_sync)
+
+const char *dma_heap_probe(void)
+{
+    static const char *heaps[] = {
+        DMA_HEAP_RV1106_CMA_PATH,
+        DMA_HEAP_CMA_PATH,
+        DMA_HEAP_SYSTEM_PATH,
+    };
+
+    for (size_t i = 0; i < sizeof(heaps) / sizeof(heaps[0]); i++) {
+        if (!access(heaps[i], R_OK | W_OK))
+            return heaps[i];
+    }
+
+    return NULL;
+}
+
+int dma_buf_alloc(const char *path, size_t size, int *fd, void **va)
+{
+    struct dma_heap_allocation_data data;
+    void *map;
+    int heap_fd;
+    int ret;
+
+    heap_fd = open(path, O_RDWR | O_CLOEXEC);
+    if (heap_fd < 0) {
+        printf("open %s failed, %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    memset(&data, 0, sizeof(data));
+    data.len = size;
+    data.fd_flags = O_CLOEXEC | O_RDWR;
+    ret = ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data);
+    close(heap_fd);
+    if (ret < 0) {
+        printf("alloc %zu bytes from %s failed, %s\n", size, path, strerror(errno));
+        return -1;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, data.fd, 0);
+    if (map == MAP_FAILED) {
+        printf("mmap dma buf failed, %s\n", strerror(errno));
+        close(data.fd);
+        return -1;
+    }
+
+    *fd = data.fd;
+    *va = map;
+
+    return 0;
+}
+
+void dma_buf_free(size_t size, int *fd, void *va)
+{
+    munmap(va, size);
+    close(*fd);
+    *fd = -1;
+}
+
+int dma_sync_device_to_cpu(int fd)
+{
+    struct dma_buf_sync sync;
+
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+    return ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+int dma_sync_cpu_to_device(int fd)
+{
+    struct dma_buf_sync sync;
+
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+    return ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
@@ -0,0 +1,38 @@
+/*
+ *  Copyright (c) 2019 Rockchip Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef _DEMO_DMA_ALLOC_H_
+#define _DEMO_DMA_ALLOC_H_
+
+#include <stddef.h>
+
+/* dma-heap buffers for V4L2_MEMORY_DMABUF capture, same heaps as rga_samples */
+#define DMA_HEAP_RV1106_CMA_PATH    "/dev/rk_dma_heap/rk-dma-heap-cma"
+#define DMA_HEAP_CMA_PATH           "/dev/dma_heap/cma"
+#define DMA_HEAP_SYSTEM_PATH        "/dev/dma_heap/system"
+
+/* first heap of the list above present on this board, NULL if none */
+const char *dma_heap_probe(void);
+
+int dma_buf_alloc(const char *path, size_t size, int *fd, void **va);
+void dma_buf_free(size_t size, int *fd, void *va);
+
+/* bracket cpu reads of a buffer the device has written */
+int dma_sync_device_to_cpu(int fd);
+int dma_sync_cpu_to_device(int fd);
+
+#endif
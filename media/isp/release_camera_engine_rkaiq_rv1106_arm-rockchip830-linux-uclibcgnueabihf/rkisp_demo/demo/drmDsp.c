@@ -19,6 +19,15 @@
 #include "rga.h"
 #endif
 
+#define DRM_DSP_MAX_IMPORT 16
+
+/* capture dma buffers imported as framebuffers, scanned out without a copy */
+struct drmDspImport {
+  int dmaFd;
+  uint32_t handle;
+  uint32_t fb_id;
+};
+
 struct drmDsp {
   struct fb_var_screeninfo vinfo;
   unsigned long screensize;
@@ -30,6 +39,7 @@ struct drmDsp {
   int num_test_planes;
   struct sp_bo* bo[2];
   struct sp_bo* nextbo;
+  struct drmDspImport imports[DRM_DSP_MAX_IMPORT];
 } gDrmDsp;
 
 int initDrmDsp() {
@@ -55,7 +65,8 @@ int initDrmDsp() {
     return -1;
   }
 
-  pDrmDsp->test_crtc = &pDrmDsp->dev->crtcs[3];
+  /* the fourth crtc on rockchip vops, single-crtc devices like vkms use the first */
+  pDrmDsp->test_crtc = &pDrmDsp->dev->crtcs[pDrmDsp->dev->num_crtcs > 3 ? 3 : 0];
   pDrmDsp->num_test_planes = pDrmDsp->test_crtc->num_planes;
   for (i = 0; i < pDrmDsp->test_crtc->num_planes; i++) {
     pDrmDsp->plane[i] = get_sp_plane(pDrmDsp->dev, pDrmDsp->test_crtc);
@@ -75,6 +86,12 @@ int initDrmDsp() {
 
 void deInitDrmDsp() {
   struct drmDsp* pDrmDsp = &gDrmDsp;
+  int i;
+
+  for (i = 0; i < DRM_DSP_MAX_IMPORT; i++) {
+    if (pDrmDsp->imports[i].fb_id)
+      drmDspReleaseFd(pDrmDsp->imports[i].dmaFd);
+  }
   if (pDrmDsp->bo[0])
     free_sp_bo(pDrmDsp->bo[0]);
   if (pDrmDsp->bo[1])
@@ -346,3 +363,98 @@ int drmDspFrame(int srcWidth, int srcHeight, int dispWidth, int dispHeight,
 #endif
   return ret;
 }
+
+static struct drmDspImport* drmDspImportFd(int width, int height, int pitch,
+                                           int dmaFd, int fmt) {
+  struct drmDsp* pDrmDsp = &gDrmDsp;
+  struct drmDspImport* imp = NULL;
+  uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+  int i, ret;
+
+  for (i = 0; i < DRM_DSP_MAX_IMPORT; i++) {
+    if (pDrmDsp->imports[i].fb_id && pDrmDsp->imports[i].dmaFd == dmaFd)
+      return &pDrmDsp->imports[i];
+    if (!imp && !pDrmDsp->imports[i].fb_id)
+      imp = &pDrmDsp->imports[i];
+  }
+  if (!imp) {
+    printf("%s: no free import slot for fd %d\n", __func__, dmaFd);
+    return NULL;
+  }
+
+  ret = drmPrimeFDToHandle(pDrmDsp->dev->fd, dmaFd, &imp->handle);
+  if (ret) {
+    printf("%s: import fd %d failed ret=%d\n", __func__, dmaFd, ret);
+    return NULL;
+  }
+  handles[0] = imp->handle;
+  pitches[0] = pitch;
+  offsets[0] = 0;
+  handles[1] = imp->handle;
+  pitches[1] = pitch;
+  offsets[1] = pitch * height;
+  ret = drmModeAddFB2(pDrmDsp->dev->fd, width, height, fmt, handles, pitches,
+                      offsets, &imp->fb_id, 0);
+  if (ret) {
+    struct drm_gem_close req = {
+      .handle = imp->handle,
+    };
+
+    printf("%s: add fb for fd %d failed ret=%d\n", __func__, dmaFd, ret);
+    drmIoctl(pDrmDsp->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+    imp->fb_id = 0;
+    return NULL;
+  }
+  imp->dmaFd = dmaFd;
+
+  return imp;
+}
+
+int drmDspFrameFd(int width, int height, int pitch, int dmaFd, int fmt)
+{
+  struct drmDsp* pDrmDsp = &gDrmDsp;
+  struct drmDspImport* imp;
+  int ret;
+
+  if (DRM_FORMAT_NV12 != fmt) {
+    printf("%s just support NV12 to display\n", __func__);
+    return -1;
+  }
+  if (!pDrmDsp->dev || !pDrmDsp->test_plane)
+    return -1;
+
+  imp = drmDspImportFd(width, height, pitch, dmaFd, fmt);
+  if (!imp)
+    return -1;
+
+  ret = drmModeSetPlane(pDrmDsp->dev->fd, pDrmDsp->test_plane->plane->plane_id,
+                        pDrmDsp->test_crtc->crtc->crtc_id, imp->fb_id, 0, 0, 0,
+                        width, height, 0, 0, width << 16, height << 16);
+  if (ret)
+    printf("failed to set plane to crtc ret=%d\n", ret);
+
+  return ret;
+}
+
+void drmDspReleaseFd(int dmaFd)
+{
+  struct drmDsp* pDrmDsp = &gDrmDsp;
+  int i;
+
+  if (!pDrmDsp->dev)
+    return;
+
+  for (i = 0; i < DRM_DSP_MAX_IMPORT; i++) {
+    struct drmDspImport* imp = &pDrmDsp->imports[i];
+
+    if (!imp->fb_id || imp->dmaFd != dmaFd)
+      continue;
+    /* removing the fb on screen also disables the plane */
+    drmModeRmFB(pDrmDsp->dev->fd, imp->fb_id);
+    struct drm_gem_close req = {
+      .handle = imp->handle,
+    };
+    drmIoctl(pDrmDsp->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
+    memset(imp, 0, sizeof(*imp));
+  }
+}
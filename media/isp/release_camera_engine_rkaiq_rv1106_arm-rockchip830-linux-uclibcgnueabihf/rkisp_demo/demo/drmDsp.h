@@ -11,6 +11,9 @@ extern "C"
 int initDrmDsp();
 int drmDspFrame(int srcWidth, int srcHeight, int dispWidth, int dispHeight,
 		int dmaFd, void* dstAddr, int fmt);
+/* scan out a dma buffer in place, the buffer must stay untouched until the next frame */
+int drmDspFrameFd(int width, int height, int pitch, int dmaFd, int fmt);
+void drmDspReleaseFd(int dmaFd);
 void deInitDrmDsp();
 #ifdef __cplusplus
 }
@@ -0,0 +1,318 @@
+/*
+ *  Copyright (c) 2019 Rockchip Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "frame_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* one write() per chunk, written back and dropped from the page cache in
+ * windows so the dirty data never piles up into one long flush */
+#define WRITER_CHUNK            (1 << 20)
+#define WRITER_FLUSH_WINDOW     (8 << 20)
+#define WRITER_REPORT_FRAMES    300
+
+struct frame_writer {
+    frame_writer_cfg_t cfg;
+    frame_writer_frame_t *queue;
+    int head;
+    int count;
+    int stop;
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    frame_writer_stats_t stats;
+
+    /* open raw/container file */
+    int fd;
+    int idx_fd;
+    int cur_mode;
+    char cur_path[256];
+    uint64_t offset;
+    uint64_t flushed;
+};
+
+static uint64_t writer_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int writer_write_all(int fd, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+
+    while (size > 0) {
+        ssize_t len = write(fd, p, size > WRITER_CHUNK ? WRITER_CHUNK : size);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += len;
+        size -= len;
+    }
+
+    return 0;
+}
+
+static void writer_flush_window(frame_writer_t *w, int final)
+{
+#ifdef SYNC_FILE_RANGE_WRITE
+    if (!final && w->offset - w->flushed < WRITER_FLUSH_WINDOW)
+        return;
+    sync_file_range(w->fd, w->flushed, w->offset - w->flushed,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                    SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(w->fd, w->flushed, w->offset - w->flushed, POSIX_FADV_DONTNEED);
+    w->flushed = w->offset;
+#else
+    if (final)
+        fdatasync(w->fd);
+#endif
+}
+
+static void writer_close_file(frame_writer_t *w)
+{
+    if (w->fd >= 0) {
+        writer_flush_window(w, 1);
+        close(w->fd);
+        w->fd = -1;
+    }
+    if (w->idx_fd >= 0) {
+        fdatasync(w->idx_fd);
+        close(w->idx_fd);
+        w->idx_fd = -1;
+    }
+    w->cur_path[0] = '\0';
+}
+
+static int writer_open_file(frame_writer_t *w, const frame_writer_frame_t *f)
+{
+    char idx_path[sizeof(f->path) + 8];
+    frame_writer_idx_header_t hdr;
+
+    writer_close_file(w);
+    w->fd = open(f->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        printf("frame writer: open %s failed, %s\n", f->path, strerror(errno));
+        return -1;
+    }
+    w->offset = 0;
+    w->flushed = 0;
+    w->cur_mode = f->mode;
+    snprintf(w->cur_path, sizeof(w->cur_path), "%s", f->path);
+    if (f->mode != FRAME_WRITER_MODE_CONTAINER)
+        return 0;
+
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", f->path);
+    w->idx_fd = open(idx_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->idx_fd < 0) {
+        printf("frame writer: open %s failed, %s\n", idx_path, strerror(errno));
+        writer_close_file(w);
+        return -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = FRAME_WRITER_IDX_MAGIC;
+    hdr.version = 1;
+    hdr.width = w->cfg.width;
+    hdr.height = w->cfg.height;
+    hdr.fourcc = w->cfg.fourcc;
+    hdr.align = FRAME_WRITER_ALIGN;
+
+    return writer_write_all(w->idx_fd, &hdr, sizeof(hdr));
+}
+
+static int writer_write_frame(frame_writer_t *w, const frame_writer_frame_t *f)
+{
+    static const char zero[FRAME_WRITER_ALIGN] = {0};
+    frame_writer_idx_entry_t entry;
+    int fd;
+
+    if (f->mode == FRAME_WRITER_MODE_FILES) {
+        fd = open(f->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return -1;
+        if (writer_write_all(fd, f->data, f->size)) {
+            close(fd);
+            return -1;
+        }
+        return close(fd);
+    }
+
+    if ((w->fd < 0 || w->cur_mode != f->mode || strcmp(w->cur_path, f->path)) &&
+            writer_open_file(w, f))
+        return -1;
+
+    if (writer_write_all(w->fd, f->data, f->size))
+        return -1;
+    entry.sequence = f->sequence;
+    entry.size = f->size;
+    entry.offset = w->offset;
+    entry.timestamp_us = f->timestamp_us;
+    w->offset += f->size;
+
+    if (f->mode == FRAME_WRITER_MODE_CONTAINER) {
+        size_t pad = (FRAME_WRITER_ALIGN - w->offset % FRAME_WRITER_ALIGN) % FRAME_WRITER_ALIGN;
+        if (pad && writer_write_all(w->fd, zero, pad))
+            return -1;
+        w->offset += pad;
+        if (writer_write_all(w->idx_fd, &entry, sizeof(entry)))
+            return -1;
+    }
+    writer_flush_window(w, 0);
+
+    return 0;
+}
+
+static void writer_report(frame_writer_t *w)
+{
+    frame_writer_stats_t *s = &w->stats;
+
+    printf("frame writer: queued %llu written %llu dropped %llu late %llu errors %llu, "
+           "%llu MB, max latency %llu ms\n",
+           (unsigned long long)s->queued, (unsigned long long)s->written,
+           (unsigned long long)s->dropped, (unsigned long long)s->late,
+           (unsigned long long)s->errors, (unsigned long long)(s->bytes >> 20),
+           (unsigned long long)(s->max_latency_us / 1000));
+}
+
+static void *writer_thread(void *arg)
+{
+    frame_writer_t *w = (frame_writer_t *)arg;
+    frame_writer_frame_t frame;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->count && !w->stop)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (!w->count)
+            break;
+        frame = w->queue[w->head];
+        pthread_mutex_unlock(&w->lock);
+
+        int ret = writer_write_frame(w, &frame);
+        int err = ret ? errno : 0;
+        uint64_t latency = writer_now_us() - frame.timestamp_us;
+        if (w->cfg.release)
+            w->cfg.release(w->cfg.opaque, frame.index);
+
+        pthread_mutex_lock(&w->lock);
+        w->head = (w->head + 1) % w->cfg.depth;
+        w->count--;
+        if (ret) {
+            w->stats.errors++;
+            printf("frame writer: write frame %u to %s failed, %s\n",
+                   frame.sequence, frame.path, strerror(err));
+        } else {
+            w->stats.written++;
+            w->stats.bytes += frame.size;
+        }
+        if (latency > FRAME_WRITER_LATE_MS * 1000)
+            w->stats.late++;
+        if (latency > w->stats.max_latency_us)
+            w->stats.max_latency_us = latency;
+        if ((w->stats.written + w->stats.errors) % WRITER_REPORT_FRAMES == 0)
+            writer_report(w);
+    }
+    pthread_mutex_unlock(&w->lock);
+    writer_close_file(w);
+
+    return NULL;
+}
+
+frame_writer_t *frame_writer_create(const frame_writer_cfg_t *cfg)
+{
+    frame_writer_t *w;
+
+    if (!cfg || cfg->depth <= 0)
+        return NULL;
+    w = (frame_writer_t *)calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+    w->cfg = *cfg;
+    w->fd = -1;
+    w->idx_fd = -1;
+    w->queue = (frame_writer_frame_t *)calloc(cfg->depth, sizeof(frame_writer_frame_t));
+    if (!w->queue) {
+        free(w);
+        return NULL;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->tid, NULL, writer_thread, w)) {
+        free(w->queue);
+        free(w);
+        return NULL;
+    }
+
+    return w;
+}
+
+void frame_writer_destroy(frame_writer_t *w)
+{
+    if (!w)
+        return;
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->tid, NULL);
+    writer_report(w);
+
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->queue);
+    free(w);
+}
+
+int frame_writer_submit(frame_writer_t *w, const frame_writer_frame_t *frame)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&w->lock);
+    if (!w->stop && w->count < w->cfg.depth) {
+        frame_writer_frame_t *slot = &w->queue[(w->head + w->count) % w->cfg.depth];
+        *slot = *frame;
+        if (!slot->timestamp_us)
+            slot->timestamp_us = writer_now_us();
+        w->count++;
+        w->stats.queued++;
+        pthread_cond_signal(&w->cond);
+        ret = 0;
+    } else {
+        w->stats.dropped++;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return ret;
+}
+
+void frame_writer_get_stats(frame_writer_t *w, frame_writer_stats_t *stats)
+{
+    pthread_mutex_lock(&w->lock);
+    *stats = w->stats;
+    pthread_mutex_unlock(&w->lock);
+}
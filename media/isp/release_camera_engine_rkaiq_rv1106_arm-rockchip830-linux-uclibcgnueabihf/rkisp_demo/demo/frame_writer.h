@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2019 Rockchip Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef _FRAME_WRITER_H_
+#define _FRAME_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Asynchronous frame dump writer.
+ *
+ * The capture thread hands over dequeued V4L2 buffers, a writer thread
+ * stores them and gives each buffer back through the release callback, so
+ * the buffer is only re-queued to V4L2 once its data is on the way to disk.
+ * When the queue is full the frame is dropped and the caller re-queues it
+ * at once.
+ *
+ * Container files: frames are stored at FRAME_WRITER_ALIGN aligned offsets
+ * in <path>, <path>.idx holds a frame_writer_idx_header_t followed by one
+ * frame_writer_idx_entry_t per frame.
+ */
+
+#define FRAME_WRITER_ALIGN      4096
+#define FRAME_WRITER_IDX_MAGIC  0x57464b52 /* "RKFW" */
+#define FRAME_WRITER_LATE_MS    100
+
+enum frame_writer_mode {
+    FRAME_WRITER_MODE_RAW,       /* frames appended back to back to path */
+    FRAME_WRITER_MODE_CONTAINER, /* aligned frames in path plus path.idx */
+    FRAME_WRITER_MODE_FILES,     /* one file per frame, path is the file */
+};
+
+typedef struct frame_writer_idx_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t fourcc;
+    uint32_t align;
+} frame_writer_idx_header_t;
+
+typedef struct frame_writer_idx_entry {
+    uint32_t sequence;
+    uint32_t size;
+    uint64_t offset;
+    uint64_t timestamp_us;
+} frame_writer_idx_entry_t;
+
+typedef struct frame_writer_frame {
+    int index;          /* V4L2 buffer index, passed back to release */
+    const void *data;
+    size_t size;
+    uint32_t sequence;
+    uint64_t timestamp_us;
+    int mode;           /* enum frame_writer_mode */
+    char path[256];
+} frame_writer_frame_t;
+
+typedef void (*frame_writer_release_cb)(void *opaque, int index);
+
+typedef struct frame_writer_cfg {
+    int depth;          /* frames the writer may hold */
+    uint32_t width;
+    uint32_t height;
+    uint32_t fourcc;
+    frame_writer_release_cb release;
+    void *opaque;
+} frame_writer_cfg_t;
+
+typedef struct frame_writer_stats {
+    uint64_t queued;
+    uint64_t written;
+    uint64_t dropped;   /* queue full, never written */
+    uint64_t late;      /* written more than FRAME_WRITER_LATE_MS after dequeue */
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t max_latency_us;
+} frame_writer_stats_t;
+
+typedef struct frame_writer frame_writer_t;
+
+frame_writer_t *frame_writer_create(const frame_writer_cfg_t *cfg);
+/* waits for the queued frames, releases them and prints the statistics */
+void frame_writer_destroy(frame_writer_t *writer);
+/* returns 0 when the writer owns the buffer, -1 when the frame was dropped */
+int frame_writer_submit(frame_writer_t *writer, const frame_writer_frame_t *frame);
+void frame_writer_get_stats(frame_writer_t *writer, frame_writer_stats_t *stats);
+
+#endif
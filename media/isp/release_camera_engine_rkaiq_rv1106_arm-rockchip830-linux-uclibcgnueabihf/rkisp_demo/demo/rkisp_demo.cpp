@@ -16,6 +16,7 @@
 #include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <dlfcn.h>
 #include <signal.h>
 #include <dirent.h>
@@ -26,6 +27,7 @@
 #include "rk_aiq_user_api2_debug.h"
 #include "sample_image_process.h"
 #include "rkisp_demo.h"
+#include "dma_alloc.h"
 #include <termios.h>
 
 
@@ -96,6 +98,8 @@ struct buffer {
     size_t length;
     int export_fd;
     int sequence;
+    int refs;       // users of a dequeued buffer, queued back to v4l2 at zero
+    bool cpu_sync;  // dmabuf mode, cpu access opened with DMA_BUF_IOCTL_SYNC
 };
 
 enum TEST_CTL_TYPE {
@@ -1131,9 +1135,128 @@ static int creat_yuv_dir(const char* path, demo_context_t *ctx)
     return 0;
 }
 
-static void process_image(const void *p, int sequence, int size, demo_context_t *ctx)
+static int queue_buffer(demo_context_t *ctx, int index)
 {
-    if (ctx->fp && sequence >= ctx->skipCnt && ctx->outputCnt-- > 0) {
+    struct buffer *b = &ctx->buffers[index];
+    struct v4l2_buffer buf;
+    struct v4l2_plane planes[FMT_NUM_PLANES];
+
+    if (b->cpu_sync) {
+        dma_sync_cpu_to_device(b->export_fd);
+        b->cpu_sync = false;
+    }
+
+    CLEAR(buf);
+    CLEAR(planes);
+    buf.type = ctx->buf_type;
+    buf.memory = ctx->memType;
+    buf.index = index;
+    if (V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == ctx->buf_type) {
+        buf.m.planes = planes;
+        buf.length = FMT_NUM_PLANES;
+        if (ctx->memType == V4L2_MEMORY_DMABUF) {
+            planes[0].m.fd = b->export_fd;
+            planes[0].length = b->length;
+        }
+    } else if (ctx->memType == V4L2_MEMORY_DMABUF) {
+        buf.m.fd = b->export_fd;
+        buf.length = b->length;
+    }
+
+    return xioctl(ctx->fd, VIDIOC_QBUF, &buf);
+}
+
+static void get_buffer(demo_context_t *ctx, int index)
+{
+    __atomic_add_fetch(&ctx->buffers[index].refs, 1, __ATOMIC_ACQ_REL);
+}
+
+// -1 with errno set when the last reference is gone and VIDIOC_QBUF failed
+static int put_buffer(demo_context_t *ctx, int index)
+{
+    if (!__atomic_sub_fetch(&ctx->buffers[index].refs, 1, __ATOMIC_ACQ_REL))
+        return queue_buffer(ctx, index);
+
+    return 0;
+}
+
+// runs on the writer thread, a failed QBUF is reported by the next read_frame
+static void writer_release_buffer(void *opaque, int index)
+{
+    demo_context_t *ctx = (demo_context_t *)opaque;
+
+    if (put_buffer(ctx, index))
+        __atomic_store_n(&ctx->writerQbufErrno, errno, __ATOMIC_RELEASE);
+}
+
+static void init_writer(demo_context_t *ctx)
+{
+    frame_writer_cfg_t cfg;
+
+#ifdef ISPFEC_API
+    // frames come from the single fec output buffer, not from v4l2 buffers
+    ctx->writerDepth = 0;
+#endif
+    ctx->writer = NULL;
+    if (ctx->writerDepth <= 0 || (!ctx->writeFile && !ctx->writeFileSync))
+        return;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.depth = ctx->writerDepth;
+    cfg.width = ctx->width;
+    cfg.height = ctx->height;
+    cfg.fourcc = ctx->format;
+    cfg.release = writer_release_buffer;
+    cfg.opaque = ctx;
+    ctx->writer = frame_writer_create(&cfg);
+    if (!ctx->writer)
+        ERR("%s: create frame writer failed, write frames inline\n", get_sensor_name(ctx));
+}
+
+static void deinit_writer(demo_context_t *ctx)
+{
+    if (!ctx->writer)
+        return;
+
+    frame_writer_destroy(ctx->writer);
+    ctx->writer = NULL;
+}
+
+// the writer holds a reference on the buffer until the frame is written
+static void writer_queue_frame(const void *p, int index, int sequence, int size,
+                               uint64_t timestamp_us, const char *path, int mode,
+                               demo_context_t *ctx)
+{
+    frame_writer_frame_t frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.index = index;
+    frame.data = p;
+    frame.size = size;
+    frame.sequence = sequence;
+    frame.timestamp_us = timestamp_us;
+    frame.mode = mode;
+    snprintf(frame.path, sizeof(frame.path), "%s", path);
+    get_buffer(ctx, index);
+    if (frame_writer_submit(ctx->writer, &frame)) {
+        ERR("%s: writer queue full, frame %d dropped\n", get_sensor_name(ctx), sequence);
+        if (put_buffer(ctx, index))
+            errno_exit(ctx, "VIDIOC_QBUF");
+    }
+}
+
+static void process_image(const void *p, int index, int sequence, int size,
+                          uint64_t timestamp_us, demo_context_t *ctx)
+{
+    if (ctx->writer && ctx->writeFile && ctx->outputCnt > 0) {
+        if (sequence < ctx->skipCnt)
+            return;
+        ctx->outputCnt--;
+        printf(">\n");
+        writer_queue_frame(p, index, sequence, size, timestamp_us, ctx->out_file,
+                           ctx->writerContainer ? FRAME_WRITER_MODE_CONTAINER :
+                           FRAME_WRITER_MODE_RAW, ctx);
+    } else if (ctx->fp && sequence >= ctx->skipCnt && ctx->outputCnt-- > 0) {
         printf(">\n");
         fwrite(p, size, 1, ctx->fp);
         fflush(ctx->fp);
@@ -1166,7 +1289,21 @@ static void process_image(const void *p, int sequence, int size, demo_context_t
                 creat_yuv_dir(DEFAULT_CAPTURE_RAW_PATH, ctx);
             }
 
-            if (ctx->_is_yuv_dir_exist) {
+            if (ctx->_is_yuv_dir_exist && ctx->writer) {
+                char path[128];
+
+                if (ctx->writerContainer)
+                    snprintf(path, sizeof(path), "%s/frames.yuv", ctx->yuv_dir_path);
+                else
+                    snprintf(path, sizeof(path), "%s/frame%d.yuv", ctx->yuv_dir_path, sequence);
+                writer_queue_frame(p, index, sequence, size, timestamp_us, path,
+                                   ctx->writerContainer ? FRAME_WRITER_MODE_CONTAINER :
+                                   FRAME_WRITER_MODE_FILES, ctx);
+                for (int i = 0; i < ctx->capture_yuv_num; i++)
+                    printf("<");
+                printf("\n");
+                rk_aiq_uapi2_debug_captureRawNotify(ctx->aiq_ctx);
+            } else if (ctx->_is_yuv_dir_exist) {
                 write_yuv_to_file(p, size, sequence, ctx);
                 rk_aiq_uapi2_debug_captureRawNotify(ctx->aiq_ctx);
             }
@@ -1179,15 +1316,65 @@ static void process_image(const void *p, int sequence, int size, demo_context_t
     }
 }
 
+static uint64_t cpu_time_us(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+           ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// fps and process cpu load, to compare --dmabuf against the default mmap mode
+static void report_capture_stats(demo_context_t *ctx, bool final)
+{
+    struct timespec ts;
+    uint64_t now, cpu;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    cpu = cpu_time_us();
+    if (!ctx->statTimeUs) {
+        ctx->statTimeUs = now;
+        ctx->statCpuUs = cpu;
+        ctx->statFrames = 0;
+        return;
+    }
+    if (!final && now - ctx->statTimeUs < 5000000)
+        return;
+
+    if (now > ctx->statTimeUs)
+        printf("%s: %s capture, %.2f fps, cpu %.1f%%\n", get_sensor_name(ctx),
+               ctx->memType == V4L2_MEMORY_DMABUF ? "dmabuf" : "mmap",
+               ctx->statFrames * 1000000.0 / (now - ctx->statTimeUs),
+               (cpu - ctx->statCpuUs) * 100.0 / (now - ctx->statTimeUs));
+    ctx->statTimeUs = now;
+    ctx->statCpuUs = cpu;
+    ctx->statFrames = 0;
+}
+
+static bool need_cpu_access(demo_context_t *ctx)
+{
+    if (ctx->writeFile || ctx->writeFileSync)
+        return true;
+#if ISPDEMO_ENABLE_DRM && !ISPDEMO_ENABLE_RGA
+    // drmDspFrame copies and scales with the cpu when the frame can't be scanned out as is
+    if (ctx->vop)
+        return true;
+#endif
+    return false;
+}
+
 static int read_frame(demo_context_t *ctx)
 {
     struct v4l2_buffer buf;
     int i, bytesused;
+    uint64_t timestamp_us;
 
     CLEAR(buf);
 
     buf.type = ctx->buf_type;
-    buf.memory = V4L2_MEMORY_MMAP;
+    buf.memory = ctx->memType;
 
     struct v4l2_plane planes[FMT_NUM_PLANES];
     memset(planes, 0, sizeof(struct v4l2_plane)*FMT_NUM_PLANES);
@@ -1196,10 +1383,25 @@ static int read_frame(demo_context_t *ctx)
         buf.length = FMT_NUM_PLANES;
     }
 
+    // a buffer the writer could not give back is lost to the capture queue
+    errno = __atomic_exchange_n(&ctx->writerQbufErrno, 0, __ATOMIC_ACQUIRE);
+    if (errno) {
+        errno_exit(ctx, "writer VIDIOC_QBUF");
+        return -1;
+    }
+
     if (-1 == xioctl(ctx->fd, VIDIOC_DQBUF, &buf))
         errno_exit(ctx, "VIDIOC_DQBUF");
 
     i = buf.index;
+    timestamp_us = (uint64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+    ctx->buffers[i].refs = 1;
+    if (ctx->memType == V4L2_MEMORY_DMABUF && need_cpu_access(ctx)) {
+        dma_sync_device_to_cpu(ctx->buffers[i].export_fd);
+        ctx->buffers[i].cpu_sync = true;
+    }
+    ctx->statFrames++;
+    report_capture_stats(ctx, false);
 
     if (V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == ctx->buf_type)
         bytesused = buf.m.planes[0].bytesused;
@@ -1251,6 +1453,19 @@ static int read_frame(demo_context_t *ctx)
         } else {
 #else
         {
+#endif
+#ifndef ISPFEC_API
+            // dmabuf frames that fit the screen are scanned out in place, the buffer stays
+            // off the capture queue until the next one replaces it on the plane
+            if (ctx->memType == V4L2_MEMORY_DMABUF && dispWidth == ctx->width &&
+                    dispHeight == ctx->height &&
+                    !drmDspFrameFd(ctx->width, ctx->height, ctx->bytesperline,
+                                   ctx->buffers[i].export_fd, DRM_FORMAT_NV12)) {
+                get_buffer(ctx, i);
+                if (ctx->dispIndex >= 0 && put_buffer(ctx, ctx->dispIndex))
+                    errno_exit(ctx, "VIDIOC_QBUF");
+                ctx->dispIndex = i;
+            } else
 #endif
             drmDspFrame(ctx->width, ctx->height, dispWidth, dispHeight, ctx->buffers[i].export_fd,
                        ctx->buffers[i].start, DRM_FORMAT_NV12);
@@ -1259,9 +1474,9 @@ static int read_frame(demo_context_t *ctx)
 #endif
 
 #ifdef ISPFEC_API
-    process_image(buf_addr,  buf.sequence, bytesused, ctx);
+    process_image(buf_addr, -1, buf.sequence, bytesused, timestamp_us, ctx);
 #else
-    process_image(ctx->buffers[i].start,  buf.sequence, bytesused, ctx);
+    process_image(ctx->buffers[i].start, i, buf.sequence, bytesused, timestamp_us, ctx);
 #endif
 
 #ifdef COLOR_CONSISTENCY_TEST
@@ -1282,7 +1497,7 @@ static int read_frame(demo_context_t *ctx)
     rk_aiq_uapi2_setAcolorSwInfo(ctx->aiq_ctx,aColor_sw_info);//ctx->aiq_ctx is slave camera
 #endif
 
-    if (-1 == xioctl(ctx->fd, VIDIOC_QBUF, &buf))
+    if (put_buffer(ctx, i))
         errno_exit(ctx, "VIDIOC_QBUF");
 
     return 1;
@@ -1370,8 +1585,8 @@ static void mainloop(demo_context_t *ctx)
     while ((ctx->frame_count == -1) || (ctx->frame_count-- > 0)) {
         if (ctx->pponeframe)
             read_frame_pp_oneframe(ctx);
-        else
-            read_frame(ctx);
+        else if (read_frame(ctx) < 0)
+            break;
     }
 }
 
@@ -1401,21 +1616,10 @@ static void start_capturing(demo_context_t *ctx)
     unsigned int i;
     enum v4l2_buf_type type;
 
+    ctx->dispIndex = -1;
     for (i = 0; i < ctx->n_buffers; ++i) {
-        struct v4l2_buffer buf;
-
-        CLEAR(buf);
-        buf.type = ctx->buf_type;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.index = i;
-
-        if (V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == ctx->buf_type) {
-            struct v4l2_plane planes[FMT_NUM_PLANES];
-
-            buf.m.planes = planes;
-            buf.length = FMT_NUM_PLANES;
-        }
-        if (-1 == xioctl(ctx->fd, VIDIOC_QBUF, &buf))
+        ctx->buffers[i].refs = 0;
+        if (queue_buffer(ctx, i))
             errno_exit(ctx, "VIDIOC_QBUF");
     }
     type = ctx->buf_type;
@@ -1466,6 +1670,14 @@ static void uninit_device(demo_context_t *ctx)
         return;
 
     for (i = 0; i < ctx->n_buffers; ++i) {
+        if (ctx->memType == V4L2_MEMORY_DMABUF) {
+#if ISPDEMO_ENABLE_DRM
+            drmDspReleaseFd(ctx->buffers[i].export_fd);
+#endif
+            dma_buf_free(ctx->buffers[i].length, &ctx->buffers[i].export_fd,
+                         ctx->buffers[i].start);
+            continue;
+        }
         if (-1 == munmap(ctx->buffers[i].start, ctx->buffers[i].length))
             errno_exit(ctx, "munmap");
 
@@ -1503,6 +1715,9 @@ static void init_mmap(int pp_onframe, demo_context_t *ctx)
         fd_tmp = ctx->fd;
 
     req.count = BUFFER_COUNT;
+    // the writer keeps up to writerDepth buffers away from the driver
+    if (!pp_onframe && ctx->writer)
+        req.count += ctx->writerDepth;
     req.type = ctx->buf_type;
     req.memory = V4L2_MEMORY_MMAP;
 
@@ -1590,6 +1805,53 @@ static void init_mmap(int pp_onframe, demo_context_t *ctx)
     }
 }
 
+static void init_dmabuf(demo_context_t *ctx)
+{
+    struct v4l2_requestbuffers req;
+
+    CLEAR(req);
+    req.count = BUFFER_COUNT;
+    if (ctx->writer)
+        req.count += ctx->writerDepth;
+    // one more for the frame on screen
+    if (ctx->vop)
+        req.count++;
+    req.type = ctx->buf_type;
+    req.memory = V4L2_MEMORY_DMABUF;
+
+    if (-1 == xioctl(ctx->fd, VIDIOC_REQBUFS, &req)) {
+        if (EINVAL == errno) {
+            ERR("%s: %s does not support dmabuf import\n", get_sensor_name(ctx),
+                get_dev_name(ctx));
+            exit(EXIT_FAILURE);
+        } else {
+            errno_exit(ctx, "VIDIOC_REQBUFS");
+        }
+    }
+
+    if (req.count < 2) {
+        ERR("%s: Insufficient buffer memory on %s\n", get_sensor_name(ctx),
+            get_dev_name(ctx));
+        exit(EXIT_FAILURE);
+    }
+
+    ctx->buffers = (struct buffer*)calloc(req.count, sizeof(struct buffer));
+    if (!ctx->buffers) {
+        ERR("%s: Out of memory\n", get_sensor_name(ctx));
+        exit(EXIT_FAILURE);
+    }
+
+    DBG("%s: alloc %u x %u bytes from %s\n", get_sensor_name(ctx), req.count,
+        ctx->sizeimage, ctx->dmaHeap);
+    for (ctx->n_buffers = 0; ctx->n_buffers < req.count; ++ctx->n_buffers) {
+        struct buffer *b = &ctx->buffers[ctx->n_buffers];
+
+        b->length = ctx->sizeimage;
+        if (dma_buf_alloc(ctx->dmaHeap, b->length, &b->export_fd, &b->start))
+            errno_exit(ctx, "dma_buf_alloc");
+    }
+}
+
 static void init_input_dmabuf_oneframe(demo_context_t *ctx) {
     struct v4l2_requestbuffers req;
 
@@ -1676,7 +1938,18 @@ static void init_device(demo_context_t *ctx)
     if (-1 == xioctl(ctx->fd, VIDIOC_S_FMT, &fmt))
         errno_exit(ctx, "VIDIOC_S_FMT");
 
-    init_mmap(false, ctx);
+    if (V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE == ctx->buf_type) {
+        ctx->bytesperline = fmt.fmt.pix_mp.plane_fmt[0].bytesperline;
+        ctx->sizeimage = fmt.fmt.pix_mp.plane_fmt[0].sizeimage;
+    } else {
+        ctx->bytesperline = fmt.fmt.pix.bytesperline;
+        ctx->sizeimage = fmt.fmt.pix.sizeimage;
+    }
+
+    if (ctx->memType == V4L2_MEMORY_DMABUF)
+        init_dmabuf(ctx);
+    else
+        init_mmap(false, ctx);
 }
 
 static void init_device_pp_oneframe(demo_context_t *ctx)
@@ -1785,11 +2058,15 @@ static void parse_args(int argc, char **argv, demo_context_t *ctx)
             {"orp", required_argument, 0, '2' },
             //{"sensor",   required_argument,       0, 'b' },
             {"camgroup",   no_argument,       0, '3' },
+            {"writer-depth",   required_argument, 0, '4' },
+            {"container",   no_argument,       0, '5' },
+            {"dmabuf",   no_argument,       0, '6' },
+            {"dma-heap",   required_argument, 0, '7' },
             {0,          0,                 0,  0  }
         };
 
         //c = getopt_long(argc, argv, "w:h:f:i:d:o:c:ps",
-        c = getopt_long(argc, argv, "w:h:f:i:g:j:d:o:c:n:k:a:t:1:2:3mpsevrl",
+        c = getopt_long(argc, argv, "w:h:f:i:g:j:d:o:c:n:k:a:t:1:2:34:567:mpsevrl",
                         long_options, &option_index);
         if (c == -1)
             break;
@@ -1893,6 +2170,19 @@ static void parse_args(int argc, char **argv, demo_context_t *ctx)
         case '3':
             ctx->camGroup = true;
             break;
+        case '4':
+            ctx->writerDepth = atoi(optarg);
+            break;
+        case '5':
+            ctx->writerContainer = true;
+            break;
+        case '6':
+            ctx->memType = V4L2_MEMORY_DMABUF;
+            break;
+        case '7':
+            ctx->memType = V4L2_MEMORY_DMABUF;
+            snprintf(ctx->dmaHeap, sizeof(ctx->dmaHeap), "%s", optarg);
+            break;
         case '?':
         case 'p':
             ERR("Usage: %s to capture rkisp1 frames\n"
@@ -1913,6 +2203,10 @@ static void parse_args(int argc, char **argv, demo_context_t *ctx)
                 "         --pponeframe,                      optional, pp oneframe readback mode\n"
                 "         --hdr <val>,                       optional, hdr mode, val 2 means hdrx2, 3 means hdrx3 \n"
                 "         --sync-to-raw,                     optional, write yuv files in sync with raw\n"
+                "         --writer-depth <val>, default 3    optional, frames queued to the writer thread, 0 writes inline\n"
+                "         --container,                       optional, write frames and a .idx index instead of one file per frame\n"
+                "         --dmabuf,                          optional, capture into dma-heap buffers shared with display and rga\n"
+                "         --dma-heap <path>,                 optional, dma heap for --dmabuf, default the first one found\n"
                 "         --limit,                           optional, yuv limit range\n"
                 "         --ctl <val>,                       optional, sysctl procedure test \n"
                 "         --iqpath <val>,                    optional, absolute path of iq file dir \n"
@@ -1937,6 +2231,9 @@ static void parse_args(int argc, char **argv, demo_context_t *ctx)
 
 static void deinit(demo_context_t *ctx)
 {
+    // drain the writer while the held buffers can still be queued back
+    deinit_writer(ctx);
+    report_capture_stats(ctx, true);
     //if (!ctx->camgroup_ctx)
      stop_capturing(ctx);
 
@@ -2347,7 +2644,25 @@ static void rkisp_routine(demo_context_t *ctx)
     if (ctx->pponeframe)
         open_device_pp_oneframe(ctx);
 
-    if (ctx->writeFile) {
+    if (ctx->memType == V4L2_MEMORY_DMABUF) {
+        if (ctx->pponeframe) {
+            ERR("%s: --dmabuf is not supported with --pponeframe, use mmap\n",
+                get_sensor_name(ctx));
+            ctx->memType = V4L2_MEMORY_MMAP;
+        } else if (!strlen(ctx->dmaHeap)) {
+            const char *heap = dma_heap_probe();
+
+            if (!heap) {
+                ERR("%s: no dma heap found, use mmap\n", get_sensor_name(ctx));
+                ctx->memType = V4L2_MEMORY_MMAP;
+            } else {
+                snprintf(ctx->dmaHeap, sizeof(ctx->dmaHeap), "%s", heap);
+            }
+        }
+    }
+
+    init_writer(ctx);
+    if (ctx->writeFile && !ctx->writer) {
         ctx->fp = fopen(ctx->out_file, "w+");
         if (ctx->fp == NULL) {
             ERR("%s: fopen output file %s failed!\n", get_sensor_name(ctx), ctx->out_file);
@@ -2588,7 +2903,8 @@ restart:
                     ctx->frame_count = 60;
                     start_capturing(ctx);
                     while ((ctx->frame_count-- > 0))
-                        read_frame(ctx);
+                        if (read_frame(ctx) < 0)
+                            break;
                     stop_capturing(ctx);
                     printf("+++++++ TEST SYSCTL COUNTS %d ++++++++++++ \n", test_ctl_cnts++);
                     printf("aiq stop .....\n");
@@ -2776,6 +3092,17 @@ int main(int argc, char **argv)
         .orpStop = false,
         .orpStopped = false,
         .camGroup = false,
+        .writerDepth = 3,
+        .writerContainer = false,
+        .writer = NULL,
+        .memType = V4L2_MEMORY_MMAP,
+        .dmaHeap = {'\0'},
+        .bytesperline = 0,
+        .sizeimage = 0,
+        .dispIndex = -1,
+        .statTimeUs = 0,
+        .statCpuUs = 0,
+        .statFrames = 0,
     };
     demo_context_t second_ctx;
     demo_context_t third_ctx;
@@ -22,6 +22,7 @@
 #include <linux/videodev2.h>
 #include "uAPI2/rk_aiq_user_api2_imgproc.h"
 #include "uAPI2/rk_aiq_user_api2_camgroup.h"
+#include "frame_writer.h"
 
 #define DBG(...) do { if(!silent) printf(__VA_ARGS__); } while(0)
 #define ERR(...) do { printf(__VA_ARGS__); } while (0)
@@ -72,6 +73,18 @@ typedef struct _demo_context {
     bool                    orpStop;
     bool                    orpStopped;
     bool                    camGroup;
+    int                     writerDepth;
+    bool                    writerContainer;
+    frame_writer_t          *writer;
+    int                     writerQbufErrno; // set by the writer thread, read by read_frame
+    enum v4l2_memory        memType;
+    char                    dmaHeap[64];
+    unsigned int            bytesperline;
+    unsigned int            sizeimage;
+    int                     dispIndex;
+    uint64_t                statTimeUs;
+    uint64_t                statCpuUs;
+    int                     statFrames;
 } demo_context_t;
 
 #endif
@@ -178,4 +178,42 @@ void rkipc_version_dump() {
 	LOG_INFO("rkipc version: %s\n", RKIPC_VERSION_INFO);
 	LOG_INFO("rkipc info: %s\n", RKIPC_BUILD_INFO);
 	LOG_INFO("rkipc type: %s\n", RKIPC_TYPE);
-}
\ No newline at end of file
+}
+
+// log:async = 0 keeps the synchronous LOG_* output, e.g. to see the last lines before a crash
+int rkipc_log_init_from_ini() {
+	rkipc_log_config_t config;
+	const char *sink = rk_param_get_string("log:sink", "console");
+
+	if (!rk_param_get_int("log:async", 1))
+		return 0;
+	memset(&config, 0, sizeof(config));
+	if (!strcmp(sink, "syslog"))
+		config.sink = RKIPC_LOG_SINK_SYSLOG;
+	else if (!strcmp(sink, "file"))
+		config.sink = RKIPC_LOG_SINK_FILE;
+	else
+		config.sink = RKIPC_LOG_SINK_CONSOLE;
+	config.file = rk_param_get_string("log:file", "/tmp/rkipc.log");
+	config.file_size_kb = rk_param_get_int("log:file_size_kb", 1024);
+	config.ring_size = rk_param_get_int("log:ring_size", 16384);
+	config.flush_ms = rk_param_get_int("log:flush_ms", 20);
+	// off by default, a rate limited site hides the messages around a failure
+	config.rate_burst = rk_param_get_int("log:rate_burst", 0);
+	config.rate_interval_ms = rk_param_get_int("log:rate_interval_ms", 30000);
+
+	return rkipc_log_init(&config);
+}
+
+int rkipc_metrics_init_from_ini() {
+	rkipc_metrics_config_t config;
+
+	if (!rk_param_get_int("metrics:enable", 1))
+		return 0;
+	memset(&config, 0, sizeof(config));
+	config.unix_path = rk_param_get_string("metrics:unix_path", "/var/tmp/rkipc_metrics");
+	config.http_addr = rk_param_get_string("metrics:http_addr", "127.0.0.1");
+	config.http_port = rk_param_get_int("metrics:http_port", 0);
+
+	return rkipc_metrics_init(&config);
+}
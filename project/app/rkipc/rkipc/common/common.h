@@ -21,6 +21,7 @@
 
 #include "iniparser.h"
 #include "log.h"
+#include "metrics.h"
 #include "param.h"
 
 #ifdef __GNUC__
@@ -68,3 +69,5 @@ char *get_time_string();
 int read_cmdline_to_buf(void *buf, int len);
 long get_cmd_val(const char *string, int len);
 void rkipc_version_dump();
+int rkipc_log_init_from_ini();
+int rkipc_metrics_init_from_ini();
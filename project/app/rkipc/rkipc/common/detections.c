@@ -0,0 +1,359 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// The payload is a version byte and LEB128 varints: frame_id, delay_us, count, then per
+// object track_id, type, score, x0, y0, x1 and y1. A person box costs about 13 bytes.
+// In the video it is the user_data_unregistered SEI (payloadType 5) of
+// rkipc_detections_uuid, placed before the first slice of the frame.
+#include "common.h"
+#include "detections.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "detections.c"
+
+#define DETECTIONS_PTS_RING 16
+#define SEI_PAYLOAD_USER_DATA_UNREGISTERED 5
+
+const unsigned char rkipc_detections_uuid[16] = {0x72, 0x6b, 0x69, 0x70, 0x63, 0x2d, 0x64, 0x65,
+                                                 0x74, 0x9e, 0x4a, 0x1b, 0xb0, 0x5c, 0x3d, 0x01};
+
+typedef struct {
+	uint32_t frame_id;
+	int64_t pts_us;
+} detections_frame_s;
+
+// the NPU runs on a few frames a second, sixteen cover the results still in flight
+static detections_frame_s g_detections_frame[DETECTIONS_PTS_RING];
+static int g_detections_frame_pos;
+static rkipc_detections_s g_detections;
+static int64_t g_detections_pts = -1; // capture time of the analyzed frame, -1 unknown
+static unsigned int g_detections_seq;
+static unsigned int g_detections_taken[RKIPC_DETECTIONS_STREAMS];
+static int g_detections_last_count;
+static pthread_mutex_t g_detections_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int detections_put(unsigned char *buf, int size, int pos, uint32_t v) {
+	do {
+		if (pos >= size)
+			return -1;
+		buf[pos++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+		v >>= 7;
+	} while (v);
+
+	return pos;
+}
+
+static int detections_get(const unsigned char *buf, int size, int *pos, uint32_t *v) {
+	uint32_t c;
+
+	*v = 0;
+	for (int shift = 0; shift < 35; shift += 7) {
+		if (*pos >= size)
+			return -1;
+		c = buf[(*pos)++];
+		*v |= (c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return 0;
+	}
+
+	return -1;
+}
+
+int rkipc_detections_pack(const rkipc_detections_s *d, unsigned char *buf, int size) {
+	const rkipc_detection_s *o;
+	int pos = 1;
+
+	if (size < 1 || d->count < 0 || d->count > RKIPC_DETECTIONS_MAX)
+		return -1;
+	buf[0] = RKIPC_DETECTIONS_VERSION;
+	pos = detections_put(buf, size, pos, d->frame_id);
+	pos = pos < 0 ? pos : detections_put(buf, size, pos, d->delay_us);
+	pos = pos < 0 ? pos : detections_put(buf, size, pos, d->count);
+	for (int i = 0; i < d->count && pos >= 0; i++) {
+		o = &d->object[i];
+		pos = detections_put(buf, size, pos, o->track_id);
+		pos = pos < 0 ? pos : detections_put(buf, size, pos, o->type);
+		pos = pos < 0 ? pos : detections_put(buf, size, pos, o->score);
+		pos = pos < 0 ? pos : detections_put(buf, size, pos, o->x0);
+		pos = pos < 0 ? pos : detections_put(buf, size, pos, o->y0);
+		pos = pos < 0 ? pos : detections_put(buf, size, pos, o->x1);
+		pos = pos < 0 ? pos : detections_put(buf, size, pos, o->y1);
+	}
+
+	return pos;
+}
+
+int rkipc_detections_unpack(const unsigned char *buf, int size, rkipc_detections_s *d) {
+	rkipc_detection_s *o;
+	uint32_t count;
+	int pos = 1;
+
+	if (size < 1 || buf[0] != RKIPC_DETECTIONS_VERSION)
+		return -1;
+	if (detections_get(buf, size, &pos, &d->frame_id) ||
+	    detections_get(buf, size, &pos, &d->delay_us) || detections_get(buf, size, &pos, &count) ||
+	    count > RKIPC_DETECTIONS_MAX)
+		return -1;
+	d->count = count;
+	for (int i = 0; i < d->count; i++) {
+		o = &d->object[i];
+		if (detections_get(buf, size, &pos, &o->track_id) ||
+		    detections_get(buf, size, &pos, &o->type) ||
+		    detections_get(buf, size, &pos, &o->score) ||
+		    detections_get(buf, size, &pos, &o->x0) || detections_get(buf, size, &pos, &o->y0) ||
+		    detections_get(buf, size, &pos, &o->x1) || detections_get(buf, size, &pos, &o->y1))
+			return -1;
+	}
+
+	return pos == size ? 0 : -1;
+}
+
+static int detections_nal_vcl(int h265, unsigned char header) {
+	if (h265)
+		return ((header >> 1) & 0x3f) < 32;
+	return (header & 0x1f) >= 1 && (header & 0x1f) <= 5;
+}
+
+static int detections_nal_sei(int h265, unsigned char header) {
+	if (h265)
+		return ((header >> 1) & 0x3f) == 39 || ((header >> 1) & 0x3f) == 40;
+	return (header & 0x1f) == 6;
+}
+
+// RBSP bytes with emulation prevention, *zeros counts the zero bytes just written
+static unsigned char *detections_rbsp(unsigned char *p, const unsigned char *src, int size,
+                                      int *zeros) {
+	for (int i = 0; i < size; i++) {
+		if (*zeros >= 2 && src[i] <= 3) {
+			*p++ = 3;
+			*zeros = 0;
+		}
+		*p++ = src[i];
+		*zeros = src[i] ? 0 : *zeros + 1;
+	}
+
+	return p;
+}
+
+int rkipc_detections_sei_frame(int h265, const unsigned char *frame, int size,
+                               const unsigned char *payload, int payload_size,
+                               unsigned char **buf, int *cap) {
+	unsigned char head = SEI_PAYLOAD_USER_DATA_UNREGISTERED, *p;
+	int insert = -1, need, zeros = 0, left;
+
+	// the start code of the first slice, with its leading zero byte
+	for (int i = 0; i + 3 < size; i++) {
+		if (frame[i] || frame[i + 1] || frame[i + 2] != 1)
+			continue;
+		if (detections_nal_vcl(h265, frame[i + 3])) {
+			insert = i > 0 && !frame[i - 1] ? i - 1 : i;
+			break;
+		}
+		i += 2;
+	}
+	if (insert < 0)
+		return -1;
+	// start code, NAL header, payload type and size, UUID, payload, trailing bits and at
+	// most one emulation prevention byte per two
+	need = size + 4 + 2 + 1 + (payload_size + 16) / 255 + 1 + (16 + payload_size + 1) * 3 / 2;
+	if (need > *cap) {
+		p = realloc(*buf, need);
+		if (!p)
+			return -1;
+		*buf = p;
+		*cap = need;
+	}
+	p = *buf;
+	memcpy(p, frame, insert);
+	p += insert;
+	memcpy(p, "\0\0\0\1", 4);
+	p += 4;
+	if (h265) {
+		*p++ = 39 << 1; // PREFIX_SEI_NUT
+		*p++ = 1;
+	} else {
+		*p++ = 6;
+	}
+	p = detections_rbsp(p, &head, 1, &zeros);
+	for (left = 16 + payload_size; left >= 255; left -= 255) {
+		head = 0xff;
+		p = detections_rbsp(p, &head, 1, &zeros);
+	}
+	head = left;
+	p = detections_rbsp(p, &head, 1, &zeros);
+	p = detections_rbsp(p, rkipc_detections_uuid, 16, &zeros);
+	p = detections_rbsp(p, payload, payload_size, &zeros);
+	*p++ = 0x80; // rbsp_trailing_bits
+	memcpy(p, frame + insert, size - insert);
+	p += size - insert;
+
+	return p - *buf;
+}
+
+typedef struct {
+	const unsigned char *p, *end;
+	int zeros;
+} detections_reader_s;
+
+// next RBSP byte, -1 at the end of the NAL unit
+static int detections_byte(detections_reader_s *r) {
+	int c;
+
+	if (r->p < r->end && r->zeros >= 2 && *r->p == 3) {
+		r->p++;
+		r->zeros = 0;
+	}
+	if (r->p >= r->end)
+		return -1;
+	c = *r->p++;
+	r->zeros = c ? 0 : r->zeros + 1;
+
+	return c;
+}
+
+static int detections_sei_message(detections_reader_s *r, unsigned char *payload,
+                                  int payload_size) {
+	int type, size, c;
+	unsigned char uuid[16];
+
+	// more_rbsp_data: what is left is not just the trailing bits
+	while (r->p < r->end && !(r->end - r->p == 1 && *r->p == 0x80)) {
+		type = size = 0;
+		while ((c = detections_byte(r)) == 0xff)
+			type += 255;
+		if (c < 0)
+			return 0;
+		type += c;
+		while ((c = detections_byte(r)) == 0xff)
+			size += 255;
+		if (c < 0)
+			return 0;
+		size += c;
+		if (type != SEI_PAYLOAD_USER_DATA_UNREGISTERED || size < 16) {
+			for (int i = 0; i < size; i++) {
+				if (detections_byte(r) < 0)
+					return 0;
+			}
+			continue;
+		}
+		for (int i = 0; i < 16; i++) {
+			if ((c = detections_byte(r)) < 0)
+				return 0;
+			uuid[i] = c;
+		}
+		if (memcmp(uuid, rkipc_detections_uuid, 16)) {
+			for (int i = 16; i < size; i++) {
+				if (detections_byte(r) < 0)
+					return 0;
+			}
+			continue;
+		}
+		if (size - 16 > payload_size)
+			return -1;
+		for (int i = 0; i < size - 16; i++) {
+			if ((c = detections_byte(r)) < 0)
+				return 0;
+			payload[i] = c;
+		}
+		return size - 16;
+	}
+
+	return 0;
+}
+
+int rkipc_detections_sei_find(int h265, int nal_length_size, const unsigned char *frame,
+                              int size, unsigned char *payload, int payload_size) {
+	detections_reader_s r;
+	int pos = 0, start, end, len, ret;
+
+	while (pos < size) {
+		if (nal_length_size) {
+			if (pos + nal_length_size > size)
+				return 0;
+			len = 0;
+			for (int i = 0; i < nal_length_size; i++)
+				len = (len << 8) | frame[pos + i];
+			start = pos + nal_length_size;
+			if (len < 0 || len > size - start)
+				return 0;
+			end = start + len;
+			pos = end;
+		} else {
+			while (pos + 3 <= size &&
+			       (frame[pos] || frame[pos + 1] || frame[pos + 2] != 1))
+				pos++;
+			if (pos + 3 > size)
+				return 0;
+			start = pos + 3;
+			for (end = start; end + 3 <= size; end++) {
+				if (!frame[end] && !frame[end + 1] && frame[end + 2] <= 1)
+					break;
+			}
+			if (end + 3 > size)
+				end = size;
+			pos = end;
+		}
+		if (start + (h265 ? 2 : 1) > end || !detections_nal_sei(h265, frame[start]))
+			continue;
+		r.p = frame + start + (h265 ? 2 : 1);
+		r.end = frame + end;
+		r.zeros = 0;
+		ret = detections_sei_message(&r, payload, payload_size);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+void rkipc_detections_frame_pts(uint32_t frame_id, int64_t pts_us) {
+	pthread_mutex_lock(&g_detections_mutex);
+	g_detections_frame[g_detections_frame_pos].frame_id = frame_id;
+	g_detections_frame[g_detections_frame_pos].pts_us = pts_us;
+	g_detections_frame_pos = (g_detections_frame_pos + 1) % DETECTIONS_PTS_RING;
+	pthread_mutex_unlock(&g_detections_mutex);
+}
+
+void rkipc_detections_update(const rkipc_detections_s *d) {
+	pthread_mutex_lock(&g_detections_mutex);
+	// the boxes of a sample hold until the next one, an empty scene needs only the first
+	if (!d->count && !g_detections_last_count) {
+		pthread_mutex_unlock(&g_detections_mutex);
+		return;
+	}
+	g_detections_last_count = d->count;
+	g_detections = *d;
+	g_detections_pts = -1;
+	for (int i = 0; i < DETECTIONS_PTS_RING; i++) {
+		if (g_detections_frame[i].frame_id == d->frame_id && g_detections_frame[i].pts_us) {
+			g_detections_pts = g_detections_frame[i].pts_us;
+			break;
+		}
+	}
+	g_detections_seq++;
+	pthread_mutex_unlock(&g_detections_mutex);
+}
+
+int rkipc_detections_take(int stream, int64_t pts_us, unsigned char *payload, int size) {
+	static rkipc_detections_s d[RKIPC_DETECTIONS_STREAMS];
+	int64_t pts;
+
+	if (stream < 0 || stream >= RKIPC_DETECTIONS_STREAMS)
+		return 0;
+	pthread_mutex_lock(&g_detections_mutex);
+	if (g_detections_taken[stream] == g_detections_seq) {
+		pthread_mutex_unlock(&g_detections_mutex);
+		return 0;
+	}
+	g_detections_taken[stream] = g_detections_seq;
+	d[stream] = g_detections;
+	pts = g_detections_pts;
+	pthread_mutex_unlock(&g_detections_mutex);
+	// a frame the NPU saw after this one was encoded, or one that left the ring
+	d[stream].delay_us = pts >= 0 && pts_us > pts ? pts_us - pts : 0;
+
+	return rkipc_detections_pack(&d[stream], payload, size);
+}
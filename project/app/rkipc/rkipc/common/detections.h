@@ -0,0 +1,67 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RKIPC_DETECTIONS_H__
+#define __RKIPC_DETECTIONS_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Per frame NPU detections, carried as user data unregistered SEI in the video and as
+// samples of the timed metadata track of a recording. Both hold the same payload.
+#define RKIPC_DETECTIONS_MIME "application/x-rkipc-detections"
+#define RKIPC_DETECTIONS_VERSION 1
+#define RKIPC_DETECTIONS_MAX 64
+#define RKIPC_DETECTIONS_STREAMS 3
+// version, four varints of header and seven of up to five bytes per object
+#define RKIPC_DETECTIONS_PAYLOAD_MAX (1 + 4 * 5 + RKIPC_DETECTIONS_MAX * 7 * 5)
+
+extern const unsigned char rkipc_detections_uuid[16];
+
+typedef struct {
+	uint32_t track_id; // tracker id of the object
+	uint32_t type;     // ROCKIVA_OBJECT_TYPE_*
+	uint32_t score;
+	uint32_t x0, y0, x1, y1; // box normalized to 10000, like RockIVA
+} rkipc_detection_s;
+
+typedef struct {
+	uint32_t frame_id; // of the frame the NPU analyzed
+	// the carrier frame, the one with this SEI or at this sample time, was captured
+	// delay_us after the analyzed one
+	uint32_t delay_us;
+	int count;
+	rkipc_detection_s object[RKIPC_DETECTIONS_MAX];
+} rkipc_detections_s;
+
+// serialized form, -1 when size is too small
+int rkipc_detections_pack(const rkipc_detections_s *d, unsigned char *buf, int size);
+// 0 for a complete payload of a known version, -1 else
+int rkipc_detections_unpack(const unsigned char *buf, int size, rkipc_detections_s *d);
+
+// frame with an Annex B SEI NAL unit of payload in front of its first VCL NAL unit,
+// *buf grows as needed, returns the new size or -1
+int rkipc_detections_sei_frame(int h265, const unsigned char *frame, int size,
+                               const unsigned char *payload, int payload_size,
+                               unsigned char **buf, int *cap);
+// payload of the first detections SEI of a frame in Annex B (nal_length_size 0) or with
+// NAL unit lengths, returns its size, 0 without one, -1 when it does not fit
+int rkipc_detections_sei_find(int h265, int nal_length_size, const unsigned char *frame,
+                              int size, unsigned char *payload, int payload_size);
+
+// Hand-off from the NPU to the encoder threads. The capture time of every frame pushed to
+// the NPU is remembered, a result goes out with the next encoded frame of each stream.
+void rkipc_detections_frame_pts(uint32_t frame_id, int64_t pts_us);
+// from the result callback, a run of empty results goes out once
+void rkipc_detections_update(const rkipc_detections_s *d);
+// payload of a result not yet taken by stream, for a frame of pts_us; 0 for none
+int rkipc_detections_take(int stream, int64_t pts_us, unsigned char *payload, int size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -229,6 +229,13 @@ int rk_isp_set_scenario(int cam_id, const char *value) {
 	return 0;
 }
 
+int rk_isp_get_scene_stats(int cam_id, char *value, int size) {
+	if (value && size > 0)
+		value[0] = '\0';
+
+	return 0;
+}
+
 // image adjustment
 
 int rk_isp_get_contrast(int cam_id, int *value) {
@@ -1430,6 +1437,10 @@ int rk_isp_af_focus_once(int cam_id) {
 	return rk_aiq_uapi2_endOpZoomChange(rkipc_aiq_get_ctx(cam_id));
 }
 
+int rk_isp_batch_begin(int cam_id) { return 0; }
+
+int rk_isp_batch_commit(int cam_id) { return 0; }
+
 int rk_isp_set_from_ini(int cam_id) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret = 0;
@@ -4,9 +4,14 @@ int rk_isp_group_init(int cam_group_id, char *iqfile_path);
 int rk_isp_group_deinit(int cam_group_id);
 int rk_isp_get_frame_rate(int cam_id, int *value);
 int rk_isp_set_frame_rate(int cam_id, int value);
+// not batched on this platform, settings still apply one by one
+int rk_isp_batch_begin(int cam_id);
+int rk_isp_batch_commit(int cam_id);
 // isp scenario
 int rk_isp_get_scenario(int cam_id, const char **value);
 int rk_isp_set_scenario(int cam_id, const char *value);
+// scene switches are not measured on this platform, value is left empty
+int rk_isp_get_scene_stats(int cam_id, char *value, int size);
 // image adjustment
 int rk_isp_get_contrast(int cam_id, int *value);
 int rk_isp_set_contrast(int cam_id, int value);
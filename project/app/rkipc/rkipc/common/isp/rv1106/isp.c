@@ -1,5 +1,8 @@
 #include "isp.h"
 #include "common.h"
+#include "isp_daynight.h"
+#include "isp_scene.h"
+#include "isp_stats.h"
 #include "rk_gpio.h"
 #include "rk_pwm.h"
 #include "video.h"
@@ -34,6 +37,8 @@ static rk_aiq_sys_ctx_t *g_aiq_ctx[MAX_AIQ_CTX];
 static rk_aiq_camgroup_ctx_t *g_camera_group_ctx[MAX_AIQ_CTX];
 rk_aiq_working_mode_t g_WDRMode[MAX_AIQ_CTX];
 rk_aiq_wb_gain_t gs_wb_gain = {2.083900, 1.000000, 1.000000, 2.018500};
+static int g_day_night[MAX_AIQ_CTX] = {-1, -1, -1, -1, -1, -1, -1, -1};
+static pthread_mutex_t g_day_night_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #define RK_ISP_CHECK_CAMERA_ID(CAMERA_ID)                                                          \
 	do {                                                                                           \
@@ -70,6 +75,470 @@ int rkipc_get_scenario_id(int cam_id) {
 	return scenario_id;
 }
 
+// batch settings
+// Between rk_isp_batch_begin and rk_isp_batch_commit, the setters modify one cached
+// copy of each AIQ attribute instead of doing their own get/set round trip, and
+// queue their ini entries. The commit sets every touched module once, in a fixed
+// order, and writes back the entries whose value changed.
+// A batch belongs to the thread that began it, i.e. to one socket client. Setters
+// called from other threads, like the day/night thread, are applied directly. A
+// batch still open when its thread exits, e.g. the client disconnected between
+// begin and commit, is committed then.
+enum {
+	ISP_ATTR_ACP,
+	ISP_ATTR_EXP_SW,
+	ISP_ATTR_AIE,
+	ISP_ATTR_LIN_EXP,
+	ISP_ATTR_WB_MODE,
+	ISP_ATTR_MWB,
+	ISP_ATTR_DEHAZE,
+	ISP_ATTR_CGC,
+	ISP_ATTR_LDCH,
+	ISP_ATTR_NUM
+};
+
+#define ISP_BATCH_MAX_PARAMS 64
+
+typedef struct {
+	char entry[128];
+	char value[64];
+} isp_batch_param_t;
+
+typedef struct isp_batch {
+	struct isp_batch *next;
+	pthread_t owner;
+	int depth;
+	int enable;
+	long long begin_us;
+	uint32_t fetched;
+	uint32_t dirty;
+	int drc_dirty;
+	float drc_gain, drc_alpha, drc_clip;
+	acp_attrib_t acp;
+	Uapi_ExpSwAttrV2_t exp_sw;
+	aie_attrib_t aie;
+	Uapi_LinExpAttrV2_t lin_exp;
+	rk_aiq_uapiV2_wb_opMode_t wb_mode;
+	rk_aiq_wb_mwb_attrib_t mwb;
+	adehaze_sw_v12_t dehaze;
+	rk_aiq_uapi_acgc_attrib_t cgc;
+	rk_aiq_ldch_v21_attrib_t ldch;
+	int param_num;
+	isp_batch_param_t params[ISP_BATCH_MAX_PARAMS];
+} isp_batch_t;
+
+// g_isp_batch_mutex protects the lists and the content of every batch, a flush
+// from another thread (isp_batch_sync) can run while the owner adds settings
+static isp_batch_t *g_isp_batch[MAX_AIQ_CTX];
+static pthread_mutex_t g_isp_batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_isp_batch_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_isp_batch_key;
+
+static long long isp_now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// the calling thread's batch, whether enabled or not, with g_isp_batch_mutex held
+static isp_batch_t *isp_batch_find(int cam_id) {
+	pthread_t self = pthread_self();
+
+	for (isp_batch_t *batch = g_isp_batch[cam_id]; batch; batch = batch->next) {
+		if (pthread_equal(batch->owner, self))
+			return batch;
+	}
+
+	return NULL;
+}
+
+// takes g_isp_batch_mutex when the calling thread batches, the caller releases it
+// with isp_batch_put once it is done with the batch
+static isp_batch_t *isp_batch_get(int cam_id) {
+	isp_batch_t *batch;
+
+	pthread_mutex_lock(&g_isp_batch_mutex);
+	batch = isp_batch_find(cam_id);
+	if (batch && batch->enable)
+		return batch;
+	pthread_mutex_unlock(&g_isp_batch_mutex);
+
+	return NULL;
+}
+
+static void isp_batch_put(isp_batch_t *batch) {
+	if (batch)
+		pthread_mutex_unlock(&g_isp_batch_mutex);
+}
+
+static void *isp_batch_attr(isp_batch_t *batch, int id) {
+	switch (id) {
+	case ISP_ATTR_ACP:
+		return &batch->acp;
+	case ISP_ATTR_EXP_SW:
+		return &batch->exp_sw;
+	case ISP_ATTR_AIE:
+		return &batch->aie;
+	case ISP_ATTR_LIN_EXP:
+		return &batch->lin_exp;
+	case ISP_ATTR_WB_MODE:
+		return &batch->wb_mode;
+	case ISP_ATTR_MWB:
+		return &batch->mwb;
+	case ISP_ATTR_DEHAZE:
+		return &batch->dehaze;
+	case ISP_ATTR_CGC:
+		return &batch->cgc;
+	case ISP_ATTR_LDCH:
+		return &batch->ldch;
+	}
+
+	return NULL;
+}
+
+static int isp_attr_size(int id) {
+	switch (id) {
+	case ISP_ATTR_ACP:
+		return sizeof(acp_attrib_t);
+	case ISP_ATTR_EXP_SW:
+		return sizeof(Uapi_ExpSwAttrV2_t);
+	case ISP_ATTR_AIE:
+		return sizeof(aie_attrib_t);
+	case ISP_ATTR_LIN_EXP:
+		return sizeof(Uapi_LinExpAttrV2_t);
+	case ISP_ATTR_WB_MODE:
+		return sizeof(rk_aiq_uapiV2_wb_opMode_t);
+	case ISP_ATTR_MWB:
+		return sizeof(rk_aiq_wb_mwb_attrib_t);
+	case ISP_ATTR_DEHAZE:
+		return sizeof(adehaze_sw_v12_t);
+	case ISP_ATTR_CGC:
+		return sizeof(rk_aiq_uapi_acgc_attrib_t);
+	case ISP_ATTR_LDCH:
+		return sizeof(rk_aiq_ldch_v21_attrib_t);
+	}
+
+	return 0;
+}
+
+static int isp_attr_fetch(int cam_id, int id, void *attr) {
+	rk_aiq_sys_ctx_t *ctx = rkipc_aiq_get_ctx(cam_id);
+
+	switch (id) {
+	case ISP_ATTR_ACP:
+		return rk_aiq_user_api2_acp_GetAttrib(ctx, (acp_attrib_t *)attr);
+	case ISP_ATTR_EXP_SW:
+		return rk_aiq_user_api2_ae_getExpSwAttr(ctx, (Uapi_ExpSwAttrV2_t *)attr);
+	case ISP_ATTR_AIE:
+		return rk_aiq_user_api2_aie_GetAttrib(ctx, (aie_attrib_t *)attr);
+	case ISP_ATTR_LIN_EXP:
+		return rk_aiq_user_api2_ae_getLinExpAttr(ctx, (Uapi_LinExpAttrV2_t *)attr);
+	case ISP_ATTR_WB_MODE:
+		return rk_aiq_user_api2_awb_GetWpModeAttrib(ctx, (rk_aiq_uapiV2_wb_opMode_t *)attr);
+	case ISP_ATTR_MWB:
+		return rk_aiq_user_api2_awb_GetMwbAttrib(ctx, (rk_aiq_wb_mwb_attrib_t *)attr);
+	case ISP_ATTR_DEHAZE:
+		memset(attr, 0, sizeof(adehaze_sw_v12_t));
+		return rk_aiq_user_api2_adehaze_v12_getSwAttrib(ctx, (adehaze_sw_v12_t *)attr);
+	case ISP_ATTR_CGC:
+		return rk_aiq_user_api2_acgc_GetAttrib(ctx, (rk_aiq_uapi_acgc_attrib_t *)attr);
+	case ISP_ATTR_LDCH:
+		return rk_aiq_user_api2_aldch_v21_GetAttrib(ctx, (rk_aiq_ldch_v21_attrib_t *)attr);
+	}
+
+	return -1;
+}
+
+static int isp_attr_apply(int cam_id, int id, void *attr) {
+	rk_aiq_sys_ctx_t *ctx = rkipc_aiq_get_ctx(cam_id);
+
+	switch (id) {
+	case ISP_ATTR_ACP:
+		return rk_aiq_user_api2_acp_SetAttrib(ctx, (acp_attrib_t *)attr);
+	case ISP_ATTR_EXP_SW:
+		return rk_aiq_user_api2_ae_setExpSwAttr(ctx, *(Uapi_ExpSwAttrV2_t *)attr);
+	case ISP_ATTR_AIE:
+		return rk_aiq_user_api2_aie_SetAttrib(ctx, (aie_attrib_t *)attr);
+	case ISP_ATTR_LIN_EXP:
+		return rk_aiq_user_api2_ae_setLinExpAttr(ctx, *(Uapi_LinExpAttrV2_t *)attr);
+	case ISP_ATTR_WB_MODE:
+		return rk_aiq_user_api2_awb_SetWpModeAttrib(ctx, *(rk_aiq_uapiV2_wb_opMode_t *)attr);
+	case ISP_ATTR_MWB:
+		return rk_aiq_user_api2_awb_SetMwbAttrib(ctx, *(rk_aiq_wb_mwb_attrib_t *)attr);
+	case ISP_ATTR_DEHAZE:
+		return rk_aiq_user_api2_adehaze_v12_setSwAttrib(ctx, (adehaze_sw_v12_t *)attr);
+	case ISP_ATTR_CGC:
+		return rk_aiq_user_api2_acgc_SetAttrib(ctx, (rk_aiq_uapi_acgc_attrib_t *)attr);
+	case ISP_ATTR_LDCH:
+		return rk_aiq_user_api2_aldch_v21_SetAttrib(ctx, (rk_aiq_ldch_v21_attrib_t *)attr);
+	}
+
+	return -1;
+}
+
+// *attr points to the batch copy while batching, to local otherwise
+static int isp_attr_get(int cam_id, int id, void *local, void **attr) {
+	isp_batch_t *batch = isp_batch_get(cam_id);
+	int ret = 0;
+
+	if (!batch) {
+		*attr = local;
+		return isp_attr_fetch(cam_id, id, local);
+	}
+	*attr = isp_batch_attr(batch, id);
+	if (!(batch->fetched & (1 << id))) {
+		ret = isp_attr_fetch(cam_id, id, *attr);
+		batch->fetched |= 1 << id;
+	}
+	isp_batch_put(batch);
+
+	return ret;
+}
+
+static int isp_attr_set(int cam_id, int id, void *attr) {
+	isp_batch_t *batch = isp_batch_get(cam_id);
+
+	if (!batch)
+		return isp_attr_apply(cam_id, id, attr);
+	batch->dirty |= 1 << id;
+	isp_batch_put(batch);
+
+	return 0;
+}
+
+static int isp_set_drc_gain(int cam_id, float gain, float alpha, float clip) {
+	isp_batch_t *batch = isp_batch_get(cam_id);
+
+	if (!batch)
+		return rk_aiq_uapi2_setDrcGain(rkipc_aiq_get_ctx(cam_id), gain, alpha, clip);
+	batch->drc_dirty = 1;
+	batch->drc_gain = gain;
+	batch->drc_alpha = alpha;
+	batch->drc_clip = clip;
+	isp_batch_put(batch);
+
+	return 0;
+}
+
+static void isp_param_set_string(int cam_id, const char *entry, const char *value) {
+	isp_batch_t *batch = isp_batch_get(cam_id);
+	isp_batch_param_t *param = NULL;
+
+	if (!batch || strlen(entry) >= sizeof(param->entry) || strlen(value) >= sizeof(param->value)) {
+		isp_batch_put(batch);
+		rk_param_set_string(entry, value);
+		return;
+	}
+	for (int i = 0; i < batch->param_num; i++) {
+		if (!strcmp(batch->params[i].entry, entry)) {
+			param = &batch->params[i];
+			break;
+		}
+	}
+	if (!param) {
+		if (batch->param_num >= ISP_BATCH_MAX_PARAMS) {
+			isp_batch_put(batch);
+			rk_param_set_string(entry, value);
+			return;
+		}
+		param = &batch->params[batch->param_num++];
+		strcpy(param->entry, entry);
+	}
+	strcpy(param->value, value);
+	isp_batch_put(batch);
+}
+
+static void isp_param_set_int(int cam_id, const char *entry, int value) {
+	char tmp[16];
+
+	snprintf(tmp, sizeof(tmp), "%d", value);
+	isp_param_set_string(cam_id, entry, tmp);
+}
+
+// setters reading entries that an earlier setter of the same batch may have queued
+static const char *isp_param_get_string(int cam_id, const char *entry, const char *default_val) {
+	isp_batch_t *batch = isp_batch_get(cam_id);
+	const char *value = NULL;
+
+	if (batch) {
+		// the strings stay valid after the put, only the owner frees the batch
+		for (int i = 0; i < batch->param_num; i++) {
+			if (!strcmp(batch->params[i].entry, entry)) {
+				value = batch->params[i].value;
+				break;
+			}
+		}
+		isp_batch_put(batch);
+	}
+
+	return value ? value : rk_param_get_string(entry, default_val);
+}
+
+// a set restarts the algorithm of the module even with the attributes it already runs
+// with, which after a scene switch shows as an exposure or colour transient
+static int isp_attr_unchanged(int cam_id, int id, void *attr) {
+	int size = isp_attr_size(id);
+	void *cur = malloc(size);
+	int ret;
+
+	if (!cur)
+		return 0;
+	ret = !isp_attr_fetch(cam_id, id, cur) && !memcmp(cur, attr, size);
+	free(cur);
+
+	return ret;
+}
+
+// with g_isp_batch_mutex held
+static int isp_batch_flush(int cam_id, isp_batch_t *batch, int *modules, int *unchanged,
+                           int *params) {
+	int ret = 0;
+
+	*modules = 0;
+	*unchanged = 0;
+	*params = 0;
+	for (int id = 0; id < ISP_ATTR_NUM; id++) {
+		if (!(batch->dirty & (1 << id)))
+			continue;
+		if (isp_attr_unchanged(cam_id, id, isp_batch_attr(batch, id))) {
+			(*unchanged)++;
+		} else {
+			if (isp_attr_apply(cam_id, id, isp_batch_attr(batch, id))) {
+				LOG_ERROR("cam %d apply attr %d failed\n", cam_id, id);
+				ret = -1;
+			}
+			(*modules)++;
+		}
+		// blc/hlc strength follows the lin exp attr, so apply drc after it like before
+		if (id == ISP_ATTR_LIN_EXP && batch->drc_dirty) {
+			ret |= rk_aiq_uapi2_setDrcGain(rkipc_aiq_get_ctx(cam_id), batch->drc_gain,
+			                               batch->drc_alpha, batch->drc_clip);
+			batch->drc_dirty = 0;
+			(*modules)++;
+		}
+	}
+	if (batch->drc_dirty) {
+		ret |= rk_aiq_uapi2_setDrcGain(rkipc_aiq_get_ctx(cam_id), batch->drc_gain,
+		                               batch->drc_alpha, batch->drc_clip);
+		(*modules)++;
+	}
+	for (int i = 0; i < batch->param_num; i++) {
+		const char *old = rk_param_get_string(batch->params[i].entry, NULL);
+		if (old && !strcmp(old, batch->params[i].value))
+			continue;
+		rk_param_set_string(batch->params[i].entry, batch->params[i].value);
+		(*params)++;
+	}
+	batch->fetched = 0;
+	batch->dirty = 0;
+	batch->drc_dirty = 0;
+	batch->param_num = 0;
+
+	return ret;
+}
+
+// applies what the open batches hold before the AIQ context is switched or
+// reinitialized, the batches then continue with attributes fetched from the new one
+static void isp_batch_sync(int cam_id) {
+	int modules, unchanged, params;
+
+	if (cam_id < 0 || cam_id >= MAX_AIQ_CTX)
+		return;
+	pthread_mutex_lock(&g_isp_batch_mutex);
+	for (isp_batch_t *batch = g_isp_batch[cam_id]; batch; batch = batch->next) {
+		if (batch->enable)
+			isp_batch_flush(cam_id, batch, &modules, &unchanged, &params);
+	}
+	pthread_mutex_unlock(&g_isp_batch_mutex);
+}
+
+static int isp_batch_end(int cam_id, isp_batch_t *batch) {
+	int ret = 0, modules = 0, unchanged = 0, params = 0;
+	isp_batch_t **pp;
+
+	pthread_mutex_lock(&g_isp_batch_mutex);
+	if (batch->enable && rkipc_aiq_get_ctx(cam_id))
+		ret = isp_batch_flush(cam_id, batch, &modules, &unchanged, &params);
+	for (pp = &g_isp_batch[cam_id]; *pp != batch; pp = &(*pp)->next)
+		;
+	*pp = batch->next;
+	pthread_mutex_unlock(&g_isp_batch_mutex);
+	LOG_INFO("cam %d: %s settings applied in %lld us, %d modules (%d unchanged), %d ini entries\n",
+	         cam_id, batch->enable ? "batched" : "unbatched", isp_now_us() - batch->begin_us,
+	         modules, unchanged, params);
+	free(batch);
+
+	return ret;
+}
+
+// runs when a thread with open batches exits, it commits them
+static void isp_batch_thread_exit(void *arg) {
+	isp_batch_t *batch;
+
+	for (int cam_id = 0; cam_id < MAX_AIQ_CTX; cam_id++) {
+		pthread_mutex_lock(&g_isp_batch_mutex);
+		batch = isp_batch_find(cam_id);
+		pthread_mutex_unlock(&g_isp_batch_mutex);
+		if (!batch)
+			continue;
+		LOG_WARN("cam %d: thread exits with an open batch, commit it\n", cam_id);
+		isp_batch_end(cam_id, batch);
+	}
+}
+
+static void isp_batch_key_create(void) {
+	pthread_key_create(&g_isp_batch_key, isp_batch_thread_exit);
+}
+
+int rk_isp_batch_begin(int cam_id) {
+	RK_ISP_CHECK_CAMERA_ID(cam_id);
+	isp_batch_t *batch;
+
+	pthread_mutex_lock(&g_isp_batch_mutex);
+	batch = isp_batch_find(cam_id);
+	if (batch)
+		batch->depth++;
+	pthread_mutex_unlock(&g_isp_batch_mutex);
+	if (batch)
+		return 0;
+	batch = (isp_batch_t *)calloc(1, sizeof(*batch));
+	if (!batch)
+		return -1;
+	// the value only has to be non NULL for the destructor to run
+	pthread_once(&g_isp_batch_once, isp_batch_key_create);
+	pthread_setspecific(g_isp_batch_key, batch);
+	batch->owner = pthread_self();
+	batch->depth = 1;
+	// isp:batch_settings = 0 applies each setting on its own, to compare timings
+	batch->enable = rk_param_get_int("isp:batch_settings", 1);
+	batch->begin_us = isp_now_us();
+	pthread_mutex_lock(&g_isp_batch_mutex);
+	batch->next = g_isp_batch[cam_id];
+	g_isp_batch[cam_id] = batch;
+	pthread_mutex_unlock(&g_isp_batch_mutex);
+
+	return 0;
+}
+
+int rk_isp_batch_commit(int cam_id) {
+	isp_batch_t *batch;
+	int depth;
+
+	if (cam_id < 0 || cam_id >= MAX_AIQ_CTX)
+		return -1;
+	pthread_mutex_lock(&g_isp_batch_mutex);
+	batch = isp_batch_find(cam_id);
+	depth = batch ? --batch->depth : 0;
+	pthread_mutex_unlock(&g_isp_batch_mutex);
+	if (!batch)
+		return -1;
+	if (depth > 0)
+		return 0;
+
+	return isp_batch_end(cam_id, batch);
+}
+
 int sample_common_isp_init(int cam_id, rk_aiq_working_mode_t WDRMode, bool MultiCam,
                            const char *iq_file_dir) {
 	if (cam_id >= MAX_AIQ_CTX) {
@@ -129,6 +598,7 @@ int sample_common_isp_init(int cam_id, rk_aiq_working_mode_t WDRMode, bool Multi
 	// 	rk_aiq_uapi2_sysctl_setMulCamConc(aiq_ctx, true);
 
 	g_aiq_ctx[cam_id] = aiq_ctx;
+	rk_isp_scene_cache_init(cam_id, aiq_ctx, main_scene, sub_scene);
 
 	return 0;
 }
@@ -270,20 +740,20 @@ int rk_isp_set_frame_rate(int cam_id, int value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
 	char entry[128] = {'\0'};
-	Uapi_ExpSwAttrV2_t expSwAttr;
+	Uapi_ExpSwAttrV2_t local, *expSwAttr;
 	LOG_DEBUG("start %d\n", value);
-	ret = rk_aiq_user_api2_ae_getExpSwAttr(rkipc_aiq_get_ctx(cam_id), &expSwAttr);
+	ret = isp_attr_get(cam_id, ISP_ATTR_EXP_SW, &local, (void **)&expSwAttr);
 	if (value == 0) {
-		expSwAttr.stAuto.stFrmRate.isFpsFix = false;
+		expSwAttr->stAuto.stFrmRate.isFpsFix = false;
 	} else {
-		expSwAttr.stAuto.stFrmRate.isFpsFix = true;
-		expSwAttr.stAuto.stFrmRate.FpsValue = value;
+		expSwAttr->stAuto.stFrmRate.isFpsFix = true;
+		expSwAttr->stAuto.stFrmRate.FpsValue = value;
 	}
-	ret = rk_aiq_user_api2_ae_setExpSwAttr(rkipc_aiq_get_ctx(cam_id), expSwAttr);
+	ret = isp_attr_set(cam_id, ISP_ATTR_EXP_SW, expSwAttr);
 	LOG_DEBUG("end, %d\n", value);
 
 	snprintf(entry, 127, "isp.%d.adjustment:fps", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return 0;
 }
@@ -316,23 +786,37 @@ int rk_isp_get_scenario(int cam_id, const char **value) {
 }
 
 int rk_isp_set_scenario(int cam_id, const char *value) {
+	char scene[32];
+
+	snprintf(scene, sizeof(scene), "%s", sub_scene);
 	if (!strcmp(value, "normal")) {
 		current_scenario_id = 0;
-		strcpy(sub_scene, rk_param_get_string("isp:normal_scene", "day"));
+		snprintf(scene, sizeof(scene), "%s", rk_param_get_string("isp:normal_scene", "day"));
 	} else if (!strcmp(value, "custom1")) {
 		current_scenario_id = 1;
-		strcpy(sub_scene, rk_param_get_string("isp:custom1_scene", "night"));
+		snprintf(scene, sizeof(scene), "%s", rk_param_get_string("isp:custom1_scene", "night"));
 	}
-	LOG_INFO("main_scene is %s, sub_scene is %s\n", main_scene, sub_scene);
-	rk_aiq_uapi2_sysctl_switch_scene(rkipc_aiq_get_ctx(cam_id), main_scene, sub_scene);
+	LOG_INFO("main_scene is %s, sub_scene is %s\n", main_scene, scene);
+	isp_batch_sync(cam_id);
+	if (rk_isp_scene_switch(cam_id, rkipc_aiq_get_ctx(cam_id), main_scene, scene))
+		LOG_WARN("switch to scene %s/%s failed, keep %s\n", main_scene, scene, sub_scene);
+	else
+		strcpy(sub_scene, scene);
 
 	if (rk_param_get_int("isp:init_form_ini", 1))
 		rk_isp_set_from_ini(0);
+	rk_isp_scene_switch_done(cam_id);
 	rk_param_set_string("isp:scenario", value);
 
 	return 0;
 }
 
+int rk_isp_get_scene_stats(int cam_id, char *value, int size) {
+	RK_ISP_CHECK_CAMERA_ID(cam_id);
+
+	return rk_isp_scene_get_stats(cam_id, value, size);
+}
+
 // image adjustment
 
 int rk_isp_get_contrast(int cam_id, int *value) {
@@ -348,12 +832,12 @@ int rk_isp_set_contrast(int cam_id, int value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
 	char entry[128] = {'\0'};
-	acp_attrib_t attrib;
-	ret = rk_aiq_user_api2_acp_GetAttrib(rkipc_aiq_get_ctx(cam_id), &attrib);
-	attrib.contrast = value * 2.55; // value[0,255]
-	ret |= rk_aiq_user_api2_acp_SetAttrib(rkipc_aiq_get_ctx(cam_id), &attrib);
+	acp_attrib_t local, *attrib;
+	ret = isp_attr_get(cam_id, ISP_ATTR_ACP, &local, (void **)&attrib);
+	attrib->contrast = value * 2.55; // value[0,255]
+	ret |= isp_attr_set(cam_id, ISP_ATTR_ACP, attrib);
 	snprintf(entry, 127, "isp.%d.adjustment:contrast", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -370,12 +854,12 @@ int rk_isp_set_brightness(int cam_id, int value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
 	char entry[128] = {'\0'};
-	acp_attrib_t attrib;
-	ret = rk_aiq_user_api2_acp_GetAttrib(rkipc_aiq_get_ctx(cam_id), &attrib);
-	attrib.brightness = value * 2.55; // value[0,255]
-	ret |= rk_aiq_user_api2_acp_SetAttrib(rkipc_aiq_get_ctx(cam_id), &attrib);
+	acp_attrib_t local, *attrib;
+	ret = isp_attr_get(cam_id, ISP_ATTR_ACP, &local, (void **)&attrib);
+	attrib->brightness = value * 2.55; // value[0,255]
+	ret |= isp_attr_set(cam_id, ISP_ATTR_ACP, attrib);
 	snprintf(entry, 127, "isp.%d.adjustment:brightness", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -393,12 +877,12 @@ int rk_isp_set_saturation(int cam_id, int value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
 	char entry[128] = {'\0'};
-	acp_attrib_t attrib;
-	ret = rk_aiq_user_api2_acp_GetAttrib(rkipc_aiq_get_ctx(cam_id), &attrib);
-	attrib.saturation = value * 2.55; // value[0,255]
-	ret |= rk_aiq_user_api2_acp_SetAttrib(rkipc_aiq_get_ctx(cam_id), &attrib);
+	acp_attrib_t local, *attrib;
+	ret = isp_attr_get(cam_id, ISP_ATTR_ACP, &local, (void **)&attrib);
+	attrib->saturation = value * 2.55; // value[0,255]
+	ret |= isp_attr_set(cam_id, ISP_ATTR_ACP, attrib);
 	snprintf(entry, 127, "isp.%d.adjustment:saturation", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -428,7 +912,7 @@ int rk_isp_set_sharpness(int cam_id, int value) {
 	}
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.adjustment:sharpness", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -446,12 +930,12 @@ int rk_isp_set_hue(int cam_id, int value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
 	char entry[128] = {'\0'};
-	acp_attrib_t attrib;
-	ret = rk_aiq_user_api2_acp_GetAttrib(rkipc_aiq_get_ctx(cam_id), &attrib);
-	attrib.hue = value * 2.55; // value[0,255]
-	ret |= rk_aiq_user_api2_acp_SetAttrib(rkipc_aiq_get_ctx(cam_id), &attrib);
+	acp_attrib_t local, *attrib;
+	ret = isp_attr_get(cam_id, ISP_ATTR_ACP, &local, (void **)&attrib);
+	attrib->hue = value * 2.55; // value[0,255]
+	ret |= isp_attr_set(cam_id, ISP_ATTR_ACP, attrib);
 	snprintf(entry, 127, "isp.%d.adjustment:hue", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -468,25 +952,25 @@ int rk_isp_get_exposure_mode(int cam_id, const char **value) {
 
 int rk_isp_set_exposure_mode(int cam_id, const char *value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	Uapi_ExpSwAttrV2_t expSwAttr;
-	rk_aiq_user_api2_ae_getExpSwAttr(rkipc_aiq_get_ctx(cam_id), &expSwAttr);
+	Uapi_ExpSwAttrV2_t local, *expSwAttr;
+	isp_attr_get(cam_id, ISP_ATTR_EXP_SW, &local, (void **)&expSwAttr);
 	if (!strcmp(value, "auto")) {
-		expSwAttr.AecOpType = RK_AIQ_OP_MODE_AUTO;
+		expSwAttr->AecOpType = RK_AIQ_OP_MODE_AUTO;
 	} else {
 		if (g_WDRMode[cam_id] != RK_AIQ_WORKING_MODE_NORMAL) {
-			expSwAttr.AecOpType = RK_AIQ_OP_MODE_MANUAL;
-			expSwAttr.stManual.HdrAE.ManualGainEn = true;
-			expSwAttr.stManual.HdrAE.ManualTimeEn = true;
+			expSwAttr->AecOpType = RK_AIQ_OP_MODE_MANUAL;
+			expSwAttr->stManual.HdrAE.ManualGainEn = true;
+			expSwAttr->stManual.HdrAE.ManualTimeEn = true;
 		} else {
-			expSwAttr.AecOpType = RK_AIQ_OP_MODE_MANUAL;
-			expSwAttr.stManual.LinearAE.ManualGainEn = true;
-			expSwAttr.stManual.LinearAE.ManualTimeEn = true;
+			expSwAttr->AecOpType = RK_AIQ_OP_MODE_MANUAL;
+			expSwAttr->stManual.LinearAE.ManualGainEn = true;
+			expSwAttr->stManual.LinearAE.ManualTimeEn = true;
 		}
 	}
-	int ret = rk_aiq_user_api2_ae_setExpSwAttr(rkipc_aiq_get_ctx(cam_id), expSwAttr);
+	int ret = isp_attr_set(cam_id, ISP_ATTR_EXP_SW, expSwAttr);
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.exposure:exposure_mode", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return 0;
 }
@@ -502,20 +986,20 @@ int rk_isp_get_gain_mode(int cam_id, const char **value) {
 
 int rk_isp_set_gain_mode(int cam_id, const char *value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	Uapi_ExpSwAttrV2_t stExpSwAttr;
+	Uapi_ExpSwAttrV2_t local, *stExpSwAttr;
 
-	rk_aiq_user_api2_ae_getExpSwAttr(rkipc_aiq_get_ctx(cam_id), &stExpSwAttr);
+	isp_attr_get(cam_id, ISP_ATTR_EXP_SW, &local, (void **)&stExpSwAttr);
 	if (!strcmp(value, "auto")) {
-		stExpSwAttr.stManual.LinearAE.ManualGainEn = false;
-		stExpSwAttr.stManual.HdrAE.ManualGainEn = false;
+		stExpSwAttr->stManual.LinearAE.ManualGainEn = false;
+		stExpSwAttr->stManual.HdrAE.ManualGainEn = false;
 	} else {
-		stExpSwAttr.stManual.LinearAE.ManualGainEn = true;
-		stExpSwAttr.stManual.HdrAE.ManualGainEn = true;
+		stExpSwAttr->stManual.LinearAE.ManualGainEn = true;
+		stExpSwAttr->stManual.HdrAE.ManualGainEn = true;
 	}
-	int ret = rk_aiq_user_api2_ae_setExpSwAttr(rkipc_aiq_get_ctx(cam_id), stExpSwAttr);
+	int ret = isp_attr_set(cam_id, ISP_ATTR_EXP_SW, stExpSwAttr);
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.exposure:gain_mode", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -531,7 +1015,7 @@ int rk_isp_get_exposure_time(int cam_id, const char **value) {
 
 int rk_isp_set_exposure_time(int cam_id, const char *value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	Uapi_ExpSwAttrV2_t stExpSwAttr;
+	Uapi_ExpSwAttrV2_t local, *stExpSwAttr;
 	float den, num, result;
 	if (strchr(value, '/') == NULL) {
 		den = 1;
@@ -540,15 +1024,15 @@ int rk_isp_set_exposure_time(int cam_id, const char *value) {
 		sscanf(value, "%f/%f", &num, &den);
 		result = num / den;
 	}
-	rk_aiq_user_api2_ae_getExpSwAttr(rkipc_aiq_get_ctx(cam_id), &stExpSwAttr);
-	stExpSwAttr.stManual.LinearAE.TimeValue = result;
-	stExpSwAttr.stManual.HdrAE.TimeValue[0] = result;
-	stExpSwAttr.stManual.HdrAE.TimeValue[1] = result;
-	stExpSwAttr.stManual.HdrAE.TimeValue[2] = result;
-	int ret = rk_aiq_user_api2_ae_setExpSwAttr(rkipc_aiq_get_ctx(cam_id), stExpSwAttr);
+	isp_attr_get(cam_id, ISP_ATTR_EXP_SW, &local, (void **)&stExpSwAttr);
+	stExpSwAttr->stManual.LinearAE.TimeValue = result;
+	stExpSwAttr->stManual.HdrAE.TimeValue[0] = result;
+	stExpSwAttr->stManual.HdrAE.TimeValue[1] = result;
+	stExpSwAttr->stManual.HdrAE.TimeValue[2] = result;
+	int ret = isp_attr_set(cam_id, ISP_ATTR_EXP_SW, stExpSwAttr);
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.exposure:exposure_time", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -565,22 +1049,22 @@ int rk_isp_get_exposure_gain(int cam_id, int *value) {
 int rk_isp_set_exposure_gain(int cam_id, int value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	char entry[128] = {'\0'};
-	Uapi_ExpSwAttrV2_t stExpSwAttr;
+	Uapi_ExpSwAttrV2_t local, *stExpSwAttr;
 	float gain_set = (value * 1.0f);
-	rk_aiq_user_api2_ae_getExpSwAttr(rkipc_aiq_get_ctx(cam_id), &stExpSwAttr);
-	if ((stExpSwAttr.stManual.LinearAE.ManualGainEn = false) ||
-	    (stExpSwAttr.stManual.HdrAE.ManualGainEn = false)) {
+	isp_attr_get(cam_id, ISP_ATTR_EXP_SW, &local, (void **)&stExpSwAttr);
+	if ((stExpSwAttr->stManual.LinearAE.ManualGainEn = false) ||
+	    (stExpSwAttr->stManual.HdrAE.ManualGainEn = false)) {
 		LOG_WARN("exposure mode is auto, not support set gain\n");
 		return 0;
 	}
-	stExpSwAttr.stManual.LinearAE.GainValue = gain_set;
-	stExpSwAttr.stManual.HdrAE.GainValue[0] = gain_set;
-	stExpSwAttr.stManual.HdrAE.GainValue[1] = gain_set;
-	stExpSwAttr.stManual.HdrAE.GainValue[2] = gain_set;
-	int ret = rk_aiq_user_api2_ae_setExpSwAttr(rkipc_aiq_get_ctx(cam_id), stExpSwAttr);
+	stExpSwAttr->stManual.LinearAE.GainValue = gain_set;
+	stExpSwAttr->stManual.HdrAE.GainValue[0] = gain_set;
+	stExpSwAttr->stManual.HdrAE.GainValue[1] = gain_set;
+	stExpSwAttr->stManual.HdrAE.GainValue[2] = gain_set;
+	int ret = isp_attr_set(cam_id, ISP_ATTR_EXP_SW, stExpSwAttr);
 
 	snprintf(entry, 127, "isp.%d.exposure:exposure_gain", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -595,26 +1079,80 @@ int rk_isp_get_night_to_day(int cam_id, const char **value) {
 	return 0;
 }
 
-int rk_isp_set_night_to_day(int cam_id, const char *value) {
-	int ret;
+// Switches effect, ir-cut, fill light and iq scene together, for the manual modes and
+// for the day/night engine. A scene switch resets the attributes, so the ini settings
+// are applied again once g_day_night_mutex is released; their night_to_day setter
+// then finds the state already set.
+int rk_isp_apply_day_night(int cam_id, int night) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	aie_attrib_t attr;
-	rk_aiq_user_api2_aie_GetAttrib(rkipc_aiq_get_ctx(cam_id), &attr);
-	if (!strcmp(value, "night")) {
-		attr.mode = RK_AIQ_IE_EFFECT_BW;
-		rk_aiq_user_api2_aie_SetAttrib(rkipc_aiq_get_ctx(cam_id), &attr);
-		rk_isp_enable_ircut(false);
+	int ret = 0;
+	char entry[128] = {'\0'};
+	char scene[32];
+	int switched = 0;
+	aie_attrib_t local, *attr;
+
+	pthread_mutex_lock(&g_day_night_mutex);
+	if (g_day_night[cam_id] == night) {
+		pthread_mutex_unlock(&g_day_night_mutex);
+		return 0;
+	}
+	g_day_night[cam_id] = night;
+	LOG_INFO("cam %d: switch to %s\n", cam_id, night ? "night" : "day");
+
+	// off by default, a scene switch costs a visible transient on every transition
+	if (rk_param_get_int("isp:daynight_switch_scene", 0)) {
+		snprintf(scene, sizeof(scene), "%s",
+		         night ? rk_param_get_string("isp:daynight_night_scene", "night")
+		               : rk_param_get_string("isp:daynight_day_scene", "day"));
+		if (strcmp(scene, sub_scene)) {
+			isp_batch_sync(cam_id);
+			if (rk_isp_scene_switch(cam_id, rkipc_aiq_get_ctx(cam_id), main_scene, scene)) {
+				LOG_WARN("switch to scene %s/%s failed, keep %s\n", main_scene, scene, sub_scene);
+			} else {
+				strcpy(sub_scene, scene);
+				switched = 1;
+			}
+		}
+	}
+
+	isp_attr_get(cam_id, ISP_ATTR_AIE, &local, (void **)&attr);
+	attr->mode = night ? RK_AIQ_IE_EFFECT_BW : RK_AIQ_IE_EFFECT_NONE;
+	ret |= isp_attr_set(cam_id, ISP_ATTR_AIE, attr);
+	if (night) {
+		ret |= rk_isp_enable_ircut(false);
+		snprintf(entry, 127, "isp.%d.night_to_day:light_brightness",
+		         rkipc_get_scenario_id(cam_id));
+		int brightness = rk_param_get_int(entry, 0);
+		if (brightness > 0) {
+			light_level = brightness;
+			ret |= rk_isp_set_light_strength(rk_param_get_int("isp:fill_light_pwm", 3), 10000,
+			                                  brightness * 100, PWM_POLARITY_NORMAL);
+		}
 	} else {
-		rk_isp_enable_ircut(true);
 		if (light_state == 1)
-			rk_isp_close_light(3);
-		attr.mode = RK_AIQ_IE_EFFECT_NONE;
-		rk_aiq_user_api2_aie_SetAttrib(rkipc_aiq_get_ctx(cam_id), &attr);
+			rk_isp_close_light(rk_param_get_int("isp:fill_light_pwm", 3));
+		ret |= rk_isp_enable_ircut(true);
+	}
+	pthread_mutex_unlock(&g_day_night_mutex);
+	if (switched) {
+		if (rk_param_get_int("isp:init_form_ini", 1))
+			ret |= rk_isp_set_from_ini(cam_id);
+		rk_isp_scene_switch_done(cam_id);
 	}
 
+	return ret;
+}
+
+int rk_isp_set_night_to_day(int cam_id, const char *value) {
+	int ret = 0;
+	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.night_to_day:night_to_day", rkipc_get_scenario_id(cam_id));
+	// written now rather than queued, a scene switch below reads it back
 	rk_param_set_string(entry, value);
+	// in auto mode the day/night engine decides, see isp_daynight.c
+	if (strcmp(value, "auto"))
+		ret = rk_isp_apply_day_night(cam_id, !strcmp(value, "night"));
 
 	return ret;
 }
@@ -642,7 +1180,7 @@ int rk_isp_set_fill_light_mode(int cam_id, const char *value) {
 #endif
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.night_to_day:fill_light_mode", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -661,16 +1199,22 @@ int rk_isp_set_light_brightness(int cam_id, int value) {
 		LOG_INFO("light brightness unchanged\n");
 		return 0;
 	}
-	int ret;
+	int ret = 0;
 	uint32_t pwm, period, duty = 0;
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	pwm = 3;
+	pwm = rk_param_get_int("isp:fill_light_pwm", 3);
 	period = 10000;
-	duty = 5000;
-	ret = rk_isp_set_light_strength(pwm, period, duty, PWM_POLARITY_NORMAL);
+	duty = period / 100 * value;
+	// the fill light only runs at night, in day the value is used on the next switch
+	if (g_day_night[cam_id] == 1) {
+		if (value > 0)
+			ret = rk_isp_set_light_strength(pwm, period, duty, PWM_POLARITY_NORMAL);
+		else if (light_state == 1)
+			rk_isp_close_light(pwm);
+	}
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.night_to_day:light_brightness", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 	light_level = value;
 	return ret;
 }
@@ -692,7 +1236,7 @@ int rk_isp_set_night_to_day_filter_level(int cam_id, int value) {
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.night_to_day:night_to_day_filter_level",
 	         rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -714,7 +1258,7 @@ int rk_isp_set_night_to_day_filter_time(int cam_id, int value) {
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.night_to_day:night_to_day_filter_time",
 	         rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -783,19 +1327,19 @@ int rk_isp_set_blc_region(int cam_id, const char *value) {
 	int ret;
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	RK_ISP_CHECK_NORMAL_MODE(cam_id);
-	Uapi_LinExpAttrV2_t LineExpAttr;
+	Uapi_LinExpAttrV2_t local, *LineExpAttr;
 
-	ret = rk_aiq_user_api2_ae_getLinExpAttr(rkipc_aiq_get_ctx(cam_id), &LineExpAttr);
+	ret = isp_attr_get(cam_id, ISP_ATTR_LIN_EXP, &local, (void **)&LineExpAttr);
 	if (!strcmp(value, "close"))
-		LineExpAttr.Params.BackLightCtrl.Enable = 0;
+		LineExpAttr->Params.BackLightCtrl.Enable = 0;
 	else
-		LineExpAttr.Params.BackLightCtrl.Enable = 1;
-	LineExpAttr.Params.BackLightCtrl.MeasArea = AECV2_MEASURE_AREA_AUTO;
-	LineExpAttr.Params.BackLightCtrl.StrBias = 0;
-	ret = rk_aiq_user_api2_ae_setLinExpAttr(rkipc_aiq_get_ctx(cam_id), LineExpAttr);
+		LineExpAttr->Params.BackLightCtrl.Enable = 1;
+	LineExpAttr->Params.BackLightCtrl.MeasArea = AECV2_MEASURE_AREA_AUTO;
+	LineExpAttr->Params.BackLightCtrl.StrBias = 0;
+	ret = isp_attr_set(cam_id, ISP_ATTR_LIN_EXP, LineExpAttr);
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.blc:blc_region", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -813,22 +1357,22 @@ int rk_isp_set_hlc(int cam_id, const char *value) {
 	int ret;
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	RK_ISP_CHECK_NORMAL_MODE(cam_id);
-	Uapi_LinExpAttrV2_t LinExpAttr;
+	Uapi_LinExpAttrV2_t local, *LinExpAttr;
 
-	ret = rk_aiq_user_api2_ae_getLinExpAttr(rkipc_aiq_get_ctx(cam_id), &LinExpAttr);
+	ret = isp_attr_get(cam_id, ISP_ATTR_LIN_EXP, &local, (void **)&LinExpAttr);
 	if (ret)
 		LOG_ERROR("get exp attr failed\n");
 	if (!strcmp(value, "close"))
-		LinExpAttr.Params.OverExpCtrl.Enable = 0;
+		LinExpAttr->Params.OverExpCtrl.Enable = 0;
 	else
-		LinExpAttr.Params.OverExpCtrl.Enable = 1;
-	LinExpAttr.Params.OverExpCtrl.StrBias = 0;
-	ret = rk_aiq_user_api2_ae_setLinExpAttr(rkipc_aiq_get_ctx(cam_id), LinExpAttr);
+		LinExpAttr->Params.OverExpCtrl.Enable = 1;
+	LinExpAttr->Params.OverExpCtrl.StrBias = 0;
+	ret = isp_attr_set(cam_id, ISP_ATTR_LIN_EXP, LinExpAttr);
 	if (ret)
 		LOG_ERROR("set exp attr failed\n");
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.blc:hlc", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -845,10 +1389,10 @@ int rk_isp_get_hdr_level(int cam_id, int *value) {
 int rk_isp_set_hdr_level(int cam_id, int value) {
 	int ret;
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	rk_aiq_uapi2_setDrcGain(rkipc_aiq_get_ctx(cam_id), (float)value, 0.1, 16); // Gain: [1, 8]
+	isp_set_drc_gain(cam_id, (float)value, 0.1, 16); // Gain: [1, 8]
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.blc:hdr_level", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -866,22 +1410,22 @@ int rk_isp_set_blc_strength(int cam_id, int value) {
 	int ret;
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	RK_ISP_CHECK_NORMAL_MODE(cam_id);
-	Uapi_LinExpAttrV2_t LineExpAttr;
+	Uapi_LinExpAttrV2_t local, *LineExpAttr;
 
-	ret = rk_aiq_user_api2_ae_getLinExpAttr(rkipc_aiq_get_ctx(cam_id), &LineExpAttr);
+	ret = isp_attr_get(cam_id, ISP_ATTR_LIN_EXP, &local, (void **)&LineExpAttr);
 	if (ret)
 		LOG_ERROR("getLinExpAttr error\n");
-	if (LineExpAttr.Params.BackLightCtrl.Enable == 0) {
+	if (LineExpAttr->Params.BackLightCtrl.Enable == 0) {
 		LOG_ERROR("blc mode is not enabled\n");
 		return 0;
 	}
-	LineExpAttr.Params.BackLightCtrl.StrBias = value;
-	ret = rk_aiq_user_api2_ae_setLinExpAttr(rkipc_aiq_get_ctx(cam_id), LineExpAttr);
+	LineExpAttr->Params.BackLightCtrl.StrBias = value;
+	ret = isp_attr_set(cam_id, ISP_ATTR_LIN_EXP, LineExpAttr);
 	if (ret)
 		LOG_ERROR("setLinExpAttr error\n");
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.blc:blc_strength", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -899,24 +1443,24 @@ int rk_isp_set_hlc_level(int cam_id, int value) {
 	int ret;
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	RK_ISP_CHECK_NORMAL_MODE(cam_id);
-	Uapi_LinExpAttrV2_t LineExpAttr;
+	Uapi_LinExpAttrV2_t local, *LineExpAttr;
 
 	if (value == 0)
 		value = 1;
-	ret = rk_aiq_user_api2_ae_getLinExpAttr(rkipc_aiq_get_ctx(cam_id), &LineExpAttr);
+	ret = isp_attr_get(cam_id, ISP_ATTR_LIN_EXP, &local, (void **)&LineExpAttr);
 	if (ret)
 		LOG_ERROR("getLinExpAttr error\n");
-	if (LineExpAttr.Params.OverExpCtrl.Enable == 0) {
+	if (LineExpAttr->Params.OverExpCtrl.Enable == 0) {
 		LOG_ERROR("hlc mode is not enabled\n");
 		return 0;
 	}
-	LineExpAttr.Params.OverExpCtrl.StrBias = value;
-	ret = rk_aiq_user_api2_ae_setLinExpAttr(rkipc_aiq_get_ctx(cam_id), LineExpAttr);
+	LineExpAttr->Params.OverExpCtrl.StrBias = value;
+	ret = isp_attr_set(cam_id, ISP_ATTR_LIN_EXP, LineExpAttr);
 	if (ret)
 		LOG_ERROR("setLinExpAttr error\n");
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.blc:hlc_level", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -936,10 +1480,10 @@ int rk_isp_set_dark_boost_level(int cam_id, int value) {
 	float Clip = 16.0;
 	float Gain = ((value / 14.3f + 1) * 1.0f);
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	ret = rk_aiq_uapi2_setDrcGain(rkipc_aiq_get_ctx(cam_id), Gain, Alpha, Clip); // [0,100]→[1,8]
+	ret = isp_set_drc_gain(cam_id, Gain, Alpha, Clip); // [0,100]→[1,8]
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.blc:dark_boost_level", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -957,17 +1501,18 @@ int rk_isp_get_white_blance_style(int cam_id, const char **value) {
 int rk_isp_set_white_blance_style(int cam_id, const char *value) {
 	int ret;
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	rk_aiq_uapiV2_wb_opMode_t attr;
+	rk_aiq_uapiV2_wb_opMode_t local, *attr;
 
+	isp_attr_get(cam_id, ISP_ATTR_WB_MODE, &local, (void **)&attr);
 	if (!strcmp(value, "manualWhiteBalance")) {
-		attr.mode = RK_AIQ_WB_MODE_MANUAL;
+		attr->mode = RK_AIQ_WB_MODE_MANUAL;
 	} else {
-		attr.mode = RK_AIQ_WB_MODE_AUTO;
+		attr->mode = RK_AIQ_WB_MODE_AUTO;
 	}
-	ret = rk_aiq_user_api2_awb_SetWpModeAttrib(rkipc_aiq_get_ctx(cam_id), attr);
+	ret = isp_attr_set(cam_id, ISP_ATTR_WB_MODE, attr);
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.white_blance:white_blance_style", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -984,27 +1529,27 @@ int rk_isp_get_white_blance_red(int cam_id, int *value) {
 int rk_isp_set_white_blance_red(int cam_id, int value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
-	rk_aiq_uapiV2_wb_opMode_t mode_attr;
-	rk_aiq_wb_mwb_attrib_t wb_mwb_attr;
+	rk_aiq_uapiV2_wb_opMode_t local_mode, *mode_attr;
+	rk_aiq_wb_mwb_attrib_t local_mwb, *wb_mwb_attr;
 
-	rk_aiq_user_api2_awb_GetWpModeAttrib(rkipc_aiq_get_ctx(cam_id), &mode_attr);
-	if (mode_attr.mode == RK_AIQ_WB_MODE_AUTO) {
+	isp_attr_get(cam_id, ISP_ATTR_WB_MODE, &local_mode, (void **)&mode_attr);
+	if (mode_attr->mode == RK_AIQ_WB_MODE_AUTO) {
 		LOG_WARN("white blance is auto, not support set gain\n");
 		return 0;
 	}
 	// get
-	rk_aiq_user_api2_awb_GetMwbAttrib(rkipc_aiq_get_ctx(cam_id), &wb_mwb_attr);
+	isp_attr_get(cam_id, ISP_ATTR_MWB, &local_mwb, (void **)&wb_mwb_attr);
 	// modify
-	wb_mwb_attr.sync.sync_mode = RK_AIQ_UAPI_MODE_SYNC;
-	wb_mwb_attr.mode = RK_AIQ_MWB_MODE_WBGAIN;
+	wb_mwb_attr->sync.sync_mode = RK_AIQ_UAPI_MODE_SYNC;
+	wb_mwb_attr->mode = RK_AIQ_MWB_MODE_WBGAIN;
 	value = (value == 0) ? 1 : value;
-	wb_mwb_attr.para.gain.rgain = value / 50.0f * gs_wb_gain.rgain;
+	wb_mwb_attr->para.gain.rgain = value / 50.0f * gs_wb_gain.rgain;
 	// set
-	rk_aiq_user_api2_awb_SetMwbAttrib(rkipc_aiq_get_ctx(cam_id), wb_mwb_attr);
+	isp_attr_set(cam_id, ISP_ATTR_MWB, wb_mwb_attr);
 
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.white_blance:white_blance_red", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -1021,28 +1566,28 @@ int rk_isp_get_white_blance_green(int cam_id, int *value) {
 int rk_isp_set_white_blance_green(int cam_id, int value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
-	rk_aiq_uapiV2_wb_opMode_t mode_attr;
-	rk_aiq_wb_mwb_attrib_t wb_mwb_attr;
+	rk_aiq_uapiV2_wb_opMode_t local_mode, *mode_attr;
+	rk_aiq_wb_mwb_attrib_t local_mwb, *wb_mwb_attr;
 
-	rk_aiq_user_api2_awb_GetWpModeAttrib(rkipc_aiq_get_ctx(cam_id), &mode_attr);
-	if (mode_attr.mode == RK_AIQ_WB_MODE_AUTO) {
+	isp_attr_get(cam_id, ISP_ATTR_WB_MODE, &local_mode, (void **)&mode_attr);
+	if (mode_attr->mode == RK_AIQ_WB_MODE_AUTO) {
 		LOG_WARN("white blance is auto, not support set gain\n");
 		return 0;
 	}
 	// get
-	rk_aiq_user_api2_awb_GetMwbAttrib(rkipc_aiq_get_ctx(cam_id), &wb_mwb_attr);
+	isp_attr_get(cam_id, ISP_ATTR_MWB, &local_mwb, (void **)&wb_mwb_attr);
 	// modify
-	wb_mwb_attr.sync.sync_mode = RK_AIQ_UAPI_MODE_SYNC;
-	wb_mwb_attr.mode = RK_AIQ_MWB_MODE_WBGAIN;
+	wb_mwb_attr->sync.sync_mode = RK_AIQ_UAPI_MODE_SYNC;
+	wb_mwb_attr->mode = RK_AIQ_MWB_MODE_WBGAIN;
 	value = (value == 0) ? 1 : value;
-	wb_mwb_attr.para.gain.grgain = value / 50.0f * gs_wb_gain.grgain;
-	wb_mwb_attr.para.gain.gbgain = value / 50.0f * gs_wb_gain.gbgain;
+	wb_mwb_attr->para.gain.grgain = value / 50.0f * gs_wb_gain.grgain;
+	wb_mwb_attr->para.gain.gbgain = value / 50.0f * gs_wb_gain.gbgain;
 	// set
-	rk_aiq_user_api2_awb_SetMwbAttrib(rkipc_aiq_get_ctx(cam_id), wb_mwb_attr);
+	isp_attr_set(cam_id, ISP_ATTR_MWB, wb_mwb_attr);
 
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.white_blance:white_blance_green", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -1059,27 +1604,27 @@ int rk_isp_get_white_blance_blue(int cam_id, int *value) {
 int rk_isp_set_white_blance_blue(int cam_id, int value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
-	rk_aiq_uapiV2_wb_opMode_t mode_attr;
-	rk_aiq_wb_mwb_attrib_t wb_mwb_attr;
+	rk_aiq_uapiV2_wb_opMode_t local_mode, *mode_attr;
+	rk_aiq_wb_mwb_attrib_t local_mwb, *wb_mwb_attr;
 
-	rk_aiq_user_api2_awb_GetWpModeAttrib(rkipc_aiq_get_ctx(cam_id), &mode_attr);
-	if (mode_attr.mode == RK_AIQ_WB_MODE_AUTO) {
+	isp_attr_get(cam_id, ISP_ATTR_WB_MODE, &local_mode, (void **)&mode_attr);
+	if (mode_attr->mode == RK_AIQ_WB_MODE_AUTO) {
 		LOG_WARN("white blance is auto, not support set gain\n");
 		return 0;
 	}
 	// get
-	rk_aiq_user_api2_awb_GetMwbAttrib(rkipc_aiq_get_ctx(cam_id), &wb_mwb_attr);
+	isp_attr_get(cam_id, ISP_ATTR_MWB, &local_mwb, (void **)&wb_mwb_attr);
 	// modify
-	wb_mwb_attr.sync.sync_mode = RK_AIQ_UAPI_MODE_SYNC;
-	wb_mwb_attr.mode = RK_AIQ_MWB_MODE_WBGAIN;
+	wb_mwb_attr->sync.sync_mode = RK_AIQ_UAPI_MODE_SYNC;
+	wb_mwb_attr->mode = RK_AIQ_MWB_MODE_WBGAIN;
 	value = (value == 0) ? 1 : value;
-	wb_mwb_attr.para.gain.bgain = value / 50.0f * gs_wb_gain.bgain;
+	wb_mwb_attr->para.gain.bgain = value / 50.0f * gs_wb_gain.bgain;
 	// set
-	rk_aiq_user_api2_awb_SetMwbAttrib(rkipc_aiq_get_ctx(cam_id), wb_mwb_attr);
+	isp_attr_set(cam_id, ISP_ATTR_MWB, wb_mwb_attr);
 
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.white_blance:white_blance_blue", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -1102,11 +1647,19 @@ int rk_isp_set_noise_reduce_mode(int cam_id, const char *value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.enhancement:noise_reduce_mode", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
 
+// the denoise levels depend on the mode, which the same batch may have just changed
+static const char *isp_get_noise_reduce_mode(int cam_id) {
+	char entry[128] = {'\0'};
+	snprintf(entry, 127, "isp.%d.enhancement:noise_reduce_mode", rkipc_get_scenario_id(cam_id));
+
+	return isp_param_get_string(cam_id, entry, "close");
+}
+
 int rk_isp_get_dehaze(int cam_id, const char **value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	char entry[128] = {'\0'};
@@ -1120,52 +1673,51 @@ int rk_isp_set_dehaze(int cam_id, const char *value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
 	char entry[128] = {'\0'};
-	adehaze_sw_v12_t attr;
-	memset(&attr, 0, sizeof(attr));
+	adehaze_sw_v12_t local, *attr;
 
-	ret = rk_aiq_user_api2_adehaze_v12_getSwAttrib(rkipc_aiq_get_ctx(cam_id), &attr);
+	ret = isp_attr_get(cam_id, ISP_ATTR_DEHAZE, &local, (void **)&attr);
 	if (ret)
 		LOG_ERROR("dehaze get SwAttrib failed %d", ret);
-	attr.sync.sync_mode = RK_AIQ_UAPI_MODE_DEFAULT;
-	attr.sync.done = false;
+	attr->sync.sync_mode = RK_AIQ_UAPI_MODE_DEFAULT;
+	attr->sync.done = false;
 	if (!strcmp(value, "close")) {
-		if (attr.mode == DEHAZE_API_AUTO) {
-			attr.stAuto.DehazeTuningPara.dehaze_setting.en = false;
-		} else if (attr.mode == DEHAZE_API_MANUAL) {
-			attr.stManual.dehaze_setting.en = false;
+		if (attr->mode == DEHAZE_API_AUTO) {
+			attr->stAuto.DehazeTuningPara.dehaze_setting.en = false;
+		} else if (attr->mode == DEHAZE_API_MANUAL) {
+			attr->stManual.dehaze_setting.en = false;
 		}
 	} else if (!strcmp(value, "open")) {
-		if (attr.mode == DEHAZE_API_AUTO) {
-			attr.stAuto.DehazeTuningPara.Enable = true;
-			attr.stAuto.DehazeTuningPara.dehaze_setting.en = true;
-			attr.stAuto.DehazeTuningPara.enhance_setting.en = false;
-			attr.stAuto.DehazeTuningPara.cfg_alpha = 1.0f;
-		} else if (attr.mode == DEHAZE_API_MANUAL) {
-			attr.stManual.Enable = true;
-			attr.stManual.dehaze_setting.en = true;
-			attr.stManual.enhance_setting.en = false;
-			attr.stManual.cfg_alpha = 1.0f;
+		if (attr->mode == DEHAZE_API_AUTO) {
+			attr->stAuto.DehazeTuningPara.Enable = true;
+			attr->stAuto.DehazeTuningPara.dehaze_setting.en = true;
+			attr->stAuto.DehazeTuningPara.enhance_setting.en = false;
+			attr->stAuto.DehazeTuningPara.cfg_alpha = 1.0f;
+		} else if (attr->mode == DEHAZE_API_MANUAL) {
+			attr->stManual.Enable = true;
+			attr->stManual.dehaze_setting.en = true;
+			attr->stManual.enhance_setting.en = false;
+			attr->stManual.cfg_alpha = 1.0f;
 		}
-		attr.Info.updateMDehazeStrth = true;
-		attr.Info.MDehazeStrth = 50;
+		attr->Info.updateMDehazeStrth = true;
+		attr->Info.MDehazeStrth = 50;
 	} else if (!strcmp(value, "auto")) {
-		if (attr.mode == DEHAZE_API_AUTO) {
-			attr.stAuto.DehazeTuningPara.Enable = true;
-			attr.stAuto.DehazeTuningPara.dehaze_setting.en = true;
-			attr.stAuto.DehazeTuningPara.enhance_setting.en = false;
-			attr.stAuto.DehazeTuningPara.cfg_alpha = 1.0f;
-		} else if (attr.mode == DEHAZE_API_MANUAL) {
-			attr.stManual.Enable = true;
-			attr.stManual.dehaze_setting.en = true;
-			attr.stManual.enhance_setting.en = false;
-			attr.stManual.cfg_alpha = 1.0f;
+		if (attr->mode == DEHAZE_API_AUTO) {
+			attr->stAuto.DehazeTuningPara.Enable = true;
+			attr->stAuto.DehazeTuningPara.dehaze_setting.en = true;
+			attr->stAuto.DehazeTuningPara.enhance_setting.en = false;
+			attr->stAuto.DehazeTuningPara.cfg_alpha = 1.0f;
+		} else if (attr->mode == DEHAZE_API_MANUAL) {
+			attr->stManual.Enable = true;
+			attr->stManual.dehaze_setting.en = true;
+			attr->stManual.enhance_setting.en = false;
+			attr->stManual.cfg_alpha = 1.0f;
 		}
-		attr.Info.updateMDehazeStrth = true;
-		attr.Info.MDehazeStrth = 50;
+		attr->Info.updateMDehazeStrth = true;
+		attr->Info.MDehazeStrth = 50;
 	}
-	ret = rk_aiq_user_api2_adehaze_v12_setSwAttrib(rkipc_aiq_get_ctx(cam_id), &attr);
+	ret = isp_attr_set(cam_id, ISP_ATTR_DEHAZE, attr);
 	snprintf(entry, 127, "isp.%d.enhancement:dehaze", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -1183,15 +1735,15 @@ int rk_isp_set_gray_scale_mode(int cam_id, const char *value) {
 	int ret;
 	char entry[128] = {'\0'};
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	rk_aiq_uapi_acgc_attrib_t attr;
-	rk_aiq_user_api2_acgc_GetAttrib(rkipc_aiq_get_ctx(cam_id), &attr);
+	rk_aiq_uapi_acgc_attrib_t local, *attr;
+	isp_attr_get(cam_id, ISP_ATTR_CGC, &local, (void **)&attr);
 	if (!strcmp(value, "[16-235]"))
-		attr.param.cgc_yuv_limit = false;
+		attr->param.cgc_yuv_limit = false;
 	else
-		attr.param.cgc_yuv_limit = true;
-	rk_aiq_user_api2_acgc_SetAttrib(rkipc_aiq_get_ctx(cam_id), &attr);
+		attr->param.cgc_yuv_limit = true;
+	isp_attr_set(cam_id, ISP_ATTR_CGC, attr);
 	snprintf(entry, 127, "isp.%d.enhancement:gray_scale_mode", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -1208,17 +1760,17 @@ int rk_isp_get_distortion_correction(int cam_id, const char **value) {
 int rk_isp_set_distortion_correction(int cam_id, const char *value) {
 	int ret;
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
-	rk_aiq_ldch_v21_attrib_t ldchAttr;
-	ret = rk_aiq_user_api2_aldch_v21_GetAttrib(rkipc_aiq_get_ctx(cam_id), &ldchAttr);
+	rk_aiq_ldch_v21_attrib_t local, *ldchAttr;
+	ret = isp_attr_get(cam_id, ISP_ATTR_LDCH, &local, (void **)&ldchAttr);
 	if (!strcmp(value, "close"))
-		ldchAttr.en = false;
+		ldchAttr->en = false;
 	else
-		ldchAttr.en = true;
-	ret = rk_aiq_user_api2_aldch_v21_SetAttrib(rkipc_aiq_get_ctx(cam_id), &ldchAttr);
+		ldchAttr->en = true;
+	ret = isp_attr_set(cam_id, ISP_ATTR_LDCH, ldchAttr);
 
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.enhancement:distortion_correction", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -1239,7 +1791,7 @@ int rk_isp_set_spatial_denoise_level(int cam_id, int value) {
 	rk_aiq_ynr_strength_v22_t ynrStrength;
 	rk_aiq_bayer2dnr_strength_v23_t bayer2dnrV23Strength;
 
-	rk_isp_get_noise_reduce_mode(cam_id, &noise_reduce_mode);
+	noise_reduce_mode = isp_get_noise_reduce_mode(cam_id);
 	LOG_DEBUG("noise_reduce_mode is %s, value is %d\n", noise_reduce_mode, value);
 	if ((!strcmp(noise_reduce_mode, "close")) || (!strcmp(noise_reduce_mode, "3dnr"))) {
 		value = 50;
@@ -1257,7 +1809,7 @@ int rk_isp_set_spatial_denoise_level(int cam_id, int value) {
 
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.enhancement:spatial_denoise_level", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -1278,7 +1830,7 @@ int rk_isp_set_temporal_denoise_level(int cam_id, int value) {
 	const char *noise_reduce_mode;
 	rk_aiq_bayertnr_strength_v23_t bayertnrV23Strength;
 
-	rk_isp_get_noise_reduce_mode(cam_id, &noise_reduce_mode);
+	noise_reduce_mode = isp_get_noise_reduce_mode(cam_id);
 	LOG_DEBUG("noise_reduce_mode is %s, value is %d\n", noise_reduce_mode, value);
 	if ((!strcmp(noise_reduce_mode, "close")) || (!strcmp(noise_reduce_mode, "2dnr"))) {
 		value = 50;
@@ -1292,7 +1844,7 @@ int rk_isp_set_temporal_denoise_level(int cam_id, int value) {
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.enhancement:temporal_denoise_level",
 	         rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -1311,20 +1863,19 @@ int rk_isp_set_dehaze_level(int cam_id, int value) {
 	int ret;
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.enhancement:dehaze", cam_id);
-	const char *mode = rk_param_get_string(entry, "close");
+	const char *mode = isp_param_get_string(cam_id, entry, "close");
 	if (!strcmp(mode, "close"))
 		return 0;
 
-	adehaze_sw_v12_t attr;
-	memset(&attr, 0, sizeof(attr));
-	rk_aiq_user_api2_adehaze_v12_getSwAttrib(rkipc_aiq_get_ctx(cam_id), &attr);
-	attr.sync.sync_mode = RK_AIQ_UAPI_MODE_DEFAULT;
-	attr.sync.done = false;
-	attr.Info.updateMDehazeStrth = true;
-	attr.Info.MDehazeStrth = value * 10;
-	ret = rk_aiq_user_api2_adehaze_v12_setSwAttrib(rkipc_aiq_get_ctx(cam_id), &attr);
+	adehaze_sw_v12_t local, *attr;
+	isp_attr_get(cam_id, ISP_ATTR_DEHAZE, &local, (void **)&attr);
+	attr->sync.sync_mode = RK_AIQ_UAPI_MODE_DEFAULT;
+	attr->sync.done = false;
+	attr->Info.updateMDehazeStrth = true;
+	attr->Info.MDehazeStrth = value * 10;
+	ret = isp_attr_set(cam_id, ISP_ATTR_DEHAZE, attr);
 	snprintf(entry, 127, "isp.%d.enhancement:dehaze_level", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -1344,7 +1895,7 @@ int rk_isp_set_fec_level(int cam_id, int value) {
 	//                                          (int)(value * 2.55)); // [0-100] -> [0->255]
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.enhancement:fec_level", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return 0;
 }
@@ -1366,16 +1917,16 @@ int rk_isp_set_ldch_level(int cam_id, int value) {
 
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret = 0;
-	rk_aiq_ldch_v21_attrib_t ldchAttr;
+	rk_aiq_ldch_v21_attrib_t local, *ldchAttr;
 
 	value = value < 0 ? 0 : value;
-	ret = rk_aiq_user_api2_aldch_v21_GetAttrib(rkipc_aiq_get_ctx(cam_id), &ldchAttr);
-	ldchAttr.correct_level = (int)(value * 2.53 + 2); // [0, 100] -> [2 , 255]
-	ret = rk_aiq_user_api2_aldch_v21_SetAttrib(rkipc_aiq_get_ctx(cam_id), &ldchAttr);
+	ret = isp_attr_get(cam_id, ISP_ATTR_LDCH, &local, (void **)&ldchAttr);
+	ldchAttr->correct_level = (int)(value * 2.53 + 2); // [0, 100] -> [2 , 255]
+	ret = isp_attr_set(cam_id, ISP_ATTR_LDCH, ldchAttr);
 
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "isp.%d.enhancement:ldch_level", rkipc_get_scenario_id(cam_id));
-	rk_param_set_int(entry, value);
+	isp_param_set_int(cam_id, entry, value);
 
 	return ret;
 }
@@ -1493,24 +2044,24 @@ int rk_isp_set_power_line_frequency_mode(int cam_id, const char *value) {
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
 	int ret;
 	char entry[128] = {'\0'};
-	Uapi_ExpSwAttrV2_t expSwAttr;
+	Uapi_ExpSwAttrV2_t local, *expSwAttr;
 
-	ret = rk_aiq_user_api2_ae_getExpSwAttr(rkipc_aiq_get_ctx(cam_id), &expSwAttr);
+	ret = isp_attr_get(cam_id, ISP_ATTR_EXP_SW, &local, (void **)&expSwAttr);
 	if (!strcmp(value, "NTSC(60HZ)")) {
-		expSwAttr.stAuto.stAntiFlicker.enable = true;
-		expSwAttr.stAuto.stAntiFlicker.Frequency = AECV2_FLICKER_FREQUENCY_60HZ;
-		expSwAttr.stAuto.stAntiFlicker.Mode = AECV2_ANTIFLICKER_NORMAL_MODE;
+		expSwAttr->stAuto.stAntiFlicker.enable = true;
+		expSwAttr->stAuto.stAntiFlicker.Frequency = AECV2_FLICKER_FREQUENCY_60HZ;
+		expSwAttr->stAuto.stAntiFlicker.Mode = AECV2_ANTIFLICKER_NORMAL_MODE;
 	} else {
-		expSwAttr.stAuto.stAntiFlicker.enable = true;
-		expSwAttr.stAuto.stAntiFlicker.Frequency = AECV2_FLICKER_FREQUENCY_50HZ;
-		expSwAttr.stAuto.stAntiFlicker.Mode = AECV2_ANTIFLICKER_NORMAL_MODE;
+		expSwAttr->stAuto.stAntiFlicker.enable = true;
+		expSwAttr->stAuto.stAntiFlicker.Frequency = AECV2_FLICKER_FREQUENCY_50HZ;
+		expSwAttr->stAuto.stAntiFlicker.Mode = AECV2_ANTIFLICKER_NORMAL_MODE;
 	}
-	ret = rk_aiq_user_api2_ae_setExpSwAttr(rkipc_aiq_get_ctx(cam_id), expSwAttr);
+	ret = isp_attr_set(cam_id, ISP_ATTR_EXP_SW, expSwAttr);
 	if (ret != RK_SUCCESS)
 		LOG_ERROR("rk_aiq_user_api2_ae_setExpSwAttr failed\n");
 	snprintf(entry, 127, "isp.%d.video_adjustment:power_line_frequency_mode",
 	         rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -1558,7 +2109,7 @@ int rk_isp_set_image_flip(int cam_id, const char *value) {
 	}
 	rk_aiq_uapi2_setMirrorFlip(rkipc_aiq_get_ctx(cam_id), mirror, flip, 4); // skip 4 frame
 	snprintf(entry, 127, "isp.%d.video_adjustment:image_flip", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return ret;
 }
@@ -1593,7 +2144,7 @@ int rk_isp_set_af_mode(int cam_id, const char *value) {
 	ret = rk_aiq_uapi2_setFocusMode(rkipc_aiq_get_ctx(cam_id), af_mode);
 	LOG_INFO("set af mode: %s, ret: %d\n", value, ret);
 	snprintf(entry, 127, "isp.%d.auto_focus:af_mode", rkipc_get_scenario_id(cam_id));
-	rk_param_set_string(entry, value);
+	isp_param_set_string(cam_id, entry, value);
 
 	return 0;
 }
@@ -1789,6 +2340,7 @@ int rk_isp_set_from_ini(int cam_id) {
 	char value[128];
 	char entry[128] = {'\0'};
 	LOG_DEBUG("start\n");
+	rk_isp_batch_begin(cam_id);
 	snprintf(entry, 127, "isp.%d.adjustment:fps", rkipc_get_scenario_id(cam_id));
 	rk_isp_set_frame_rate(cam_id, rk_param_get_int(entry, 30));
 	// image adjustment
@@ -1891,6 +2443,7 @@ int rk_isp_set_from_ini(int cam_id) {
 	// auto focus
 	// LOG_DEBUG("auto focus\n");
 	// rk_isp_set_af_mode(cam_id, const char *value);
+	ret = rk_isp_batch_commit(cam_id);
 
 	LOG_DEBUG("end\n");
 
@@ -1926,6 +2479,12 @@ int rk_isp_init(int cam_id, char *iqfile_path) {
 	}
 
 	ret |= sample_common_isp_run(cam_id);
+	if (!ret) {
+		rk_isp_stats_init(cam_id, g_aiq_ctx[cam_id],
+		                  g_WDRMode[cam_id] != RK_AIQ_WORKING_MODE_NORMAL);
+		rk_isp_daynight_init(cam_id, g_aiq_ctx[cam_id],
+		                     g_WDRMode[cam_id] != RK_AIQ_WORKING_MODE_NORMAL);
+	}
 
 	return ret;
 }
@@ -1933,6 +2492,12 @@ int rk_isp_init(int cam_id, char *iqfile_path) {
 int rk_isp_deinit(int cam_id) {
 	LOG_INFO("cam_id is %d\n", cam_id);
 	RK_ISP_CHECK_CAMERA_ID(cam_id);
+	rk_isp_daynight_deinit(cam_id);
+	isp_batch_sync(cam_id);
+	rk_isp_stats_deinit(cam_id);
+	rk_isp_scene_cache_deinit(cam_id);
+	// rk_isp_init starts again from the day scene
+	g_day_night[cam_id] = -1;
 	LOG_INFO("rk_aiq_uapi2_sysctl_stop enter\n");
 	rk_aiq_uapi2_sysctl_stop(g_aiq_ctx[cam_id], false);
 	LOG_INFO("rk_aiq_uapi2_sysctl_deinit enter\n");
@@ -6,6 +6,10 @@ int rk_isp_get_frame_rate(int cam_id, int *value);
 int rk_isp_set_frame_rate(int cam_id, int value);
 int rk_isp_set_frame_rate_without_ini(int cam_id, int value);
 int rk_isp_set_from_ini(int cam_id);
+// settings made between begin and commit are applied once per AIQ module at commit,
+// getters keep returning the committed values until then
+int rk_isp_batch_begin(int cam_id);
+int rk_isp_batch_commit(int cam_id);
 int rk_isp_fastboot_init(int cam_id);
 int rk_isp_fastboot_deinit(int cam_id);
 int rk_isp_set_group_ldch_level_form_buffer(int cam_id, void *ldch_0, void *ldch_1, int ldch_size_0,
@@ -13,6 +17,8 @@ int rk_isp_set_group_ldch_level_form_buffer(int cam_id, void *ldch_0, void *ldch
 // isp scenario
 int rk_isp_get_scenario(int cam_id, const char **value);
 int rk_isp_set_scenario(int cam_id, const char *value);
+// switch latency and transient frames, one line per cached scene
+int rk_isp_get_scene_stats(int cam_id, char *value, int size);
 // image adjustment
 int rk_isp_get_contrast(int cam_id, int *value);
 int rk_isp_set_contrast(int cam_id, int value);
@@ -36,6 +42,7 @@ int rk_isp_set_exposure_gain(int cam_id, int value);
 // night_to_day
 int rk_isp_get_night_to_day(int cam_id, const char **value);
 int rk_isp_set_night_to_day(int cam_id, const char *value);
+int rk_isp_apply_day_night(int cam_id, int night);
 int rk_isp_get_fill_light_mode(int cam_id, const char **value);
 int rk_isp_set_fill_light_mode(int cam_id, const char *value);
 int rk_isp_get_light_brightness(int cam_id, int *value);
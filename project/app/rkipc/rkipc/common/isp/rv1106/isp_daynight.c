@@ -0,0 +1,350 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Day/night engine. Every isp:daynight_interval_ms it takes a light level sample:
+//   lv  = 10 * log2(mean luma / (time * gains)) from the AE results, scene
+//         brightness independent of the exposure AE picked
+//   adc = raw photoresistor reading when isp:daynight_adc_chn is set, it is not
+//         fooled by the fill light and decides whenever it is available
+// A sample below the night threshold, or above the day threshold, makes that state a
+// candidate. The candidate must hold for night_to_day_filter_time seconds before the
+// switch, and samples are ignored for isp:daynight_hold_ms after one while AE settles.
+// isp:daynight_switch_scene = 1 also switches the IQ sub scene to daynight_day_scene
+// or daynight_night_scene, it is off by default.
+//
+// isp:daynight_trace records the samples, isp:daynight_sim replays such a file instead
+// of sampling, logging the decisions and only applying them with isp:daynight_sim_apply.
+#include "isp_daynight.h"
+#include "common.h"
+#include "isp.h"
+#include "rk_adc.h"
+
+#include <math.h>
+#include <rk_aiq_user_api2_ae.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "isp_daynight.c"
+
+#define DAYNIGHT_MAX_CAM 8
+#define DAYNIGHT_LV_NONE -9999
+
+typedef struct {
+	long long time_ms;
+	int lv;
+	int adc; // -1 without sensor
+} daynight_sample_t;
+
+typedef struct {
+	int cam_id;
+	int hdr;
+	int run;
+	pthread_t tid;
+	rk_aiq_sys_ctx_t *aiq_ctx;
+	long long start_ms;
+	// settings
+	int interval_ms;
+	int night_lv;
+	int ir_lv_offset;
+	int hold_ms;
+	int filter_level;
+	int dwell_ms;
+	int adc_dev;
+	int adc_chn;
+	int adc_night;
+	int adc_day;
+	// state
+	int auto_mode;
+	int night; // -1 until the first decision
+	int pending;
+	long long pending_since;
+	long long switched_at;
+	int switch_count;
+	FILE *trace;
+	FILE *sim;
+	int sim_apply;
+	int sim_speed;
+	long long sim_last_ms;
+} daynight_ctx_t;
+
+static daynight_ctx_t *g_daynight[DAYNIGHT_MAX_CAM];
+
+static long long daynight_now_ms() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// true when the thread should stop
+static int daynight_sleep(daynight_ctx_t *ctx, long long ms) {
+	while (ctx->run && ms > 0) {
+		long long step = ms > 50 ? 50 : ms;
+		usleep(step * 1000);
+		ms -= step;
+	}
+
+	return !ctx->run;
+}
+
+// the per scenario settings follow the web page without a restart
+static void daynight_load(daynight_ctx_t *ctx) {
+	char entry[128] = {'\0'};
+	int scenario_id = rkipc_get_scenario_id(ctx->cam_id);
+	const char *mode;
+
+	snprintf(entry, 127, "isp.%d.night_to_day:night_to_day", scenario_id);
+	mode = rk_param_get_string(entry, "day");
+	ctx->auto_mode = !strcmp(mode, "auto");
+	if (!ctx->auto_mode && !ctx->sim) {
+		// the manual setter already applied it, continue from there once back in auto
+		ctx->night = !strcmp(mode, "night");
+		ctx->pending = -1;
+	}
+	snprintf(entry, 127, "isp.%d.night_to_day:night_to_day_filter_level", scenario_id);
+	ctx->filter_level = rk_param_get_int(entry, 5);
+	snprintf(entry, 127, "isp.%d.night_to_day:night_to_day_filter_time", scenario_id);
+	ctx->dwell_ms = rk_param_get_int(entry, 5) * 1000;
+}
+
+static void daynight_sample(daynight_ctx_t *ctx, daynight_sample_t *sample) {
+	Uapi_ExpQueryInfo_t info;
+	const RkAiqExpRealParam_t *exp;
+	float luma, exposure;
+
+	sample->time_ms = daynight_now_ms() - ctx->start_ms;
+	sample->lv = DAYNIGHT_LV_NONE;
+	sample->adc = -1;
+	if (!rk_aiq_user_api2_ae_queryExpResInfo(ctx->aiq_ctx, &info)) {
+		if (ctx->hdr) {
+			luma = info.HdrAeInfo.Frm1Luma;
+			exp = &info.HdrAeInfo.HdrExp[1];
+		} else {
+			luma = info.LinAeInfo.MeanLuma;
+			exp = &info.LinAeInfo.LinearExp;
+		}
+		exposure = exp->integration_time * exp->analog_gain;
+		exposure *= exp->digital_gain > 1.0f ? exp->digital_gain : 1.0f;
+		exposure *= exp->isp_dgain > 1.0f ? exp->isp_dgain : 1.0f;
+		if (exposure > 0.0f)
+			sample->lv = (int)lroundf(10.0f * log2f((luma > 1.0f ? luma : 1.0f) / exposure));
+	}
+	if (ctx->adc_dev >= 0) {
+		int value = rk_adc_get_value(ctx->adc_dev, ctx->adc_chn);
+		sample->adc = value < 0 ? -1 : value;
+	}
+}
+
+// 1 with a sample, 0 at the end of the trace
+static int daynight_sim_read(daynight_ctx_t *ctx, daynight_sample_t *sample) {
+	char line[128];
+
+	while (fgets(line, sizeof(line), ctx->sim)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		sample->adc = -1;
+		if (sscanf(line, "%lld %d %d", &sample->time_ms, &sample->lv, &sample->adc) < 2)
+			continue;
+		if (ctx->sim_speed > 0 && ctx->sim_last_ms >= 0 && sample->time_ms > ctx->sim_last_ms &&
+		    daynight_sleep(ctx, (sample->time_ms - ctx->sim_last_ms) / ctx->sim_speed))
+			return 0;
+		ctx->sim_last_ms = sample->time_ms;
+		return 1;
+	}
+
+	return 0;
+}
+
+// the state the sample asks for, -1 when it cannot tell
+static int daynight_want(daynight_ctx_t *ctx, const daynight_sample_t *sample) {
+	int current = ctx->night < 0 ? 0 : ctx->night;
+
+	if (ctx->adc_chn >= 0 && sample->adc >= 0) {
+		// a higher reading means darker when the night threshold is the larger one
+		int inverse = ctx->adc_night > ctx->adc_day;
+		if (inverse ? sample->adc >= ctx->adc_night : sample->adc <= ctx->adc_night)
+			return 1;
+		if (inverse ? sample->adc <= ctx->adc_day : sample->adc >= ctx->adc_day)
+			return 0;
+		return current;
+	}
+	if (sample->lv == DAYNIGHT_LV_NONE)
+		return -1;
+	if (sample->lv < ctx->night_lv)
+		return 1;
+	// at night the fill light brightens the scene, the day threshold moves up with it
+	if (sample->lv > ctx->night_lv + ctx->filter_level * 4 +
+	                     (ctx->night == 1 ? ctx->ir_lv_offset : 0))
+		return 0;
+
+	return current;
+}
+
+// 1 when the state changed
+static int daynight_step(daynight_ctx_t *ctx, const daynight_sample_t *sample) {
+	int want = daynight_want(ctx, sample);
+
+	if (want < 0)
+		return 0;
+	if (ctx->night < 0) {
+		ctx->night = want;
+		ctx->switched_at = sample->time_ms;
+		LOG_INFO("cam %d: start in %s, lv %d adc %d\n", ctx->cam_id, want ? "night" : "day",
+		         sample->lv, sample->adc);
+		return 1;
+	}
+	if (sample->time_ms - ctx->switched_at < ctx->hold_ms)
+		return 0;
+	if (want == ctx->night) {
+		if (ctx->pending >= 0)
+			LOG_INFO("cam %d: stay in %s, %s lasted %lld ms, lv %d adc %d\n", ctx->cam_id,
+			         ctx->night ? "night" : "day", ctx->pending ? "night" : "day",
+			         sample->time_ms - ctx->pending_since, sample->lv, sample->adc);
+		ctx->pending = -1;
+		return 0;
+	}
+	if (ctx->pending != want) {
+		ctx->pending = want;
+		ctx->pending_since = sample->time_ms;
+		LOG_INFO("cam %d: %s candidate, lv %d adc %d, switch after %d ms\n", ctx->cam_id,
+		         want ? "night" : "day", sample->lv, sample->adc, ctx->dwell_ms);
+		return 0;
+	}
+	if (sample->time_ms - ctx->pending_since < ctx->dwell_ms)
+		return 0;
+
+	ctx->night = want;
+	ctx->pending = -1;
+	ctx->switched_at = sample->time_ms;
+	ctx->switch_count++;
+	LOG_INFO("cam %d: switch to %s at %lld ms, lv %d adc %d, %d switches\n", ctx->cam_id,
+	         want ? "night" : "day", sample->time_ms, sample->lv, sample->adc,
+	         ctx->switch_count);
+
+	return 1;
+}
+
+static void *daynight_thread(void *arg) {
+	daynight_ctx_t *ctx = (daynight_ctx_t *)arg;
+	daynight_sample_t sample;
+	char name[32];
+
+	snprintf(name, sizeof(name), "daynight_%d", ctx->cam_id);
+	prctl(PR_SET_NAME, name, 0, 0, 0);
+	while (ctx->run) {
+		daynight_load(ctx);
+		if (ctx->sim) {
+			if (!daynight_sim_read(ctx, &sample)) {
+				LOG_INFO("cam %d: simulation done, %d switches\n", ctx->cam_id,
+				         ctx->switch_count);
+				break;
+			}
+		} else {
+			if (daynight_sleep(ctx, ctx->interval_ms))
+				break;
+			if (!ctx->auto_mode)
+				continue;
+			daynight_sample(ctx, &sample);
+		}
+		if (ctx->trace)
+			fprintf(ctx->trace, "%lld %d %d\n", sample.time_ms, sample.lv, sample.adc);
+		if (!daynight_step(ctx, &sample))
+			continue;
+		if (!ctx->sim || (ctx->sim_apply && ctx->auto_mode))
+			rk_isp_apply_day_night(ctx->cam_id, ctx->night);
+	}
+
+	return NULL;
+}
+
+int rk_isp_daynight_init(int cam_id, rk_aiq_sys_ctx_t *aiq_ctx, int hdr) {
+	daynight_ctx_t *ctx;
+	const char *path;
+
+	if (!rk_param_get_int("isp:daynight", 1))
+		return 0;
+	if (cam_id < 0 || cam_id >= DAYNIGHT_MAX_CAM || !aiq_ctx || g_daynight[cam_id])
+		return -1;
+
+	ctx = (daynight_ctx_t *)calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+	ctx->cam_id = cam_id;
+	ctx->hdr = hdr;
+	ctx->aiq_ctx = aiq_ctx;
+	ctx->start_ms = daynight_now_ms();
+	ctx->night = -1;
+	ctx->pending = -1;
+	ctx->sim_last_ms = -1;
+	ctx->interval_ms = rk_param_get_int("isp:daynight_interval_ms", 500);
+	ctx->night_lv = rk_param_get_int("isp:daynight_night_lv", 60);
+	ctx->ir_lv_offset = rk_param_get_int("isp:daynight_ir_lv_offset", 20);
+	ctx->hold_ms = rk_param_get_int("isp:daynight_hold_ms", 5000);
+	ctx->adc_dev = -1;
+	ctx->adc_chn = rk_param_get_int("isp:daynight_adc_chn", -1);
+	if (ctx->adc_chn >= 0) {
+		ctx->adc_dev = rk_adc_get_devnum(rk_param_get_string("isp:daynight_adc_dev", "saradc"));
+		if (ctx->adc_dev < 0)
+			LOG_WARN("daynight adc device not found, use isp luminance only\n");
+		ctx->adc_night = rk_param_get_int("isp:daynight_adc_night", 200);
+		ctx->adc_day = rk_param_get_int("isp:daynight_adc_day", 400);
+	}
+
+	path = rk_param_get_string("isp:daynight_trace", "");
+	if (path[0]) {
+		ctx->trace = fopen(path, "w");
+		if (ctx->trace) {
+			setvbuf(ctx->trace, NULL, _IOLBF, 0);
+			fprintf(ctx->trace, "# time_ms lv adc\n");
+		} else {
+			LOG_WARN("open trace %s fail, %s\n", path, strerror(errno));
+		}
+	}
+	path = rk_param_get_string("isp:daynight_sim", "");
+	if (path[0]) {
+		ctx->sim = fopen(path, "r");
+		if (!ctx->sim) {
+			LOG_ERROR("open simulation trace %s fail, %s\n", path, strerror(errno));
+		} else {
+			ctx->sim_apply = rk_param_get_int("isp:daynight_sim_apply", 0);
+			ctx->sim_speed = rk_param_get_int("isp:daynight_sim_speed", 1);
+			LOG_INFO("cam %d: replay %s at speed %d, %s\n", cam_id, path, ctx->sim_speed,
+			         ctx->sim_apply ? "applying decisions" : "log only");
+		}
+	}
+
+	ctx->run = 1;
+	if (pthread_create(&ctx->tid, NULL, daynight_thread, ctx)) {
+		LOG_ERROR("create daynight thread fail\n");
+		if (ctx->trace)
+			fclose(ctx->trace);
+		if (ctx->sim)
+			fclose(ctx->sim);
+		free(ctx);
+		return -1;
+	}
+	g_daynight[cam_id] = ctx;
+
+	return 0;
+}
+
+// must run before the aiq context goes away, the thread queries it
+int rk_isp_daynight_deinit(int cam_id) {
+	daynight_ctx_t *ctx;
+
+	if (cam_id < 0 || cam_id >= DAYNIGHT_MAX_CAM || !g_daynight[cam_id])
+		return 0;
+	ctx = g_daynight[cam_id];
+	ctx->run = 0;
+	pthread_join(ctx->tid, NULL);
+	if (ctx->trace)
+		fclose(ctx->trace);
+	if (ctx->sim)
+		fclose(ctx->sim);
+	free(ctx);
+	g_daynight[cam_id] = NULL;
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef __ISP_DAYNIGHT_H__
+#define __ISP_DAYNIGHT_H__
+
+#include <rk_aiq_user_api2_sysctl.h>
+
+// switches between day and night while isp.N.night_to_day:night_to_day is "auto",
+// with night_to_day_filter_level as hysteresis and night_to_day_filter_time as dwell
+int rk_isp_daynight_init(int cam_id, rk_aiq_sys_ctx_t *aiq_ctx, int hdr);
+int rk_isp_daynight_deinit(int cam_id);
+
+#endif
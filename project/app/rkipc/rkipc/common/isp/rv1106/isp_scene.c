@@ -0,0 +1,331 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// IQ scene cache. rk_aiq_uapi2_sysctl_init parses the IQ file of every scene into
+// the calib database once, but a scene name is only resolved when switching to it,
+// on the running pipe. With isp:scene_cache the sub scenes the config refers to
+// (normal_scene, custom1_scene, daynight_day_scene, daynight_night_scene) are
+// resolved before the pipe starts, a later switch to one that failed is refused
+// instead of disturbing the picture.
+//
+// Every switch is measured: latency from the switch call until the settings are
+// re-applied, and transient frames from the switch until AE and AWB report
+// convergence again, or isp:scene_settle_timeout_ms passes.
+#include "isp_scene.h"
+#include "common.h"
+
+#include <rk_aiq_user_api2_ae.h>
+#include <rk_aiq_user_api2_awb.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "isp_scene.c"
+
+#define ISP_SCENE_MAX_CAM 8
+#define ISP_SCENE_MAX_NUM 8
+#define ISP_SCENE_POLL_MS 10
+
+typedef struct {
+	char main[32];
+	char sub[32];
+	int cached;
+	// stats
+	int switches;
+	int timeouts;
+	long long last_us;
+	long long max_us;
+	long long total_us;
+	int last_frames;
+	int max_frames;
+	long long total_frames;
+} isp_scene_t;
+
+typedef struct {
+	int cam_id;
+	int enable;
+	int run;
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	rk_aiq_sys_ctx_t *aiq_ctx;
+	rk_aiq_isp_stats_t *stats;
+	int scene_num;
+	isp_scene_t scenes[ISP_SCENE_MAX_NUM];
+	// switch in progress
+	isp_scene_t *current;
+	int settling;
+	long long begin_us;
+	long long begin_frame;
+} isp_scene_ctx_t;
+
+static isp_scene_ctx_t *g_isp_scene[ISP_SCENE_MAX_CAM];
+
+static long long isp_scene_now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// id of the latest frame with 3a results, -1 before the first one
+static long long isp_scene_frame_id(isp_scene_ctx_t *ctx) {
+	if (rk_aiq_uapi2_sysctl_get3AStats(ctx->aiq_ctx, ctx->stats))
+		return -1;
+
+	return ctx->stats->frame_id;
+}
+
+static int isp_scene_converged(isp_scene_ctx_t *ctx) {
+	Uapi_ExpQueryInfo_t exp;
+	rk_aiq_wb_querry_info_t wb;
+
+	if (rk_aiq_user_api2_ae_queryExpResInfo(ctx->aiq_ctx, &exp) || !exp.IsConverged)
+		return 0;
+	if (rk_aiq_user_api2_awb_QueryWBInfo(ctx->aiq_ctx, &wb) || !wb.awbConverged)
+		return 0;
+
+	return 1;
+}
+
+static isp_scene_t *isp_scene_find(isp_scene_ctx_t *ctx, const char *main_scene,
+                                   const char *sub_scene) {
+	for (int i = 0; i < ctx->scene_num; i++) {
+		if (!strcmp(ctx->scenes[i].main, main_scene) && !strcmp(ctx->scenes[i].sub, sub_scene))
+			return &ctx->scenes[i];
+	}
+
+	return NULL;
+}
+
+static isp_scene_t *isp_scene_add(isp_scene_ctx_t *ctx, const char *main_scene,
+                                  const char *sub_scene) {
+	isp_scene_t *scene = isp_scene_find(ctx, main_scene, sub_scene);
+
+	if (scene || ctx->scene_num >= ISP_SCENE_MAX_NUM)
+		return scene;
+	scene = &ctx->scenes[ctx->scene_num++];
+	snprintf(scene->main, sizeof(scene->main), "%s", main_scene);
+	snprintf(scene->sub, sizeof(scene->sub), "%s", sub_scene);
+
+	return scene;
+}
+
+static void isp_scene_settle(isp_scene_ctx_t *ctx, long long frame, int timeout) {
+	isp_scene_t *scene = ctx->current;
+	int frames = 0;
+
+	if (frame >= 0 && ctx->begin_frame >= 0)
+		frames = frame - ctx->begin_frame;
+	scene->last_frames = frames;
+	if (frames > scene->max_frames)
+		scene->max_frames = frames;
+	scene->total_frames += frames;
+	if (timeout)
+		scene->timeouts++;
+	LOG_INFO("cam %d: scene %s/%s switched in %lld us, %d transient frames%s\n", ctx->cam_id,
+	         scene->main, scene->sub, scene->last_us, frames, timeout ? " (not settled)" : "");
+	ctx->settling = 0;
+	ctx->current = NULL;
+}
+
+static void *isp_scene_thread(void *arg) {
+	isp_scene_ctx_t *ctx = (isp_scene_ctx_t *)arg;
+	char name[32];
+
+	snprintf(name, sizeof(name), "isp_scene_%d", ctx->cam_id);
+	prctl(PR_SET_NAME, name, 0, 0, 0);
+	pthread_mutex_lock(&ctx->mutex);
+	while (ctx->run) {
+		long long frame, timeout_us;
+
+		if (!ctx->settling) {
+			pthread_cond_wait(&ctx->cond, &ctx->mutex);
+			continue;
+		}
+		pthread_mutex_unlock(&ctx->mutex);
+		usleep(ISP_SCENE_POLL_MS * 1000);
+		// a frame must have been processed with the new scene before convergence counts
+		frame = isp_scene_frame_id(ctx);
+		timeout_us = rk_param_get_int("isp:scene_settle_timeout_ms", 3000) * 1000LL;
+		pthread_mutex_lock(&ctx->mutex);
+		if (!ctx->settling)
+			continue;
+		if (frame > ctx->begin_frame && isp_scene_converged(ctx))
+			isp_scene_settle(ctx, frame, 0);
+		else if (isp_scene_now_us() - ctx->begin_us > timeout_us)
+			isp_scene_settle(ctx, frame, 1);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+
+	return NULL;
+}
+
+int rk_isp_scene_cache_init(int cam_id, rk_aiq_sys_ctx_t *aiq_ctx, const char *main_scene,
+                            const char *sub_scene) {
+	const char *keys[] = {"isp:normal_scene", "isp:custom1_scene", "isp:daynight_day_scene",
+	                      "isp:daynight_night_scene"};
+	const char *defaults[] = {"day", "night", "day", "night"};
+	isp_scene_ctx_t *ctx;
+	long long begin;
+
+	if (cam_id < 0 || cam_id >= ISP_SCENE_MAX_CAM || !aiq_ctx || g_isp_scene[cam_id])
+		return -1;
+	ctx = (isp_scene_ctx_t *)calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+	ctx->stats = (rk_aiq_isp_stats_t *)calloc(1, sizeof(*ctx->stats));
+	if (!ctx->stats) {
+		free(ctx);
+		return -1;
+	}
+	ctx->cam_id = cam_id;
+	ctx->aiq_ctx = aiq_ctx;
+	// isp:scene_cache = 0 resolves scenes on the running pipe, to compare the timings
+	ctx->enable = rk_param_get_int("isp:scene_cache", 1);
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+
+	isp_scene_add(ctx, main_scene, sub_scene)->cached = 1;
+	for (int i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+		isp_scene_add(ctx, main_scene, rk_param_get_string(keys[i], defaults[i]));
+
+	begin = isp_scene_now_us();
+	for (int i = 0; ctx->enable && i < ctx->scene_num; i++) {
+		isp_scene_t *scene = &ctx->scenes[i];
+
+		if (scene->cached)
+			continue;
+		scene->cached = !rk_aiq_uapi2_sysctl_switch_scene(aiq_ctx, scene->main, scene->sub);
+		if (!scene->cached)
+			LOG_WARN("cam %d: scene %s/%s not in the iq file\n", cam_id, scene->main,
+			         scene->sub);
+	}
+	if (ctx->enable && ctx->scene_num > 1) {
+		// the pipe starts with the scene it was initialized with
+		if (rk_aiq_uapi2_sysctl_switch_scene(aiq_ctx, main_scene, sub_scene))
+			LOG_ERROR("cam %d: restore scene %s/%s failed\n", cam_id, main_scene, sub_scene);
+		LOG_INFO("cam %d: %d scenes resolved in %lld us\n", cam_id, ctx->scene_num,
+		         isp_scene_now_us() - begin);
+	}
+
+	ctx->run = 1;
+	if (pthread_create(&ctx->tid, NULL, isp_scene_thread, ctx)) {
+		LOG_ERROR("create scene thread fail\n");
+		pthread_mutex_destroy(&ctx->mutex);
+		pthread_cond_destroy(&ctx->cond);
+		free(ctx->stats);
+		free(ctx);
+		return -1;
+	}
+	g_isp_scene[cam_id] = ctx;
+
+	return 0;
+}
+
+int rk_isp_scene_cache_deinit(int cam_id) {
+	isp_scene_ctx_t *ctx;
+
+	if (cam_id < 0 || cam_id >= ISP_SCENE_MAX_CAM || !g_isp_scene[cam_id])
+		return 0;
+	ctx = g_isp_scene[cam_id];
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->run = 0;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->mutex);
+	pthread_join(ctx->tid, NULL);
+	pthread_mutex_destroy(&ctx->mutex);
+	pthread_cond_destroy(&ctx->cond);
+	free(ctx->stats);
+	free(ctx);
+	g_isp_scene[cam_id] = NULL;
+
+	return 0;
+}
+
+int rk_isp_scene_switch(int cam_id, rk_aiq_sys_ctx_t *aiq_ctx, const char *main_scene,
+                        const char *sub_scene) {
+	isp_scene_ctx_t *ctx;
+	isp_scene_t *scene;
+	long long frame;
+	int ret;
+
+	if (cam_id < 0 || cam_id >= ISP_SCENE_MAX_CAM || !g_isp_scene[cam_id])
+		return rk_aiq_uapi2_sysctl_switch_scene(aiq_ctx, main_scene, sub_scene);
+	ctx = g_isp_scene[cam_id];
+	pthread_mutex_lock(&ctx->mutex);
+	scene = isp_scene_find(ctx, main_scene, sub_scene);
+	if (ctx->enable && (!scene || !scene->cached)) {
+		pthread_mutex_unlock(&ctx->mutex);
+		LOG_WARN("cam %d: scene %s/%s is not cached, not switching\n", cam_id, main_scene,
+		         sub_scene);
+		return -1;
+	}
+	if (!scene)
+		scene = isp_scene_add(ctx, main_scene, sub_scene);
+	// a switch before the last one settled ends that measurement
+	if (ctx->current && ctx->settling)
+		isp_scene_settle(ctx, -1, 1);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	frame = isp_scene_frame_id(ctx);
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->begin_us = isp_scene_now_us();
+	ctx->begin_frame = frame;
+	ret = rk_aiq_uapi2_sysctl_switch_scene(ctx->aiq_ctx, main_scene, sub_scene);
+	ctx->current = ret ? NULL : scene;
+	pthread_mutex_unlock(&ctx->mutex);
+
+	return ret;
+}
+
+void rk_isp_scene_switch_done(int cam_id) {
+	isp_scene_ctx_t *ctx;
+	isp_scene_t *scene;
+
+	if (cam_id < 0 || cam_id >= ISP_SCENE_MAX_CAM || !g_isp_scene[cam_id])
+		return;
+	ctx = g_isp_scene[cam_id];
+	pthread_mutex_lock(&ctx->mutex);
+	scene = ctx->current;
+	if (scene && !ctx->settling) {
+		scene->switches++;
+		scene->last_us = isp_scene_now_us() - ctx->begin_us;
+		if (scene->last_us > scene->max_us)
+			scene->max_us = scene->last_us;
+		scene->total_us += scene->last_us;
+		ctx->settling = 1;
+		pthread_cond_signal(&ctx->cond);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+int rk_isp_scene_get_stats(int cam_id, char *value, int size) {
+	isp_scene_ctx_t *ctx;
+	int len = 0;
+
+	if (!value || size <= 0)
+		return -1;
+	value[0] = '\0';
+	if (cam_id < 0 || cam_id >= ISP_SCENE_MAX_CAM || !g_isp_scene[cam_id])
+		return -1;
+	ctx = g_isp_scene[cam_id];
+	pthread_mutex_lock(&ctx->mutex);
+	for (int i = 0; i < ctx->scene_num && len < size; i++) {
+		isp_scene_t *scene = &ctx->scenes[i];
+		int n = scene->switches ? scene->switches : 1;
+
+		len += snprintf(value + len, size - len,
+		                "%s/%s: %s, %d switches, latency last %lld avg %lld max %lld ms, "
+		                "transient frames last %d avg %lld max %d, %d not settled\n",
+		                scene->main, scene->sub,
+		                !ctx->enable ? "uncached" : scene->cached ? "cached" : "missing",
+		                scene->switches, scene->last_us / 1000, scene->total_us / n / 1000,
+		                scene->max_us / 1000, scene->last_frames, scene->total_frames / n,
+		                scene->max_frames, scene->timeouts);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+
+	return 0;
+}
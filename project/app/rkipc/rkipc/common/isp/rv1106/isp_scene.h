@@ -0,0 +1,24 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef __ISP_SCENE_H__
+#define __ISP_SCENE_H__
+
+#include <rk_aiq_user_api2_sysctl.h>
+
+// resolves every sub scene the config can switch to while the AIQ context is not
+// started yet, must be called between rk_aiq_uapi2_sysctl_init and prepare
+int rk_isp_scene_cache_init(int cam_id, rk_aiq_sys_ctx_t *aiq_ctx, const char *main_scene,
+                            const char *sub_scene);
+int rk_isp_scene_cache_deinit(int cam_id);
+
+// switches to a cached scene, a scene that failed to resolve is refused without
+// touching the running pipe. Call rk_isp_scene_switch_done once the settings are
+// re-applied, the latency ends there and transient frames are counted from the
+// switch until AE and AWB converge again.
+int rk_isp_scene_switch(int cam_id, rk_aiq_sys_ctx_t *aiq_ctx, const char *main_scene,
+                        const char *sub_scene);
+void rk_isp_scene_switch_done(int cam_id);
+int rk_isp_scene_get_stats(int cam_id, char *value, int size);
+
+#endif
@@ -0,0 +1,154 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "isp_stats.h"
+#include "common.h"
+#include "isp_stats_shm.h"
+
+#include <rk_aiq_user_api2_awb.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "isp_stats.c"
+
+#define ISP_STATS_MAX_CAM 8
+#define ISP_STATS_TIMEOUT_MS 500
+
+typedef struct {
+	int cam_id;
+	int hdr;
+	int run;
+	pthread_t tid;
+	rk_aiq_sys_ctx_t *aiq_ctx;
+	isp_stats_shm_t *shm;
+} isp_stats_ctx_t;
+
+static isp_stats_ctx_t *g_isp_stats[ISP_STATS_MAX_CAM];
+
+static uint64_t isp_stats_now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void isp_stats_fill(isp_stats_ctx_t *ctx, const rk_aiq_isp_stats_t *stats,
+                           isp_stats_record_t *rec) {
+	// hdr2 reports the long frame in the second channel, linear in the first
+	int chn = ctx->hdr ? 1 : 0;
+	const Aec_Stat_Res_t *ae = &stats->aec_stats.ae_data.chn[chn];
+	const RkAiqExpRealParam_t *exp = ctx->hdr
+	                                     ? &stats->aec_stats.ae_exp.HdrExp[1].exp_real_params
+	                                     : &stats->aec_stats.ae_exp.LinearExp.exp_real_params;
+	rk_aiq_wb_querry_info_t wb;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->frame_id = stats->frame_id;
+	rec->cam_id = ctx->cam_id;
+	rec->timestamp_us = isp_stats_now_us();
+
+	rec->integration_time = exp->integration_time;
+	rec->analog_gain = exp->analog_gain;
+	rec->digital_gain = exp->digital_gain;
+	rec->isp_dgain = exp->isp_dgain;
+	rec->iso = exp->iso;
+
+	rec->grid_w = ISP_STATS_GRID_W;
+	rec->grid_h = ISP_STATS_GRID_H;
+	memcpy(rec->luma, ae->rawae_big.channely_xy, sizeof(rec->luma));
+	memcpy(rec->hist, ae->rawhist_big.bins, sizeof(rec->hist));
+
+	for (int i = 0; i < ISP_STATS_GRID_NUM; i++) {
+		rec->af_fv[i] = stats->af_stats_v3x.wnda_fv_h1[i];
+		rec->af_fv_sum += rec->af_fv[i];
+	}
+
+	// gains in use rather than the raw awb statistics, that is what consumers act on
+	if (!rk_aiq_user_api2_awb_QueryWBInfo(ctx->aiq_ctx, &wb)) {
+		rec->awb_gain[0] = wb.gain.rgain;
+		rec->awb_gain[1] = wb.gain.grgain;
+		rec->awb_gain[2] = wb.gain.gbgain;
+		rec->awb_gain[3] = wb.gain.bgain;
+		rec->awb_cct = wb.cctGloabl.CCT;
+		rec->awb_converged = wb.awbConverged;
+	}
+}
+
+static void *isp_stats_thread(void *arg) {
+	isp_stats_ctx_t *ctx = (isp_stats_ctx_t *)arg;
+	isp_stats_record_t rec;
+	char name[32];
+
+	snprintf(name, sizeof(name), "isp_stats_%d", ctx->cam_id);
+	prctl(PR_SET_NAME, name, 0, 0, 0);
+	while (ctx->run) {
+		rk_aiq_isp_stats_t *stats = NULL;
+		XCamReturn ret =
+		    rk_aiq_uapi2_sysctl_get3AStatsBlk(ctx->aiq_ctx, &stats, ISP_STATS_TIMEOUT_MS);
+
+		if (ret == XCAM_RETURN_ERROR_TIMEOUT)
+			continue;
+		if (ret != XCAM_RETURN_NO_ERROR || !stats) {
+			LOG_WARN("cam %d get 3a stats fail %d, stop publishing\n", ctx->cam_id, ret);
+			break;
+		}
+		isp_stats_fill(ctx, stats, &rec);
+		rk_aiq_uapi2_sysctl_release3AStatsRef(ctx->aiq_ctx, stats);
+		isp_stats_shm_publish(ctx->shm, &rec);
+	}
+
+	return NULL;
+}
+
+int rk_isp_stats_init(int cam_id, rk_aiq_sys_ctx_t *aiq_ctx, int hdr) {
+	isp_stats_ctx_t *ctx;
+	char path[64];
+
+	if (!rk_param_get_int("isp:stats_shm", 0))
+		return 0;
+	if (cam_id < 0 || cam_id >= ISP_STATS_MAX_CAM || !aiq_ctx || g_isp_stats[cam_id])
+		return -1;
+
+	ctx = (isp_stats_ctx_t *)calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+	ctx->cam_id = cam_id;
+	ctx->hdr = hdr;
+	ctx->aiq_ctx = aiq_ctx;
+	snprintf(path, sizeof(path), ISP_STATS_SHM_PATH, cam_id);
+	ctx->shm = isp_stats_shm_create(
+	    path, rk_param_get_int("isp:stats_shm_slots", ISP_STATS_SHM_DEFAULT_SLOTS));
+	if (!ctx->shm) {
+		LOG_ERROR("create %s fail, %s\n", path, strerror(errno));
+		free(ctx);
+		return -1;
+	}
+	ctx->run = 1;
+	if (pthread_create(&ctx->tid, NULL, isp_stats_thread, ctx)) {
+		LOG_ERROR("create stats thread fail\n");
+		isp_stats_shm_close(ctx->shm);
+		free(ctx);
+		return -1;
+	}
+	g_isp_stats[cam_id] = ctx;
+	LOG_INFO("cam %d publishes 3a stats to %s\n", cam_id, path);
+
+	return 0;
+}
+
+// must run before rk_aiq_uapi2_sysctl_stop, the thread may still wait for stats
+int rk_isp_stats_deinit(int cam_id) {
+	isp_stats_ctx_t *ctx;
+
+	if (cam_id < 0 || cam_id >= ISP_STATS_MAX_CAM || !g_isp_stats[cam_id])
+		return 0;
+	ctx = g_isp_stats[cam_id];
+	ctx->run = 0;
+	pthread_join(ctx->tid, NULL);
+	isp_stats_shm_close(ctx->shm);
+	free(ctx);
+	g_isp_stats[cam_id] = NULL;
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef __ISP_STATS_H__
+#define __ISP_STATS_H__
+
+#include <rk_aiq_user_api2_sysctl.h>
+
+// publishes every frame's 3A statistics to ISP_STATS_SHM_PATH when
+// isp:stats_shm is set, see isp_stats_shm.h for the layout
+int rk_isp_stats_init(int cam_id, rk_aiq_sys_ctx_t *aiq_ctx, int hdr);
+int rk_isp_stats_deinit(int cam_id);
+
+#endif
@@ -0,0 +1,175 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "isp_stats_shm.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+	uint64_t seq;
+	isp_stats_record_t record;
+} isp_stats_shm_slot_t;
+
+struct isp_stats_shm {
+	isp_stats_shm_header_t *header;
+	size_t size;
+	int owner;
+	uint64_t next; // reader: next record to read
+	char path[64];
+};
+
+_Static_assert(sizeof(isp_stats_record_t) % 8 == 0, "record must keep slots 8 byte aligned");
+
+static isp_stats_shm_slot_t *isp_stats_shm_slot(isp_stats_shm_t *shm, uint64_t n) {
+	isp_stats_shm_header_t *header = shm->header;
+
+	return (isp_stats_shm_slot_t *)((char *)header + header->header_size +
+	                                (n % header->slot_count) * header->slot_size);
+}
+
+// plain files in /dev/shm are what shm_open() gives, without needing librt on uclibc
+isp_stats_shm_t *isp_stats_shm_create(const char *path, int slot_count) {
+	isp_stats_shm_t *shm;
+	size_t size;
+	void *map;
+	int fd;
+
+	if (slot_count < 2)
+		slot_count = 2;
+	size = sizeof(isp_stats_shm_header_t) + slot_count * sizeof(isp_stats_shm_slot_t);
+
+	// readers still mapping a previous instance see it closed, not rewritten
+	unlink(path);
+	fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, size)) {
+		close(fd);
+		unlink(path);
+		return NULL;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		unlink(path);
+		return NULL;
+	}
+
+	shm = (isp_stats_shm_t *)calloc(1, sizeof(*shm));
+	if (!shm) {
+		munmap(map, size);
+		unlink(path);
+		return NULL;
+	}
+	shm->header = (isp_stats_shm_header_t *)map;
+	shm->size = size;
+	shm->owner = 1;
+	strncpy(shm->path, path, sizeof(shm->path) - 1);
+
+	shm->header->version = ISP_STATS_SHM_VERSION;
+	shm->header->header_size = sizeof(isp_stats_shm_header_t);
+	shm->header->record_size = sizeof(isp_stats_record_t);
+	shm->header->slot_size = sizeof(isp_stats_shm_slot_t);
+	shm->header->slot_count = slot_count;
+	shm->header->write_count = 0;
+	__atomic_store_n(&shm->header->magic, ISP_STATS_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return shm;
+}
+
+void isp_stats_shm_publish(isp_stats_shm_t *shm, const isp_stats_record_t *record) {
+	uint64_t n = shm->header->write_count;
+	isp_stats_shm_slot_t *slot = isp_stats_shm_slot(shm, n);
+
+	__atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&slot->record, record, sizeof(*record));
+	__atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&shm->header->write_count, n + 1, __ATOMIC_RELEASE);
+}
+
+isp_stats_shm_t *isp_stats_shm_open(const char *path) {
+	isp_stats_shm_header_t header;
+	isp_stats_shm_t *shm;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+	    header.magic != ISP_STATS_SHM_MAGIC || header.version != ISP_STATS_SHM_VERSION ||
+	    header.slot_count < 2 || header.slot_size < header.record_size + sizeof(uint64_t) ||
+	    fstat(fd, &st) ||
+	    (uint64_t)st.st_size < header.header_size + (uint64_t)header.slot_count * header.slot_size) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	shm = (isp_stats_shm_t *)calloc(1, sizeof(*shm));
+	if (!shm) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	shm->header = (isp_stats_shm_header_t *)map;
+	shm->size = st.st_size;
+	shm->next = __atomic_load_n(&shm->header->write_count, __ATOMIC_ACQUIRE);
+
+	return shm;
+}
+
+int isp_stats_shm_read(isp_stats_shm_t *shm, isp_stats_record_t *record, uint32_t *lost) {
+	isp_stats_shm_header_t *header = shm->header;
+	size_t size = header->record_size < sizeof(*record) ? header->record_size : sizeof(*record);
+	uint64_t count;
+
+	if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != ISP_STATS_SHM_MAGIC)
+		return -1;
+	count = __atomic_load_n(&header->write_count, __ATOMIC_ACQUIRE);
+	// the oldest slot may be rewritten right now, start one after it
+	if (count - shm->next >= header->slot_count) {
+		if (lost)
+			*lost += count - shm->next - (header->slot_count - 1);
+		shm->next = count - (header->slot_count - 1);
+	}
+
+	while (shm->next < count) {
+		isp_stats_shm_slot_t *slot = isp_stats_shm_slot(shm, shm->next);
+		uint64_t expect = 2 * shm->next + 2;
+		uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+
+		shm->next++;
+		if (seq == expect) {
+			memset(record, 0, sizeof(*record));
+			memcpy(record, &slot->record, size);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == expect)
+				return 1;
+		}
+		if (lost)
+			(*lost)++;
+	}
+
+	return 0;
+}
+
+void isp_stats_shm_close(isp_stats_shm_t *shm) {
+	if (!shm)
+		return;
+	if (shm->owner) {
+		__atomic_store_n(&shm->header->magic, ISP_STATS_SHM_CLOSED, __ATOMIC_RELEASE);
+		unlink(shm->path);
+	}
+	munmap(shm->header, shm->size);
+	free(shm);
+}
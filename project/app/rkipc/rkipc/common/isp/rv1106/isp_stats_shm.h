@@ -0,0 +1,84 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef __ISP_STATS_SHM_H__
+#define __ISP_STATS_SHM_H__
+
+#include <stdint.h>
+
+// Per-frame 3A statistics published by rkipc in /dev/shm for external tools.
+//
+// The shared file is an isp_stats_shm_header_t followed by slot_count slots.
+// Record n goes to slot n % slot_count, its seq is 2n+1 while it is written
+// and 2n+2 once complete, write_count is bumped after that. Readers never
+// take a lock: they copy a slot and keep it only if seq did not change.
+// Layout changes that only append record fields keep the major version and
+// grow record_size, readers copy what they know about.
+
+#define ISP_STATS_SHM_PATH "/dev/shm/rkipc_isp_stats_%d"
+#define ISP_STATS_SHM_MAGIC 0x53505349 // "ISPS"
+#define ISP_STATS_SHM_VERSION 1
+#define ISP_STATS_SHM_CLOSED 0         // magic once the publisher went away
+#define ISP_STATS_SHM_DEFAULT_SLOTS 16
+
+#define ISP_STATS_FILE_MAGIC 0x46535349 // "ISSF", recorded stats file
+#define ISP_STATS_GRID_W 15
+#define ISP_STATS_GRID_H 15
+#define ISP_STATS_GRID_NUM (ISP_STATS_GRID_W * ISP_STATS_GRID_H)
+#define ISP_STATS_HIST_BINS 256
+
+// fixed size and naturally aligned, same layout on 32 and 64 bit
+typedef struct {
+	uint32_t frame_id;
+	uint32_t cam_id;
+	uint64_t timestamp_us; // CLOCK_MONOTONIC when published
+	float integration_time; // seconds
+	float analog_gain;
+	float digital_gain;
+	float isp_dgain;
+	int32_t iso;
+	uint32_t awb_converged;
+	float awb_gain[4]; // r, gr, gb, b
+	float awb_cct;
+	uint16_t grid_w;
+	uint16_t grid_h;
+	uint64_t af_fv_sum;
+	uint32_t hist[ISP_STATS_HIST_BINS];   // raw histogram
+	uint32_t af_fv[ISP_STATS_GRID_NUM];   // horizontal fv per af window
+	uint16_t luma[ISP_STATS_GRID_NUM];    // mean luma per ae window
+	uint16_t reserved;
+} isp_stats_record_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t record_size;
+	uint32_t slot_size;
+	uint32_t slot_count;
+	uint64_t write_count;
+} isp_stats_shm_header_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t reserved;
+} isp_stats_file_header_t;
+
+typedef struct isp_stats_shm isp_stats_shm_t;
+
+// publisher side
+isp_stats_shm_t *isp_stats_shm_create(const char *path, int slot_count);
+void isp_stats_shm_publish(isp_stats_shm_t *shm, const isp_stats_record_t *record);
+
+// reader side, starts with the next record published after open
+isp_stats_shm_t *isp_stats_shm_open(const char *path);
+// 1 a record was copied, 0 nothing new, -1 the publisher is gone and the
+// reader should reopen; *lost counts records overwritten before being read
+int isp_stats_shm_read(isp_stats_shm_t *shm, isp_stats_record_t *record, uint32_t *lost);
+
+// unmaps, the publisher also marks the file closed and removes it
+void isp_stats_shm_close(isp_stats_shm_t *shm);
+
+#endif
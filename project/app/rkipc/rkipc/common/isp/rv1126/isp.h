@@ -9,11 +9,16 @@ int rk_isp_get_frame_rate(int cam_id, int *value);
 int rk_isp_set_frame_rate(int cam_id, int value);
 int rk_isp_set_frame_rate_without_ini(int cam_id, int value);
 int rk_isp_set_from_ini(int cam_id);
+// not batched on this platform, settings still apply one by one
+int rk_isp_batch_begin(int cam_id);
+int rk_isp_batch_commit(int cam_id);
 int rk_isp_set_group_ldch_level_form_buffer(int cam_id, void *ldch_0, void *ldch_1, int ldch_size_0,
                                             int ldch_size_1);
 // isp scenario
 int rk_isp_get_scenario(int cam_id, const char **value);
 int rk_isp_set_scenario(int cam_id, const char *value);
+// scene switches are not measured on this platform, value is left empty
+int rk_isp_get_scene_stats(int cam_id, char *value, int size);
 // image adjustment
 int rk_isp_get_contrast(int cam_id, int *value);
 int rk_isp_set_contrast(int cam_id, int value);
@@ -0,0 +1,642 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Asynchronous logger behind the LOG_* macros. A logging thread only encodes the
+// call site and the raw arguments into its own single producer ring, strings by
+// value, and returns. The flush thread merges the rings in timestamp order,
+// formats the records and writes them to the console, syslog or a file, so a
+// slow console UART never stalls a stream thread. A full ring drops the record
+// and counts it instead of blocking. Records still in the rings are written out by
+// rkipc_log_deinit, which also runs at exit().
+//
+// With rate_burst set, every call site is rate limited on its own: rate_burst
+// messages back to back, then one per rate_interval_ms. The next message that gets
+// through reports how many were suppressed in between.
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+// syslog.h defines LOG_INFO and LOG_DEBUG as well, take its priorities first
+static const int g_syslog_priority[] = {LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG};
+#undef LOG_INFO
+#undef LOG_DEBUG
+
+#include "log.h"
+
+#define LOG_RING_MIN_SIZE 4096
+#define LOG_STR_MAX 512
+#define LOG_LINE_MAX 1024
+#define LOG_RECORD_PAD 0xffff
+
+int rkipc_log_async = 0;
+
+typedef struct {
+	uint16_t size; // whole record, LOG_RECORD_PAD marks the unused end of the buffer
+	uint16_t suppressed;
+	uint32_t reserved;
+	long long time_us;
+	rkipc_log_site_t *site;
+} log_record_t;
+
+typedef struct log_ring_s {
+	struct log_ring_s *next;
+	uint8_t *buf;
+	uint32_t size;
+	uint32_t head; // written by the owning thread
+	uint32_t tail; // written by the flush thread
+	uint32_t dropped;
+	uint32_t too_long; // arguments that do not fit in one record
+	int dead;
+} log_ring_t;
+
+static rkipc_log_config_t g_config;
+static pthread_mutex_t g_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static log_ring_t *g_rings;
+static pthread_key_t g_ring_key;
+static pthread_once_t g_ring_key_once = PTHREAD_ONCE_INIT;
+static __thread log_ring_t *t_ring;
+static pthread_t g_flush_tid;
+static int g_flush_run;
+static FILE *g_file;
+static char g_file_path[256];
+static long g_file_size;
+static int g_atexit_done;
+
+static long long log_now_us(clockid_t clock) {
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// GCRA: the site may log when its theoretical arrival time is no further than
+// burst intervals ahead of now, every message moves it one interval on
+int rkipc_log_site_allow(rkipc_log_site_t *site) {
+	long long now, tat, next;
+	int burst = g_config.rate_burst, interval = g_config.rate_interval_ms;
+	int suppressed;
+
+	if (burst <= 0 || interval <= 0)
+		return 1;
+	now = log_now_us(CLOCK_MONOTONIC) / 1000;
+	tat = __atomic_load_n(&site->tat_ms, __ATOMIC_RELAXED);
+	do {
+		if (tat - now > (long long)(burst - 1) * interval) {
+			__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+		next = (tat > now ? tat : now) + interval;
+	} while (!__atomic_compare_exchange_n(&site->tat_ms, &tat, next, 0, __ATOMIC_RELAXED,
+	                                      __ATOMIC_RELAXED));
+
+	// without the ring there is no record to carry the count, print it on its own
+	if (!rkipc_log_async && __atomic_load_n(&site->suppressed, __ATOMIC_RELAXED)) {
+		suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+		if (suppressed)
+			fprintf(stderr, "[%s][%s]:%d similar messages suppressed\n", site->tag, site->func,
+			        suppressed);
+	}
+
+	return 1;
+}
+
+// conversion of one printf spec: 'i' int, 'l' long, 'L' long long, 'd' double,
+// 'D' long double, 'p' pointer, 's' string, 0 for none or unsupported. *precision is -1
+// without one, LOG_PRECISION_STAR when it is the last star argument.
+#define LOG_PRECISION_STAR (-2)
+static char log_spec_type(const char **fmt, int *stars, int *precision) {
+	const char *p = *fmt;
+	int len = 0;
+
+	*stars = 0;
+	*precision = -1;
+	while (*p && strchr("-+ #0", *p))
+		p++;
+	for (int i = 0; i < 2; i++) {
+		if (*p == '*') {
+			(*stars)++;
+			p++;
+			if (i == 1)
+				*precision = LOG_PRECISION_STAR;
+		} else {
+			if (i == 1)
+				*precision = 0;
+			while (*p >= '0' && *p <= '9') {
+				if (i == 1 && *precision < LOG_STR_MAX)
+					*precision = *precision * 10 + *p - '0';
+				p++;
+			}
+		}
+		if (i == 0 && *p == '.')
+			p++;
+		else if (i == 0)
+			break;
+	}
+	while (*p && strchr("hlLqjzt", *p)) {
+		if (*p == 'l' || *p == 'q' || *p == 'L')
+			len++;
+		else if (*p == 'j')
+			len = 2;
+		else if (*p == 'z' || *p == 't')
+			len = sizeof(size_t) == sizeof(long long) ? 2 : 1;
+		p++;
+	}
+	*fmt = p + (*p ? 1 : 0);
+	switch (*p) {
+	case 'd':
+	case 'i':
+	case 'u':
+	case 'x':
+	case 'X':
+	case 'o':
+	case 'c':
+		return len >= 2 ? 'L' : len == 1 ? 'l' : 'i';
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		return len ? 'D' : 'd';
+	case 'p':
+		return 'p';
+	case 's':
+		return 's';
+	}
+
+	return 0;
+}
+
+static int log_put(uint8_t *dst, int room, const void *src, int size) {
+	if (size > room)
+		return -1;
+	memcpy(dst, src, size);
+
+	return size;
+}
+
+// encodes the arguments in the order the format consumes them
+static int log_encode(uint8_t *dst, int room, const char *fmt, va_list ap) {
+	int used = 0, ret = 0;
+
+	while ((fmt = strchr(fmt, '%'))) {
+		int stars, precision, star = -1;
+		char type;
+
+		if (fmt[1] == '%') {
+			fmt += 2;
+			continue;
+		}
+		fmt++;
+		type = log_spec_type(&fmt, &stars, &precision);
+		for (int i = 0; i < stars && ret >= 0; i++) {
+			star = va_arg(ap, int);
+			ret = log_put(dst + used, room - used, &star, sizeof(star));
+			used += ret;
+		}
+		if (ret < 0)
+			return -1;
+		// a negative precision argument is taken as if there was none
+		if (precision == LOG_PRECISION_STAR)
+			precision = star;
+		switch (type) {
+		case 'i': {
+			int v = va_arg(ap, int);
+			ret = log_put(dst + used, room - used, &v, sizeof(v));
+			break;
+		}
+		case 'l': {
+			long v = va_arg(ap, long);
+			ret = log_put(dst + used, room - used, &v, sizeof(v));
+			break;
+		}
+		case 'L': {
+			long long v = va_arg(ap, long long);
+			ret = log_put(dst + used, room - used, &v, sizeof(v));
+			break;
+		}
+		case 'd': {
+			double v = va_arg(ap, double);
+			ret = log_put(dst + used, room - used, &v, sizeof(v));
+			break;
+		}
+		case 'D': {
+			long double v = va_arg(ap, long double);
+			ret = log_put(dst + used, room - used, &v, sizeof(v));
+			break;
+		}
+		case 'p': {
+			void *v = va_arg(ap, void *);
+			ret = log_put(dst + used, room - used, &v, sizeof(v));
+			break;
+		}
+		case 's': {
+			const char *v = va_arg(ap, const char *);
+			uint16_t len;
+
+			if (!v)
+				v = "(null)";
+			// the string may be a buffer that is not terminated within its precision
+			len = strnlen(v, precision >= 0 && precision < LOG_STR_MAX ? precision
+			                                                            : LOG_STR_MAX);
+			// a long string is cut to what is left of the record rather than dropped
+			if (room - used >= (int)sizeof(len) && len > room - used - (int)sizeof(len))
+				len = room - used - sizeof(len);
+			ret = log_put(dst + used, room - used, &len, sizeof(len));
+			if (ret >= 0) {
+				used += ret;
+				ret = log_put(dst + used, room - used, v, len);
+			}
+			break;
+		}
+		default:
+			ret = 0;
+			break;
+		}
+		if (ret < 0)
+			return -1;
+		used += ret;
+	}
+
+	return used;
+}
+
+static const uint8_t *log_get(const uint8_t *src, void *v, int size) {
+	memcpy(v, src, size);
+
+	return src + size;
+}
+
+// formats a record the way printf would have, one conversion at a time
+static int log_format(char *line, int size, const log_record_t *rec) {
+	const rkipc_log_site_t *site = rec->site;
+	const uint8_t *arg = (const uint8_t *)(rec + 1);
+	const char *fmt = site->format;
+	int len;
+
+	len = snprintf(line, size, "[%s][%s]:", site->tag, site->func);
+	if (rec->suppressed && len < size)
+		len += snprintf(line + len, size - len, "(%d similar messages suppressed) ",
+		                rec->suppressed);
+	while (*fmt && len < size) {
+		const char *spec = strchr(fmt, '%');
+		char conv[32];
+		int star[2] = {0, 0}, stars, precision;
+		char type;
+
+		if (!spec) {
+			len += snprintf(line + len, size - len, "%s", fmt);
+			break;
+		}
+		len += snprintf(line + len, size - len, "%.*s", (int)(spec - fmt), fmt);
+		if (len >= size)
+			break;
+		if (spec[1] == '%') {
+			len += snprintf(line + len, size - len, "%%");
+			fmt = spec + 2;
+			continue;
+		}
+		fmt = spec + 1;
+		type = log_spec_type(&fmt, &stars, &precision);
+		if (fmt - spec >= (int)sizeof(conv))
+			break;
+		memcpy(conv, spec, fmt - spec);
+		conv[fmt - spec] = '\0';
+		for (int i = 0; i < stars; i++)
+			arg = log_get(arg, &star[i], sizeof(int));
+#define LOG_EMIT(v)                                                                                \
+	(stars == 2   ? snprintf(line + len, size - len, conv, star[0], star[1], v)                    \
+	 : stars == 1 ? snprintf(line + len, size - len, conv, star[0], v)                             \
+	              : snprintf(line + len, size - len, conv, v))
+		switch (type) {
+		case 'i': {
+			int v;
+			arg = log_get(arg, &v, sizeof(v));
+			len += LOG_EMIT(v);
+			break;
+		}
+		case 'l': {
+			long v;
+			arg = log_get(arg, &v, sizeof(v));
+			len += LOG_EMIT(v);
+			break;
+		}
+		case 'L': {
+			long long v;
+			arg = log_get(arg, &v, sizeof(v));
+			len += LOG_EMIT(v);
+			break;
+		}
+		case 'd': {
+			double v;
+			arg = log_get(arg, &v, sizeof(v));
+			len += LOG_EMIT(v);
+			break;
+		}
+		case 'D': {
+			long double v;
+			arg = log_get(arg, &v, sizeof(v));
+			len += LOG_EMIT(v);
+			break;
+		}
+		case 'p': {
+			void *v;
+			arg = log_get(arg, &v, sizeof(v));
+			len += LOG_EMIT(v);
+			break;
+		}
+		case 's': {
+			char v[LOG_STR_MAX + 1];
+			uint16_t n;
+			arg = log_get(arg, &n, sizeof(n));
+			memcpy(v, arg, n);
+			v[n] = '\0';
+			arg += n;
+			len += LOG_EMIT(v);
+			break;
+		}
+		default:
+			// %n and friends are not replayed
+			len += snprintf(line + len, size - len, "%s", conv);
+			break;
+		}
+#undef LOG_EMIT
+	}
+	if (len >= size) {
+		// keep the line break of a truncated message
+		len = size - 1;
+		line[len - 1] = '\n';
+	}
+
+	return len;
+}
+
+static void log_ring_release(void *arg) {
+	log_ring_t *ring = (log_ring_t *)arg;
+
+	// the flush thread frees it once drained
+	__atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void log_ring_key_create(void) { pthread_key_create(&g_ring_key, log_ring_release); }
+
+static log_ring_t *log_ring_get(void) {
+	log_ring_t *ring = t_ring;
+	uint32_t size = LOG_RING_MIN_SIZE;
+
+	if (ring)
+		return ring;
+	while (size < (uint32_t)g_config.ring_size)
+		size <<= 1;
+	ring = (log_ring_t *)calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+	ring->buf = (uint8_t *)malloc(size);
+	if (!ring->buf) {
+		free(ring);
+		return NULL;
+	}
+	ring->size = size;
+	pthread_setspecific(g_ring_key, ring);
+	pthread_mutex_lock(&g_rings_mutex);
+	ring->next = g_rings;
+	g_rings = ring;
+	pthread_mutex_unlock(&g_rings_mutex);
+	t_ring = ring;
+
+	return ring;
+}
+
+void rkipc_log_write(rkipc_log_site_t *site, ...) {
+	long long buf[LOG_LINE_MAX / sizeof(long long)]; // aligned for the record header
+	uint8_t *tmp = (uint8_t *)buf;
+	log_record_t *rec = (log_record_t *)buf;
+	log_ring_t *ring = log_ring_get();
+	uint32_t head, tail, offset, room;
+	va_list ap;
+	int args;
+
+	if (!ring)
+		return;
+	va_start(ap, site);
+	args = log_encode(tmp + sizeof(*rec), sizeof(buf) - sizeof(*rec), site->format, ap);
+	va_end(ap);
+	if (args < 0) {
+		__atomic_add_fetch(&ring->too_long, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	memset(rec, 0, sizeof(*rec));
+	rec->size = (sizeof(*rec) + args + 7) & ~7;
+	rec->time_us = log_now_us(CLOCK_REALTIME);
+	rec->site = site;
+	if (__atomic_load_n(&site->suppressed, __ATOMIC_RELAXED)) {
+		int suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+		rec->suppressed = suppressed > 0xffff ? 0xffff : suppressed;
+	}
+
+	head = ring->head;
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	offset = head & (ring->size - 1);
+	room = ring->size - (head - tail);
+	// a record never wraps, the rest of the buffer is padded instead
+	if (ring->size - offset < rec->size) {
+		if (room < ring->size - offset + rec->size) {
+			__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		*(uint16_t *)(ring->buf + offset) = LOG_RECORD_PAD;
+		head += ring->size - offset;
+		offset = 0;
+	} else if (room < rec->size) {
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	memcpy(ring->buf + offset, tmp, sizeof(*rec) + args);
+	__atomic_store_n(&ring->head, head + rec->size, __ATOMIC_RELEASE);
+}
+
+static void log_output(int level, const char *line, int len) {
+	char stamp[32];
+	struct tm tm;
+	time_t now;
+
+	switch (g_config.sink) {
+	case RKIPC_LOG_SINK_SYSLOG:
+		syslog(g_syslog_priority[level < 0 ? 0 : level > 3 ? 3 : level], "%s", line);
+		break;
+	case RKIPC_LOG_SINK_FILE:
+		if (!g_file)
+			break;
+		now = time(NULL);
+		localtime_r(&now, &tm);
+		strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S ", &tm);
+		fputs(stamp, g_file);
+		fwrite(line, 1, len, g_file);
+		g_file_size += strlen(stamp) + len;
+		if (g_config.file_size_kb > 0 && g_file_size >= g_config.file_size_kb * 1024L) {
+			char old[256];
+
+			fclose(g_file);
+			snprintf(old, sizeof(old), "%s.1", g_config.file);
+			rename(g_config.file, old);
+			g_file = fopen(g_config.file, "w");
+			g_file_size = 0;
+		}
+		break;
+	default:
+		fwrite(line, 1, len, stderr);
+		break;
+	}
+}
+
+// oldest pending record over all rings, NULL when they are empty
+static log_record_t *log_ring_peek(log_ring_t *ring) {
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	uint8_t *rec;
+
+	while (ring->tail != head) {
+		rec = ring->buf + (ring->tail & (ring->size - 1));
+		if (*(uint16_t *)rec != LOG_RECORD_PAD)
+			return (log_record_t *)rec;
+		__atomic_store_n(&ring->tail, ring->tail + ring->size - (ring->tail & (ring->size - 1)),
+		                 __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+// records are formatted under g_rings_mutex and written after it is released, a
+// slow sink must not block a thread creating its ring
+static int log_flush(void) {
+	char line[LOG_LINE_MAX];
+	int count = 0, level, len;
+	uint32_t dropped = 0, too_long = 0;
+
+	for (;;) {
+		log_ring_t *oldest = NULL;
+		log_record_t *rec = NULL;
+
+		pthread_mutex_lock(&g_rings_mutex);
+		for (log_ring_t *ring = g_rings; ring; ring = ring->next) {
+			log_record_t *r = log_ring_peek(ring);
+
+			if (r && (!rec || r->time_us < rec->time_us)) {
+				rec = r;
+				oldest = ring;
+			}
+		}
+		if (!rec) {
+			pthread_mutex_unlock(&g_rings_mutex);
+			break;
+		}
+		level = rec->site->level;
+		len = log_format(line, sizeof(line), rec);
+		__atomic_store_n(&oldest->tail, oldest->tail + rec->size, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&g_rings_mutex);
+		log_output(level, line, len);
+		count++;
+	}
+	pthread_mutex_lock(&g_rings_mutex);
+	for (log_ring_t **pp = &g_rings; *pp;) {
+		log_ring_t *ring = *pp;
+
+		dropped += __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+		too_long += __atomic_exchange_n(&ring->too_long, 0, __ATOMIC_RELAXED);
+		if (__atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE) && !log_ring_peek(ring)) {
+			*pp = ring->next;
+			free(ring->buf);
+			free(ring);
+		} else {
+			pp = &ring->next;
+		}
+	}
+	pthread_mutex_unlock(&g_rings_mutex);
+	if (dropped) {
+		len = snprintf(line, sizeof(line), "[log.c][%s]:%u messages dropped, ring full\n",
+		               __FUNCTION__, dropped);
+		log_output(LOG_LEVEL_WARN, line, len);
+	}
+	if (too_long) {
+		len = snprintf(line, sizeof(line), "[log.c][%s]:%u messages dropped, too long\n",
+		               __FUNCTION__, too_long);
+		log_output(LOG_LEVEL_WARN, line, len);
+	}
+	if (count && g_file)
+		fflush(g_file);
+
+	return count;
+}
+
+static void log_atexit(void) { rkipc_log_deinit(); }
+
+static void *log_flush_thread(void *arg) {
+	prctl(PR_SET_NAME, "rkipc_log", 0, 0, 0);
+	while (__atomic_load_n(&g_flush_run, __ATOMIC_ACQUIRE)) {
+		log_flush();
+		usleep(g_config.flush_ms * 1000);
+	}
+	log_flush();
+
+	return NULL;
+}
+
+int rkipc_log_init(const rkipc_log_config_t *config) {
+	if (rkipc_log_async)
+		return 0;
+	g_config = *config;
+	// the caller's string may not outlive the init
+	snprintf(g_file_path, sizeof(g_file_path), "%s", config->file ? config->file : "");
+	g_config.file = g_file_path;
+	if (g_config.flush_ms <= 0)
+		g_config.flush_ms = 20;
+	if (g_config.sink == RKIPC_LOG_SINK_FILE) {
+		g_file = fopen(g_config.file, "a");
+		if (!g_file) {
+			fprintf(stderr, "[log.c][%s]:open %s fail, log to the console\n", __FUNCTION__,
+			        g_config.file);
+			g_config.sink = RKIPC_LOG_SINK_CONSOLE;
+		} else {
+			g_file_size = ftell(g_file);
+		}
+	} else if (g_config.sink == RKIPC_LOG_SINK_SYSLOG) {
+		openlog("rkipc", LOG_PID, LOG_USER);
+	}
+	pthread_once(&g_ring_key_once, log_ring_key_create);
+	g_flush_run = 1;
+	if (pthread_create(&g_flush_tid, NULL, log_flush_thread, NULL))
+		return -1;
+	__atomic_store_n(&rkipc_log_async, 1, __ATOMIC_RELEASE);
+	if (!g_atexit_done) {
+		atexit(log_atexit);
+		g_atexit_done = 1;
+	}
+
+	return 0;
+}
+
+// rings of running threads stay allocated, a late call may still be writing to one
+int rkipc_log_deinit(void) {
+	if (!rkipc_log_async)
+		return 0;
+	__atomic_store_n(&rkipc_log_async, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&g_flush_run, 0, __ATOMIC_RELEASE);
+	pthread_join(g_flush_tid, NULL);
+	if (g_file) {
+		fclose(g_file);
+		g_file = NULL;
+	}
+	if (g_config.sink == RKIPC_LOG_SINK_SYSLOG)
+		closelog();
+
+	return 0;
+}
@@ -17,54 +17,69 @@
 
 extern int enable_minilog;
 extern int rkipc_log_level;
+extern int rkipc_log_async;
 
 #define LOG_LEVEL_ERROR 0
 #define LOG_LEVEL_WARN 1
 #define LOG_LEVEL_INFO 2
 #define LOG_LEVEL_DEBUG 3
 
+// calls above this level are compiled out, e.g. add_definitions(-DRKIPC_LOG_COMPILE_LEVEL=2)
+// drops LOG_DEBUG from a release build
+#ifndef RKIPC_LOG_COMPILE_LEVEL
+#define RKIPC_LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
 #ifndef LOG_TAG
 #define LOG_TAG "rkipc_server"
 #endif // LOG_TAG
 
-#define LOG_INFO(format, ...)                                                                      \
-	do {                                                                                           \
-		if (rkipc_log_level < LOG_LEVEL_INFO)                                                      \
-			break;                                                                                 \
-		if (enable_minilog)                                                                        \
-			minilog_info("[%s][%s]:" format, LOG_TAG, __FUNCTION__, ##__VA_ARGS__);                \
-		else                                                                                       \
-			fprintf(stderr, "[%s][%s]:" format, LOG_TAG, __FUNCTION__, ##__VA_ARGS__);             \
-	} while (0)
+// one per call site, the rate limit state is only touched by log.c
+typedef struct {
+	const char *tag;
+	const char *func;
+	const char *format;
+	int level;
+	long long tat_ms;
+	int suppressed;
+} rkipc_log_site_t;
 
-#define LOG_WARN(format, ...)                                                                      \
-	do {                                                                                           \
-		if (rkipc_log_level < LOG_LEVEL_WARN)                                                      \
-			break;                                                                                 \
-		if (enable_minilog)                                                                        \
-			minilog_warn("[%s][%s]:" format, LOG_TAG, __FUNCTION__, ##__VA_ARGS__);                \
-		else                                                                                       \
-			fprintf(stderr, "[%s][%s]:" format, LOG_TAG, __FUNCTION__, ##__VA_ARGS__);             \
-	} while (0)
+enum { RKIPC_LOG_SINK_CONSOLE, RKIPC_LOG_SINK_SYSLOG, RKIPC_LOG_SINK_FILE };
 
-#define LOG_ERROR(format, ...)                                                                     \
-	do {                                                                                           \
-		if (rkipc_log_level < LOG_LEVEL_ERROR)                                                     \
-			break;                                                                                 \
-		if (enable_minilog)                                                                        \
-			minilog_error("[%s][%s]:" format, LOG_TAG, __FUNCTION__, ##__VA_ARGS__);               \
-		else                                                                                       \
-			fprintf(stderr, "[%s][%s]:" format, LOG_TAG, __FUNCTION__, ##__VA_ARGS__);             \
-	} while (0)
+typedef struct {
+	int sink;
+	const char *file;
+	int file_size_kb;     // rotated to <file>.1 when reached, 0 for no limit
+	int ring_size;        // bytes per logging thread
+	int flush_ms;         // flush thread period
+	int rate_burst;       // messages a call site may log back to back, 0 for no limit
+	int rate_interval_ms; // then one message per interval
+} rkipc_log_config_t;
+
+// until rkipc_log_init, and with minilog, calls print synchronously as before
+int rkipc_log_init(const rkipc_log_config_t *config);
+int rkipc_log_deinit(void);
+int rkipc_log_site_allow(rkipc_log_site_t *site);
+void rkipc_log_write(rkipc_log_site_t *site, ...);
 
-#define LOG_DEBUG(format, ...)                                                                     \
+#define RKIPC_LOG(level, minilog_func, format, ...)                                                \
 	do {                                                                                           \
-		if (rkipc_log_level < LOG_LEVEL_DEBUG)                                                     \
+		static rkipc_log_site_t __rkipc_log_site = {LOG_TAG, __FUNCTION__, format, level, 0, 0};   \
+		if (level > RKIPC_LOG_COMPILE_LEVEL || rkipc_log_level < level)                            \
+			break;                                                                                 \
+		if (!rkipc_log_site_allow(&__rkipc_log_site))                                              \
 			break;                                                                                 \
 		if (enable_minilog)                                                                        \
-			minilog_debug("[%s][%s]:" format, LOG_TAG, __FUNCTION__, ##__VA_ARGS__);               \
+			minilog_func("[%s][%s]:" format, LOG_TAG, __FUNCTION__, ##__VA_ARGS__);                \
+		else if (rkipc_log_async)                                                                  \
+			rkipc_log_write(&__rkipc_log_site, ##__VA_ARGS__);                                     \
 		else                                                                                       \
 			fprintf(stderr, "[%s][%s]:" format, LOG_TAG, __FUNCTION__, ##__VA_ARGS__);             \
 	} while (0)
 
+#define LOG_INFO(format, ...) RKIPC_LOG(LOG_LEVEL_INFO, minilog_info, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) RKIPC_LOG(LOG_LEVEL_WARN, minilog_warn, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) RKIPC_LOG(LOG_LEVEL_ERROR, minilog_error, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...) RKIPC_LOG(LOG_LEVEL_DEBUG, minilog_debug, format, ##__VA_ARGS__)
+
 #endif
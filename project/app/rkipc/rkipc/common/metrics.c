@@ -0,0 +1,441 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Metrics registry for the stream pipes. Metrics are registered once at module
+// init, under a mutex, and never freed, so the pointers a module keeps stay
+// valid for the life of the process. Updates are single atomic operations and
+// never take a lock, the exporter thread reads them while they are updated.
+//
+// The exporter speaks HTTP/1.0 on a UNIX socket and, optionally, on a local TCP
+// port, any GET of /metrics returns the Prometheus text format:
+//   curl --unix-socket /var/tmp/rkipc_metrics http://localhost/metrics
+//   wget -qO- http://127.0.0.1:<port>/metrics
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "metrics.c"
+
+#define METRIC_NAME_MAX 64
+#define METRIC_LABELS_MAX 64
+#define METRICS_REQUEST_MAX 1024
+#define METRICS_REQUEST_TIMEOUT_MS 1000
+#define METRICS_DUMP_INIT_SIZE (16 * 1024)
+
+enum { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM };
+
+struct rkipc_metric {
+	int type;
+	char name[METRIC_NAME_MAX];
+	char labels[METRIC_LABELS_MAX];
+	const char *help;
+	long long value; // counter and gauge
+	long long sum;   // histogram
+	int bucket_count;
+	long long bounds[RKIPC_METRIC_MAX_BUCKETS];
+	long long buckets[RKIPC_METRIC_MAX_BUCKETS + 1]; // not cumulative, the last one is +Inf
+};
+
+static pthread_mutex_t g_metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rkipc_metric_t *g_metrics[RKIPC_METRICS_MAX];
+static int g_metric_num; // published with release once the slot is filled
+static int g_metrics_enable;
+static int g_listen_fd[2] = {-1, -1};
+static pthread_t g_exporter_tid;
+static int g_exporter_run;
+static char g_unix_path[108];
+
+const long long rkipc_metric_us_bounds[RKIPC_METRIC_US_BOUNDS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 1000000};
+
+long long rkipc_metrics_now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static rkipc_metric_t *metric_register(int type, const char *name, const char *labels,
+                                       const char *help, const long long *bounds, int count) {
+	rkipc_metric_t *metric = NULL;
+	int i;
+
+	if (!__atomic_load_n(&g_metrics_enable, __ATOMIC_ACQUIRE) || !name)
+		return NULL;
+	if (!labels)
+		labels = "";
+	pthread_mutex_lock(&g_metrics_mutex);
+	for (i = 0; i < g_metric_num; i++) {
+		if (!strcmp(g_metrics[i]->name, name) && !strcmp(g_metrics[i]->labels, labels)) {
+			metric = g_metrics[i]->type == type ? g_metrics[i] : NULL;
+			if (!metric)
+				LOG_ERROR("%s{%s} is registered with another type\n", name, labels);
+			goto out;
+		}
+	}
+	if (g_metric_num >= RKIPC_METRICS_MAX) {
+		LOG_ERROR("registry full, %s{%s} is not exported\n", name, labels);
+		goto out;
+	}
+	metric = calloc(1, sizeof(*metric));
+	if (!metric)
+		goto out;
+	metric->type = type;
+	snprintf(metric->name, sizeof(metric->name), "%s", name);
+	snprintf(metric->labels, sizeof(metric->labels), "%s", labels);
+	metric->help = help;
+	if (type == METRIC_HISTOGRAM) {
+		metric->bucket_count = count < RKIPC_METRIC_MAX_BUCKETS ? count : RKIPC_METRIC_MAX_BUCKETS;
+		memcpy(metric->bounds, bounds, metric->bucket_count * sizeof(long long));
+	}
+	g_metrics[g_metric_num] = metric;
+	__atomic_store_n(&g_metric_num, g_metric_num + 1, __ATOMIC_RELEASE);
+out:
+	pthread_mutex_unlock(&g_metrics_mutex);
+
+	return metric;
+}
+
+rkipc_metric_t *rkipc_metric_counter(const char *name, const char *labels, const char *help) {
+	return metric_register(METRIC_COUNTER, name, labels, help, NULL, 0);
+}
+
+rkipc_metric_t *rkipc_metric_gauge(const char *name, const char *labels, const char *help) {
+	return metric_register(METRIC_GAUGE, name, labels, help, NULL, 0);
+}
+
+rkipc_metric_t *rkipc_metric_histogram(const char *name, const char *labels, const char *help,
+                                       const long long *bounds, int count) {
+	if (!bounds || count <= 0)
+		return NULL;
+	return metric_register(METRIC_HISTOGRAM, name, labels, help, bounds, count);
+}
+
+void rkipc_metric_add(rkipc_metric_t *metric, long long value) {
+	if (metric)
+		__atomic_fetch_add(&metric->value, value, __ATOMIC_RELAXED);
+}
+
+void rkipc_metric_set(rkipc_metric_t *metric, long long value) {
+	if (metric)
+		__atomic_store_n(&metric->value, value, __ATOMIC_RELAXED);
+}
+
+void rkipc_metric_observe(rkipc_metric_t *metric, long long value) {
+	int i;
+
+	if (!metric)
+		return;
+	for (i = 0; i < metric->bucket_count; i++) {
+		if (value <= metric->bounds[i])
+			break;
+	}
+	__atomic_fetch_add(&metric->buckets[i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&metric->sum, value, __ATOMIC_RELAXED);
+}
+
+long long rkipc_metric_get(rkipc_metric_t *metric) {
+	long long count = 0;
+
+	if (!metric)
+		return 0;
+	if (metric->type != METRIC_HISTOGRAM)
+		return __atomic_load_n(&metric->value, __ATOMIC_RELAXED);
+	for (int i = 0; i <= metric->bucket_count; i++)
+		count += __atomic_load_n(&metric->buckets[i], __ATOMIC_RELAXED);
+
+	return count;
+}
+
+// appends like snprintf, len keeps growing past size so the caller learns what it needs
+static int dump_printf(char *buf, int size, int len, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+static int dump_printf(char *buf, int size, int len, const char *format, ...) {
+	va_list ap;
+	int ret;
+
+	va_start(ap, format);
+	ret = vsnprintf(len < size ? buf + len : NULL, len < size ? size - len : 0, format, ap);
+	va_end(ap);
+
+	return ret > 0 ? len + ret : len;
+}
+
+static int dump_metric(char *buf, int size, int len, rkipc_metric_t *metric) {
+	const char *sep = metric->labels[0] ? "," : "";
+	long long count = 0;
+	int i;
+
+	if (metric->type != METRIC_HISTOGRAM) {
+		if (metric->labels[0])
+			return dump_printf(buf, size, len, "%s{%s} %lld\n", metric->name, metric->labels,
+			                   __atomic_load_n(&metric->value, __ATOMIC_RELAXED));
+		return dump_printf(buf, size, len, "%s %lld\n", metric->name,
+		                   __atomic_load_n(&metric->value, __ATOMIC_RELAXED));
+	}
+	for (i = 0; i <= metric->bucket_count; i++) {
+		count += __atomic_load_n(&metric->buckets[i], __ATOMIC_RELAXED);
+		if (i < metric->bucket_count)
+			len = dump_printf(buf, size, len, "%s_bucket{%s%sle=\"%lld\"} %lld\n", metric->name,
+			                  metric->labels, sep, metric->bounds[i], count);
+		else
+			len = dump_printf(buf, size, len, "%s_bucket{%s%sle=\"+Inf\"} %lld\n", metric->name,
+			                  metric->labels, sep, count);
+	}
+	if (metric->labels[0]) {
+		len = dump_printf(buf, size, len, "%s_sum{%s} %lld\n", metric->name, metric->labels,
+		                  __atomic_load_n(&metric->sum, __ATOMIC_RELAXED));
+		return dump_printf(buf, size, len, "%s_count{%s} %lld\n", metric->name, metric->labels,
+		                   count);
+	}
+	len = dump_printf(buf, size, len, "%s_sum %lld\n", metric->name,
+	                  __atomic_load_n(&metric->sum, __ATOMIC_RELAXED));
+
+	return dump_printf(buf, size, len, "%s_count %lld\n", metric->name, count);
+}
+
+int rkipc_metrics_dump(char *buf, int size) {
+	static const char *type_name[] = {"counter", "gauge", "histogram"};
+	int num = __atomic_load_n(&g_metric_num, __ATOMIC_ACQUIRE);
+	int len = 0;
+	int i, j;
+
+	if (buf && size > 0)
+		buf[0] = '\0';
+	else
+		size = 0;
+	// the format wants every sample of a family together under one HELP and TYPE
+	for (i = 0; i < num; i++) {
+		for (j = 0; j < i; j++) {
+			if (!strcmp(g_metrics[j]->name, g_metrics[i]->name))
+				break;
+		}
+		if (j < i)
+			continue;
+		if (g_metrics[i]->help)
+			len = dump_printf(buf, size, len, "# HELP %s %s\n", g_metrics[i]->name,
+			                  g_metrics[i]->help);
+		len = dump_printf(buf, size, len, "# TYPE %s %s\n", g_metrics[i]->name,
+		                  type_name[g_metrics[i]->type]);
+		for (j = i; j < num; j++) {
+			if (!strcmp(g_metrics[j]->name, g_metrics[i]->name))
+				len = dump_metric(buf, size, len, g_metrics[j]);
+		}
+	}
+
+	return len;
+}
+
+static int metrics_listen_unix(const char *path) {
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -1;
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	unlink(path);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || chmod(path, 0666) < 0 ||
+	    listen(fd, 4) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int metrics_listen_tcp(const char *ip, int port) {
+	struct sockaddr_in addr;
+	int fd, on = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, ip, &addr.sin_addr) != 1)
+		return -1;
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int metrics_send(int fd, const char *buf, int len) {
+	int ret;
+
+	while (len > 0) {
+		ret = send(fd, buf, len, MSG_NOSIGNAL);
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+// one short request at a time, a scrape is far cheaper than the timeout, which also
+// bounds a client that stops reading the answer
+static void metrics_serve(int fd, char **dump, int *dump_size) {
+	struct timeval tv = {METRICS_REQUEST_TIMEOUT_MS / 1000,
+	                     (METRICS_REQUEST_TIMEOUT_MS % 1000) * 1000};
+	char request[METRICS_REQUEST_MAX], header[128];
+	int len = 0, ret;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	while (len < (int)sizeof(request) - 1) {
+		ret = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+		if (ret <= 0)
+			break;
+		len += ret;
+		request[len] = '\0';
+		if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+			break;
+	}
+	request[len] = '\0';
+	if (strncmp(request, "GET /metrics", 12) ||
+	    (request[12] != ' ' && request[12] != '?' && request[12] != '\r')) {
+		static const char not_found[] = "HTTP/1.0 404 Not Found\r\n"
+		                                "Content-Length: 0\r\n"
+		                                "Connection: close\r\n\r\n";
+		metrics_send(fd, not_found, sizeof(not_found) - 1);
+		return;
+	}
+
+	len = rkipc_metrics_dump(*dump, *dump_size);
+	if (len >= *dump_size) {
+		char *bigger = realloc(*dump, len + 1);
+
+		if (bigger) {
+			*dump = bigger;
+			*dump_size = len + 1;
+			len = rkipc_metrics_dump(*dump, *dump_size);
+		}
+		if (len >= *dump_size)
+			len = *dump_size - 1;
+	}
+	snprintf(header, sizeof(header),
+	         "HTTP/1.0 200 OK\r\n"
+	         "Content-Type: text/plain; version=0.0.4\r\n"
+	         "Content-Length: %d\r\n"
+	         "Connection: close\r\n\r\n",
+	         len);
+	if (!metrics_send(fd, header, strlen(header)))
+		metrics_send(fd, *dump, len);
+}
+
+static void *metrics_exporter_thread(void *arg) {
+	struct pollfd fds[2];
+	int dump_size = METRICS_DUMP_INIT_SIZE;
+	char *dump = malloc(dump_size);
+	int nfds, fd, i;
+
+	prctl(PR_SET_NAME, "rkipc_metrics", 0, 0, 0);
+	if (!dump)
+		return NULL;
+	while (__atomic_load_n(&g_exporter_run, __ATOMIC_ACQUIRE)) {
+		nfds = 0;
+		for (i = 0; i < 2; i++) {
+			if (g_listen_fd[i] < 0)
+				continue;
+			fds[nfds].fd = g_listen_fd[i];
+			fds[nfds].events = POLLIN;
+			nfds++;
+		}
+		if (poll(fds, nfds, 200) <= 0)
+			continue;
+		for (i = 0; i < nfds; i++) {
+			if (!(fds[i].revents & POLLIN))
+				continue;
+			fd = accept(fds[i].fd, NULL, NULL);
+			if (fd < 0)
+				continue;
+			metrics_serve(fd, &dump, &dump_size);
+			close(fd);
+		}
+	}
+	free(dump);
+
+	return NULL;
+}
+
+int rkipc_metrics_init(const rkipc_metrics_config_t *config) {
+	if (__atomic_load_n(&g_metrics_enable, __ATOMIC_ACQUIRE))
+		return 0;
+	if (config->unix_path && config->unix_path[0]) {
+		snprintf(g_unix_path, sizeof(g_unix_path), "%s", config->unix_path);
+		g_listen_fd[0] = metrics_listen_unix(g_unix_path);
+		if (g_listen_fd[0] < 0)
+			LOG_ERROR("listen on %s fail\n", g_unix_path);
+	}
+	if (config->http_port > 0) {
+		const char *addr = config->http_addr ? config->http_addr : "127.0.0.1";
+
+		g_listen_fd[1] = metrics_listen_tcp(addr, config->http_port);
+		if (g_listen_fd[1] < 0)
+			LOG_ERROR("listen on %s:%d fail\n", addr, config->http_port);
+	}
+	// metrics are still registered and updated without an exporter,
+	// rkipc_metrics_dump can read them
+	__atomic_store_n(&g_metrics_enable, 1, __ATOMIC_RELEASE);
+	if (g_listen_fd[0] < 0 && g_listen_fd[1] < 0)
+		return 0;
+	g_exporter_run = 1;
+	if (pthread_create(&g_exporter_tid, NULL, metrics_exporter_thread, NULL)) {
+		g_exporter_run = 0;
+		LOG_ERROR("create exporter thread fail\n");
+		return -1;
+	}
+	LOG_INFO("exporter on %s, tcp port %d\n", g_listen_fd[0] >= 0 ? g_unix_path : "none",
+	         g_listen_fd[1] >= 0 ? config->http_port : 0);
+
+	return 0;
+}
+
+// registered metrics stay valid, only the exporter stops
+int rkipc_metrics_deinit(void) {
+	if (g_exporter_run) {
+		__atomic_store_n(&g_exporter_run, 0, __ATOMIC_RELEASE);
+		pthread_join(g_exporter_tid, NULL);
+	}
+	if (g_listen_fd[0] >= 0) {
+		close(g_listen_fd[0]);
+		unlink(g_unix_path);
+		g_listen_fd[0] = -1;
+	}
+	if (g_listen_fd[1] >= 0) {
+		close(g_listen_fd[1]);
+		g_listen_fd[1] = -1;
+	}
+
+	return 0;
+}
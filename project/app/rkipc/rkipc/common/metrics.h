@@ -0,0 +1,53 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef _RK_METRICS_H_
+#define _RK_METRICS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RKIPC_METRICS_MAX 256
+#define RKIPC_METRIC_MAX_BUCKETS 16
+#define RKIPC_METRIC_US_BOUNDS 12
+
+typedef struct rkipc_metric rkipc_metric_t;
+
+typedef struct {
+	const char *unix_path; // HTTP over a UNIX socket, NULL or "" to disable
+	const char *http_addr; // HTTP over TCP, only used with http_port
+	int http_port;         // 0 to disable
+} rkipc_metrics_config_t;
+
+// registration is only possible after rkipc_metrics_init and returns NULL otherwise,
+// NULL is a valid metric and every update on it is a no-op. Registering the same
+// name and labels twice returns the same metric. Labels are already formatted,
+// e.g. "chn=\"0\"", or NULL.
+int rkipc_metrics_init(const rkipc_metrics_config_t *config);
+int rkipc_metrics_deinit(void);
+rkipc_metric_t *rkipc_metric_counter(const char *name, const char *labels, const char *help);
+rkipc_metric_t *rkipc_metric_gauge(const char *name, const char *labels, const char *help);
+// bounds are the inclusive upper bounds of each bucket in ascending order, +Inf is implied
+rkipc_metric_t *rkipc_metric_histogram(const char *name, const char *labels, const char *help,
+                                       const long long *bounds, int count);
+
+// updates are lock free and may be called from any thread
+void rkipc_metric_add(rkipc_metric_t *metric, long long value);
+void rkipc_metric_set(rkipc_metric_t *metric, long long value);
+void rkipc_metric_observe(rkipc_metric_t *metric, long long value);
+long long rkipc_metric_get(rkipc_metric_t *metric);
+#define rkipc_metric_inc(metric) rkipc_metric_add(metric, 1)
+#define rkipc_metric_dec(metric) rkipc_metric_add(metric, -1)
+
+// Prometheus text exposition format, returns the length it needs like snprintf
+int rkipc_metrics_dump(char *buf, int size);
+long long rkipc_metrics_now_us(void);
+// 100 us to 1 s, for the time a frame spends in one stage of the pipe
+extern const long long rkipc_metric_us_bounds[RKIPC_METRIC_US_BOUNDS];
+
+#ifdef __cplusplus
+}
+#endif
+#endif
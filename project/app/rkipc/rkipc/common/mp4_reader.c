@@ -0,0 +1,788 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Demuxer for the recordings of rkipc, shared by the keyframe index and RTSP playback.
+// Opening or seeking only reads boxes, a sample is read when it is asked for.
+#include "common.h"
+#include "mp4_reader.h"
+
+#include <sys/stat.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "mp4_reader.c"
+
+#define MP4_MOOV_MAX (16 * 1024 * 1024)
+#define MP4_MOOF_MAX (1024 * 1024)
+
+enum { MP4_VIDEO = 0, MP4_AUDIO, MP4_META, MP4_TRACK_NUM };
+
+typedef struct {
+	uint32_t track_id; // 0 for a track the file does not have
+	uint32_t timescale;
+	uint32_t trex_duration;
+	uint32_t trex_size;
+	uint32_t trex_flags;
+	const unsigned char *stts, *stss, *stsz, *stsc, *stco;
+	int stts_size, stss_size, stsz_size, stsc_size, stco_size, co64;
+	uint64_t first_dts; // after the sample tables, where fragments go on
+	uint64_t next_dts;  // for a fragment without tfdt
+} mp4_track_s;
+
+typedef struct {
+	rkipc_mp4_sample_s *sample;
+	int num;
+	int cap;
+} mp4_list_s;
+
+struct rkipc_mp4_reader {
+	int fd;
+	off_t file_size;
+	unsigned char *moov;
+	rkipc_mp4_info_s info;
+	mp4_track_s track[MP4_TRACK_NUM];
+	mp4_list_s table;    // from the sample tables
+	mp4_list_s fragment; // of the last moof read
+	mp4_list_s *list;    // next returns from this one
+	int pos;
+	off_t first_box; // after the moov, fragments follow it
+	off_t next_box;
+	int video_skip; // video tracks before the one read
+	int metadata;   // the metadata track is read too
+};
+
+static uint32_t mp4_be16(const unsigned char *p) { return (p[0] << 8) | p[1]; }
+
+static uint32_t mp4_be32(const unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t mp4_be64(const unsigned char *p) {
+	return ((uint64_t)mp4_be32(p) << 32) | mp4_be32(p + 4);
+}
+
+static int64_t mp4_us(uint64_t time, uint32_t timescale) {
+	return (int64_t)(time / timescale * 1000000 + time % timescale * 1000000 / timescale);
+}
+
+static int mp4_push(mp4_list_s *list, int which, int key, uint64_t dts, uint32_t timescale,
+                    uint64_t offset, uint32_t size) {
+	rkipc_mp4_sample_s *sample;
+	int cap;
+
+	if (list->num == list->cap) {
+		cap = list->cap ? list->cap * 2 : 256;
+		sample = realloc(list->sample, cap * sizeof(*sample));
+		if (!sample)
+			return -1;
+		list->sample = sample;
+		list->cap = cap;
+	}
+	sample = &list->sample[list->num++];
+	sample->time_us = mp4_us(dts, timescale);
+	sample->offset = offset;
+	sample->size = size;
+	sample->audio = which == MP4_AUDIO;
+	sample->key = key;
+	sample->metadata = which == MP4_META;
+
+	return 0;
+}
+
+// by time, video, audio and metadata, then by position in the file
+static int mp4_compare(const void *a, const void *b) {
+	const rkipc_mp4_sample_s *x = a, *y = b;
+
+	if (x->time_us != y->time_us)
+		return x->time_us < y->time_us ? -1 : 1;
+	if (x->audio != y->audio || x->metadata != y->metadata)
+		return (x->audio + 2 * x->metadata) - (y->audio + 2 * y->metadata);
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+// first child box of a type, *size gets the size of its body
+static const unsigned char *mp4_child(const unsigned char *p, int len, const char *type,
+                                      int *size) {
+	uint32_t box;
+
+	for (int pos = 0; pos + 8 <= len; pos += box) {
+		box = mp4_be32(p + pos);
+		if (box < 8 || box > (uint32_t)(len - pos))
+			return NULL;
+		if (!memcmp(p + pos + 4, type, 4)) {
+			*size = box - 8;
+			return p + pos + 8;
+		}
+	}
+
+	return NULL;
+}
+
+static void mp4_param_add(rkipc_mp4_info_s *info, const unsigned char *nal, int size) {
+	if (info->param_size + 4 + size > RKIPC_MP4_PARAM_MAX)
+		return;
+	memcpy(info->param + info->param_size, "\0\0\0\1", 4);
+	memcpy(info->param + info->param_size + 4, nal, size);
+	info->param_size += 4 + size;
+}
+
+// a VisualSampleEntry is 78 bytes before its avcC or hvcC
+static void mp4_video_entry(rkipc_mp4_info_s *info, const unsigned char *entry, int size) {
+	const unsigned char *p, *end;
+	int num, count, nal;
+
+	if (size < 86)
+		return;
+	info->h265 = !memcmp(entry + 4, "hvc1", 4) || !memcmp(entry + 4, "hev1", 4);
+	info->width = mp4_be16(entry + 32);
+	info->height = mp4_be16(entry + 34);
+	p = mp4_child(entry + 86, size - 86, info->h265 ? "hvcC" : "avcC", &size);
+	if (!p)
+		return;
+	end = p + size;
+	if (!info->h265) {
+		if (size < 7)
+			return;
+		info->nal_length_size = (p[4] & 3) + 1;
+		num = p[5] & 0x1f;
+		p += 6;
+		for (int pps = 0; pps < 2; pps++) {
+			for (int i = 0; i < num && p + 2 <= end; i++) {
+				nal = mp4_be16(p);
+				if (p + 2 + nal > end)
+					return;
+				mp4_param_add(info, p + 2, nal);
+				p += 2 + nal;
+			}
+			if (p >= end)
+				return;
+			num = *p++;
+		}
+		return;
+	}
+	if (size < 23)
+		return;
+	info->nal_length_size = (p[21] & 3) + 1;
+	num = p[22];
+	p += 23;
+	for (int i = 0; i < num && p + 3 <= end; i++) {
+		count = mp4_be16(p + 1);
+		p += 3;
+		for (int j = 0; j < count && p + 2 <= end; j++) {
+			nal = mp4_be16(p);
+			if (p + 2 + nal > end)
+				return;
+			mp4_param_add(info, p + 2, nal);
+			p += 2 + nal;
+		}
+	}
+}
+
+// tag and length of an MPEG-4 descriptor, the length is within end
+static int mp4_descriptor(const unsigned char **p, const unsigned char *end, int *tag) {
+	int len = 0, c;
+
+	if (*p >= end)
+		return -1;
+	*tag = *(*p)++;
+	for (int i = 0; i < 4 && *p < end; i++) {
+		c = *(*p)++;
+		len = (len << 7) | (c & 0x7f);
+		if (!(c & 0x80))
+			return len <= end - *p ? len : -1;
+	}
+
+	return -1;
+}
+
+// an AudioSpecificConfig of AAC is in the esds of mp4a, 28 bytes after the entry header
+static int mp4_audio_entry(rkipc_mp4_info_s *info, const unsigned char *entry, int size) {
+	const unsigned char *p, *end;
+	int len, tag, flags, object;
+
+	if (size < 36)
+		return RKIPC_MP4_AUDIO_NONE;
+	info->channels = mp4_be16(entry + 24);
+	info->sample_rate = mp4_be32(entry + 32) >> 16;
+	if (!memcmp(entry + 4, "alaw", 4))
+		return RKIPC_MP4_AUDIO_G711A;
+	if (!memcmp(entry + 4, "ulaw", 4))
+		return RKIPC_MP4_AUDIO_G711U;
+	if (memcmp(entry + 4, "mp4a", 4))
+		return RKIPC_MP4_AUDIO_NONE;
+	p = mp4_child(entry + 36, size - 36, "esds", &len);
+	if (!p || len < 4)
+		return RKIPC_MP4_AUDIO_NONE;
+	end = p + len;
+	p += 4;
+	if (mp4_descriptor(&p, end, &tag) < 3 || tag != 0x03)
+		return RKIPC_MP4_AUDIO_NONE;
+	flags = p[2];
+	p += 3;
+	if (flags & 0x80)
+		p += 2;
+	if ((flags & 0x40) && p < end)
+		p += 1 + *p;
+	if (flags & 0x20)
+		p += 2;
+	if (mp4_descriptor(&p, end, &tag) < 13 || tag != 0x04)
+		return RKIPC_MP4_AUDIO_NONE;
+	object = p[0];
+	p += 13;
+	if (object == 0x69 || object == 0x6b)
+		return RKIPC_MP4_AUDIO_MP2;
+	if (object != 0x40 && object != 0x66 && object != 0x67 && object != 0x68)
+		return RKIPC_MP4_AUDIO_NONE;
+	// AAC cannot be sent without its config
+	len = mp4_descriptor(&p, end, &tag);
+	if (len < 2 || len > RKIPC_MP4_AUDIO_CONFIG_MAX || tag != 0x05)
+		return RKIPC_MP4_AUDIO_NONE;
+	memcpy(info->audio_config, p, len);
+	info->audio_config_size = len;
+
+	return RKIPC_MP4_AUDIO_AAC;
+}
+
+// the chosen video and the first audio track, audio only in a codec that can be sent, and
+// when asked for the first metadata track
+static void mp4_parse_trak(rkipc_mp4_reader_t *reader, const unsigned char *trak, int len) {
+	const unsigned char *mdia, *hdlr, *tkhd, *mdhd, *minf, *stbl, *stsd, *mime;
+	int size, mdia_size, stbl_size, which, audio;
+	mp4_track_s *t;
+
+	mdia = mp4_child(trak, len, "mdia", &mdia_size);
+	hdlr = mdia ? mp4_child(mdia, mdia_size, "hdlr", &size) : NULL;
+	if (!hdlr || size < 12)
+		return;
+	if (!memcmp(hdlr + 8, "vide", 4))
+		which = MP4_VIDEO;
+	else if (!memcmp(hdlr + 8, "soun", 4))
+		which = MP4_AUDIO;
+	else if (!memcmp(hdlr + 8, "meta", 4) && reader->metadata)
+		which = MP4_META;
+	else
+		return;
+	t = &reader->track[which];
+	if (t->track_id)
+		return;
+	if (which == MP4_VIDEO && reader->video_skip) {
+		reader->video_skip--;
+		return;
+	}
+	tkhd = mp4_child(trak, len, "tkhd", &size);
+	if (!tkhd || size < 24)
+		return;
+	t->track_id = mp4_be32(tkhd + (tkhd[0] == 1 ? 20 : 12));
+	mdhd = mp4_child(mdia, mdia_size, "mdhd", &size);
+	if (mdhd && size >= 24)
+		t->timescale = mp4_be32(mdhd + (mdhd[0] == 1 ? 20 : 12));
+	minf = mp4_child(mdia, mdia_size, "minf", &size);
+	stbl = minf ? mp4_child(minf, size, "stbl", &stbl_size) : NULL;
+	stsd = stbl ? mp4_child(stbl, stbl_size, "stsd", &size) : NULL;
+	// stsd: version, flags and entry count before the first entry
+	if (!t->track_id || !t->timescale || !stsd || size < 16 || mp4_be32(stsd + 8) < 8 ||
+	    mp4_be32(stsd + 8) > (uint32_t)size - 8) {
+		memset(t, 0, sizeof(*t));
+		return;
+	}
+	if (which == MP4_VIDEO) {
+		reader->info.nal_length_size = 4;
+		mp4_video_entry(&reader->info, stsd + 8, mp4_be32(stsd + 8));
+	} else if (which == MP4_META) {
+		// TextMetaDataSampleEntry: 8 reserved and reference bytes, then content_encoding
+		// and mime_format as C strings
+		size = mp4_be32(stsd + 8);
+		if (memcmp(stsd + 12, "mett", 4) || size < 18) {
+			memset(t, 0, sizeof(*t));
+			return;
+		}
+		mime = memchr(stsd + 24, 0, size - 16);
+		if (mime && ++mime < stsd + 8 + size)
+			snprintf(reader->info.metadata_mime, sizeof(reader->info.metadata_mime), "%.*s",
+			         (int)(stsd + 8 + size - mime), mime);
+	} else {
+		audio = mp4_audio_entry(&reader->info, stsd + 8, mp4_be32(stsd + 8));
+		if (audio == RKIPC_MP4_AUDIO_NONE) {
+			memset(t, 0, sizeof(*t));
+			return;
+		}
+		reader->info.audio = audio;
+		if (!reader->info.sample_rate)
+			reader->info.sample_rate = t->timescale;
+	}
+	t->stts = mp4_child(stbl, stbl_size, "stts", &t->stts_size);
+	t->stss = mp4_child(stbl, stbl_size, "stss", &t->stss_size);
+	t->stsz = mp4_child(stbl, stbl_size, "stsz", &t->stsz_size);
+	t->stsc = mp4_child(stbl, stbl_size, "stsc", &t->stsc_size);
+	t->stco = mp4_child(stbl, stbl_size, "stco", &t->stco_size);
+	if (!t->stco) {
+		t->stco = mp4_child(stbl, stbl_size, "co64", &t->stco_size);
+		t->co64 = 1;
+	}
+}
+
+static void mp4_parse_moov(rkipc_mp4_reader_t *reader, const unsigned char *moov, int len) {
+	const unsigned char *mvex;
+	uint32_t id;
+	int size, n;
+
+	for (int pos = 0; pos + 8 <= len; pos += n) {
+		n = mp4_be32(moov + pos);
+		if (n < 8 || n > len - pos)
+			break;
+		if (!memcmp(moov + pos + 4, "trak", 4))
+			mp4_parse_trak(reader, moov + pos + 8, n - 8);
+	}
+	mvex = mp4_child(moov, len, "mvex", &size);
+	for (int pos = 0; mvex && pos + 32 <= size; pos += n) {
+		n = mp4_be32(mvex + pos);
+		if (n < 8 || n > size - pos)
+			break;
+		if (memcmp(mvex + pos + 4, "trex", 4) || n < 32)
+			continue;
+		id = mp4_be32(mvex + pos + 12);
+		for (int i = 0; i < MP4_TRACK_NUM; i++) {
+			if (!reader->track[i].track_id || reader->track[i].track_id != id)
+				continue;
+			reader->track[i].trex_duration = mp4_be32(mvex + pos + 20);
+			reader->track[i].trex_size = mp4_be32(mvex + pos + 24);
+			reader->track[i].trex_flags = mp4_be32(mvex + pos + 28);
+		}
+	}
+}
+
+// the samples of a moov sample table, the layout of a finished rkmuxer file
+static int mp4_table(rkipc_mp4_reader_t *reader, int which) {
+	mp4_track_s *t = &reader->track[which];
+	uint32_t count, fixed_size, chunks, stsc_num, stts_num, stss_num, stsc_i = 0, stts_i = 0;
+	uint32_t stss_i = 0, chunk = 0, in_chunk = 0, per_chunk, stts_left, delta, size;
+	uint64_t offset, dts = 0;
+	int key;
+
+	if (!t->track_id || !t->stsz || !t->stsc || !t->stco || !t->stts || t->stsz_size < 12 ||
+	    t->stsc_size < 8 || t->stco_size < 8 || t->stts_size < 8)
+		return 0;
+	fixed_size = mp4_be32(t->stsz + 4);
+	count = mp4_be32(t->stsz + 8);
+	chunks = mp4_be32(t->stco + 4);
+	stsc_num = mp4_be32(t->stsc + 4);
+	stts_num = mp4_be32(t->stts + 4);
+	stss_num = t->stss && t->stss_size >= 8 ? mp4_be32(t->stss + 4) : 0;
+	if ((!fixed_size && (uint64_t)count * 4 + 12 > (uint64_t)t->stsz_size) ||
+	    (uint64_t)chunks * (t->co64 ? 8 : 4) + 8 > (uint64_t)t->stco_size ||
+	    (uint64_t)stsc_num * 12 + 8 > (uint64_t)t->stsc_size ||
+	    (uint64_t)stts_num * 8 + 8 > (uint64_t)t->stts_size ||
+	    (t->stss && (uint64_t)stss_num * 4 + 8 > (uint64_t)t->stss_size))
+		return -1;
+	// a fragmented file has empty tables, its samples are in the moofs
+	if (!count || !chunks || !stsc_num || !stts_num)
+		return 0;
+	per_chunk = mp4_be32(t->stsc + 12);
+	stts_left = mp4_be32(t->stts + 8);
+	delta = mp4_be32(t->stts + 12);
+	offset = t->co64 ? mp4_be64(t->stco + 8) : mp4_be32(t->stco + 8);
+	for (uint32_t i = 0; i < count && chunk < chunks; i++) {
+		size = fixed_size ? fixed_size : mp4_be32(t->stsz + 12 + i * 4);
+		// stss lists the sync samples from 1, without it every sample is one
+		key = !t->stss;
+		if (t->stss && stss_i < stss_num && mp4_be32(t->stss + 8 + stss_i * 4) == i + 1) {
+			stss_i++;
+			key = 1;
+		}
+		if (offset + size <= (uint64_t)reader->file_size &&
+		    mp4_push(&reader->table, which, key, dts, t->timescale, offset, size))
+			return -1;
+		offset += size;
+		while (stts_left == 0 && ++stts_i < stts_num) {
+			stts_left = mp4_be32(t->stts + 8 + stts_i * 8);
+			delta = mp4_be32(t->stts + 12 + stts_i * 8);
+		}
+		dts += delta;
+		stts_left--;
+		if (++in_chunk < per_chunk)
+			continue;
+		in_chunk = 0;
+		if (++chunk >= chunks)
+			break;
+		if (t->co64)
+			offset = mp4_be64(t->stco + 8 + chunk * 8);
+		else
+			offset = mp4_be32(t->stco + 8 + chunk * 4);
+		if (stsc_i + 1 < stsc_num && mp4_be32(t->stsc + 8 + (stsc_i + 1) * 12) == chunk + 1) {
+			stsc_i++;
+			per_chunk = mp4_be32(t->stsc + 12 + stsc_i * 12);
+		}
+	}
+	t->first_dts = dts;
+
+	return 0;
+}
+
+// samples of one moof, sync samples are the ones without sample_is_non_sync_sample;
+// -1 when the data of the moof is not all in the file yet
+static int mp4_moof(rkipc_mp4_reader_t *reader, const unsigned char *moof, int len,
+                    uint64_t moof_offset) {
+	const unsigned char *traf, *tfhd, *tfdt, *p, *end;
+	uint32_t tf_flags, tr_flags, count, duration, size, flags, first_flags = 0, id;
+	uint64_t base, offset, dts;
+	int traf_size, n, which;
+	mp4_track_s *t;
+
+	for (int pos = 0; pos + 8 <= len; pos += mp4_be32(moof + pos)) {
+		n = mp4_be32(moof + pos);
+		if (n < 8 || n > len - pos)
+			break;
+		if (memcmp(moof + pos + 4, "traf", 4))
+			continue;
+		traf = moof + pos + 8;
+		traf_size = n - 8;
+		tfhd = mp4_child(traf, traf_size, "tfhd", &n);
+		if (!tfhd || n < 8)
+			continue;
+		id = mp4_be32(tfhd + 4);
+		for (which = 0; which < MP4_TRACK_NUM; which++) {
+			if (reader->track[which].track_id && reader->track[which].track_id == id)
+				break;
+		}
+		if (which == MP4_TRACK_NUM)
+			continue;
+		t = &reader->track[which];
+		tf_flags = mp4_be32(tfhd) & 0xffffff;
+		if (n < 8 + 4 * __builtin_popcount(tf_flags & 0x3a) + 8 * !!(tf_flags & 0x01))
+			continue;
+		p = tfhd + 8;
+		base = moof_offset;
+		duration = t->trex_duration;
+		size = t->trex_size;
+		flags = t->trex_flags;
+		if (tf_flags & 0x01) {
+			base = mp4_be64(p);
+			p += 8;
+		}
+		if (tf_flags & 0x02)
+			p += 4;
+		if (tf_flags & 0x08) {
+			duration = mp4_be32(p);
+			p += 4;
+		}
+		if (tf_flags & 0x10) {
+			size = mp4_be32(p);
+			p += 4;
+		}
+		if (tf_flags & 0x20)
+			flags = mp4_be32(p);
+		tfdt = mp4_child(traf, traf_size, "tfdt", &n);
+		dts = t->next_dts;
+		if (tfdt && n >= 8)
+			dts = tfdt[0] == 1 && n >= 12 ? mp4_be64(tfdt + 4) : mp4_be32(tfdt + 4);
+		offset = base;
+		for (int tr = 0; tr + 8 <= traf_size; tr += n) {
+			n = mp4_be32(traf + tr);
+			if (n < 8 || n > traf_size - tr)
+				break;
+			if (memcmp(traf + tr + 4, "trun", 4))
+				continue;
+			p = traf + tr + 8;
+			end = traf + tr + n;
+			if (p + 8 > end)
+				break;
+			tr_flags = mp4_be32(p) & 0xffffff;
+			count = mp4_be32(p + 4);
+			p += 8;
+			if (tr_flags & 0x01) {
+				offset = base + (int32_t)mp4_be32(p);
+				p += 4;
+			}
+			if (tr_flags & 0x04) {
+				first_flags = mp4_be32(p);
+				p += 4;
+			}
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t sample_duration = duration, sample_size = size, sample_flags = flags;
+
+				if (p + 4 * __builtin_popcount(tr_flags & 0xf00) > end)
+					break;
+				if (tr_flags & 0x100) {
+					sample_duration = mp4_be32(p);
+					p += 4;
+				}
+				if (tr_flags & 0x200) {
+					sample_size = mp4_be32(p);
+					p += 4;
+				}
+				if (tr_flags & 0x400) {
+					sample_flags = mp4_be32(p);
+					p += 4;
+				} else if (i == 0 && (tr_flags & 0x04)) {
+					sample_flags = first_flags;
+				}
+				if (tr_flags & 0x800)
+					p += 4;
+				if (offset + sample_size > (uint64_t)reader->file_size)
+					return -1;
+				if (mp4_push(&reader->fragment, which,
+				             which != MP4_VIDEO || !(sample_flags & 0x10000), dts, t->timescale,
+				             offset, sample_size))
+					return -1;
+				offset += sample_size;
+				dts += sample_duration;
+			}
+		}
+		t->next_dts = dts;
+	}
+
+	return 0;
+}
+
+static int mp4_read_box(int fd, off_t offset, off_t file_size, uint64_t *size, int *header,
+                        char *type) {
+	unsigned char h[16];
+
+	if (offset + 8 > file_size || pread(fd, h, 8, offset) != 8)
+		return -1;
+	*size = mp4_be32(h);
+	*header = 8;
+	memcpy(type, h + 4, 4);
+	if (*size == 1) {
+		if (offset + 16 > file_size || pread(fd, h + 8, 8, offset + 8) != 8)
+			return -1;
+		*size = mp4_be64(h + 8);
+		*header = 16;
+	} else if (*size == 0) {
+		*size = file_size - offset;
+	}
+	if (*size < (uint64_t)*header || offset + (off_t)*size > file_size)
+		return -1;
+
+	return 0;
+}
+
+static unsigned char *mp4_read_body(int fd, off_t offset, uint64_t size, int header, int max) {
+	unsigned char *buf;
+
+	if (size - header > (uint64_t)max)
+		return NULL;
+	buf = malloc(size - header);
+	if (buf && pread(fd, buf, size - header, offset + header) != (ssize_t)(size - header)) {
+		free(buf);
+		buf = NULL;
+	}
+
+	return buf;
+}
+
+// A slot of a recording pool (storage/fmp4.h) is longer than its recording, a free box
+// right after the 28 byte ftyp holds its length. What follows is an older recording.
+static int mp4_file_size(rkipc_mp4_reader_t *reader) {
+	unsigned char h[24];
+	struct stat st;
+	uint64_t length;
+
+	if (fstat(reader->fd, &st))
+		return -1;
+	reader->file_size = st.st_size;
+	if (pread(reader->fd, h, sizeof(h), 28) == sizeof(h) && mp4_be32(h) == 48 &&
+	    !memcmp(h + 4, "freerkpl", 8)) {
+		length = mp4_be64(h + 16);
+		if (length < (uint64_t)reader->file_size)
+			reader->file_size = length;
+	}
+
+	return 0;
+}
+
+// the next moof with samples becomes the list, 1 when there is none in the file yet
+static int mp4_next_fragment(rkipc_mp4_reader_t *reader) {
+	unsigned char *moof;
+	uint64_t size, dts[MP4_TRACK_NUM];
+	off_t offset;
+	char type[4];
+	int header, ret;
+
+	// a recording still being written grows
+	mp4_file_size(reader);
+	while (!mp4_read_box(reader->fd, reader->next_box, reader->file_size, &size, &header, type)) {
+		offset = reader->next_box;
+		if (memcmp(type, "moof", 4)) {
+			reader->next_box += size;
+			continue;
+		}
+		moof = mp4_read_body(reader->fd, offset, size, header, MP4_MOOF_MAX);
+		if (!moof)
+			return 1;
+		for (int i = 0; i < MP4_TRACK_NUM; i++)
+			dts[i] = reader->track[i].next_dts;
+		reader->fragment.num = 0;
+		ret = mp4_moof(reader, moof, size - header, offset);
+		free(moof);
+		if (ret) {
+			// read again once its mdat is complete
+			for (int i = 0; i < MP4_TRACK_NUM; i++)
+				reader->track[i].next_dts = dts[i];
+			reader->fragment.num = 0;
+			return 1;
+		}
+		reader->next_box += size;
+		if (!reader->fragment.num)
+			continue;
+		qsort(reader->fragment.sample, reader->fragment.num, sizeof(rkipc_mp4_sample_s),
+		      mp4_compare);
+		reader->list = &reader->fragment;
+		reader->pos = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+// the last video I frame at or before time_us, -1 without one
+static int mp4_find_key(const mp4_list_s *list, int64_t time_us) {
+	int low = 0, high = list->num - 1, mid;
+
+	if (!list->num || list->sample[0].time_us > time_us)
+		return -1;
+	while (low < high) {
+		mid = (low + high + 1) / 2;
+		if (list->sample[mid].time_us <= time_us)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+	for (; low >= 0; low--) {
+		if (!list->sample[low].audio && !list->sample[low].metadata && list->sample[low].key)
+			return low;
+	}
+
+	return -1;
+}
+
+static void mp4_rewind(rkipc_mp4_reader_t *reader) {
+	for (int i = 0; i < MP4_TRACK_NUM; i++)
+		reader->track[i].next_dts = reader->track[i].first_dts;
+	reader->next_box = reader->first_box;
+	reader->list = &reader->table;
+	reader->pos = 0;
+}
+
+static rkipc_mp4_reader_t *mp4_open(const char *path, int video, int metadata) {
+	rkipc_mp4_reader_t *reader;
+	uint64_t size;
+	off_t offset = 0;
+	char type[4];
+	int header;
+
+	reader = calloc(1, sizeof(*reader));
+	if (!reader)
+		return NULL;
+	reader->video_skip = video;
+	reader->metadata = metadata;
+	reader->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (reader->fd < 0 || mp4_file_size(reader)) {
+		rkipc_mp4_reader_close(reader);
+		return NULL;
+	}
+	// a moov with sample tables comes before or after mdat, fragments always follow it
+	while (!mp4_read_box(reader->fd, offset, reader->file_size, &size, &header, type)) {
+		if (!memcmp(type, "moov", 4)) {
+			reader->moov = mp4_read_body(reader->fd, offset, size, header, MP4_MOOV_MAX);
+			if (reader->moov)
+				mp4_parse_moov(reader, reader->moov, size - header);
+			reader->first_box = offset + size;
+			break;
+		}
+		offset += size;
+	}
+	if (!reader->moov || !reader->track[MP4_VIDEO].track_id ||
+	    mp4_table(reader, MP4_VIDEO) || mp4_table(reader, MP4_AUDIO) ||
+	    mp4_table(reader, MP4_META)) {
+		rkipc_mp4_reader_close(reader);
+		return NULL;
+	}
+	if (reader->table.num)
+		qsort(reader->table.sample, reader->table.num, sizeof(rkipc_mp4_sample_s),
+		      mp4_compare);
+	mp4_rewind(reader);
+
+	return reader;
+}
+
+rkipc_mp4_reader_t *rkipc_mp4_reader_open(const char *path, int video) {
+	return mp4_open(path, video, 0);
+}
+
+rkipc_mp4_reader_t *rkipc_mp4_reader_open_metadata(const char *path, int video) {
+	return mp4_open(path, video, 1);
+}
+
+void rkipc_mp4_reader_close(rkipc_mp4_reader_t *reader) {
+	if (!reader)
+		return;
+	if (reader->fd >= 0)
+		close(reader->fd);
+	free(reader->moov);
+	free(reader->table.sample);
+	free(reader->fragment.sample);
+	free(reader);
+}
+
+const rkipc_mp4_info_s *rkipc_mp4_reader_info(rkipc_mp4_reader_t *reader) {
+	return &reader->info;
+}
+
+int rkipc_mp4_reader_next(rkipc_mp4_reader_t *reader, rkipc_mp4_sample_s *sample) {
+	if (reader->pos >= reader->list->num && mp4_next_fragment(reader))
+		return 1;
+	*sample = reader->list->sample[reader->pos++];
+
+	return 0;
+}
+
+int rkipc_mp4_reader_seek(rkipc_mp4_reader_t *reader, int64_t time_us) {
+	uint64_t dts[MP4_TRACK_NUM], best_dts[MP4_TRACK_NUM];
+	off_t box, best_box = -1;
+	int i, key, best = -1;
+
+	mp4_rewind(reader);
+	key = mp4_find_key(&reader->table, time_us);
+	// past the sample tables the fragments are walked, their moofs are small
+	if (key < 0 || reader->table.sample[reader->table.num - 1].time_us < time_us) {
+		for (;;) {
+			box = reader->next_box;
+			for (int j = 0; j < MP4_TRACK_NUM; j++)
+				dts[j] = reader->track[j].next_dts;
+			if (mp4_next_fragment(reader) || reader->fragment.sample[0].time_us > time_us)
+				break;
+			i = mp4_find_key(&reader->fragment, time_us);
+			if (i < 0)
+				continue;
+			best_box = box;
+			best = i;
+			memcpy(best_dts, dts, sizeof(dts));
+		}
+	}
+	mp4_rewind(reader);
+	if (best_box >= 0) {
+		reader->next_box = best_box;
+		for (int j = 0; j < MP4_TRACK_NUM; j++)
+			reader->track[j].next_dts = best_dts[j];
+		if (mp4_next_fragment(reader)) {
+			mp4_rewind(reader);
+			return -1;
+		}
+		reader->pos = best;
+	} else if (key >= 0) {
+		reader->pos = key;
+	}
+
+	return 0;
+}
+
+int rkipc_mp4_reader_read(rkipc_mp4_reader_t *reader, const rkipc_mp4_sample_s *sample,
+                          unsigned char *buf) {
+	if (pread(reader->fd, buf, sample->size, sample->offset) != (ssize_t)sample->size)
+		return -1;
+
+	return 0;
+}
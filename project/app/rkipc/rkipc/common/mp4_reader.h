@@ -0,0 +1,71 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RKIPC_MP4_READER_H__
+#define __RKIPC_MP4_READER_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RKIPC_MP4_PARAM_MAX 512
+#define RKIPC_MP4_AUDIO_CONFIG_MAX 16
+
+enum {
+	RKIPC_MP4_AUDIO_NONE = 0,
+	RKIPC_MP4_AUDIO_G711A,
+	RKIPC_MP4_AUDIO_G711U,
+	RKIPC_MP4_AUDIO_AAC,
+	RKIPC_MP4_AUDIO_MP2,
+};
+
+typedef struct {
+	int h265;
+	int nal_length_size;
+	int width;
+	int height;
+	unsigned char param[RKIPC_MP4_PARAM_MAX]; // VPS, SPS and PPS, Annex B
+	int param_size;
+	int audio; // RKIPC_MP4_AUDIO_*
+	int sample_rate;
+	int channels;
+	unsigned char audio_config[RKIPC_MP4_AUDIO_CONFIG_MAX]; // AAC AudioSpecificConfig
+	int audio_config_size;
+	char metadata_mime[64]; // of the timed metadata track, empty without one
+} rkipc_mp4_info_s;
+
+typedef struct {
+	int64_t time_us; // decode time from the start of the file
+	uint64_t offset;
+	uint32_t size;
+	uint16_t audio;
+	uint16_t key;
+	uint16_t metadata;
+} rkipc_mp4_sample_s;
+
+typedef struct rkipc_mp4_reader rkipc_mp4_reader_t;
+
+// a recording with a video track, the sample tables of a finished file or the fragments
+// of rk_fmp4, which may still be growing. video picks the video track, 0 for the first,
+// 1 for the sub stream of a multi-track recording.
+rkipc_mp4_reader_t *rkipc_mp4_reader_open(const char *path, int video);
+// the same with the samples of a timed metadata track, they come after the video and
+// audio of the same time
+rkipc_mp4_reader_t *rkipc_mp4_reader_open_metadata(const char *path, int video);
+void rkipc_mp4_reader_close(rkipc_mp4_reader_t *reader);
+const rkipc_mp4_info_s *rkipc_mp4_reader_info(rkipc_mp4_reader_t *reader);
+// samples of all tracks by time, 0 for one, 1 at the end of the file or of what is sane
+int rkipc_mp4_reader_next(rkipc_mp4_reader_t *reader, rkipc_mp4_sample_s *sample);
+// the next sample is then the I frame at or before time_us, else the first one
+int rkipc_mp4_reader_seek(rkipc_mp4_reader_t *reader, int64_t time_us);
+// video keeps the NAL unit lengths of the file, buf holds sample->size bytes
+int rkipc_mp4_reader_read(rkipc_mp4_reader_t *reader, const rkipc_mp4_sample_s *sample,
+                          unsigned char *buf);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
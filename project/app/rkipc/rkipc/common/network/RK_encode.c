@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 #include "RK_encode.h"
+#include "encode_utils.h"
 #include "gbk_to_utf8.h"
 #include "utf8_to_gbk.h"
 #include <stdio.h>
@@ -44,10 +45,40 @@ int RK_encode_is_utf8(char *buf, const int size) {
 	return 1;
 }
 
-int RK_encode_gbk_to_utf8(unsigned char *src, int len, unsigned char *dst) {
-	return gbk_to_utf8(src, len, dst);
+int RK_encode_gbk_to_utf8(unsigned char *src, int len, unsigned char *dst, int dst_len) {
+	return gbk_to_utf8(src, len, dst, dst_len);
 }
 
-int RK_encode_utf8_to_gbk(unsigned char *src, int len, unsigned char *dst) {
-	return utf8_to_gbk(src, len, dst);
+int RK_encode_utf8_to_gbk(unsigned char *src, int len, unsigned char *dst, int dst_len) {
+	return utf8_to_gbk(src, len, dst, dst_len);
+}
+
+int RK_encode_utf8_to_wchar(const unsigned char *src, int len, wchar_t *dst, int dst_len) {
+	int i = 0;
+	int j = 0;
+	int n;
+	uint32_t unicode;
+
+	if (dst_len <= 0)
+		return -1;
+	while (i < len && j < dst_len - 1) {
+		n = rk_encode_ascii_span(src + i, len - i);
+		if (n > dst_len - 1 - j)
+			n = dst_len - 1 - j;
+		while (n--)
+			dst[j++] = src[i++];
+		if (i >= len || j >= dst_len - 1)
+			break;
+		n = rk_encode_utf8_decode(src + i, len - i, &unicode);
+		if (n < 0) {
+			// keep the rest of an OSD string readable
+			unicode = '?';
+			n = 1;
+		}
+		dst[j++] = unicode;
+		i += n;
+	}
+	dst[j] = L'\0';
+
+	return j;
 }
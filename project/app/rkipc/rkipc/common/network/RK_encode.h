@@ -4,13 +4,20 @@
 #ifndef __RK_ENCODE_H__
 #define __RK_ENCODE_H__
 
+#include <wchar.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int RK_encode_is_utf8(char *buffer, const int size);
-int RK_encode_gbk_to_utf8(unsigned char *src, int len, unsigned char *dst);
-int RK_encode_utf8_to_gbk(unsigned char *src, int len, unsigned char *dst);
+// Return the number of bytes written to dst, or -1 on malformed input or when
+// dst_len is too small. The output is not NUL-terminated.
+int RK_encode_gbk_to_utf8(unsigned char *src, int len, unsigned char *dst, int dst_len);
+int RK_encode_utf8_to_gbk(unsigned char *src, int len, unsigned char *dst, int dst_len);
+// Decode UTF-8 into at most dst_len - 1 wide characters plus a terminator,
+// invalid sequences become '?'. Return the number of wide characters written.
+int RK_encode_utf8_to_wchar(const unsigned char *src, int len, wchar_t *dst, int dst_len);
 
 #ifdef __cplusplus
 }
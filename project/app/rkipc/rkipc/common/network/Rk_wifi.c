@@ -735,7 +735,8 @@ char *RK_wifi_scan_r_sec(const unsigned int cols) {
 						is_nonpsk = 1;
 					}
 				} else if (4 == index) {
-					char utf8[strlen(p_strtok) + 1];
+					// a 2-byte GBK character takes 3 bytes in UTF-8
+					char utf8[strlen(p_strtok) * 3 / 2 + 1];
 					memset(utf8, 0, sizeof(utf8));
 
 					if (strlen(p_strtok) > 0) {
@@ -754,8 +755,12 @@ char *RK_wifi_scan_r_sec(const unsigned int cols) {
 						memset(utf8_noescape, 0, sizeof(utf8_noescape));
 						memset(dst_noescape, 0, sizeof(dst_noescape));
 						if (!is_utf8) {
-							RK_encode_gbk_to_utf8((unsigned char *)dst, strlen(dst),
-							                      (unsigned char *)utf8);
+							// if convert gbk to utf8 failed, ignore it
+							if (RK_encode_gbk_to_utf8((unsigned char *)dst, strlen(dst),
+							                          (unsigned char *)utf8,
+							                          sizeof(utf8) - 1) < 0) {
+								continue;
+							}
 							remove_escape_character(dst, dst_noescape);
 							remove_escape_character(utf8, utf8_noescape);
 							m_gbk_head = encode_gbk_insert(m_gbk_head, dst_noescape, utf8_noescape);
@@ -0,0 +1,109 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef _ENCODE_UTILS_H_
+#define _ENCODE_UTILS_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Length of the leading run of 7-bit ASCII bytes in s[0, len).
+// SSID and OSD strings are mostly ASCII, so callers copy this run with one
+// memcpy and only fall back to the per-character path for the rest.
+static inline int rk_encode_ascii_span(const unsigned char *s, int len) {
+	int i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+	for (; i + 16 <= len; i += 16) {
+		uint8x16_t v = vld1q_u8(s + i);
+		uint8x8_t m = vorr_u8(vget_low_u8(v), vget_high_u8(v));
+		if (vget_lane_u64(vreinterpret_u64_u8(m), 0) & 0x8080808080808080ULL)
+			break;
+	}
+#elif defined(__SSE2__)
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		if (_mm_movemask_epi8(v))
+			break;
+	}
+#endif
+	for (; i + 4 <= len; i += 4) {
+		uint32_t w;
+		memcpy(&w, s + i, 4);
+		if (w & 0x80808080u)
+			break;
+	}
+	while (i < len && s[i] < 0x80)
+		i++;
+
+	return i;
+}
+
+// Decode one UTF-8 sequence. Returns the number of bytes consumed (1-4) and
+// stores the code point, or -1 for truncated, overlong, surrogate or
+// out-of-range sequences.
+static inline int rk_encode_utf8_decode(const unsigned char *s, int len, uint32_t *cp) {
+	uint32_t c = s[0];
+	int n, i;
+
+	if (c < 0x80) {
+		*cp = c;
+		return 1;
+	} else if (c < 0xc2) {
+		return -1; // stray continuation byte or overlong 2-byte lead
+	} else if (c < 0xe0) {
+		n = 2;
+		c &= 0x1f;
+	} else if (c < 0xf0) {
+		n = 3;
+		c &= 0x0f;
+	} else if (c < 0xf5) {
+		n = 4;
+		c &= 0x07;
+	} else {
+		return -1;
+	}
+	if (n > len)
+		return -1;
+	for (i = 1; i < n; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return -1;
+		c = (c << 6) | (s[i] & 0x3f);
+	}
+	if ((n == 3 && c < 0x800) || (n == 4 && (c < 0x10000 || c > 0x10ffff)) ||
+	    (c >= 0xd800 && c <= 0xdfff))
+		return -1;
+	*cp = c;
+
+	return n;
+}
+
+// Encode a code point as UTF-8 into out (at least 4 bytes), returns the length.
+static inline int rk_encode_utf8_encode(uint32_t c, unsigned char *out) {
+	if (c < 0x80) {
+		out[0] = (unsigned char)c;
+		return 1;
+	} else if (c < 0x800) {
+		out[0] = (unsigned char)(0xc0 | (c >> 6));
+		out[1] = (unsigned char)(0x80 | (c & 0x3f));
+		return 2;
+	} else if (c < 0x10000) {
+		out[0] = (unsigned char)(0xe0 | (c >> 12));
+		out[1] = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+		out[2] = (unsigned char)(0x80 | (c & 0x3f));
+		return 3;
+	}
+	out[0] = (unsigned char)(0xf0 | (c >> 18));
+	out[1] = (unsigned char)(0x80 | ((c >> 12) & 0x3f));
+	out[2] = (unsigned char)(0x80 | ((c >> 6) & 0x3f));
+	out[3] = (unsigned char)(0x80 | (c & 0x3f));
+
+	return 4;
+}
+
+#endif
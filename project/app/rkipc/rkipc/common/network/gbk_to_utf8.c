@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 //  ����: ʫŵ��
 #include "gbk_to_utf8.h"
+#include "encode_utils.h"
 #include <string.h>
 
 extern const unsigned short mb_gb2uni_table[];
@@ -2023,59 +2024,37 @@ static unsigned short gbk_to_unicode(unsigned char ch, unsigned char cl) {
 	return (ch <= 0x7d && cl <= 0xbe) ? mb_gb2uni_table[ch * 0xbf + cl] : 0x1fff;
 }
 
-static int unicode_to_utf8(unsigned long c, unsigned char *pszUtf8, int *pnUtf8Len) {
-	char tmp[16];
+int gbk_to_utf8(unsigned char *src, int len, unsigned char *dst, int dst_len) {
+	int i = 0;
+	int j = 0;
+	int n;
+	unsigned short uc;
+	unsigned char utf8[4];
 
-	if (c < 0x80) {
-		*tmp = (char)c;
-		*(tmp + 1) = '\0';
-	}
-	if (c >= 0x80) {
-		register char *t = tmp;
-		if (c < 0x0800) {
-			*t++ = (char)(0xC0 | ((c >> 6) & 0x1F));
-		} else {
-			if (c < 0x010000) {
-				*t++ = (char)(0xE0 | ((c >> 12) & 0x0F));
-			} else {
-				if (c < 0x200000) {
-					*t++ = (char)(0xF0 | ((c >> 18) & 0x07));
-				} else {
-					if (c < 0x04000000) {
-						*t++ = (char)(0xF8 | ((c >> 24) & 0x03));
-					} else {
-						*t++ = (char)(0xFC | ((c >> 30) & 0x01));
-						*t++ = (char)(0x80 | ((c >> 24) & 0x3F));
-					}
-					*t++ = (char)(0x80 | ((c >> 18) & 0x3F));
-				}
-				*t++ = (char)(0x80 | ((c >> 12) & 0x3F));
-			}
-			*t++ = (char)(0x80 | ((c >> 6) & 0x3F));
+	while (i < len) {
+		n = rk_encode_ascii_span(src + i, len - i);
+		if (n) {
+			if (j + n > dst_len)
+				return -1;
+			memcpy(dst + j, src + i, n);
+			i += n;
+			j += n;
+			continue;
 		}
-		*t++ = (char)(0x80 | (c & 0x3F));
-		*t = '\0';
+		// double-byte character: lead 0x81-0xfe, trail 0x40-0xfe except 0x7f
+		if (i + 1 >= len || src[i] == 0xff || src[i + 1] < 0x40 || src[i + 1] == 0x7f ||
+		    src[i + 1] == 0xff)
+			return -1;
+		uc = gbk_to_unicode(src[i], src[i + 1]);
+		if (uc == 0x1fff)
+			return -1;
+		i += 2;
+		n = rk_encode_utf8_encode(uc, utf8);
+		if (j + n > dst_len)
+			return -1;
+		memcpy(dst + j, utf8, n);
+		j += n;
 	}
-	strcpy((char *)pszUtf8, tmp);
-	*pnUtf8Len = strlen(tmp);
-	return 0;
-}
 
-int gbk_to_utf8(unsigned char *src, int len, unsigned char *dst) {
-	int i, j = 0;
-	unsigned long c;
-	int nLen;
-	for (i = 0; i < len; i++) {
-		if (src[i] < 0x80) {
-			c = src[i];
-		} else {
-			unsigned short uc;
-			uc = gbk_to_unicode(src[i], src[i + 1]);
-			c = (unsigned long)uc;
-			i++;
-		}
-		unicode_to_utf8(c, (unsigned char *)(dst + j), &nLen);
-		j += nLen;
-	}
 	return j;
 }
@@ -0,0 +1,608 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "net_state.h"
+#include "common.h"
+#include "network.h"
+#include <dirent.h>
+#include <net/if_arp.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <linux/if.h> // must be included later than <net/if.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "net_state.c"
+
+#define NET_NL_BUFSIZE 8192
+#define NET_RESOLV_CONF "/etc/resolv.conf"
+
+typedef int (*net_nl_handler)(struct nlmsghdr *nh, void *arg);
+
+static net_if_state_s g_net_if[NET_STATE_MAX_IF];
+static int g_net_if_seen[NET_STATE_MAX_IF]; // by the link dump of a resync
+static pthread_rwlock_t g_net_state_lock = PTHREAD_RWLOCK_INITIALIZER;
+static int g_net_state_fd = -1;
+static int g_net_state_ready = 0;
+static unsigned int g_net_nl_seq = 0;
+
+static net_if_state_s *net_state_find(int ifindex, int alloc) {
+	net_if_state_s *free_slot = NULL;
+
+	for (int i = 0; i < NET_STATE_MAX_IF; i++) {
+		if (g_net_if[i].index == ifindex)
+			return &g_net_if[i];
+		if (!free_slot && g_net_if[i].index == 0)
+			free_slot = &g_net_if[i];
+	}
+	if (!alloc || !free_slot)
+		return NULL;
+	memset(free_slot, 0, sizeof(*free_slot));
+	free_slot->index = ifindex;
+
+	return free_slot;
+}
+
+static void net_nl_addattr(struct nlmsghdr *nh, int type, const void *data, int len) {
+	struct rtattr *rta = (struct rtattr *)((char *)nh + NLMSG_ALIGN(nh->nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+static int net_nl_open(unsigned int groups) {
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0) {
+		LOG_ERROR("netlink socket fail, %s\n", strerror(errno));
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = groups;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		LOG_ERROR("netlink bind fail, %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Send one request and wait for its ACK, or for the end of the dump when
+// handler is given. Returns 0 or -errno.
+static int net_nl_transact(struct nlmsghdr *req, net_nl_handler handler, void *arg) {
+	char buf[NET_NL_BUFSIZE];
+	struct nlmsghdr *nh;
+	int fd, len, ret = -EIO, done = 0;
+
+	fd = net_nl_open(0);
+	if (fd < 0)
+		return -errno;
+	req->nlmsg_seq = __sync_add_and_fetch(&g_net_nl_seq, 1);
+	req->nlmsg_flags |= NLM_F_REQUEST | (handler ? NLM_F_DUMP : NLM_F_ACK);
+	if (send(fd, req, req->nlmsg_len, 0) < 0) {
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+	while (!done && (len = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq != req->nlmsg_seq)
+				continue;
+			if (nh->nlmsg_type == NLMSG_DONE) {
+				ret = 0;
+				done = 1;
+				break;
+			}
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				ret = ((struct nlmsgerr *)NLMSG_DATA(nh))->error;
+				done = 1;
+				break;
+			}
+			if (handler)
+				handler(nh, arg);
+		}
+	}
+	close(fd);
+
+	return ret;
+}
+
+static int net_nl_dump(int type, int family, net_nl_handler handler, void *arg) {
+	struct {
+		struct nlmsghdr nh;
+		struct rtgenmsg gen;
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.gen));
+	req.nh.nlmsg_type = type;
+	req.gen.rtgen_family = family;
+
+	return net_nl_transact(&req.nh, handler, arg);
+}
+
+static int net_state_update_link(struct nlmsghdr *nh, int *ifindex) {
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	struct rtattr *rta = IFLA_RTA(ifi);
+	int len = IFLA_PAYLOAD(nh);
+	net_if_state_s *state;
+	unsigned int old_flags;
+
+	*ifindex = ifi->ifi_index;
+	if (nh->nlmsg_type == RTM_DELLINK) {
+		state = net_state_find(ifi->ifi_index, 0);
+		if (state)
+			memset(state, 0, sizeof(*state));
+		return NET_STATE_NO_CHANGE;
+	}
+	state = net_state_find(ifi->ifi_index, 1);
+	if (!state) {
+		LOG_WARN("more than %d interfaces, ignore index %d\n", NET_STATE_MAX_IF, ifi->ifi_index);
+		return NET_STATE_NO_CHANGE;
+	}
+	g_net_if_seen[state - g_net_if] = 1;
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME)
+			snprintf(state->name, sizeof(state->name), "%s", (char *)RTA_DATA(rta));
+	}
+	old_flags = state->flags;
+	state->flags = ifi->ifi_flags;
+	if (!((old_flags ^ state->flags) & IFF_LOWER_UP))
+		return NET_STATE_NO_CHANGE;
+
+	return (state->flags & IFF_LOWER_UP) ? NET_STATE_LINK_UP : NET_STATE_LINK_DOWN;
+}
+
+static void net_state_update_addr(struct nlmsghdr *nh, int *ifindex) {
+	struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+	struct rtattr *rta = IFA_RTA(ifa);
+	int len = IFA_PAYLOAD(nh);
+	struct in_addr addr = {0};
+	net_if_state_s *state;
+
+	*ifindex = ifa->ifa_index;
+	if (ifa->ifa_family != AF_INET || (ifa->ifa_flags & IFA_F_SECONDARY))
+		return;
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFA_LOCAL || (rta->rta_type == IFA_ADDRESS && !addr.s_addr))
+			memcpy(&addr, RTA_DATA(rta), sizeof(addr));
+	}
+	state = net_state_find(ifa->ifa_index, 0);
+	if (!state)
+		return;
+	if (nh->nlmsg_type == RTM_NEWADDR) {
+		state->addr = addr;
+		state->netmask.s_addr =
+		    ifa->ifa_prefixlen ? htonl(0xFFFFFFFFu << (32 - ifa->ifa_prefixlen)) : 0;
+	} else if (state->addr.s_addr == addr.s_addr) {
+		state->addr.s_addr = 0;
+		state->netmask.s_addr = 0;
+	}
+}
+
+static void net_state_update_route(struct nlmsghdr *nh, int *ifindex) {
+	struct rtmsg *rtm = NLMSG_DATA(nh);
+	struct rtattr *rta = RTM_RTA(rtm);
+	int len = RTM_PAYLOAD(nh);
+	struct in_addr gateway = {0};
+	net_if_state_s *state;
+	int oif = 0;
+
+	if (rtm->rtm_family != AF_INET || rtm->rtm_table != RT_TABLE_MAIN || rtm->rtm_dst_len)
+		return;
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == RTA_OIF)
+			oif = *(int *)RTA_DATA(rta);
+		else if (rta->rta_type == RTA_GATEWAY)
+			memcpy(&gateway, RTA_DATA(rta), sizeof(gateway));
+	}
+	// a route without an output interface, e.g. blackhole, belongs to no slot
+	if (!oif)
+		return;
+	*ifindex = oif;
+	state = net_state_find(oif, 0);
+	if (!state)
+		return;
+	if (nh->nlmsg_type == RTM_NEWROUTE)
+		state->gateway = gateway;
+	else if (state->gateway.s_addr == gateway.s_addr)
+		state->gateway.s_addr = 0;
+}
+
+int rk_net_state_update(struct nlmsghdr *nh, int *ifindex) {
+	int ret = NET_STATE_NO_CHANGE;
+	int index = 0;
+
+	pthread_rwlock_wrlock(&g_net_state_lock);
+	switch (nh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		ret = net_state_update_link(nh, &index);
+		break;
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		net_state_update_addr(nh, &index);
+		break;
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		net_state_update_route(nh, &index);
+		break;
+	default:
+		break;
+	}
+	pthread_rwlock_unlock(&g_net_state_lock);
+	if (ifindex)
+		*ifindex = index;
+
+	return ret;
+}
+
+static int net_state_dump_handler(struct nlmsghdr *nh, void *arg) {
+	net_state_link_cb cb = (net_state_link_cb)arg;
+	int event, ifindex;
+
+	event = rk_net_state_update(nh, &ifindex);
+	if (cb && event != NET_STATE_NO_CHANGE)
+		cb(ifindex, event == NET_STATE_LINK_UP);
+
+	return 0;
+}
+
+int rk_net_state_init(void) {
+	if (g_net_state_fd >= 0)
+		return g_net_state_fd;
+	// subscribe first, so that nothing between the dump and the first read is lost
+	g_net_state_fd = net_nl_open(RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV4_ROUTE);
+	if (g_net_state_fd < 0)
+		return -1;
+
+	pthread_rwlock_wrlock(&g_net_state_lock);
+	memset(g_net_if, 0, sizeof(g_net_if));
+	pthread_rwlock_unlock(&g_net_state_lock);
+	net_nl_dump(RTM_GETLINK, AF_UNSPEC, net_state_dump_handler, NULL);
+	net_nl_dump(RTM_GETADDR, AF_INET, net_state_dump_handler, NULL);
+	net_nl_dump(RTM_GETROUTE, AF_INET, net_state_dump_handler, NULL);
+	g_net_state_ready = 1;
+
+	return g_net_state_fd;
+}
+
+int rk_net_state_resync(net_state_link_cb cb) {
+	int ret;
+
+	// events were lost, addresses and routes are dumped again from scratch and
+	// interfaces missing from the link dump are gone
+	pthread_rwlock_wrlock(&g_net_state_lock);
+	memset(g_net_if_seen, 0, sizeof(g_net_if_seen));
+	for (int i = 0; i < NET_STATE_MAX_IF; i++) {
+		g_net_if[i].addr.s_addr = 0;
+		g_net_if[i].netmask.s_addr = 0;
+		g_net_if[i].gateway.s_addr = 0;
+	}
+	pthread_rwlock_unlock(&g_net_state_lock);
+	ret = net_nl_dump(RTM_GETLINK, AF_UNSPEC, net_state_dump_handler, cb);
+	if (!ret) {
+		pthread_rwlock_wrlock(&g_net_state_lock);
+		for (int i = 0; i < NET_STATE_MAX_IF; i++) {
+			if (g_net_if[i].index && !g_net_if_seen[i])
+				memset(&g_net_if[i], 0, sizeof(g_net_if[i]));
+		}
+		pthread_rwlock_unlock(&g_net_state_lock);
+	}
+	if (!ret)
+		ret = net_nl_dump(RTM_GETADDR, AF_INET, net_state_dump_handler, cb);
+	if (!ret)
+		ret = net_nl_dump(RTM_GETROUTE, AF_INET, net_state_dump_handler, cb);
+	if (ret) {
+		LOG_ERROR("netlink resync fail, %s\n", strerror(-ret));
+		return -1;
+	}
+
+	return 0;
+}
+
+void rk_net_state_deinit(void) {
+	g_net_state_ready = 0;
+	if (g_net_state_fd >= 0) {
+		close(g_net_state_fd);
+		g_net_state_fd = -1;
+	}
+}
+
+int rk_net_state_get(const char *ifname, net_if_state_s *state) {
+	int ret = -1;
+
+	if (!g_net_state_ready || !ifname)
+		return -1;
+	pthread_rwlock_rdlock(&g_net_state_lock);
+	for (int i = 0; i < NET_STATE_MAX_IF; i++) {
+		if (g_net_if[i].index && !strcmp(g_net_if[i].name, ifname)) {
+			*state = g_net_if[i];
+			ret = 0;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&g_net_state_lock);
+
+	return ret;
+}
+
+int rk_net_state_get_by_index(int ifindex, net_if_state_s *state) {
+	net_if_state_s *found;
+	int ret = -1;
+
+	if (!g_net_state_ready || ifindex <= 0)
+		return -1;
+	pthread_rwlock_rdlock(&g_net_state_lock);
+	found = net_state_find(ifindex, 0);
+	if (found) {
+		*state = *found;
+		ret = 0;
+	}
+	pthread_rwlock_unlock(&g_net_state_lock);
+
+	return ret;
+}
+
+int rk_net_if_set_up(const char *ifname, int up) {
+	struct ifreq ifr;
+	int fd, ret;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	ret = ioctl(fd, SIOCGIFFLAGS, &ifr);
+	if (!ret) {
+		if (up)
+			ifr.ifr_flags |= IFF_UP;
+		else
+			ifr.ifr_flags &= ~IFF_UP;
+		ret = ioctl(fd, SIOCSIFFLAGS, &ifr);
+	}
+	if (ret)
+		LOG_ERROR("set %s %s fail, %s\n", ifname, up ? "up" : "down", strerror(errno));
+	close(fd);
+
+	return ret;
+}
+
+int rk_net_if_set_mac(const char *ifname, const char *mac) {
+	unsigned char hw[6];
+	struct ifreq ifr;
+	int fd, ret;
+
+	if (sscanf(mac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &hw[0], &hw[1], &hw[2], &hw[3], &hw[4],
+	           &hw[5]) != 6) {
+		LOG_ERROR("invalid mac %s\n", mac);
+		return -1;
+	}
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	rk_net_if_set_up(ifname, 0);
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	ifr.ifr_hwaddr.sa_family = ARPHRD_ETHER;
+	memcpy(ifr.ifr_hwaddr.sa_data, hw, sizeof(hw));
+	ret = ioctl(fd, SIOCSIFHWADDR, &ifr);
+	if (ret)
+		LOG_ERROR("set %s mac fail, %s\n", ifname, strerror(errno));
+	close(fd);
+	rk_net_if_set_up(ifname, 1);
+
+	return ret;
+}
+
+typedef struct net_addr_list {
+	int ifindex;
+	int count;
+	struct {
+		struct in_addr addr;
+		int prefixlen;
+	} entry[16];
+} net_addr_list_s;
+
+static int net_addr_collect_handler(struct nlmsghdr *nh, void *arg) {
+	net_addr_list_s *list = arg;
+	struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+	struct rtattr *rta = IFA_RTA(ifa);
+	int len = IFA_PAYLOAD(nh);
+
+	if (nh->nlmsg_type != RTM_NEWADDR || ifa->ifa_family != AF_INET ||
+	    ifa->ifa_index != list->ifindex || list->count >= 16)
+		return 0;
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFA_LOCAL) {
+			memcpy(&list->entry[list->count].addr, RTA_DATA(rta), sizeof(struct in_addr));
+			list->entry[list->count].prefixlen = ifa->ifa_prefixlen;
+			list->count++;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int net_nl_addr(int type, int ifindex, struct in_addr addr, int prefixlen) {
+	struct {
+		struct nlmsghdr nh;
+		struct ifaddrmsg ifa;
+		char attr[64];
+	} req;
+	struct in_addr broadcast;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifa));
+	req.nh.nlmsg_type = type;
+	if (type == RTM_NEWADDR)
+		req.nh.nlmsg_flags = NLM_F_CREATE | NLM_F_REPLACE;
+	req.ifa.ifa_family = AF_INET;
+	req.ifa.ifa_prefixlen = prefixlen;
+	req.ifa.ifa_index = ifindex;
+	net_nl_addattr(&req.nh, IFA_LOCAL, &addr, sizeof(addr));
+	net_nl_addattr(&req.nh, IFA_ADDRESS, &addr, sizeof(addr));
+	if (type == RTM_NEWADDR && prefixlen < 31) {
+		broadcast.s_addr = addr.s_addr | htonl(0xFFFFFFFFu >> prefixlen);
+		net_nl_addattr(&req.nh, IFA_BROADCAST, &broadcast, sizeof(broadcast));
+	}
+
+	return net_nl_transact(&req.nh, NULL, NULL);
+}
+
+int rk_net_ipv4_flush(const char *ifname) {
+	net_addr_list_s list;
+	int ret = 0;
+
+	memset(&list, 0, sizeof(list));
+	list.ifindex = if_nametoindex(ifname);
+	if (!list.ifindex)
+		return -1;
+	net_nl_dump(RTM_GETADDR, AF_INET, net_addr_collect_handler, &list);
+	for (int i = 0; i < list.count; i++) {
+		if (net_nl_addr(RTM_DELADDR, list.ifindex, list.entry[i].addr, list.entry[i].prefixlen))
+			ret = -1;
+	}
+
+	return ret;
+}
+
+int rk_net_ipv4_set_addr(const char *ifname, const char *address, const char *netmask) {
+	struct in_addr addr, mask;
+	int ifindex, ret;
+
+	ifindex = if_nametoindex(ifname);
+	if (!ifindex || !inet_aton(address, &addr) || !inet_aton(netmask, &mask)) {
+		LOG_ERROR("invalid %s %s/%s\n", ifname, address, netmask);
+		return -1;
+	}
+	rk_net_ipv4_flush(ifname);
+	ret = net_nl_addr(RTM_NEWADDR, ifindex, addr, __builtin_popcount(mask.s_addr));
+	if (ret)
+		LOG_ERROR("add %s to %s fail, %s\n", address, ifname, strerror(-ret));
+
+	return ret;
+}
+
+static int net_nl_default_route(int type, int ifindex, const struct in_addr *gateway) {
+	struct {
+		struct nlmsghdr nh;
+		struct rtmsg rtm;
+		char attr[64];
+	} req;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(req.rtm));
+	req.nh.nlmsg_type = type;
+	req.rtm.rtm_family = AF_INET;
+	req.rtm.rtm_table = RT_TABLE_MAIN;
+	if (type == RTM_NEWROUTE) {
+		req.nh.nlmsg_flags = NLM_F_CREATE | NLM_F_REPLACE;
+		req.rtm.rtm_protocol = RTPROT_BOOT;
+		req.rtm.rtm_scope = RT_SCOPE_UNIVERSE;
+		req.rtm.rtm_type = RTN_UNICAST;
+	} else {
+		req.rtm.rtm_scope = RT_SCOPE_NOWHERE;
+	}
+	if (gateway)
+		net_nl_addattr(&req.nh, RTA_GATEWAY, gateway, sizeof(*gateway));
+	if (ifindex)
+		net_nl_addattr(&req.nh, RTA_OIF, &ifindex, sizeof(ifindex));
+
+	return net_nl_transact(&req.nh, NULL, NULL);
+}
+
+int rk_net_route_set_default(const char *ifname, const char *gateway) {
+	struct in_addr gw;
+	int ret;
+
+	if (!inet_aton(gateway, &gw)) {
+		LOG_ERROR("invalid gateway %s\n", gateway);
+		return -1;
+	}
+	ret = net_nl_default_route(RTM_NEWROUTE, if_nametoindex(ifname), &gw);
+	if (ret)
+		LOG_ERROR("add default gw %s fail, %s\n", gateway, strerror(-ret));
+
+	return ret;
+}
+
+int rk_net_route_del_default(const char *ifname) {
+	int ifindex = ifname ? if_nametoindex(ifname) : 0;
+
+	// there may be one default route per metric, remove them all
+	for (int i = 0; i < 8; i++) {
+		if (net_nl_default_route(RTM_DELROUTE, ifindex, NULL))
+			break;
+	}
+
+	return 0;
+}
+
+int rk_net_resolv_clear(void) {
+	int fd = open(NET_RESOLV_CONF, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if (fd < 0)
+		return -1;
+	close(fd);
+
+	return 0;
+}
+
+int rk_net_dhcp_start(const char *ifname) {
+	pid_t pid;
+	int status;
+
+	// double fork, so that udhcpc is reparented to init and never left as a zombie
+	pid = fork();
+	if (pid < 0) {
+		LOG_ERROR("fork fail, %s\n", strerror(errno));
+		return -1;
+	}
+	if (pid == 0) {
+		if (fork() == 0) {
+			// no -q, udhcpc stays to renew the lease until rk_net_dhcp_stop
+			execlp("udhcpc", "udhcpc", "-i", ifname, "-T", "1", "-A", "0", "-b", (char *)NULL);
+			_exit(127);
+		}
+		_exit(0);
+	}
+	waitpid(pid, &status, 0);
+
+	return 0;
+}
+
+int rk_net_dhcp_stop(void) {
+	char path[64], comm[32];
+	struct dirent *entry;
+	DIR *dir;
+	FILE *fp;
+	pid_t pid;
+
+	dir = opendir("/proc");
+	if (!dir)
+		return -1;
+	while ((entry = readdir(dir)) != NULL) {
+		pid = atoi(entry->d_name);
+		if (pid <= 0)
+			continue;
+		snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		if (fgets(comm, sizeof(comm), fp) && !strncmp(comm, "udhcpc\n", 7))
+			kill(pid, SIGKILL);
+		fclose(fp);
+	}
+	closedir(dir);
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef __NET_STATE_H__
+#define __NET_STATE_H__
+
+#include <linux/netlink.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NET_STATE_MAX_IF 8
+
+enum {
+	NET_STATE_NO_CHANGE = 0,
+	NET_STATE_LINK_UP,
+	NET_STATE_LINK_DOWN,
+};
+
+typedef struct net_if_state {
+	int index; // 0 means the slot is free
+	char name[IFNAMSIZ];
+	unsigned int flags; // IFF_*
+	struct in_addr addr;
+	struct in_addr netmask;
+	struct in_addr gateway; // default route through this interface
+} net_if_state_s;
+
+/**
+ * @brief open the netlink socket subscribed to link/ipv4 address/ipv4 route
+ *        events and fill the cache with a dump of the current state
+ * @return the event socket fd, -1 on error
+ */
+int rk_net_state_init(void);
+void rk_net_state_deinit(void);
+
+typedef void (*net_state_link_cb)(int ifindex, int up);
+/**
+ * @brief dump the current state again after events were lost, e.g. ENOBUFS
+ * @param cb called for every carrier edge found by the dump, may be NULL
+ * @return 0, -1 on error
+ */
+int rk_net_state_resync(net_state_link_cb cb);
+
+/**
+ * @brief apply one netlink message to the cache
+ * @param[out] ifindex interface the message is about
+ * @return NET_STATE_LINK_UP/NET_STATE_LINK_DOWN on a carrier edge,
+ *         NET_STATE_NO_CHANGE otherwise
+ */
+int rk_net_state_update(struct nlmsghdr *nh, int *ifindex);
+
+// Getters answer from the cache, they return -1 if the cache is not running
+// or the interface does not exist.
+int rk_net_state_get(const char *ifname, net_if_state_s *state);
+int rk_net_state_get_by_index(int ifindex, net_if_state_s *state);
+
+// Changes are applied in-process through netlink/ioctl, no shell commands.
+int rk_net_if_set_up(const char *ifname, int up);
+int rk_net_if_set_mac(const char *ifname, const char *mac);
+int rk_net_ipv4_flush(const char *ifname);
+int rk_net_ipv4_set_addr(const char *ifname, const char *address, const char *netmask);
+int rk_net_route_set_default(const char *ifname, const char *gateway);
+int rk_net_route_del_default(const char *ifname);
+int rk_net_resolv_clear(void);
+int rk_net_dhcp_start(const char *ifname);
+int rk_net_dhcp_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,7 @@
 #include "network.h"
 #include "Rk_wifi.h"
 #include "common.h"
+#include "net_state.h"
 #include "ntp.h"
 #include <linux/if.h> // must be included later than <net/if.h>
 
@@ -17,7 +18,6 @@
 
 static char netmode[32];
 static rk_network_cb rk_cb;
-static int netlink_fd = 0;
 static int g_network_run_ = 0;
 static pthread_t ntp_client_thread_id;
 static void *g_ntp_signal = NULL;
@@ -195,27 +195,21 @@ RKIPC_MAYBE_UNUSED static int whether_ether_is_linked(char *ifname, int ifname_s
 
 int rk_network_ipv4_set(char *interface, char *method, char *address, char *netmask,
                         char *gateway) {
-	char netconfig_cmd[512] = {0};
-
 	if (strcasecmp(method, "static") == 0) {
-		snprintf(netconfig_cmd, sizeof(netconfig_cmd), "ifconfig %s %s netmask %s", interface,
-		         address, netmask);
-		memcpy(netmode, method, strlen(method));
-		LOG_INFO("netconfig_cmd:%s\n", netconfig_cmd);
-		system(netconfig_cmd);
+		snprintf(netmode, sizeof(netmode), "%s", method);
+		LOG_INFO("%s %s netmask %s gw %s\n", interface, address, netmask, gateway);
+		rk_net_dhcp_stop();
+		if (rk_net_ipv4_set_addr(interface, address, netmask))
+			return -1;
 		//处理路由
-		// if( Ether_info.link_type != 1 ){
-		snprintf(netconfig_cmd, sizeof(netconfig_cmd), "route add -net default gw %s", gateway);
-		LOG_INFO("netconfig_cmd:%s\n", netconfig_cmd);
-		system(netconfig_cmd);
-		//}
+		rk_net_route_set_default(interface, gateway);
 	}
 	// IPv4 DHCP
 	if (strcasecmp(method, "dhcp") == 0) {
 		// Ether_info.v4_is_dhcp = true;
-		memcpy(netmode, method, strlen(method));
 		snprintf(netmode, sizeof(netmode), "%s", method);
-		system("udhcpc -n &");
+		rk_net_dhcp_stop();
+		rk_net_dhcp_start(interface);
 	}
 
 	return 0;
@@ -230,6 +224,19 @@ int rk_network_ipv4_get(char *interface, char *method, char *address, char *netm
 	struct ifreq ifrcopy;
 	char ip[32] = {0};
 	char subnetMask[32] = {0};
+	net_if_state_s state;
+
+	if (!rk_net_state_get(interface, &state)) {
+		if (!state.addr.s_addr)
+			return -1;
+		inet_ntop(AF_INET, &state.addr, address, INET_ADDRSTRLEN);
+		inet_ntop(AF_INET, &state.netmask, netmask, INET_ADDRSTRLEN);
+		inet_ntop(AF_INET, &state.gateway, gateway, INET_ADDRSTRLEN);
+		if (strcmp(netmode, "") == 0)
+			snprintf(netmode, sizeof(netmode), "dhcp"); //默认DHCP连接
+		strcpy(method, netmode);
+		return 0;
+	}
 
 	if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
 		perror("socket");
@@ -418,21 +425,7 @@ int rk_network_get_mac(const char *ifname, char *mac) {
 	return 0;
 }
 
-void rk_network_set_mac(const char *ifname, const char *mac) {
-	char ifcmd[128];
-
-	memset(ifcmd, 0, sizeof(ifcmd));
-	snprintf(ifcmd, sizeof(ifcmd), "ifconfig %s down", ifname);
-	system(ifcmd);
-
-	memset(ifcmd, 0, sizeof(ifcmd));
-	snprintf(ifcmd, sizeof(ifcmd), "ifconfig %s hw ether %s", ifname, mac);
-	system(ifcmd);
-
-	memset(ifcmd, 0, sizeof(ifcmd));
-	snprintf(ifcmd, sizeof(ifcmd), "ifconfig %s up", ifname);
-	system(ifcmd);
-}
+void rk_network_set_mac(const char *ifname, const char *mac) { rk_net_if_set_mac(ifname, mac); }
 
 int rk_network_nicspeed_get(const char *ifname, int *speed, int *duplex, int *autoneg) {
 	struct ifreq ifr;
@@ -645,153 +638,115 @@ int rk_network_nicspeed_support_get(const char *ifname, char *nic_supported) {
 
 int rk_ethernet_power_set(const char *ifname, int powerswitch) {
 	if (powerswitch == 1) {
-		char netconfig_cmd[512] = {0};
 		// ifconfig up 网络接口
-		if (rk_nic_state_get(ifname) == ETH_DOWN) { //以太网，网卡未激活;*/
-			snprintf(netconfig_cmd, sizeof(netconfig_cmd), "ifconfig %s up",
-			         ifname); //激活网卡，如:ifconfig eth0 up
-			system(netconfig_cmd);
-		}
-		return 0;
+		if (rk_nic_state_get(ifname) == ETH_DOWN) //以太网，网卡未激活
+			return rk_net_if_set_up(ifname, 1);
+	} else if (powerswitch == 0) {
+		LOG_INFO("%s down\n", ifname);
+		return rk_net_if_set_up(ifname, 0);
 	}
 
-	else if (powerswitch == 0) {
-		char netconfig_cmd[512] = {0};
-		snprintf(netconfig_cmd, sizeof(netconfig_cmd), "ifconfig %s down", ifname);
-		LOG_INFO("%s\n", netconfig_cmd);
-		system(netconfig_cmd);
+	return 0;
+}
 
-		return 0;
-	}
+static void rk_network_link_changed(int ifindex, int up) {
+	net_if_state_s state;
 
-	return 0;
+	if (rk_net_state_get_by_index(ifindex, &state))
+		return;
+	LOG_INFO("[%s] link %s\n", state.name, up ? "up" : "down");
+	if (up) {
+		rk_net_dhcp_stop();
+		rk_net_route_del_default(NULL);
+		rk_net_resolv_clear();
+		rk_net_dhcp_start(state.name);
+	} else {
+		rk_net_ipv4_flush(state.name);
+	}
+	if (rk_cb)
+		rk_cb(up);
 }
 
 int rk_network_get_cable_state() {
-	int fd, retval, status;
+	int fd, retval, ifindex, event;
 	char buf[BUFLEN] = {0};
 	int len = BUFLEN;
-	struct sockaddr_nl addr;
 	struct nlmsghdr *nh;
-	struct ifinfomsg *ifinfo;
-	char name[IFNAMSIZ], cmd1[64], cmd2[64];
-	// struct rtattr *attr;
 
-	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
-	netlink_fd = fd;
+	fd = rk_net_state_init();
+	if (fd < 0)
+		return -1;
 	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &len, sizeof(len));
-	memset(&addr, 0, sizeof(addr));
-	addr.nl_family = AF_NETLINK;
-	addr.nl_groups = RTNLGRP_LINK;
-	bind(fd, (struct sockaddr *)&addr, sizeof(addr));
-	while ((retval = read(fd, buf, BUFLEN)) > 0) {
-		LOG_INFO("read Cable state\n");
+	while (g_network_run_) {
+		retval = read(fd, buf, BUFLEN);
+		if (retval < 0 && errno == EINTR)
+			continue;
+		// the socket overflowed, the cache no longer matches the kernel
+		if (retval < 0 && errno == ENOBUFS) {
+			LOG_WARN("netlink events lost, resync\n");
+			if (rk_net_state_resync(rk_network_link_changed))
+				break;
+			continue;
+		}
+		if (retval <= 0) {
+			LOG_ERROR("netlink read fail, %s\n", retval ? strerror(errno) : "closed");
+			break;
+		}
 		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, retval); nh = NLMSG_NEXT(nh, retval)) {
 			if (nh->nlmsg_type == NLMSG_DONE)
 				break;
-			else if (nh->nlmsg_type == NLMSG_ERROR)
-				return -1;
-			else if (nh->nlmsg_type != RTM_NEWLINK)
-				continue;
-			ifinfo = NLMSG_DATA(nh);
-
-			if_indextoname(ifinfo->ifi_index, name);
-			LOG_INFO("\n[%s] link %s\n", name, (ifinfo->ifi_flags & IFF_LOWER_UP) ? "up" : "down");
-
-			memset(cmd1, 0, 32);
-			memset(cmd2, 0, 32);
-			sprintf(cmd1, "udhcpc -i %s -T 1 -A 0 -b -q", name);
-			sprintf(cmd2, "ifconfig %s 0.0.0.0", name);
-
-			if (ifinfo->ifi_flags & IFF_LOWER_UP) {
-				status = 1;
-				system("killall -9 udhcpc");
-				system("route del default gw 0.0.0.0");
-				system("cat /dev/null > /etc/resolv.conf");
-				system(cmd1);
-			} else {
-				status = 0;
-				system(cmd2);
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				LOG_WARN("netlink error %d, resync\n",
+				         ((struct nlmsgerr *)NLMSG_DATA(nh))->error);
+				if (rk_net_state_resync(rk_network_link_changed))
+					goto fail;
+				break;
 			}
-
-			if (rk_cb)
-				rk_cb(status);
-
-			/*
-			 attr = (struct rtattr*)(((char*)nh) + NLMSG_SPACE(sizeof(*ifinfo)));
-			 len = nh->nlmsg_len - NLMSG_SPACE(sizeof(*ifinfo));
-			 for (; RTA_OK(attr, len); attr = RTA_NEXT(attr, len)){
-			     if (attr->rta_type == IFLA_IFNAME)  {
-			         //LOG_INFO(" %s\n", (char*)RTA_DATA(attr));
-			         break;
-			     }
-			 }
-			 LOG_INFO("\n");
-			 */
+			event = rk_net_state_update(nh, &ifindex);
+			if (event != NET_STATE_NO_CHANGE)
+				rk_network_link_changed(ifindex, event == NET_STATE_LINK_UP);
 		}
 	}
+	if (!g_network_run_)
+		return 0;
+fail:
+	// nobody keeps the cache up to date any more, getters go back to ioctl
+	rk_net_state_deinit();
 
-	return 0;
+	return -1;
 }
 
 int rk_nic_state_get(const char *ifname) {
-	char buffer[BUFSIZ];
-	char cmd[100];
-	FILE *read_fp;
-	int chars_read;
-	int ret = 0;
-
-	memset(buffer, 0, BUFSIZ);
-	memset(cmd, 0, 100);
-	sprintf(cmd, "ifconfig -a | grep %s", ifname);
-	read_fp = popen(cmd, "r");
-	if (read_fp != NULL) {
-		chars_read = fread(buffer, sizeof(char), BUFSIZ - 1, read_fp);
-		pclose(read_fp);
-
-		if (chars_read > 0) {
-			ret = 1;
-		} else {
-			fprintf(stderr, "%s: NO FOUND\r\n", ifname);
+	net_if_state_s state;
+	struct ifreq ifr;
+	int fd, ret;
+
+	if (rk_net_state_get(ifname, &state)) {
+		// cache not running, ask the kernel directly
+		fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (fd < 0)
+			return -1;
+		memset(&ifr, 0, sizeof(ifr));
+		snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+		ret = ioctl(fd, SIOCGIFFLAGS, &ifr);
+		close(fd);
+		if (ret) {
+			LOG_INFO("%s: NO FOUND\n", ifname);
 			return 0;
 		}
+		state.flags = (unsigned short)ifr.ifr_flags;
 	}
-	if (ret == 1) {
-		memset(buffer, 0, BUFSIZ);
-		memset(cmd, 0, 100);
-		sprintf(cmd, "ifconfig |grep %s", ifname);
-		read_fp = popen(cmd, "r");
-		if (read_fp != NULL) {
-			chars_read = fread(buffer, sizeof(char), BUFSIZ - 1, read_fp);
-			pclose(read_fp);
-
-			if (chars_read > 0) {
-				ret = 2;
-			} else {
-				fprintf(stderr, "%s: DOWN\r\n", ifname);
-				return 1;
-			}
-		}
+	if (!(state.flags & IFF_UP)) {
+		LOG_INFO("%s: DOWN\n", ifname);
+		return 1;
 	}
-	if (ret == 2) {
-		memset(buffer, 0, BUFSIZ);
-		memset(cmd, 0, 100);
-		sprintf(cmd, "ifconfig %s | grep RUNNING | awk '{print $3}'", ifname);
-		read_fp = popen(cmd, "r");
-		if (read_fp != NULL) {
-			chars_read = fread(buffer, sizeof(char), BUFSIZ - 1, read_fp);
-			pclose(read_fp);
-
-			if (chars_read > 0) {
-				fprintf(stderr, "%s: LINKED\r\n", ifname);
-				return 3;
-			} else {
-				fprintf(stderr, "%s: UNPLUGGED\r\n", ifname);
-				return 2;
-			}
-		}
+	if (!(state.flags & IFF_RUNNING)) {
+		LOG_INFO("%s: UNPLUGGED\n", ifname);
+		return 2;
 	}
-	return -1;
+	LOG_INFO("%s: LINKED\n", ifname);
+
+	return 3;
 }
 
 static void *rk_net_proc() {
@@ -857,7 +812,7 @@ void rk_network_deinit() { // pthread_t pthid
 			g_ntp_signal = NULL;
 		}
 	}
-	close(netlink_fd);
+	rk_net_state_deinit();
 }
 
 int rk_wifi_power_get(int *on) {
@@ -2,8 +2,13 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 #include "utf8_to_gbk.h"
+#include "encode_utils.h"
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+
 extern const unsigned short mb_uni2gb_table[];
+extern const unsigned short mb_gb2uni_table[];
 
 const unsigned short mb_uni2gb_table[20902] = {
     0xd2bb, 0xb6a1, 0x8140, 0xc6df, 0x8141, 0x8142, 0x8143, 0xcdf2, 0xd5c9, 0xc8fd, 0xc9cf, 0xcfc2,
@@ -1749,31 +1754,143 @@ const unsigned short mb_uni2gb_table[20902] = {
     0xfd8b, 0xfd8c, 0xfd8d, 0xfd8e, 0xfd8f, 0xfd90, 0xfd91, 0xfd92, 0xfd93, 0xc1fa, 0xb9a8, 0xede8,
     0xfd94, 0xfd95, 0xfd96, 0xb9ea, 0xd9df, 0xfd97, 0xfd98, 0xfd99, 0xfd9a, 0xfd9b};
 
-int utf8_to_gbk(unsigned char *pszBufIn, int nBufInLen, unsigned char *pszBufOut) {
+// mb_uni2gb_table only covers the CJK unified ideographs. Everything else GBK
+// can represent (punctuation, full-width forms, kana, Cyrillic...) is looked up
+// in a table derived once from mb_gb2uni_table: entries sorted by code point,
+// with a 256-entry first level indexed by the high byte of the code point.
+#define UNI2GB_CJK_BEGIN 0x4e00
+#define UNI2GB_CJK_COUNT 20902
+#define GBK_LEAD_MIN 0x81
+#define GBK_LEAD_MAX 0xfe
+#define GBK_TRAIL_MIN 0x40
+#define GBK_TRAIL_MAX 0xfe
+#define GBK_TRAIL_NUM 0xbf
+
+typedef struct uni2gb_pair {
+	unsigned short unicode;
+	unsigned short gbk;
+} uni2gb_pair_s;
+
+static pthread_once_t g_uni2gb_once = PTHREAD_ONCE_INIT;
+static uni2gb_pair_s *g_uni2gb_extra;
+static unsigned short g_uni2gb_page[257];
+
+static int uni2gb_pair_cmp(const void *a, const void *b) {
+	const uni2gb_pair_s *pa = a;
+	const uni2gb_pair_s *pb = b;
+
+	if (pa->unicode != pb->unicode)
+		return pa->unicode - pb->unicode;
+	return pa->gbk - pb->gbk;
+}
+
+static int uni2gb_is_cjk(uint32_t unicode) {
+	return unicode >= UNI2GB_CJK_BEGIN && unicode < UNI2GB_CJK_BEGIN + UNI2GB_CJK_COUNT;
+}
+
+// Collect every non-ASCII, non-CJK mapping of the GBK table into out,
+// or only count them when out is NULL.
+static int uni2gb_extra_scan(uni2gb_pair_s *out) {
+	int lead, trail, count = 0;
+	unsigned short unicode;
+
+	for (lead = GBK_LEAD_MIN; lead <= GBK_LEAD_MAX; lead++) {
+		for (trail = GBK_TRAIL_MIN; trail <= GBK_TRAIL_MAX; trail++) {
+			if (trail == 0x7f)
+				continue;
+			unicode = mb_gb2uni_table[(lead - GBK_LEAD_MIN) * GBK_TRAIL_NUM +
+			                          (trail - GBK_TRAIL_MIN)];
+			// 0x003f marks unmapped cells, ASCII never needs the table
+			if (unicode < 0x80 || unicode == 0x1fff || uni2gb_is_cjk(unicode))
+				continue;
+			if (out) {
+				out[count].unicode = unicode;
+				out[count].gbk = (lead << 8) | trail;
+			}
+			count++;
+		}
+	}
+
+	return count;
+}
+
+static void uni2gb_extra_init(void) {
+	int count, page, i = 0;
+
+	count = uni2gb_extra_scan(NULL);
+	g_uni2gb_extra = malloc(count * sizeof(uni2gb_pair_s));
+	if (!g_uni2gb_extra)
+		return;
+	uni2gb_extra_scan(g_uni2gb_extra);
+	qsort(g_uni2gb_extra, count, sizeof(uni2gb_pair_s), uni2gb_pair_cmp);
+
+	for (page = 0; page <= 256; page++) {
+		while (i < count && (g_uni2gb_extra[i].unicode >> 8) < page)
+			i++;
+		g_uni2gb_page[page] = i;
+	}
+}
+
+static unsigned short unicode_to_gbk(uint32_t unicode) {
+	int lo, hi, mid;
+
+	if (uni2gb_is_cjk(unicode))
+		return mb_uni2gb_table[unicode - UNI2GB_CJK_BEGIN];
+	if (unicode > 0xffff)
+		return 0;
+
+	pthread_once(&g_uni2gb_once, uni2gb_extra_init);
+	if (!g_uni2gb_extra)
+		return 0;
+	lo = g_uni2gb_page[unicode >> 8];
+	hi = g_uni2gb_page[(unicode >> 8) + 1];
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (g_uni2gb_extra[mid].unicode < unicode)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < g_uni2gb_page[(unicode >> 8) + 1] && g_uni2gb_extra[lo].unicode == unicode)
+		return g_uni2gb_extra[lo].gbk;
+
+	return 0;
+}
+
+int utf8_to_gbk(unsigned char *src, int len, unsigned char *dst, int dst_len) {
 	int i = 0;
 	int j = 0;
-	unsigned short unicode;
+	int n;
+	uint32_t unicode;
 	unsigned short gbk;
-	for (; i < nBufInLen; i++, j++) {
-		if ((pszBufIn[i] & 0x80) == 0x00) { // 1λ
-			pszBufOut[j] = pszBufIn[i];
-		}                                        /*else if((pszBufIn[i] & 0xE0) == 0xC0) {// 2λ
-		                                           nLen = 2;
-		                                           unicode = (pszBufIn[i] & 0x1F << 6) | (pszBufIn[i+1]& 0x3F);
-		                                       }*/
-		else if ((pszBufIn[i] & 0xF0) == 0xE0) { // 3λ
-			if (i + 2 >= nBufInLen)
+
+	while (i < len) {
+		n = rk_encode_ascii_span(src + i, len - i);
+		if (n) {
+			if (j + n > dst_len)
 				return -1;
-			unicode = (((int)(pszBufIn[i] & 0x0F)) << 12) | (((int)(pszBufIn[i + 1] & 0x3F)) << 6) |
-			          (pszBufIn[i + 2] & 0x3F);
-			gbk = mb_uni2gb_table[unicode - 0x4e00];
-			pszBufOut[j] = gbk / 256;
-			pszBufOut[j + 1] = gbk % 256;
-			j++;
-			i += 2;
-		} else {
+			memcpy(dst + j, src + i, n);
+			i += n;
+			j += n;
+			continue;
+		}
+		n = rk_encode_utf8_decode(src + i, len - i, &unicode);
+		if (n < 0)
 			return -1;
+		i += n;
+		gbk = unicode_to_gbk(unicode);
+		if (!gbk) {
+			// valid UTF-8 that GBK cannot represent
+			if (j + 1 > dst_len)
+				return -1;
+			dst[j++] = '?';
+			continue;
 		}
+		if (j + 2 > dst_len)
+			return -1;
+		dst[j++] = gbk >> 8;
+		dst[j++] = gbk & 0xff;
 	}
+
 	return j;
 }
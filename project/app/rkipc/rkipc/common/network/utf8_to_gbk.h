@@ -8,7 +8,7 @@
 extern "C" {
 #endif
 
-int utf8_to_gbk(unsigned char *src, int len, unsigned char *dst);
+int utf8_to_gbk(unsigned char *src, int len, unsigned char *dst, int dst_len);
 
 #ifdef __cplusplus
 }
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include "bmp_reader.h"
+#include "osd_pixel.h"
 
 #ifdef LOG_TAG
 #undef LOG_TAG
@@ -54,6 +55,54 @@ void bmp32_to_argb8888(BITMAPINFOHEADER bitInfoHead, RGBQUAD *argb_8888_data, ui
 	}
 }
 
+// Convert straight from the BMP rows into a 16bpp canvas, without going
+// through an ARGB8888 copy of the whole image.
+void bmp_to_pixel_format(BITMAPINFOHEADER bitInfoHead, int pixel_format, unsigned char *buffer,
+                         uint8_t *bmp_data) {
+	LOG_INFO("bmp%d_to_%s\n", bitInfoHead.biBitCount, osd_pixel_format_name(pixel_format));
+	int k;
+	uint32_t a, color;
+	int width = bitInfoHead.biWidth;
+	int height = bitInfoHead.biHeight;
+	int bytes = bitInfoHead.biBitCount / 8;
+	int pitch = WIDTHBYTES(width * bitInfoHead.biBitCount);
+
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			k = (height - i - 1) * pitch + j * bytes;
+			color = bmp_data[k + 2] << 16 | bmp_data[k + 1] << 8 | bmp_data[k];
+			if (bytes == 4)
+				a = bmp_data[k + 3];
+			else if (color == 0x000008) // same color key as bmp24_to_argb8888
+				a = 0x00;
+			else
+				a = 0xFF;
+			osd_put_pixel(buffer, pixel_format, width, j, i, a << 24 | color);
+		}
+	}
+}
+
+// A 32-bit BMP with soft edges needs ARGB4444, anything with on/off alpha
+// fits in ARGB1555.
+static int bmp_choose_pixel_format(BITMAPINFOHEADER bitInfoHead, uint8_t *bmp_data) {
+	int width = bitInfoHead.biWidth;
+	int height = bitInfoHead.biHeight;
+	int pitch = WIDTHBYTES(width * bitInfoHead.biBitCount);
+	uint8_t a;
+
+	if (bitInfoHead.biBitCount != 32)
+		return OSD_PIXEL_FMT_ARGB1555;
+	for (int i = 0; i < height; i++) {
+		for (int j = 0; j < width; j++) {
+			a = bmp_data[i * pitch + j * 4 + 3];
+			if (a != 0x00 && a != 0xFF)
+				return OSD_PIXEL_FMT_ARGB4444;
+		}
+	}
+
+	return OSD_PIXEL_FMT_ARGB1555;
+}
+
 int bmp_check(FILE *pfile, BITMAPFILEHEADER *bitHead, BITMAPINFOHEADER *bitInfoHead) {
 	LOG_INFO("bmp_check\n");
 	uint16_t fileType;
@@ -104,14 +153,20 @@ int load_bmp_form_file(osd_data_s *data) {
 		return -1;
 	}
 
-	data->buffer = malloc(bitInfoHead.biWidth * bitInfoHead.biHeight * sizeof(RGBQUAD));
-	memset(data->buffer, 0, bitInfoHead.biWidth * bitInfoHead.biHeight * sizeof(RGBQUAD));
+	// images have no palette, any compact request means a 16bpp canvas
+	if (data->pixel_format != OSD_PIXEL_FMT_ARGB8888)
+		data->pixel_format = bmp_choose_pixel_format(bitInfoHead, bmp_data);
+	data->size = osd_buffer_size(data->pixel_format, bitInfoHead.biWidth, bitInfoHead.biHeight);
+	data->buffer = malloc(data->size);
 	if (data->buffer == NULL) {
 		printf("data->buffer malloc fail!\n");
 		return -1;
 	}
+	memset(data->buffer, 0, data->size);
 
-	if (bitInfoHead.biBitCount == 24) {
+	if (data->pixel_format != OSD_PIXEL_FMT_ARGB8888) {
+		bmp_to_pixel_format(bitInfoHead, data->pixel_format, data->buffer, bmp_data);
+	} else if (bitInfoHead.biBitCount == 24) {
 		bmp24_to_argb8888(bitInfoHead, (RGBQUAD *)data->buffer, bmp_data);
 	} else {
 		bmp32_to_argb8888(bitInfoHead, (RGBQUAD *)data->buffer, bmp_data);
@@ -119,7 +174,6 @@ int load_bmp_form_file(osd_data_s *data) {
 
 	data->width = bitInfoHead.biWidth;
 	data->height = bitInfoHead.biHeight;
-	data->size = data->width * data->height * sizeof(RGBQUAD);
 
 	LOG_INFO("FreeBmpData\n");
 	fclose(pfile);
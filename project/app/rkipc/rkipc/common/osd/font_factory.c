@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 #include "font_factory.h"
+#include "osd_pixel.h"
 
 #ifdef LOG_TAG
 #undef LOG_TAG
@@ -18,6 +19,7 @@ FT_Vector pen_;
 double font_angle_;
 int font_size_;
 unsigned int font_color_;
+unsigned int font_argb_;
 char *font_path_[128];
 unsigned int color_index_;
 unsigned int trans_index_;
@@ -86,6 +88,7 @@ unsigned int set_font_color(unsigned int font_color) {
 	font_color_ |= font_color >> 8 & 0x0000FF00;  // R
 	font_color_ |= font_color << 8 & 0x00FF0000;  // G
 	font_color_ |= font_color << 24 & 0xFF000000; // B
+	font_argb_ = 0xFF000000 | (font_color & 0x00FFFFFF);
 	// LOG_INFO("font_color is %08x, font_color_ is %08x\n", font_color,
 	// font_color_);
 	// unsigned char cR = font_color_ >> 16 & 0xFF;
@@ -223,3 +226,64 @@ int wstr_get_actual_advance_x(const wchar_t *wstr) {
 	pthread_mutex_unlock(&g_font_mutex);
 	return pen_.x / 64; // 26.6 Cartesian pixels, 64 = 2^6
 }
+
+// Same as draw_argb8888_buffer, but writes only the glyph pixels in the
+// requested format. For OSD_PIXEL_FMT_2BPP the glyph coverage picks palette index 1 to 3,
+// the font color at growing alpha, see osd_text_buffer_alloc.
+static void draw_format_buffer(unsigned char *buffer, int buf_w, int buf_h, int pixel_format) {
+	int i, j, p, q;
+	int left = slot_->bitmap_left;
+	int top = (face_->size->metrics.ascender >> 6) - slot_->bitmap_top;
+	int right = left + slot_->bitmap.width;
+	int bottom = top + slot_->bitmap.rows;
+	int coverage;
+
+	for (j = top, q = 0; j < bottom; j++, q++) {
+		int bmp_offset = q * slot_->bitmap.width;
+		for (i = left, p = 0; i < right; i++, p++) {
+			if (i < 0 || j < 0 || i >= buf_w || j >= buf_h)
+				continue;
+			coverage = slot_->bitmap.buffer[bmp_offset + p];
+			if (pixel_format == OSD_PIXEL_FMT_2BPP)
+				coverage = (coverage * (OSD_PALETTE_NUM - 1) + 127) / 255;
+			if (!coverage)
+				continue;
+			osd_put_pixel(buffer, pixel_format, buf_w, i, j,
+			              pixel_format == OSD_PIXEL_FMT_2BPP ? coverage : font_argb_);
+		}
+	}
+}
+
+void draw_format_text(unsigned char *buffer, int buf_w, int buf_h, int pixel_format,
+                      const wchar_t *wstr) {
+	if (pixel_format == OSD_PIXEL_FMT_ARGB8888) {
+		draw_argb8888_text(buffer, buf_w, buf_h, wstr);
+		return;
+	}
+	if (wstr == NULL) {
+		LOG_ERROR("wstr is NULL\n");
+		return;
+	}
+	int len = wcslen(wstr);
+	pen_.x = 0;
+	pen_.y = 0;
+	for (int i = 0; i < len; i++) {
+		pthread_mutex_lock(&g_font_mutex);
+		if (!face_) {
+			LOG_INFO("please check font_path %s\n", *font_path_);
+			pthread_mutex_unlock(&g_font_mutex);
+			return;
+		}
+		FT_Set_Transform(face_, NULL, &pen_);
+		if (FT_Load_Char(face_, wstr[i], FT_LOAD_DEFAULT | FT_LOAD_NO_BITMAP)) {
+			LOG_DEBUG("FT_Load_Char error\n");
+			pthread_mutex_unlock(&g_font_mutex);
+			continue;
+		}
+		FT_Render_Glyph(slot_, FT_RENDER_MODE_NORMAL);
+		draw_format_buffer(buffer, buf_w, buf_h, pixel_format);
+		pen_.x += slot_->advance.x;
+		pen_.y += slot_->advance.y;
+		pthread_mutex_unlock(&g_font_mutex);
+	}
+}
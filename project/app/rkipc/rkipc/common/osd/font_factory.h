@@ -24,6 +24,8 @@ unsigned int get_font_color();
 void draw_argb8888_buffer(unsigned int *buffer, int buf_w, int buf_h);
 void draw_argb8888_wchar(unsigned char *buffer, int buf_w, int buf_h, const wchar_t wch);
 void draw_argb8888_text(unsigned char *buffer, int buf_w, int buf_h, const wchar_t *wstr);
+void draw_format_text(unsigned char *buffer, int buf_w, int buf_h, int pixel_format,
+                      const wchar_t *wstr);
 int wstr_get_actual_advance_x(const wchar_t *wstr);
 
 #endif
\ No newline at end of file
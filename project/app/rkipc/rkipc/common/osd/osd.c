@@ -4,10 +4,11 @@
 // #include <locale.h>
 
 #include "osd.h"
+#include "RK_encode.h"
 #include "common.h"
 #include "font_factory.h"
 #include "osd_common.h"
-#include <iconv.h>
+#include "osd_pixel.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,6 +24,7 @@
 
 static int g_osd_server_run_ = 1;
 static int g_osd_font_already_set = 0;
+static int g_osd_compact_format = 0;
 static double g_x_rate = 1.0;
 static double g_y_rate = 1.0;
 static pthread_t osd_time_thread_id_;
@@ -77,54 +79,39 @@ int fill_text(osd_data_s *data) {
 	// if (ret)
 	// 	return -1;
 	set_font_color(data->text.font_color);
-	draw_argb8888_text(data->buffer, data->width, data->height, data->text.wch);
+	draw_format_text(data->buffer, data->width, data->height, data->pixel_format, data->text.wch);
 	// destroy_font();
 	return 0;
 }
 
+// osd.common:pixel_format = compact selects a 2bpp canvas for text, whose
+// palette is transparent then the font color at 1/3, 2/3 and full alpha, and
+// ARGB1555/4444 for images.
+static void osd_get_pixel_format_param() {
+	const char *pixel_format = rk_param_get_string("osd.common:pixel_format", "argb8888");
+
+	g_osd_compact_format = pixel_format && !strcmp(pixel_format, "compact");
+}
+
+static void osd_text_buffer_alloc(osd_data_s *osd_data) {
+	osd_data->pixel_format = g_osd_compact_format ? OSD_PIXEL_FMT_2BPP : OSD_PIXEL_FMT_ARGB8888;
+	memset(osd_data->palette, 0, sizeof(osd_data->palette));
+	for (int i = 1; i < OSD_PALETTE_NUM; i++)
+		osd_data->palette[i] = (0xFF * i / (OSD_PALETTE_NUM - 1)) << 24 |
+		                       (osd_data->text.font_color & 0x00FFFFFF);
+	osd_data->size = osd_buffer_size(osd_data->pixel_format, osd_data->width, osd_data->height);
+	osd_data->buffer = malloc(osd_data->size);
+	memset(osd_data->buffer, 0, osd_data->size);
+}
+
+static void osd_report_size(int id, osd_data_s *osd_data) {
+	LOG_INFO("osd[%d] %dx%d %s, %u bytes (argb8888 %u bytes)\n", id, osd_data->width,
+	         osd_data->height, osd_pixel_format_name(osd_data->pixel_format), osd_data->size,
+	         osd_buffer_size(OSD_PIXEL_FMT_ARGB8888, osd_data->width, osd_data->height));
+}
+
 int iconv_utf8_to_wchar(const char *in, wchar_t *out) {
-	char entry[128] = {'\0'};
-	// LOG_DEBUG("in is %s\n", in);
-	// LOG_DEBUG("strlen(in) is %ld\n", strlen(in));
-#if 0
-	int ret = mbstowcs(out, in, strlen(in));
-	LOG_DEBUG("mbstowcs ret is %d\n", ret);
-	if (ret == -1)
-		return ret;
-	out[ret] = '\0';
-	return ret;
-#endif
-	int ret;
-	size_t src_len = strlen(in);
-	// the bytes that Chinese and English in UTF-8 are different,
-	// and cannot be based on src_len calculates out_len
-	size_t out_len = MAX_WCH_BYTE;
-	// To have this temporary variable,
-	// otherwise iconv will directly overwrite the original pointer
-	char *tmp_out_buffer = (char *)out;
-	iconv_t cd = iconv_open("WCHAR_T", "UTF-8");
-	if (cd == (iconv_t)-1) {
-		perror("iconv_open error");
-		return -1;
-	}
-	memset(entry, 0, 128);
-	memcpy(entry, in, src_len); // iconv maybe change the char *
-	memset(entry + src_len, 0, 1);
-	char *tmp_in_buffer = (char *)entry;
-	ret = iconv(cd, &tmp_in_buffer, (size_t *)&src_len, &tmp_out_buffer,
-				(size_t *)&out_len);
-	if (ret == -1)
-		perror("iconv error");
-	iconv_close(cd);
-	out[abs(MAX_WCH_BYTE - out_len) / 4] = '\0';
-	// LOG_DEBUG("out_len is %d\n", out_len);
-	// LOG_DEBUG("wcslen(out) is %ld\n", wcslen(out));
-	// for (int i = 0; i < strlen(display_text); i++) {
-	// 	LOG_INFO("111 display_text [%02x]\n", display_text[i]);
-	// }
-	// for (int i = 0; i < wcslen(osd_data.text.wch); i++) {
-	// 	LOG_INFO("222 osd_data.text.wch [%04x]\n", osd_data.text.wch[i]);
-	// }
+	RK_encode_utf8_to_wchar((const unsigned char *)in, strlen(in), out, MAX_WCH_BYTE);
 
 	return 0;
 }
@@ -284,10 +271,9 @@ static void *osd_time_server(void *arg) {
 	generate_date_time(osd_data.text.format, osd_data.text.wch);
 	osd_data.width = UPALIGNTO16(wstr_get_actual_advance_x(osd_data.text.wch));
 	osd_data.height = UPALIGNTO16(osd_data.text.font_size);
-	osd_data.size = osd_data.width * osd_data.height * 4; // BGRA8888 4byte
-	osd_data.buffer = malloc(osd_data.size);
-	memset(osd_data.buffer, 0, osd_data.size);
+	osd_text_buffer_alloc(&osd_data);
 	fill_text(&osd_data);
+	osd_report_size(osd_time_id, &osd_data);
 	// rk_osd_bmp_destroy_(osd_time_id);
 	rk_osd_bmp_create_(osd_time_id, &osd_data);
 	free(osd_data.buffer);
@@ -307,9 +293,7 @@ static void *osd_time_server(void *arg) {
 		generate_date_time(osd_data.text.format, osd_data.text.wch);
 		osd_data.width = UPALIGNTO16(wstr_get_actual_advance_x(osd_data.text.wch));
 		osd_data.height = UPALIGNTO16(osd_data.text.font_size);
-		osd_data.size = osd_data.width * osd_data.height * 4; // BGRA8888 4byte
-		osd_data.buffer = malloc(osd_data.size);
-		memset(osd_data.buffer, 0, osd_data.size);
+		osd_text_buffer_alloc(&osd_data);
 		fill_text(&osd_data);
 		rk_osd_bmp_change_(osd_time_id, &osd_data);
 		free(osd_data.buffer);
@@ -332,6 +316,7 @@ int rk_osd_init() {
 	g_x_rate = (double)video_width / (double)normalized_screen_width;
 	g_y_rate = (double)video_height / (double)normalized_screen_height;
 	LOG_DEBUG("g_x_rate is %lf, g_y_rate is %lf\n", g_x_rate, g_y_rate);
+	osd_get_pixel_format_param();
 
 	for (int i = 0; i < MAX_OSD_NUM; i++) {
 		snprintf(entry, 127, "osd.%d:type", i);
@@ -352,8 +337,11 @@ int rk_osd_init() {
 		if (!strcmp(osd_type, "image")) {
 			snprintf(entry, 127, "osd.%d:image_path", i);
 			osd_data.image = rk_param_get_string(entry, NULL);
+			osd_data.pixel_format =
+			    g_osd_compact_format ? OSD_PIXEL_FMT_ARGB1555 : OSD_PIXEL_FMT_ARGB8888;
 			// load bmp
 			fill_image(&osd_data);
+			osd_report_size(i, &osd_data);
 			rk_osd_bmp_create_(i, &osd_data);
 			if (osd_data.buffer)
 				free(osd_data.buffer);
@@ -398,9 +386,7 @@ int rk_osd_init() {
 					continue;
 				osd_data.width = UPALIGNTO16(wstr_get_actual_advance_x(osd_data.text.wch));
 				osd_data.height = UPALIGNTO16(osd_data.text.font_size);
-				osd_data.size = osd_data.width * osd_data.height * 4; // BGRA8888 4byte
-				osd_data.buffer = malloc(osd_data.size);
-				memset(osd_data.buffer, 0, osd_data.size);
+				osd_text_buffer_alloc(&osd_data);
 				fill_text(&osd_data);
 				while (osd_data.origin_x + osd_data.width > video_width) {
 					osd_data.origin_x -= 16;
@@ -414,6 +400,7 @@ int rk_osd_init() {
 					          osd_data.origin_y, osd_data.width, osd_data.height);
 					continue;
 				}
+				osd_report_size(i, &osd_data);
 				rk_osd_bmp_create_(i, &osd_data);
 				free(osd_data.buffer);
 			} else if (!strcmp(osd_type, "dateTime")) {
@@ -501,6 +488,7 @@ int rk_osd_bmp_change(int osd_id) {
 	g_x_rate = (double)video_width / (double)normalized_screen_width;
 	g_y_rate = (double)video_height / (double)normalized_screen_height;
 	LOG_DEBUG("g_x_rate is %lf, g_y_rate is %lf\n", g_x_rate, g_y_rate);
+	osd_get_pixel_format_param();
 
 	snprintf(entry, 127, "osd.%d:type", osd_id);
 	osd_type = rk_param_get_string(entry, NULL);
@@ -534,9 +522,7 @@ int rk_osd_bmp_change(int osd_id) {
 		iconv_utf8_to_wchar(display_text, osd_data.text.wch);
 		osd_data.width = UPALIGNTO16(wcslen(osd_data.text.wch) * osd_data.text.font_size);
 		osd_data.height = UPALIGNTO16(osd_data.text.font_size);
-		osd_data.size = osd_data.width * osd_data.height * 4; // BGRA8888 4byte
-		osd_data.buffer = malloc(osd_data.size);
-		memset(osd_data.buffer, 0, osd_data.size);
+		osd_text_buffer_alloc(&osd_data);
 		fill_text(&osd_data);
 		while (osd_data.origin_x + osd_data.width > video_width) {
 			osd_data.origin_x -= 16;
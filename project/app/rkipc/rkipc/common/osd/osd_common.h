@@ -31,6 +31,15 @@ enum {
 	OSD_TYPE_BORDER = 3,
 };
 
+enum {
+	OSD_PIXEL_FMT_ARGB8888 = 0,
+	OSD_PIXEL_FMT_ARGB1555 = 1,
+	OSD_PIXEL_FMT_ARGB4444 = 2,
+	OSD_PIXEL_FMT_2BPP = 3, // palette indexed, see osd_data_s.palette
+};
+
+#define OSD_PALETTE_NUM 4
+
 typedef struct text_data {
 	wchar_t wch[MAX_WCH_BYTE];
 	unsigned int font_size;
@@ -58,6 +67,8 @@ typedef struct osd_data {
 	int height;
 	unsigned char *buffer;
 	unsigned int size;
+	int pixel_format;
+	unsigned int palette[OSD_PALETTE_NUM]; // 0xAARRGGBB, only for OSD_PIXEL_FMT_2BPP
 
 	int origin_x;
 	int origin_y;
@@ -0,0 +1,71 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "osd_pixel.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "osd_pixel.c"
+
+int osd_pixel_format_bits(int pixel_format) {
+	switch (pixel_format) {
+	case OSD_PIXEL_FMT_ARGB1555:
+	case OSD_PIXEL_FMT_ARGB4444:
+		return 16;
+	case OSD_PIXEL_FMT_2BPP:
+		return 2;
+	default:
+		return 32;
+	}
+}
+
+const char *osd_pixel_format_name(int pixel_format) {
+	switch (pixel_format) {
+	case OSD_PIXEL_FMT_ARGB1555:
+		return "argb1555";
+	case OSD_PIXEL_FMT_ARGB4444:
+		return "argb4444";
+	case OSD_PIXEL_FMT_2BPP:
+		return "2bpp";
+	default:
+		return "argb8888";
+	}
+}
+
+unsigned int osd_buffer_size(int pixel_format, int width, int height) {
+	return (width * height * osd_pixel_format_bits(pixel_format) + 7) / 8;
+}
+
+void osd_put_pixel(unsigned char *buffer, int pixel_format, int buf_w, int x, int y,
+                   uint32_t color) {
+	int index = y * buf_w + x;
+	uint32_t a = color >> 24 & 0xFF;
+	uint32_t r = color >> 16 & 0xFF;
+	uint32_t g = color >> 8 & 0xFF;
+	uint32_t b = color & 0xFF;
+	uint16_t *pixel16 = (uint16_t *)buffer;
+
+	switch (pixel_format) {
+	case OSD_PIXEL_FMT_ARGB1555:
+		pixel16[index] = (a >= 0x80) << 15 | (r >> 3) << 10 | (g >> 3) << 5 | (b >> 3);
+		break;
+	case OSD_PIXEL_FMT_ARGB4444:
+		pixel16[index] = (a >> 4) << 12 | (r >> 4) << 8 | (g >> 4) << 4 | (b >> 4);
+		break;
+	case OSD_PIXEL_FMT_2BPP:
+		// four pixels per byte, leftmost pixel in the low bits
+		buffer[index >> 2] &= ~(0x3 << ((index & 0x3) << 1));
+		buffer[index >> 2] |= (color & 0x3) << ((index & 0x3) << 1);
+		break;
+	default:
+		// A, R, G, B in memory like the RGBQUAD of bmp_reader.h and the font_color_ of
+		// draw_argb8888_buffer, which is what RK_FMT_ARGB8888 regions already take
+		buffer[index * 4] = a;
+		buffer[index * 4 + 1] = r;
+		buffer[index * 4 + 2] = g;
+		buffer[index * 4 + 3] = b;
+		break;
+	}
+}
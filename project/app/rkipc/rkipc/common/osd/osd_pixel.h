@@ -0,0 +1,19 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef _RK_OSD_PIXEL_H_
+#define _RK_OSD_PIXEL_H_
+
+#include "common.h"
+#include "osd_common.h"
+
+// Colors are passed around as 0xAARRGGBB. For OSD_PIXEL_FMT_2BPP the color
+// argument of osd_put_pixel is the palette index instead.
+int osd_pixel_format_bits(int pixel_format);
+const char *osd_pixel_format_name(int pixel_format);
+unsigned int osd_buffer_size(int pixel_format, int width, int height);
+void osd_put_pixel(unsigned char *buffer, int pixel_format, int buf_w, int x, int y,
+                   uint32_t color);
+
+#endif // _RK_OSD_PIXEL_H_
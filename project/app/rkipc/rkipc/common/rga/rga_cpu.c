@@ -0,0 +1,592 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "rga_cpu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RGA_CPU_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RGA_CPU_SSE2 1
+#endif
+
+typedef struct rga_cpu_fmt {
+	int yuv;     // NV12/NV21
+	int swap_uv; // NV21
+	int bpp;     // bytes per pixel of packed formats
+	int r, g, b; // byte offsets in a packed pixel
+	int a;       // -1 without alpha
+} rga_cpu_fmt_s;
+
+static int rga_cpu_get_fmt(int format, rga_cpu_fmt_s *fmt) {
+	memset(fmt, 0, sizeof(*fmt));
+	fmt->a = -1;
+	switch (format) {
+	case RK_FORMAT_YCrCb_420_SP:
+		fmt->swap_uv = 1;
+		// fall through
+	case RK_FORMAT_YCbCr_420_SP:
+		fmt->yuv = 1;
+		fmt->bpp = 1;
+		return 0;
+	case RK_FORMAT_RGBA_8888:
+		fmt->a = 3;
+		// fall through
+	case RK_FORMAT_RGB_888:
+		fmt->bpp = fmt->a < 0 ? 3 : 4;
+		fmt->r = 0;
+		fmt->g = 1;
+		fmt->b = 2;
+		return 0;
+	case RK_FORMAT_BGRA_8888:
+		fmt->a = 3;
+		// fall through
+	case RK_FORMAT_BGR_888:
+		fmt->bpp = fmt->a < 0 ? 3 : 4;
+		fmt->b = 0;
+		fmt->g = 1;
+		fmt->r = 2;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+static int rga_cpu_check(const rga_buffer_t *buf, rga_cpu_fmt_s *fmt) {
+	if (!buf->vir_addr || buf->width <= 0 || buf->height <= 0)
+		return IM_STATUS_INVALID_PARAM;
+	if (rga_cpu_get_fmt(buf->format, fmt))
+		return IM_STATUS_NOT_SUPPORTED;
+
+	return IM_STATUS_SUCCESS;
+}
+
+static int rga_cpu_wstride(const rga_buffer_t *buf) {
+	return buf->wstride > 0 ? buf->wstride : buf->width;
+}
+
+static int rga_cpu_hstride(const rga_buffer_t *buf) {
+	return buf->hstride > 0 ? buf->hstride : buf->height;
+}
+
+static uint8_t *rga_cpu_uv_plane(const rga_buffer_t *buf) {
+	return (uint8_t *)buf->vir_addr + rga_cpu_wstride(buf) * rga_cpu_hstride(buf);
+}
+
+// clip rect to the image, YUV420 rects are widened to even coordinates
+static int rga_cpu_clip(const rga_buffer_t *buf, const rga_cpu_fmt_s *fmt, im_rect *rect) {
+	int x0 = rect->x, y0 = rect->y;
+	int x1 = rect->x + rect->width, y1 = rect->y + rect->height;
+
+	if (x0 < 0)
+		x0 = 0;
+	if (y0 < 0)
+		y0 = 0;
+	if (x1 > buf->width)
+		x1 = buf->width;
+	if (y1 > buf->height)
+		y1 = buf->height;
+	if (fmt->yuv) {
+		// the chroma pairs stay inside an odd sized buffer
+		x0 &= ~1;
+		y0 &= ~1;
+		x1 = (x1 + 1) & ~1;
+		y1 = (y1 + 1) & ~1;
+		if (x1 > buf->width)
+			x1 = buf->width & ~1;
+		if (y1 > buf->height)
+			y1 = buf->height & ~1;
+	}
+	if (x1 <= x0 || y1 <= y0)
+		return -1;
+	rect->x = x0;
+	rect->y = y0;
+	rect->width = x1 - x0;
+	rect->height = y1 - y0;
+
+	return 0;
+}
+
+static void rga_cpu_rgb_to_yuv(int r, int g, int b, uint8_t *y, uint8_t *u, uint8_t *v) {
+	*y = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+	*u = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+	*v = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t rga_cpu_clamp(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+/* ---- kernels ---- */
+
+static void rga_cpu_fill_row16(uint8_t *dst, uint16_t pattern, int n) {
+	int i = 0;
+#if defined(RGA_CPU_NEON)
+	uint8x16_t v = vreinterpretq_u8_u16(vdupq_n_u16(pattern));
+	for (; i + 8 <= n; i += 8)
+		vst1q_u8(dst + i * 2, v);
+#elif defined(RGA_CPU_SSE2)
+	__m128i v = _mm_set1_epi16((short)pattern);
+	for (; i + 8 <= n; i += 8)
+		_mm_storeu_si128((__m128i *)(dst + i * 2), v);
+#endif
+	for (; i < n; i++) {
+		dst[i * 2] = pattern & 0xff;
+		dst[i * 2 + 1] = pattern >> 8;
+	}
+}
+
+static void rga_cpu_fill_row32(uint8_t *dst, uint32_t pattern, int n) {
+	int i = 0;
+#if defined(RGA_CPU_NEON)
+	uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(pattern));
+	for (; i + 4 <= n; i += 4)
+		vst1q_u8(dst + i * 4, v);
+#elif defined(RGA_CPU_SSE2)
+	__m128i v = _mm_set1_epi32((int)pattern);
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_si128((__m128i *)(dst + i * 4), v);
+#endif
+	for (; i < n; i++)
+		memcpy(dst + i * 4, &pattern, 4);
+}
+
+// d = (a * (128 - f) + b * f + 64) >> 7, f in [0, 128]
+static void rga_cpu_blend_row(uint8_t *d, const uint8_t *a, const uint8_t *b, int n, int f) {
+	int i = 0;
+
+	if (f == 0) {
+		memcpy(d, a, n);
+		return;
+	}
+#if defined(RGA_CPU_NEON)
+	uint8x8_t wa = vdup_n_u8(128 - f), wb = vdup_n_u8(f);
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t va = vld1q_u8(a + i), vb = vld1q_u8(b + i);
+		uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(va), wa), vget_low_u8(vb), wb);
+		uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(va), wa), vget_high_u8(vb), wb);
+		vst1q_u8(d + i, vcombine_u8(vrshrn_n_u16(lo, 7), vrshrn_n_u16(hi, 7)));
+	}
+#elif defined(RGA_CPU_SSE2)
+	__m128i wa = _mm_set1_epi16(128 - f), wb = _mm_set1_epi16(f);
+	__m128i round = _mm_set1_epi16(64), zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+		                           _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+		                           _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, round), 7);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, round), 7);
+		_mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < n; i++)
+		d[i] = (uint8_t)((a[i] * (128 - f) + b[i] * f + 64) >> 7);
+}
+
+// BT.601 limited range in Q6. The SIMD paths saturate at 16 bit before the
+// shift, which only affects values that clamp to 0 or 255 anyway.
+#define RGA_CPU_YUV_R(y, u, v) ((y) + 102 * (v))
+#define RGA_CPU_YUV_G(y, u, v) ((y)-52 * (v)-25 * (u))
+#define RGA_CPU_YUV_B(y, u, v) ((y) + 129 * (u))
+
+static void rga_cpu_nv12_to_rgb_row(const uint8_t *yrow, const uint8_t *uvrow, uint8_t *dst,
+                                    int width, const rga_cpu_fmt_s *src_fmt,
+                                    const rga_cpu_fmt_s *dst_fmt) {
+	int x = 0;
+	int uo = src_fmt->swap_uv, vo = !src_fmt->swap_uv;
+
+#if defined(RGA_CPU_NEON)
+	if (dst_fmt->bpp == 3) {
+		for (; x + 16 <= width; x += 16) {
+			uint8x16_t y = vld1q_u8(yrow + x);
+			uint8x8x2_t uv = vld2_u8(uvrow + x);
+			int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uv.val[uo])), vdupq_n_s16(128));
+			int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(uv.val[vo])), vdupq_n_s16(128));
+			int16x8x2_t uu = vzipq_s16(u, u), vv = vzipq_s16(v, v);
+			int16x8_t yy[2];
+			uint8x8_t r[2], g[2], b[2];
+			uint8x16x3_t out;
+			yy[0] = vmulq_n_s16(
+			    vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_low_u8(y))), vdupq_n_s16(16)), 74);
+			yy[1] = vmulq_n_s16(
+			    vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vget_high_u8(y))), vdupq_n_s16(16)), 74);
+			for (int k = 0; k < 2; k++) {
+				r[k] = vqshrun_n_s16(vqaddq_s16(yy[k], vmulq_n_s16(vv.val[k], 102)), 6);
+				g[k] = vqshrun_n_s16(vqsubq_s16(vqsubq_s16(yy[k], vmulq_n_s16(vv.val[k], 52)),
+				                                vmulq_n_s16(uu.val[k], 25)),
+				                     6);
+				b[k] = vqshrun_n_s16(vqaddq_s16(yy[k], vmulq_n_s16(uu.val[k], 129)), 6);
+			}
+			out.val[dst_fmt->r] = vcombine_u8(r[0], r[1]);
+			out.val[dst_fmt->g] = vcombine_u8(g[0], g[1]);
+			out.val[dst_fmt->b] = vcombine_u8(b[0], b[1]);
+			vst3q_u8(dst + x * 3, out);
+		}
+	}
+#elif defined(RGA_CPU_SSE2)
+	if (dst_fmt->bpp == 3) {
+		const __m128i zero = _mm_setzero_si128(), c128 = _mm_set1_epi16(128);
+		const __m128i c16 = _mm_set1_epi16(16), c74 = _mm_set1_epi16(74);
+		const __m128i c102 = _mm_set1_epi16(102), c52 = _mm_set1_epi16(52);
+		const __m128i c25 = _mm_set1_epi16(25), c129 = _mm_set1_epi16(129);
+		uint8_t rb[16], gb[16], bb[16];
+		for (; x + 16 <= width; x += 16) {
+			__m128i y = _mm_loadu_si128((const __m128i *)(yrow + x));
+			__m128i uv = _mm_loadu_si128((const __m128i *)(uvrow + x));
+			__m128i lo = _mm_and_si128(uv, _mm_set1_epi16(0xff));
+			__m128i hi = _mm_srli_epi16(uv, 8);
+			__m128i u = _mm_sub_epi16(uo ? hi : lo, c128);
+			__m128i v = _mm_sub_epi16(uo ? lo : hi, c128);
+			__m128i uu[2] = {_mm_unpacklo_epi16(u, u), _mm_unpackhi_epi16(u, u)};
+			__m128i vv[2] = {_mm_unpacklo_epi16(v, v), _mm_unpackhi_epi16(v, v)};
+			__m128i yy[2] = {
+			    _mm_mullo_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(y, zero), c16), c74),
+			    _mm_mullo_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(y, zero), c16), c74)};
+			__m128i r[2], g[2], b[2];
+			for (int k = 0; k < 2; k++) {
+				r[k] = _mm_srai_epi16(_mm_adds_epi16(yy[k], _mm_mullo_epi16(vv[k], c102)), 6);
+				g[k] = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(yy[k],
+				                                                    _mm_mullo_epi16(vv[k], c52)),
+				                                     _mm_mullo_epi16(uu[k], c25)),
+				                      6);
+				b[k] = _mm_srai_epi16(_mm_adds_epi16(yy[k], _mm_mullo_epi16(uu[k], c129)), 6);
+			}
+			_mm_storeu_si128((__m128i *)rb, _mm_packus_epi16(r[0], r[1]));
+			_mm_storeu_si128((__m128i *)gb, _mm_packus_epi16(g[0], g[1]));
+			_mm_storeu_si128((__m128i *)bb, _mm_packus_epi16(b[0], b[1]));
+			for (int k = 0; k < 16; k++) {
+				uint8_t *p = dst + (x + k) * 3;
+				p[dst_fmt->r] = rb[k];
+				p[dst_fmt->g] = gb[k];
+				p[dst_fmt->b] = bb[k];
+			}
+		}
+	}
+#endif
+	for (; x < width; x++) {
+		int y = (yrow[x] - 16) * 74;
+		int u = uvrow[(x & ~1) + uo] - 128;
+		int v = uvrow[(x & ~1) + vo] - 128;
+		uint8_t *p = dst + x * dst_fmt->bpp;
+		p[dst_fmt->r] = rga_cpu_clamp(RGA_CPU_YUV_R(y, u, v) >> 6);
+		p[dst_fmt->g] = rga_cpu_clamp(RGA_CPU_YUV_G(y, u, v) >> 6);
+		p[dst_fmt->b] = rga_cpu_clamp(RGA_CPU_YUV_B(y, u, v) >> 6);
+		if (dst_fmt->a >= 0)
+			p[dst_fmt->a] = 0xff;
+	}
+}
+
+/* ---- fill ---- */
+
+IM_STATUS rga_cpu_fill(rga_buffer_t dst, im_rect rect, uint32_t color) {
+	rga_cpu_fmt_s fmt;
+	int ret = rga_cpu_check(&dst, &fmt);
+	int stride = rga_cpu_wstride(&dst);
+	int r = color & 0xff, g = (color >> 8) & 0xff, b = (color >> 16) & 0xff;
+	uint8_t *base = (uint8_t *)dst.vir_addr;
+
+	if (ret != IM_STATUS_SUCCESS)
+		return ret;
+	if (rga_cpu_clip(&dst, &fmt, &rect))
+		return IM_STATUS_SUCCESS;
+
+	if (fmt.yuv) {
+		uint8_t y, u, v;
+		uint8_t *uv = rga_cpu_uv_plane(&dst);
+		rga_cpu_rgb_to_yuv(r, g, b, &y, &u, &v);
+		uint16_t pattern = fmt.swap_uv ? (v | u << 8) : (u | v << 8);
+		for (int j = rect.y; j < rect.y + rect.height; j++)
+			memset(base + j * stride + rect.x, y, rect.width);
+		for (int j = rect.y / 2; j < (rect.y + rect.height) / 2; j++)
+			rga_cpu_fill_row16(uv + j * stride + rect.x, pattern, rect.width / 2);
+	} else {
+		uint8_t px[4];
+		px[fmt.r] = r;
+		px[fmt.g] = g;
+		px[fmt.b] = b;
+		if (fmt.a >= 0)
+			px[fmt.a] = color >> 24;
+		for (int j = rect.y; j < rect.y + rect.height; j++) {
+			uint8_t *row = base + (j * stride + rect.x) * fmt.bpp;
+			if (fmt.bpp == 4) {
+				uint32_t pattern;
+				memcpy(&pattern, px, 4);
+				rga_cpu_fill_row32(row, pattern, rect.width);
+			} else if (j == rect.y) {
+				for (int i = 0; i < rect.width; i++)
+					memcpy(row + i * 3, px, 3);
+			} else {
+				memcpy(row, base + (rect.y * stride + rect.x) * 3, rect.width * 3);
+			}
+		}
+	}
+
+	return IM_STATUS_SUCCESS;
+}
+
+IM_STATUS rga_cpu_rectangle_array(rga_buffer_t dst, const im_rect *rect_array, int array_size,
+                                  uint32_t color, int thickness) {
+	IM_STATUS ret = IM_STATUS_SUCCESS;
+
+	for (int i = 0; i < array_size && ret == IM_STATUS_SUCCESS; i++) {
+		const im_rect *r = &rect_array[i];
+		if (thickness < 0) {
+			ret = rga_cpu_fill(dst, *r, color);
+			continue;
+		}
+		im_rect up = {r->x, r->y, r->width, thickness};
+		im_rect bottom = {r->x, r->y + r->height - thickness, r->width, thickness};
+		im_rect left = {r->x, r->y, thickness, r->height};
+		im_rect right = {r->x + r->width - thickness, r->y, thickness, r->height};
+		ret = rga_cpu_fill(dst, up, color);
+		if (ret == IM_STATUS_SUCCESS)
+			ret = rga_cpu_fill(dst, bottom, color);
+		if (ret == IM_STATUS_SUCCESS)
+			ret = rga_cpu_fill(dst, left, color);
+		if (ret == IM_STATUS_SUCCESS)
+			ret = rga_cpu_fill(dst, right, color);
+	}
+
+	return ret;
+}
+
+/* ---- mosaic ---- */
+
+// average every block x block cell of the area, coordinates in elements of
+// ch interleaved bytes
+static void rga_cpu_mosaic_plane(uint8_t *base, int stride, int ch, int x0, int y0, int x1,
+                                 int y1, int block) {
+	for (int by = y0; by < y1; by += block) {
+		int ey = by + block < y1 ? by + block : y1;
+		for (int bx = x0; bx < x1; bx += block) {
+			int ex = bx + block < x1 ? bx + block : x1;
+			int n = (ex - bx) * (ey - by);
+			for (int c = 0; c < ch; c++) {
+				int sum = 0;
+				for (int j = by; j < ey; j++)
+					for (int i = bx; i < ex; i++)
+						sum += base[j * stride + i * ch + c];
+				uint8_t avg = (uint8_t)((sum + n / 2) / n);
+				for (int j = by; j < ey; j++)
+					for (int i = bx; i < ex; i++)
+						base[j * stride + i * ch + c] = avg;
+			}
+		}
+	}
+}
+
+IM_STATUS rga_cpu_mosaic(rga_buffer_t image, im_rect rect, int mosaic_mode) {
+	rga_cpu_fmt_s fmt;
+	int ret = rga_cpu_check(&image, &fmt);
+	int stride = rga_cpu_wstride(&image);
+	int block = 8 << mosaic_mode;
+
+	if (ret != IM_STATUS_SUCCESS)
+		return ret;
+	if (mosaic_mode < IM_MOSAIC_8 || mosaic_mode > IM_MOSAIC_128)
+		return IM_STATUS_INVALID_PARAM;
+	if (rga_cpu_clip(&image, &fmt, &rect))
+		return IM_STATUS_SUCCESS;
+
+	if (fmt.yuv) {
+		rga_cpu_mosaic_plane((uint8_t *)image.vir_addr, stride, 1, rect.x, rect.y,
+		                     rect.x + rect.width, rect.y + rect.height, block);
+		rga_cpu_mosaic_plane(rga_cpu_uv_plane(&image), stride, 2, rect.x / 2, rect.y / 2,
+		                     (rect.x + rect.width) / 2, (rect.y + rect.height) / 2, block / 2);
+	} else {
+		rga_cpu_mosaic_plane((uint8_t *)image.vir_addr, stride * fmt.bpp, fmt.bpp, rect.x,
+		                     rect.y, rect.x + rect.width, rect.y + rect.height, block);
+	}
+
+	return IM_STATUS_SUCCESS;
+}
+
+/* ---- crop ---- */
+
+IM_STATUS rga_cpu_crop(rga_buffer_t src, rga_buffer_t dst, im_rect rect) {
+	rga_cpu_fmt_s fmt, dst_fmt;
+	int ret = rga_cpu_check(&src, &fmt);
+	int sstride = rga_cpu_wstride(&src), dstride = rga_cpu_wstride(&dst);
+	const uint8_t *s = (const uint8_t *)src.vir_addr;
+	uint8_t *d = (uint8_t *)dst.vir_addr;
+
+	if (ret == IM_STATUS_SUCCESS)
+		ret = rga_cpu_check(&dst, &dst_fmt);
+	if (ret != IM_STATUS_SUCCESS)
+		return ret;
+	if (src.format != dst.format)
+		return IM_STATUS_NOT_SUPPORTED;
+	if (rga_cpu_clip(&src, &fmt, &rect))
+		return IM_STATUS_INVALID_PARAM;
+	if (rect.width > dst.width)
+		rect.width = dst.width & (fmt.yuv ? ~1 : ~0);
+	if (rect.height > dst.height)
+		rect.height = dst.height & (fmt.yuv ? ~1 : ~0);
+
+	for (int j = 0; j < rect.height; j++)
+		memcpy(d + j * dstride * fmt.bpp, s + ((rect.y + j) * sstride + rect.x) * fmt.bpp,
+		       rect.width * fmt.bpp);
+	if (fmt.yuv) {
+		const uint8_t *suv = rga_cpu_uv_plane(&src);
+		uint8_t *duv = rga_cpu_uv_plane(&dst);
+		for (int j = 0; j < rect.height / 2; j++)
+			memcpy(duv + j * dstride, suv + (rect.y / 2 + j) * sstride + rect.x, rect.width);
+	}
+
+	return IM_STATUS_SUCCESS;
+}
+
+/* ---- resize ---- */
+
+// horizontal pass into tmp, then a SIMD vertical blend of two such rows
+static int rga_cpu_resize_plane(const uint8_t *src, int sstride, int sw, int sh, uint8_t *dst,
+                                int dstride, int dw, int dh, int ch) {
+	int *xi = (int *)malloc(dw * 3 * sizeof(int));
+	uint8_t *tmp[2] = {(uint8_t *)malloc(dw * ch), (uint8_t *)malloc(dw * ch)};
+	int tmp_row[2] = {-1, -1};
+	int *x1 = xi + dw, *xf = xi + dw * 2;
+
+	if (!xi || !tmp[0] || !tmp[1]) {
+		free(xi);
+		free(tmp[0]);
+		free(tmp[1]);
+		return -1;
+	}
+	// pixel centers aligned, Q7
+	for (int x = 0; x < dw; x++) {
+		int f = (int)(((2LL * x + 1) * sw - dw) * 128 / (2 * dw));
+		if (f < 0)
+			f = 0;
+		xi[x] = f >> 7;
+		xf[x] = f & 127;
+		if (xi[x] >= sw - 1) {
+			xi[x] = sw - 1;
+			xf[x] = 0;
+		}
+		x1[x] = xi[x] + 1 < sw ? xi[x] + 1 : xi[x];
+	}
+	for (int y = 0; y < dh; y++) {
+		int f = (int)(((2LL * y + 1) * sh - dh) * 128 / (2 * dh));
+		int yi, yf, rows[2];
+		if (f < 0)
+			f = 0;
+		yi = f >> 7;
+		yf = f & 127;
+		if (yi >= sh - 1) {
+			yi = sh - 1;
+			yf = 0;
+		}
+		rows[0] = yi;
+		rows[1] = yi + 1 < sh ? yi + 1 : yi;
+		if (tmp_row[1] == rows[0]) {
+			uint8_t *t = tmp[0];
+			tmp[0] = tmp[1];
+			tmp[1] = t;
+			tmp_row[0] = tmp_row[1];
+			tmp_row[1] = -1;
+		}
+		for (int k = 0; k < 2; k++) {
+			if (tmp_row[k] == rows[k] || (k == 1 && !yf))
+				continue;
+			const uint8_t *s = src + rows[k] * sstride;
+			for (int x = 0; x < dw; x++) {
+				const uint8_t *a = s + xi[x] * ch, *b = s + x1[x] * ch;
+				for (int c = 0; c < ch; c++)
+					tmp[k][x * ch + c] =
+					    (uint8_t)((a[c] * (128 - xf[x]) + b[c] * xf[x] + 64) >> 7);
+			}
+			tmp_row[k] = rows[k];
+		}
+		rga_cpu_blend_row(dst + y * dstride, tmp[0], tmp[1], dw * ch, yf);
+	}
+	free(xi);
+	free(tmp[0]);
+	free(tmp[1]);
+
+	return 0;
+}
+
+IM_STATUS rga_cpu_resize(rga_buffer_t src, rga_buffer_t dst) {
+	rga_cpu_fmt_s fmt, dst_fmt;
+	int ret = rga_cpu_check(&src, &fmt);
+	int sstride = rga_cpu_wstride(&src), dstride = rga_cpu_wstride(&dst);
+
+	if (ret == IM_STATUS_SUCCESS)
+		ret = rga_cpu_check(&dst, &dst_fmt);
+	if (ret != IM_STATUS_SUCCESS)
+		return ret;
+	if (src.format != dst.format)
+		return IM_STATUS_NOT_SUPPORTED;
+
+	if (fmt.yuv) {
+		ret = rga_cpu_resize_plane((const uint8_t *)src.vir_addr, sstride, src.width, src.height,
+		                           (uint8_t *)dst.vir_addr, dstride, dst.width, dst.height, 1);
+		ret |= rga_cpu_resize_plane(rga_cpu_uv_plane(&src), sstride, src.width / 2,
+		                            src.height / 2, rga_cpu_uv_plane(&dst), dstride,
+		                            dst.width / 2, dst.height / 2, 2);
+	} else {
+		ret = rga_cpu_resize_plane((const uint8_t *)src.vir_addr, sstride * fmt.bpp, src.width,
+		                           src.height, (uint8_t *)dst.vir_addr, dstride * fmt.bpp,
+		                           dst.width, dst.height, fmt.bpp);
+	}
+
+	return ret ? IM_STATUS_OUT_OF_MEMORY : IM_STATUS_SUCCESS;
+}
+
+/* ---- cvtcolor ---- */
+
+static void rga_cpu_rgb_to_nv12(const rga_buffer_t *src, const rga_cpu_fmt_s *src_fmt,
+                                const rga_buffer_t *dst, const rga_cpu_fmt_s *dst_fmt) {
+	int sstride = rga_cpu_wstride(src) * src_fmt->bpp, dstride = rga_cpu_wstride(dst);
+	const uint8_t *s = (const uint8_t *)src->vir_addr;
+	uint8_t *d = (uint8_t *)dst->vir_addr, *duv = rga_cpu_uv_plane(dst);
+	int w = dst->width & ~1, h = dst->height & ~1;
+	uint8_t y, u, v;
+
+	for (int j = 0; j < h; j += 2) {
+		for (int i = 0; i < w; i += 2) {
+			int r = 0, g = 0, b = 0;
+			for (int k = 0; k < 4; k++) {
+				const uint8_t *p = s + (j + k / 2) * sstride + (i + k % 2) * src_fmt->bpp;
+				r += p[src_fmt->r];
+				g += p[src_fmt->g];
+				b += p[src_fmt->b];
+				rga_cpu_rgb_to_yuv(p[src_fmt->r], p[src_fmt->g], p[src_fmt->b], &y, &u, &v);
+				d[(j + k / 2) * dstride + i + k % 2] = y;
+			}
+			rga_cpu_rgb_to_yuv((r + 2) / 4, (g + 2) / 4, (b + 2) / 4, &y, &u, &v);
+			duv[j / 2 * dstride + i + dst_fmt->swap_uv] = u;
+			duv[j / 2 * dstride + i + !dst_fmt->swap_uv] = v;
+		}
+	}
+}
+
+IM_STATUS rga_cpu_cvtcolor(rga_buffer_t src, rga_buffer_t dst) {
+	rga_cpu_fmt_s src_fmt, dst_fmt;
+	int ret = rga_cpu_check(&src, &src_fmt);
+
+	if (ret == IM_STATUS_SUCCESS)
+		ret = rga_cpu_check(&dst, &dst_fmt);
+	if (ret != IM_STATUS_SUCCESS)
+		return ret;
+	if (src.width != dst.width || src.height != dst.height || src_fmt.yuv == dst_fmt.yuv)
+		return IM_STATUS_NOT_SUPPORTED;
+
+	if (src_fmt.yuv) {
+		int sstride = rga_cpu_wstride(&src), dstride = rga_cpu_wstride(&dst) * dst_fmt.bpp;
+		const uint8_t *uv = rga_cpu_uv_plane(&src);
+		for (int j = 0; j < dst.height; j++)
+			rga_cpu_nv12_to_rgb_row((const uint8_t *)src.vir_addr + j * sstride,
+			                        uv + j / 2 * sstride, (uint8_t *)dst.vir_addr + j * dstride,
+			                        dst.width, &src_fmt, &dst_fmt);
+	} else {
+		rga_cpu_rgb_to_nv12(&src, &src_fmt, &dst, &dst_fmt);
+	}
+
+	return IM_STATUS_SUCCESS;
+}
@@ -0,0 +1,42 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef __RKIPC_RGA_CPU_H__
+#define __RKIPC_RGA_CPU_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef RGA_CPU_NO_LIBRGA
+#include "rga_cpu_im2d.h"
+#else
+#include <rga/im2d.h>
+#endif
+
+// CPU implementation of the im2d subset used by rkipc. Buffers are accessed
+// through rga_buffer_t.vir_addr, wstride/hstride are in pixels like for RGA.
+// Supported formats: RK_FORMAT_YCbCr_420_SP, RK_FORMAT_YCrCb_420_SP,
+// RK_FORMAT_RGB_888, RK_FORMAT_BGR_888, RK_FORMAT_RGBA_8888, RK_FORMAT_BGRA_8888.
+// Colors are 0xAABBGGRR as for imfill, YUV targets use BT.601 limited range.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+IM_STATUS rga_cpu_fill(rga_buffer_t dst, im_rect rect, uint32_t color);
+// thickness < 0 fills the rects, like imrectangleArray
+IM_STATUS rga_cpu_rectangle_array(rga_buffer_t dst, const im_rect *rect_array, int array_size,
+                                  uint32_t color, int thickness);
+IM_STATUS rga_cpu_mosaic(rga_buffer_t image, im_rect rect, int mosaic_mode);
+// dst gets rect of src, both in the same format
+IM_STATUS rga_cpu_crop(rga_buffer_t src, rga_buffer_t dst, im_rect rect);
+// bilinear, both in the same format
+IM_STATUS rga_cpu_resize(rga_buffer_t src, rga_buffer_t dst);
+// NV12/NV21 <-> RGB888/BGR888, same size
+IM_STATUS rga_cpu_cvtcolor(rga_buffer_t src, rga_buffer_t dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef __RKIPC_RGA_CPU_IM2D_H__
+#define __RKIPC_RGA_CPU_IM2D_H__
+
+#include <stdint.h>
+
+// The part of <rga/im2d.h> rga_cpu.h needs, with the values of librga, for builds on a
+// host without the librga headers (RGA_CPU_NO_LIBRGA). Only vir_addr and the geometry
+// of rga_buffer_t are used by the cpu backend.
+
+typedef uint32_t rga_buffer_handle_t;
+
+typedef enum {
+	RK_FORMAT_RGBA_8888 = 0x0 << 8,
+	RK_FORMAT_RGB_888 = 0x2 << 8,
+	RK_FORMAT_BGRA_8888 = 0x3 << 8,
+	RK_FORMAT_BGR_888 = 0x7 << 8,
+	RK_FORMAT_YCbCr_420_SP = 0xa << 8,
+	RK_FORMAT_YCrCb_420_SP = 0xe << 8,
+} RgaSURF_FORMAT;
+
+typedef enum {
+	IM_RKFBC64x4_MODE = 1 << 4,
+} IM_RD_MODE;
+
+typedef enum {
+	IM_MOSAIC_8 = 0x0,
+	IM_MOSAIC_16 = 0x1,
+	IM_MOSAIC_32 = 0x2,
+	IM_MOSAIC_64 = 0x3,
+	IM_MOSAIC_128 = 0x4,
+} IM_MOSAIC_MODE;
+
+typedef enum {
+	IM_STATUS_NOERROR = 2,
+	IM_STATUS_SUCCESS = 1,
+	IM_STATUS_NOT_SUPPORTED = -1,
+	IM_STATUS_OUT_OF_MEMORY = -2,
+	IM_STATUS_INVALID_PARAM = -3,
+	IM_STATUS_ILLEGAL_PARAM = -4,
+	IM_STATUS_ERROR_VERSION = -5,
+	IM_STATUS_FAILED = 0,
+} IM_STATUS;
+
+typedef struct {
+	int x;
+	int y;
+	int width;
+	int height;
+} im_rect;
+
+typedef struct {
+	void *vir_addr;
+	void *phy_addr;
+	int fd;
+
+	int width;
+	int height;
+	int wstride;
+	int hstride;
+	int format;
+
+	int color_space_mode;
+	int global_alpha;
+	int rd_mode;
+
+	rga_buffer_handle_t handle;
+} rga_buffer_t;
+
+#endif
@@ -0,0 +1,232 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "rga_draw.h"
+#include "common.h"
+#include "rga_cpu.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "rga_draw.c"
+
+// per-frame time, bucketed by object count: 0, 1, 2, 3-4, 5-8, 9-16, 17+
+#define RGA_DRAW_BUCKET_NUM 7
+#define RGA_DRAW_REPORT_FRAMES 300
+// while RGA is slow, every this many frames still go to RGA to see if it recovered
+#define RGA_DRAW_PROBE_FRAMES 16
+
+static const char *g_rga_draw_mode_name[] = {"batch", "legacy", "cpu"};
+static int g_rga_draw_mode = RGA_DRAW_MODE_BATCH;
+static pthread_mutex_t g_rga_draw_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int g_frames;
+static int g_bucket_frames[RGA_DRAW_BUCKET_NUM];
+static long long g_bucket_us[RGA_DRAW_BUCKET_NUM];
+static long long g_bucket_max_us[RGA_DRAW_BUCKET_NUM];
+// librga does not tell how many jobs are queued in the driver, the time from submit to
+// fence of our own jobs grows with it and stands in for the queue depth
+static int g_rga_busy_us;
+static long long g_rga_avg_us;
+static int g_rga_busy_frames;
+
+static long long rga_draw_now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int rga_draw_bucket(int object_num) {
+	if (object_num <= 2)
+		return object_num < 0 ? 0 : object_num;
+	if (object_num <= 4)
+		return 3;
+	if (object_num <= 8)
+		return 4;
+	if (object_num <= 16)
+		return 5;
+
+	return 6;
+}
+
+static void rga_draw_stats_add(int object_num, long long cost_us) {
+	static const char *bucket_name[RGA_DRAW_BUCKET_NUM] = {"0",   "1",    "2",  "3-4",
+	                                                       "5-8", "9-16", "17+"};
+	int bucket = rga_draw_bucket(object_num);
+
+	pthread_mutex_lock(&g_rga_draw_mutex);
+	g_bucket_frames[bucket]++;
+	g_bucket_us[bucket] += cost_us;
+	if (cost_us > g_bucket_max_us[bucket])
+		g_bucket_max_us[bucket] = cost_us;
+	if (++g_frames >= RGA_DRAW_REPORT_FRAMES) {
+		for (int i = 0; i < RGA_DRAW_BUCKET_NUM; i++) {
+			if (!g_bucket_frames[i])
+				continue;
+			LOG_INFO("%s mode, %s objects: %d frames, avg %lld us, max %lld us\n",
+			         g_rga_draw_mode_name[g_rga_draw_mode], bucket_name[i], g_bucket_frames[i],
+			         g_bucket_us[i] / g_bucket_frames[i], g_bucket_max_us[i]);
+		}
+		g_frames = 0;
+		memset(g_bucket_frames, 0, sizeof(g_bucket_frames));
+		memset(g_bucket_us, 0, sizeof(g_bucket_us));
+		memset(g_bucket_max_us, 0, sizeof(g_bucket_max_us));
+	}
+	pthread_mutex_unlock(&g_rga_draw_mutex);
+}
+
+void rga_draw_init() {
+	const char *mode = rk_param_get_string("video.source:rga_draw_mode", "batch");
+
+	g_rga_draw_mode = RGA_DRAW_MODE_BATCH;
+	for (int i = 0; i < (int)(sizeof(g_rga_draw_mode_name) / sizeof(char *)); i++) {
+		if (!strcmp(mode, g_rga_draw_mode_name[i]))
+			g_rga_draw_mode = i;
+	}
+	g_rga_busy_us = rk_param_get_int("video.source:rga_draw_cpu_busy_us", 0);
+	g_rga_avg_us = 0;
+	g_rga_busy_frames = 0;
+	LOG_INFO("rga draw mode is %s, cpu above %d us\n", g_rga_draw_mode_name[g_rga_draw_mode],
+	         g_rga_busy_us);
+}
+
+// draw on the CPU while the jobs of the last frames waited longer than rga_draw_cpu_busy_us
+static int rga_draw_rga_busy() {
+	int busy = 0;
+
+	if (g_rga_busy_us <= 0)
+		return 0;
+	pthread_mutex_lock(&g_rga_draw_mutex);
+	if (g_rga_avg_us > g_rga_busy_us && ++g_rga_busy_frames % RGA_DRAW_PROBE_FRAMES)
+		busy = 1;
+	pthread_mutex_unlock(&g_rga_draw_mutex);
+
+	return busy;
+}
+
+static void rga_draw_rga_account(long long cost_us) {
+	pthread_mutex_lock(&g_rga_draw_mutex);
+	// average over about 8 frames
+	g_rga_avg_us = g_rga_avg_us ? g_rga_avg_us + (cost_us - g_rga_avg_us) / 8 : cost_us;
+	if (g_rga_avg_us <= g_rga_busy_us)
+		g_rga_busy_frames = 0;
+	pthread_mutex_unlock(&g_rga_draw_mutex);
+}
+
+void rga_draw_list_reset(rga_draw_list_s *list, int thickness) {
+	list->rect_num = 0;
+	list->mosaic_num = 0;
+	list->thickness = thickness;
+	list->mosaic_mode = IM_MOSAIC_16;
+	list->object_num = 0;
+	list->cpu_used = 0;
+}
+
+int rga_draw_list_add_rect(rga_draw_list_s *list, int x, int y, int w, int h, uint32_t color) {
+	if (list->rect_num >= RGA_DRAW_MAX_RECT)
+		return -1;
+	list->rect[list->rect_num].x = x;
+	list->rect[list->rect_num].y = y;
+	list->rect[list->rect_num].width = w;
+	list->rect[list->rect_num].height = h;
+	list->rect_color[list->rect_num] = color;
+	list->rect_num++;
+
+	return 0;
+}
+
+int rga_draw_list_add_mosaic(rga_draw_list_s *list, int x, int y, int w, int h) {
+	if (list->mosaic_num >= RGA_DRAW_MAX_MOSAIC)
+		return -1;
+	list->mosaic[list->mosaic_num].x = x;
+	list->mosaic[list->mosaic_num].y = y;
+	list->mosaic[list->mosaic_num].width = w;
+	list->mosaic[list->mosaic_num].height = h;
+	list->mosaic_num++;
+
+	return 0;
+}
+
+// four synchronous fills per border, each one a separate kernel round-trip
+static int rga_draw_submit_legacy(rga_buffer_t dst, const rga_draw_list_s *list) {
+	IM_STATUS status = IM_STATUS_SUCCESS;
+	int line = list->thickness;
+
+	for (int i = 0; i < list->rect_num; i++) {
+		const im_rect *r = &list->rect[i];
+		int color = (int)list->rect_color[i];
+		if (line < 0) {
+			status |= imfill_t(dst, *r, color, 1);
+			continue;
+		}
+		im_rect rect_up = {r->x, r->y, r->width, line};
+		im_rect rect_buttom = {r->x, r->y + r->height - line, r->width, line};
+		im_rect rect_left = {r->x, r->y, line, r->height};
+		im_rect rect_right = {r->x + r->width - line, r->y, line, r->height};
+		status |= imfill_t(dst, rect_up, color, 1);
+		status |= imfill_t(dst, rect_buttom, color, 1);
+		status |= imfill_t(dst, rect_left, color, 1);
+		status |= imfill_t(dst, rect_right, color, 1);
+	}
+	for (int i = 0; i < list->mosaic_num; i++)
+		status |= immosaic(dst, list->mosaic[i], list->mosaic_mode, 1);
+
+	return status == IM_STATUS_SUCCESS ? 0 : -1;
+}
+
+static int rga_draw_submit_cpu(rga_buffer_t dst, rga_draw_list_s *list) {
+	IM_STATUS status = IM_STATUS_SUCCESS;
+
+	list->cpu_used = 1;
+	for (int i = 0; i < list->rect_num && status == IM_STATUS_SUCCESS; i++)
+		status = rga_cpu_rectangle_array(dst, &list->rect[i], 1, list->rect_color[i],
+		                                 list->thickness);
+	for (int i = 0; i < list->mosaic_num && status == IM_STATUS_SUCCESS; i++)
+		status = rga_cpu_mosaic(dst, list->mosaic[i], list->mosaic_mode);
+
+	return status == IM_STATUS_SUCCESS ? 0 : -1;
+}
+
+int rga_draw_submit(rga_buffer_t dst, rga_draw_list_s *list, int *release_fence_fd) {
+	int ret;
+
+	*release_fence_fd = -1;
+	list->submit_us = rga_draw_now_us();
+	list->cpu_used = 0;
+	if (!list->rect_num && !list->mosaic_num)
+		return 0;
+	if (dst.vir_addr && (g_rga_draw_mode == RGA_DRAW_MODE_CPU || rga_draw_rga_busy()))
+		return rga_draw_submit_cpu(dst, list);
+	if (g_rga_draw_mode == RGA_DRAW_MODE_BATCH) {
+		ret = rga_draw_submit_job(dst, list, release_fence_fd);
+		if (!ret)
+			return 0;
+		LOG_WARN("rga job submit fail, fall back to single calls\n");
+		*release_fence_fd = -1;
+	}
+	ret = rga_draw_submit_legacy(dst, list);
+	if (ret && dst.vir_addr) {
+		LOG_WARN("rga draw fail, fall back to cpu\n");
+		ret = rga_draw_submit_cpu(dst, list);
+	}
+
+	return ret;
+}
+
+int rga_draw_wait(rga_draw_list_s *list, int release_fence_fd) {
+	long long cost_us;
+	int ret = 0;
+
+	// imsync closes the fence only when the wait succeeds
+	if (release_fence_fd >= 0 && imsync(release_fence_fd) != IM_STATUS_SUCCESS) {
+		LOG_ERROR("imsync fence %d fail\n", release_fence_fd);
+		close(release_fence_fd);
+		ret = -1;
+	}
+	cost_us = rga_draw_now_us() - list->submit_us;
+	if (!list->cpu_used && (list->rect_num || list->mosaic_num))
+		rga_draw_rga_account(cost_us);
+	rga_draw_stats_add(list->object_num, cost_us);
+
+	return ret;
+}
@@ -0,0 +1,62 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#ifndef __RKIPC_RGA_DRAW_H__
+#define __RKIPC_RGA_DRAW_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <rga/im2d.h>
+
+#define RGA_DRAW_MAX_RECT 128
+#define RGA_DRAW_MAX_MOSAIC 16
+
+enum {
+	RGA_DRAW_MODE_BATCH = 0, // one job per frame, submitted asynchronously
+	RGA_DRAW_MODE_LEGACY,    // one synchronous imfill per border, kept for comparison
+	RGA_DRAW_MODE_CPU,       // rga_cpu.h on dst.vir_addr, leaves RGA to the other users
+};
+
+// Everything drawn into one frame, submitted to RGA as a single job.
+typedef struct rga_draw_list {
+	int rect_num;
+	im_rect rect[RGA_DRAW_MAX_RECT];
+	uint32_t rect_color[RGA_DRAW_MAX_RECT];
+	int thickness; // border width of all rects, -1 fills them
+	int mosaic_num;
+	im_rect mosaic[RGA_DRAW_MAX_MOSAIC];
+	int mosaic_mode; // IM_MOSAIC_8 ... IM_MOSAIC_128
+	int object_num;  // for the statistics only
+	long long submit_us;
+	int cpu_used; // set by rga_draw_submit, the caller flushes the cache of dst
+} rga_draw_list_s;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void rga_draw_init();
+void rga_draw_list_reset(rga_draw_list_s *list, int thickness);
+int rga_draw_list_add_rect(rga_draw_list_s *list, int x, int y, int w, int h, uint32_t color);
+int rga_draw_list_add_mosaic(rga_draw_list_s *list, int x, int y, int w, int h);
+
+/**
+ * @brief submit the list to RGA, or draw it on the CPU in cpu mode and when
+ *        RGA fails while dst.vir_addr is set
+ * @param[out] release_fence_fd fence signalled when the job is done, -1 when
+ *             the job already completed (legacy/cpu mode or synchronous fallback)
+ * @return 0 on success
+ */
+int rga_draw_submit(rga_buffer_t dst, rga_draw_list_s *list, int *release_fence_fd);
+// wait for a submitted list and account the per-frame time
+int rga_draw_wait(rga_draw_list_s *list, int release_fence_fd);
+
+// implemented with the C++ only im2d task api
+int rga_draw_submit_job(rga_buffer_t dst, const rga_draw_list_s *list, int *release_fence_fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+#include "rga_draw.h"
+
+// All borders of one color become one rectangle task, mosaics one more, and
+// the whole job reaches the kernel in a single ioctl.
+int rga_draw_submit_job(rga_buffer_t dst, const rga_draw_list_s *list, int *release_fence_fd) {
+	im_rect rects[RGA_DRAW_MAX_RECT];
+	uint8_t done[RGA_DRAW_MAX_RECT] = {0};
+	im_job_handle_t job;
+	IM_STATUS status = IM_STATUS_SUCCESS;
+	int num;
+
+	job = imbeginJob();
+	if (job <= 0)
+		return -1;
+	for (int i = 0; i < list->rect_num && status == IM_STATUS_SUCCESS; i++) {
+		if (done[i])
+			continue;
+		num = 0;
+		for (int j = i; j < list->rect_num; j++) {
+			if (!done[j] && list->rect_color[j] == list->rect_color[i]) {
+				rects[num++] = list->rect[j];
+				done[j] = 1;
+			}
+		}
+		status = imrectangleTaskArray(job, dst, rects, num, list->rect_color[i], list->thickness);
+	}
+	if (status == IM_STATUS_SUCCESS && list->mosaic_num)
+		status = immosaicTaskArray(job, dst, (im_rect *)list->mosaic, list->mosaic_num,
+		                           list->mosaic_mode);
+	if (status != IM_STATUS_SUCCESS) {
+		imcancelJob(job);
+		return -1;
+	}
+	*release_fence_fd = -1;
+	status = imendJob(job, IM_ASYNC, 0, release_fence_fd);
+
+	return status == IM_STATUS_SUCCESS ? 0 : -1;
+}
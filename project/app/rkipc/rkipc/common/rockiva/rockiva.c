@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 #include "rockiva.h"
 #include "common.h"
+#include "detections.h"
 
 #ifdef LOG_TAG
 #undef LOG_TAG
@@ -16,6 +17,11 @@ RockIvaInitParam globalParams;
 int rockit_run_flag = 0;
 static void *rockiva_signal = NULL;
 rknn_list *rknn_list_;
+static rkipc_rockiva_result_callback rkipc_rockiva_result_ = NULL;
+
+void rkipc_rockiva_result_callback_register(rkipc_rockiva_result_callback callback_ptr) {
+	rkipc_rockiva_result_ = callback_ptr;
+}
 
 void create_rknn_list(rknn_list **s) {
 	pthread_mutex_lock(&g_rknn_list_mutex);
@@ -114,8 +120,217 @@ int rkipc_rknn_object_get(RockIvaBaResult *ba_result) {
 	return ret;
 }
 
+// NPU scheduling: frames go to RockIVA at npu_fps while IVS reports motion or
+// the detector still sees something, at npu_idle_fps otherwise. A frame is
+// dropped rather than queued while the previous inference has not returned.
+#define NPU_MD_TIMEOUT_MS 2000     // no MD result for this long, assume motion
+#define NPU_RESULT_TIMEOUT_MS 2000 // inference result assumed lost
+#define NPU_REPORT_INTERVAL_MS 60000
+
+typedef struct npu_sched {
+	int active_interval_ms;
+	int idle_interval_ms;
+	int hold_ms;
+	int active;
+	int busy;
+	long long push_time;
+	long long last_motion;
+	long long last_md_update;
+	long long last_object;
+	long long report_start;
+	int pushed;
+	int results;
+	int timed; // results with a latency, the first one after a push
+	long long busy_ms;
+	long long latency_max;
+} npu_sched_s;
+
+static pthread_mutex_t g_npu_sched_mutex = PTHREAD_MUTEX_INITIALIZER;
+static npu_sched_s g_npu_sched;
+
+typedef struct {
+	rkipc_metric_t *pushed;
+	rkipc_metric_t *results;
+	rkipc_metric_t *lost;
+	rkipc_metric_t *latency_ms;
+	rkipc_metric_t *active;
+	rkipc_metric_t *objects;
+} npu_metrics_s;
+
+static const long long g_npu_latency_ms_bounds[] = {10, 20, 30, 50, 75, 100, 150, 250, 500, 1000};
+static npu_metrics_s g_npu_metrics;
+
+static void rockiva_npu_metrics_register() {
+	npu_metrics_s *m = &g_npu_metrics;
+
+	m->pushed = rkipc_metric_counter("rkipc_npu_frames_pushed_total", NULL,
+	                                 "Frames pushed to the NPU");
+	m->results =
+	    rkipc_metric_counter("rkipc_npu_results_total", NULL, "Inference results received");
+	m->lost = rkipc_metric_counter("rkipc_npu_results_lost_total", NULL,
+	                               "Pushed frames that never got a result");
+	m->latency_ms = rkipc_metric_histogram(
+	    "rkipc_npu_latency_ms", NULL, "Time from pushing a frame to its result",
+	    g_npu_latency_ms_bounds, sizeof(g_npu_latency_ms_bounds) / sizeof(long long));
+	m->active = rkipc_metric_gauge("rkipc_npu_active", NULL,
+	                               "1 at the active frame rate, 0 at the idle frame rate");
+	m->objects = rkipc_metric_gauge("rkipc_npu_objects", NULL, "Objects in the last result");
+}
+
+static void rockiva_npu_sched_init() {
+	int npu_fps = rk_param_get_int("video.source:npu_fps", 10);
+	int idle_fps = rk_param_get_int("video.source:npu_idle_fps", 0);
+
+	if (npu_fps <= 0)
+		npu_fps = 10;
+	pthread_mutex_lock(&g_npu_sched_mutex);
+	memset(&g_npu_sched, 0, sizeof(g_npu_sched));
+	g_npu_sched.active_interval_ms = 1000 / npu_fps;
+	g_npu_sched.idle_interval_ms =
+	    (idle_fps > 0 && idle_fps < npu_fps) ? 1000 / idle_fps : g_npu_sched.active_interval_ms;
+	g_npu_sched.hold_ms = rk_param_get_int("video.source:npu_active_hold_ms", 3000);
+	g_npu_sched.active = 1;
+	g_npu_sched.report_start = rkipc_get_curren_time_ms();
+	pthread_mutex_unlock(&g_npu_sched_mutex);
+	rockiva_npu_metrics_register();
+	rkipc_metric_set(g_npu_metrics.active, 1);
+	LOG_INFO("npu interval %d ms active, %d ms idle\n", g_npu_sched.active_interval_ms,
+	         g_npu_sched.idle_interval_ms);
+}
+
+static void rockiva_npu_sched_report(long long now) {
+	npu_sched_s *s = &g_npu_sched;
+	long long elapsed = now - s->report_start;
+
+	if (elapsed < NPU_REPORT_INTERVAL_MS)
+		return;
+	LOG_INFO("npu: %s, %d pushed, %d results, duty %lld%%, latency avg %lld ms max %lld ms\n",
+	         s->active ? "active" : "idle", s->pushed, s->results,
+	         s->busy_ms * 100 / elapsed, s->timed ? s->busy_ms / s->timed : 0,
+	         s->latency_max);
+	s->pushed = 0;
+	s->results = 0;
+	s->timed = 0;
+	s->busy_ms = 0;
+	s->latency_max = 0;
+	s->report_start = now;
+}
+
+void rkipc_rockiva_motion_update(int motion) {
+	long long now = rkipc_get_curren_time_ms();
+
+	pthread_mutex_lock(&g_npu_sched_mutex);
+	g_npu_sched.last_md_update = now;
+	if (motion)
+		g_npu_sched.last_motion = now;
+	pthread_mutex_unlock(&g_npu_sched_mutex);
+}
+
+int rkipc_rockiva_frame_interval_ms() {
+	npu_sched_s *s = &g_npu_sched;
+	long long now = rkipc_get_curren_time_ms();
+	int active, interval;
+
+	pthread_mutex_lock(&g_npu_sched_mutex);
+	active = (now - s->last_md_update > NPU_MD_TIMEOUT_MS) ||
+	         (now - s->last_motion < s->hold_ms) || (now - s->last_object < s->hold_ms);
+	if (active != s->active) {
+		LOG_INFO("npu switch to %s rate\n", active ? "active" : "idle");
+		s->active = active;
+		rkipc_metric_set(g_npu_metrics.active, active);
+	}
+	interval = active ? s->active_interval_ms : s->idle_interval_ms;
+	rockiva_npu_sched_report(now);
+	pthread_mutex_unlock(&g_npu_sched_mutex);
+
+	return interval;
+}
+
+static void rockiva_npu_sched_result(const RockIvaBaResult *result) {
+	npu_sched_s *s = &g_npu_sched;
+	long long now = rkipc_get_curren_time_ms();
+	long long latency;
+
+	pthread_mutex_lock(&g_npu_sched_mutex);
+	s->results++;
+	rkipc_metric_inc(g_npu_metrics.results);
+	if (s->busy) {
+		latency = now - s->push_time;
+		s->busy = 0;
+		s->timed++;
+		s->busy_ms += latency;
+		if (latency > s->latency_max)
+			s->latency_max = latency;
+		rkipc_metric_observe(g_npu_metrics.latency_ms, latency);
+	}
+	rkipc_metric_set(g_npu_metrics.objects, result->objNum);
+	if (result->objNum > 0)
+		s->last_object = now;
+	pthread_mutex_unlock(&g_npu_sched_mutex);
+}
+
+// The caller releases the frame buffer as soon as this returns, so the push waits until
+// RockIVA is done with the image. That already keeps a single frame in flight, frames
+// are not gated on the result as well. busy times the oldest push without a result.
+static int rockiva_push_frame(RockIvaImage *image) {
+	npu_sched_s *s = &g_npu_sched;
+	long long now = rkipc_get_curren_time_ms();
+	int ret;
+
+	pthread_mutex_lock(&g_npu_sched_mutex);
+	if (s->busy && now - s->push_time > NPU_RESULT_TIMEOUT_MS) {
+		LOG_WARN("no result %lld ms after push, drop it\n", now - s->push_time);
+		s->busy = 0;
+		rkipc_metric_inc(g_npu_metrics.lost);
+	}
+	if (!s->busy) {
+		s->busy = 1;
+		s->push_time = now;
+	}
+	s->pushed++;
+	pthread_mutex_unlock(&g_npu_sched_mutex);
+	rkipc_metric_inc(g_npu_metrics.pushed);
+	ret = ROCKIVA_PushFrame(rkba_handle, image, NULL);
+	if (ret == 0) {
+		rk_signal_wait(rockiva_signal, 10000);
+	} else {
+		LOG_ERROR("ROCKIVA_PushFrame fail, ret is %d\n", ret);
+		pthread_mutex_lock(&g_npu_sched_mutex);
+		s->busy = 0;
+		pthread_mutex_unlock(&g_npu_sched_mutex);
+	}
+
+	return ret;
+}
+
+// every result goes to the encoders, they carry it as SEI and into the recording
+static void rockiva_detections_update(const RockIvaBaResult *result) {
+	rkipc_detections_s d;
+	const RockIvaBaObjectInfo *object;
+
+	d.frame_id = result->frameId;
+	d.delay_us = 0;
+	d.count = 0;
+	for (int i = 0; i < result->objNum && d.count < RKIPC_DETECTIONS_MAX; i++) {
+		object = &result->triggerObjects[i];
+		d.object[d.count].track_id = object->objInfo.objId;
+		d.object[d.count].type = object->objInfo.type;
+		d.object[d.count].score = object->objInfo.score;
+		d.object[d.count].x0 = object->objInfo.rect.topLeft.x;
+		d.object[d.count].y0 = object->objInfo.rect.topLeft.y;
+		d.object[d.count].x1 = object->objInfo.rect.bottomRight.x;
+		d.object[d.count].y1 = object->objInfo.rect.bottomRight.y;
+		d.count++;
+	}
+	rkipc_detections_update(&d);
+}
+
 void rkba_callback(const RockIvaBaResult *result, const RockIvaExecuteStatus status,
                    void *userData) {
+	rockiva_npu_sched_result(result);
+	rockiva_detections_update(result);
+	if (rkipc_rockiva_result_)
+		rkipc_rockiva_result_(result);
 	if (result->objNum == 0)
 		return;
 
@@ -299,6 +514,7 @@ int rkipc_rockiva_init() {
 	ROCKIVA_SetFrameReleaseCallback(rkba_handle, rockiva_frame_release_callback);
 
 	create_rknn_list(&rknn_list_);
+	rockiva_npu_sched_init();
 	rockit_run_flag = 1;
 	LOG_INFO("end\n");
 
@@ -334,11 +550,7 @@ int rkipc_rockiva_write_rgb888_frame(uint16_t width, uint16_t height, uint32_t f
 	image->info.format = ROCKIVA_IMAGE_FORMAT_BGR888;
 	image->dataAddr = buffer;
 	image->frameId = frame_id;
-	ret = ROCKIVA_PushFrame(rkba_handle, image, NULL);
-	if (ret == 0)
-		rk_signal_wait(rockiva_signal, 10000);
-	else
-		LOG_ERROR("ROCKIVA_PushFrame fail, ret is %d\n", ret);
+	ret = rockiva_push_frame(image);
 	free(image);
 
 	return ret;
@@ -358,11 +570,7 @@ int rkipc_rockiva_write_rgb888_frame_by_fd(uint16_t width, uint16_t height, uint
 	image->dataAddr = NULL;
 	image->dataPhyAddr = NULL;
 	image->dataFd = fd;
-	ret = ROCKIVA_PushFrame(rkba_handle, image, NULL);
-	if (ret == 0)
-		rk_signal_wait(rockiva_signal, 10000);
-	else
-		LOG_ERROR("ROCKIVA_PushFrame fail, ret is %d\n", ret);
+	ret = rockiva_push_frame(image);
 	free(image);
 
 	return ret;
@@ -394,11 +602,7 @@ int rkipc_rockiva_write_nv12_frame_by_fd(uint16_t width, uint16_t height, uint32
 	image->dataAddr = NULL;
 	image->dataPhyAddr = NULL;
 	image->dataFd = fd;
-	ret = ROCKIVA_PushFrame(rkba_handle, image, NULL);
-	if (ret == 0)
-		rk_signal_wait(rockiva_signal, 10000);
-	else
-		LOG_ERROR("ROCKIVA_PushFrame fail, ret is %d\n", ret);
+	ret = rockiva_push_frame(image);
 	free(image);
 
 	return ret;
@@ -428,11 +632,7 @@ int rkipc_rockiva_write_nv12_frame_by_phy_addr(uint16_t width, uint16_t height,
 	image->info.format = ROCKIVA_IMAGE_FORMAT_YUV420SP_NV12;
 	image->frameId = frame_id;
 	image->dataPhyAddr = phy_addr;
-	ret = ROCKIVA_PushFrame(rkba_handle, image, NULL);
-	if (ret == 0)
-		rk_signal_wait(rockiva_signal, 10000);
-	else
-		LOG_ERROR("ROCKIVA_PushFrame fail, ret is %d\n", ret);
+	ret = rockiva_push_frame(image);
 	free(image);
 
 	return ret;
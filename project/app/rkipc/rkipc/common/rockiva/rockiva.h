@@ -20,6 +20,8 @@ typedef struct my_stack {
 	Node *top;
 } rknn_list;
 
+typedef void (*rkipc_rockiva_result_callback)(const RockIvaBaResult *);
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -35,6 +37,11 @@ int rkipc_rockiva_write_nv12_frame_by_fd(uint16_t width, uint16_t height, uint32
 int rkipc_rockiva_write_nv12_frame_by_phy_addr(uint16_t width, uint16_t height, uint32_t frame_id,
                                                uint8_t *phy_addr);
 int rkipc_rknn_object_get(RockIvaBaResult *ba_result);
+// adaptive npu rate: feed IVS motion, ask for the next push interval
+void rkipc_rockiva_motion_update(int motion);
+int rkipc_rockiva_frame_interval_ms();
+// called from the RockIVA thread for every result, including empty ones
+void rkipc_rockiva_result_callback_register(rkipc_rockiva_result_callback callback_ptr);
 #ifdef __cplusplus
 }
 #endif
@@ -82,6 +82,8 @@ int rk_roi_set_all() {
 		}
 		rk_roi_set_(&roi_data);
 	}
+	// static slots or the resolution may have changed, reprogram dynamic slots
+	rk_roi_dynamic_reset();
 
 	return 0;
 }
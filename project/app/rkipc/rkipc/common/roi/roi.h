@@ -23,6 +23,36 @@ typedef int (*rk_roi_set_callback)(roi_data_s *);
 void rk_roi_set_callback_register(rk_roi_set_callback callback_ptr);
 
 int rk_roi_set_all();
+
+// Detection driven ROI. Boxes come from the NPU in coordinates normalized to
+// ROI_BOX_NORMALIZED (same convention as RockIVA), the controller turns the
+// tracked ones into VENC ROI slots that are not used by roi.x.
+#define ROI_BOX_NORMALIZED 10000
+#define ROI_DYNAMIC_MAX_BOX 32
+
+enum {
+	ROI_BOX_TYPE_OBJECT = 0, // person, vehicle...
+	ROI_BOX_TYPE_DETAIL,     // face, plate: needs the lowest QP to stay legible
+};
+
+typedef struct roi_box {
+	int id; // tracker id, -1 if the detector does not track
+	int type;
+	int score; // 0-100
+	int x;
+	int y;
+	int w;
+	int h;
+} roi_box_s;
+
+typedef int (*rk_roi_qp_set_callback)(roi_data_s *, int qp);
+
+void rk_roi_dynamic_set_callback_register(rk_roi_qp_set_callback callback_ptr);
+int rk_roi_dynamic_init();
+int rk_roi_dynamic_deinit();
+void rk_roi_dynamic_reset();
+void rk_roi_dynamic_update(const roi_box_s *boxes, int num);
+void rk_roi_dynamic_account(int stream_id, unsigned int bytes);
 // roi.x
 int rk_roi_get_stream_type(int id, const char **value);
 int rk_roi_set_stream_type(int id, const char *value);
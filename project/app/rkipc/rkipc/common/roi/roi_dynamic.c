@@ -0,0 +1,504 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "common.h"
+#include "roi.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "roi_dynamic.c"
+
+// VENC supports 8 ROI regions per channel, a higher index wins where
+// regions overlap. roi.x takes the indexes it is configured with, the
+// controller uses the remaining ones for detections sorted by quality.
+// The background always takes index 0, the lowest priority, so it never
+// overrides a configured ROI; it is off when roi.x uses index 0 itself.
+#define ROI_VENC_SLOT_NUM 8
+#define ROI_DYNAMIC_STREAM_NUM 2
+#define ROI_DYNAMIC_MAX_TRACK 32
+
+typedef struct roi_track {
+	int valid;
+	int id;
+	int type;
+	int hits;
+	long long last_seen;
+	int x, y, w, h; // normalized
+} roi_track_s;
+
+typedef struct roi_region {
+	int x, y, w, h; // normalized
+	int quality_level;
+} roi_region_s;
+
+typedef struct roi_stream {
+	int enabled;
+	int width;
+	int height;
+	int background_index; // -1 when the background is left alone
+	int slot_num;
+	int slot_index[ROI_VENC_SLOT_NUM]; // ascending, lowest priority first
+	roi_data_s applied[ROI_VENC_SLOT_NUM];
+	int applied_qp[ROI_VENC_SLOT_NUM];
+	long long bytes;
+	long long roi_active_ms;
+} roi_stream_s;
+
+static const char *g_stream_type[ROI_DYNAMIC_STREAM_NUM] = {"mainStream", "subStream"};
+
+static rk_roi_qp_set_callback rk_roi_qp_set_ = NULL;
+static pthread_mutex_t g_track_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_apply_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t g_roi_dynamic_thread_id;
+static int g_roi_dynamic_run_ = 0;
+static int g_roi_dynamic_setup_ = 1;
+static roi_track_s g_tracks[ROI_DYNAMIC_MAX_TRACK];
+static roi_stream_s g_streams[ROI_DYNAMIC_STREAM_NUM];
+
+static int g_interval_ms;
+static int g_min_score;
+static int g_enter_hits;
+static int g_hold_ms;
+static int g_margin;
+static int g_quality_level;
+static int g_detail_quality_level;
+static int g_background_qp;
+static int g_report_interval;
+
+void rk_roi_dynamic_set_callback_register(rk_roi_qp_set_callback callback_ptr) {
+	rk_roi_qp_set_ = callback_ptr;
+}
+
+// same scale as rk_roi_set: 1 -> -6 ... 6 -> -16
+static int roi_quality_to_qp(int quality_level) {
+	if (quality_level < 1)
+		quality_level = 1;
+	if (quality_level > 6)
+		quality_level = 6;
+
+	return -4 - 2 * quality_level;
+}
+
+static long long roi_area(int w, int h) { return (long long)w * h; }
+
+static int roi_iou_percent(const roi_track_s *t, const roi_box_s *b) {
+	int x0 = t->x > b->x ? t->x : b->x;
+	int y0 = t->y > b->y ? t->y : b->y;
+	int x1 = (t->x + t->w) < (b->x + b->w) ? (t->x + t->w) : (b->x + b->w);
+	int y1 = (t->y + t->h) < (b->y + b->h) ? (t->y + t->h) : (b->y + b->h);
+	long long inter, uni;
+
+	if (x1 <= x0 || y1 <= y0)
+		return 0;
+	inter = roi_area(x1 - x0, y1 - y0);
+	uni = roi_area(t->w, t->h) + roi_area(b->w, b->h) - inter;
+
+	return uni > 0 ? (int)(inter * 100 / uni) : 0;
+}
+
+static void roi_region_union(const roi_region_s *a, const roi_region_s *b, roi_region_s *out) {
+	int x0 = a->x < b->x ? a->x : b->x;
+	int y0 = a->y < b->y ? a->y : b->y;
+	int x1 = (a->x + a->w) > (b->x + b->w) ? (a->x + a->w) : (b->x + b->w);
+	int y1 = (a->y + a->h) > (b->y + b->h) ? (a->y + a->h) : (b->y + b->h);
+
+	out->x = x0;
+	out->y = y0;
+	out->w = x1 - x0;
+	out->h = y1 - y0;
+	out->quality_level =
+	    a->quality_level > b->quality_level ? a->quality_level : b->quality_level;
+}
+
+// Greedily merge the pair that adds the least uncovered area until the
+// regions fit in the available slots.
+static int roi_region_merge(roi_region_s *regions, int num, int max_num) {
+	roi_region_s merged;
+	long long cost, best_cost;
+	int best_i, best_j;
+
+	if (max_num <= 0)
+		return 0;
+	while (num > max_num) {
+		best_i = 0;
+		best_j = 1;
+		best_cost = -1;
+		for (int i = 0; i < num; i++) {
+			for (int j = i + 1; j < num; j++) {
+				roi_region_union(&regions[i], &regions[j], &merged);
+				cost = roi_area(merged.w, merged.h) - roi_area(regions[i].w, regions[i].h) -
+				       roi_area(regions[j].w, regions[j].h);
+				if (best_cost < 0 || cost < best_cost) {
+					best_cost = cost;
+					best_i = i;
+					best_j = j;
+				}
+			}
+		}
+		roi_region_union(&regions[best_i], &regions[best_j], &regions[best_i]);
+		regions[best_j] = regions[num - 1];
+		num--;
+	}
+
+	return num;
+}
+
+static void roi_region_sort(roi_region_s *regions, int num) {
+	roi_region_s tmp;
+
+	for (int i = 1; i < num; i++) {
+		tmp = regions[i];
+		int j = i - 1;
+		while (j >= 0 && regions[j].quality_level > tmp.quality_level) {
+			regions[j + 1] = regions[j];
+			j--;
+		}
+		regions[j + 1] = tmp;
+	}
+}
+
+void rk_roi_dynamic_update(const roi_box_s *boxes, int num) {
+	long long now = rkipc_get_curren_time_ms();
+	roi_track_s *track;
+	int best, best_iou, iou, active;
+
+	if (!g_roi_dynamic_run_)
+		return;
+	if (num > ROI_DYNAMIC_MAX_BOX)
+		num = ROI_DYNAMIC_MAX_BOX;
+
+	pthread_mutex_lock(&g_track_mutex);
+	for (int i = 0; i < num; i++) {
+		const roi_box_s *b = &boxes[i];
+		if (b->w <= 0 || b->h <= 0)
+			continue;
+		track = NULL;
+		best = -1;
+		best_iou = 30;
+		for (int j = 0; j < ROI_DYNAMIC_MAX_TRACK; j++) {
+			if (!g_tracks[j].valid || g_tracks[j].type != b->type)
+				continue;
+			if (b->id >= 0) {
+				if (g_tracks[j].id == b->id) {
+					best = j;
+					break;
+				}
+				continue;
+			}
+			iou = roi_iou_percent(&g_tracks[j], b);
+			if (iou >= best_iou) {
+				best_iou = iou;
+				best = j;
+			}
+		}
+		if (best >= 0) {
+			track = &g_tracks[best];
+			// score hysteresis: a box that already owns a ROI keeps it at half the score
+			active = track->hits >= g_enter_hits;
+			if (b->score < (active ? g_min_score / 2 : g_min_score))
+				continue;
+			if (now - track->last_seen > g_hold_ms)
+				track->hits = 0;
+			if (track->hits < g_enter_hits)
+				track->hits++;
+		} else {
+			if (b->score < g_min_score)
+				continue;
+			best = 0;
+			for (int j = 0; j < ROI_DYNAMIC_MAX_TRACK; j++) {
+				if (!g_tracks[j].valid) {
+					best = j;
+					break;
+				}
+				if (g_tracks[j].last_seen < g_tracks[best].last_seen)
+					best = j;
+			}
+			track = &g_tracks[best];
+			track->valid = 1;
+			track->id = b->id;
+			track->type = b->type;
+			track->hits = 1;
+		}
+		track->last_seen = now;
+		track->x = b->x;
+		track->y = b->y;
+		track->w = b->w;
+		track->h = b->h;
+	}
+	pthread_mutex_unlock(&g_track_mutex);
+}
+
+void rk_roi_dynamic_account(int stream_id, unsigned int bytes) {
+	if (stream_id < 0 || stream_id >= ROI_DYNAMIC_STREAM_NUM || !g_roi_dynamic_run_)
+		return;
+	__atomic_add_fetch(&g_streams[stream_id].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void rk_roi_dynamic_reset() {
+	pthread_mutex_lock(&g_apply_mutex);
+	g_roi_dynamic_setup_ = 1;
+	pthread_mutex_unlock(&g_apply_mutex);
+}
+
+static void roi_stream_apply(roi_stream_s *stream, int stream_id, int slot, int enabled, int x,
+                             int y, int w, int h, int qp) {
+	roi_data_s *applied = &stream->applied[slot];
+	int index = stream->slot_index[slot];
+
+	if (!enabled && !applied->enabled)
+		return;
+	if (enabled && applied->enabled && stream->applied_qp[slot] == qp) {
+		// geometry hysteresis: keep the programmed rect while it still covers
+		// the target and is not more than twice as large
+		if (applied->position_x <= x && applied->position_y <= y &&
+		    applied->position_x + applied->width >= x + w &&
+		    applied->position_y + applied->height >= y + h &&
+		    roi_area(applied->width, applied->height) <= 2 * roi_area(w, h))
+			return;
+	}
+	applied->stream_type = g_stream_type[stream_id];
+	applied->id = index;
+	applied->enabled = enabled;
+	if (enabled) {
+		applied->position_x = x;
+		applied->position_y = y;
+		applied->width = w;
+		applied->height = h;
+	}
+	stream->applied_qp[slot] = qp;
+	if (rk_roi_qp_set_)
+		rk_roi_qp_set_(applied, qp);
+}
+
+static void roi_dynamic_setup() {
+	char entry[128] = {'\0'};
+	int rotation = rk_param_get_int("video.source:rotation", 0);
+	int used[ROI_VENC_SLOT_NUM];
+	int was_enabled[ROI_VENC_SLOT_NUM];
+	const char *stream_type;
+	roi_stream_s *stream;
+
+	for (int s = 0; s < ROI_DYNAMIC_STREAM_NUM; s++) {
+		stream = &g_streams[s];
+		memset(used, 0, sizeof(used));
+		memset(was_enabled, 0, sizeof(was_enabled));
+		for (int i = 0; i < stream->slot_num; i++) {
+			if (stream->applied[i].enabled)
+				was_enabled[stream->slot_index[i]] = 1;
+		}
+		for (int id = 0; id < MAX_ROI_NUM; id++) {
+			snprintf(entry, 127, "roi.%d:stream_type", id);
+			stream_type = rk_param_get_string(entry, "mainStream");
+			snprintf(entry, 127, "roi.%d:enabled", id);
+			if (strcmp(stream_type, g_stream_type[s]) || rk_param_get_int(entry, 0) != 1)
+				continue;
+			snprintf(entry, 127, "roi.%d:id", id);
+			int index = rk_param_get_int(entry, -1);
+			if (index >= 0 && index < ROI_VENC_SLOT_NUM)
+				used[index] = 1;
+		}
+
+		snprintf(entry, 127, "video.source:enable_venc_%d", s);
+		stream->enabled = rk_param_get_int(entry, 0);
+		snprintf(entry, 127, "roi.dynamic:%s", s ? "sub_stream" : "main_stream");
+		stream->enabled &= rk_param_get_int(entry, 1);
+		snprintf(entry, 127, "video.%d:smart", s);
+		if (!strcmp(rk_param_get_string(entry, "close"), "open")) {
+			LOG_INFO("video.%d:smart is open, skip dynamic roi\n", s);
+			stream->enabled = 0;
+		}
+		snprintf(entry, 127, "video.%d:width", s);
+		stream->width = rk_param_get_int(entry, 0);
+		snprintf(entry, 127, "video.%d:height", s);
+		stream->height = rk_param_get_int(entry, 0);
+		if (rotation == 90 || rotation == 270)
+			RKIPC_SWAP(stream->width, stream->height);
+
+		stream->slot_num = 0;
+		stream->background_index = -1;
+		for (int i = 0; i < ROI_VENC_SLOT_NUM; i++) {
+			if (used[i])
+				continue;
+			if (was_enabled[i] && rk_roi_qp_set_) {
+				roi_data_s roi_data;
+				memset(&roi_data, 0, sizeof(roi_data));
+				roi_data.stream_type = g_stream_type[s];
+				roi_data.id = i;
+				rk_roi_qp_set_(&roi_data, 0);
+			}
+			stream->slot_index[stream->slot_num++] = i;
+		}
+		memset(stream->applied, 0, sizeof(stream->applied));
+		if (g_background_qp > 0 && stream->slot_num > 1 && stream->slot_index[0] == 0)
+			stream->background_index = 0;
+		else if (g_background_qp > 0 && stream->enabled)
+			LOG_WARN("stream %d: no dynamic background, roi index 0 is taken or no slot left\n", s);
+		LOG_INFO("stream %d: dynamic roi %s, %d slots, background %s\n", s,
+		         stream->enabled ? "on" : "off", stream->slot_num,
+		         stream->background_index >= 0 ? "on" : "off");
+	}
+}
+
+static void roi_dynamic_tick(long long now) {
+	roi_region_s regions[ROI_DYNAMIC_MAX_TRACK];
+	roi_region_s merged[ROI_DYNAMIC_MAX_TRACK];
+	roi_stream_s *stream;
+	int num = 0, merged_num, first, x0, y0, x1, y1;
+
+	pthread_mutex_lock(&g_track_mutex);
+	for (int i = 0; i < ROI_DYNAMIC_MAX_TRACK; i++) {
+		roi_track_s *t = &g_tracks[i];
+		if (!t->valid)
+			continue;
+		if (now - t->last_seen > g_hold_ms) {
+			t->valid = 0;
+			continue;
+		}
+		if (t->hits < g_enter_hits)
+			continue;
+		int mx = t->w * g_margin / 100;
+		int my = t->h * g_margin / 100;
+		regions[num].x = t->x - mx > 0 ? t->x - mx : 0;
+		regions[num].y = t->y - my > 0 ? t->y - my : 0;
+		regions[num].w = (t->x + t->w + mx < ROI_BOX_NORMALIZED ? t->x + t->w + mx
+		                                                        : ROI_BOX_NORMALIZED) -
+		                 regions[num].x;
+		regions[num].h = (t->y + t->h + my < ROI_BOX_NORMALIZED ? t->y + t->h + my
+		                                                        : ROI_BOX_NORMALIZED) -
+		                 regions[num].y;
+		regions[num].quality_level =
+		    t->type == ROI_BOX_TYPE_DETAIL ? g_detail_quality_level : g_quality_level;
+		num++;
+	}
+	pthread_mutex_unlock(&g_track_mutex);
+
+	pthread_mutex_lock(&g_apply_mutex);
+	if (g_roi_dynamic_setup_) {
+		roi_dynamic_setup();
+		g_roi_dynamic_setup_ = 0;
+	}
+	for (int s = 0; s < ROI_DYNAMIC_STREAM_NUM; s++) {
+		stream = &g_streams[s];
+		if (!stream->enabled || stream->width <= 0 || stream->height <= 0)
+			continue;
+		first = 0;
+		if (stream->background_index >= 0) {
+			roi_stream_apply(stream, s, 0, 1, 0, 0, stream->width, stream->height,
+			                 g_background_qp);
+			first = 1;
+		}
+		memcpy(merged, regions, num * sizeof(roi_region_s));
+		merged_num = roi_region_merge(merged, num, stream->slot_num - first);
+		roi_region_sort(merged, merged_num);
+		for (int i = 0; i < merged_num; i++) {
+			x0 = (int)((long long)merged[i].x * stream->width / ROI_BOX_NORMALIZED) & ~15;
+			y0 = (int)((long long)merged[i].y * stream->height / ROI_BOX_NORMALIZED) & ~15;
+			x1 = UPALIGNTO16((int)((long long)(merged[i].x + merged[i].w) * stream->width /
+			                       ROI_BOX_NORMALIZED));
+			y1 = UPALIGNTO16((int)((long long)(merged[i].y + merged[i].h) * stream->height /
+			                       ROI_BOX_NORMALIZED));
+			if (x1 > stream->width)
+				x1 = stream->width;
+			if (y1 > stream->height)
+				y1 = stream->height;
+			roi_stream_apply(stream, s, first + i, x1 > x0 && y1 > y0, x0, y0, x1 - x0, y1 - y0,
+			                 roi_quality_to_qp(merged[i].quality_level));
+		}
+		for (int i = first + merged_num; i < stream->slot_num; i++)
+			roi_stream_apply(stream, s, i, 0, 0, 0, 0, 0, 0);
+		if (merged_num)
+			stream->roi_active_ms += g_interval_ms;
+	}
+	pthread_mutex_unlock(&g_apply_mutex);
+}
+
+// The saving is measured against video.x:max_rate, it is only meaningful when
+// the encoder is allowed to undershoot (VBR/AVBR), CBR spends the budget anyway.
+static void roi_dynamic_report(long long elapsed_ms) {
+	char entry[128] = {'\0'};
+	long long bytes, kbps, saved_mb;
+	int max_rate;
+
+	for (int s = 0; s < ROI_DYNAMIC_STREAM_NUM; s++) {
+		bytes = __atomic_exchange_n(&g_streams[s].bytes, 0, __ATOMIC_RELAXED);
+		if (!g_streams[s].enabled || elapsed_ms <= 0)
+			continue;
+		snprintf(entry, 127, "video.%d:max_rate", s);
+		max_rate = rk_param_get_int(entry, 0);
+		kbps = bytes * 8 / elapsed_ms;
+		saved_mb = (max_rate - kbps) * 3600 / 8 / 1000;
+		LOG_INFO("stream %d: %lld kbps against max_rate %d kbps, saved %lld MB/hour (%lld%%), "
+		         "detection roi active %lld%% of the time\n",
+		         s, kbps, max_rate, saved_mb, max_rate > 0 ? (max_rate - kbps) * 100 / max_rate : 0,
+		         g_streams[s].roi_active_ms * 100 / elapsed_ms);
+		g_streams[s].roi_active_ms = 0;
+	}
+}
+
+static void *rk_roi_dynamic_thread(void *arg) {
+	long long now, report_start = rkipc_get_curren_time_ms();
+
+	LOG_DEBUG("#Start %s thread, arg:%p\n", __func__, arg);
+	prctl(PR_SET_NAME, "RkipcRoiDynamic", 0, 0, 0);
+	while (g_roi_dynamic_run_) {
+		usleep(g_interval_ms * 1000);
+		now = rkipc_get_curren_time_ms();
+		roi_dynamic_tick(now);
+		if (now - report_start >= g_report_interval * 1000LL) {
+			roi_dynamic_report(now - report_start);
+			report_start = now;
+		}
+	}
+
+	return NULL;
+}
+
+int rk_roi_dynamic_init() {
+	if (!rk_param_get_int("roi.dynamic:enabled", 0)) {
+		LOG_INFO("dynamic roi is disabled\n");
+		return 0;
+	}
+	g_interval_ms = rk_param_get_int("roi.dynamic:interval_ms", 200);
+	g_min_score = rk_param_get_int("roi.dynamic:min_score", 50);
+	g_enter_hits = rk_param_get_int("roi.dynamic:enter_hits", 2);
+	g_hold_ms = rk_param_get_int("roi.dynamic:hold_ms", 1000);
+	g_margin = rk_param_get_int("roi.dynamic:margin", 10);
+	g_quality_level = rk_param_get_int("roi.dynamic:quality_level", 4);
+	g_detail_quality_level = rk_param_get_int("roi.dynamic:detail_quality_level", 6);
+	g_background_qp = rk_param_get_int("roi.dynamic:background_qp", 0);
+	g_report_interval = rk_param_get_int("roi.dynamic:report_interval", 3600);
+	if (g_interval_ms < 40)
+		g_interval_ms = 40;
+	if (g_enter_hits < 1)
+		g_enter_hits = 1;
+	if (g_report_interval < 1)
+		g_report_interval = 1;
+
+	memset(g_tracks, 0, sizeof(g_tracks));
+	memset(g_streams, 0, sizeof(g_streams));
+	rk_roi_dynamic_reset();
+	g_roi_dynamic_run_ = 1;
+	pthread_create(&g_roi_dynamic_thread_id, NULL, rk_roi_dynamic_thread, NULL);
+	LOG_INFO("interval %d ms, min_score %d, enter_hits %d, hold %d ms, background_qp %d\n",
+	         g_interval_ms, g_min_score, g_enter_hits, g_hold_ms, g_background_qp);
+
+	return 0;
+}
+
+int rk_roi_dynamic_deinit() {
+	if (!g_roi_dynamic_run_)
+		return 0;
+	g_roi_dynamic_run_ = 0;
+	pthread_join(g_roi_dynamic_thread_id, NULL);
+	// give the slots back so roi.x and a later init start from a clean state
+	pthread_mutex_lock(&g_apply_mutex);
+	for (int s = 0; s < ROI_DYNAMIC_STREAM_NUM; s++) {
+		for (int i = 0; i < g_streams[s].slot_num; i++)
+			roi_stream_apply(&g_streams[s], s, i, 0, 0, 0, 0, 0, 0);
+	}
+	pthread_mutex_unlock(&g_apply_mutex);
+
+	return 0;
+}
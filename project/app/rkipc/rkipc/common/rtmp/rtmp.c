@@ -1,8 +1,17 @@
 // Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
+//
+// Every RTMP stream has a bounded queue and its own sender thread, the VENC and
+// audio threads only copy the frame in and return, so a stalled uplink no longer
+// holds up RTSP and recording fed from the same thread. When the queue backs up
+// non-reference frames go first, then the rest of the GOP up to the next I frame.
+// Queue occupancy also steers the VENC bitrate of the stream through the callback
+// the video module registers, off by default. A failed connect or write reconnects
+// with exponential backoff and asks the video module for an I frame to start on.
 #include "common.h"
 #include "rkmuxer.h"
+#include "rtmp.h"
 #include <sys/time.h>
 
 #ifdef LOG_TAG
@@ -10,43 +19,474 @@
 #endif
 #define LOG_TAG "rtmp.c"
 
-static int g_rtmp_enable[3] = {0, 0, 0};
-static VideoParam g_video_param;
+#define RTMP_STREAM_NUM 3
+#define RTMP_QUEUE_MIN_BYTES (256 * 1024)
+#define RTMP_ABR_LOW_PERCENT 10 // below this the bitrate may grow again
+#define RTMP_ABR_RAISE_PERIODS 3
+#define RTMP_ABR_MIN_KBPS 64 // floor whatever rtmp:abr_min_percent works out to
+
+enum { RTMP_FRAME_VIDEO, RTMP_FRAME_AUDIO };
+
+enum {
+	RTMP_DROP_NONREF,  // non-reference frame above the high watermark
+	RTMP_DROP_GOP,     // rest of a GOP after a frame of it did not fit
+	RTMP_DROP_AUDIO,   // audio frame did not fit
+	RTMP_DROP_OFFLINE, // not connected, or waiting for the first I frame after connecting
+	RTMP_DROP_NUM,
+};
+
+static const char *g_rtmp_drop_reason[RTMP_DROP_NUM] = {"nonref", "gop", "audio", "offline"};
+
+typedef struct rtmp_frame {
+	struct rtmp_frame *next;
+	int type;
+	int key_frame;
+	int64_t present_time;
+	unsigned int size;
+	unsigned char data[];
+} rtmp_frame_s;
+
+typedef struct {
+	rkipc_metric_t *frames[2];
+	rkipc_metric_t *bytes;
+	rkipc_metric_t *errors;
+	rkipc_metric_t *send_us;
+	rkipc_metric_t *dropped[RTMP_DROP_NUM];
+	rkipc_metric_t *queue_bytes;
+	rkipc_metric_t *bitrate;
+	rkipc_metric_t *connected;
+	rkipc_metric_t *reconnects;
+} rtmp_metrics_s;
+
+typedef struct {
+	int id;
+	int run;
+	int h265;
+	char url[256];
+	VideoParam video_param;
+	pthread_t sender;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	// under mutex
+	rtmp_frame_s *head;
+	rtmp_frame_s *tail;
+	int queue_bytes;
+	int queue_peak;
+	int capacity;
+	int nonref_drop_bytes;
+	int online;
+	int skip_to_key; // the drop reason while waiting for an I frame, 0 otherwise
+	int dropped;
+	int writers;    // enqueues copying a frame outside the locks, queue_bytes has it already
+	int generation; // bumped by rtmp_set_online, a frame copied across it is dropped
+	// sender thread only
+	int bitrate;
+	int abr;
+	int abr_min_percent;
+	int abr_interval_ms;
+	int abr_calm;
+	long long abr_time;
+	int reconnect_min_ms;
+	int reconnect_max_ms;
+	rtmp_metrics_s metrics;
+} rtmp_conn_s;
+
+static rtmp_conn_s *g_rtmp_conn[RTMP_STREAM_NUM];
 static pthread_mutex_t g_rtmp_mutex = PTHREAD_MUTEX_INITIALIZER;
-// static AudioParam g_audio_param;
+static rk_rtmp_bitrate_set_callback g_rtmp_bitrate_set_ = NULL;
+static rk_rtmp_request_idr_callback g_rtmp_request_idr_ = NULL;
+
+void rk_rtmp_bitrate_set_callback_register(rk_rtmp_bitrate_set_callback callback_ptr) {
+	pthread_mutex_lock(&g_rtmp_mutex);
+	g_rtmp_bitrate_set_ = callback_ptr;
+	pthread_mutex_unlock(&g_rtmp_mutex);
+}
+
+void rk_rtmp_request_idr_callback_register(rk_rtmp_request_idr_callback callback_ptr) {
+	pthread_mutex_lock(&g_rtmp_mutex);
+	g_rtmp_request_idr_ = callback_ptr;
+	pthread_mutex_unlock(&g_rtmp_mutex);
+}
+
+static void rtmp_metrics_register(rtmp_conn_s *c) {
+	rtmp_metrics_s *m = &c->metrics;
+	char labels[48];
+
+	snprintf(labels, sizeof(labels), "stream=\"%d\",type=\"video\"", c->id);
+	m->frames[RTMP_FRAME_VIDEO] =
+	    rkipc_metric_counter("rkipc_rtmp_frames_total", labels, "Frames sent by the RTMP muxer");
+	snprintf(labels, sizeof(labels), "stream=\"%d\",type=\"audio\"", c->id);
+	m->frames[RTMP_FRAME_AUDIO] =
+	    rkipc_metric_counter("rkipc_rtmp_frames_total", labels, "Frames sent by the RTMP muxer");
+	for (int i = 0; i < RTMP_DROP_NUM; i++) {
+		snprintf(labels, sizeof(labels), "stream=\"%d\",reason=\"%s\"", c->id,
+		         g_rtmp_drop_reason[i]);
+		m->dropped[i] = rkipc_metric_counter("rkipc_rtmp_dropped_frames_total", labels,
+		                                     "Frames dropped before the RTMP muxer");
+	}
+	snprintf(labels, sizeof(labels), "stream=\"%d\"", c->id);
+	m->bytes =
+	    rkipc_metric_counter("rkipc_rtmp_bytes_total", labels, "Bytes sent by the RTMP muxer");
+	m->errors = rkipc_metric_counter("rkipc_rtmp_errors_total", labels,
+	                                 "Frames the RTMP muxer failed to send");
+	m->send_us = rkipc_metric_histogram("rkipc_rtmp_send_us", labels,
+	                                    "Time the RTMP muxer takes to send a frame",
+	                                    rkipc_metric_us_bounds, RKIPC_METRIC_US_BOUNDS);
+	m->queue_bytes =
+	    rkipc_metric_gauge("rkipc_rtmp_queue_bytes", labels, "Bytes waiting in the RTMP queue");
+	m->bitrate = rkipc_metric_gauge("rkipc_rtmp_bitrate_kbps", labels,
+	                                "VENC bitrate asked for by the RTMP rate control");
+	m->connected =
+	    rkipc_metric_gauge("rkipc_rtmp_connected", labels, "1 while the RTMP muxer is connected");
+	m->reconnects =
+	    rkipc_metric_counter("rkipc_rtmp_reconnects_total", labels, "RTMP connection attempts");
+}
+
+// judged by the first VCL NAL unit: nal_ref_idc 0 for H.264, an even sub-layer
+// non-reference type below 16 for H.265
+static int rtmp_frame_is_reference(const unsigned char *buf, unsigned int size, int h265) {
+	unsigned int i;
+	int type;
+
+	for (i = 0; i + 3 < size; i++) {
+		if (buf[i] != 0 || buf[i + 1] != 0 || buf[i + 2] != 1)
+			continue;
+		i += 3;
+		if (h265) {
+			type = (buf[i] >> 1) & 0x3f;
+			if (type < 32)
+				return type > 14 || (type & 1);
+		} else {
+			type = buf[i] & 0x1f;
+			if (type >= 1 && type <= 5)
+				return (buf[i] >> 5) & 0x3;
+		}
+	}
+
+	return 1;
+}
+
+static void rtmp_queue_free(rtmp_conn_s *c) {
+	rtmp_frame_s *frame;
+
+	// frames still being copied keep their share of queue_bytes
+	while (c->head) {
+		frame = c->head;
+		c->head = frame->next;
+		c->queue_bytes -= frame->size;
+		free(frame);
+	}
+	c->tail = NULL;
+}
+
+// frames lost to a connection that is down say nothing about the uplink bandwidth
+static void rtmp_count_drop(rtmp_conn_s *c, int reason) {
+	rkipc_metric_inc(c->metrics.dropped[reason]);
+	if (reason != RTMP_DROP_OFFLINE)
+		c->dropped++;
+}
+
+static void rtmp_queue_drop_all(rtmp_conn_s *c, int reason) {
+	rtmp_frame_s *frame;
+
+	for (frame = c->head; frame; frame = frame->next)
+		rtmp_count_drop(c, reason);
+	rtmp_queue_free(c);
+}
+
+// the frame is copied outside g_rtmp_mutex and c->mutex, so a big I frame does not
+// hold up the other streams or the sender
+static void rtmp_enqueue(int id, int type, unsigned char *buffer, unsigned int size,
+                         int64_t present_time, int key_frame) {
+	rtmp_conn_s *c;
+	rtmp_frame_s *frame;
+	int fits, generation, reason = -1;
+
+	pthread_mutex_lock(&g_rtmp_mutex);
+	c = g_rtmp_conn[id];
+	if (!c) {
+		pthread_mutex_unlock(&g_rtmp_mutex);
+		return;
+	}
+	// rk_rtmp_deinit takes c->mutex after removing c, it then waits for the writers
+	pthread_mutex_lock(&c->mutex);
+	pthread_mutex_unlock(&g_rtmp_mutex);
+	fits = c->queue_bytes + (long long)size <= c->capacity;
+	if (!c->online) {
+		reason = RTMP_DROP_OFFLINE;
+	} else if (c->skip_to_key && !(type == RTMP_FRAME_VIDEO && key_frame)) {
+		reason = c->skip_to_key;
+	} else if (type == RTMP_FRAME_AUDIO) {
+		if (!fits)
+			reason = RTMP_DROP_AUDIO;
+	} else if (key_frame) {
+		// whatever is still queued is older than this I frame and can go as a whole
+		c->skip_to_key = 0;
+		if (!fits)
+			rtmp_queue_drop_all(c, RTMP_DROP_GOP);
+	} else if (!fits) {
+		reason = RTMP_DROP_GOP;
+		c->skip_to_key = RTMP_DROP_GOP;
+	} else if (c->queue_bytes >= c->nonref_drop_bytes &&
+	           !rtmp_frame_is_reference(buffer, size, c->h265)) {
+		reason = RTMP_DROP_NONREF;
+	}
+	if (reason >= 0) {
+		rtmp_count_drop(c, reason);
+		pthread_mutex_unlock(&c->mutex);
+		return;
+	}
+	c->queue_bytes += size;
+	generation = c->generation;
+	c->writers++;
+	pthread_mutex_unlock(&c->mutex);
+
+	frame = malloc(sizeof(*frame) + size);
+	if (frame) {
+		frame->next = NULL;
+		frame->type = type;
+		frame->key_frame = key_frame;
+		frame->present_time = present_time;
+		frame->size = size;
+		memcpy(frame->data, buffer, size);
+	}
+
+	pthread_mutex_lock(&c->mutex);
+	c->writers--;
+	if (!frame || generation != c->generation) {
+		c->queue_bytes -= size;
+		if (frame)
+			rtmp_count_drop(c, RTMP_DROP_OFFLINE);
+		free(frame);
+	} else {
+		if (c->tail)
+			c->tail->next = frame;
+		else
+			c->head = frame;
+		c->tail = frame;
+		if (c->queue_bytes > c->queue_peak)
+			c->queue_peak = c->queue_bytes;
+		rkipc_metric_set(c->metrics.queue_bytes, c->queue_bytes);
+	}
+	pthread_cond_broadcast(&c->cond);
+	pthread_mutex_unlock(&c->mutex);
+}
+
+static int rtmp_config_bitrate(int id) {
+	char entry[128] = {'\0'};
+
+	snprintf(entry, 127, "video.%d:max_rate", id);
+	return rk_param_get_int(entry, 1024);
+}
+
+// AIMD on the queue: back off by 30% when it fills past the nonref watermark or
+// drops a frame, creep back up by 10% of the configured rate once it has stayed
+// nearly empty for a few periods. video.N:max_rate is read every time, so a
+// change made by the user becomes the new ceiling.
+static void rtmp_abr_update(rtmp_conn_s *c, long long now) {
+	rk_rtmp_bitrate_set_callback callback;
+	int config, floor, target, peak, dropped;
+
+	if (!c->abr || now - c->abr_time < c->abr_interval_ms)
+		return;
+	c->abr_time = now;
+	pthread_mutex_lock(&c->mutex);
+	peak = c->queue_peak;
+	dropped = c->dropped;
+	c->queue_peak = c->queue_bytes;
+	c->dropped = 0;
+	pthread_mutex_unlock(&c->mutex);
+
+	config = rtmp_config_bitrate(c->id);
+	if (config <= 0)
+		return;
+	floor = config * c->abr_min_percent / 100;
+	if (floor < RTMP_ABR_MIN_KBPS)
+		floor = RTMP_ABR_MIN_KBPS;
+	target = c->bitrate > config ? config : c->bitrate;
+	if (dropped || peak >= c->nonref_drop_bytes) {
+		target = target * 7 / 10;
+		c->abr_calm = 0;
+	} else if (peak < c->capacity / 100 * RTMP_ABR_LOW_PERCENT) {
+		if (++c->abr_calm >= RTMP_ABR_RAISE_PERIODS) {
+			target += config / 10;
+			c->abr_calm = 0;
+		}
+	} else {
+		c->abr_calm = 0;
+	}
+	if (target < floor)
+		target = floor;
+	if (target > config)
+		target = config;
+	if (target == c->bitrate)
+		return;
+
+	pthread_mutex_lock(&g_rtmp_mutex);
+	callback = g_rtmp_bitrate_set_;
+	pthread_mutex_unlock(&g_rtmp_mutex);
+	if (!callback)
+		return;
+	LOG_INFO("%d: bitrate %d -> %d kbps, queue peak %d/%d bytes, %d dropped\n", c->id,
+	         c->bitrate, target, peak, c->capacity, dropped);
+	// back at the configured rate the limit is released, a later max_rate is not held down
+	if (callback(c->id, target < config ? target : 0) == 0) {
+		c->bitrate = target;
+		rkipc_metric_set(c->metrics.bitrate, target);
+	}
+}
+
+static void rtmp_set_online(rtmp_conn_s *c, int online) {
+	pthread_mutex_lock(&c->mutex);
+	c->online = online;
+	// a connection has to start at an I frame, anything queued is from the old one
+	c->skip_to_key = RTMP_DROP_OFFLINE;
+	c->generation++;
+	rtmp_queue_drop_all(c, RTMP_DROP_OFFLINE);
+	rkipc_metric_set(c->metrics.queue_bytes, c->queue_bytes);
+	pthread_mutex_unlock(&c->mutex);
+	rkipc_metric_set(c->metrics.connected, online);
+}
+
+// waits for a frame, rk_rtmp_deinit also wakes it, so it does not sit out a backoff.
+// Nothing is queued while offline, a backoff always waits for the full time.
+static void rtmp_wait(rtmp_conn_s *c, int ms) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(&c->mutex);
+	if (c->run && !c->head)
+		pthread_cond_timedwait(&c->cond, &c->mutex, &ts);
+	pthread_mutex_unlock(&c->mutex);
+}
+
+static int rtmp_backoff(rtmp_conn_s *c, int backoff_ms) {
+	rtmp_wait(c, backoff_ms);
+	return backoff_ms * 2 > c->reconnect_max_ms ? c->reconnect_max_ms : backoff_ms * 2;
+}
+
+static void *rk_rtmp_sender(void *arg) {
+	rtmp_conn_s *c = arg;
+	rtmp_frame_s *frame;
+	rk_rtmp_request_idr_callback request_idr;
+	int backoff_ms = c->reconnect_min_ms;
+	int connected = 0;
+	long long begin_us;
+	int ret;
+
+	prctl(PR_SET_NAME, "rk_rtmp_sender", 0, 0, 0);
+	while (c->run) {
+		if (!connected) {
+			rkipc_metric_inc(c->metrics.reconnects);
+			if (rkmuxer_init(c->id + 3, "flv", c->url, &c->video_param, NULL)) {
+				LOG_WARN("%d: connect %s fail, retry in %d ms\n", c->id, c->url, backoff_ms);
+				rkmuxer_deinit(c->id + 3);
+				backoff_ms = rtmp_backoff(c, backoff_ms);
+				continue;
+			}
+			LOG_INFO("%d: connected to %s\n", c->id, c->url);
+			connected = 1;
+			rtmp_set_online(c, 1);
+			// without it the stream only starts at the next regular I frame, a GOP later
+			pthread_mutex_lock(&g_rtmp_mutex);
+			request_idr = g_rtmp_request_idr_;
+			pthread_mutex_unlock(&g_rtmp_mutex);
+			if (request_idr && request_idr(c->id))
+				LOG_WARN("%d: request idr fail\n", c->id);
+		}
+
+		// wakes up at least once a second to run the rate control
+		rtmp_wait(c, 1000);
+		pthread_mutex_lock(&c->mutex);
+		frame = c->head;
+		if (frame) {
+			c->head = frame->next;
+			if (!c->head)
+				c->tail = NULL;
+			c->queue_bytes -= frame->size;
+			rkipc_metric_set(c->metrics.queue_bytes, c->queue_bytes);
+		}
+		pthread_mutex_unlock(&c->mutex);
+		rtmp_abr_update(c, rkipc_get_curren_time_ms());
+		if (!frame)
+			continue;
+
+		begin_us = rkipc_metrics_now_us();
+		if (frame->type == RTMP_FRAME_VIDEO)
+			ret = rkmuxer_write_video_frame(c->id + 3, frame->data, frame->size,
+			                                frame->present_time, frame->key_frame);
+		else
+			ret = rkmuxer_write_audio_frame(c->id + 3, frame->data, frame->size,
+			                                frame->present_time);
+		rkipc_metric_observe(c->metrics.send_us, rkipc_metrics_now_us() - begin_us);
+		if (ret) {
+			rkipc_metric_inc(c->metrics.errors);
+			LOG_WARN("%d: write fail %d, reconnect in %d ms\n", c->id, ret, backoff_ms);
+			free(frame);
+			rkmuxer_deinit(c->id + 3);
+			connected = 0;
+			rtmp_set_online(c, 0);
+			backoff_ms = rtmp_backoff(c, backoff_ms);
+			continue;
+		}
+		backoff_ms = c->reconnect_min_ms;
+		rkipc_metric_inc(c->metrics.frames[frame->type]);
+		rkipc_metric_add(c->metrics.bytes, frame->size);
+		free(frame);
+	}
+	if (connected)
+		rkmuxer_deinit(c->id + 3);
+	rtmp_set_online(c, 0);
+
+	return NULL;
+}
 
 int rk_rtmp_init(int id, const char *rtmp_url) {
 	int ret = 0;
 	char entry[128] = {'\0'};
+	rtmp_conn_s *c;
 	LOG_DEBUG("begin\n");
+	if (id < 0 || id >= RTMP_STREAM_NUM || g_rtmp_conn[id])
+		return -1;
 	system("ifconfig lo up");
 
-	// set g_video_param
-	memset(&g_video_param, 0, sizeof(g_video_param));
-	g_video_param.level = 52;
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -1;
+	c->id = id;
+	snprintf(c->url, sizeof(c->url), "%s", rtmp_url);
+	// set c->video_param
+	c->video_param.level = 52;
 	snprintf(entry, 127, "video.%d:width", id);
-	g_video_param.width = rk_param_get_int(entry, 1920);
+	c->video_param.width = rk_param_get_int(entry, 1920);
 	snprintf(entry, 127, "video.%d:height", id);
-	g_video_param.height = rk_param_get_int(entry, 1080);
-	snprintf(entry, 127, "video.%d:max_rate", id);
-	g_video_param.bit_rate = rk_param_get_int(entry, 1024) * 1024;
+	c->video_param.height = rk_param_get_int(entry, 1080);
+	c->video_param.bit_rate = rtmp_config_bitrate(id) * 1024;
 	snprintf(entry, 127, "video.%d:dst_frame_rate_den", id);
-	g_video_param.frame_rate_den = rk_param_get_int(entry, 1);
+	c->video_param.frame_rate_den = rk_param_get_int(entry, 1);
 	snprintf(entry, 127, "video.%d:dst_frame_rate_num", id);
-	g_video_param.frame_rate_num = rk_param_get_int(entry, 30);
+	c->video_param.frame_rate_num = rk_param_get_int(entry, 30);
 	snprintf(entry, 127, "video.%d:output_data_type", id);
 	const char *output_data_type = rk_param_get_string(entry, "H.264");
-	if (output_data_type)
-		memcpy(g_video_param.codec, output_data_type, strlen(output_data_type));
+	if (output_data_type) {
+		snprintf(c->video_param.codec, sizeof(c->video_param.codec), "%s", output_data_type);
+		c->h265 = !strcmp(output_data_type, "H.265");
+	}
 	snprintf(entry, 127, "video.%d:h264_profile", id);
 	const char *h264_profile = rk_param_get_string(entry, "high");
 	if (!strcmp(h264_profile, "high"))
-		g_video_param.profile = 100;
+		c->video_param.profile = 100;
 	else if (!strcmp(h264_profile, "main"))
-		g_video_param.profile = 77;
+		c->video_param.profile = 77;
 	else if (!strcmp(h264_profile, "baseline"))
-		g_video_param.profile = 66;
-	memcpy(g_video_param.format, "NV12", strlen("NV12"));
+		c->video_param.profile = 66;
+	memcpy(c->video_param.format, "NV12", strlen("NV12"));
 	// set g_audio_param
 	// g_audio_param.channels = rk_param_get_int("audio.0:channels", 2);
 	// g_audio_param.sample_rate = rk_param_get_int("audio.0:sample_rate", 16000);
@@ -57,20 +497,74 @@ int rk_rtmp_init(int id, const char *rtmp_url) {
 	// const char *codec = rk_param_get_string("audio.0:encode_type", NULL);
 	// if (codec)
 	// 	memcpy(g_audio_param.codec, codec, strlen(codec));
+
+	// the queue holds rtmp:queue_ms worth of the configured bitrate
+	c->capacity = (long long)c->video_param.bit_rate / 8 *
+	              rk_param_get_int("rtmp:queue_ms", 2000) / 1000;
+	if (c->capacity < RTMP_QUEUE_MIN_BYTES)
+		c->capacity = RTMP_QUEUE_MIN_BYTES;
+	c->nonref_drop_bytes = c->capacity / 100 * rk_param_get_int("rtmp:nonref_drop_percent", 50);
+	// the encoder is shared with RTSP and recording, which would follow the rtmp uplink
+	c->abr = rk_param_get_int("rtmp:abr", 0);
+	c->abr_min_percent = rk_param_get_int("rtmp:abr_min_percent", 25);
+	c->abr_interval_ms = rk_param_get_int("rtmp:abr_interval_ms", 1000);
+	c->reconnect_min_ms = rk_param_get_int("rtmp:reconnect_min_ms", 1000);
+	c->reconnect_max_ms = rk_param_get_int("rtmp:reconnect_max_ms", 30000);
+	if (c->abr_min_percent <= 0 || c->abr_min_percent > 100)
+		c->abr_min_percent = 25;
+	if (c->reconnect_min_ms <= 0)
+		c->reconnect_min_ms = 1000;
+	if (c->reconnect_max_ms < c->reconnect_min_ms)
+		c->reconnect_max_ms = c->reconnect_min_ms;
+	c->bitrate = rtmp_config_bitrate(id);
+	c->skip_to_key = RTMP_DROP_OFFLINE;
+	pthread_mutex_init(&c->mutex, NULL);
+	pthread_cond_init(&c->cond, NULL);
+	rtmp_metrics_register(c);
+	rkipc_metric_set(c->metrics.bitrate, c->bitrate);
+
+	c->run = 1;
+	if (pthread_create(&c->sender, NULL, rk_rtmp_sender, c)) {
+		LOG_ERROR("%d: create sender fail\n", id);
+		pthread_cond_destroy(&c->cond);
+		pthread_mutex_destroy(&c->mutex);
+		free(c);
+		return -1;
+	}
 	pthread_mutex_lock(&g_rtmp_mutex);
-	rkmuxer_init(id + 3, "flv", rtmp_url, &g_video_param, NULL);
-	g_rtmp_enable[id] = 1;
+	g_rtmp_conn[id] = c;
 	pthread_mutex_unlock(&g_rtmp_mutex);
+	LOG_INFO("%d: %s, queue %d bytes\n", id, rtmp_url, c->capacity);
 
 	return ret;
 }
 
+// a sender stuck writing to a dead uplink is only released by the socket timeout
 int rk_rtmp_deinit(int id) {
+	rtmp_conn_s *c;
+
 	LOG_DEBUG("begin\n");
+	if (id < 0 || id >= RTMP_STREAM_NUM)
+		return -1;
 	pthread_mutex_lock(&g_rtmp_mutex);
-	g_rtmp_enable[id] = 0;
-	rkmuxer_deinit(id + 3);
+	c = g_rtmp_conn[id];
+	g_rtmp_conn[id] = NULL;
 	pthread_mutex_unlock(&g_rtmp_mutex);
+	if (!c)
+		return 0;
+	pthread_mutex_lock(&c->mutex);
+	c->run = 0;
+	pthread_cond_broadcast(&c->cond);
+	pthread_mutex_unlock(&c->mutex);
+	pthread_join(c->sender, NULL);
+	pthread_mutex_lock(&c->mutex);
+	while (c->writers)
+		pthread_cond_wait(&c->cond, &c->mutex);
+	pthread_mutex_unlock(&c->mutex);
+	rtmp_queue_free(c);
+	pthread_cond_destroy(&c->cond);
+	pthread_mutex_destroy(&c->mutex);
+	free(c);
 	LOG_DEBUG("end\n");
 
 	return 0;
@@ -78,20 +572,18 @@ int rk_rtmp_deinit(int id) {
 
 int rk_rtmp_write_video_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                               int64_t present_time, int key_frame) {
-	pthread_mutex_lock(&g_rtmp_mutex);
-	if (g_rtmp_enable[id])
-		rkmuxer_write_video_frame(id + 3, buffer, buffer_size, present_time, key_frame);
-	pthread_mutex_unlock(&g_rtmp_mutex);
+	if (id < 0 || id >= RTMP_STREAM_NUM)
+		return -1;
+	rtmp_enqueue(id, RTMP_FRAME_VIDEO, buffer, buffer_size, present_time, key_frame);
 
 	return 0;
 }
 
 int rk_rtmp_write_audio_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                               int64_t present_time) {
-	if (g_rtmp_enable[id]) {
-		pthread_mutex_lock(&g_rtmp_mutex);
-		rkmuxer_write_audio_frame(id + 3, buffer, buffer_size, present_time);
-		pthread_mutex_unlock(&g_rtmp_mutex);
-	}
+	if (id < 0 || id >= RTMP_STREAM_NUM)
+		return -1;
+	rtmp_enqueue(id, RTMP_FRAME_AUDIO, buffer, buffer_size, present_time, 0);
+
 	return 0;
 }
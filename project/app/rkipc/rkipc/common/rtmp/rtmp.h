@@ -9,6 +9,14 @@
 extern "C" {
 #endif
 
+// called from the sender thread with the VENC bitrate in kbps the stream should
+// run at, 0 for no limit under video.N:max_rate, returns 0 once it is applied
+typedef int (*rk_rtmp_bitrate_set_callback)(int id, int kbps);
+// called from the sender thread after each connect, returns 0 once an I frame is requested
+typedef int (*rk_rtmp_request_idr_callback)(int id);
+
+void rk_rtmp_bitrate_set_callback_register(rk_rtmp_bitrate_set_callback callback_ptr);
+void rk_rtmp_request_idr_callback_register(rk_rtmp_request_idr_callback callback_ptr);
 int rk_rtmp_init(int id, const char *rtmp_url);
 int rk_rtmp_deinit(int id);
 int rk_rtmp_write_video_frame(int id, unsigned char *buffer, unsigned int buffer_size,
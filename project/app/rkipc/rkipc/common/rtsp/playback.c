@@ -0,0 +1,1292 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// RTSP playback of the recordings. librtsp owns port 554 and only knows live sessions, it
+// has no Range, Scale or PAUSE, so recordings get a small server of their own:
+//   rtsp://<ip>:8554/playback?start=20231019114600&end=20231019120000&id=0
+// start and end are local times like the segment names, end is optional and id is the
+// recording, storage.<id>. track=sub plays the sub stream of a multi-track recording,
+// segments without one are skipped. The catalog callback finds the segments, which are
+// played one after the other; a gap between them is cut to one frame. PLAY takes a Range
+// in npt from start or in clock time, Scale 2, 4 or 8 sends I frames only, PAUSE keeps
+// the position. Every RTP packet carries the ONVIF replay extension with the recording
+// time of its frame, RTCP sender reports map RTP time to the recording time.
+// The server has no authentication, so rkipc only starts it with rtsp:playback = 1 and
+// binds it to rtsp:playback_addr, loopback unless configured otherwise.
+#include "common.h"
+#include "mp4_reader.h"
+#include "playback.h"
+#include "rtsp.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "playback.c"
+
+#define PLAYBACK_SESSION_MAX 8
+#define PLAYBACK_REQUEST_MAX 4096
+#define PLAYBACK_REPLY_MAX 4096
+#define PLAYBACK_PAYLOAD_MAX 1400
+#define PLAYBACK_NAL_MAX 64
+#define PLAYBACK_SAMPLE_MAX (4 * 1024 * 1024)
+#define PLAYBACK_GAP_US 40000         // what a gap in the recording is cut to
+#define PLAYBACK_LATE_US 1000000      // behind by more, the pacing starts again from now
+#define PLAYBACK_TAIL_WAIT_MS 10000   // for the segment being recorded to grow
+#define PLAYBACK_NTP_OFFSET 2208988800ULL
+#define PLAYBACK_EXT_ONVIF 0xabac
+
+enum { PLAYBACK_VIDEO = 0, PLAYBACK_AUDIO, PLAYBACK_TRACK_NUM };
+
+typedef struct {
+	int setup;
+	int tcp;     // interleaved on the RTSP connection
+	int channel; // interleaved RTP channel, RTCP is the next one
+	int rtp_fd;
+	int rtcp_fd;
+	struct sockaddr_in rtp_addr;
+	struct sockaddr_in rtcp_addr;
+	int payload_type;
+	int clock_rate;
+	uint32_t ssrc;
+	uint32_t ts_base;
+	uint16_t seq;
+	uint32_t packets;
+	uint32_t octets;
+	long long sr_us; // last sender report
+} playback_track_s;
+
+typedef struct {
+	int used;
+	int run;
+	int done;
+	pthread_t thread;
+	int fd;
+	uint32_t id;
+	long long active_us; // last request or RTCP of the client
+	char req[PLAYBACK_REQUEST_MAX + 1]; // kept terminated
+	int req_len;
+	// what DESCRIBE found
+	int opened;
+	int recording;
+	int video_track; // 0 for the main stream, 1 for the sub stream
+	int64_t start_ms;
+	int64_t end_ms; // 0 without an end
+	rkipc_mp4_info_s info;
+	playback_track_s track[PLAYBACK_TRACK_NUM];
+	// the segment being read
+	rkipc_mp4_reader_t *reader;
+	char path[256];
+	int64_t segment_ms;
+	int audio_ok; // same audio as described
+	// the sample to send next
+	rkipc_mp4_sample_s sample;
+	int pending;
+	int64_t sample_wall_us;
+	int64_t prev_wall_us; // -1 after a seek
+	int64_t stream_us;    // RTP time with the gaps cut and the scale applied
+	int discontinuity;
+	unsigned char *buf;
+	uint32_t buf_size;
+	// PLAY
+	int playing;
+	int started;
+	double scale;
+	int cseq;
+	long long play_clock_us;
+	int64_t play_stream_us;
+	int64_t ntp_wall_us; // the recording time at ntp_stream_us
+	int64_t ntp_stream_us;
+	long long tail_us; // since when there is nothing to read, 0 while reading
+} playback_session_s;
+
+static playback_session_s g_playback_session[PLAYBACK_SESSION_MAX];
+static pthread_mutex_t g_playback_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rkipc_rtsp_playback_catalog_callback g_playback_catalog_ = NULL;
+static pthread_t g_playback_thread;
+static int g_playback_run;
+static int g_playback_fd = -1;
+static int g_playback_sessions;
+static int g_playback_timeout_ms;
+static int64_t g_playback_gap_us;
+static rkipc_metric_t *g_playback_sessions_metric;
+static rkipc_metric_t *g_playback_bytes;
+
+void rkipc_rtsp_playback_catalog_callback_register(
+    rkipc_rtsp_playback_catalog_callback callback_ptr) {
+	pthread_mutex_lock(&g_playback_mutex);
+	g_playback_catalog_ = callback_ptr;
+	pthread_mutex_unlock(&g_playback_mutex);
+}
+
+static int playback_catalog(int id, int64_t wall_time_ms, int next, char *path, int len,
+                            int64_t *start_time_ms) {
+	rkipc_rtsp_playback_catalog_callback catalog;
+
+	pthread_mutex_lock(&g_playback_mutex);
+	catalog = g_playback_catalog_;
+	pthread_mutex_unlock(&g_playback_mutex);
+	if (!catalog)
+		return -1;
+
+	return catalog(id, wall_time_ms, next, path, len, start_time_ms);
+}
+
+static void playback_be16(unsigned char *p, unsigned int v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void playback_be32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void playback_ntp(unsigned char *p, int64_t wall_us) {
+	playback_be32(p, wall_us / 1000000 + PLAYBACK_NTP_OFFSET);
+	playback_be32(p + 4, (uint32_t)(((uint64_t)(wall_us % 1000000) << 32) / 1000000));
+}
+
+static int playback_base64(const unsigned char *in, int len, char *out, int size) {
+	static const char table[] =
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned int v;
+	int n = 0;
+
+	if ((len + 2) / 3 * 4 >= size)
+		return -1;
+	for (int i = 0; i < len; i += 3) {
+		v = in[i] << 16 | (i + 1 < len ? in[i + 1] << 8 : 0) | (i + 2 < len ? in[i + 2] : 0);
+		out[n++] = table[v >> 18 & 0x3f];
+		out[n++] = table[v >> 12 & 0x3f];
+		out[n++] = i + 1 < len ? table[v >> 6 & 0x3f] : '=';
+		out[n++] = i + 2 < len ? table[v & 0x3f] : '=';
+	}
+	out[n] = '\0';
+
+	return n;
+}
+
+// the NAL units of an Annex B buffer with 4 byte start codes, as the reader writes them
+static int playback_annexb_next(const unsigned char *p, int size, int *pos, int *len) {
+	int begin, end;
+
+	if (*pos + 4 > size)
+		return -1;
+	begin = *pos + 4;
+	for (end = begin; end + 4 <= size; end++) {
+		if (!p[end] && !p[end + 1] && !p[end + 2] && p[end + 3] == 1)
+			break;
+	}
+	if (end + 4 > size)
+		end = size;
+	*pos = end;
+	*len = end - begin;
+
+	return begin;
+}
+
+static int playback_send_all(int fd, const void *buf, int len) {
+	const char *p = buf;
+	int ret;
+
+	while (len > 0) {
+		ret = send(fd, p, len, MSG_NOSIGNAL);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+// pkt has 4 bytes in front of the packet for the interleaved header
+static int playback_send_packet(playback_session_s *s, playback_track_s *t, int rtcp,
+                                unsigned char *pkt, int len) {
+	rkipc_metric_add(g_playback_bytes, len);
+	if (t->tcp) {
+		pkt[0] = '$';
+		pkt[1] = t->channel + rtcp;
+		playback_be16(pkt + 2, len);
+		return playback_send_all(s->fd, pkt, len + 4);
+	}
+	// a lost datagram is no reason to end the session
+	if (rtcp)
+		sendto(t->rtcp_fd, pkt + 4, len, MSG_NOSIGNAL, (struct sockaddr *)&t->rtcp_addr,
+		       sizeof(t->rtcp_addr));
+	else
+		sendto(t->rtp_fd, pkt + 4, len, MSG_NOSIGNAL, (struct sockaddr *)&t->rtp_addr,
+		       sizeof(t->rtp_addr));
+
+	return 0;
+}
+
+static uint32_t playback_rtp_time(playback_track_s *t, int64_t stream_us) {
+	return t->ts_base + (uint32_t)((uint64_t)stream_us * t->clock_rate / 1000000);
+}
+
+// a sender report, with bye set followed by a BYE
+static int playback_send_sr(playback_session_s *s, playback_track_s *t, int bye) {
+	unsigned char pkt[4 + 36];
+	unsigned char *p = pkt + 4;
+	int64_t stream_us = s->pending ? s->stream_us : s->play_stream_us;
+
+	p[0] = 0x80;
+	p[1] = 200;
+	playback_be16(p + 2, 6);
+	playback_be32(p + 4, t->ssrc);
+	playback_ntp(p + 8, s->ntp_wall_us + (stream_us - s->ntp_stream_us));
+	playback_be32(p + 16, playback_rtp_time(t, stream_us));
+	playback_be32(p + 20, t->packets);
+	playback_be32(p + 24, t->octets);
+	if (bye) {
+		p[28] = 0x81;
+		p[29] = 203;
+		playback_be16(p + 30, 1);
+		playback_be32(p + 32, t->ssrc);
+	}
+	t->sr_us = rkipc_metrics_now_us();
+
+	return playback_send_packet(s, t, 1, pkt, bye ? 36 : 28);
+}
+
+static int playback_send_rtp(playback_session_s *s, playback_track_s *t, int marker,
+                             const unsigned char *head, int head_len,
+                             const unsigned char *payload, int len) {
+	unsigned char pkt[4 + 28 + PLAYBACK_PAYLOAD_MAX];
+	unsigned char *p = pkt + 4;
+
+	p[0] = 0x90; // version 2 with a header extension
+	p[1] = (marker ? 0x80 : 0) | t->payload_type;
+	playback_be16(p + 2, t->seq++);
+	playback_be32(p + 4, playback_rtp_time(t, s->stream_us));
+	playback_be32(p + 8, t->ssrc);
+	// ONVIF replay, the recording time, C for a clean point, D after a gap or a seek and the
+	// low byte of the CSeq of the PLAY
+	playback_be16(p + 12, PLAYBACK_EXT_ONVIF);
+	playback_be16(p + 14, 3);
+	playback_ntp(p + 16, s->sample_wall_us);
+	p[24] = (s->sample.key ? 0x80 : 0) | (s->discontinuity ? 0x20 : 0);
+	p[25] = s->cseq;
+	p[26] = 0;
+	p[27] = 0;
+	if (head_len)
+		memcpy(p + 28, head, head_len);
+	memcpy(p + 28 + head_len, payload, len);
+	t->packets++;
+	t->octets += head_len + len;
+	s->discontinuity = 0;
+
+	return playback_send_packet(s, t, 0, pkt, 28 + head_len + len);
+}
+
+// single NAL unit packets, or FU-A and for H.265 FU when larger
+static int playback_send_nal(playback_session_s *s, playback_track_s *t,
+                             const unsigned char *nal, int len, int last) {
+	unsigned char head[3];
+	int h265 = s->info.h265;
+	int hdr = h265 ? 2 : 1;
+	int chunk, type;
+
+	if (len <= hdr)
+		return 0;
+	if (len <= PLAYBACK_PAYLOAD_MAX)
+		return playback_send_rtp(s, t, last, NULL, 0, nal, len);
+	if (h265) {
+		type = (nal[0] >> 1) & 0x3f;
+		head[0] = (nal[0] & 0x81) | (49 << 1);
+		head[1] = nal[1];
+	} else {
+		type = nal[0] & 0x1f;
+		head[0] = (nal[0] & 0xe0) | 28;
+	}
+	head[hdr] = 0x80 | type;
+	nal += hdr;
+	len -= hdr;
+	while (len > 0) {
+		chunk = len > PLAYBACK_PAYLOAD_MAX - hdr - 1 ? PLAYBACK_PAYLOAD_MAX - hdr - 1 : len;
+		if (chunk == len)
+			head[hdr] |= 0x40;
+		if (playback_send_rtp(s, t, last && chunk == len, head, hdr + 1, nal, chunk))
+			return -1;
+		head[hdr] &= ~0x80;
+		nal += chunk;
+		len -= chunk;
+	}
+
+	return 0;
+}
+
+static int playback_send_video(playback_session_s *s, playback_track_s *t) {
+	const unsigned char *nal[PLAYBACK_NAL_MAX];
+	const rkipc_mp4_info_s *info = rkipc_mp4_reader_info(s->reader);
+	int size[PLAYBACK_NAL_MAX];
+	int num = 0, in_band = 0, pos = 0, len, type, begin;
+	uint32_t n;
+
+	while (pos + info->nal_length_size <= (int)s->sample.size && num < PLAYBACK_NAL_MAX) {
+		n = 0;
+		for (int i = 0; i < info->nal_length_size; i++)
+			n = n << 8 | s->buf[pos + i];
+		pos += info->nal_length_size;
+		if (!n || n > s->sample.size - pos)
+			break;
+		type = info->h265 ? (s->buf[pos] >> 1) & 0x3f : s->buf[pos] & 0x1f;
+		if (type == (info->h265 ? 33 : 7))
+			in_band = 1;
+		nal[num] = s->buf + pos;
+		size[num++] = n;
+		pos += n;
+	}
+	// an I frame decodes on its own, with the parameter sets of its segment
+	if (s->sample.key && !in_band) {
+		pos = 0;
+		while ((begin = playback_annexb_next(info->param, info->param_size, &pos, &len)) >= 0) {
+			if (playback_send_nal(s, t, info->param + begin, len, 0))
+				return -1;
+		}
+	}
+	for (int i = 0; i < num; i++) {
+		if (playback_send_nal(s, t, nal[i], size[i], i == num - 1))
+			return -1;
+	}
+
+	return 0;
+}
+
+// G.711 and MP2 in packets of whole samples, AAC with the AU header of AAC-hbr
+static int playback_send_audio(playback_session_s *s, playback_track_s *t) {
+	unsigned char head[4];
+	int len = s->sample.size;
+
+	if (s->info.audio == RKIPC_MP4_AUDIO_AAC) {
+		if (len > PLAYBACK_PAYLOAD_MAX - 4)
+			return 0;
+		playback_be16(head, 16);
+		playback_be16(head + 2, len << 3);
+		return playback_send_rtp(s, t, 1, head, 4, s->buf, len);
+	}
+	if (s->info.audio == RKIPC_MP4_AUDIO_MP2) {
+		if (len > PLAYBACK_PAYLOAD_MAX - 4)
+			return 0;
+		memset(head, 0, sizeof(head));
+		return playback_send_rtp(s, t, 1, head, 4, s->buf, len);
+	}
+	if (len > PLAYBACK_PAYLOAD_MAX)
+		len = PLAYBACK_PAYLOAD_MAX;
+
+	return playback_send_rtp(s, t, 1, NULL, 0, s->buf, len);
+}
+
+static int playback_send_sample(playback_session_s *s) {
+	playback_track_s *t = &s->track[s->sample.audio ? PLAYBACK_AUDIO : PLAYBACK_VIDEO];
+	long long now = rkipc_metrics_now_us();
+	unsigned char *buf;
+
+	if (s->sample.size > PLAYBACK_SAMPLE_MAX)
+		return 0;
+	if (s->sample.size > s->buf_size) {
+		buf = realloc(s->buf, s->sample.size);
+		if (!buf)
+			return 0;
+		s->buf = buf;
+		s->buf_size = s->sample.size;
+	}
+	// a sample the file does not hold in full is left out
+	if (rkipc_mp4_reader_read(s->reader, &s->sample, s->buf))
+		return 0;
+	if ((!t->packets || now - t->sr_us >= 1000000) && playback_send_sr(s, t, 0))
+		return -1;
+
+	return s->sample.audio ? playback_send_audio(s, t) : playback_send_video(s, t);
+}
+
+static int playback_use_segment(playback_session_s *s, const char *path, int64_t start_ms) {
+	const rkipc_mp4_info_s *info;
+	rkipc_mp4_reader_t *reader;
+
+	reader = rkipc_mp4_reader_open(path, s->video_track);
+	if (!reader) {
+		LOG_WARN("%s is not readable\n", path);
+		return -1;
+	}
+	info = rkipc_mp4_reader_info(reader);
+	// another codec can not go on in the same RTP session
+	if (s->reader && info->h265 != s->info.h265) {
+		LOG_WARN("%s is %s, skipped\n", path, info->h265 ? "H.265" : "H.264");
+		rkipc_mp4_reader_close(reader);
+		return -1;
+	}
+	if (s->reader)
+		rkipc_mp4_reader_close(s->reader);
+	s->reader = reader;
+	snprintf(s->path, sizeof(s->path), "%s", path);
+	s->segment_ms = start_ms;
+	s->audio_ok = info->audio == s->info.audio && info->sample_rate == s->info.sample_rate &&
+	              info->channels == s->info.channels;
+
+	return 0;
+}
+
+// 0 with the next segment open, 1 while the last one may still grow, -1 past the end
+static int playback_next_segment(playback_session_s *s) {
+	char path[sizeof(s->path)];
+	int64_t start_ms = s->segment_ms;
+
+	while (!playback_catalog(s->recording, start_ms, 1, path, sizeof(path), &start_ms)) {
+		if (s->end_ms && start_ms > s->end_ms)
+			return -1;
+		if (!playback_use_segment(s, path, start_ms))
+			return 0;
+	}
+
+	return 1;
+}
+
+// the next sample to send, 1 when there is none yet, -1 at the end
+static int playback_fetch(playback_session_s *s) {
+	rkipc_mp4_sample_s sample;
+	int64_t wall_us, delta;
+	int ret;
+
+	while (!s->pending) {
+		if (rkipc_mp4_reader_next(s->reader, &sample)) {
+			ret = playback_next_segment(s);
+			if (ret)
+				return ret;
+			continue;
+		}
+		if (sample.audio && (s->scale != 1.0 || !s->audio_ok || !s->track[PLAYBACK_AUDIO].setup))
+			continue;
+		if (!sample.audio && (!s->track[PLAYBACK_VIDEO].setup || (s->scale >= 2.0 && !sample.key)))
+			continue;
+		wall_us = s->segment_ms * 1000 + sample.time_us;
+		if (s->end_ms && wall_us > s->end_ms * 1000)
+			return -1;
+		delta = s->prev_wall_us < 0 ? 0 : wall_us - s->prev_wall_us;
+		if (delta < 0)
+			delta = 0;
+		if (delta > g_playback_gap_us) {
+			delta = PLAYBACK_GAP_US;
+			s->discontinuity = 1;
+		}
+		s->stream_us += (int64_t)(delta / s->scale);
+		s->prev_wall_us = wall_us;
+		s->sample = sample;
+		s->sample_wall_us = wall_us;
+		s->pending = 1;
+	}
+
+	return 0;
+}
+
+// the I frame at or before wall_ms, or the start of the first segment after it
+static int playback_seek(playback_session_s *s, int64_t wall_ms) {
+	char path[sizeof(s->path)];
+	int64_t start_ms;
+
+	if (playback_catalog(s->recording, wall_ms, 0, path, sizeof(path), &start_ms) &&
+	    playback_catalog(s->recording, wall_ms, 1, path, sizeof(path), &start_ms))
+		return -1;
+	if (s->end_ms && start_ms > s->end_ms)
+		return -1;
+	if (strcmp(path, s->path) && playback_use_segment(s, path, start_ms))
+		return -1;
+	rkipc_mp4_reader_seek(s->reader, (wall_ms - start_ms) * 1000);
+	s->pending = 0;
+	s->prev_wall_us = -1;
+	s->discontinuity = 1;
+	s->tail_us = 0;
+
+	return 0;
+}
+
+static int64_t playback_local_time(const char *str) {
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if (strlen(str) < 14 || sscanf(str, "%4d%2d%2d%2d%2d%2d", &tm.tm_year, &tm.tm_mon,
+	                               &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+
+	return (int64_t)mktime(&tm) * 1000;
+}
+
+// YYYYMMDDThhmmss[.fraction]Z of RFC 2326 3.7
+static int64_t playback_utc_time(const char *str) {
+	struct tm tm;
+	double frac = 0;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(str, "%4d%2d%2dT%2d%2d%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour,
+	           &tm.tm_min, &tm.tm_sec) != 6)
+		return -1;
+	if (str[15] == '.')
+		frac = atof(str + 15);
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+
+	return (int64_t)timegm(&tm) * 1000 + (int64_t)(frac * 1000);
+}
+
+// the value of name in the query of url
+static int playback_query(const char *url, const char *name, char *value, int len) {
+	const char *p = strchr(url, '?');
+	int n = strlen(name), i = 0;
+
+	while (p) {
+		p++;
+		if (!strncmp(p, name, n) && p[n] == '=') {
+			p += n + 1;
+			while (p[i] && p[i] != '&' && i < len - 1) {
+				value[i] = p[i];
+				i++;
+			}
+			value[i] = '\0';
+			return 0;
+		}
+		p = strchr(p, '&');
+	}
+
+	return -1;
+}
+
+static int playback_open(playback_session_s *s, const char *url) {
+	char value[32], path[sizeof(s->path)];
+	const char *p = strstr(url, "://");
+	int64_t start_ms;
+
+	p = p ? strchr(p + 3, '/') : url;
+	if (!p || strncmp(p, "/playback", 9) || playback_query(p, "start", value, sizeof(value)))
+		return -1;
+	s->start_ms = playback_local_time(value);
+	s->end_ms = 0;
+	if (!playback_query(p, "end", value, sizeof(value)))
+		s->end_ms = playback_local_time(value);
+	s->recording = 0;
+	if (!playback_query(p, "id", value, sizeof(value)))
+		s->recording = atoi(value);
+	s->video_track = 0;
+	if (!playback_query(p, "track", value, sizeof(value)))
+		s->video_track = !strcmp(value, "sub") || !strcmp(value, "1");
+	if (s->start_ms < 0 || s->end_ms < 0 || (s->end_ms && s->end_ms <= s->start_ms))
+		return -1;
+
+	start_ms = s->start_ms;
+	if (playback_catalog(s->recording, start_ms, 0, path, sizeof(path), &start_ms) &&
+	    playback_catalog(s->recording, start_ms, 1, path, sizeof(path), &start_ms))
+		return -1;
+	while (playback_use_segment(s, path, start_ms)) {
+		if (playback_catalog(s->recording, start_ms, 1, path, sizeof(path), &start_ms))
+			return -1;
+	}
+	if (s->end_ms && start_ms > s->end_ms) {
+		rkipc_mp4_reader_close(s->reader);
+		s->reader = NULL;
+		return -1;
+	}
+	s->info = *rkipc_mp4_reader_info(s->reader);
+	s->audio_ok = 1;
+	s->track[PLAYBACK_VIDEO].payload_type = 96;
+	s->track[PLAYBACK_VIDEO].clock_rate = 90000;
+	s->track[PLAYBACK_AUDIO].clock_rate = s->info.sample_rate;
+	switch (s->info.audio) {
+	case RKIPC_MP4_AUDIO_G711A:
+	case RKIPC_MP4_AUDIO_G711U:
+		// the static payload types are 8 kHz mono
+		if (s->info.sample_rate == 8000 && s->info.channels == 1)
+			s->track[PLAYBACK_AUDIO].payload_type =
+			    s->info.audio == RKIPC_MP4_AUDIO_G711A ? 8 : 0;
+		else
+			s->track[PLAYBACK_AUDIO].payload_type = 97;
+		break;
+	case RKIPC_MP4_AUDIO_MP2:
+		s->track[PLAYBACK_AUDIO].payload_type = 14;
+		s->track[PLAYBACK_AUDIO].clock_rate = 90000;
+		break;
+	default:
+		s->track[PLAYBACK_AUDIO].payload_type = 97;
+		break;
+	}
+	if (s->track[PLAYBACK_AUDIO].clock_rate <= 0)
+		s->info.audio = RKIPC_MP4_AUDIO_NONE;
+	s->opened = 1;
+
+	return 0;
+}
+
+static int playback_sdp(playback_session_s *s, char *sdp, int size) {
+	char ip[INET_ADDRSTRLEN] = "0.0.0.0", vps[256] = "", sps[256] = "", pps[256] = "";
+	char b64[256], *list;
+	const unsigned char *profile = NULL;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	int n, pos = 0, begin, len, type, pt = s->track[PLAYBACK_AUDIO].payload_type;
+
+	if (!getsockname(s->fd, (struct sockaddr *)&addr, &addr_len))
+		inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+	while ((begin = playback_annexb_next(s->info.param, s->info.param_size, &pos, &len)) >= 0) {
+		if (!len || playback_base64(s->info.param + begin, len, b64, sizeof(b64)) < 0)
+			continue;
+		if (s->info.h265) {
+			type = (s->info.param[begin] >> 1) & 0x3f;
+			list = type == 32 ? vps : type == 33 ? sps : type == 34 ? pps : NULL;
+		} else {
+			type = s->info.param[begin] & 0x1f;
+			list = type == 7 || type == 8 ? sps : NULL;
+			if (type == 7 && len >= 4 && !profile)
+				profile = s->info.param + begin + 1;
+		}
+		if (list && strlen(list) + strlen(b64) + 2 < sizeof(sps))
+			sprintf(list + strlen(list), "%s%s", list[0] ? "," : "", b64);
+	}
+
+	n = snprintf(sdp, size,
+	             "v=0\r\no=- %u 1 IN IP4 %s\r\ns=rkipc playback\r\nc=IN IP4 0.0.0.0\r\n"
+	             "t=0 0\r\na=control:*\r\n",
+	             s->id, ip);
+	if (s->end_ms)
+		n += snprintf(sdp + n, size - n, "a=range:npt=0-%.3f\r\n",
+		              (s->end_ms - s->start_ms) / 1000.0);
+	else
+		n += snprintf(sdp + n, size - n, "a=range:npt=0-\r\n");
+	if (s->info.h265)
+		n += snprintf(sdp + n, size - n,
+		              "m=video 0 RTP/AVP 96\r\na=rtpmap:96 H265/90000\r\n"
+		              "a=fmtp:96 sprop-vps=%s;sprop-sps=%s;sprop-pps=%s\r\n",
+		              vps, sps, pps);
+	else if (profile)
+		n += snprintf(sdp + n, size - n,
+		              "m=video 0 RTP/AVP 96\r\na=rtpmap:96 H264/90000\r\n"
+		              "a=fmtp:96 packetization-mode=1;profile-level-id=%02X%02X%02X;"
+		              "sprop-parameter-sets=%s\r\n",
+		              profile[0], profile[1], profile[2], sps);
+	else
+		n += snprintf(sdp + n, size - n,
+		              "m=video 0 RTP/AVP 96\r\na=rtpmap:96 H264/90000\r\n"
+		              "a=fmtp:96 packetization-mode=1\r\n");
+	n += snprintf(sdp + n, size - n, "a=control:track1\r\n");
+	if (n >= size)
+		return -1;
+
+	switch (s->info.audio) {
+	case RKIPC_MP4_AUDIO_G711A:
+	case RKIPC_MP4_AUDIO_G711U:
+		n += snprintf(sdp + n, size - n, "m=audio 0 RTP/AVP %d\r\na=rtpmap:%d %s/%d/%d\r\n", pt,
+		              pt, s->info.audio == RKIPC_MP4_AUDIO_G711A ? "PCMA" : "PCMU",
+		              s->info.sample_rate, s->info.channels);
+		break;
+	case RKIPC_MP4_AUDIO_AAC:
+		n += snprintf(sdp + n, size - n,
+		              "m=audio 0 RTP/AVP 97\r\na=rtpmap:97 MPEG4-GENERIC/%d/%d\r\n"
+		              "a=fmtp:97 streamtype=5;profile-level-id=15;mode=AAC-hbr;sizelength=13;"
+		              "indexlength=3;indexdeltalength=3;config=",
+		              s->info.sample_rate, s->info.channels);
+		for (int i = 0; i < s->info.audio_config_size && n < size; i++)
+			n += snprintf(sdp + n, size - n, "%02X", s->info.audio_config[i]);
+		if (n < size)
+			n += snprintf(sdp + n, size - n, "\r\n");
+		break;
+	case RKIPC_MP4_AUDIO_MP2:
+		n += snprintf(sdp + n, size - n, "m=audio 0 RTP/AVP 14\r\na=rtpmap:14 MPA/90000\r\n");
+		break;
+	default:
+		return n < size ? n : -1;
+	}
+	if (n < size)
+		n += snprintf(sdp + n, size - n, "a=control:track2\r\n");
+
+	return n < size ? n : -1;
+}
+
+// the value of header name, matched from the start of a line
+static int playback_header(const char *req, const char *name, char *value, int len) {
+	const char *p = strstr(req, "\r\n");
+	int n = strlen(name), i = 0;
+
+	while (p && p[2] != '\r') {
+		p += 2;
+		if (!strncasecmp(p, name, n) && p[n] == ':') {
+			p += n + 1;
+			while (*p == ' ' || *p == '\t')
+				p++;
+			while (p[i] && p[i] != '\r' && i < len - 1) {
+				value[i] = p[i];
+				i++;
+			}
+			value[i] = '\0';
+			return 0;
+		}
+		p = strstr(p, "\r\n");
+	}
+
+	return -1;
+}
+
+static int playback_reply(playback_session_s *s, int code, const char *reason, const char *cseq,
+                          const char *headers, const char *body) {
+	char reply[PLAYBACK_REPLY_MAX];
+	int n;
+
+	n = snprintf(reply, sizeof(reply), "RTSP/1.0 %d %s\r\nCSeq: %s\r\nServer: rkipc\r\n%s", code,
+	             reason, cseq, headers ? headers : "");
+	if (body && n < (int)sizeof(reply))
+		n += snprintf(reply + n, sizeof(reply) - n, "Content-Length: %d\r\n\r\n%s",
+		              (int)strlen(body), body);
+	else if (n < (int)sizeof(reply))
+		n += snprintf(reply + n, sizeof(reply) - n, "\r\n");
+	if (n >= (int)sizeof(reply))
+		return -1;
+
+	return playback_send_all(s->fd, reply, n);
+}
+
+static int playback_udp_bind(int port) {
+	struct sockaddr_in addr;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// an even port for RTP and the one after it for RTCP, as RFC 3550 asks
+static int playback_udp_pair(playback_track_s *t) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int port;
+
+	for (int i = 0; i < 16; i++) {
+		t->rtp_fd = playback_udp_bind(0);
+		if (t->rtp_fd < 0)
+			return -1;
+		getsockname(t->rtp_fd, (struct sockaddr *)&addr, &len);
+		port = ntohs(addr.sin_port);
+		if (!(port & 1)) {
+			t->rtcp_fd = playback_udp_bind(port + 1);
+			if (t->rtcp_fd >= 0)
+				return port;
+		}
+		close(t->rtp_fd);
+		t->rtp_fd = -1;
+	}
+
+	return -1;
+}
+
+static int playback_setup(playback_session_s *s, const char *url, const char *req,
+                          const char *cseq) {
+	char transport[256], headers[512];
+	struct sockaddr_in peer;
+	socklen_t peer_len = sizeof(peer);
+	playback_track_s *t;
+	const char *p;
+	int a, b, n, port;
+
+	if (!s->opened && playback_open(s, url))
+		return playback_reply(s, 404, "Not Found", cseq, NULL, NULL);
+	t = &s->track[strstr(url, "track2") ? PLAYBACK_AUDIO : PLAYBACK_VIDEO];
+	if (t == &s->track[PLAYBACK_AUDIO] && s->info.audio == RKIPC_MP4_AUDIO_NONE)
+		return playback_reply(s, 404, "Not Found", cseq, NULL, NULL);
+	if (t->setup)
+		return playback_reply(s, 459, "Aggregate Operation Not Allowed", cseq, NULL, NULL);
+	if (playback_header(req, "Transport", transport, sizeof(transport)) ||
+	    strstr(transport, "multicast"))
+		return playback_reply(s, 461, "Unsupported Transport", cseq, NULL, NULL);
+
+	if (strstr(transport, "RTP/AVP/TCP")) {
+		a = t == &s->track[PLAYBACK_AUDIO] ? 2 : 0;
+		p = strstr(transport, "interleaved=");
+		if (p)
+			sscanf(p, "interleaved=%d", &a);
+		t->tcp = 1;
+		t->channel = a;
+		snprintf(headers, sizeof(headers),
+		         "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d;ssrc=%08X\r\n"
+		         "Session: %08X;timeout=%d\r\n",
+		         a, a + 1, t->ssrc, s->id, g_playback_timeout_ms / 1000);
+	} else {
+		p = strstr(transport, "client_port=");
+		n = p ? sscanf(p, "client_port=%d-%d", &a, &b) : 0;
+		if (n < 1)
+			return playback_reply(s, 461, "Unsupported Transport", cseq, NULL, NULL);
+		if (n < 2)
+			b = a + 1;
+		port = playback_udp_pair(t);
+		if (port < 0 || getpeername(s->fd, (struct sockaddr *)&peer, &peer_len))
+			return playback_reply(s, 500, "Internal Server Error", cseq, NULL, NULL);
+		t->rtp_addr = peer;
+		t->rtp_addr.sin_port = htons(a);
+		t->rtcp_addr = peer;
+		t->rtcp_addr.sin_port = htons(b);
+		snprintf(headers, sizeof(headers),
+		         "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d;ssrc=%08X\r\n"
+		         "Session: %08X;timeout=%d\r\n",
+		         a, b, port, port + 1, t->ssrc, s->id, g_playback_timeout_ms / 1000);
+	}
+	t->setup = 1;
+
+	return playback_reply(s, 200, "OK", cseq, headers, NULL);
+}
+
+// npt from start, or clock in UTC; -1 for now or without a Range
+static int64_t playback_range(playback_session_s *s, const char *range, int64_t *end_ms) {
+	const char *p;
+	int64_t begin_ms = -1;
+
+	*end_ms = -1;
+	if (!strncmp(range, "npt=", 4)) {
+		if (strncmp(range + 4, "now", 3) && range[4] != '-')
+			begin_ms = s->start_ms + (int64_t)(atof(range + 4) * 1000);
+		p = strchr(range + 4, '-');
+		if (p && p[1] >= '0' && p[1] <= '9')
+			*end_ms = s->start_ms + (int64_t)(atof(p + 1) * 1000);
+	} else if (!strncmp(range, "clock=", 6)) {
+		if (range[6] != '-')
+			begin_ms = playback_utc_time(range + 6);
+		p = strchr(range + 6, '-');
+		if (p && p[1])
+			*end_ms = playback_utc_time(p + 1);
+	}
+
+	return begin_ms;
+}
+
+static int playback_play(playback_session_s *s, const char *url, const char *req,
+                         const char *cseq) {
+	char value[128], headers[1024], base[512];
+	playback_track_s *t;
+	double scale = 1.0;
+	int64_t begin_ms = -1, end_ms = -1, pos_ms;
+	int n, len;
+
+	if (!s->track[PLAYBACK_VIDEO].setup && !s->track[PLAYBACK_AUDIO].setup)
+		return playback_reply(s, 455, "Method Not Valid in This State", cseq, NULL, NULL);
+	if (!playback_header(req, "Scale", value, sizeof(value))) {
+		scale = atof(value);
+		// backwards would need the GOPs in reverse
+		if (scale <= 0)
+			return playback_reply(s, 456, "Header Field Not Valid for Resource", cseq, NULL,
+			                      NULL);
+		if (scale > 16)
+			scale = 16;
+	}
+	if (!playback_header(req, "Range", value, sizeof(value)))
+		begin_ms = playback_range(s, value, &end_ms);
+	if (!s->started && begin_ms < 0)
+		begin_ms = s->start_ms;
+	if (end_ms > 0)
+		s->end_ms = end_ms;
+	// the pending sample may be one the new scale does not send
+	if (begin_ms < 0 && scale != s->scale && s->pending)
+		begin_ms = s->sample_wall_us / 1000;
+	s->scale = scale;
+	if (begin_ms >= 0 && playback_seek(s, begin_ms))
+		return playback_reply(s, 457, "Invalid Range", cseq, NULL, NULL);
+	if (playback_fetch(s) < 0)
+		return playback_reply(s, 457, "Invalid Range", cseq, NULL, NULL);
+	if (begin_ms >= 0 || !s->started) {
+		s->ntp_wall_us = s->pending ? s->sample_wall_us : begin_ms * 1000;
+		s->ntp_stream_us = s->stream_us;
+	}
+	s->started = 1;
+	s->playing = 1;
+	s->cseq = atoi(cseq);
+	s->play_clock_us = rkipc_metrics_now_us();
+	s->play_stream_us = s->stream_us;
+	s->tail_us = 0;
+
+	pos_ms = s->pending ? s->sample_wall_us / 1000 : begin_ms;
+	if (pos_ms < s->start_ms)
+		pos_ms = s->start_ms;
+	snprintf(base, sizeof(base), "%s", url);
+	len = strlen(base);
+	if (len && base[len - 1] == '/')
+		base[len - 1] = '\0';
+	n = snprintf(headers, sizeof(headers), "Session: %08X\r\nRange: npt=%.3f-\r\nScale: %g\r\n",
+	             s->id, (pos_ms - s->start_ms) / 1000.0, scale);
+	n += snprintf(headers + n, sizeof(headers) - n, "RTP-Info: ");
+	for (int i = 0; i < PLAYBACK_TRACK_NUM; i++) {
+		t = &s->track[i];
+		if (!t->setup || n >= (int)sizeof(headers))
+			continue;
+		n += snprintf(headers + n, sizeof(headers) - n, "%surl=%s/track%d;seq=%u;rtptime=%u",
+		              i && s->track[0].setup ? "," : "", base, i + 1, t->seq,
+		              playback_rtp_time(t, s->stream_us));
+	}
+	if (n < (int)sizeof(headers))
+		snprintf(headers + n, sizeof(headers) - n, "\r\n");
+
+	return playback_reply(s, 200, "OK", cseq, headers, NULL);
+}
+
+// 1 ends the session
+static int playback_request(playback_session_s *s, const char *req) {
+	char method[32], url[512], cseq[16] = "0", headers[768], sdp[2048];
+	int ret;
+
+	if (sscanf(req, "%31s %511s", method, url) != 2)
+		return 1;
+	playback_header(req, "CSeq", cseq, sizeof(cseq));
+	LOG_DEBUG("%s %s\n", method, url);
+	snprintf(headers, sizeof(headers), "Session: %08X\r\n", s->id);
+	if (!strcmp(method, "OPTIONS")) {
+		ret = playback_reply(s, 200, "OK", cseq,
+		                     "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, GET_PARAMETER, "
+		                     "SET_PARAMETER, TEARDOWN\r\n",
+		                     NULL);
+	} else if (!strcmp(method, "DESCRIBE")) {
+		if ((!s->opened && playback_open(s, url)) || playback_sdp(s, sdp, sizeof(sdp)) < 0)
+			return playback_reply(s, 404, "Not Found", cseq, NULL, NULL);
+		snprintf(headers, sizeof(headers),
+		         "Content-Type: application/sdp\r\nContent-Base: %s/\r\n", url);
+		ret = playback_reply(s, 200, "OK", cseq, headers, sdp);
+	} else if (!strcmp(method, "SETUP")) {
+		ret = playback_setup(s, url, req, cseq);
+	} else if (!strcmp(method, "PLAY")) {
+		ret = playback_play(s, url, req, cseq);
+	} else if (!strcmp(method, "PAUSE")) {
+		s->playing = 0;
+		ret = playback_reply(s, 200, "OK", cseq, headers, NULL);
+	} else if (!strcmp(method, "GET_PARAMETER") || !strcmp(method, "SET_PARAMETER")) {
+		ret = playback_reply(s, 200, "OK", cseq, headers, NULL);
+	} else if (!strcmp(method, "TEARDOWN")) {
+		playback_reply(s, 200, "OK", cseq, headers, NULL);
+		return 1;
+	} else {
+		ret = playback_reply(s, 501, "Not Implemented", cseq, NULL, NULL);
+	}
+
+	return ret ? 1 : 0;
+}
+
+// the body that follows a request header, -1 for a Content-Length that is not a number
+// or more than the session can hold
+static int playback_content_length(const char *req) {
+	char value[16], *tail;
+	long length;
+
+	if (playback_header(req, "Content-Length", value, sizeof(value)))
+		return 0;
+	length = strtol(value, &tail, 10);
+	while (*tail == ' ' || *tail == '\t')
+		tail++;
+	if (tail == value || *tail || length < 0 || length > PLAYBACK_REQUEST_MAX)
+		return -1;
+
+	return length;
+}
+
+// requests and interleaved RTCP on the connection, 1 ends the session
+static int playback_input(playback_session_s *s) {
+	char *end;
+	int total, length;
+
+	while (s->req_len > 0) {
+		if (s->req[0] == '$') {
+			if (s->req_len < 4)
+				return 0;
+			total = 4 + ((unsigned char)s->req[2] << 8 | (unsigned char)s->req[3]);
+			if (total > PLAYBACK_REQUEST_MAX)
+				return 1;
+		} else {
+			end = strstr(s->req, "\r\n\r\n");
+			if (!end)
+				return s->req_len == PLAYBACK_REQUEST_MAX;
+			// the header is terminated in place, a body is skipped
+			*end = '\0';
+			total = end - s->req + 4;
+			length = playback_content_length(s->req);
+			if (length < 0 || total + length > PLAYBACK_REQUEST_MAX) {
+				LOG_WARN("session %08X: bad Content-Length\n", s->id);
+				return 1;
+			}
+			total += length;
+			if (total > s->req_len) {
+				*end = '\r';
+				return 0;
+			}
+			if (playback_request(s, s->req))
+				return 1;
+		}
+		if (total <= 0 || total > s->req_len)
+			return total <= 0;
+		memmove(s->req, s->req + total, s->req_len - total);
+		s->req_len -= total;
+		s->req[s->req_len] = '\0';
+	}
+
+	return 0;
+}
+
+static void playback_end(playback_session_s *s) {
+	for (int i = 0; i < PLAYBACK_TRACK_NUM; i++) {
+		if (s->track[i].setup)
+			playback_send_sr(s, &s->track[i], 1);
+	}
+	s->playing = 0;
+	LOG_INFO("session %08X reached the end\n", s->id);
+}
+
+// what is due now is sent, the return is how long to wait for more in ms
+static int playback_pace(playback_session_s *s, int *stop) {
+	long long now, due;
+	int ret;
+
+	while (s->playing) {
+		ret = playback_fetch(s);
+		now = rkipc_metrics_now_us();
+		if (ret > 0 && !s->tail_us)
+			s->tail_us = now;
+		if (ret < 0 || (ret > 0 && now - s->tail_us > PLAYBACK_TAIL_WAIT_MS * 1000LL)) {
+			playback_end(s);
+			break;
+		}
+		if (ret > 0)
+			return 200;
+		s->tail_us = 0;
+		due = s->play_clock_us + (long long)(s->stream_us - s->play_stream_us);
+		if (due < now - PLAYBACK_LATE_US) {
+			s->play_clock_us = now;
+			s->play_stream_us = s->stream_us;
+			due = now;
+		}
+		if (due > now)
+			return (due - now + 999) / 1000 > 200 ? 200 : (due - now + 999) / 1000;
+		if (playback_send_sample(s)) {
+			*stop = 1;
+			break;
+		}
+		s->pending = 0;
+	}
+
+	return 200;
+}
+
+static void *playback_session_thread(void *arg) {
+	playback_session_s *s = arg;
+	struct pollfd fds[1 + 2 * PLAYBACK_TRACK_NUM];
+	unsigned char buf[1500];
+	int num, timeout, len, stop = 0;
+	long long now;
+
+	prctl(PR_SET_NAME, "rkipc_playback", 0, 0, 0);
+	rkipc_metric_inc(g_playback_sessions_metric);
+	while (s->run && !stop) {
+		timeout = playback_pace(s, &stop);
+		if (stop)
+			break;
+		fds[0].fd = s->fd;
+		fds[0].events = POLLIN;
+		num = 1;
+		for (int i = 0; i < PLAYBACK_TRACK_NUM; i++) {
+			if (s->track[i].rtp_fd >= 0) {
+				fds[num].fd = s->track[i].rtp_fd;
+				fds[num++].events = POLLIN;
+			}
+			if (s->track[i].rtcp_fd >= 0) {
+				fds[num].fd = s->track[i].rtcp_fd;
+				fds[num++].events = POLLIN;
+			}
+		}
+		if (poll(fds, num, timeout) > 0) {
+			now = rkipc_metrics_now_us();
+			if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+				len = recv(s->fd, s->req + s->req_len, PLAYBACK_REQUEST_MAX - s->req_len,
+				           MSG_DONTWAIT);
+				if (len <= 0 && !(len < 0 && (errno == EAGAIN || errno == EINTR)))
+					break;
+				if (len > 0) {
+					s->req_len += len;
+					s->req[s->req_len] = '\0';
+					s->active_us = now;
+					if (playback_input(s))
+						break;
+				}
+			}
+			// receiver reports only keep the session alive
+			for (int i = 1; i < num; i++) {
+				if ((fds[i].revents & POLLIN) &&
+				    recv(fds[i].fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+					s->active_us = now;
+			}
+		}
+		if (rkipc_metrics_now_us() - s->active_us > g_playback_timeout_ms * 1000LL) {
+			LOG_INFO("session %08X timed out\n", s->id);
+			break;
+		}
+	}
+	rkipc_metric_dec(g_playback_sessions_metric);
+	close(s->fd);
+	for (int i = 0; i < PLAYBACK_TRACK_NUM; i++) {
+		if (s->track[i].rtp_fd >= 0)
+			close(s->track[i].rtp_fd);
+		if (s->track[i].rtcp_fd >= 0)
+			close(s->track[i].rtcp_fd);
+	}
+	if (s->reader)
+		rkipc_mp4_reader_close(s->reader);
+	free(s->buf);
+	s->done = 1;
+
+	return NULL;
+}
+
+static void playback_session_start(int fd) {
+	playback_session_s *s = NULL;
+	struct timeval tv = {3, 0};
+	int num = 0;
+
+	pthread_mutex_lock(&g_playback_mutex);
+	for (int i = 0; i < PLAYBACK_SESSION_MAX; i++) {
+		if (g_playback_session[i].used && g_playback_session[i].done) {
+			pthread_join(g_playback_session[i].thread, NULL);
+			g_playback_session[i].used = 0;
+		}
+		if (g_playback_session[i].used)
+			num++;
+		else if (!s)
+			s = &g_playback_session[i];
+	}
+	if (!s || num >= g_playback_sessions) {
+		pthread_mutex_unlock(&g_playback_mutex);
+		LOG_WARN("%d playback sessions already\n", num);
+		close(fd);
+		return;
+	}
+	memset(s, 0, sizeof(*s));
+	s->used = 1;
+	s->run = 1;
+	s->fd = fd;
+	s->id = (uint32_t)rand() ^ (uint32_t)rkipc_metrics_now_us();
+	s->active_us = rkipc_metrics_now_us();
+	s->scale = 1.0;
+	s->prev_wall_us = -1;
+	for (int i = 0; i < PLAYBACK_TRACK_NUM; i++) {
+		s->track[i].rtp_fd = -1;
+		s->track[i].rtcp_fd = -1;
+		s->track[i].ssrc = rand();
+		s->track[i].ts_base = rand();
+		s->track[i].seq = rand();
+	}
+	// a client that stops reading must not hold the session forever
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (pthread_create(&s->thread, NULL, playback_session_thread, s)) {
+		s->used = 0;
+		close(fd);
+	}
+	pthread_mutex_unlock(&g_playback_mutex);
+}
+
+static void *rkipc_rtsp_playback_server(void *arg) {
+	struct pollfd pfd;
+	int fd;
+
+	prctl(PR_SET_NAME, "rkipc_playback_srv", 0, 0, 0);
+	pfd.fd = g_playback_fd;
+	pfd.events = POLLIN;
+	while (g_playback_run) {
+		if (poll(&pfd, 1, 200) <= 0)
+			continue;
+		fd = accept(g_playback_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		playback_session_start(fd);
+	}
+
+	return NULL;
+}
+
+int rkipc_rtsp_playback_init(const char *bind_addr, int port) {
+	struct sockaddr_in addr;
+	int opt = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (!bind_addr)
+		bind_addr = "127.0.0.1";
+	if (inet_pton(AF_INET, bind_addr, &addr.sin_addr) != 1) {
+		LOG_ERROR("bad address %s\n", bind_addr);
+		return -1;
+	}
+
+	g_playback_sessions = rk_param_get_int("rtsp:playback_sessions", 2);
+	if (g_playback_sessions > PLAYBACK_SESSION_MAX)
+		g_playback_sessions = PLAYBACK_SESSION_MAX;
+	g_playback_timeout_ms = rk_param_get_int("rtsp:playback_timeout_ms", 60000);
+	g_playback_gap_us = rk_param_get_int("rtsp:playback_gap_ms", 5000) * 1000LL;
+	g_playback_sessions_metric = rkipc_metric_gauge("rkipc_rtsp_playback_sessions", NULL,
+	                                                "RTSP sessions playing back recordings");
+	g_playback_bytes = rkipc_metric_counter("rkipc_rtsp_playback_bytes_total", NULL,
+	                                        "RTP and RTCP bytes sent by RTSP playback");
+	srand(time(NULL) ^ getpid());
+
+	g_playback_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (g_playback_fd < 0)
+		return -1;
+	setsockopt(g_playback_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+	if (bind(g_playback_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(g_playback_fd, 4)) {
+		LOG_ERROR("%s:%d, %s\n", bind_addr, port, strerror(errno));
+		close(g_playback_fd);
+		g_playback_fd = -1;
+		return -1;
+	}
+	g_playback_run = 1;
+	if (pthread_create(&g_playback_thread, NULL, rkipc_rtsp_playback_server, NULL)) {
+		g_playback_run = 0;
+		close(g_playback_fd);
+		g_playback_fd = -1;
+		return -1;
+	}
+	LOG_INFO("rtsp://%s:%d/playback?start=YYYYmmddHHMMSS\n", bind_addr, port);
+
+	return 0;
+}
+
+int rkipc_rtsp_playback_deinit() {
+	if (g_playback_run) {
+		g_playback_run = 0;
+		pthread_join(g_playback_thread, NULL);
+	}
+	// no new sessions without the server thread, the mutex is left to the catalog lookups
+	for (int i = 0; i < PLAYBACK_SESSION_MAX; i++) {
+		if (!g_playback_session[i].used)
+			continue;
+		g_playback_session[i].run = 0;
+		pthread_join(g_playback_session[i].thread, NULL);
+		g_playback_session[i].used = 0;
+	}
+	if (g_playback_fd >= 0) {
+		close(g_playback_fd);
+		g_playback_fd = -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,20 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RTSP_PLAYBACK_H__
+#define __RTSP_PLAYBACK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// rtsp://<ip>:<port>/playback?start=20231019114600&end=20231019120000&id=0
+// There is no authentication, addr is the IPv4 address to listen on, NULL for loopback.
+int rkipc_rtsp_playback_init(const char *addr, int port);
+int rkipc_rtsp_playback_deinit();
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,572 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// The RTSP server in librtsp keeps its RTCP sockets to itself, so the feedback of
+// the clients is read next to it: a raw TCP socket sees the SETUP requests going
+// to port 554 and learns which client ports belong to which stream, a raw UDP
+// socket sees the RTCP those ports send. Both only get a copy, librtsp still
+// receives everything. Receiver reports give the loss fraction, jitter and round
+// trip time of every session, generic NACKs the packets the client missed.
+//
+// Once a second the controller takes the worst session of each stream: more than
+// rtsp:abr_loss_high lost cuts the bitrate by half the loss fraction, a round trip
+// above rtsp:abr_rtt_ms by 15%, and a clean report lets it grow by 8% again. Below
+// rtsp:abr_fps_percent of video.N:max_rate the frame rate goes down with it.
+//
+// Both are opt-in, rtsp:rtcp_monitor opens raw sockets and rtsp:abr changes the
+// encoder that recording and the other outputs share.
+#include "common.h"
+#include "rtcp.h"
+#include "rtsp.h"
+
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "rtcp.c"
+
+#define RTCP_STREAM_NUM 3
+#define RTCP_SESSION_MAX 16
+#define RTCP_RTSP_PORT 554
+#define RTCP_PACKET_MAX 2048
+#define RTCP_NTP_OFFSET 2208988800ULL
+
+enum { RTCP_PT_SR = 200, RTCP_PT_RR = 201, RTCP_PT_RTPFB = 205 };
+
+typedef struct {
+	int used;
+	int stream;
+	int audio;
+	struct in_addr addr;
+	int rtp_port;
+	int rtcp_port;
+	long long setup_ms;
+	long long report_ms;
+	int fresh; // a report came in since the controller last looked
+	int loss;
+	int lost;
+	int jitter_ms;
+	int rtt_ms;
+	int nack_packets;
+	int nack_fresh;
+	int reports;
+} rtcp_session_s;
+
+typedef struct {
+	int kbps;
+	int fps;
+	long long hold_ms; // no increase before this
+	rkipc_metric_t *sessions;
+	rkipc_metric_t *loss;
+	rkipc_metric_t *jitter_ms;
+	rkipc_metric_t *rtt_ms;
+	rkipc_metric_t *reports;
+	rkipc_metric_t *nack_packets;
+	rkipc_metric_t *target_kbps;
+	rkipc_metric_t *target_fps;
+} rtcp_stream_s;
+
+static char g_rtcp_path[RTCP_STREAM_NUM][64];
+static rtcp_session_s g_rtcp_session[RTCP_SESSION_MAX];
+static rtcp_stream_s g_rtcp_stream[RTCP_STREAM_NUM];
+static pthread_mutex_t g_rtcp_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rkipc_rtsp_rate_set_callback g_rtcp_rate_set_ = NULL;
+static pthread_t g_rtcp_thread;
+static int g_rtcp_run;
+static int g_rtcp_udp_fd = -1;
+static int g_rtcp_tcp_fd = -1;
+static int g_rtcp_timeout_ms;
+static int g_rtcp_audio_rate;
+
+static int g_abr;
+static int g_abr_interval_ms;
+static int g_abr_loss_high;
+static int g_abr_loss_low;
+static int g_abr_rtt_ms;
+static int g_abr_min_percent;
+static int g_abr_fps_percent;
+static int g_abr_min_fps;
+
+void rkipc_rtsp_rate_set_callback_register(rkipc_rtsp_rate_set_callback callback_ptr) {
+	pthread_mutex_lock(&g_rtcp_mutex);
+	g_rtcp_rate_set_ = callback_ptr;
+	pthread_mutex_unlock(&g_rtcp_mutex);
+}
+
+int rkipc_rtsp_get_session_stats(rkipc_rtsp_session_stats_s *stats, int max) {
+	long long now = rkipc_get_curren_time_ms();
+	rtcp_session_s *s;
+	int num = 0;
+
+	pthread_mutex_lock(&g_rtcp_mutex);
+	for (int i = 0; i < RTCP_SESSION_MAX && num < max; i++) {
+		s = &g_rtcp_session[i];
+		if (!s->used)
+			continue;
+		stats[num].stream = s->stream;
+		stats[num].audio = s->audio;
+		inet_ntop(AF_INET, &s->addr, stats[num].addr, sizeof(stats[num].addr));
+		stats[num].port = s->rtcp_port;
+		stats[num].loss = s->loss;
+		stats[num].lost = s->lost;
+		stats[num].jitter_ms = s->jitter_ms;
+		stats[num].rtt_ms = s->rtt_ms;
+		stats[num].nack_packets = s->nack_packets;
+		stats[num].reports = s->reports;
+		stats[num].age_ms = now - (s->reports ? s->report_ms : s->setup_ms);
+		num++;
+	}
+	pthread_mutex_unlock(&g_rtcp_mutex);
+
+	return num;
+}
+
+static unsigned int rtcp_be32(const unsigned char *p) {
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// the middle 32 bits of the NTP time, the unit of LSR and DLSR
+static unsigned int rtcp_ntp_mid32() {
+	struct timespec ts;
+	unsigned long long sec;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	sec = ts.tv_sec + RTCP_NTP_OFFSET;
+	return (unsigned int)((sec & 0xffff) << 16) |
+	       (unsigned int)(((unsigned long long)ts.tv_nsec << 16) / 1000000000);
+}
+
+static void rtcp_report_block(rtcp_session_s *s, const unsigned char *b, long long now) {
+	unsigned int jitter = rtcp_be32(b + 12);
+	unsigned int lsr = rtcp_be32(b + 16);
+	unsigned int dlsr = rtcp_be32(b + 20);
+	unsigned int rtt;
+	int clock = s->audio ? g_rtcp_audio_rate : 90000;
+
+	s->loss = b[4] * 1000 / 256;
+	s->lost = (int)(rtcp_be32(b + 4) << 8) >> 8;
+	s->jitter_ms = (long long)jitter * 1000 / clock;
+	// RFC 3550 6.4.1, only when the client saw a sender report
+	if (lsr) {
+		rtt = rtcp_ntp_mid32() - lsr - dlsr;
+		if (rtt < 60 << 16)
+			s->rtt_ms = ((unsigned long long)rtt * 1000) >> 16;
+	}
+	s->report_ms = now;
+	s->reports++;
+	s->fresh = 1;
+}
+
+static void rtcp_parse(rtcp_session_s *s, const unsigned char *p, int len, long long now) {
+	const unsigned char *block, *end;
+	int count, pt, size, lost;
+
+	while (len >= 8) {
+		if ((p[0] >> 6) != 2)
+			break;
+		count = p[0] & 0x1f;
+		pt = p[1];
+		size = ((p[2] << 8 | p[3]) + 1) * 4;
+		if (size > len)
+			break;
+		end = p + size;
+		if (pt == RTCP_PT_SR || pt == RTCP_PT_RR) {
+			block = p + (pt == RTCP_PT_SR ? 28 : 8);
+			// a client only receives from us, the first block is about our stream
+			if (count && block + 24 <= end)
+				rtcp_report_block(s, block, now);
+		} else if (pt == RTCP_PT_RTPFB && count == 1) {
+			// generic NACK, every FCI is one packet id and a bitmask of 16 more
+			for (block = p + 12; block + 4 <= end; block += 4) {
+				lost = 1 + __builtin_popcount(block[2] << 8 | block[3]);
+				s->nack_packets += lost;
+				s->nack_fresh += lost;
+			}
+		}
+		p += size;
+		len -= size;
+	}
+}
+
+static rtcp_session_s *rtcp_session_find(struct in_addr addr, int port) {
+	rtcp_session_s *s;
+
+	for (int i = 0; i < RTCP_SESSION_MAX; i++) {
+		s = &g_rtcp_session[i];
+		if (s->used && s->addr.s_addr == addr.s_addr &&
+		    (s->rtcp_port == port || s->rtp_port == port))
+			return s;
+	}
+
+	return NULL;
+}
+
+static void rtcp_udp_input(const unsigned char *ip, int len) {
+	int ihl = (ip[0] & 0xf) * 4;
+	struct in_addr addr;
+	rtcp_session_s *s;
+	int port, size;
+
+	if (len < ihl + 8 || (ip[6] & 0x3f) || ip[7]) // fragments are not reassembled
+		return;
+	memcpy(&addr, ip + 12, sizeof(addr));
+	port = ip[ihl] << 8 | ip[ihl + 1];
+	size = (ip[ihl + 4] << 8 | ip[ihl + 5]) - 8;
+	if (size > len - ihl - 8)
+		size = len - ihl - 8;
+	pthread_mutex_lock(&g_rtcp_mutex);
+	s = rtcp_session_find(addr, port);
+	if (s)
+		rtcp_parse(s, ip + ihl + 8, size, rkipc_get_curren_time_ms());
+	pthread_mutex_unlock(&g_rtcp_mutex);
+}
+
+// SETUP rtsp://192.168.1.10/live/0/track1 RTSP/1.0 ... Transport: RTP/AVP;client_port=a-b
+static int rtcp_setup_stream(const char *req, int *audio) {
+	const char *path = strstr(req, "://");
+	int len;
+
+	path = path ? strchr(path + 3, '/') : NULL;
+	if (!path)
+		return -1;
+	for (int i = 0; i < RTCP_STREAM_NUM; i++) {
+		len = strlen(g_rtcp_path[i]);
+		if (!len || strncmp(path, g_rtcp_path[i], len))
+			continue;
+		if (path[len] != '/' && path[len] != ' ')
+			continue;
+		// librtsp describes video as track1 and audio as track2
+		*audio = !strncmp(path + len, "/track2", 7);
+		return i;
+	}
+
+	return -1;
+}
+
+static void rtcp_tcp_input(const unsigned char *ip, int len) {
+	int ihl = (ip[0] & 0xf) * 4;
+	char req[RTCP_PACKET_MAX];
+	rtcp_session_s *s, *oldest = NULL;
+	struct in_addr addr;
+	int doff, stream, audio, rtp_port, rtcp_port;
+	const char *transport;
+	char *line_end;
+
+	if (len < ihl + 20)
+		return;
+	doff = (ip[ihl + 12] >> 4) * 4;
+	if (len - ihl - doff < 6 || memcmp(ip + ihl + doff, "SETUP ", 6))
+		return;
+	memcpy(req, ip + ihl + doff, len - ihl - doff);
+	req[len - ihl - doff] = '\0';
+	line_end = strchr(req, '\r');
+	transport = strstr(req, "client_port=");
+	if (!line_end || !transport)
+		return; // interleaved on the RTSP connection or split over segments
+	*line_end = '\0';
+	stream = rtcp_setup_stream(req, &audio);
+	if (stream < 0)
+		return;
+	rtcp_port = -1;
+	if (sscanf(transport, "client_port=%d-%d", &rtp_port, &rtcp_port) < 1)
+		return;
+	if (rtcp_port < 0)
+		rtcp_port = rtp_port + 1;
+	memcpy(&addr, ip + 12, sizeof(addr));
+
+	pthread_mutex_lock(&g_rtcp_mutex);
+	s = rtcp_session_find(addr, rtcp_port);
+	for (int i = 0; !s && i < RTCP_SESSION_MAX; i++) {
+		if (!g_rtcp_session[i].used)
+			s = &g_rtcp_session[i];
+		else if (!oldest || g_rtcp_session[i].setup_ms < oldest->setup_ms)
+			oldest = &g_rtcp_session[i];
+	}
+	if (!s)
+		s = oldest;
+	memset(s, 0, sizeof(*s));
+	s->used = 1;
+	s->stream = stream;
+	s->audio = audio;
+	s->addr = addr;
+	s->rtp_port = rtp_port;
+	s->rtcp_port = rtcp_port;
+	s->rtt_ms = -1;
+	s->setup_ms = rkipc_get_curren_time_ms();
+	pthread_mutex_unlock(&g_rtcp_mutex);
+	LOG_INFO("stream %d %s session from %s:%d\n", stream, audio ? "audio" : "video",
+	         inet_ntoa(addr), rtcp_port);
+}
+
+static int rtcp_stream_base_fps(int id) {
+	char entry[128] = {'\0'};
+	int num, den;
+
+	snprintf(entry, 127, "video.%d:dst_frame_rate_num", id);
+	num = rk_param_get_int(entry, 30);
+	snprintf(entry, 127, "video.%d:dst_frame_rate_den", id);
+	den = rk_param_get_int(entry, 1);
+
+	return den > 0 ? num / den : num;
+}
+
+static void rtcp_stream_apply(int id, int kbps, int fps) {
+	rtcp_stream_s *st = &g_rtcp_stream[id];
+	rkipc_rtsp_rate_set_callback callback;
+
+	if (kbps == st->kbps && fps == st->fps)
+		return;
+	pthread_mutex_lock(&g_rtcp_mutex);
+	callback = g_rtcp_rate_set_;
+	pthread_mutex_unlock(&g_rtcp_mutex);
+	if (!callback)
+		return;
+	LOG_INFO("stream %d: %d kbps %d fps -> %d kbps %d fps\n", id, st->kbps, st->fps, kbps, fps);
+	if (callback(id, kbps, fps))
+		return;
+	st->kbps = kbps;
+	st->fps = fps;
+	rkipc_metric_set(st->target_kbps, kbps);
+	rkipc_metric_set(st->target_fps, fps);
+}
+
+static void rtcp_stream_control(int id, long long now) {
+	rtcp_stream_s *st = &g_rtcp_stream[id];
+	char entry[128] = {'\0'};
+	int max_kbps, min_kbps, base_fps, fps_kbps, kbps, fps;
+	int sessions = 0, fresh = 0, nack = 0, loss = 0, jitter = 0, rtt = -1;
+	rtcp_session_s *s;
+
+	pthread_mutex_lock(&g_rtcp_mutex);
+	for (int i = 0; i < RTCP_SESSION_MAX; i++) {
+		s = &g_rtcp_session[i];
+		if (!s->used || s->stream != id)
+			continue;
+		if (now - (s->reports ? s->report_ms : s->setup_ms) > g_rtcp_timeout_ms) {
+			LOG_INFO("stream %d session from %s:%d gone\n", id, inet_ntoa(s->addr),
+			         s->rtcp_port);
+			s->used = 0;
+			continue;
+		}
+		sessions++;
+		if (!s->reports)
+			continue;
+		fresh |= s->fresh;
+		nack += s->nack_fresh;
+		loss = s->loss > loss ? s->loss : loss;
+		jitter = s->jitter_ms > jitter ? s->jitter_ms : jitter;
+		rtt = s->rtt_ms > rtt ? s->rtt_ms : rtt;
+		s->fresh = 0;
+		s->nack_fresh = 0;
+	}
+	pthread_mutex_unlock(&g_rtcp_mutex);
+	rkipc_metric_set(st->sessions, sessions);
+	rkipc_metric_set(st->loss, loss);
+	rkipc_metric_set(st->jitter_ms, jitter);
+	rkipc_metric_set(st->rtt_ms, rtt);
+	rkipc_metric_add(st->nack_packets, nack);
+
+	snprintf(entry, 127, "video.%d:max_rate", id);
+	max_kbps = rk_param_get_int(entry, 1024);
+	min_kbps = max_kbps * g_abr_min_percent / 100;
+	base_fps = rtcp_stream_base_fps(id);
+	if (!g_abr || !sessions) {
+		// nobody watching over UDP, recording and RTMP get the configured stream back
+		rtcp_stream_apply(id, 0, base_fps);
+		return;
+	}
+	if (!st->kbps) {
+		st->kbps = max_kbps;
+		st->fps = base_fps;
+	}
+	kbps = st->kbps > max_kbps ? max_kbps : st->kbps;
+	if (!fresh)
+		return;
+	if (loss > g_abr_loss_high) {
+		kbps = (long long)kbps * (2000 - loss) / 2000;
+		st->hold_ms = now + g_abr_interval_ms * 2;
+	} else if (g_abr_rtt_ms > 0 && rtt > g_abr_rtt_ms) {
+		kbps = kbps * 85 / 100;
+		st->hold_ms = now + g_abr_interval_ms * 2;
+	} else if (loss < g_abr_loss_low && !nack && now >= st->hold_ms) {
+		kbps += kbps * 8 / 100 + 1;
+	}
+	if (kbps < min_kbps)
+		kbps = min_kbps;
+	if (kbps > max_kbps)
+		kbps = max_kbps;
+	// below fps_kbps fewer frames keep each one watchable
+	fps = base_fps;
+	fps_kbps = max_kbps * g_abr_fps_percent / 100;
+	if (fps_kbps > 0 && kbps < fps_kbps) {
+		fps = (long long)base_fps * kbps / fps_kbps;
+		if (fps < g_abr_min_fps)
+			fps = g_abr_min_fps;
+		if (fps > base_fps)
+			fps = base_fps;
+	}
+	rtcp_stream_apply(id, kbps, fps);
+}
+
+static void *rkipc_rtcp_monitor(void *arg) {
+	unsigned char buf[RTCP_PACKET_MAX];
+	struct pollfd fds[2];
+	long long now, next_ms = 0;
+	int len;
+
+	prctl(PR_SET_NAME, "rkipc_rtcp", 0, 0, 0);
+	fds[0].fd = g_rtcp_udp_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = g_rtcp_tcp_fd;
+	fds[1].events = POLLIN;
+	while (g_rtcp_run) {
+		if (poll(fds, 2, 200) > 0) {
+			if (fds[0].revents & POLLIN) {
+				len = recv(g_rtcp_udp_fd, buf, sizeof(buf), MSG_DONTWAIT);
+				if (len > 20)
+					rtcp_udp_input(buf, len);
+			}
+			if (fds[1].revents & POLLIN) {
+				len = recv(g_rtcp_tcp_fd, buf, sizeof(buf) - 1, MSG_DONTWAIT);
+				if (len > 20)
+					rtcp_tcp_input(buf, len);
+			}
+		}
+		now = rkipc_get_curren_time_ms();
+		if (now < next_ms)
+			continue;
+		next_ms = now + g_abr_interval_ms;
+		for (int i = 0; i < RTCP_STREAM_NUM; i++) {
+			if (g_rtcp_path[i][0])
+				rtcp_stream_control(i, now);
+		}
+	}
+
+	return NULL;
+}
+
+// the kernel only queues what the filter accepts, everything else costs no copy
+static int rtcp_raw_socket(int protocol) {
+	// TCP to the RTSP port
+	struct sock_filter tcp_code[] = {
+	    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+	    BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),
+	    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, RTCP_RTSP_PORT, 0, 1),
+	    BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	    BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	// UDP with an RTP version 2 payload of type SR to APP, RR and RTPFB included
+	struct sock_filter udp_code[] = {
+	    BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+	    BPF_STMT(BPF_LD | BPF_B | BPF_IND, 8),
+	    BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xc0),
+	    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x80, 0, 4),
+	    BPF_STMT(BPF_LD | BPF_B | BPF_IND, 9),
+	    BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, RTCP_PT_SR, 0, 2),
+	    BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 206, 1, 0),
+	    BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	    BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+	struct sock_fprog prog;
+	int fd;
+
+	if (protocol == IPPROTO_TCP) {
+		prog.len = sizeof(tcp_code) / sizeof(tcp_code[0]);
+		prog.filter = tcp_code;
+	} else {
+		prog.len = sizeof(udp_code) / sizeof(udp_code[0]);
+		prog.filter = udp_code;
+	}
+	fd = socket(AF_INET, SOCK_RAW | SOCK_CLOEXEC, protocol);
+	if (fd < 0)
+		return -1;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int rkipc_rtcp_monitor_init(const char *path[], int num) {
+	char labels[32];
+	rtcp_stream_s *st;
+
+	if (!rk_param_get_int("rtsp:rtcp_monitor", 0))
+		return 0;
+	g_rtcp_timeout_ms = rk_param_get_int("rtsp:rtcp_timeout_ms", 20000);
+	g_rtcp_audio_rate = rk_param_get_int("audio.0:sample_rate", 16000);
+	if (g_rtcp_audio_rate <= 0)
+		g_rtcp_audio_rate = 8000;
+	g_abr = rk_param_get_int("rtsp:abr", 0);
+	g_abr_interval_ms = rk_param_get_int("rtsp:abr_interval_ms", 1000);
+	g_abr_loss_high = rk_param_get_int("rtsp:abr_loss_high", 100);
+	g_abr_loss_low = rk_param_get_int("rtsp:abr_loss_low", 20);
+	g_abr_rtt_ms = rk_param_get_int("rtsp:abr_rtt_ms", 800);
+	g_abr_min_percent = rk_param_get_int("rtsp:abr_min_percent", 25);
+	g_abr_fps_percent = rk_param_get_int("rtsp:abr_fps_percent", 50);
+	g_abr_min_fps = rk_param_get_int("rtsp:abr_min_fps", 10);
+
+	memset(g_rtcp_path, 0, sizeof(g_rtcp_path));
+	memset(g_rtcp_session, 0, sizeof(g_rtcp_session));
+	for (int i = 0; i < num && i < RTCP_STREAM_NUM; i++) {
+		if (!path[i])
+			continue;
+		snprintf(g_rtcp_path[i], sizeof(g_rtcp_path[i]), "%s", path[i]);
+		st = &g_rtcp_stream[i];
+		memset(st, 0, sizeof(*st));
+		snprintf(labels, sizeof(labels), "stream=\"%d\"", i);
+		st->sessions = rkipc_metric_gauge("rkipc_rtsp_udp_sessions", labels,
+		                                  "RTSP tracks over UDP with a live RTCP peer");
+		st->loss = rkipc_metric_gauge("rkipc_rtsp_loss_permille", labels,
+		                              "Worst fraction lost of the last receiver reports");
+		st->jitter_ms = rkipc_metric_gauge("rkipc_rtsp_jitter_ms", labels,
+		                                   "Worst interarrival jitter of the receiver reports");
+		st->rtt_ms = rkipc_metric_gauge("rkipc_rtsp_rtt_ms", labels,
+		                                "Worst round trip time of the receiver reports");
+		st->nack_packets = rkipc_metric_counter("rkipc_rtsp_nack_packets_total", labels,
+		                                        "Packets RTSP clients asked for with NACK");
+		st->target_kbps =
+		    rkipc_metric_gauge("rkipc_rtsp_target_kbps", labels,
+		                       "VENC bitrate asked for by the RTCP rate control, 0 for none");
+		st->target_fps = rkipc_metric_gauge("rkipc_rtsp_target_fps", labels,
+		                                    "VENC frame rate asked for by the RTCP rate control");
+	}
+
+	g_rtcp_udp_fd = rtcp_raw_socket(IPPROTO_UDP);
+	g_rtcp_tcp_fd = rtcp_raw_socket(IPPROTO_TCP);
+	if (g_rtcp_udp_fd < 0 || g_rtcp_tcp_fd < 0) {
+		LOG_WARN("raw socket fail, %s, RTCP is not monitored\n", strerror(errno));
+		rkipc_rtcp_monitor_deinit();
+		return -1;
+	}
+	g_rtcp_run = 1;
+	if (pthread_create(&g_rtcp_thread, NULL, rkipc_rtcp_monitor, NULL)) {
+		g_rtcp_run = 0;
+		rkipc_rtcp_monitor_deinit();
+		return -1;
+	}
+
+	return 0;
+}
+
+int rkipc_rtcp_monitor_deinit() {
+	if (g_rtcp_run) {
+		g_rtcp_run = 0;
+		pthread_join(g_rtcp_thread, NULL);
+	}
+	if (g_rtcp_udp_fd >= 0)
+		close(g_rtcp_udp_fd);
+	if (g_rtcp_tcp_fd >= 0)
+		close(g_rtcp_tcp_fd);
+	g_rtcp_udp_fd = -1;
+	g_rtcp_tcp_fd = -1;
+
+	return 0;
+}
@@ -0,0 +1,19 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RTCP_H__
+#define __RTCP_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// paths are the RTSP session urls, "/live/0", NULL for a stream that is not served
+int rkipc_rtcp_monitor_init(const char *path[], int num);
+int rkipc_rtcp_monitor_deinit();
+
+#ifdef __cplusplus
+}
+#endif
+#endif
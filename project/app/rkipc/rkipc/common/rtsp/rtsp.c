@@ -2,6 +2,8 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 #include "common.h"
+#include "playback.h"
+#include "rtcp.h"
 #include "rtsp_demo.h"
 
 #ifdef LOG_TAG
@@ -15,11 +17,51 @@ rtsp_session_handle g_rtsp_session_0 = NULL;
 rtsp_session_handle g_rtsp_session_1 = NULL;
 rtsp_session_handle g_rtsp_session_2 = NULL;
 
+#define RTSP_STREAM_NUM 3
+
+typedef struct {
+	rkipc_metric_t *frames;
+	rkipc_metric_t *bytes;
+	rkipc_metric_t *send_us;
+} rtsp_metrics_s;
+
+static rtsp_metrics_s g_rtsp_video_metrics[RTSP_STREAM_NUM];
+static rtsp_metrics_s g_rtsp_audio_metrics;
+
+static void rtsp_metrics_register(rtsp_metrics_s *metrics, const char *labels) {
+	metrics->frames = rkipc_metric_counter("rkipc_rtsp_frames_total", labels,
+	                                       "Frames handed to the RTSP server");
+	metrics->bytes = rkipc_metric_counter("rkipc_rtsp_bytes_total", labels,
+	                                      "Bytes handed to the RTSP server");
+	// includes waiting for g_rtsp_mutex, audio and all streams share it
+	metrics->send_us =
+	    rkipc_metric_histogram("rkipc_rtsp_send_us", labels, "Time a writer spends sending",
+	                           rkipc_metric_us_bounds, RKIPC_METRIC_US_BOUNDS);
+}
+
+static void rtsp_metrics_account(rtsp_metrics_s *metrics, unsigned int buffer_size,
+                                 long long begin_us) {
+	if (!metrics->frames)
+		return;
+	rkipc_metric_inc(metrics->frames);
+	rkipc_metric_add(metrics->bytes, buffer_size);
+	rkipc_metric_observe(metrics->send_us, rkipc_metrics_now_us() - begin_us);
+}
+
 int rkipc_rtsp_init(const char *rtsp_url_0, const char *rtsp_url_1, const char *rtsp_url_2) {
 	const char *tmp_output_data_type = "H.264";
+	const char *url[RTSP_STREAM_NUM] = {rtsp_url_0, rtsp_url_1, rtsp_url_2};
+	char labels[32];
 
 	LOG_DEBUG("start\n");
 	pthread_mutex_lock(&g_rtsp_mutex);
+	for (int i = 0; i < RTSP_STREAM_NUM; i++) {
+		if (!url[i])
+			continue;
+		snprintf(labels, sizeof(labels), "stream=\"%d\",type=\"video\"", i);
+		rtsp_metrics_register(&g_rtsp_video_metrics[i], labels);
+	}
+	rtsp_metrics_register(&g_rtsp_audio_metrics, "type=\"audio\"");
 	g_rtsplive = create_rtsp_demo(554);
 	if (rtsp_url_0) {
 		g_rtsp_session_0 = rtsp_new_session(g_rtsplive, rtsp_url_0);
@@ -71,6 +113,12 @@ int rkipc_rtsp_init(const char *rtsp_url_0, const char *rtsp_url_1, const char *
 	}
 
 	pthread_mutex_unlock(&g_rtsp_mutex);
+	// not being able to see RTCP only costs the rate control
+	rkipc_rtcp_monitor_init(url, RTSP_STREAM_NUM);
+	// no authentication, off by default and only on loopback unless configured
+	if (rk_param_get_int("rtsp:playback", 0))
+		rkipc_rtsp_playback_init(rk_param_get_string("rtsp:playback_addr", "127.0.0.1"),
+		                         rk_param_get_int("rtsp:playback_port", 8554));
 	LOG_DEBUG("end\n");
 
 	return 0;
@@ -78,6 +126,8 @@ int rkipc_rtsp_init(const char *rtsp_url_0, const char *rtsp_url_1, const char *
 
 int rkipc_rtsp_deinit() {
 	LOG_DEBUG("%s\n", __func__);
+	rkipc_rtsp_playback_deinit();
+	rkipc_rtcp_monitor_deinit();
 	pthread_mutex_lock(&g_rtsp_mutex);
 	if (g_rtsp_session_0) {
 		rtsp_del_session(g_rtsp_session_0);
@@ -102,6 +152,8 @@ int rkipc_rtsp_deinit() {
 
 int rkipc_rtsp_write_video_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                                  int64_t present_time) {
+	long long begin_us = rkipc_metrics_now_us();
+
 	pthread_mutex_lock(&g_rtsp_mutex);
 	if (g_rtsplive == NULL) {
 		pthread_mutex_unlock(&g_rtsp_mutex);
@@ -114,6 +166,8 @@ int rkipc_rtsp_write_video_frame(int id, unsigned char *buffer, unsigned int buf
 	if ((id == 2) && g_rtsp_session_2)
 		rtsp_tx_video(g_rtsp_session_2, buffer, buffer_size, present_time);
 	rtsp_do_event(g_rtsplive);
+	if (id >= 0 && id < RTSP_STREAM_NUM)
+		rtsp_metrics_account(&g_rtsp_video_metrics[id], buffer_size, begin_us);
 	pthread_mutex_unlock(&g_rtsp_mutex);
 
 	return 0;
@@ -121,6 +175,8 @@ int rkipc_rtsp_write_video_frame(int id, unsigned char *buffer, unsigned int buf
 
 int rkipc_rtsp_write_audio_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                                  int64_t present_time) {
+	long long begin_us = rkipc_metrics_now_us();
+
 	pthread_mutex_lock(&g_rtsp_mutex);
 	if (g_rtsplive == NULL) {
 		pthread_mutex_unlock(&g_rtsp_mutex);
@@ -133,6 +189,7 @@ int rkipc_rtsp_write_audio_frame(int id, unsigned char *buffer, unsigned int buf
 	if (g_rtsp_session_2)
 		rtsp_tx_audio(g_rtsp_session_2, buffer, buffer_size, present_time);
 	rtsp_do_event(g_rtsplive);
+	rtsp_metrics_account(&g_rtsp_audio_metrics, buffer_size, begin_us);
 	pthread_mutex_unlock(&g_rtsp_mutex);
 
 	return 0;
@@ -9,12 +9,42 @@
 extern "C" {
 #endif
 
+typedef struct {
+	int stream;       // RTSP stream id, which is also the VENC channel feeding it
+	int audio;        // 1 for the audio track of the stream
+	char addr[16];    // client address
+	int port;         // client RTCP port
+	int loss;         // fraction lost in the last receiver report, per mille
+	int lost;         // cumulative packets lost
+	int jitter_ms;    // interarrival jitter
+	int rtt_ms;       // -1 until the client echoes a sender report
+	int nack_packets; // packets asked for again with generic NACK
+	int reports;      // receiver reports seen
+	int age_ms;       // since the last report, or since SETUP without one
+} rkipc_rtsp_session_stats_s;
+
+// called from the RTCP monitor thread with the bitrate and frame rate a VENC channel
+// should run at, kbps 0 for no limit under video.N:max_rate, returns 0 once applied
+typedef int (*rkipc_rtsp_rate_set_callback)(int id, int kbps, int fps);
+
+// the recorded segment of recording id starting last at or before wall_time_ms, with next
+// set the first one starting after it, 0 when there is one
+typedef int (*rkipc_rtsp_playback_catalog_callback)(int id, int64_t wall_time_ms, int next,
+                                                    char *path, int len,
+                                                    int64_t *start_time_ms);
+
 int rkipc_rtsp_init(const char *rtsp_url_0, const char *rtsp_url_1, const char *rtsp_url_2);
 int rkipc_rtsp_deinit();
 int rkipc_rtsp_write_video_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                                  int64_t present_time);
 int rkipc_rtsp_write_audio_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                                  int64_t present_time);
+// UDP sessions only, RTCP interleaved on the RTSP connection is not seen
+int rkipc_rtsp_get_session_stats(rkipc_rtsp_session_stats_s *stats, int max);
+void rkipc_rtsp_rate_set_callback_register(rkipc_rtsp_rate_set_callback callback_ptr);
+// recordings are played back on rtsp:playback_port once there is a catalog
+void rkipc_rtsp_playback_catalog_callback_register(
+    rkipc_rtsp_playback_catalog_callback callback_ptr);
 
 #ifdef __cplusplus
 }
@@ -154,6 +154,52 @@ int ser_rk_isp_set_scenario(int fd) {
 	return 0;
 }
 
+int ser_rk_isp_get_scene_stats(int fd) {
+	int err = 0;
+	int id, len;
+	char value[1024];
+
+	if (sock_read(fd, &id, sizeof(id)) == SOCKERR_CLOSED)
+		return -1;
+	err = rk_isp_get_scene_stats(id, value, sizeof(value));
+	len = strlen(value);
+	if (sock_write(fd, &len, sizeof(len)) == SOCKERR_CLOSED)
+		return -1;
+	if (sock_write(fd, value, len) == SOCKERR_CLOSED)
+		return -1;
+	if (sock_write(fd, &err, sizeof(int)) == SOCKERR_CLOSED)
+		return -1;
+
+	return 0;
+}
+
+// isp batch, a page apply sends its settings between begin and commit
+int ser_rk_isp_batch_begin(int fd) {
+	int err = 0;
+	int id;
+
+	if (sock_read(fd, &id, sizeof(id)) == SOCKERR_CLOSED)
+		return -1;
+	err = rk_isp_batch_begin(id);
+	if (sock_write(fd, &err, sizeof(int)) == SOCKERR_CLOSED)
+		return -1;
+
+	return 0;
+}
+
+int ser_rk_isp_batch_commit(int fd) {
+	int err = 0;
+	int id;
+
+	if (sock_read(fd, &id, sizeof(id)) == SOCKERR_CLOSED)
+		return -1;
+	err = rk_isp_batch_commit(id);
+	if (sock_write(fd, &err, sizeof(int)) == SOCKERR_CLOSED)
+		return -1;
+
+	return 0;
+}
+
 // isp adjustment
 
 int ser_rk_isp_get_contrast(int fd) {
@@ -4429,6 +4475,38 @@ int ser_rk_storage_record_statue_get(int fd) {
 	return 0;
 }
 
+int ser_rk_storage_card_status_get(int fd) {
+	int err = 0;
+	int value;
+
+	err = rk_storage_card_status_get(&value);
+	LOG_DEBUG("value is %d\n", value);
+	if (sock_write(fd, &value, sizeof(value)) == SOCKERR_CLOSED)
+		return -1;
+	if (sock_write(fd, &err, sizeof(int)) == SOCKERR_CLOSED)
+		return -1;
+
+	return 0;
+}
+
+int ser_rk_storage_card_info_get(int fd) {
+	int err = 0;
+	int len;
+	char value[512];
+
+	err = rk_storage_card_info_get(value, sizeof(value));
+	len = strlen(value);
+	LOG_DEBUG("len is %d, value is %s\n", len, value);
+	if (sock_write(fd, &len, sizeof(len)) == SOCKERR_CLOSED)
+		return -1;
+	if (sock_write(fd, value, len) == SOCKERR_CLOSED)
+		return -1;
+	if (sock_write(fd, &err, sizeof(int)) == SOCKERR_CLOSED)
+		return -1;
+
+	return 0;
+}
+
 int ser_rk_take_photo(int fd) {
 	int err = 0;
 
@@ -5457,6 +5535,10 @@ static const struct FunMap map[] = {
     // isp scenario
     {(char *)"rk_isp_get_scenario", &ser_rk_isp_get_scenario},
     {(char *)"rk_isp_set_scenario", &ser_rk_isp_set_scenario},
+    {(char *)"rk_isp_get_scene_stats", &ser_rk_isp_get_scene_stats},
+    // isp batch
+    {(char *)"rk_isp_batch_begin", &ser_rk_isp_batch_begin},
+    {(char *)"rk_isp_batch_commit", &ser_rk_isp_batch_commit},
     // isp adjustment
     {(char *)"rk_isp_get_contrast", &ser_rk_isp_get_contrast},
     {(char *)"rk_isp_set_contrast", &ser_rk_isp_set_contrast},
@@ -5693,6 +5775,8 @@ static const struct FunMap map[] = {
     {(char *)"rk_storage_record_start", &ser_rk_storage_record_start},
     {(char *)"rk_storage_record_stop", &ser_rk_storage_record_stop},
     {(char *)"rk_storage_record_statue_get", &ser_rk_storage_record_statue_get},
+    {(char *)"rk_storage_card_status_get", &ser_rk_storage_card_status_get},
+    {(char *)"rk_storage_card_info_get", &ser_rk_storage_card_info_get},
     {(char *)"rk_take_photo", &ser_rk_take_photo},
     // event
     {(char *)"rk_event_ri_get_enabled", &ser_rk_event_ri_get_enabled},
@@ -5760,6 +5844,30 @@ static const struct FunMap map[] = {
     {(char *)"rk_system_add_user", &ser_rk_system_add_user},
     {(char *)"rk_system_del_user", &ser_rk_system_del_user}};
 
+typedef struct {
+	rkipc_metric_t *connections;
+	rkipc_metric_t *clients;
+	rkipc_metric_t *requests;
+	rkipc_metric_t *unknown;
+	rkipc_metric_t *request_us;
+} server_metrics_s;
+
+static server_metrics_s g_server_metrics;
+
+static void rkipc_server_metrics_register(void) {
+	server_metrics_s *m = &g_server_metrics;
+
+	m->connections = rkipc_metric_counter("rkipc_server_connections_total", NULL,
+	                                      "Clients accepted on " CS_PATH);
+	m->clients = rkipc_metric_gauge("rkipc_server_clients", NULL, "Clients connected now");
+	m->requests = rkipc_metric_counter("rkipc_server_requests_total", NULL, "Requests handled");
+	m->unknown = rkipc_metric_counter("rkipc_server_unknown_requests_total", NULL,
+	                                  "Requests naming a function the server does not have");
+	m->request_us =
+	    rkipc_metric_histogram("rkipc_server_request_us", NULL, "Time spent handling a request",
+	                           rkipc_metric_us_bounds, RKIPC_METRIC_US_BOUNDS);
+}
+
 static void *rec_thread(void *arg) {
 	int fd = (int)(intptr_t)arg;
 	char *name = NULL;
@@ -5767,7 +5875,9 @@ static void *rec_thread(void *arg) {
 	int ret = 0;
 	int i;
 	int maplen = sizeof(map) / sizeof(struct FunMap);
+	long long begin_us;
 	pthread_detach(pthread_self());
+	rkipc_metric_inc(g_server_metrics.clients);
 
 	if (sock_write(fd, &ret, sizeof(int)) == SOCKERR_CLOSED) {
 		ret = -1;
@@ -5788,12 +5898,18 @@ again:
 		goto out;
 	}
 
+	begin_us = rkipc_metrics_now_us();
 	for (i = 0; i < maplen; i++) {
 		// printf("%s, %s\n", map[i].fun_name, name);
 		if (!strcmp(map[i].fun_name, name)) {
 			ret = map[i].fun(fd);
+			break;
 		}
 	}
+	if (i == maplen)
+		rkipc_metric_inc(g_server_metrics.unknown);
+	rkipc_metric_inc(g_server_metrics.requests);
+	rkipc_metric_observe(g_server_metrics.request_us, rkipc_metrics_now_us() - begin_us);
 out:
 	if (name)
 		free(name);
@@ -5804,6 +5920,7 @@ out:
 	}
 
 	close(fd);
+	rkipc_metric_dec(g_server_metrics.clients);
 	pthread_exit(NULL);
 
 	return 0;
@@ -5825,8 +5942,10 @@ static void *rkipc_server_thread(void *arg) {
 			LOG_ERROR("accept fail\n");
 		}
 
-		if (clifd >= 0)
+		if (clifd >= 0) {
+			rkipc_metric_inc(g_server_metrics.connections);
 			pthread_create(&thread_id, NULL, rec_thread, (void *)(intptr_t)clifd);
+		}
 	}
 	RkIpcServerTid = 0;
 	pthread_exit(NULL);
@@ -5842,6 +5961,7 @@ int rkipc_server_init(void) {
 	action.sa_flags = 0;
 	sigaction(SIGPIPE, &action, NULL);
 
+	rkipc_server_metrics_register();
 	RkIpcServerRun = 1;
 	if (RkIpcServerTid == 0)
 		pthread_create(&RkIpcServerTid, NULL, rkipc_server_thread, NULL);
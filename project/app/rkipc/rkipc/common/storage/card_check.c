@@ -0,0 +1,317 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Qualification of a card when it is inserted. Slow and counterfeit cards mount like any
+// other and only show up weeks later as broken recordings, so the card is measured first:
+// synced writes into a file of its own, what the card says about itself in its CID and CSD
+// registers and, on request and only while nothing has it mounted, writes at scattered
+// offsets of the partition that have to read back.
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // O_DIRECT
+#endif
+#include "card_check.h"
+#include "common.h"
+
+#include <libgen.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "card_check.c"
+
+#define CARD_BLOCK 4096
+#define CARD_SEQ_BLOCK (1024 * 1024)
+#define CARD_CAPACITY_SKIP (4 * 1024 * 1024) // partition start, boot sector and FAT
+
+static long long card_now_us(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint64_t card_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int card_sysfs_read(const char *dir, const char *attr, char *buf, int len) {
+	char path[320];
+	FILE *fp;
+	int n;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	n = fgets(buf, len, fp) ? strlen(buf) : 0;
+	fclose(fp);
+	while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' '))
+		buf[--n] = '\0';
+
+	return n ? 0 : -1;
+}
+
+static unsigned int card_csd_bits(const uint8_t *csd, int start, int len) {
+	unsigned int value = 0;
+
+	for (int i = start + len - 1; i >= start; i--)
+		value = value << 1 | ((csd[15 - i / 8] >> (i % 8)) & 1);
+
+	return value;
+}
+
+int64_t rk_card_check_csd_bytes(const char *csd) {
+	uint8_t reg[16];
+	unsigned int c_size;
+
+	if (!csd || strlen(csd) != 32)
+		return 0;
+	for (int i = 0; i < 16; i++) {
+		if (sscanf(csd + i * 2, "%2hhx", &reg[i]) != 1)
+			return 0;
+	}
+	switch (card_csd_bits(reg, 126, 2)) {
+	case 0:
+		c_size = card_csd_bits(reg, 62, 12);
+		return (int64_t)(c_size + 1)
+		       << (card_csd_bits(reg, 47, 3) + 2 + card_csd_bits(reg, 80, 4));
+	case 1:
+		return (int64_t)(card_csd_bits(reg, 48, 22) + 1) * 512 * 1024;
+	case 2:
+		return (int64_t)(card_csd_bits(reg, 48, 28) + 1) * 512 * 1024;
+	default:
+		return 0;
+	}
+}
+
+// /sys/class/block/mmcblk1p1 is a partition of /sys/class/block/mmcblk1, the registers
+// are attributes of the card below the disk
+static void card_check_sysfs(const char *dev, rk_card_check_result_s *result) {
+	char dir[96], disk[112], device[128], buf[64], name[64];
+	struct stat st;
+
+	snprintf(name, sizeof(name), "%s", dev);
+	snprintf(dir, sizeof(dir), "/sys/class/block/%s", basename(name));
+	snprintf(disk, sizeof(disk), "%s/partition", dir);
+	if (!stat(disk, &st))
+		snprintf(disk, sizeof(disk), "%s/..", dir);
+	else
+		snprintf(disk, sizeof(disk), "%s", dir);
+	if (!card_sysfs_read(disk, "size", buf, sizeof(buf)))
+		result->device_bytes = strtoll(buf, NULL, 10) * 512;
+
+	snprintf(device, sizeof(device), "%s/device", disk);
+	if (card_sysfs_read(device, "type", result->type, sizeof(result->type)))
+		return;
+	card_sysfs_read(device, "name", result->name, sizeof(result->name));
+	card_sysfs_read(device, "date", result->date, sizeof(result->date));
+	if (!card_sysfs_read(device, "manfid", buf, sizeof(buf)))
+		result->manfid = strtoul(buf, NULL, 16);
+	if (!card_sysfs_read(device, "oemid", buf, sizeof(buf)))
+		result->oemid = strtoul(buf, NULL, 16);
+	if (!card_sysfs_read(device, "serial", buf, sizeof(buf)))
+		result->serial = strtoul(buf, NULL, 16);
+	// eMMC keep the size of anything above 2 GiB in the EXT_CSD
+	if (!strcmp(result->type, "SD") && !card_sysfs_read(device, "csd", buf, sizeof(buf)))
+		result->csd_bytes = rk_card_check_csd_bytes(buf);
+}
+
+// O_DIRECT when the file system takes it, the writes have to reach the card either way
+static int card_open(const char *path, int flags, int *direct) {
+	int fd = open(path, flags | O_DIRECT | O_CLOEXEC, 0644);
+
+	*direct = fd >= 0;
+	if (fd < 0)
+		fd = open(path, flags | O_CLOEXEC, 0644);
+
+	return fd;
+}
+
+static int card_check_write(const char *mount_path, const rk_card_check_config_s *config,
+                            rk_card_check_result_s *result, uint64_t *seed) {
+	int64_t file_bytes = (int64_t)config->file_mb * CARD_SEQ_BLOCK;
+	long long begin_us, us, total_us = 0, max_us = 0;
+	char path[320];
+	uint8_t *buf = NULL;
+	struct stat st;
+	int fd, direct, ret = -1;
+
+	snprintf(path, sizeof(path), "%s/%s", mount_path, RK_CARD_CHECK_FILE);
+	fd = card_open(path, O_RDWR | O_CREAT, &direct);
+	if (fd < 0) {
+		LOG_ERROR("open %s fail, %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) || (st.st_size < file_bytes && posix_fallocate(fd, 0, file_bytes) &&
+	                       ftruncate(fd, file_bytes))) {
+		LOG_ERROR("allocate %s fail, %s\n", path, strerror(errno));
+		goto out;
+	}
+	if (posix_memalign((void **)&buf, CARD_BLOCK, CARD_SEQ_BLOCK))
+		goto out;
+	for (int i = 0; i < CARD_SEQ_BLOCK / 8; i++)
+		((uint64_t *)buf)[i] = card_random(seed);
+
+	begin_us = card_now_us();
+	for (int i = 0; i < config->file_mb; i++) {
+		if (pwrite(fd, buf, CARD_SEQ_BLOCK, (off_t)i * CARD_SEQ_BLOCK) != CARD_SEQ_BLOCK ||
+		    fdatasync(fd))
+			goto out;
+	}
+	us = card_now_us() - begin_us;
+	result->seq_write_kbps = (int64_t)config->file_mb * 1024 * 1000000 / (us > 0 ? us : 1);
+
+	for (int i = 0; i < config->random_writes; i++) {
+		off_t offset = card_random(seed) % (file_bytes / CARD_BLOCK) * CARD_BLOCK;
+
+		begin_us = card_now_us();
+		if (pwrite(fd, buf + i % 256 * CARD_BLOCK, CARD_BLOCK, offset) != CARD_BLOCK ||
+		    fdatasync(fd))
+			goto out;
+		us = card_now_us() - begin_us;
+		total_us += us;
+		max_us = us > max_us ? us : max_us;
+	}
+	if (config->random_writes)
+		result->rand_write_iops =
+		    (int64_t)config->random_writes * 1000000 / (total_us > 0 ? total_us : 1);
+	result->rand_write_max_ms = (max_us + 999) / 1000;
+	ret = 0;
+	LOG_INFO("%s%s: %d KiB/s sequential, %d IOPS random, %d ms at most\n", path,
+	         direct ? "" : " (buffered)", result->seq_write_kbps, result->rand_write_iops,
+	         result->rand_write_max_ms);
+out:
+	if (ret)
+		LOG_ERROR("write %s fail, %s\n", path, strerror(errno));
+	free(buf);
+	close(fd);
+
+	return ret;
+}
+
+static void card_pattern(uint8_t *block, int64_t offset, uint64_t nonce) {
+	uint64_t state = nonce ^ (uint64_t)offset ^ 0x9e3779b97f4a7c15ULL;
+
+	for (int i = 0; i < CARD_BLOCK / 8; i++)
+		((uint64_t *)block)[i] = card_random(&state);
+	memcpy(block, "RKCC", 4);
+	memcpy(block + 8, &offset, sizeof(offset));
+}
+
+// Blocks up to the end of the partition are saved, overwritten with a pattern of their
+// own offset, read back and restored. Counterfeit cards either lose what is written past
+// their real size, which the samples scattered over the partition read back as garbage,
+// or wrap around at it, flash comes in powers of two and one and a half of them. Samples
+// at the first offset plus each of those sizes all land on the first one then, whatever
+// the offset of the partition on the disk. The blocks belong to whatever file system is on
+// the partition, so a block device is opened exclusively, which the kernel refuses while
+// it is mounted.
+static int card_check_capacity(const char *dev, const rk_card_check_config_s *config,
+                               rk_card_check_result_s *result, uint64_t nonce) {
+	int n = 0, scattered = config->capacity_samples;
+	int64_t size = 0, *offset = NULL;
+	uint8_t *saved = NULL, *block = NULL, *readable = NULL, expect[CARD_BLOCK];
+	struct stat st;
+	int fd, direct, ret = -1;
+
+	result->capacity_bad_offset = -1;
+	fd = card_open(dev, O_RDWR | O_EXCL, &direct);
+	if (fd < 0) {
+		if (errno == EBUSY)
+			LOG_WARN("%s is mounted or in use, capacity not sampled\n", dev);
+		else
+			LOG_ERROR("open %s fail, %s\n", dev, strerror(errno));
+		return -1;
+	}
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode))
+		size = st.st_size;
+	else if (ioctl(fd, BLKGETSIZE64, &size))
+		size = 0;
+	if (size < CARD_CAPACITY_SKIP + (int64_t)scattered * CARD_BLOCK) {
+		LOG_WARN("%s: %lld bytes, too small to sample\n", dev, (long long)size);
+		close(fd);
+		return -1;
+	}
+	offset = calloc(scattered + 128, sizeof(*offset));
+	readable = calloc(scattered + 128, 1);
+	if (!offset || !readable ||
+	    posix_memalign((void **)&saved, CARD_BLOCK, (scattered + 128) * CARD_BLOCK) ||
+	    posix_memalign((void **)&block, CARD_BLOCK, CARD_BLOCK))
+		goto out;
+	offset[n++] = CARD_CAPACITY_SKIP;
+	for (int64_t step = CARD_CAPACITY_SKIP; CARD_CAPACITY_SKIP + step + CARD_BLOCK <= size;
+	     step *= 2) {
+		offset[n++] = CARD_CAPACITY_SKIP + step;
+		if (CARD_CAPACITY_SKIP + step * 3 / 2 + CARD_BLOCK <= size)
+			offset[n++] = CARD_CAPACITY_SKIP + step * 3 / 2;
+	}
+	for (int i = 1; i <= scattered; i++)
+		offset[n++] = CARD_CAPACITY_SKIP + (size - CARD_CAPACITY_SKIP - CARD_BLOCK) * i /
+		                                       scattered / CARD_BLOCK * CARD_BLOCK;
+	// all of them are saved before the first write, one that wraps onto another saves the
+	// same block again
+	for (int i = 0; i < n; i++)
+		readable[i] = pread(fd, saved + i * CARD_BLOCK, CARD_BLOCK, offset[i]) == CARD_BLOCK;
+	for (int i = 0; i < n; i++) {
+		card_pattern(block, offset[i], nonce);
+		if (readable[i] && pwrite(fd, block, CARD_BLOCK, offset[i]) != CARD_BLOCK)
+			readable[i] = 0;
+	}
+	fdatasync(fd);
+	if (!direct) {
+		ioctl(fd, BLKFLSBUF, 0);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	}
+	for (int i = 0; i < n; i++) {
+		card_pattern(expect, offset[i], nonce);
+		if (readable[i] && pread(fd, block, CARD_BLOCK, offset[i]) == CARD_BLOCK &&
+		    !memcmp(block, expect, CARD_BLOCK))
+			continue;
+		result->capacity_bad++;
+		if (result->capacity_bad_offset < 0)
+			result->capacity_bad_offset = offset[i];
+	}
+	for (int i = 0; i < n; i++) {
+		if (readable[i] && pwrite(fd, saved + i * CARD_BLOCK, CARD_BLOCK, offset[i]) != CARD_BLOCK)
+			LOG_ERROR("%s: restore %lld fail, %s\n", dev, (long long)offset[i], strerror(errno));
+	}
+	fdatasync(fd);
+	result->capacity_samples = n;
+	ret = 0;
+	LOG_INFO("%s: %lld bytes, %d of %d samples bad\n", dev, (long long)size,
+	         result->capacity_bad, n);
+out:
+	free(block);
+	free(saved);
+	free(readable);
+	free(offset);
+	close(fd);
+
+	return ret;
+}
+
+int rk_card_check(const char *dev, const char *mount_path, const rk_card_check_config_s *config,
+                  rk_card_check_result_s *result) {
+	uint64_t seed = card_now_us() | 1;
+
+	memset(result, 0, sizeof(*result));
+	result->capacity_bad_offset = -1;
+	card_check_sysfs(dev, result);
+	LOG_INFO("%s: %s %s manfid 0x%06x oemid 0x%04x serial 0x%08x date %s, csd %lld bytes, "
+	         "disk %lld bytes\n",
+	         dev, result->type, result->name, result->manfid, result->oemid, result->serial,
+	         result->date, (long long)result->csd_bytes, (long long)result->device_bytes);
+	if (config->capacity_samples > 0)
+		card_check_capacity(dev, config, result, card_random(&seed));
+	if (mount_path && config->file_mb > 0 && card_check_write(mount_path, config, result, &seed))
+		result->write_error = 1;
+
+	return 0;
+}
@@ -0,0 +1,65 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RK_CARD_CHECK_H__
+#define __RK_CARD_CHECK_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// written over by every check, its clusters are allocated once like a pool slot
+#define RK_CARD_CHECK_FILE ".rkipc_card_check"
+
+typedef enum {
+	RK_CARD_UNCHECKED = 0,
+	RK_CARD_OK,
+	RK_CARD_DEGRADED, // records at a lower bitrate
+	RK_CARD_FAILED,   // does not record
+} rk_card_state_e;
+
+typedef struct {
+	int file_mb;          // size of the check file, the sequential write covers all of it
+	int random_writes;    // 4 KiB writes at random offsets of the file
+	int capacity_samples; // 0 leaves the block device alone, it must not be mounted otherwise
+} rk_card_check_config_s;
+
+typedef struct {
+	// from the CID and CSD in sysfs, empty when the disk is not an SD or MMC card
+	char type[8];
+	char name[16];
+	unsigned int manfid;
+	unsigned int oemid;
+	unsigned int serial;
+	char date[16];
+	int64_t csd_bytes;    // capacity the CSD register claims, 0 when unknown
+	int64_t device_bytes; // of the whole disk
+	// synced writes into the check file
+	int seq_write_kbps; // KiB/s of 1 MiB writes, each followed by fdatasync
+	int rand_write_iops;
+	int rand_write_max_ms;
+	// blocks written at scattered offsets of the unmounted partition and read back
+	int capacity_samples;
+	int capacity_bad;
+	int64_t capacity_bad_offset; // lowest offset that did not read back, -1 for none
+	int write_error;             // the check file could not be written at all
+} rk_card_check_result_s;
+
+// Qualifies the card behind dev, a partition mounted at mount_path, NULL skips the check
+// file. The capacity sample writes to the block device itself and is left out while dev is
+// mounted or open exclusively elsewhere; it saves the blocks it writes to and puts them
+// back, a counterfeit card that wraps around at its real size reads back what was written
+// to another sample or over the file system.
+int rk_card_check(const char *dev, const char *mount_path, const rk_card_check_config_s *config,
+                  rk_card_check_result_s *result);
+// CSD capacity of a version 1, 2 or 3 register in the hexadecimal form of sysfs, 0 when
+// it does not parse
+int64_t rk_card_check_csd_bytes(const char *csd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,1410 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Fragmented MP4 (ISO/IEC 14496-12) for recording: ftyp and an empty moov with
+// mvex go out together with the first fragment, then one moof and mdat per GOP.
+// Whatever reached the disk before a power loss is playable up to the last complete
+// fragment, rk_fmp4_recover cuts off the torn one. A clean close appends mfra,
+// its trailing mfro is how the recovery scan tells a finished file in one read.
+//
+// Besides the main video and audio a file may carry the sub stream as a second video
+// track and a timed metadata track. All of them share a fragment per GOP of the main
+// stream, laid out track after track in one mdat, so the card sees one sequential write
+// and one flush where separate files would need one each.
+#include "common.h"
+#include "fmp4.h"
+
+#include <sys/stat.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "fmp4.c"
+
+#define FMP4_VIDEO_TIMESCALE 90000
+#define FMP4_VIDEO_TRACK 1
+#define FMP4_AUDIO_TRACK 2
+#define FMP4_SUB_VIDEO_TRACK 3
+#define FMP4_META_TRACK 4
+#define FMP4_FRAGMENT_MAX_BYTES (4 * 1024 * 1024)
+#define FMP4_PARAM_SET_MAX 4
+
+#define FMP4_FTYP_SIZE 28
+#define FMP4_SLOT_HEADER_SIZE 48 // free box, "rkpl", version, length, start and end time
+
+#define FMP4_SAMPLE_SYNC 0x02000000     // sample_depends_on 2
+#define FMP4_SAMPLE_NON_SYNC 0x01010000 // sample_depends_on 1, sample_is_non_sync_sample
+
+enum {
+	FMP4_AUDIO_NONE,
+	FMP4_AUDIO_ALAW,
+	FMP4_AUDIO_ULAW,
+	FMP4_AUDIO_AAC,
+	FMP4_AUDIO_MP2,
+	FMP4_AUDIO_MP3,
+};
+
+typedef struct {
+	unsigned char *data;
+	int size;
+	int cap;
+	int error;
+} fmp4_buf_s;
+
+typedef struct fmp4_fragment {
+	struct fmp4_fragment *next;
+	fmp4_buf_s buf;
+	int key_frame;
+	rk_segment_index_record_s key; // indexed once the fragment is on disk
+	int64_t end_time_ms;           // wall time of the end of the fragment, 0 for others
+} fmp4_fragment_s;
+
+typedef struct {
+	unsigned int size;
+	unsigned int duration;
+	int key_frame;
+	int64_t pts;
+	int64_t wall_time_ms;
+} fmp4_sample_s;
+
+typedef struct {
+	fmp4_sample_s *sample;
+	int count;
+	int cap;
+	fmp4_buf_s data;
+	uint64_t next_dts; // decode time the next fragment continues from
+} fmp4_track_s;
+
+typedef struct {
+	uint64_t time;
+	uint64_t moof_offset;
+} fmp4_tfra_s;
+
+struct rk_fmp4 {
+	int fd;
+	char path[256];
+	int h265;
+	int width;
+	int height;
+	int audio;
+	int sample_rate;
+	int channels;
+	unsigned char asc[2]; // AAC AudioSpecificConfig
+	int sub;              // a sub stream track is configured
+	int sub_h265;
+	int sub_width;
+	int sub_height;
+	char meta_mime[64]; // empty without a metadata track
+	int fsync_fragments;
+	int fragment_ms;
+	int queue_limit;
+	rk_segment_index_t *index;
+	int64_t slot_bytes;
+	rkipc_metric_t *write_us;
+	// caller side
+	int started;
+	int skip_to_key;
+	int sub_started;
+	int sub_skip_to_key;
+	int sub_in_file; // decided with the header
+	int header_built;
+	fmp4_buf_s param; // parameter sets of the first I frames, Annex B
+	fmp4_buf_s sub_param;
+	int64_t base_pts;
+	unsigned int sequence;
+	uint64_t offset; // file offset of the next fragment
+	fmp4_buf_s header;
+	fmp4_track_s video;
+	fmp4_track_s audio_track;
+	fmp4_track_s sub_video;
+	fmp4_track_s meta;
+	fmp4_tfra_s *tfra;
+	int tfra_count;
+	int tfra_cap;
+	// writer thread
+	pthread_t writer;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	fmp4_fragment_s *head;
+	fmp4_fragment_s *tail;
+	int queued;
+	int run;
+	int failed;
+	rk_fmp4_slot_s slot; // what the slot header says, writer thread only
+};
+
+static void fmp4_put(fmp4_buf_s *b, const void *p, int n) {
+	unsigned char *data;
+	int cap;
+
+	if (b->error || n <= 0)
+		return;
+	if (b->size + n > b->cap) {
+		cap = b->cap ? b->cap * 2 : 4096;
+		while (cap < b->size + n)
+			cap *= 2;
+		data = realloc(b->data, cap);
+		if (!data) {
+			b->error = 1;
+			return;
+		}
+		b->data = data;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->size, p, n);
+	b->size += n;
+}
+
+static void fmp4_u8(fmp4_buf_s *b, unsigned int v) {
+	unsigned char c = v;
+
+	fmp4_put(b, &c, 1);
+}
+
+static void fmp4_u16(fmp4_buf_s *b, unsigned int v) {
+	unsigned char c[2] = {v >> 8, v};
+
+	fmp4_put(b, c, 2);
+}
+
+static void fmp4_u24(fmp4_buf_s *b, unsigned int v) {
+	unsigned char c[3] = {v >> 16, v >> 8, v};
+
+	fmp4_put(b, c, 3);
+}
+
+static void fmp4_u32(fmp4_buf_s *b, unsigned int v) {
+	unsigned char c[4] = {v >> 24, v >> 16, v >> 8, v};
+
+	fmp4_put(b, c, 4);
+}
+
+static void fmp4_u64(fmp4_buf_s *b, uint64_t v) {
+	fmp4_u32(b, v >> 32);
+	fmp4_u32(b, v);
+}
+
+static void fmp4_zero(fmp4_buf_s *b, int n) {
+	while (n--)
+		fmp4_u8(b, 0);
+}
+
+static int fmp4_box(fmp4_buf_s *b, const char *type) {
+	int offset = b->size;
+
+	fmp4_u32(b, 0);
+	fmp4_put(b, type, 4);
+	return offset;
+}
+
+static int fmp4_full_box(fmp4_buf_s *b, const char *type, int version, unsigned int flags) {
+	int offset = fmp4_box(b, type);
+
+	fmp4_u8(b, version);
+	fmp4_u24(b, flags);
+	return offset;
+}
+
+static void fmp4_box_end(fmp4_buf_s *b, int offset) {
+	unsigned int size = b->size - offset;
+
+	if (b->error)
+		return;
+	b->data[offset] = size >> 24;
+	b->data[offset + 1] = size >> 16;
+	b->data[offset + 2] = size >> 8;
+	b->data[offset + 3] = size;
+}
+
+static void fmp4_buf_free(fmp4_buf_s *b) {
+	free(b->data);
+	memset(b, 0, sizeof(*b));
+}
+
+static unsigned int fmp4_be32(const unsigned char *p) {
+	return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// next NAL unit of an Annex B buffer, returns its size and leaves *nal at its header
+static int fmp4_next_nal(const unsigned char *buf, int size, int *pos,
+                         const unsigned char **nal) {
+	int i = *pos, begin = -1;
+
+	for (; i + 3 <= size; i++) {
+		if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] == 1) {
+			if (begin >= 0)
+				break;
+			i += 2;
+			begin = i + 1;
+		}
+	}
+	if (begin < 0 || begin >= size)
+		return 0;
+	if (i + 3 > size)
+		i = size;
+	*pos = i;
+	*nal = buf + begin;
+	// the zero before 00 00 01 belongs to a four byte start code
+	while (i > begin && buf[i - 1] == 0)
+		i--;
+	return i - begin;
+}
+
+static int fmp4_nal_type(int h265, const unsigned char *nal) {
+	return h265 ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+}
+
+static int fmp4_param_set(int h265, const unsigned char *nal) {
+	int type = fmp4_nal_type(h265, nal);
+
+	return h265 ? type >= 32 && type <= 34 : type == 7 || type == 8;
+}
+
+// the parameter sets in front of an I frame, kept for the moov built later
+static void fmp4_param_copy(fmp4_buf_s *b, int h265, const unsigned char *buf, int size) {
+	const unsigned char *nal;
+	int pos = 0, nal_size;
+
+	while ((nal_size = fmp4_next_nal(buf, size, &pos, &nal)) > 0) {
+		if (!fmp4_param_set(h265, nal))
+			continue;
+		fmp4_put(b, "\0\0\0\1", 4);
+		fmp4_put(b, nal, nal_size);
+	}
+}
+
+static int fmp4_param_list(const fmp4_buf_s *b, const unsigned char *ps[], int ps_size[]) {
+	int num = 0, pos = 0, nal_size;
+	const unsigned char *nal;
+
+	while ((nal_size = fmp4_next_nal(b->data, b->size, &pos, &nal)) > 0 &&
+	       num < FMP4_PARAM_SET_MAX) {
+		ps[num] = nal;
+		ps_size[num++] = nal_size;
+	}
+
+	return num;
+}
+
+// RBSP of the start of an SPS, enough for profile_tier_level
+static int fmp4_unescape(const unsigned char *src, int size, unsigned char *dst, int max) {
+	int n = 0, zeros = 0;
+
+	for (int i = 0; i < size && n < max; i++) {
+		if (zeros >= 2 && src[i] == 3) {
+			zeros = 0;
+			continue;
+		}
+		zeros = src[i] ? 0 : zeros + 1;
+		dst[n++] = src[i];
+	}
+
+	return n;
+}
+
+static void fmp4_avcc(fmp4_buf_s *b, const unsigned char *ps[], const int ps_size[], int num) {
+	const unsigned char *sps = NULL;
+	int sps_size = 0, count;
+	int off = fmp4_box(b, "avcC");
+
+	for (int i = 0; i < num; i++) {
+		if ((ps[i][0] & 0x1f) == 7) {
+			sps = ps[i];
+			sps_size = ps_size[i];
+			break;
+		}
+	}
+	fmp4_u8(b, 1);
+	fmp4_u8(b, sps_size > 3 ? sps[1] : 100);
+	fmp4_u8(b, sps_size > 3 ? sps[2] : 0);
+	fmp4_u8(b, sps_size > 3 ? sps[3] : 51);
+	fmp4_u8(b, 0xff); // four byte NAL unit lengths
+	for (int type = 7; type <= 8; type++) {
+		count = 0;
+		for (int i = 0; i < num; i++)
+			count += (ps[i][0] & 0x1f) == type;
+		fmp4_u8(b, type == 7 ? 0xe0 | count : count);
+		for (int i = 0; i < num; i++) {
+			if ((ps[i][0] & 0x1f) != type)
+				continue;
+			fmp4_u16(b, ps_size[i]);
+			fmp4_put(b, ps[i], ps_size[i]);
+		}
+	}
+	fmp4_box_end(b, off);
+}
+
+static void fmp4_hvcc(fmp4_buf_s *b, const unsigned char *ps[], const int ps_size[], int num) {
+	unsigned char ptl[16] = {0x01, 0x60, 0, 0, 0, 0x90, 0, 0, 0, 0, 0, 0x5d};
+	unsigned char rbsp[20];
+	int sub_layers = 0, count, n;
+	int off = fmp4_box(b, "hvcC");
+
+	// SPS: NAL header, then vps id, max_sub_layers_minus1, nesting, profile_tier_level
+	for (int i = 0; i < num; i++) {
+		if (((ps[i][0] >> 1) & 0x3f) != 33)
+			continue;
+		n = fmp4_unescape(ps[i] + 2, ps_size[i] - 2, rbsp, sizeof(rbsp));
+		if (n >= 13) {
+			sub_layers = (rbsp[0] >> 1) & 0x7;
+			memcpy(ptl, rbsp + 1, 12);
+		}
+		break;
+	}
+	fmp4_u8(b, 1);
+	fmp4_put(b, ptl, 12); // profile space, tier, profile, compatibility, constraints, level
+	fmp4_u16(b, 0xf000);  // min_spatial_segmentation_idc
+	fmp4_u8(b, 0xfc);     // parallelismType
+	fmp4_u8(b, 0xfd);     // chroma_format_idc 4:2:0
+	fmp4_u8(b, 0xf8);     // bit_depth_luma_minus8
+	fmp4_u8(b, 0xf8);     // bit_depth_chroma_minus8
+	fmp4_u16(b, 0);       // avgFrameRate
+	fmp4_u8(b, ((sub_layers + 1) << 3) | (1 << 2) | 3);
+	fmp4_u8(b, 3); // numOfArrays
+	for (int type = 32; type <= 34; type++) {
+		count = 0;
+		for (int i = 0; i < num; i++)
+			count += ((ps[i][0] >> 1) & 0x3f) == type;
+		fmp4_u8(b, 0x80 | type); // array_completeness
+		fmp4_u16(b, count);
+		for (int i = 0; i < num; i++) {
+			if (((ps[i][0] >> 1) & 0x3f) != type)
+				continue;
+			fmp4_u16(b, ps_size[i]);
+			fmp4_put(b, ps[i], ps_size[i]);
+		}
+	}
+	fmp4_box_end(b, off);
+}
+
+static void fmp4_esds(fmp4_buf_s *b, int object_type, const unsigned char *dsi, int dsi_size) {
+	int off = fmp4_full_box(b, "esds", 0, 0);
+
+	fmp4_u8(b, 0x03); // ES_Descriptor
+	fmp4_u8(b, 21 + (dsi_size ? 2 + dsi_size : 0));
+	fmp4_u16(b, FMP4_AUDIO_TRACK);
+	fmp4_u8(b, 0);
+	fmp4_u8(b, 0x04); // DecoderConfigDescriptor
+	fmp4_u8(b, 13 + (dsi_size ? 2 + dsi_size : 0));
+	fmp4_u8(b, object_type);
+	fmp4_u8(b, 0x15); // audio stream
+	fmp4_u24(b, 0);
+	fmp4_u32(b, 0);
+	fmp4_u32(b, 0);
+	if (dsi_size) {
+		fmp4_u8(b, 0x05); // DecoderSpecificInfo
+		fmp4_u8(b, dsi_size);
+		fmp4_put(b, dsi, dsi_size);
+	}
+	fmp4_u8(b, 0x06); // SLConfigDescriptor
+	fmp4_u8(b, 1);
+	fmp4_u8(b, 2);
+	fmp4_box_end(b, off);
+}
+
+static void fmp4_matrix(fmp4_buf_s *b) {
+	static const unsigned int matrix[9] = {0x10000, 0, 0, 0, 0x10000, 0, 0, 0, 0x40000000};
+
+	for (int i = 0; i < 9; i++)
+		fmp4_u32(b, matrix[i]);
+}
+
+static void fmp4_trak(rk_fmp4_t *w, fmp4_buf_s *b, int track, const unsigned char *ps[],
+                      const int ps_size[], int num) {
+	int video = track == FMP4_VIDEO_TRACK || track == FMP4_SUB_VIDEO_TRACK;
+	int sub = track == FMP4_SUB_VIDEO_TRACK;
+	int h265 = sub ? w->sub_h265 : w->h265;
+	int width = sub ? w->sub_width : w->width;
+	int height = sub ? w->sub_height : w->height;
+	const char *handler = video ? "vide" : track == FMP4_AUDIO_TRACK ? "soun" : "meta";
+	const char *name = video ? "VideoHandler" : track == FMP4_AUDIO_TRACK ? "SoundHandler"
+	                                                                      : "MetaHandler";
+	int trak, mdia, minf, dinf, dref, stbl, stsd, entry, off;
+
+	trak = fmp4_box(b, "trak");
+	off = fmp4_full_box(b, "tkhd", 0, 3); // enabled, in movie
+	fmp4_u32(b, 0);
+	fmp4_u32(b, 0);
+	fmp4_u32(b, track);
+	fmp4_u32(b, 0);
+	fmp4_u32(b, 0); // duration, the fragments carry it
+	fmp4_zero(b, 8);
+	fmp4_u16(b, 0);
+	fmp4_u16(b, video && w->sub_in_file); // alternate_group, main and sub show the same
+	fmp4_u16(b, track == FMP4_AUDIO_TRACK ? 0x0100 : 0);
+	fmp4_u16(b, 0);
+	fmp4_matrix(b);
+	fmp4_u32(b, video ? width << 16 : 0);
+	fmp4_u32(b, video ? height << 16 : 0);
+	fmp4_box_end(b, off);
+
+	mdia = fmp4_box(b, "mdia");
+	off = fmp4_full_box(b, "mdhd", 0, 0);
+	fmp4_u32(b, 0);
+	fmp4_u32(b, 0);
+	fmp4_u32(b, track == FMP4_AUDIO_TRACK ? w->sample_rate : FMP4_VIDEO_TIMESCALE);
+	fmp4_u32(b, 0);
+	fmp4_u16(b, 0x55c4); // und
+	fmp4_u16(b, 0);
+	fmp4_box_end(b, off);
+	off = fmp4_full_box(b, "hdlr", 0, 0);
+	fmp4_u32(b, 0);
+	fmp4_put(b, handler, 4);
+	fmp4_zero(b, 12);
+	fmp4_put(b, name, strlen(name) + 1);
+	fmp4_box_end(b, off);
+
+	minf = fmp4_box(b, "minf");
+	if (video) {
+		off = fmp4_full_box(b, "vmhd", 0, 1);
+		fmp4_zero(b, 8);
+	} else if (track == FMP4_AUDIO_TRACK) {
+		off = fmp4_full_box(b, "smhd", 0, 0);
+		fmp4_zero(b, 4);
+	} else {
+		off = fmp4_full_box(b, "nmhd", 0, 0);
+	}
+	fmp4_box_end(b, off);
+	dinf = fmp4_box(b, "dinf");
+	dref = fmp4_full_box(b, "dref", 0, 0);
+	fmp4_u32(b, 1);
+	off = fmp4_full_box(b, "url ", 0, 1); // media in this file
+	fmp4_box_end(b, off);
+	fmp4_box_end(b, dref);
+	fmp4_box_end(b, dinf);
+
+	stbl = fmp4_box(b, "stbl");
+	stsd = fmp4_full_box(b, "stsd", 0, 0);
+	fmp4_u32(b, 1);
+	if (video) {
+		entry = fmp4_box(b, h265 ? "hvc1" : "avc1");
+		fmp4_zero(b, 6);
+		fmp4_u16(b, 1); // data_reference_index
+		fmp4_zero(b, 16);
+		fmp4_u16(b, width);
+		fmp4_u16(b, height);
+		fmp4_u32(b, 0x00480000); // 72 dpi
+		fmp4_u32(b, 0x00480000);
+		fmp4_u32(b, 0);
+		fmp4_u16(b, 1); // frame_count
+		fmp4_zero(b, 32);
+		fmp4_u16(b, 0x18); // depth
+		fmp4_u16(b, 0xffff);
+		if (h265)
+			fmp4_hvcc(b, ps, ps_size, num);
+		else
+			fmp4_avcc(b, ps, ps_size, num);
+	} else if (track == FMP4_META_TRACK) {
+		// TextMetaDataSampleEntry, no content encoding
+		entry = fmp4_box(b, "mett");
+		fmp4_zero(b, 6);
+		fmp4_u16(b, 1);
+		fmp4_u8(b, 0);
+		fmp4_put(b, w->meta_mime, strlen(w->meta_mime) + 1);
+	} else {
+		if (w->audio == FMP4_AUDIO_ALAW)
+			entry = fmp4_box(b, "alaw");
+		else if (w->audio == FMP4_AUDIO_ULAW)
+			entry = fmp4_box(b, "ulaw");
+		else
+			entry = fmp4_box(b, "mp4a");
+		fmp4_zero(b, 6);
+		fmp4_u16(b, 1);
+		fmp4_zero(b, 8);
+		fmp4_u16(b, w->channels);
+		fmp4_u16(b, 16);
+		fmp4_u32(b, 0);
+		fmp4_u32(b, w->sample_rate < 65536 ? w->sample_rate << 16 : 0);
+		if (w->audio == FMP4_AUDIO_AAC)
+			fmp4_esds(b, 0x40, w->asc, 2);
+		else if (w->audio == FMP4_AUDIO_MP2)
+			fmp4_esds(b, 0x6b, NULL, 0);
+		else if (w->audio == FMP4_AUDIO_MP3) // MPEG-2 below 32 kHz
+			fmp4_esds(b, w->sample_rate < 32000 ? 0x69 : 0x6b, NULL, 0);
+	}
+	fmp4_box_end(b, entry);
+	fmp4_box_end(b, stsd);
+	// the sample tables stay empty, every sample is in a fragment
+	off = fmp4_full_box(b, "stts", 0, 0);
+	fmp4_u32(b, 0);
+	fmp4_box_end(b, off);
+	off = fmp4_full_box(b, "stsc", 0, 0);
+	fmp4_u32(b, 0);
+	fmp4_box_end(b, off);
+	off = fmp4_full_box(b, "stsz", 0, 0);
+	fmp4_u32(b, 0);
+	fmp4_u32(b, 0);
+	fmp4_box_end(b, off);
+	off = fmp4_full_box(b, "stco", 0, 0);
+	fmp4_u32(b, 0);
+	fmp4_box_end(b, off);
+	fmp4_box_end(b, stbl);
+	fmp4_box_end(b, minf);
+	fmp4_box_end(b, mdia);
+	fmp4_box_end(b, trak);
+}
+
+static void fmp4_ftyp(rk_fmp4_t *w, fmp4_buf_s *b) {
+	int off = fmp4_box(b, "ftyp");
+
+	fmp4_put(b, "iso6", 4);
+	fmp4_u32(b, 0);
+	fmp4_put(b, "iso6isommp41", 12);
+	fmp4_box_end(b, off);
+	if (w->slot_bytes) {
+		// an empty slot header, the writer fills it in as fragments reach the disk
+		off = fmp4_box(b, "free");
+		fmp4_put(b, "rkpl", 4);
+		fmp4_u32(b, 1); // version
+		fmp4_zero(b, FMP4_SLOT_HEADER_SIZE - 16);
+		fmp4_box_end(b, off);
+	}
+}
+
+// ftyp and moov, from the parameter sets in front of the first I frames, with the first
+// fragment, the tracks are known by then
+static void fmp4_header(rk_fmp4_t *w) {
+	const unsigned char *ps[FMP4_PARAM_SET_MAX], *sub_ps[FMP4_PARAM_SET_MAX];
+	int ps_size[FMP4_PARAM_SET_MAX], sub_ps_size[FMP4_PARAM_SET_MAX];
+	int track[4], tracks = 0, num, sub_num = 0;
+	fmp4_buf_s *b = &w->header;
+	int off, moov, mvex;
+
+	num = fmp4_param_list(&w->param, ps, ps_size);
+	if (w->sub_in_file)
+		sub_num = fmp4_param_list(&w->sub_param, sub_ps, sub_ps_size);
+	track[tracks++] = FMP4_VIDEO_TRACK;
+	if (w->audio)
+		track[tracks++] = FMP4_AUDIO_TRACK;
+	if (w->sub_in_file)
+		track[tracks++] = FMP4_SUB_VIDEO_TRACK;
+	if (w->meta_mime[0])
+		track[tracks++] = FMP4_META_TRACK;
+	if (w->index) {
+		unsigned char param[RK_SEGMENT_INDEX_PARAM_MAX];
+		int param_size = 0;
+
+		for (int i = 0; i < num && param_size + 4 + ps_size[i] <= (int)sizeof(param); i++) {
+			memcpy(param + param_size, "\0\0\0\1", 4);
+			memcpy(param + param_size + 4, ps[i], ps_size[i]);
+			param_size += 4 + ps_size[i];
+		}
+		rk_segment_index_set_param(w->index, w->h265, 4, param, param_size);
+	}
+
+	fmp4_ftyp(w, b);
+	moov = fmp4_box(b, "moov");
+	off = fmp4_full_box(b, "mvhd", 0, 0);
+	fmp4_u32(b, 0);
+	fmp4_u32(b, 0);
+	fmp4_u32(b, 1000);
+	fmp4_u32(b, 0);
+	fmp4_u32(b, 0x00010000); // rate
+	fmp4_u16(b, 0x0100);     // volume
+	fmp4_zero(b, 10);
+	fmp4_matrix(b);
+	fmp4_zero(b, 24);
+	fmp4_u32(b, FMP4_META_TRACK + 1);
+	fmp4_box_end(b, off);
+	// the main stream first, players take the first video track
+	for (int i = 0; i < tracks; i++) {
+		if (track[i] == FMP4_SUB_VIDEO_TRACK)
+			fmp4_trak(w, b, track[i], sub_ps, sub_ps_size, sub_num);
+		else
+			fmp4_trak(w, b, track[i], ps, ps_size, num);
+	}
+	mvex = fmp4_box(b, "mvex");
+	for (int i = 0; i < tracks; i++) {
+		off = fmp4_full_box(b, "trex", 0, 0);
+		fmp4_u32(b, track[i]);
+		fmp4_u32(b, 1); // default_sample_description_index
+		fmp4_u32(b, 0);
+		fmp4_u32(b, 0);
+		fmp4_u32(b, 0);
+		fmp4_box_end(b, off);
+	}
+	fmp4_box_end(b, mvex);
+	fmp4_box_end(b, moov);
+}
+
+static void fmp4_put_be64(unsigned char *p, uint64_t v) {
+	for (int i = 7; i >= 0; i--, v >>= 8)
+		p[i] = v;
+}
+
+static uint64_t fmp4_be64(const unsigned char *p) {
+	return ((uint64_t)fmp4_be32(p) << 32) | fmp4_be32(p + 4);
+}
+
+// length, start and end time of the slot header
+static int fmp4_slot_write(int fd, const rk_fmp4_slot_s *slot) {
+	unsigned char h[24];
+
+	fmp4_put_be64(h, slot->length);
+	fmp4_put_be64(h + 8, slot->start_time_ms);
+	fmp4_put_be64(h + 16, slot->end_time_ms);
+
+	return pwrite(fd, h, sizeof(h), FMP4_FTYP_SIZE + 16) == sizeof(h) ? 0 : -1;
+}
+
+int rk_fmp4_slot_read(int fd, rk_fmp4_slot_s *slot) {
+	unsigned char h[FMP4_SLOT_HEADER_SIZE];
+
+	if (pread(fd, h, sizeof(h), FMP4_FTYP_SIZE) != sizeof(h) ||
+	    fmp4_be32(h) != FMP4_SLOT_HEADER_SIZE || memcmp(h + 4, "freerkpl", 8))
+		return -1;
+	slot->length = fmp4_be64(h + 16);
+	slot->start_time_ms = fmp4_be64(h + 24);
+	slot->end_time_ms = fmp4_be64(h + 32);
+
+	return 0;
+}
+
+int rk_fmp4_slot_init(int fd) {
+	rk_fmp4_t w;
+	fmp4_buf_s b = {0};
+	int ret = -1;
+
+	memset(&w, 0, sizeof(w));
+	w.slot_bytes = 1;
+	fmp4_ftyp(&w, &b);
+	if (!b.error && b.size == FMP4_FTYP_SIZE + FMP4_SLOT_HEADER_SIZE &&
+	    pwrite(fd, b.data, b.size, 0) == b.size)
+		ret = 0;
+	fmp4_buf_free(&b);
+
+	return ret;
+}
+
+// the rest of a slot after its recording becomes a free box, then the header covers it
+static int fmp4_slot_finish(int fd, const rk_fmp4_slot_s *slot) {
+	unsigned char h[16];
+	struct stat st;
+	uint64_t rest;
+	int n = 8;
+
+	if (fstat(fd, &st))
+		return -1;
+	rest = (uint64_t)st.st_size > slot->length ? st.st_size - slot->length : 0;
+	if (rest > 0xffffffff) {
+		fmp4_put_be64(h + 8, rest);
+		rest = 1;
+		n = 16;
+	}
+	h[0] = rest >> 24;
+	h[1] = rest >> 16;
+	h[2] = rest >> 8;
+	h[3] = rest;
+	memcpy(h + 4, "free", 4);
+	if (rest >= 8 || n == 16) {
+		if (pwrite(fd, h, n, slot->length) != n)
+			return -1;
+	} else if (rest && ftruncate(fd, slot->length)) {
+		return -1;
+	}
+
+	return fmp4_slot_write(fd, slot);
+}
+
+static int fmp4_sample_add(fmp4_track_s *t, const unsigned char *data, unsigned int size,
+                           int64_t pts, int key_frame) {
+	fmp4_sample_s *sample;
+
+	if (t->count == t->cap) {
+		sample = realloc(t->sample, (t->cap ? t->cap * 2 : 64) * sizeof(*sample));
+		if (!sample)
+			return -1;
+		t->sample = sample;
+		t->cap = t->cap ? t->cap * 2 : 64;
+	}
+	sample = &t->sample[t->count++];
+	sample->size = size;
+	sample->duration = 0;
+	sample->key_frame = key_frame;
+	sample->pts = pts;
+	if (data)
+		fmp4_put(&t->data, data, size);
+
+	return t->data.error ? -1 : 0;
+}
+
+static uint64_t fmp4_time(int64_t pts_us, int64_t base_us, unsigned int timescale) {
+	return pts_us > base_us ? (uint64_t)(pts_us - base_us) * timescale / 1000000 : 0;
+}
+
+static unsigned int fmp4_audio_duration(rk_fmp4_t *w, unsigned int size) {
+	if (w->audio == FMP4_AUDIO_AAC)
+		return 1024;
+	if (w->audio == FMP4_AUDIO_MP2)
+		return 1152;
+	if (w->audio == FMP4_AUDIO_MP3) // MPEG-2 and 2.5 layer III frames are half as long
+		return w->sample_rate < 32000 ? 576 : 1152;
+	return size / (w->channels > 0 ? w->channels : 1);
+}
+
+// sample durations of a video or metadata track up to the sample at end_pts, or for the
+// last one as long as the one before, returns the decode time of the first sample
+static uint64_t fmp4_durations(rk_fmp4_t *w, fmp4_track_s *t, int64_t end_pts) {
+	uint64_t start, time, end;
+
+	start = fmp4_time(t->sample[0].pts, w->base_pts, FMP4_VIDEO_TIMESCALE);
+	if (start < t->next_dts)
+		start = t->next_dts;
+	time = start;
+	for (int i = 0; i < t->count; i++) {
+		if (i + 1 < t->count)
+			end = fmp4_time(t->sample[i + 1].pts, w->base_pts, FMP4_VIDEO_TIMESCALE);
+		else if (end_pts >= 0)
+			end = fmp4_time(end_pts, w->base_pts, FMP4_VIDEO_TIMESCALE);
+		else
+			end = time + (i ? t->sample[i - 1].duration : FMP4_VIDEO_TIMESCALE / 30);
+		t->sample[i].duration = end > time ? end - time : 1;
+		time += t->sample[i].duration;
+	}
+	t->next_dts = time;
+
+	return start;
+}
+
+static void fmp4_traf(rk_fmp4_t *w, fmp4_buf_s *b, fmp4_track_s *t, int track,
+                      uint64_t decode_time, int *data_offset_pos) {
+	int video = track == FMP4_VIDEO_TRACK || track == FMP4_SUB_VIDEO_TRACK;
+	int traf, off;
+
+	traf = fmp4_box(b, "traf");
+	off = fmp4_full_box(b, "tfhd", 0, 0x020000); // default-base-is-moof
+	fmp4_u32(b, track);
+	fmp4_box_end(b, off);
+	off = fmp4_full_box(b, "tfdt", 1, 0);
+	fmp4_u64(b, decode_time);
+	fmp4_box_end(b, off);
+	// data-offset, sample-duration, sample-size and for video sample-flags
+	off = fmp4_full_box(b, "trun", 0, video ? 0x701 : 0x301);
+	fmp4_u32(b, t->count);
+	*data_offset_pos = b->size;
+	fmp4_u32(b, 0);
+	for (int i = 0; i < t->count; i++) {
+		fmp4_u32(b, t->sample[i].duration);
+		fmp4_u32(b, t->sample[i].size);
+		if (video)
+			fmp4_u32(b, t->sample[i].key_frame ? FMP4_SAMPLE_SYNC : FMP4_SAMPLE_NON_SYNC);
+	}
+	fmp4_box_end(b, off);
+	fmp4_box_end(b, traf);
+}
+
+static void fmp4_patch32(fmp4_buf_s *b, int pos, unsigned int v) {
+	if (b->error)
+		return;
+	b->data[pos] = v >> 24;
+	b->data[pos + 1] = v >> 16;
+	b->data[pos + 2] = v >> 8;
+	b->data[pos + 3] = v;
+}
+
+static int64_t fmp4_wall_time_ms() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static int fmp4_queue(rk_fmp4_t *w, fmp4_buf_s *buf, const rk_segment_index_record_s *key,
+                      int64_t end_time_ms) {
+	fmp4_fragment_s *fragment;
+
+	pthread_mutex_lock(&w->mutex);
+	if (w->failed || w->queued + buf->size > w->queue_limit) {
+		pthread_mutex_unlock(&w->mutex);
+		return -1;
+	}
+	fragment = malloc(sizeof(*fragment));
+	if (!fragment) {
+		pthread_mutex_unlock(&w->mutex);
+		return -1;
+	}
+	fragment->next = NULL;
+	fragment->buf = *buf;
+	fragment->key_frame = key != NULL;
+	if (key)
+		fragment->key = *key;
+	fragment->end_time_ms = end_time_ms;
+	if (w->tail)
+		w->tail->next = fragment;
+	else
+		w->head = fragment;
+	w->tail = fragment;
+	w->queued += buf->size;
+	memset(buf, 0, sizeof(*buf));
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+
+	return 0;
+}
+
+static void fmp4_track_reset(fmp4_track_s *t) {
+	t->count = 0;
+	t->data.size = 0;
+}
+
+// moof and mdat for everything pending, next_pts is the video frame that follows
+static int fmp4_flush(rk_fmp4_t *w, int64_t next_pts) {
+	fmp4_track_s *v = &w->video, *a = &w->audio_track, *sv = &w->sub_video, *m = &w->meta;
+	fmp4_track_s *track[4] = {v, sv, a, m};
+	const int id[4] = {FMP4_VIDEO_TRACK, FMP4_SUB_VIDEO_TRACK, FMP4_AUDIO_TRACK,
+	                   FMP4_META_TRACK};
+	uint64_t time[4] = {0}, t;
+	int moof, pos[4] = {0}, mdat, ret, size, key_frame, pending = 0;
+	rk_segment_index_record_s key;
+	fmp4_buf_s b = {0};
+	fmp4_tfra_s *tfra;
+
+	if (!w->header_built) {
+		// the sub stream is in the file when its parameter sets came in time
+		w->sub_in_file = w->sub_param.size > 0;
+		fmp4_header(w);
+		w->header_built = 1;
+	}
+	if (!w->sub_in_file)
+		fmp4_track_reset(sv);
+	for (int i = 0; i < 4; i++)
+		pending += track[i]->count;
+	if (!pending)
+		return 0;
+	if (v->count)
+		time[0] = fmp4_durations(w, v, next_pts);
+	if (sv->count)
+		time[1] = fmp4_durations(w, sv, next_pts);
+	if (a->count) {
+		time[2] = fmp4_time(a->sample[0].pts, w->base_pts, w->sample_rate);
+		if (time[2] < a->next_dts)
+			time[2] = a->next_dts;
+		t = time[2];
+		for (int i = 0; i < a->count; i++) {
+			a->sample[i].duration = fmp4_audio_duration(w, a->sample[i].size);
+			t += a->sample[i].duration;
+		}
+		a->next_dts = t;
+	}
+	if (m->count)
+		time[3] = fmp4_durations(w, m, next_pts);
+
+	// the first fragment carries ftyp and moov, they are only released once queued
+	fmp4_put(&b, w->header.data, w->header.size);
+	moof = fmp4_box(&b, "moof");
+	ret = fmp4_full_box(&b, "mfhd", 0, 0);
+	fmp4_u32(&b, ++w->sequence);
+	fmp4_box_end(&b, ret);
+	for (int i = 0; i < 4; i++) {
+		if (track[i]->count)
+			fmp4_traf(w, &b, track[i], id[i], time[i], &pos[i]);
+	}
+	fmp4_box_end(&b, moof);
+	// every track of the GOP in one mdat, the card gets one sequential write
+	mdat = fmp4_box(&b, "mdat");
+	for (int i = 0; i < 4; i++) {
+		if (!track[i]->count)
+			continue;
+		fmp4_patch32(&b, pos[i], b.size - moof);
+		fmp4_put(&b, track[i]->data.data, track[i]->data.size);
+	}
+	fmp4_box_end(&b, mdat);
+
+	key_frame = v->count && v->sample[0].key_frame;
+	memset(&key, 0, sizeof(key));
+	if (key_frame) {
+		key.wall_time_ms = v->sample[0].wall_time_ms;
+		key.pts_us = v->sample[0].pts - w->base_pts;
+		key.offset = w->offset + mdat + 8;
+		key.size = v->sample[0].size;
+		key.type = RK_SEGMENT_INDEX_KEY;
+	}
+	for (int i = 0; i < 4; i++)
+		fmp4_track_reset(track[i]);
+	size = b.size;
+	if (b.error || fmp4_queue(w, &b, key_frame ? &key : NULL, fmp4_wall_time_ms())) {
+		LOG_WARN("%s: disk behind, fragment %u dropped\n", w->path, w->sequence);
+		fmp4_buf_free(&b);
+		// the frames up to the next I frame reference the dropped ones
+		w->skip_to_key = 1;
+		w->sub_skip_to_key = 1;
+		return -1;
+	}
+	if (key_frame) {
+		if (w->tfra_count == w->tfra_cap) {
+			tfra = realloc(w->tfra, (w->tfra_cap ? w->tfra_cap * 2 : 64) * sizeof(*tfra));
+			if (tfra) {
+				w->tfra = tfra;
+				w->tfra_cap = w->tfra_cap ? w->tfra_cap * 2 : 64;
+			}
+		}
+		if (w->tfra_count < w->tfra_cap) {
+			w->tfra[w->tfra_count].time = time[0];
+			w->tfra[w->tfra_count++].moof_offset = w->offset + moof;
+		}
+	}
+	w->offset += size;
+	fmp4_buf_free(&w->header);
+
+	return 0;
+}
+
+static void *rk_fmp4_writer(void *arg) {
+	rk_fmp4_t *w = arg;
+	fmp4_fragment_s *fragment;
+	int fragments = 0, done, n;
+	long long begin_us;
+
+	prctl(PR_SET_NAME, "rk_fmp4_writer", 0, 0, 0);
+	for (;;) {
+		pthread_mutex_lock(&w->mutex);
+		while (w->run && !w->head)
+			pthread_cond_wait(&w->cond, &w->mutex);
+		fragment = w->head;
+		if (fragment) {
+			w->head = fragment->next;
+			if (!w->head)
+				w->tail = NULL;
+		}
+		pthread_mutex_unlock(&w->mutex);
+		if (!fragment)
+			break;
+
+		begin_us = rkipc_metrics_now_us();
+		for (done = 0; done < fragment->buf.size && !w->failed; done += n) {
+			n = write(w->fd, fragment->buf.data + done, fragment->buf.size - done);
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+			} else if (n <= 0) {
+				LOG_ERROR("%s: write fail, %s\n", w->path, strerror(errno));
+				w->failed = 1;
+			}
+		}
+		if (!w->failed && w->fsync_fragments > 0 && ++fragments % w->fsync_fragments == 0)
+			fdatasync(w->fd);
+		rkipc_metric_observe(w->write_us, rkipc_metrics_now_us() - begin_us);
+		// the slot header only ever covers what was written, it reaches the card with the
+		// flush of the next fragment
+		if (!w->failed && w->slot_bytes) {
+			w->slot.length += fragment->buf.size;
+			if (!w->slot.start_time_ms && fragment->key_frame)
+				w->slot.start_time_ms = fragment->key.wall_time_ms;
+			if (fragment->end_time_ms)
+				w->slot.end_time_ms = fragment->end_time_ms;
+			if (w->slot.start_time_ms)
+				fmp4_slot_write(w->fd, &w->slot);
+		}
+		if (!w->failed && fragment->key_frame)
+			rk_segment_index_add_key(w->index, fragment->key.wall_time_ms, fragment->key.pts_us,
+			                         fragment->key.offset, fragment->key.size);
+		pthread_mutex_lock(&w->mutex);
+		w->queued -= fragment->buf.size;
+		pthread_mutex_unlock(&w->mutex);
+		fmp4_buf_free(&fragment->buf);
+		free(fragment);
+	}
+
+	return NULL;
+}
+
+static int fmp4_audio_codec(const char *codec) {
+	if (!codec)
+		return FMP4_AUDIO_NONE;
+	if (!strcmp(codec, "G711A"))
+		return FMP4_AUDIO_ALAW;
+	if (!strcmp(codec, "G711U"))
+		return FMP4_AUDIO_ULAW;
+	if (!strcmp(codec, "AAC"))
+		return FMP4_AUDIO_AAC;
+	if (!strcmp(codec, "MP2"))
+		return FMP4_AUDIO_MP2;
+	if (!strcmp(codec, "MP3"))
+		return FMP4_AUDIO_MP3;
+	return FMP4_AUDIO_NONE;
+}
+
+static void fmp4_aac_asc(rk_fmp4_t *w, int profile, int rate_index, int channels) {
+	w->asc[0] = (profile << 3) | (rate_index >> 1);
+	w->asc[1] = ((rate_index & 1) << 7) | (channels << 3);
+}
+
+rk_fmp4_t *rk_fmp4_open(const char *path, const rk_fmp4_config_s *config) {
+	static const int aac_rates[] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+	                                22050, 16000, 12000, 11025, 8000,  7350};
+	rk_fmp4_t *w = calloc(1, sizeof(*w));
+	int rate_index = 4;
+
+	if (!w)
+		return NULL;
+	snprintf(w->path, sizeof(w->path), "%s", path);
+	w->h265 = config->video_codec && !strcmp(config->video_codec, "H.265");
+	w->width = config->width;
+	w->height = config->height;
+	w->audio = fmp4_audio_codec(config->audio_codec);
+	w->sample_rate = config->sample_rate > 0 ? config->sample_rate : 8000;
+	w->sub = config->sub_video_codec != NULL;
+	w->sub_h265 = w->sub && !strcmp(config->sub_video_codec, "H.265");
+	w->sub_width = config->sub_width;
+	w->sub_height = config->sub_height;
+	if (config->metadata_mime)
+		snprintf(w->meta_mime, sizeof(w->meta_mime), "%s", config->metadata_mime);
+	w->channels = config->channels > 0 ? config->channels : 1;
+	if (w->audio == FMP4_AUDIO_AAC) {
+		for (int i = 0; i < (int)(sizeof(aac_rates) / sizeof(aac_rates[0])); i++) {
+			if (aac_rates[i] == w->sample_rate)
+				rate_index = i;
+		}
+		fmp4_aac_asc(w, 2, rate_index, w->channels);
+	}
+	w->fsync_fragments = config->fsync_fragments;
+	w->slot_bytes = config->slot_bytes > 0 ? config->slot_bytes : 0;
+	w->write_us = config->write_us;
+	w->fragment_ms = config->fragment_ms > 0 ? config->fragment_ms : 4000;
+	w->queue_limit = config->queue_bytes > 0 ? config->queue_bytes : 8 * 1024 * 1024;
+	w->index = config->index;
+	// a slot keeps its clusters, it is written over from the start
+	w->fd = open(path, O_WRONLY | O_CREAT | (w->slot_bytes ? 0 : O_TRUNC) | O_CLOEXEC, 0644);
+	if (w->fd < 0) {
+		LOG_ERROR("open %s fail, %s\n", path, strerror(errno));
+		free(w);
+		return NULL;
+	}
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	w->run = 1;
+	if (pthread_create(&w->writer, NULL, rk_fmp4_writer, w)) {
+		close(w->fd);
+		pthread_cond_destroy(&w->cond);
+		pthread_mutex_destroy(&w->mutex);
+		free(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+// Annex B to four byte lengths, the parameter sets stay in band as well
+static int fmp4_video_sample(fmp4_track_s *t, const unsigned char *buffer, unsigned int size,
+                             int64_t present_time, int key_frame) {
+	const unsigned char *nal;
+	unsigned char length[4];
+	int pos = 0, nal_size, begin = t->data.size;
+
+	while ((nal_size = fmp4_next_nal(buffer, size, &pos, &nal)) > 0) {
+		length[0] = nal_size >> 24;
+		length[1] = nal_size >> 16;
+		length[2] = nal_size >> 8;
+		length[3] = nal_size;
+		fmp4_put(&t->data, length, 4);
+		fmp4_put(&t->data, nal, nal_size);
+	}
+
+	return fmp4_sample_add(t, NULL, t->data.size - begin, present_time, key_frame);
+}
+
+int rk_fmp4_write_video(rk_fmp4_t *w, const unsigned char *buffer, unsigned int size,
+                        int64_t present_time, int key_frame) {
+	int ret = 0;
+
+	if (!w || w->failed)
+		return -1;
+	if (!w->started) {
+		// a file starts at an I frame, audio before it is dropped as well
+		if (!key_frame)
+			return -1;
+		fmp4_param_copy(&w->param, w->h265, buffer, size);
+		w->base_pts = present_time;
+		w->started = 1;
+	}
+	if (w->video.count &&
+	    (key_frame || w->video.data.size + size > FMP4_FRAGMENT_MAX_BYTES ||
+	     present_time - w->video.sample[0].pts >= (int64_t)w->fragment_ms * 1000))
+		ret = fmp4_flush(w, present_time);
+	if (w->skip_to_key && !key_frame)
+		return -1;
+	w->skip_to_key = 0;
+
+	if (fmp4_video_sample(&w->video, buffer, size, present_time, key_frame))
+		return -1;
+	if (key_frame)
+		w->video.sample[w->video.count - 1].wall_time_ms = fmp4_wall_time_ms();
+
+	return ret;
+}
+
+int rk_fmp4_write_sub_video(rk_fmp4_t *w, const unsigned char *buffer, unsigned int size,
+                            int64_t present_time, int key_frame) {
+	fmp4_track_s *t;
+
+	if (!w || w->failed || !w->sub || !w->started || present_time < w->base_pts)
+		return -1;
+	t = &w->sub_video;
+	if (!w->sub_started) {
+		if (!key_frame || w->header_built)
+			return -1;
+		fmp4_param_copy(&w->sub_param, w->sub_h265, buffer, size);
+		if (!w->sub_param.size)
+			return -1;
+		w->sub_started = 1;
+	}
+	if (!w->sub_in_file && w->header_built)
+		return -1;
+	// the main stream cuts the fragments, a sub frame that does not fit waits for an I frame
+	if (t->data.size + size > FMP4_FRAGMENT_MAX_BYTES)
+		w->sub_skip_to_key = 1;
+	if (w->sub_skip_to_key && (!key_frame || t->data.size + size > FMP4_FRAGMENT_MAX_BYTES))
+		return -1;
+	w->sub_skip_to_key = 0;
+
+	return fmp4_video_sample(t, buffer, size, present_time, key_frame);
+}
+
+int rk_fmp4_write_metadata(rk_fmp4_t *w, const unsigned char *buffer, unsigned int size,
+                           int64_t present_time) {
+	if (!w || w->failed || !w->meta_mime[0] || !w->started || present_time < w->base_pts)
+		return -1;
+	if (w->meta.data.size + size > FMP4_FRAGMENT_MAX_BYTES)
+		return -1;
+
+	return fmp4_sample_add(&w->meta, buffer, size, present_time, 1);
+}
+
+int rk_fmp4_write_audio(rk_fmp4_t *w, const unsigned char *buffer, unsigned int size,
+                        int64_t present_time) {
+	int header = 0;
+
+	if (!w || w->failed || !w->audio || !w->started || present_time < w->base_pts)
+		return -1;
+	// ADTS in front of AAC frames is replaced by the AudioSpecificConfig in esds
+	if (w->audio == FMP4_AUDIO_AAC && size > 7 && buffer[0] == 0xff &&
+	    (buffer[1] & 0xf0) == 0xf0) {
+		header = buffer[1] & 1 ? 7 : 9;
+		if (!w->audio_track.next_dts && !w->audio_track.count)
+			fmp4_aac_asc(w, ((buffer[2] >> 6) & 3) + 1, (buffer[2] >> 2) & 0xf,
+			             ((buffer[2] & 1) << 2) | (buffer[3] >> 6));
+		if (size <= (unsigned int)header)
+			return -1;
+	}
+
+	return fmp4_sample_add(&w->audio_track, buffer + header, size - header, present_time, 1);
+}
+
+static void fmp4_mfra(rk_fmp4_t *w, fmp4_buf_s *b) {
+	int mfra, off;
+
+	mfra = fmp4_box(b, "mfra");
+	if (w->tfra_count) {
+		off = fmp4_full_box(b, "tfra", 1, 0);
+		fmp4_u32(b, FMP4_VIDEO_TRACK);
+		fmp4_u32(b, 0); // one byte traf, trun and sample numbers
+		fmp4_u32(b, w->tfra_count);
+		for (int i = 0; i < w->tfra_count; i++) {
+			fmp4_u64(b, w->tfra[i].time);
+			fmp4_u64(b, w->tfra[i].moof_offset);
+			fmp4_u8(b, 1);
+			fmp4_u8(b, 1);
+			fmp4_u8(b, 1);
+		}
+		fmp4_box_end(b, off);
+	}
+	off = fmp4_full_box(b, "mfro", 0, 0);
+	fmp4_u32(b, b->size - mfra + 4);
+	fmp4_box_end(b, off);
+	fmp4_box_end(b, mfra);
+}
+
+int rk_fmp4_close(rk_fmp4_t *w) {
+	fmp4_buf_s b = {0};
+	int ret;
+
+	if (!w)
+		return -1;
+	if (w->started) {
+		fmp4_flush(w, -1);
+		fmp4_mfra(w, &b);
+		if (b.error || fmp4_queue(w, &b, NULL, 0))
+			fmp4_buf_free(&b);
+	}
+	pthread_mutex_lock(&w->mutex);
+	w->run = 0;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+	pthread_join(w->writer, NULL);
+	if (!w->failed && w->slot_bytes && w->slot.length)
+		fmp4_slot_finish(w->fd, &w->slot);
+	if (w->fsync_fragments > 0)
+		fdatasync(w->fd);
+	ret = w->failed ? -1 : 0;
+	close(w->fd);
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+	fmp4_buf_free(&w->header);
+	fmp4_buf_free(&w->param);
+	fmp4_buf_free(&w->sub_param);
+	fmp4_buf_free(&w->video.data);
+	fmp4_buf_free(&w->audio_track.data);
+	fmp4_buf_free(&w->sub_video.data);
+	fmp4_buf_free(&w->meta.data);
+	free(w->video.sample);
+	free(w->audio_track.sample);
+	free(w->sub_video.sample);
+	free(w->meta.sample);
+	free(w->tfra);
+	free(w);
+
+	return ret;
+}
+
+static int fmp4_read_box(int fd, off_t offset, off_t file_size, uint64_t *size, char *type) {
+	unsigned char h[16];
+
+	if (offset + 8 > file_size || pread(fd, h, 8, offset) != 8)
+		return -1;
+	*size = fmp4_be32(h);
+	memcpy(type, h + 4, 4);
+	if (*size == 1) {
+		if (offset + 16 > file_size || pread(fd, h + 8, 8, offset + 8) != 8)
+			return -1;
+		*size = ((uint64_t)fmp4_be32(h + 8) << 32) | fmp4_be32(h + 12);
+	} else if (*size == 0) {
+		*size = file_size - offset;
+	}
+
+	return *size < 8 ? -1 : 0;
+}
+
+// the ftyp fmp4_ftyp writes, files of other writers are never modified
+static int fmp4_is_own(int fd) {
+	static const char ftyp[] = "\0\0\0\x1c"
+	                           "ftypiso6\0\0\0\0iso6isommp41";
+	char h[FMP4_FTYP_SIZE];
+
+	return pread(fd, h, sizeof(h), 0) == sizeof(h) && !memcmp(h, ftyp, sizeof(h));
+}
+
+// walks the children of the moov at offset, 1 if one of them is mvex
+static int fmp4_moov_has_mvex(int fd, off_t offset, uint64_t moov_size) {
+	off_t end = offset + moov_size, child = offset + 8;
+	uint64_t size;
+	char type[4];
+
+	while (child < end && !fmp4_read_box(fd, child, end, &size, type)) {
+		if (!memcmp(type, "mvex", 4))
+			return 1;
+		child += size;
+	}
+
+	return 0;
+}
+
+int rk_fmp4_recover(const char *path) {
+	unsigned char tail[16];
+	off_t size, offset = 0, good = 0, moof_end = 0;
+	int fd, fragmented = 0, moov = 0, fragments = 0, ret = RK_FMP4_RECOVER_INTACT;
+	uint64_t box_size;
+	char type[4];
+	fmp4_buf_s b = {0};
+	rk_fmp4_slot_s slot;
+	rk_fmp4_t w;
+	struct stat st;
+	int is_slot, own;
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return RK_FMP4_RECOVER_INTACT;
+	if (fstat(fd, &st) || st.st_size < 16) {
+		close(fd);
+		return RK_FMP4_RECOVER_INTACT;
+	}
+	size = st.st_size;
+	// the recording of a slot ends where its header says, the rest is an older one
+	is_slot = !rk_fmp4_slot_read(fd, &slot);
+	if (is_slot && !slot.length) {
+		close(fd);
+		LOG_WARN("%s is an empty slot\n", path);
+		return RK_FMP4_RECOVER_REMOVED;
+	}
+	if (is_slot && slot.length < (uint64_t)size)
+		size = slot.length;
+	if (size < 16) {
+		close(fd);
+		return RK_FMP4_RECOVER_INTACT;
+	}
+	own = is_slot || fmp4_is_own(fd);
+	// a clean close ends in mfro
+	if (pread(fd, tail, 16, size - 16) == 16 && !memcmp(tail + 4, "mfro", 4)) {
+		close(fd);
+		return RK_FMP4_RECOVER_INTACT;
+	}
+
+	while (!fmp4_read_box(fd, offset, size, &box_size, type)) {
+		if (offset == 0 && memcmp(type, "ftyp", 4))
+			break;
+		if (offset + (off_t)box_size > size)
+			break; // torn
+		if (!memcmp(type, "moov", 4)) {
+			moov = 1;
+			fragmented = fmp4_moov_has_mvex(fd, offset, box_size);
+		}
+		offset += box_size;
+		if (!memcmp(type, "moof", 4)) {
+			moof_end = offset;
+			continue;
+		}
+		if (!memcmp(type, "mdat", 4) && moof_end) {
+			fragments++;
+			good = offset;
+		} else if (!moof_end) {
+			good = offset;
+		}
+		moof_end = 0;
+	}
+	if (!fragmented) {
+		if (!moov && offset)
+			ret = RK_FMP4_RECOVER_BROKEN;
+		close(fd);
+		if (ret == RK_FMP4_RECOVER_BROKEN)
+			LOG_WARN("%s has no moov, it was not closed and is not fragmented\n", path);
+		return ret;
+	}
+	if (!own) {
+		close(fd);
+		LOG_INFO("%s was not written by this muxer, left as is\n", path);
+		return RK_FMP4_RECOVER_INTACT;
+	}
+	// a file is never deleted, only an empty slot is marked as such
+	if (!fragments) {
+		if (is_slot) {
+			memset(&slot, 0, sizeof(slot));
+			fmp4_slot_write(fd, &slot);
+			fdatasync(fd);
+			ret = RK_FMP4_RECOVER_REMOVED;
+		} else {
+			ret = RK_FMP4_RECOVER_BROKEN;
+		}
+		close(fd);
+		LOG_WARN("%s has no complete fragment, %s\n", path, is_slot ? "emptied" : "left as is");
+		return ret;
+	}
+
+	// cut off the torn fragment and finalize with an empty mfra, the next scan skips it
+	if (!is_slot && good < size && ftruncate(fd, good))
+		LOG_ERROR("%s: truncate fail, %s\n", path, strerror(errno));
+	memset(&w, 0, sizeof(w));
+	fmp4_mfra(&w, &b);
+	if (!b.error && pwrite(fd, b.data, b.size, good) == b.size)
+		ret = RK_FMP4_RECOVER_REPAIRED;
+	if (is_slot && ret == RK_FMP4_RECOVER_REPAIRED) {
+		slot.length = good + b.size;
+		if (fmp4_slot_finish(fd, &slot))
+			ret = RK_FMP4_RECOVER_INTACT;
+	}
+	fmp4_buf_free(&b);
+	fdatasync(fd);
+	close(fd);
+	LOG_INFO("%s: %d fragments kept, %lld of %lld bytes\n", path, fragments, (long long)good,
+	         (long long)size);
+
+	return ret;
+}
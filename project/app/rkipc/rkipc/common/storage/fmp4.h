@@ -0,0 +1,84 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RK_FMP4_H__
+#define __RK_FMP4_H__
+
+#include <stdint.h>
+
+#include "metrics.h"
+#include "segment_index.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct rk_fmp4 rk_fmp4_t;
+
+typedef struct {
+	const char *video_codec; // "H.264" or "H.265"
+	int width;
+	int height;
+	const char *audio_codec; // "G711A", "G711U", "AAC", "MP2" or "MP3", else no audio
+	int sample_rate;
+	int channels;
+	const char *sub_video_codec; // a second video track, the sub stream, NULL for none
+	int sub_width;
+	int sub_height;
+	const char *metadata_mime; // a timed metadata track of this MIME type, NULL for none
+	int fsync_fragments; // fdatasync every n fragments, 0 leaves it to the kernel
+	int fragment_ms;     // longest fragment when I frames are further apart than this
+	int queue_bytes;     // fragments waiting for the disk before new ones are dropped
+	rk_segment_index_t *index; // gets the I frames that are on disk, may be NULL
+	// the file is a preallocated slot of this size and is rewritten in place, 0 creates it
+	int64_t slot_bytes;
+	rkipc_metric_t *write_us; // histogram of the time a fragment takes to reach the disk
+} rk_fmp4_config_s;
+
+// A slot of a segment pool is longer than its recording. A free box right after ftyp
+// holds how much of it is the recording and the time it covers, and the rest of a
+// closed slot is one more free box, so the file stays a valid MP4 on any player.
+typedef struct {
+	uint64_t length; // bytes of the recording, 0 for an empty slot
+	int64_t start_time_ms;
+	int64_t end_time_ms;
+} rk_fmp4_slot_s;
+
+// the file starts at the first I frame, a moof and mdat follow for every GOP and are
+// written by a thread of the writer, so the caller never waits for the disk. Every track
+// of a GOP goes into its fragment, one write and one fdatasync for all of them.
+rk_fmp4_t *rk_fmp4_open(const char *path, const rk_fmp4_config_s *config);
+int rk_fmp4_close(rk_fmp4_t *fmp4);
+// 0 when the frame is taken, -1 when it is dropped
+int rk_fmp4_write_video(rk_fmp4_t *fmp4, const unsigned char *buffer, unsigned int size,
+                        int64_t present_time, int key_frame);
+int rk_fmp4_write_audio(rk_fmp4_t *fmp4, const unsigned char *buffer, unsigned int size,
+                        int64_t present_time);
+// the sub stream is in the file when its first I frame comes before the first fragment
+// is written, present_time is on the clock of the main stream
+int rk_fmp4_write_sub_video(rk_fmp4_t *fmp4, const unsigned char *buffer, unsigned int size,
+                            int64_t present_time, int key_frame);
+int rk_fmp4_write_metadata(rk_fmp4_t *fmp4, const unsigned char *buffer, unsigned int size,
+                           int64_t present_time);
+
+enum {
+	RK_FMP4_RECOVER_INTACT,    // complete, or not a file of this writer
+	RK_FMP4_RECOVER_REPAIRED,  // cut back to the last complete fragment and finalized
+	RK_FMP4_RECOVER_REMOVED,   // a pool slot without a complete fragment, marked empty
+	RK_FMP4_RECOVER_BROKEN,    // no moov, or no complete fragment, nothing to repair it from
+};
+
+// checks a file left behind by a crash, cheap for files that were closed properly. Only
+// files with the ftyp of this writer are modified, and no file is ever deleted. A pool
+// slot is never cut, it keeps its size and is marked empty instead.
+int rk_fmp4_recover(const char *path);
+// 0 with the header of a pool slot, -1 for any other file
+int rk_fmp4_slot_read(int fd, rk_fmp4_slot_s *slot);
+// turns a file of any content into an empty slot, its size is kept
+int rk_fmp4_slot_init(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,451 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Keyframe index of a recording. Seeking or taking a thumbnail then costs one read
+// of a small sidecar and one read of the I frame, instead of parsing the MP4.
+#include "common.h"
+#include "mp4_reader.h"
+#include "segment_index.h"
+
+#include <sys/stat.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "segment_index.c"
+
+struct rk_segment_index {
+	char media_path[256];
+	int fd;
+	pthread_mutex_t mutex;
+	rk_segment_index_header_s header;
+	off_t offset;
+	int64_t event_second; // pending event record
+	int event_flags;
+};
+
+int rk_segment_index_path(const char *media_path, char *path, int len) {
+	const char *name = strrchr(media_path, '/');
+	int dir_len = name ? name - media_path + 1 : 0;
+
+	name = name ? name + 1 : media_path;
+	if (snprintf(path, len, "%.*s%s/%s%s", dir_len, media_path, RK_SEGMENT_INDEX_DIR, name,
+	             RK_SEGMENT_INDEX_SUFFIX) >= len)
+		return -1;
+
+	return 0;
+}
+
+int rk_segment_index_remove(const char *media_path) {
+	char path[512];
+
+	if (rk_segment_index_path(media_path, path, sizeof(path)))
+		return -1;
+	if (unlink(path) && errno != ENOENT)
+		return -1;
+
+	return 0;
+}
+
+static int index_write_header(rk_segment_index_t *index) {
+	if (pwrite(index->fd, &index->header, sizeof(index->header), 0) != sizeof(index->header))
+		return -1;
+
+	return 0;
+}
+
+rk_segment_index_t *rk_segment_index_open(const char *media_path, int64_t start_time_ms) {
+	rk_segment_index_t *index;
+	char path[512], *slash;
+
+	if (rk_segment_index_path(media_path, path, sizeof(path)))
+		return NULL;
+	index = calloc(1, sizeof(*index));
+	if (!index)
+		return NULL;
+	slash = strrchr(path, '/');
+	*slash = '\0';
+	mkdir(path, 0777);
+	*slash = '/';
+	index->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (index->fd < 0) {
+		LOG_ERROR("open %s fail, %s\n", path, strerror(errno));
+		free(index);
+		return NULL;
+	}
+	memcpy(&index->header, RK_SEGMENT_INDEX_MAGIC, sizeof(index->header.magic));
+	index->header.version = RK_SEGMENT_INDEX_VERSION;
+	index->header.record_size = sizeof(rk_segment_index_record_s);
+	index->header.records_offset = RK_SEGMENT_INDEX_HEADER_SIZE;
+	index->header.nal_length_size = 4;
+	index->header.start_time_ms = start_time_ms;
+	index->offset = RK_SEGMENT_INDEX_HEADER_SIZE;
+	index->event_second = -1;
+	snprintf(index->media_path, sizeof(index->media_path), "%s", media_path);
+	pthread_mutex_init(&index->mutex, NULL);
+	index_write_header(index);
+
+	return index;
+}
+
+void rk_segment_index_set_param(rk_segment_index_t *index, int h265, int nal_length_size,
+                                const unsigned char *param, int size) {
+	if (!index)
+		return;
+	pthread_mutex_lock(&index->mutex);
+	index->header.h265 = h265;
+	index->header.nal_length_size = nal_length_size;
+	// too large for the header, a key frame is still decodable by its in band copy
+	index->header.param_size = size <= RK_SEGMENT_INDEX_PARAM_MAX ? size : 0;
+	memcpy(index->header.param, param, index->header.param_size);
+	index_write_header(index);
+	pthread_mutex_unlock(&index->mutex);
+}
+
+static int index_append(rk_segment_index_t *index, const rk_segment_index_record_s *record) {
+	if (pwrite(index->fd, record, sizeof(*record), index->offset) != sizeof(*record))
+		return -1;
+	index->offset += sizeof(*record);
+
+	return 0;
+}
+
+int rk_segment_index_add_key(rk_segment_index_t *index, int64_t wall_time_ms, int64_t pts_us,
+                             uint64_t offset, uint32_t size) {
+	rk_segment_index_record_s record;
+	int ret;
+
+	if (!index)
+		return -1;
+	memset(&record, 0, sizeof(record));
+	record.wall_time_ms = wall_time_ms;
+	record.pts_us = pts_us;
+	record.offset = offset;
+	record.size = size;
+	record.type = RK_SEGMENT_INDEX_KEY;
+	pthread_mutex_lock(&index->mutex);
+	ret = index_append(index, &record);
+	pthread_mutex_unlock(&index->mutex);
+
+	return ret;
+}
+
+static void index_flush_event(rk_segment_index_t *index) {
+	rk_segment_index_record_s record;
+
+	if (index->event_second < 0)
+		return;
+	memset(&record, 0, sizeof(record));
+	record.wall_time_ms = index->event_second * 1000;
+	record.type = RK_SEGMENT_INDEX_EVENT;
+	record.flags = index->event_flags;
+	index_append(index, &record);
+	index->event_second = -1;
+	index->event_flags = 0;
+}
+
+void rk_segment_index_add_event(rk_segment_index_t *index, int64_t wall_time_ms, int flags) {
+	if (!index)
+		return;
+	pthread_mutex_lock(&index->mutex);
+	if (index->event_second != wall_time_ms / 1000)
+		index_flush_event(index);
+	index->event_second = wall_time_ms / 1000;
+	index->event_flags |= flags;
+	pthread_mutex_unlock(&index->mutex);
+}
+
+int rk_segment_index_close(rk_segment_index_t *index) {
+	if (!index)
+		return -1;
+	pthread_mutex_lock(&index->mutex);
+	index_flush_event(index);
+	pthread_mutex_unlock(&index->mutex);
+	close(index->fd);
+	pthread_mutex_destroy(&index->mutex);
+	free(index);
+
+	return 0;
+}
+
+int rk_segment_index_build(rk_segment_index_t *index) {
+	const rkipc_mp4_info_s *info;
+	rkipc_mp4_sample_s sample;
+	rkipc_mp4_reader_t *reader;
+	int keys = 0;
+
+	if (!index)
+		return -1;
+	reader = rkipc_mp4_reader_open(index->media_path, 0);
+	if (!reader)
+		return -1;
+	info = rkipc_mp4_reader_info(reader);
+	rk_segment_index_set_param(index, info->h265, info->nal_length_size, info->param,
+	                           info->param_size);
+	// a file cut short ends at its last complete sample
+	while (!rkipc_mp4_reader_next(reader, &sample)) {
+		if (sample.audio || !sample.key)
+			continue;
+		if (!rk_segment_index_add_key(index, index->header.start_time_ms + sample.time_us / 1000,
+		                              sample.time_us, sample.offset, sample.size))
+			keys++;
+	}
+	rkipc_mp4_reader_close(reader);
+
+	return keys;
+}
+
+static int index_compare(const void *a, const void *b) {
+	const rk_segment_index_record_s *x = a, *y = b;
+
+	if (x->wall_time_ms != y->wall_time_ms)
+		return x->wall_time_ms < y->wall_time_ms ? -1 : 1;
+	return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+int rk_segment_index_load(const char *media_path, rk_segment_index_s *index) {
+	rk_segment_index_record_s *record;
+	char path[512];
+	struct stat st;
+	int fd, num;
+	ssize_t len;
+
+	memset(index, 0, sizeof(*index));
+	if (rk_segment_index_path(media_path, path, sizeof(path)))
+		return -1;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_size < RK_SEGMENT_INDEX_HEADER_SIZE ||
+	    pread(fd, &index->header, sizeof(index->header), 0) != sizeof(index->header) ||
+	    memcmp(index->header.magic, RK_SEGMENT_INDEX_MAGIC, 4) ||
+	    index->header.version != RK_SEGMENT_INDEX_VERSION ||
+	    index->header.record_size != sizeof(*record) ||
+	    index->header.records_offset > st.st_size ||
+	    index->header.param_size > RK_SEGMENT_INDEX_PARAM_MAX) {
+		close(fd);
+		return -1;
+	}
+	// a record cut short by a power loss is left out
+	num = (st.st_size - index->header.records_offset) / sizeof(*record);
+	record = malloc(num * sizeof(*record) + 1);
+	len = record ? pread(fd, record, num * sizeof(*record), index->header.records_offset) : -1;
+	close(fd);
+	if (len != (ssize_t)(num * sizeof(*record))) {
+		free(record);
+		return -1;
+	}
+	// the keys are split off in place, events go to their own array
+	index->key = record;
+	index->event = malloc(num * sizeof(*record) + 1);
+	if (!index->event) {
+		free(record);
+		index->key = NULL;
+		return -1;
+	}
+	for (int i = 0; i < num; i++) {
+		if (record[i].type == RK_SEGMENT_INDEX_KEY)
+			index->key[index->key_num++] = record[i];
+		else if (record[i].type == RK_SEGMENT_INDEX_EVENT)
+			index->event[index->event_num++] = record[i];
+	}
+	qsort(index->key, index->key_num, sizeof(*record), index_compare);
+	qsort(index->event, index->event_num, sizeof(*record), index_compare);
+
+	return 0;
+}
+
+void rk_segment_index_free(rk_segment_index_s *index) {
+	free(index->key);
+	free(index->event);
+	memset(index, 0, sizeof(*index));
+}
+
+int rk_segment_index_find(const rk_segment_index_s *index, int64_t wall_time_ms, int before) {
+	int low = 0, high = index->key_num - 1, mid;
+
+	if (!index->key_num)
+		return -1;
+	// last key at or before the time
+	while (low < high) {
+		mid = (low + high + 1) / 2;
+		if (index->key[mid].wall_time_ms <= wall_time_ms)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+	if (before || low + 1 >= index->key_num || index->key[low].wall_time_ms > wall_time_ms)
+		return low;
+	if (index->key[low + 1].wall_time_ms - wall_time_ms <
+	    wall_time_ms - index->key[low].wall_time_ms)
+		return low + 1;
+
+	return low;
+}
+
+// length prefixed NAL units to Annex B, with the parameter sets first unless in band
+static unsigned char *index_annexb(int h265, int nal_length_size, const unsigned char *param,
+                                   int param_size, const unsigned char *sample, int size,
+                                   int *out_len) {
+	unsigned char *out;
+	int n, len, pos = 0, out_size, in_band = 0;
+
+	if (nal_length_size < 1 || nal_length_size > 4)
+		return NULL;
+	// a start code takes the place of each length, at most four bytes more per NAL unit
+	out_size = param_size + size * 2 + 4;
+	out = malloc(out_size);
+	if (!out)
+		return NULL;
+	len = param_size;
+	memcpy(out, param, len);
+	while (pos + nal_length_size <= size) {
+		n = 0;
+		for (int b = 0; b < nal_length_size; b++)
+			n = (n << 8) | sample[pos + b];
+		pos += nal_length_size;
+		if (n <= 0 || n > size - pos || len + 4 + n > out_size)
+			break;
+		// parameter sets in band, the header copy is not needed
+		if (h265 ? ((sample[pos] >> 1) & 0x3f) == 33 : (sample[pos] & 0x1f) == 7)
+			in_band = 1;
+		memcpy(out + len, "\0\0\0\1", 4);
+		memcpy(out + len + 4, sample + pos, n);
+		len += 4 + n;
+		pos += n;
+	}
+	if (in_band && param_size) {
+		memmove(out, out + param_size, len - param_size);
+		len -= param_size;
+	}
+	*out_len = len;
+
+	return out;
+}
+
+int rk_segment_index_read_key_frame(const char *media_path, int64_t wall_time_ms, int before,
+                                    unsigned char **buffer, int *size,
+                                    rk_segment_index_record_s *record) {
+	rk_segment_index_s index;
+	rk_segment_index_record_s *key;
+	unsigned char *sample, *out;
+	int fd, i, len, ret = -1;
+	struct stat st;
+
+	if (rk_segment_index_load(media_path, &index))
+		return -1;
+	i = rk_segment_index_find(&index, wall_time_ms, before);
+	if (i < 0 || index.header.nal_length_size < 1 || index.header.nal_length_size > 4) {
+		rk_segment_index_free(&index);
+		return -1;
+	}
+	key = &index.key[i];
+	fd = open(media_path, O_RDONLY | O_CLOEXEC);
+	// the file may have been cut back to its last complete fragment since
+	if (fd < 0 || fstat(fd, &st) || key->offset + key->size > (uint64_t)st.st_size)
+		goto out;
+	sample = malloc(key->size);
+	if (!sample)
+		goto out;
+	if (pread(fd, sample, key->size, key->offset) != (ssize_t)key->size) {
+		free(sample);
+		goto out;
+	}
+	out = index_annexb(index.header.h265, index.header.nal_length_size, index.header.param,
+	                   index.header.param_size, sample, key->size, &len);
+	free(sample);
+	if (!out)
+		goto out;
+	*buffer = out;
+	*size = len;
+	if (record)
+		*record = *key;
+	ret = 0;
+out:
+	if (fd >= 0)
+		close(fd);
+	rk_segment_index_free(&index);
+
+	return ret;
+}
+
+int rk_segment_index_scan_key_frame(const char *media_path, int video, int64_t wall_time_ms,
+                                    int before, unsigned char **buffer, int *size,
+                                    rk_segment_index_record_s *record) {
+	const rkipc_mp4_info_s *info;
+	rkipc_mp4_sample_s sample, best = {0};
+	rkipc_mp4_reader_t *reader;
+	int64_t start, time, best_time = 0;
+	unsigned char *data, *out = NULL;
+	int found = 0, len;
+
+	start = rk_segment_index_name_time(media_path);
+	reader = rkipc_mp4_reader_open(media_path, video);
+	if (start < 0 || !reader) {
+		rkipc_mp4_reader_close(reader);
+		return -1;
+	}
+	// as rk_segment_index_find, the last I frame at or before the time, else the first one
+	while (!rkipc_mp4_reader_next(reader, &sample)) {
+		if (sample.audio || !sample.key)
+			continue;
+		time = start + sample.time_us / 1000;
+		if (found && time > wall_time_ms) {
+			if (!before && best_time <= wall_time_ms &&
+			    time - wall_time_ms < wall_time_ms - best_time) {
+				best = sample;
+				best_time = time;
+			}
+			break;
+		}
+		best = sample;
+		best_time = time;
+		found = 1;
+	}
+	info = rkipc_mp4_reader_info(reader);
+	data = found ? malloc(best.size) : NULL;
+	if (data && !rkipc_mp4_reader_read(reader, &best, data))
+		out = index_annexb(info->h265, info->nal_length_size, info->param, info->param_size,
+		                   data, best.size, &len);
+	free(data);
+	rkipc_mp4_reader_close(reader);
+	if (!out)
+		return -1;
+	*buffer = out;
+	*size = len;
+	if (record) {
+		memset(record, 0, sizeof(*record));
+		record->wall_time_ms = best_time;
+		record->pts_us = best.time_us;
+		record->offset = best.offset;
+		record->size = best.size;
+		record->type = RK_SEGMENT_INDEX_KEY;
+	}
+
+	return 0;
+}
+
+int rk_segment_index_name(int64_t wall_time_ms, char *name, int len) {
+	time_t t = wall_time_ms / 1000;
+	struct tm tm;
+
+	localtime_r(&t, &tm);
+	return strftime(name, len, "%Y%m%d%H%M%S", &tm) ? 0 : -1;
+}
+
+int64_t rk_segment_index_name_time(const char *media_path) {
+	const char *name = strrchr(media_path, '/');
+	struct tm tm;
+
+	name = name ? name + 1 : media_path;
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(name, "%4d%2d%2d%2d%2d%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour,
+	           &tm.tm_min, &tm.tm_sec) != 6)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+
+	return (int64_t)mktime(&tm) * 1000;
+}
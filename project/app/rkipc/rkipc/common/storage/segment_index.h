@@ -0,0 +1,100 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RK_SEGMENT_INDEX_H__
+#define __RK_SEGMENT_INDEX_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// <folder>/20231019114600.mp4 is indexed by <folder>/.index/20231019114600.mp4.idx,
+// outside the folder so that the file list and the quota only see recordings
+#define RK_SEGMENT_INDEX_DIR ".index"
+#define RK_SEGMENT_INDEX_SUFFIX ".idx"
+#define RK_SEGMENT_INDEX_MAGIC "RKIX"
+#define RK_SEGMENT_INDEX_VERSION 1
+#define RK_SEGMENT_INDEX_HEADER_SIZE 256
+#define RK_SEGMENT_INDEX_PARAM_MAX 232
+
+enum {
+	RK_SEGMENT_INDEX_KEY = 1,   // an I frame
+	RK_SEGMENT_INDEX_EVENT = 2, // events in the second starting at wall_time_ms
+};
+
+// per second event flags
+#define RK_SEGMENT_EVENT_MOTION (1 << 0)
+#define RK_SEGMENT_EVENT_OBJECT (1 << 1)
+
+// the file is a header followed by records, little endian, both fixed size, so that a
+// sidecar cut by a power loss only loses its last record
+typedef struct {
+	char magic[4];
+	uint16_t version;
+	uint16_t record_size;
+	uint32_t records_offset;
+	uint8_t h265;
+	uint8_t nal_length_size;
+	uint16_t param_size;
+	int64_t start_time_ms;                    // wall clock of the first frame
+	uint8_t param[RK_SEGMENT_INDEX_PARAM_MAX]; // VPS, SPS and PPS, Annex B
+} rk_segment_index_header_s;
+
+typedef struct {
+	int64_t wall_time_ms;
+	int64_t pts_us;  // from the start of the file
+	uint64_t offset; // of the sample in the media file, NAL units with length prefixes
+	uint32_t size;
+	uint16_t type;
+	uint16_t flags; // RK_SEGMENT_EVENT_*
+} rk_segment_index_record_s;
+
+typedef struct rk_segment_index rk_segment_index_t;
+
+// writing, a sidecar grows with the recording and is complete when it is closed
+rk_segment_index_t *rk_segment_index_open(const char *media_path, int64_t start_time_ms);
+int rk_segment_index_close(rk_segment_index_t *index);
+void rk_segment_index_set_param(rk_segment_index_t *index, int h265, int nal_length_size,
+                                const unsigned char *param, int size);
+int rk_segment_index_add_key(rk_segment_index_t *index, int64_t wall_time_ms, int64_t pts_us,
+                             uint64_t offset, uint32_t size);
+void rk_segment_index_add_event(rk_segment_index_t *index, int64_t wall_time_ms, int flags);
+// adds the I frames of a finished MP4, with a moov sample table or fragments
+int rk_segment_index_build(rk_segment_index_t *index);
+int rk_segment_index_remove(const char *media_path);
+int rk_segment_index_path(const char *media_path, char *path, int len);
+
+// reading
+typedef struct {
+	rk_segment_index_header_s header;
+	rk_segment_index_record_s *key; // by wall time
+	int key_num;
+	rk_segment_index_record_s *event;
+	int event_num;
+} rk_segment_index_s;
+
+int rk_segment_index_load(const char *media_path, rk_segment_index_s *index);
+void rk_segment_index_free(rk_segment_index_s *index);
+// the I frame at or before wall_time_ms with before set, for a seek, else the nearest one
+int rk_segment_index_find(const rk_segment_index_s *index, int64_t wall_time_ms, int before);
+// the I frame as Annex B, parameter sets first, *buffer is to be freed
+int rk_segment_index_read_key_frame(const char *media_path, int64_t wall_time_ms, int before,
+                                    unsigned char **buffer, int *size,
+                                    rk_segment_index_record_s *record);
+// the same from the MP4 itself, for a track the sidecar does not cover, video as for
+// rkipc_mp4_reader_open
+int rk_segment_index_scan_key_frame(const char *media_path, int video, int64_t wall_time_ms,
+                                    int before, unsigned char **buffer, int *size,
+                                    rk_segment_index_record_s *record);
+
+// recordings are named by local time, YYYYmmddHHMMSS, names sort by time as well
+int rk_segment_index_name(int64_t wall_time_ms, char *name, int len);
+int64_t rk_segment_index_name_time(const char *media_path);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
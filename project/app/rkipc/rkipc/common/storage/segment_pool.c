@@ -0,0 +1,281 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Recording pool of a folder. Deleting the oldest recording and creating the next one
+// leaves holes all over a FAT card, new files are scattered over them and the card
+// spends its time in read-modify-write of erase blocks. A pool allocates every file
+// once and only ever renames and overwrites them, what is recorded is told apart from
+// what is left of the older recording by the slot header of fmp4.h.
+#include "common.h"
+#include "fmp4.h"
+#include "segment_index.h"
+#include "segment_pool.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "segment_pool.c"
+
+struct rk_segment_pool {
+	char folder[256];
+	char spare_dir[256 + sizeof(RK_SEGMENT_POOL_DIR)];
+	int slots;
+	int64_t slot_bytes;
+	char current[64]; // the recording taken last, never deleted
+	int seq;
+	int allocating; // a slot is being allocated without the mutex
+	int quit;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+typedef struct {
+	int recordings;
+	int spares;
+	char oldest[64];
+	char spare[64];
+} pool_scan_s;
+
+static int pool_is_recording(const char *name) {
+	const char *ext = strrchr(name, '.');
+
+	return name[0] != '.' && ext && !strcmp(ext, ".mp4");
+}
+
+// recordings are named after the time they start, the smallest name is the oldest
+static void pool_scan(rk_segment_pool_t *pool, pool_scan_s *scan) {
+	struct dirent *entry;
+	DIR *dir;
+
+	memset(scan, 0, sizeof(*scan));
+	dir = opendir(pool->folder);
+	while (dir && (entry = readdir(dir))) {
+		if (entry->d_type != DT_REG || !pool_is_recording(entry->d_name))
+			continue;
+		scan->recordings++;
+		if (strlen(entry->d_name) < sizeof(scan->oldest) &&
+		    (!scan->oldest[0] || strcmp(entry->d_name, scan->oldest) < 0))
+			snprintf(scan->oldest, sizeof(scan->oldest), "%s", entry->d_name);
+	}
+	if (dir)
+		closedir(dir);
+	dir = opendir(pool->spare_dir);
+	while (dir && (entry = readdir(dir))) {
+		if (entry->d_type != DT_REG || entry->d_name[0] == '.')
+			continue;
+		scan->spares++;
+		if (strlen(entry->d_name) < sizeof(scan->spare))
+			snprintf(scan->spare, sizeof(scan->spare), "%s", entry->d_name);
+	}
+	if (dir)
+		closedir(dir);
+}
+
+static int64_t pool_free_bytes(rk_segment_pool_t *pool) {
+	struct statvfs st;
+
+	if (statvfs(pool->folder, &st))
+		return 0;
+
+	return (int64_t)st.f_bavail * st.f_frsize;
+}
+
+// grows a file to a whole slot and marks it empty, the header is on the card before the
+// file gets the name of a new recording
+static int pool_slot_prepare(rk_segment_pool_t *pool, const char *path) {
+	struct stat st;
+	int fd, ret = -1;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		LOG_ERROR("open %s fail, %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) == 0) {
+		errno = st.st_size < pool->slot_bytes ? posix_fallocate(fd, 0, pool->slot_bytes) : 0;
+		if (errno)
+			LOG_ERROR("allocate %s fail, %s\n", path, strerror(errno));
+		else if (rk_fmp4_slot_init(fd) == 0 && fdatasync(fd) == 0)
+			ret = 0;
+	}
+	close(fd);
+
+	return ret;
+}
+
+// called with the mutex held, 1 when the pool changed and another step may follow
+static int pool_step(rk_segment_pool_t *pool) {
+	char path[sizeof(pool->spare_dir) + 64], spare[sizeof(path)];
+	pool_scan_s scan;
+	int ret;
+
+	pool_scan(pool, &scan);
+	if (scan.recordings + scan.spares > pool->slots) {
+		if (scan.spares) {
+			snprintf(path, sizeof(path), "%s/%s", pool->spare_dir, scan.spare);
+		} else if (scan.recordings > 1 && strcmp(scan.oldest, pool->current)) {
+			snprintf(path, sizeof(path), "%s/%s", pool->folder, scan.oldest);
+			rk_segment_index_remove(path);
+		} else {
+			return 0;
+		}
+		LOG_INFO("%d slots, delete %s\n", pool->slots, path);
+
+		return remove(path) ? 0 : 1;
+	}
+	if (pool->allocating || scan.recordings + scan.spares == pool->slots ||
+	    pool_free_bytes(pool) < 2 * pool->slot_bytes)
+		return 0;
+
+	// allocated under a hidden name, take only ever sees whole slots
+	snprintf(path, sizeof(path), "%s/.new", pool->spare_dir);
+	pool->allocating = 1;
+	pthread_mutex_unlock(&pool->mutex);
+	ret = pool_slot_prepare(pool, path);
+	pthread_mutex_lock(&pool->mutex);
+	pool->allocating = 0;
+	pthread_cond_broadcast(&pool->cond);
+	if (ret) {
+		unlink(path);
+		return 0;
+	}
+	do {
+		snprintf(spare, sizeof(spare), "%s/slot%05d", pool->spare_dir, pool->seq++);
+	} while (!access(spare, F_OK));
+
+	return rename(path, spare) ? 0 : 1;
+}
+
+static void *pool_thread(void *arg) {
+	rk_segment_pool_t *pool = arg;
+	struct timespec deadline;
+
+	prctl(PR_SET_NAME, "rk_segment_pool", 0, 0, 0);
+	pthread_mutex_lock(&pool->mutex);
+	while (!pool->quit) {
+		if (pool_step(pool))
+			continue;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += 60;
+		pthread_cond_timedwait(&pool->cond, &pool->mutex, &deadline);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+rk_segment_pool_t *rk_segment_pool_open(const char *folder, int slots, int64_t slot_bytes) {
+	rk_segment_pool_t *pool;
+
+	if (slots <= 0 || slot_bytes <= 0)
+		return NULL;
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	snprintf(pool->folder, sizeof(pool->folder), "%s", folder);
+	snprintf(pool->spare_dir, sizeof(pool->spare_dir), "%s/%s", folder, RK_SEGMENT_POOL_DIR);
+	pool->slots = slots;
+	pool->slot_bytes = slot_bytes;
+	if (mkdir(pool->spare_dir, 0777) && errno != EEXIST) {
+		LOG_ERROR("create %s fail, %s\n", pool->spare_dir, strerror(errno));
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	if (pthread_create(&pool->thread, NULL, pool_thread, pool)) {
+		pthread_cond_destroy(&pool->cond);
+		pthread_mutex_destroy(&pool->mutex);
+		free(pool);
+		return NULL;
+	}
+	LOG_INFO("%s: %d slots of %lld bytes\n", folder, slots, (long long)slot_bytes);
+
+	return pool;
+}
+
+void rk_segment_pool_close(rk_segment_pool_t *pool) {
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	pthread_join(pool->thread, NULL);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+int rk_segment_pool_take(rk_segment_pool_t *pool, const char *path) {
+	const char *name = strrchr(path, '/');
+	char src[sizeof(pool->spare_dir) + 64];
+	pool_scan_s scan;
+	int recycled = 0, ret = -1;
+
+	name = name ? name + 1 : path;
+	pthread_mutex_lock(&pool->mutex);
+	pool_scan(pool, &scan);
+	if (scan.spares) {
+		snprintf(src, sizeof(src), "%s/%s", pool->spare_dir, scan.spare);
+	} else if (scan.recordings && strcmp(scan.oldest, name) &&
+	           (scan.recordings >= pool->slots ||
+	            pool_free_bytes(pool) < 2 * pool->slot_bytes)) {
+		snprintf(src, sizeof(src), "%s/%s", pool->folder, scan.oldest);
+		recycled = 1;
+	} else {
+		// still filling, this recording is a file of its own and becomes a slot later
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->mutex);
+		return -1;
+	}
+	if (pool_slot_prepare(pool, src) == 0 && rename(src, path) == 0) {
+		if (recycled)
+			rk_segment_index_remove(src);
+		snprintf(pool->current, sizeof(pool->current), "%s", name);
+		ret = 0;
+	}
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return ret;
+}
+
+int rk_segment_pool_fill(rk_segment_pool_t *pool) {
+	pool_scan_s scan;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		if (pool_step(pool))
+			continue;
+		if (!pool->allocating)
+			break;
+		pthread_cond_wait(&pool->cond, &pool->mutex);
+	}
+	pool_scan(pool, &scan);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return scan.recordings + scan.spares;
+}
+
+int rk_segment_pool_release(const char *path) {
+	const char *name = strrchr(path, '/');
+	char spare_dir[512], spare[576];
+	int dir_len = name ? name - path : 1;
+
+	name = name ? name + 1 : path;
+	snprintf(spare_dir, sizeof(spare_dir), "%.*s/%s", dir_len, name == path ? "." : path,
+	         RK_SEGMENT_POOL_DIR);
+	snprintf(spare, sizeof(spare), "%s/%s", spare_dir, name);
+	if (mkdir(spare_dir, 0777) && errno != EEXIST)
+		return -1;
+	rk_segment_index_remove(path);
+
+	return rename(path, spare);
+}
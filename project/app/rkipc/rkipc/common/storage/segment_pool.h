@@ -0,0 +1,37 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef __RK_SEGMENT_POOL_H__
+#define __RK_SEGMENT_POOL_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// slots that were never recorded into wait in <folder>/.pool/, outside the folder so that
+// the file list and the quota only see recordings
+#define RK_SEGMENT_POOL_DIR ".pool"
+
+typedef struct rk_segment_pool rk_segment_pool_t;
+
+// A folder of at most slots recordings of slot_bytes each. The files are allocated once
+// and then recorded over in place, the oldest recording is renamed to the new one, so the
+// clusters of a file never change and the FAT never fragments. A thread of the pool
+// allocates the missing slots while there is space for them.
+rk_segment_pool_t *rk_segment_pool_open(const char *folder, int slots, int64_t slot_bytes);
+void rk_segment_pool_close(rk_segment_pool_t *pool);
+// 0 when path is now an empty slot, -1 when the pool has no slot yet and path is to be
+// created as an ordinary file
+int rk_segment_pool_take(rk_segment_pool_t *pool, const char *path);
+// allocates every missing slot before it returns, the number of slots
+int rk_segment_pool_fill(rk_segment_pool_t *pool);
+// a slot that recover emptied goes back to the spare slots of its folder
+int rk_segment_pool_release(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
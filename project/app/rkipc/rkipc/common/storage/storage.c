@@ -22,6 +22,32 @@ static int rk_storage_muxer_deinit_by_id(int id);
 
 static rk_storage_muxer_struct rk_storage_muxer_group[STORAGE_NUM];
 
+typedef struct {
+	rkipc_metric_t *video_frames;
+	rkipc_metric_t *audio_frames;
+	rkipc_metric_t *bytes;
+	rkipc_metric_t *dropped;
+	rkipc_metric_t *write_us;
+	rkipc_metric_t *fragment_write_us;
+	rkipc_metric_t *files;
+	rkipc_metric_t *recording;
+} storage_metrics_s;
+
+static storage_metrics_s g_storage_metrics[STORAGE_NUM];
+
+typedef struct {
+	rk_card_check_result_s result;
+	int state;
+	int cap_kbps[STORAGE_NUM]; // of the video stream of the same id, 0 for none
+	// the mount the result was measured on, a restart of storage on it keeps the result
+	char dev_path[RKIPC_MAX_FILE_PATH_LEN];
+	int mount_id;
+} storage_card_s;
+
+static storage_card_s g_storage_card = {.mount_id = -1};
+static pthread_mutex_t g_storage_card_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rk_storage_bitrate_set_callback g_storage_bitrate_set_ = NULL;
+
 static rkipc_str_dev_attr rkipc_storage_get_param(rkipc_storage_handle *pHandle) {
 	return pHandle->dev_attr;
 }
@@ -136,6 +162,10 @@ int rkipc_storage_set_dev_attr(rkipc_str_dev_attr *pstDevAttr) {
 		pstDevAttr->folder_attr[1].limit = rk_param_get_int("storage.1:video_quota", 30);
 		pstDevAttr->folder_attr[2].limit = rk_param_get_int("storage.2:video_quota", 30);
 	}
+	for (int i = 0; i < STORAGE_NUM; i++) {
+		snprintf(entry, 127, "storage.%d:pool", i);
+		pstDevAttr->folder_attr[i].pool = rk_param_get_int(entry, 0);
+	}
 
 	return 0;
 }
@@ -491,10 +521,13 @@ static void *rkipc_storage_file_monitor_thread(void *arg) {
 							}
 						}
 
-						if ((event->mask & IN_DELETE) || (event->mask & IN_MOVED_FROM))
+						if ((event->mask & IN_DELETE) || (event->mask & IN_MOVED_FROM)) {
 							if (rkipc_storage_file_list_del(&pHandle->dev_sta.folder[j],
 							                                event->name))
 								LOG_ERROR("FileListDel failed");
+							sprintf(d_name, "%s/%s", pHandle->dev_sta.folder[j].cpath, event->name);
+							rk_segment_index_remove(d_name);
+						}
 
 						if (event->mask & IN_CLOSE_WRITE) {
 							sprintf(d_name, "%s/%s", pHandle->dev_sta.folder[j].cpath, event->name);
@@ -534,6 +567,28 @@ static void *rkipc_storage_file_monitor_thread(void *arg) {
 // 	}
 // }
 
+// files left open by a crash or power loss, the ones being recorded right now are skipped
+static int rk_storage_file_recover(const char *path) {
+	const char *ext = strrchr(path, '.');
+	int recording = 0, ret;
+
+	if (!ext || strcmp(ext, ".mp4") || !rk_param_get_int("storage:fmp4_recover", 1))
+		return RK_FMP4_RECOVER_INTACT;
+	pthread_mutex_lock(&g_rkmuxer_mutex);
+	for (int i = 0; i < STORAGE_NUM; i++)
+		recording |= rk_storage_muxer_group[i].g_record_run_ &&
+		             !strcmp(rk_storage_muxer_group[i].file_name, path);
+	pthread_mutex_unlock(&g_rkmuxer_mutex);
+	if (recording)
+		return RK_FMP4_RECOVER_INTACT;
+	ret = rk_fmp4_recover(path);
+	// an emptied slot of a pool is still there, it becomes a spare
+	if (ret == RK_FMP4_RECOVER_REMOVED)
+		rk_segment_pool_release(path);
+
+	return ret;
+}
+
 int rkipc_storage_read_file_list(rkipc_str_folder *folder, rkipc_str_folder_attr *folder_attr) {
 	DIR *dir;
 	struct dirent *ptr;
@@ -568,6 +623,8 @@ int rkipc_storage_read_file_list(rkipc_str_folder *folder, rkipc_str_folder_attr
 		if (ptr->d_type == 8) { // file
 			sprintf(d_name, "%s/%s", folder->cpath, ptr->d_name);
 			// LOG_DEBUG("d_name:%s\n", d_name);
+			if (rk_storage_file_recover(d_name) == RK_FMP4_RECOVER_REMOVED)
+				continue;
 			if (lstat(d_name, &statbuf)) {
 				LOG_ERROR("lstat[%s](IN_MOVED_TO) failed\n", d_name);
 			} else {
@@ -662,7 +719,8 @@ static void *rkipc_storage_file_scan_thread(void *arg) {
 		total_space = 0;
 		// delete file by num limit
 		for (i = 0; i < devAttr.folder_num; i++) {
-			if (devAttr.folder_attr[i].num_limit == false)
+			// a pool recycles its own files
+			if (devAttr.folder_attr[i].num_limit == false || devAttr.folder_attr[i].pool)
 				continue;
 			limit = pHandle->dev_sta.folder[i].file_num;
 			while (limit > devAttr.folder_attr[i].limit) {
@@ -681,6 +739,7 @@ static void *rkipc_storage_file_scan_thread(void *arg) {
 					rkipc_storage_file_list_del(&pHandle->dev_sta.folder[i], filename);
 					if (remove(file))
 						LOG_ERROR("Delete %s file error.\n", file);
+					rk_segment_index_remove(file);
 					usleep(100);
 					continue;
 				}
@@ -698,7 +757,7 @@ static void *rkipc_storage_file_scan_thread(void *arg) {
 		// delete file by space limit
 		for (i = 0; i < devAttr.folder_num; i++) {
 			pthread_mutex_lock(&pHandle->dev_sta.folder[i].mutex);
-			if (devAttr.folder_attr[i].num_limit == false)
+			if (devAttr.folder_attr[i].num_limit == false && !devAttr.folder_attr[i].pool)
 				total_space += pHandle->dev_sta.folder[i].total_space;
 			pthread_mutex_unlock(&pHandle->dev_sta.folder[i].mutex);
 		}
@@ -710,7 +769,7 @@ static void *rkipc_storage_file_scan_thread(void *arg) {
 		         pHandle->dev_sta.free_size, devAttr.free_size_del_min, devAttr.free_size_del_max);
 		LOG_INFO("total_space is %ld\n", total_space);
 		for (i = 0; i < devAttr.folder_num; i++) {
-			if (devAttr.folder_attr[i].num_limit == true)
+			if (devAttr.folder_attr[i].num_limit == true || devAttr.folder_attr[i].pool)
 				continue;
 			limit = pHandle->dev_sta.folder[i].total_space * 100 / total_space;
 			// LOG_INFO("pHandle->dev_sta.folder[i].total_space*100 is %lld, total_space is %lld\n",
@@ -732,6 +791,7 @@ static void *rkipc_storage_file_scan_thread(void *arg) {
 					rkipc_storage_file_list_del(&pHandle->dev_sta.folder[i], filename);
 					if (remove(file))
 						LOG_ERROR("Delete %s file error.\n", file);
+					rk_segment_index_remove(file);
 					usleep(100);
 					continue;
 				}
@@ -765,6 +825,167 @@ file_scan_out:
 	return NULL;
 }
 
+// max_rate of each video stream that is recorded, in a file of its own or as a sub track
+static int rk_storage_card_streams(int kbps[STORAGE_NUM]) {
+	char entry[128] = {'\0'};
+	int sub, total = 0;
+
+	memset(kbps, 0, sizeof(int) * STORAGE_NUM);
+	for (int i = 0; i < STORAGE_NUM - 1; i++) {
+		snprintf(entry, 127, "storage.%d:enable", i);
+		if (rk_param_get_int(entry, 0) == 0)
+			continue;
+		snprintf(entry, 127, "video.%d:max_rate", i);
+		kbps[i] = rk_param_get_int(entry, 512);
+		snprintf(entry, 127, "storage.%d:sub_stream", i);
+		sub = rk_param_get_int(entry, -1);
+		if (sub >= 0 && sub < STORAGE_NUM && sub != i) {
+			snprintf(entry, 127, "video.%d:max_rate", sub);
+			kbps[sub] = rk_param_get_int(entry, 512);
+		}
+	}
+	for (int i = 0; i < STORAGE_NUM; i++)
+		total += kbps[i];
+
+	return total;
+}
+
+// Recording may take storage:card_write_share percent of the synced sequential speed, and
+// the slowest random write of the card is a stall the fMP4 write queue has to ride out.
+// Streams that do not fit are scaled down together, down to storage:card_min_kbps for all
+// of them, below that and on a card that does not read back what was written there is no
+// recording at all.
+static int rk_storage_card_grade(const rk_card_check_result_s *result, int cap_kbps[]) {
+	int kbps[STORAGE_NUM], total, budget = INT32_MAX;
+	int64_t queue_kbit = (int64_t)rk_param_get_int("storage:fmp4_queue_kb", 8192) * 8;
+
+	memset(cap_kbps, 0, sizeof(int) * STORAGE_NUM);
+	if (result->write_error || result->capacity_bad)
+		return RK_CARD_FAILED;
+	total = rk_storage_card_streams(kbps);
+	if (result->seq_write_kbps > 0)
+		budget = (int64_t)result->seq_write_kbps * 8 *
+		         rk_param_get_int("storage:card_write_share", 50) / 100;
+	if (result->rand_write_max_ms > 0 && queue_kbit * 1000 / result->rand_write_max_ms < budget)
+		budget = queue_kbit * 1000 / result->rand_write_max_ms;
+	if (total <= budget)
+		return RK_CARD_OK;
+	if (budget < rk_param_get_int("storage:card_min_kbps", 512))
+		return RK_CARD_FAILED;
+	for (int i = 0; i < STORAGE_NUM; i++)
+		cap_kbps[i] = (int64_t)kbps[i] * budget / total;
+
+	return RK_CARD_DEGRADED;
+}
+
+// called with g_storage_card_mutex held, a stream is set once its cap changes
+static void rk_storage_card_apply(const int cap_kbps[]) {
+	for (int i = 0; i < STORAGE_NUM; i++) {
+		if (cap_kbps[i] == g_storage_card.cap_kbps[i])
+			continue;
+		g_storage_card.cap_kbps[i] = cap_kbps[i];
+		if (cap_kbps[i])
+			LOG_INFO("stream %d: %d kbps for the card\n", i, cap_kbps[i]);
+		else
+			LOG_INFO("stream %d: no cap for the card\n", i);
+		if (g_storage_bitrate_set_)
+			g_storage_bitrate_set_(i, cap_kbps[i]);
+	}
+}
+
+static void rk_storage_card_metrics(void) {
+	rkipc_metric_set(rkipc_metric_gauge("rkipc_storage_card_state", NULL,
+	                                    "0 unchecked, 1 ok, 2 degraded, 3 failed"),
+	                 g_storage_card.state);
+	rkipc_metric_set(rkipc_metric_gauge("rkipc_storage_card_write_kbytes_per_second", NULL,
+	                                    "Synced sequential write speed of the card"),
+	                 g_storage_card.result.seq_write_kbps);
+	rkipc_metric_set(rkipc_metric_gauge("rkipc_storage_card_write_max_ms", NULL,
+	                                    "Slowest synced random write of the card"),
+	                 g_storage_card.result.rand_write_max_ms);
+}
+
+// the mount ID of /proc/self/mountinfo, a new one for every mount, -1 when not mounted
+static int rkipc_storage_mount_id(const char *mount_path) {
+	char line[MAX_STRLINE_LEN], point[RKIPC_MAX_FILE_PATH_LEN];
+	int id, mount_id = -1;
+	FILE *fp;
+
+	fp = fopen("/proc/self/mountinfo", "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		// the last one mounted there is on top
+		if (sscanf(line, "%d %*d %*s %*s %255s", &id, point) == 2 && !strcmp(point, mount_path))
+			mount_id = id;
+	}
+	fclose(fp);
+
+	return mount_id;
+}
+
+// before the scan thread, nothing writes to the card while it is checked. The card is
+// mounted by then, storage:card_check_samples is opt-in and card_check refuses to sample
+// a partition that is mounted, see card_check_tool for a card that is not.
+static void rkipc_storage_card_check(rkipc_storage_handle *pHandle, const char *mount_path) {
+	rk_card_check_config_s config;
+	rk_card_check_result_s result;
+	int cap_kbps[STORAGE_NUM] = {0}, state = RK_CARD_UNCHECKED, measured;
+	int mount_id = rkipc_storage_mount_id(mount_path);
+
+	// a video restart restarts storage as well, the card it measured is still mounted, only
+	// the streams it is graded against may have changed
+	pthread_mutex_lock(&g_storage_card_mutex);
+	measured = mount_id >= 0 && mount_id == g_storage_card.mount_id &&
+	           g_storage_card.state != RK_CARD_UNCHECKED &&
+	           !strcmp(g_storage_card.dev_path, pHandle->dev_sta.dev_path);
+	if (measured)
+		result = g_storage_card.result;
+	pthread_mutex_unlock(&g_storage_card_mutex);
+	if (rk_param_get_int("storage:card_check", 1)) {
+		config.file_mb = rk_param_get_int("storage:card_check_mb", 8);
+		config.random_writes = rk_param_get_int("storage:card_check_random", 64);
+		config.capacity_samples = rk_param_get_int("storage:card_check_samples", 0);
+		if (measured)
+			LOG_INFO("%s: measured on mount %d already\n", pHandle->dev_sta.dev_path, mount_id);
+		else
+			rk_card_check(pHandle->dev_sta.dev_path, mount_path, &config, &result);
+		state = rk_storage_card_grade(&result, cap_kbps);
+	} else {
+		memset(&result, 0, sizeof(result));
+	}
+	LOG_INFO("%s: card %s\n", pHandle->dev_sta.dev_path,
+	         state == RK_CARD_OK         ? "ok"
+	         : state == RK_CARD_DEGRADED ? "degraded"
+	         : state == RK_CARD_FAILED   ? "failed"
+	                                     : "unchecked");
+	pthread_mutex_lock(&g_storage_card_mutex);
+	g_storage_card.result = result;
+	g_storage_card.state = state;
+	snprintf(g_storage_card.dev_path, sizeof(g_storage_card.dev_path), "%s",
+	         pHandle->dev_sta.dev_path);
+	g_storage_card.mount_id = mount_id;
+	rk_storage_card_apply(cap_kbps);
+	rk_storage_card_metrics();
+	pthread_mutex_unlock(&g_storage_card_mutex);
+	if (state == RK_CARD_FAILED) {
+		for (int i = 0; i < STORAGE_NUM - 1; i++)
+			record_flag[i] = 0;
+	}
+}
+
+static void rkipc_storage_card_remove(void) {
+	int cap_kbps[STORAGE_NUM] = {0};
+
+	pthread_mutex_lock(&g_storage_card_mutex);
+	memset(&g_storage_card.result, 0, sizeof(g_storage_card.result));
+	g_storage_card.state = RK_CARD_UNCHECKED;
+	g_storage_card.mount_id = -1;
+	rk_storage_card_apply(cap_kbps);
+	rk_storage_card_metrics();
+	pthread_mutex_unlock(&g_storage_card_mutex);
+}
+
 static int rkipc_storage_dev_add(char *dev, rkipc_storage_handle *pHandle) {
 	int ret;
 	rkipc_str_dev_attr dev_attr;
@@ -809,6 +1030,7 @@ static int rkipc_storage_dev_add(char *dev, rkipc_storage_handle *pHandle) {
 		return ret;
 	}
 
+	rkipc_storage_card_check(pHandle, dev_attr.mount_path);
 	pHandle->dev_sta.mount_status = DISK_SCANNING;
 	if (pthread_create(&pHandle->dev_sta.file_scan_tid, NULL, rkipc_storage_file_scan_thread,
 	                   (void *)pHandle))
@@ -952,12 +1174,13 @@ static int rkipc_storage_msg_rec_cb(void *hd, int msg, void *data, int data_len,
 			LOG_INFO("recognized dev_path\n");
 			for (int i = 0; i < STORAGE_NUM - 1; i++) {
 				snprintf(entry, 127, "storage.%d:enable", i);
-				if (rk_param_get_int(entry, 0) == 1) {
+				if (rk_param_get_int(entry, 0) == 1 &&
+				    g_storage_card.state != RK_CARD_FAILED) {
 					LOG_INFO("start record!\n");
 					record_flag[i] = 1;
 					rk_storage_muxer_deinit_by_id(i);
 					rk_storage_muxer_init_by_id(i);
-				} else if (rk_param_get_int(entry, 0) == 0) {
+				} else {
 					record_flag[i] = 0;
 					rk_storage_muxer_deinit_by_id(i);
 				}
@@ -974,6 +1197,7 @@ static int rkipc_storage_msg_rec_cb(void *hd, int msg, void *data, int data_len,
 			record_flag[i] = 0;
 			rk_storage_muxer_deinit_by_id(i);
 		}
+		rkipc_storage_card_remove();
 		break;
 	case MSG_DEV_CHANGED:
 		break;
@@ -1204,6 +1428,7 @@ static int rkipc_storage_para_init(rkipc_storage_handle *pstHandle,
 				pstHandle->dev_attr.folder_attr[i].sort_cond = pstDevAttr->folder_attr[i].sort_cond;
 				pstHandle->dev_attr.folder_attr[i].num_limit = pstDevAttr->folder_attr[i].num_limit;
 				pstHandle->dev_attr.folder_attr[i].limit = pstDevAttr->folder_attr[i].limit;
+				pstHandle->dev_attr.folder_attr[i].pool = pstDevAttr->folder_attr[i].pool;
 				sprintf(pstHandle->dev_attr.folder_attr[i].folder_path,
 				        pstDevAttr->folder_attr[i].folder_path);
 			}
@@ -1249,6 +1474,7 @@ static int rkipc_storage_auto_delete_init(rkipc_storage_handle *pstHandle) {
 	         pstHandle->dev_sta.dev_attr_1);
 	if (!rkipc_storage_get_mount_dev(dev_attr.mount_path, pstHandle->dev_sta.dev_path,
 	                                 pstHandle->dev_sta.dev_type, pstHandle->dev_sta.dev_attr_1)) {
+		rkipc_storage_card_check(pstHandle, dev_attr.mount_path);
 		pstHandle->dev_sta.mount_status = DISK_SCANNING;
 		if (pthread_create(&(pstHandle->dev_sta.file_scan_tid), NULL,
 		                   rkipc_storage_file_scan_thread, (void *)(pstHandle))) {
@@ -1625,6 +1851,132 @@ int rkipc_storage_current_path_set(char *value) { return 0; }
 // 	return out;
 // }
 
+static void rk_storage_metrics_register(int id) {
+	storage_metrics_s *metrics = &g_storage_metrics[id];
+	char labels[32];
+
+	snprintf(labels, sizeof(labels), "stream=\"%d\",type=\"video\"", id);
+	metrics->video_frames = rkipc_metric_counter("rkipc_storage_frames_total", labels,
+	                                             "Frames written to the record muxer");
+	snprintf(labels, sizeof(labels), "stream=\"%d\",type=\"audio\"", id);
+	metrics->audio_frames = rkipc_metric_counter("rkipc_storage_frames_total", labels,
+	                                             "Frames written to the record muxer");
+	snprintf(labels, sizeof(labels), "stream=\"%d\"", id);
+	metrics->bytes = rkipc_metric_counter("rkipc_storage_bytes_total", labels,
+	                                      "Bytes written to the record muxer");
+	metrics->dropped = rkipc_metric_counter("rkipc_storage_dropped_frames_total", labels,
+	                                        "Frames the record muxer refused, it fell behind");
+	// includes waiting for a file switch, the old file is closed with the lock held
+	metrics->write_us =
+	    rkipc_metric_histogram("rkipc_storage_write_us", labels, "Time a writer spends writing",
+	                           rkipc_metric_us_bounds, RKIPC_METRIC_US_BOUNDS);
+	metrics->fragment_write_us = rkipc_metric_histogram(
+	    "rkipc_storage_fragment_write_us", labels, "Time a fragment takes to reach the disk",
+	    rkipc_metric_us_bounds, RKIPC_METRIC_US_BOUNDS);
+	metrics->files =
+	    rkipc_metric_counter("rkipc_storage_files_total", labels, "Record files opened");
+	metrics->recording =
+	    rkipc_metric_gauge("rkipc_storage_recording", labels, "1 while the muxer is recording");
+}
+
+static void rk_storage_metrics_account(storage_metrics_s *metrics, rkipc_metric_t *frames,
+                                       unsigned int buffer_size, int ret, long long begin_us) {
+	if (ret) {
+		rkipc_metric_inc(metrics->dropped);
+		return;
+	}
+	rkipc_metric_inc(frames);
+	rkipc_metric_add(metrics->bytes, buffer_size);
+	rkipc_metric_observe(metrics->write_us, rkipc_metrics_now_us() - begin_us);
+}
+
+static int64_t rkipc_storage_wall_time_ms() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// without storage.N:pool_slots the pool takes the quota of the folder
+static void rk_storage_pool_open(int id) {
+	rk_storage_muxer_struct *muxer = &rk_storage_muxer_group[id];
+	int slots = muxer->pool_slots;
+	char entry[128];
+	struct statfs st;
+
+	if (slots <= 0) {
+		if (statfs(muxer->record_path, &st))
+			return;
+		if (rk_param_get_int("storage:num_limit_enable", 0)) {
+			snprintf(entry, 127, "storage.%d:file_max_num", id);
+			slots = rk_param_get_int(entry, 300);
+		} else {
+			snprintf(entry, 127, "storage.%d:video_quota", id);
+			slots = (int64_t)st.f_blocks * st.f_bsize / 100 * rk_param_get_int(entry, 30) /
+			        muxer->pool_slot_bytes;
+		}
+	}
+	muxer->segment_pool = rk_segment_pool_open(muxer->record_path, slots, muxer->pool_slot_bytes);
+}
+
+// called with g_rkmuxer_mutex held
+static void rk_storage_muxer_open(int id) {
+	rk_storage_muxer_struct *muxer = &rk_storage_muxer_group[id];
+	rk_fmp4_config_s config;
+	int64_t slot_bytes = 0;
+
+	// the old recording of a slot is gone before the index of the new one exists
+	if (muxer->pool && !muxer->segment_pool)
+		rk_storage_pool_open(id);
+	if (muxer->segment_pool && !rk_segment_pool_take(muxer->segment_pool, muxer->file_name))
+		slot_bytes = muxer->pool_slot_bytes;
+	if (rk_param_get_int("storage:segment_index", 1))
+		muxer->index = rk_segment_index_open(muxer->file_name, rkipc_storage_wall_time_ms());
+	if (!muxer->fragmented) {
+		rkmuxer_init(id, NULL, muxer->file_name, &muxer->g_video_param, &muxer->g_audio_param);
+		return;
+	}
+	memset(&config, 0, sizeof(config));
+	config.video_codec = muxer->g_video_param.codec;
+	config.width = muxer->g_video_param.width;
+	config.height = muxer->g_video_param.height;
+	config.audio_codec = muxer->g_audio_param.codec;
+	config.sample_rate = muxer->g_audio_param.sample_rate;
+	config.channels = muxer->g_audio_param.channels;
+	if (muxer->sub_stream >= 0) {
+		config.sub_video_codec = muxer->sub_codec;
+		config.sub_width = muxer->sub_width;
+		config.sub_height = muxer->sub_height;
+	}
+	if (muxer->metadata)
+		config.metadata_mime = RKIPC_DETECTIONS_MIME;
+	config.fsync_fragments = rk_param_get_int("storage:fmp4_fsync", 1);
+	config.fragment_ms = rk_param_get_int("storage:fmp4_fragment_ms", 4000);
+	config.queue_bytes = rk_param_get_int("storage:fmp4_queue_kb", 8192) * 1024;
+	config.index = muxer->index;
+	config.slot_bytes = slot_bytes;
+	config.write_us = g_storage_metrics[id].fragment_write_us;
+	muxer->fmp4 = rk_fmp4_open(muxer->file_name, &config);
+}
+
+// called with g_rkmuxer_mutex held
+static void rk_storage_muxer_close(int id) {
+	rk_storage_muxer_struct *muxer = &rk_storage_muxer_group[id];
+
+	muxer->g_record_run_ = 0;
+	if (muxer->fmp4) {
+		rk_fmp4_close(muxer->fmp4);
+		muxer->fmp4 = NULL;
+	} else {
+		rkmuxer_deinit(id);
+		// rkmuxer offsets are only known from the moov it writes on close
+		if (muxer->index && rk_segment_index_build(muxer->index) < 0)
+			LOG_WARN("[%d] no key frame index for the last file\n", id);
+	}
+	rk_segment_index_close(muxer->index);
+	muxer->index = NULL;
+}
+
 static void *rk_storage_record(void *arg) {
 	int *id_ptr = arg;
 	int id = *id_ptr;
@@ -1633,26 +1985,26 @@ static void *rk_storage_record(void *arg) {
 	while (g_storage_record_flag[id] && record_flag[id] == 1) {
 		time_t t = time(NULL);
 		struct tm tm = *localtime(&t);
+		// the recovery scan skips file_name, it must not change before the old file is closed
+		pthread_mutex_lock(&g_rkmuxer_mutex);
+		rk_storage_muxer_close(id);
 		snprintf(rk_storage_muxer_group[id].file_name, 512, "%s/%d%02d%02d%02d%02d%02d.%s",
 		         rk_storage_muxer_group[id].record_path, tm.tm_year + 1900, tm.tm_mon + 1,
 		         tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
 		         rk_storage_muxer_group[id].file_format);
 		LOG_INFO("[%d], file_name is %s\n", id, rk_storage_muxer_group[id].file_name);
-		pthread_mutex_lock(&g_rkmuxer_mutex);
-		rk_storage_muxer_group[id].g_record_run_ = 0;
-		rkmuxer_deinit(id);
-		rkmuxer_init(id, NULL, rk_storage_muxer_group[id].file_name,
-		             &rk_storage_muxer_group[id].g_video_param,
-		             &rk_storage_muxer_group[id].g_audio_param);
+		rk_storage_muxer_open(id);
 		rk_storage_muxer_group[id].g_record_run_ = 1;
 		pthread_mutex_unlock(&g_rkmuxer_mutex);
+		rkipc_metric_inc(g_storage_metrics[id].files);
+		rkipc_metric_set(g_storage_metrics[id].recording, 1);
 		rk_signal_wait(rk_storage_muxer_group[id].g_storage_signal,
 		               rk_storage_muxer_group[id].file_duration * 1000);
 	}
 	pthread_mutex_lock(&g_rkmuxer_mutex);
-	rk_storage_muxer_group[id].g_record_run_ = 0;
-	rkmuxer_deinit(id);
+	rk_storage_muxer_close(id);
 	pthread_mutex_unlock(&g_rkmuxer_mutex);
+	rkipc_metric_set(g_storage_metrics[id].recording, 0);
 
 	return NULL;
 }
@@ -1664,6 +2016,7 @@ static int rk_storage_muxer_init_by_id(int id) {
 	const char *folder_name = NULL;
 
 	rk_storage_muxer_group[id].id = id;
+	rk_storage_metrics_register(id);
 	// set rk_storage_muxer_group[id].g_video_param
 	rk_storage_muxer_group[id].g_video_param.level = 52;
 	snprintf(entry, 127, "video.%d:width", id);
@@ -1730,6 +2083,54 @@ static int rk_storage_muxer_init_by_id(int id) {
 	rk_storage_muxer_group[id].file_format = rk_param_get_string(entry, "mp4");
 	snprintf(entry, 127, "storage.%d:file_duration", id);
 	rk_storage_muxer_group[id].file_duration = rk_param_get_int(entry, 60);
+	snprintf(entry, 127, "storage.%d:fragmented", id);
+	rk_storage_muxer_group[id].fragmented =
+	    rk_param_get_int(entry, 0) && !strcmp(rk_storage_muxer_group[id].file_format, "mp4");
+	// main, sub, audio and metadata in one file take the fragmented writer, rkmuxer has
+	// a single video track
+	snprintf(entry, 127, "storage.%d:sub_stream", id);
+	rk_storage_muxer_group[id].sub_stream = rk_param_get_int(entry, -1);
+	snprintf(entry, 127, "storage.%d:metadata", id);
+	rk_storage_muxer_group[id].metadata = rk_param_get_int(entry, 0);
+	if (rk_storage_muxer_group[id].sub_stream == id ||
+	    rk_storage_muxer_group[id].sub_stream >= STORAGE_NUM)
+		rk_storage_muxer_group[id].sub_stream = -1;
+	if (rk_storage_muxer_group[id].sub_stream >= 0) {
+		int sub = rk_storage_muxer_group[id].sub_stream;
+
+		snprintf(entry, 127, "video.%d:output_data_type", sub);
+		snprintf(rk_storage_muxer_group[id].sub_codec,
+		         sizeof(rk_storage_muxer_group[id].sub_codec), "%s",
+		         rk_param_get_string(entry, "H.264"));
+		snprintf(entry, 127, "video.%d:width", sub);
+		rk_storage_muxer_group[id].sub_width = rk_param_get_int(entry, 704);
+		snprintf(entry, 127, "video.%d:height", sub);
+		rk_storage_muxer_group[id].sub_height = rk_param_get_int(entry, 576);
+	}
+	// a slot is only told apart from the older recording in it by the fragmented writer
+	snprintf(entry, 127, "storage.%d:pool", id);
+	rk_storage_muxer_group[id].pool =
+	    rk_param_get_int(entry, 0) && !strcmp(rk_storage_muxer_group[id].file_format, "mp4");
+	snprintf(entry, 127, "storage.%d:pool_slots", id);
+	rk_storage_muxer_group[id].pool_slots = rk_param_get_int(entry, 0);
+	// without storage.N:pool_slot_mb a slot holds file_duration at the max bitrate of the
+	// recorded streams, plus a quarter, a longer recording grows its slot
+	snprintf(entry, 127, "storage.%d:pool_slot_mb", id);
+	rk_storage_muxer_group[id].pool_slot_bytes = (int64_t)rk_param_get_int(entry, 0) << 20;
+	if (rk_storage_muxer_group[id].pool_slot_bytes <= 0) {
+		int64_t bit_rate = rk_storage_muxer_group[id].g_video_param.bit_rate;
+
+		if (rk_storage_muxer_group[id].sub_stream >= 0) {
+			snprintf(entry, 127, "video.%d:max_rate", rk_storage_muxer_group[id].sub_stream);
+			bit_rate += rk_param_get_int(entry, 512) * 1024;
+		}
+		bit_rate = bit_rate / 8 * rk_storage_muxer_group[id].file_duration * 5 / 4;
+		rk_storage_muxer_group[id].pool_slot_bytes = ((bit_rate >> 20) + 1) << 20;
+	}
+	if ((rk_storage_muxer_group[id].sub_stream >= 0 || rk_storage_muxer_group[id].metadata ||
+	     rk_storage_muxer_group[id].pool) &&
+	    !strcmp(rk_storage_muxer_group[id].file_format, "mp4"))
+		rk_storage_muxer_group[id].fragmented = 1;
 
 	snprintf(entry, 127, "storage.%d:enable", id);
 	if (rk_param_get_int(entry, 0) == 0) {
@@ -1775,6 +2176,8 @@ int rk_storage_muxer_deinit_by_id(int id) {
 		rk_signal_destroy(rk_storage_muxer_group[id].g_storage_signal);
 		rk_storage_muxer_group[id].g_storage_signal = NULL;
 	}
+	rk_segment_pool_close(rk_storage_muxer_group[id].segment_pool);
+	rk_storage_muxer_group[id].segment_pool = NULL;
 	LOG_DEBUG("end\n");
 
 	return 0;
@@ -1799,6 +2202,17 @@ int rk_storage_init() {
 	return 0;
 }
 
+// the caps in force go to a callback registered after the card was graded
+void rk_storage_bitrate_set_callback_register(rk_storage_bitrate_set_callback callback_ptr) {
+	pthread_mutex_lock(&g_storage_card_mutex);
+	g_storage_bitrate_set_ = callback_ptr;
+	for (int i = 0; callback_ptr && i < STORAGE_NUM; i++) {
+		if (g_storage_card.cap_kbps[i])
+			callback_ptr(i, g_storage_card.cap_kbps[i]);
+	}
+	pthread_mutex_unlock(&g_storage_card_mutex);
+}
+
 int rk_storage_deinit() {
 	for (int i = 0; i < STORAGE_NUM; i++) {
 		rk_storage_muxer_deinit_by_id(i);
@@ -1806,15 +2220,49 @@ int rk_storage_deinit() {
 	rkipc_storage_free_dev_attr(g_sd_dev_attr);
 	rkipc_storage_manager_deinit(g_sd_phandle);
 	g_sd_phandle = NULL;
+	// the VENC limits go with the video restart around it, init grades the card again and
+	// sets the caps anew, the measured result is kept for the same mount
+	pthread_mutex_lock(&g_storage_card_mutex);
+	memset(g_storage_card.cap_kbps, 0, sizeof(g_storage_card.cap_kbps));
+	pthread_mutex_unlock(&g_storage_card_mutex);
 
 	return 0;
 }
 
+// called with g_rkmuxer_mutex held, frames of a stream that is the sub track of another
+// recording go into its file as well
+static void rk_storage_write_sub_video(int id, unsigned char *buffer, unsigned int buffer_size,
+                                       int64_t present_time, int key_frame) {
+	long long begin_us = rkipc_metrics_now_us();
+	int ret;
+
+	for (int i = 0; i < STORAGE_NUM; i++) {
+		if (rk_storage_muxer_group[i].sub_stream != id || !rk_storage_muxer_group[i].fmp4 ||
+		    !rk_storage_muxer_group[i].g_record_run_)
+			continue;
+		ret = rk_fmp4_write_sub_video(rk_storage_muxer_group[i].fmp4, buffer, buffer_size,
+		                              present_time, key_frame);
+		rk_storage_metrics_account(&g_storage_metrics[i], g_storage_metrics[i].video_frames,
+		                           buffer_size, ret, begin_us);
+	}
+}
+
 int rk_storage_write_video_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                                  int64_t present_time, int key_frame) {
+	long long begin_us = rkipc_metrics_now_us();
+	int ret;
+
 	pthread_mutex_lock(&g_rkmuxer_mutex);
-	if (rk_storage_muxer_group[id].g_record_run_)
-		rkmuxer_write_video_frame(id, buffer, buffer_size, present_time, key_frame);
+	rk_storage_write_sub_video(id, buffer, buffer_size, present_time, key_frame);
+	if (rk_storage_muxer_group[id].g_record_run_) {
+		if (rk_storage_muxer_group[id].fmp4)
+			ret = rk_fmp4_write_video(rk_storage_muxer_group[id].fmp4, buffer, buffer_size,
+			                          present_time, key_frame);
+		else
+			ret = rkmuxer_write_video_frame(id, buffer, buffer_size, present_time, key_frame);
+		rk_storage_metrics_account(&g_storage_metrics[id], g_storage_metrics[id].video_frames,
+		                           buffer_size, ret, begin_us);
+	}
 	pthread_mutex_unlock(&g_rkmuxer_mutex);
 
 	return 0;
@@ -1822,32 +2270,60 @@ int rk_storage_write_video_frame(int id, unsigned char *buffer, unsigned int buf
 
 int rk_storage_write_audio_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                                  int64_t present_time) {
+	long long begin_us = rkipc_metrics_now_us();
+	int ret;
+
 	pthread_mutex_lock(&g_rkmuxer_mutex);
-	if (rk_storage_muxer_group[id].g_record_run_)
-		rkmuxer_write_audio_frame(id, buffer, buffer_size, present_time);
+	if (rk_storage_muxer_group[id].g_record_run_) {
+		if (rk_storage_muxer_group[id].fmp4)
+			ret = rk_fmp4_write_audio(rk_storage_muxer_group[id].fmp4, buffer, buffer_size,
+			                          present_time);
+		else
+			ret = rkmuxer_write_audio_frame(id, buffer, buffer_size, present_time);
+		rk_storage_metrics_account(&g_storage_metrics[id], g_storage_metrics[id].audio_frames,
+		                           buffer_size, ret, begin_us);
+	}
 	pthread_mutex_unlock(&g_rkmuxer_mutex);
 
 	return 0;
 }
 
+int rk_storage_write_metadata(int id, const unsigned char *buffer, unsigned int buffer_size,
+                              int64_t present_time) {
+	int ret = -1;
+
+	if (id < 0 || id >= STORAGE_NUM)
+		return -1;
+	pthread_mutex_lock(&g_rkmuxer_mutex);
+	if (rk_storage_muxer_group[id].g_record_run_ && rk_storage_muxer_group[id].fmp4)
+		ret = rk_fmp4_write_metadata(rk_storage_muxer_group[id].fmp4, buffer, buffer_size,
+		                             present_time);
+	pthread_mutex_unlock(&g_rkmuxer_mutex);
+
+	return ret;
+}
+
 int rk_storage_record_start() {
 	// only main stream, id default is 0
 	LOG_INFO("start\n");
+	if (g_storage_card.state == RK_CARD_FAILED) {
+		LOG_ERROR("the card failed its check\n");
+		return -1;
+	}
 	time_t t = time(NULL);
 	struct tm tm = *localtime(&t);
 
+	pthread_mutex_lock(&g_rkmuxer_mutex);
+	rk_storage_muxer_close(0);
 	snprintf(rk_storage_muxer_group[0].file_name, 512, "%s/%d%02d%02d%02d%02d%02d.%s",
 	         rk_storage_muxer_group[0].record_path, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
 	         tm.tm_hour, tm.tm_min, tm.tm_sec, rk_storage_muxer_group[0].file_format);
 	LOG_INFO("file_name is %s\n", rk_storage_muxer_group[0].file_name);
-	pthread_mutex_lock(&g_rkmuxer_mutex);
-	rk_storage_muxer_group[0].g_record_run_ = 0;
-	rkmuxer_deinit(0);
-	rkmuxer_init(0, NULL, rk_storage_muxer_group[0].file_name,
-	             &rk_storage_muxer_group[0].g_video_param,
-	             &rk_storage_muxer_group[0].g_audio_param);
+	rk_storage_muxer_open(0);
 	rk_storage_muxer_group[0].g_record_run_ = 1;
 	pthread_mutex_unlock(&g_rkmuxer_mutex);
+	rkipc_metric_inc(g_storage_metrics[0].files);
+	rkipc_metric_set(g_storage_metrics[0].recording, 1);
 	LOG_INFO("end\n");
 
 	return 0;
@@ -1857,9 +2333,9 @@ int rk_storage_record_stop() {
 	// only main stream, id default is 0
 	LOG_INFO("start\n");
 	pthread_mutex_lock(&g_rkmuxer_mutex);
-	rk_storage_muxer_group[0].g_record_run_ = 0;
-	rkmuxer_deinit(0);
+	rk_storage_muxer_close(0);
 	pthread_mutex_unlock(&g_rkmuxer_mutex);
+	rkipc_metric_set(g_storage_metrics[0].recording, 0);
 	LOG_INFO("end\n");
 
 	return 0;
@@ -1869,3 +2345,92 @@ int rk_storage_record_statue_get(int *value) {
 	*value = rk_storage_muxer_group[0].g_record_run_;
 	return 0;
 }
+
+int rk_storage_card_status_get(int *value) {
+	*value = g_storage_card.state;
+	return 0;
+}
+
+int rk_storage_card_info_get(char *value, int len) {
+	const rk_card_check_result_s *r = &g_storage_card.result;
+
+	pthread_mutex_lock(&g_storage_card_mutex);
+	snprintf(value, len,
+	         "state=%d\ntype=%s\nname=%s\nmanfid=0x%06x\noemid=0x%04x\nserial=0x%08x\n"
+	         "date=%s\ncsd_bytes=%lld\ndevice_bytes=%lld\nseq_write_kbps=%d\n"
+	         "rand_write_iops=%d\nrand_write_max_ms=%d\ncapacity_samples=%d\n"
+	         "capacity_bad=%d\ncap_kbps=%d,%d\n",
+	         g_storage_card.state, r->type, r->name, r->manfid, r->oemid, r->serial, r->date,
+	         (long long)r->csd_bytes, (long long)r->device_bytes, r->seq_write_kbps,
+	         r->rand_write_iops, r->rand_write_max_ms, r->capacity_samples, r->capacity_bad,
+	         g_storage_card.cap_kbps[0], g_storage_card.cap_kbps[1]);
+	pthread_mutex_unlock(&g_storage_card_mutex);
+
+	return 0;
+}
+
+int rk_storage_mark_event(int flags) {
+	int64_t now = rkipc_storage_wall_time_ms();
+
+	pthread_mutex_lock(&g_rkmuxer_mutex);
+	for (int i = 0; i < STORAGE_NUM; i++) {
+		if (rk_storage_muxer_group[i].g_record_run_)
+			rk_segment_index_add_event(rk_storage_muxer_group[i].index, now, flags);
+	}
+	pthread_mutex_unlock(&g_rkmuxer_mutex);
+
+	return 0;
+}
+
+int rk_storage_find_segment(int id, int64_t wall_time_ms, int next, char *path, int len,
+                            int64_t *start_time_ms) {
+	rkipc_storage_handle *handle = (rkipc_storage_handle *)g_sd_phandle;
+	rkipc_str_folder *folder = NULL;
+	char name[32], segment[RKIPC_MAX_FILE_PATH_LEN] = "";
+	int cmp;
+
+	if (id < 0 || id >= STORAGE_NUM || !handle || rk_segment_index_name(wall_time_ms, name, 32))
+		return -1;
+	for (int i = 0; i < handle->dev_sta.folder_num; i++) {
+		if (!strcmp(handle->dev_sta.folder[i].cpath, rk_storage_muxer_group[id].record_path))
+			folder = &handle->dev_sta.folder[i];
+	}
+	if (!folder)
+		return -1;
+	// names sort by start time, the list itself may be sorted by modification time
+	pthread_mutex_lock(&folder->mutex);
+	for (rkipc_str_file *file = folder->file_list_first; file; file = file->next) {
+		cmp = strncmp(file->filename, name, 14);
+		if (next ? cmp > 0 && (!segment[0] || strcmp(file->filename, segment) < 0)
+		         : cmp <= 0 && strcmp(file->filename, segment) > 0)
+			snprintf(segment, sizeof(segment), "%s", file->filename);
+	}
+	pthread_mutex_unlock(&folder->mutex);
+	if (!segment[0] || snprintf(path, len, "%s/%s", folder->cpath, segment) >= len)
+		return -1;
+	if (start_time_ms)
+		*start_time_ms = rk_segment_index_name_time(segment);
+
+	return 0;
+}
+
+int rk_storage_get_key_frame(int id, int track, int64_t wall_time_ms, int before,
+                             unsigned char **buffer, int *size, int64_t *key_time_ms) {
+	rk_segment_index_record_s record;
+	char path[RKIPC_MAX_FILE_PATH_LEN * 3];
+	int ret;
+
+	if (rk_storage_find_segment(id, wall_time_ms, 0, path, sizeof(path), NULL))
+		return -1;
+	// the sidecar only indexes the main stream, the sub track is looked up in the file
+	if (track == RK_STORAGE_TRACK_SUB)
+		ret = rk_segment_index_scan_key_frame(path, 1, wall_time_ms, before, buffer, size,
+		                                      &record);
+	else
+		ret = rk_segment_index_read_key_frame(path, wall_time_ms, before, buffer, size,
+		                                      &record);
+	if (!ret && key_time_ms)
+		*key_time_ms = record.wall_time_ms;
+
+	return ret;
+}
@@ -20,8 +20,12 @@
 #include <sys/vfs.h>
 
 //#include "cJSON.h"
+#include "card_check.h"
 #include "common.h"
+#include "detections.h"
+#include "fmp4.h"
 #include "rkmuxer.h"
+#include "segment_pool.h"
 
 #define RKIPC_MAX_FORMAT_ID_LEN 8
 #define RKIPC_MAX_VOLUME_LEN 11
@@ -85,6 +89,7 @@ typedef struct {
 	rkipc_sort_condition sort_cond;
 	bool num_limit;
 	int limit;
+	bool pool; // the folder is a recording pool, it never deletes by num or space
 } rkipc_str_folder_attr;
 
 typedef struct {
@@ -190,17 +195,57 @@ typedef struct rk_storage_muxer_struct_ {
 	pthread_t record_thread_id;
 	VideoParam g_video_param;
 	AudioParam g_audio_param;
+	int fragmented;
+	int sub_stream; // storage id whose frames are the second video track, -1 for none
+	char sub_codec[16];
+	int sub_width;
+	int sub_height;
+	int metadata; // with a timed metadata track of NPU detections, see detections.h
+	int pool;     // records over preallocated files, see segment_pool.h
+	int pool_slots;
+	int64_t pool_slot_bytes;
+	rk_segment_pool_t *segment_pool;
+	rk_fmp4_t *fmp4;
+	rk_segment_index_t *index;
 } rk_storage_muxer_struct;
 
+enum {
+	RK_STORAGE_TRACK_MAIN, // the video of the recording
+	RK_STORAGE_TRACK_SUB,  // the sub stream recorded in the same file
+};
+
+// a card that cannot take the recorded streams at their max_rate caps the bitrate of the
+// video stream, kbps 0 lifts the cap
+typedef int (*rk_storage_bitrate_set_callback)(int stream_id, int kbps);
+
 int rk_storage_init();
 int rk_storage_deinit();
+void rk_storage_bitrate_set_callback_register(rk_storage_bitrate_set_callback callback_ptr);
 int rk_storage_write_video_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                                  int64_t present_time, int key_frame);
 int rk_storage_write_audio_frame(int id, unsigned char *buffer, unsigned int buffer_size,
                                  int64_t present_time);
+// a sample of the metadata track of recording id, present_time on the video clock
+int rk_storage_write_metadata(int id, const unsigned char *buffer, unsigned int buffer_size,
+                              int64_t present_time);
 int rk_storage_record_start();
 int rk_storage_record_stop();
 int rk_storage_record_statue_get(int *value);
+// RK_CARD_* of the mounted card, RK_CARD_UNCHECKED without one
+int rk_storage_card_status_get(int *value);
+// the measurements behind it, one "key=value" per line
+int rk_storage_card_info_get(char *value, int len);
+// RK_SEGMENT_EVENT_* seen now, kept per second in the index of the files being recorded
+int rk_storage_mark_event(int flags);
+// the segment of recording id starting last at or before wall_time_ms, with next set the
+// first one starting after it
+int rk_storage_find_segment(int id, int64_t wall_time_ms, int next, char *path, int len,
+                            int64_t *start_time_ms);
+// the I frame of a track, RK_STORAGE_TRACK_*, of recording id at or before wall_time_ms
+// with before set, else the nearest, Annex B with the parameter sets first, *buffer is to
+// be freed
+int rk_storage_get_key_frame(int id, int track, int64_t wall_time_ms, int before,
+                             unsigned char **buffer, int *size, int64_t *key_time_ms);
 
 // int rkipc_storage_quota_get(int id, char **value);    // TODO, current only sd card
 int rkipc_storage_quota_set(int id, char *value); // TODO
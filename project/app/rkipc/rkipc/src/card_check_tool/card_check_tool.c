@@ -0,0 +1,114 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// The check rkipc runs on a card when it is inserted, see common/storage/card_check.h,
+// against any mounted partition: a card in a reader, a loop device, or a device mapper
+// target that delays writes or wraps around like a counterfeit card. The capacity samples
+// write to the partition itself, they are taken only with -s and only from a partition
+// that is not mounted, the mount path is left out then.
+//   card_check_tool [options] <partition> [mount path]
+//   card_check_tool -c <csd>  decodes the capacity of a CSD register
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "card_check.h"
+#include "log.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "card_check_tool.c"
+
+int enable_minilog = 0;
+int rkipc_log_level = LOG_LEVEL_WARN;
+
+static rk_card_check_config_s g_config = {8, 64, 0};
+static const char *g_csd;
+
+static const char short_options[] = "m:r:s:c:vh";
+static const struct option long_options[] = {{"mb", required_argument, NULL, 'm'},
+                                             {"random", required_argument, NULL, 'r'},
+                                             {"samples", required_argument, NULL, 's'},
+                                             {"csd", required_argument, NULL, 'c'},
+                                             {"verbose", no_argument, NULL, 'v'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s [options] <partition> [mount path]\n"
+	        "Options:\n"
+	        "-m | --mb       size of the check file and of the sequential write, default is 8\n"
+	        "-r | --random   synced 4 KiB writes at random offsets, default is 64\n"
+	        "-s | --samples  scattered capacity samples of an unmounted partition, default is 0\n"
+	        "-c | --csd      decode the capacity of a CSD register given in hexadecimal\n"
+	        "-v | --verbose  log what is measured\n"
+	        "-h | --help     for help\n\n",
+	        argv[0]);
+}
+
+int main(int argc, char **argv) {
+	rk_card_check_result_s result;
+
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case 'm':
+			g_config.file_mb = atoi(optarg);
+			break;
+		case 'r':
+			g_config.random_writes = atoi(optarg);
+			break;
+		case 's':
+			g_config.capacity_samples = atoi(optarg);
+			break;
+		case 'c':
+			g_csd = optarg;
+			break;
+		case 'v':
+			rkipc_log_level = LOG_LEVEL_INFO;
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			return 0;
+		default:
+			usage_tip(stderr, argv);
+			return -1;
+		}
+	}
+	if (g_csd) {
+		printf("%lld\n", (long long)rk_card_check_csd_bytes(g_csd));
+		return 0;
+	}
+	if (argc - optind < 1 || argc - optind > 2 || g_config.file_mb < 0 ||
+	    g_config.random_writes < 0 || g_config.capacity_samples < 0) {
+		usage_tip(stderr, argv);
+		return -1;
+	}
+
+	rk_card_check(argv[optind], optind + 1 < argc ? argv[optind + 1] : NULL, &g_config, &result);
+	printf("type               %s\n", result.type[0] ? result.type : "-");
+	printf("name               %s\n", result.name[0] ? result.name : "-");
+	printf("manfid             0x%06x\n", result.manfid);
+	printf("oemid              0x%04x\n", result.oemid);
+	printf("serial             0x%08x\n", result.serial);
+	printf("date               %s\n", result.date[0] ? result.date : "-");
+	printf("csd bytes          %lld\n", (long long)result.csd_bytes);
+	printf("disk bytes         %lld\n", (long long)result.device_bytes);
+	printf("seq write KiB/s    %d\n", result.seq_write_kbps);
+	printf("rand write IOPS    %d\n", result.rand_write_iops);
+	printf("rand write max ms  %d\n", result.rand_write_max_ms);
+	printf("capacity samples   %d\n", result.capacity_samples);
+	printf("capacity bad       %d", result.capacity_bad);
+	if (result.capacity_bad)
+		printf(", first at %lld", (long long)result.capacity_bad_offset);
+	printf("\nwrite error        %d\n", result.write_error);
+
+	return result.capacity_bad || result.write_error ? 1 : 0;
+}
@@ -0,0 +1,533 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// NPU detections carried in the video and in recordings, see common/detections.h.
+//   detections_tool /mnt/sdcard/video0/20230601120000.mp4
+// prints the detections SEI of every frame and the samples of the metadata track, and
+// whether both agree. A file that is not MP4 is read as H.264 or H.265 Annex B, -5 for
+// H.265. With -t the tool records synthetic detections the way the encoder threads do,
+// reads the file back, checks every payload bit for bit and prints what they cost:
+//   detections_tool -t /tmp/detections -o 8 -r 10 -k 2048
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "detections.h"
+#include "fmp4.h"
+#include "log.h"
+#include "mp4_reader.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "detections_tool.c"
+
+#define TOOL_NAME_LEN 256
+#define TOOL_NPU_LATENCY_US 80000
+
+int enable_minilog = 0;
+int rkipc_log_level = LOG_LEVEL_WARN;
+
+static const char *g_test_dir;
+static int g_h265;
+static int g_objects = 4;
+static int g_rate = 10;
+static int g_kbps = 2048;
+static int g_fps = 25;
+static int g_seconds = 60;
+static int g_video;
+
+typedef struct {
+	int64_t pts;
+	unsigned char payload[RKIPC_DETECTIONS_PAYLOAD_MAX];
+	int size;
+	rkipc_detections_s d;
+} tool_expect_s;
+
+static const char short_options[] = "5t:o:r:k:f:s:v:h";
+static const struct option long_options[] = {{"h265", no_argument, NULL, '5'},
+                                             {"test", required_argument, NULL, 't'},
+                                             {"objects", required_argument, NULL, 'o'},
+                                             {"rate", required_argument, NULL, 'r'},
+                                             {"kbps", required_argument, NULL, 'k'},
+                                             {"fps", required_argument, NULL, 'f'},
+                                             {"seconds", required_argument, NULL, 's'},
+                                             {"video", required_argument, NULL, 'v'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s [options] [file]\n"
+	        "Options:\n"
+	        "-5 | --h265      an Annex B file is H.265, default is H.264\n"
+	        "-v | --video     video track of a recording, 1 for the sub stream, default is 0\n"
+	        "-t | --test      record synthetic detections in this folder and check them\n"
+	        "-o | --objects   objects of a busy scene in the test, default is 4\n"
+	        "-r | --rate      NPU results per second in the test, default is 10\n"
+	        "-k | --kbps      video bitrate the overhead is compared to, default is 2048\n"
+	        "-f | --fps       frame rate in the test, default is 25\n"
+	        "-s | --seconds   length of the test recording, default is 60\n"
+	        "-h | --help      for help\n\n",
+	        argv[0]);
+}
+
+static void tool_print(const char *what, int64_t time_us, const unsigned char *payload,
+                       int size) {
+	rkipc_detections_s d;
+
+	printf("%-5s %10.3f ", what, time_us / 1000000.0);
+	if (rkipc_detections_unpack(payload, size, &d)) {
+		printf("%d bytes that do not unpack\n", size);
+		return;
+	}
+	printf("frame %u, %u ms later, %d objects\n", d.frame_id, d.delay_us / 1000, d.count);
+	for (int i = 0; i < d.count; i++)
+		printf("      id %u type %u score %u box %u,%u %u,%u\n", d.object[i].track_id,
+		       d.object[i].type, d.object[i].score, d.object[i].x0, d.object[i].y0,
+		       d.object[i].x1, d.object[i].y1);
+}
+
+static int tool_dump_mp4(rkipc_mp4_reader_t *reader) {
+	const rkipc_mp4_info_s *info = rkipc_mp4_reader_info(reader);
+	unsigned char *buf = NULL, sei[RKIPC_DETECTIONS_PAYLOAD_MAX];
+	int64_t sei_time = -1;
+	int frames = 0, seis = 0, samples = 0, agree = 0, sei_size = 0, size;
+	uint32_t cap = 0;
+	rkipc_mp4_sample_s sample;
+	unsigned char *p;
+
+	printf("%s, metadata track %s\n", info->h265 ? "H.265" : "H.264",
+	       info->metadata_mime[0] ? info->metadata_mime : "none");
+	while (!rkipc_mp4_reader_next(reader, &sample)) {
+		if (sample.audio)
+			continue;
+		if (sample.size > cap) {
+			p = realloc(buf, sample.size);
+			if (!p)
+				break;
+			buf = p;
+			cap = sample.size;
+		}
+		if (rkipc_mp4_reader_read(reader, &sample, buf))
+			break;
+		if (sample.metadata) {
+			samples++;
+			tool_print("meta", sample.time_us, buf, sample.size);
+			// the sample goes with the SEI of the video frame at its time
+			agree += sei_time == sample.time_us && sei_size == (int)sample.size &&
+			         !memcmp(sei, buf, sei_size);
+			continue;
+		}
+		frames++;
+		size = rkipc_detections_sei_find(info->h265, info->nal_length_size, buf, sample.size,
+		                                 sei, sizeof(sei));
+		if (size <= 0)
+			continue;
+		seis++;
+		sei_time = sample.time_us;
+		sei_size = size;
+		tool_print("sei", sample.time_us, sei, size);
+	}
+	free(buf);
+	printf("%d frames, %d with detections SEI, %d metadata samples, %d of them agree\n", frames,
+	       seis, samples, agree);
+
+	return 0;
+}
+
+static int tool_dump_annexb(const char *path) {
+	unsigned char *buf, sei[RKIPC_DETECTIONS_PAYLOAD_MAX];
+	int start, end, seis = 0, size;
+	struct stat st;
+	FILE *fp;
+
+	if (stat(path, &st) || !(buf = malloc(st.st_size + 1))) {
+		printf("can not read %s\n", path);
+		return -1;
+	}
+	fp = fopen(path, "rb");
+	if (!fp || fread(buf, 1, st.st_size, fp) != (size_t)st.st_size) {
+		printf("can not read %s\n", path);
+		if (fp)
+			fclose(fp);
+		free(buf);
+		return -1;
+	}
+	fclose(fp);
+	// NAL unit by NAL unit, an elementary stream has no times
+	for (start = 0; start + 3 <= st.st_size; start = end) {
+		for (end = start + 3; end + 3 <= st.st_size; end++) {
+			if (!buf[end] && !buf[end + 1] && buf[end + 2] == 1)
+				break;
+		}
+		if (end + 3 > st.st_size)
+			end = st.st_size;
+		size = rkipc_detections_sei_find(g_h265, 0, buf + start, end - start, sei, sizeof(sei));
+		if (size <= 0)
+			continue;
+		printf("@%-9d", start);
+		tool_print("sei", 0, sei, size);
+		seis++;
+	}
+	free(buf);
+	printf("%d detections SEI\n", seis);
+
+	return 0;
+}
+
+// n objects of random boxes, with values that put runs of zero bytes into the payload
+// and a track id of the largest size
+static void tool_scene(rkipc_detections_s *d, int n, unsigned int *seed) {
+	rkipc_detection_s *o;
+
+	d->count = n;
+	for (int i = 0; i < n; i++) {
+		o = &d->object[i];
+		o->track_id = i == 3 ? 0xffffffff : i;
+		o->type = i % 3 == 0 ? 0 : rand_r(seed) % 8;
+		o->score = i % 5 == 1 ? 0 : 30 + rand_r(seed) % 70;
+		o->x0 = i % 4 == 0 ? 0 : rand_r(seed) % 9000;
+		o->y0 = i % 4 == 0 ? 0 : rand_r(seed) % 9000;
+		o->x1 = o->x0 + 128 + rand_r(seed) % 872;
+		o->y1 = i % 4 == 2 ? 10000 : o->y0 + 256;
+	}
+}
+
+static int tool_same(const rkipc_detections_s *a, const rkipc_detections_s *b) {
+	if (a->frame_id != b->frame_id || a->delay_us != b->delay_us || a->count != b->count)
+		return 0;
+	return !memcmp(a->object, b->object, a->count * sizeof(a->object[0]));
+}
+
+// an Annex B frame of size bytes, SPS and PPS in front of an I frame, random bytes
+// without zeros so no start code shows up in them
+static int tool_frame(unsigned char *out, int size, int key, unsigned int *seed) {
+	static const unsigned char sps[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40,
+	                                    0x78, 0x02, 0x27, 0xe5, 0x84, 0x00, 0x00, 0x03, 0x00,
+	                                    0x04, 0x00, 0x00, 0x03, 0x00, 0xca, 0x3c, 0x60, 0xc6,
+	                                    0x58};
+	static const unsigned char pps[] = {0, 0, 0, 1, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+	int len = 0;
+
+	if (key) {
+		memcpy(out, sps, sizeof(sps));
+		memcpy(out + sizeof(sps), pps, sizeof(pps));
+		len = sizeof(sps) + sizeof(pps);
+	}
+	memcpy(out + len, "\0\0\0\1", 4);
+	out[len + 4] = key ? 0x65 : 0x41;
+	for (int i = 5; i < size; i++)
+		out[len + i] = 1 + rand_r(seed) % 255;
+
+	return len + size;
+}
+
+// SEI of both codecs in front of a slice, found again in Annex B and with NAL lengths
+static int tool_test_sei(unsigned int *seed) {
+	unsigned char frame[256], payload[RKIPC_DETECTIONS_PAYLOAD_MAX];
+	unsigned char found[RKIPC_DETECTIONS_PAYLOAD_MAX], *buf = NULL, *avcc;
+	rkipc_detections_s d, back;
+	int cap = 0, size, len, ret = 0, start, pos;
+
+	for (int h265 = 0; h265 < 2; h265++) {
+		for (int n = 0; n <= RKIPC_DETECTIONS_MAX; n++) {
+			memset(&d, 0, sizeof(d));
+			d.frame_id = n * 7919;
+			d.delay_us = n * 40000;
+			tool_scene(&d, n, seed);
+			len = rkipc_detections_pack(&d, payload, sizeof(payload));
+			memcpy(frame, "\0\0\0\1", 4);
+			frame[4] = h265 ? 1 << 1 : 0x41; // TRAIL_R or a non-IDR slice
+			frame[5] = 1;
+			for (int i = 6; i < (int)sizeof(frame); i++)
+				frame[i] = 1 + rand_r(seed) % 255;
+			size = rkipc_detections_sei_frame(h265, frame, sizeof(frame), payload, len, &buf,
+			                                  &cap);
+			if (len < 0 || size < 0 ||
+			    rkipc_detections_sei_find(h265, 0, buf, size, found, sizeof(found)) != len ||
+			    memcmp(found, payload, len) || rkipc_detections_unpack(found, len, &back) ||
+			    !tool_same(&d, &back) || memcmp(buf + size - sizeof(frame), frame, 256)) {
+				printf("%s SEI of %d objects does not come back\n", h265 ? "H.265" : "H.264",
+				       n);
+				ret = -1;
+				continue;
+			}
+			// the same with the start codes turned into four byte lengths, as in MP4
+			avcc = malloc(size);
+			if (!avcc)
+				break;
+			memcpy(avcc, buf, size);
+			for (start = 4; start < size; start = pos + 4) {
+				for (pos = start; pos + 4 <= size && memcmp(avcc + pos, "\0\0\0\1", 4); pos++)
+					;
+				if (pos + 4 > size)
+					pos = size;
+				avcc[start - 4] = (pos - start) >> 24;
+				avcc[start - 3] = (pos - start) >> 16;
+				avcc[start - 2] = (pos - start) >> 8;
+				avcc[start - 1] = pos - start;
+			}
+			if (rkipc_detections_sei_find(h265, 4, avcc, size, found, sizeof(found)) != len ||
+			    memcmp(found, payload, len)) {
+				printf("%s SEI of %d objects is not found with NAL lengths\n",
+				       h265 ? "H.265" : "H.264", n);
+				ret = -1;
+			}
+			free(avcc);
+		}
+	}
+	free(buf);
+
+	return ret;
+}
+
+static int tool_test(void) {
+	const int frame_size = g_kbps * 1000 / 8 / g_fps;
+	const int frames = g_seconds * g_fps, every = g_fps / g_rate > 0 ? g_fps / g_rate : 1;
+	unsigned char *frame, *buf = NULL, found[RKIPC_DETECTIONS_PAYLOAD_MAX];
+	char path[TOOL_NAME_LEN * 2];
+	tool_expect_s *expect;
+	rkipc_detections_s d, back;
+	rk_fmp4_config_s config;
+	rk_fmp4_t *fmp4;
+	rkipc_mp4_reader_t *reader;
+	rkipc_mp4_sample_s sample;
+	const rkipc_mp4_info_s *info;
+	unsigned int seed = 1;
+	int64_t pts, pending_pts = -1, video_bytes = 0, sei_bytes = 0, meta_bytes = 0;
+	int cap = 0, size, len, num = 0, pending = -1, results = 0, busy = 0, ret = 0;
+	int seis = 0, samples = 0, lossless = 0, aligned = 0, v = 0, m = 0;
+	FILE *es;
+
+	if (tool_test_sei(&seed))
+		ret = -1;
+	else
+		printf("SEI of 0 to %d objects comes back from H.264 and H.265, Annex B and MP4\n",
+		       RKIPC_DETECTIONS_MAX);
+	if (mkdir(g_test_dir, 0755) && access(g_test_dir, W_OK)) {
+		printf("can not use %s\n", g_test_dir);
+		return -1;
+	}
+	frame = malloc(frame_size * 4 + 64);
+	expect = calloc(frames, sizeof(*expect));
+	if (!frame || !expect) {
+		free(frame);
+		free(expect);
+		return -1;
+	}
+	memset(&config, 0, sizeof(config));
+	config.video_codec = "H.264";
+	config.width = 1920;
+	config.height = 1080;
+	config.metadata_mime = RKIPC_DETECTIONS_MIME;
+	config.queue_bytes = 64 * 1024 * 1024;
+	snprintf(path, sizeof(path), "%s/detections.h264", g_test_dir);
+	es = fopen(path, "wb");
+	snprintf(path, sizeof(path), "%s/detections.mp4", g_test_dir);
+	fmp4 = rk_fmp4_open(path, &config);
+	if (!fmp4 || !es) {
+		printf("can not record to %s\n", g_test_dir);
+		ret = -1;
+		goto out;
+	}
+	// the encoder thread of rv1106_ipc: frames go to the NPU at its rate, a result comes
+	// back a little later and leaves with the next encoded frame
+	for (int i = 0; i < frames; i++) {
+		pts = (int64_t)i * 1000000 / g_fps;
+		if (pending >= 0 && pts >= pending_pts + TOOL_NPU_LATENCY_US) {
+			memset(&d, 0, sizeof(d));
+			d.frame_id = pending;
+			// a third of the time the scene is busy, else empty
+			busy = (results / 30) % 3 == 2;
+			tool_scene(&d, busy ? 1 + rand_r(&seed) % g_objects : 0, &seed);
+			rkipc_detections_update(&d);
+			results++;
+			pending = -1;
+		}
+		if (i % every == 0 && pending < 0) {
+			rkipc_detections_frame_pts(i, pts);
+			pending = i;
+			pending_pts = pts;
+		}
+		size = tool_frame(frame, i % g_fps ? frame_size * 15 / 16 : frame_size * 4,
+		                  i % g_fps == 0, &seed);
+		video_bytes += size;
+		len = rkipc_detections_take(0, pts, expect[num].payload, RKIPC_DETECTIONS_PAYLOAD_MAX);
+		if (len > 0) {
+			expect[num].pts = pts;
+			expect[num].size = len;
+			rkipc_detections_unpack(expect[num].payload, len, &expect[num].d);
+			len = rkipc_detections_sei_frame(0, frame, size, expect[num].payload, len, &buf,
+			                                 &cap);
+			if (len < 0) {
+				printf("no slice to put the SEI in front of\n");
+				ret = -1;
+				break;
+			}
+			sei_bytes += len - size;
+			size = len;
+			len = expect[num++].size;
+		}
+		fwrite(len > 0 ? buf : frame, 1, size, es);
+		rk_fmp4_write_video(fmp4, len > 0 ? buf : frame, size, pts, i % g_fps == 0);
+		if (len > 0) {
+			rk_fmp4_write_metadata(fmp4, expect[num - 1].payload, len, pts);
+			meta_bytes += len;
+		}
+	}
+out:
+	if (es)
+		fclose(es);
+	rk_fmp4_close(fmp4);
+	if (ret)
+		goto free;
+
+	// every payload back from the SEI of its frame and from the metadata track
+	reader = rkipc_mp4_reader_open_metadata(path, 0);
+	if (!reader) {
+		printf("can not read %s back\n", path);
+		ret = -1;
+		goto free;
+	}
+	info = rkipc_mp4_reader_info(reader);
+	if (strcmp(info->metadata_mime, RKIPC_DETECTIONS_MIME)) {
+		printf("metadata track of %s is \"%s\"\n", path, info->metadata_mime);
+		ret = -1;
+	}
+	cap = 0;
+	free(buf);
+	buf = NULL;
+	while (!rkipc_mp4_reader_next(reader, &sample)) {
+		if ((int)sample.size > cap) {
+			unsigned char *p = realloc(buf, sample.size);
+
+			if (!p)
+				break;
+			buf = p;
+			cap = sample.size;
+		}
+		if (rkipc_mp4_reader_read(reader, &sample, buf))
+			break;
+		if (sample.metadata) {
+			if (m >= num || sample.size != (uint32_t)expect[m].size ||
+			    memcmp(buf, expect[m].payload, sample.size)) {
+				printf("metadata sample %d at %.3f s differs\n", m, sample.time_us / 1e6);
+				ret = -1;
+			} else {
+				samples++;
+				aligned += sample.time_us == expect[m].pts;
+			}
+			m++;
+			continue;
+		}
+		len = rkipc_detections_sei_find(info->h265, info->nal_length_size, buf, sample.size,
+		                                found, sizeof(found));
+		if (len <= 0) {
+			if (v < num && sample.time_us == expect[v].pts) {
+				printf("SEI %d at %.3f s is missing\n", v, sample.time_us / 1e6);
+				ret = -1;
+				v++;
+			}
+			continue;
+		}
+		if (v >= num || sample.time_us != expect[v].pts || len != expect[v].size ||
+		    memcmp(found, expect[v].payload, len) || rkipc_detections_unpack(found, len, &back) ||
+		    !tool_same(&back, &expect[v].d)) {
+			printf("SEI %d at %.3f s differs\n", v, sample.time_us / 1e6);
+			ret = -1;
+		} else {
+			seis++;
+			lossless++;
+		}
+		v++;
+	}
+	rkipc_mp4_reader_close(reader);
+	if (seis != num || samples != num || aligned != num)
+		ret = -1;
+
+	printf("%d s at %d fps, %d kbps, %d NPU results per second, up to %d objects\n", g_seconds,
+	       g_fps, g_kbps, g_rate, g_objects);
+	printf("%d results, %d sent, %d SEI and %d metadata samples read back, %d lossless, "
+	       "%d at the time of their frame\n",
+	       results, num, seis, samples, lossless, aligned);
+	printf("SEI %.2f kbps, %.3f%% of the video, %.1f bytes per result\n",
+	       sei_bytes * 8.0 / g_seconds / 1000, sei_bytes * 100.0 / video_bytes,
+	       num ? (double)sei_bytes / num : 0.0);
+	printf("metadata track %.2f kbps, %.1f bytes per sample\n", meta_bytes * 8.0 / g_seconds / 1000,
+	       num ? (double)meta_bytes / num : 0.0);
+	printf("%s\n", ret ? "FAILED" : "OK");
+free:
+	free(buf);
+	free(frame);
+	free(expect);
+
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	rkipc_mp4_reader_t *reader;
+	int ret;
+
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case '5':
+			g_h265 = 1;
+			break;
+		case 't':
+			g_test_dir = optarg;
+			break;
+		case 'o':
+			g_objects = atoi(optarg);
+			break;
+		case 'r':
+			g_rate = atoi(optarg);
+			break;
+		case 'k':
+			g_kbps = atoi(optarg);
+			break;
+		case 'f':
+			g_fps = atoi(optarg);
+			break;
+		case 's':
+			g_seconds = atoi(optarg);
+			break;
+		case 'v':
+			g_video = atoi(optarg);
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			return 0;
+		default:
+			usage_tip(stderr, argv);
+			return -1;
+		}
+	}
+	if (g_test_dir) {
+		if (g_objects < 1 || g_objects > RKIPC_DETECTIONS_MAX || g_rate < 1 || g_kbps < 64 ||
+		    g_fps < 1 || g_seconds < 1) {
+			usage_tip(stderr, argv);
+			return -1;
+		}
+		return tool_test() ? 1 : 0;
+	}
+	if (optind >= argc) {
+		usage_tip(stderr, argv);
+		return -1;
+	}
+	reader = rkipc_mp4_reader_open_metadata(argv[optind], g_video);
+	if (!reader)
+		return tool_dump_annexb(argv[optind]) ? 1 : 0;
+	ret = tool_dump_mp4(reader);
+	rkipc_mp4_reader_close(reader);
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,391 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Throughput of the UTF-8/GBK transcoder of common/network on ASCII, CJK and mixed
+// text, and of OSD string decoding against iconv opened for every string as osd.c used
+// to do. With -c the files of a corpus folder and -n mutations of them go through
+// every conversion, checking that:
+//   - nothing is written past the destination size, whatever the size, and on
+//     success nothing past the returned length
+//   - valid UTF-8 of GBK characters comes back unchanged through GBK
+//   - GBK that converts comes back unchanged through UTF-8
+//   - the wide string is terminated and never longer than the input
+// src/encode_bench/corpus holds the seeds. Built with ENCODE_BENCH_LIBFUZZER the same
+// checks are a libFuzzer target instead.
+#include <dirent.h>
+#include <getopt.h>
+#include <iconv.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+#include "RK_encode.h"
+#include "encode_utils.h"
+
+#define BENCH_TEXT_SIZE (1024 * 1024)
+#define BENCH_OSD_LEN 64
+#define FUZZ_MAX 4096
+#define FUZZ_CANARY 0xa5
+
+static int g_rounds = 20;
+static const char *g_corpus;
+static int g_mutations = 100000;
+
+static const char short_options[] = "r:c:n:h";
+static const struct option long_options[] = {{"rounds", required_argument, NULL, 'r'},
+                                             {"corpus", required_argument, NULL, 'c'},
+                                             {"mutations", required_argument, NULL, 'n'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s [options]\n"
+	        "Options:\n"
+	        "-r | --rounds     passes over 1 MiB of each text, default is 20\n"
+	        "-c | --corpus     check the files of this folder instead of the benchmark\n"
+	        "-n | --mutations  random mutations of the corpus, default is 100000\n"
+	        "-h | --help       for help\n\n",
+	        argv[0]);
+}
+
+static int fuzz_failures;
+
+static void fuzz_fail(const char *what, const unsigned char *data, int len) {
+	fuzz_failures++;
+	printf("%s:", what);
+	for (int i = 0; i < len && i < 32; i++)
+		printf(" %02x", data[i]);
+	printf("%s\n", len > 32 ? " ..." : "");
+}
+
+static int fuzz_canary_ok(const unsigned char *buf, int from, int size) {
+	for (int i = from; i < size; i++) {
+		if (buf[i] != FUZZ_CANARY)
+			return 0;
+	}
+
+	return 1;
+}
+
+// every conversion of data with a destination of each size up to the full one
+static void fuzz_one(const unsigned char *data, int len) {
+	static unsigned char in[FUZZ_MAX], gbk[FUZZ_MAX * 2 + 16], utf8[FUZZ_MAX * 3 + 16];
+	static unsigned char back[FUZZ_MAX * 3 + 16];
+	static wchar_t wide[FUZZ_MAX + 2];
+	int ret, full, question = 0, n;
+
+	if (len > FUZZ_MAX)
+		len = FUZZ_MAX;
+	// the conversions take non-const input
+	memcpy(in, data, len);
+	for (int i = 0; i < len; i++)
+		question += in[i] == '?';
+
+	// UTF-8 to GBK, then back when no character was replaced
+	memset(gbk, FUZZ_CANARY, sizeof(gbk));
+	full = RK_encode_utf8_to_gbk(in, len, gbk, len * 2);
+	if (full > len * 2 || !fuzz_canary_ok(gbk, full < 0 ? len * 2 : full, sizeof(gbk)))
+		fuzz_fail("utf8_to_gbk writes past its output", in, len);
+	for (int size = 0; full > 0 && size < full; size += 1 + size / 8) {
+		memset(gbk, FUZZ_CANARY, sizeof(gbk));
+		ret = RK_encode_utf8_to_gbk(in, len, gbk, size);
+		if (ret >= 0 || !fuzz_canary_ok(gbk, size, sizeof(gbk)))
+			fuzz_fail("utf8_to_gbk overruns a short output", in, len);
+	}
+	if (full >= 0) {
+		full = RK_encode_utf8_to_gbk(in, len, gbk, len * 2);
+		n = 0;
+		for (int i = 0; i < full; i++) {
+			// the trail byte of a GBK character may be '?' too
+			if (gbk[i] >= 0x80)
+				i++;
+			else
+				n += gbk[i] == '?';
+		}
+		if (n == question) {
+			ret = RK_encode_gbk_to_utf8(gbk, full, back, sizeof(back));
+			if (ret != len || memcmp(back, in, len))
+				fuzz_fail("UTF-8 does not come back through GBK", in, len);
+		}
+	}
+
+	// GBK to UTF-8, then back
+	memset(utf8, FUZZ_CANARY, sizeof(utf8));
+	full = RK_encode_gbk_to_utf8(in, len, utf8, len * 3);
+	if (full > len * 3 || !fuzz_canary_ok(utf8, full < 0 ? len * 3 : full, sizeof(utf8)))
+		fuzz_fail("gbk_to_utf8 writes past its output", in, len);
+	for (int size = 0; full > 0 && size < full; size += 1 + size / 8) {
+		memset(utf8, FUZZ_CANARY, sizeof(utf8));
+		ret = RK_encode_gbk_to_utf8(in, len, utf8, size);
+		if (ret >= 0 || !fuzz_canary_ok(utf8, size, sizeof(utf8)))
+			fuzz_fail("gbk_to_utf8 overruns a short output", in, len);
+	}
+	if (full >= 0) {
+		full = RK_encode_gbk_to_utf8(in, len, utf8, len * 3);
+		ret = RK_encode_utf8_to_gbk(utf8, full, back, sizeof(back));
+		if (ret != len || memcmp(back, in, len))
+			fuzz_fail("GBK does not come back through UTF-8", in, len);
+	}
+
+	// UTF-8 to wide characters, as the OSD decodes its text
+	for (int size = 1; size <= len + 1; size += 1 + size / 8) {
+		wmemset(wide, 0x5a5a, FUZZ_MAX + 2);
+		ret = RK_encode_utf8_to_wchar(in, len, wide, size);
+		if (ret < 0 || ret >= size || ret > len || wide[ret] != L'\0' ||
+		    (size < FUZZ_MAX + 2 && wide[size] != 0x5a5a))
+			fuzz_fail("utf8_to_wchar", in, len);
+	}
+}
+
+#ifdef ENCODE_BENCH_LIBFUZZER
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size) {
+	fuzz_one(data, size);
+	if (fuzz_failures)
+		abort();
+
+	return 0;
+}
+#else
+static long long now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// byte flips, inserted and removed bytes and bytes of other seeds, a corpus stays short
+static int fuzz_mutate(unsigned char *buf, int len, unsigned char **seeds, int *lens, int num,
+                       unsigned int *seed) {
+	int pos, other;
+
+	for (int k = 1 + rand_r(seed) % 4; k > 0; k--) {
+		pos = len ? rand_r(seed) % len : 0;
+		switch (rand_r(seed) % 5) {
+		case 0:
+			if (len)
+				buf[pos] ^= 1 << (rand_r(seed) % 8);
+			break;
+		case 1:
+			if (len)
+				buf[pos] = rand_r(seed);
+			break;
+		case 2:
+			if (len < FUZZ_MAX) {
+				memmove(buf + pos + 1, buf + pos, len - pos);
+				buf[pos] = 0x80 + rand_r(seed) % 0x80;
+				len++;
+			}
+			break;
+		case 3:
+			if (len) {
+				memmove(buf + pos, buf + pos + 1, len - pos - 1);
+				len--;
+			}
+			break;
+		default:
+			other = rand_r(seed) % num;
+			if (lens[other] && len + 8 <= FUZZ_MAX) {
+				int from = rand_r(seed) % lens[other], n = 1 + rand_r(seed) % 8;
+
+				if (from + n > lens[other])
+					n = lens[other] - from;
+				memmove(buf + pos + n, buf + pos, len - pos);
+				memcpy(buf + pos, seeds[other] + from, n);
+				len += n;
+			}
+		}
+	}
+
+	return len;
+}
+
+static int fuzz_corpus(const char *dir) {
+	unsigned char *seeds[256], buf[FUZZ_MAX];
+	int lens[256], num = 0, len;
+	unsigned int seed = 1;
+	char path[512];
+	struct dirent *entry;
+	FILE *fp;
+	DIR *d = opendir(dir);
+
+	if (!d) {
+		printf("can not open %s\n", dir);
+		return -1;
+	}
+	while ((entry = readdir(d)) != NULL && num < 256) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		fp = fopen(path, "rb");
+		if (!fp)
+			continue;
+		seeds[num] = malloc(FUZZ_MAX);
+		lens[num] = seeds[num] ? fread(seeds[num], 1, FUZZ_MAX, fp) : 0;
+		fclose(fp);
+		if (seeds[num])
+			fuzz_one(seeds[num], lens[num]);
+		num++;
+	}
+	closedir(d);
+	if (!num) {
+		printf("no seeds in %s\n", dir);
+		return -1;
+	}
+	printf("%d seeds, %d failures\n", num, fuzz_failures);
+	for (int i = 0; i < g_mutations && fuzz_failures < 20; i++) {
+		int from = rand_r(&seed) % num;
+
+		len = lens[from];
+		memcpy(buf, seeds[from], len);
+		len = fuzz_mutate(buf, len, seeds, lens, num, &seed);
+		fuzz_one(buf, len);
+	}
+	printf("%d mutations, %d failures\n", g_mutations, fuzz_failures);
+	for (int i = 0; i < num; i++)
+		free(seeds[i]);
+
+	return fuzz_failures ? -1 : 0;
+}
+
+// SSID like ASCII, CJK ideographs, and ASCII with a CJK character every few words
+static int bench_text(unsigned char *utf8, int kind, unsigned int *seed) {
+	unsigned char c[4];
+	int len = 0, n;
+
+	while (len + 4 < BENCH_TEXT_SIZE) {
+		if (kind == 0 || (kind == 2 && rand_r(seed) % 8)) {
+			utf8[len++] = ' ' + rand_r(seed) % 95;
+			continue;
+		}
+		// the common ideographs, all of them in GBK
+		n = rk_encode_utf8_encode(0x4e00 + rand_r(seed) % 0x51a5, c);
+		memcpy(utf8 + len, c, n);
+		len += n;
+	}
+
+	return len;
+}
+
+static void bench_report(const char *name, const char *what, long long ns, long long bytes) {
+	printf("%-6s %-22s %9.1f MB/s\n", name, what, bytes * 1000.0 / ns);
+}
+
+static int bench(void) {
+	static const char *names[] = {"ascii", "cjk", "mixed"};
+	unsigned char *utf8, *gbk, *back;
+	wchar_t *wide;
+	unsigned int seed = 1;
+	int len, gbk_len, ret = 0;
+	long long begin;
+
+	utf8 = malloc(BENCH_TEXT_SIZE);
+	gbk = malloc(BENCH_TEXT_SIZE);
+	back = malloc(BENCH_TEXT_SIZE * 3 / 2);
+	wide = malloc(BENCH_TEXT_SIZE * sizeof(wchar_t));
+	if (!utf8 || !gbk || !back || !wide) {
+		ret = -1;
+		goto out;
+	}
+	for (int kind = 0; kind < 3; kind++) {
+		len = bench_text(utf8, kind, &seed);
+		gbk_len = RK_encode_utf8_to_gbk(utf8, len, gbk, BENCH_TEXT_SIZE);
+		if (gbk_len < 0 || RK_encode_gbk_to_utf8(gbk, gbk_len, back, BENCH_TEXT_SIZE * 3 / 2) !=
+		                       len || memcmp(back, utf8, len)) {
+			printf("%s text does not come back\n", names[kind]);
+			ret = -1;
+			continue;
+		}
+		begin = now_ns();
+		for (int i = 0; i < g_rounds; i++)
+			RK_encode_utf8_to_gbk(utf8, len, gbk, BENCH_TEXT_SIZE);
+		bench_report(names[kind], "utf8 to gbk", now_ns() - begin, (long long)len * g_rounds);
+		begin = now_ns();
+		for (int i = 0; i < g_rounds; i++)
+			RK_encode_gbk_to_utf8(gbk, gbk_len, back, BENCH_TEXT_SIZE * 3 / 2);
+		bench_report(names[kind], "gbk to utf8", now_ns() - begin,
+		             (long long)gbk_len * g_rounds);
+		begin = now_ns();
+		for (int i = 0; i < g_rounds; i++)
+			RK_encode_utf8_to_wchar(utf8, len, wide, BENCH_TEXT_SIZE);
+		bench_report(names[kind], "utf8 to wchar", now_ns() - begin, (long long)len * g_rounds);
+	}
+
+	// OSD strings are short, the cost used to be iconv_open and iconv_close
+	len = bench_text(utf8, 2, &seed);
+	for (int kind = 0; kind < 2; kind++) {
+		int strings = len / BENCH_OSD_LEN * g_rounds / 4;
+
+		begin = now_ns();
+		for (int i = 0; i < strings; i++) {
+			const unsigned char *s = utf8 + (i * BENCH_OSD_LEN) % (len - BENCH_OSD_LEN);
+			int n = BENCH_OSD_LEN;
+
+			// whole characters only
+			while (n && (s[n] & 0xc0) == 0x80)
+				n--;
+			if (kind) {
+				RK_encode_utf8_to_wchar(s, n, wide, BENCH_OSD_LEN + 1);
+				continue;
+			}
+			size_t in_left = n, out_left = (BENCH_OSD_LEN + 1) * sizeof(wchar_t);
+			char *in = (char *)s, *out = (char *)wide;
+			iconv_t cd = iconv_open("WCHAR_T", "UTF-8");
+
+			if (cd == (iconv_t)-1) {
+				printf("no iconv from UTF-8\n");
+				break;
+			}
+			iconv(cd, &in, &in_left, &out, &out_left);
+			iconv_close(cd);
+		}
+		printf("%-6s %-22s %9.2f us/string\n", "osd",
+		       kind ? "RK_encode_utf8_to_wchar" : "iconv per string",
+		       (now_ns() - begin) / 1000.0 / strings);
+	}
+out:
+	free(utf8);
+	free(gbk);
+	free(back);
+	free(wide);
+
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case 'r':
+			g_rounds = atoi(optarg);
+			break;
+		case 'c':
+			g_corpus = optarg;
+			break;
+		case 'n':
+			g_mutations = atoi(optarg);
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			return 0;
+		default:
+			usage_tip(stderr, argv);
+			return -1;
+		}
+	}
+	if (g_rounds < 1 || g_mutations < 0) {
+		usage_tip(stderr, argv);
+		return -1;
+	}
+	if (g_corpus)
+		return fuzz_corpus(g_corpus) ? 1 : 0;
+
+	return bench() ? 1 : 0;
+}
+#endif
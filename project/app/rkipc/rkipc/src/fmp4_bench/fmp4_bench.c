@@ -0,0 +1,386 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Recording cost of the main and sub stream in two files, one writer each as storage.0
+// and storage.1 do, against one multi-track file with storage.0:sub_stream=1:
+//   fmp4_bench -d /mnt/sdcard/bench -t 600
+// The same synthetic H.264 and AAC frames go through rk_fmp4 as fast as the disk takes
+// them, audio into both files of the first run as rkipc does. Printed per run are the CPU
+// time of the process, the write calls and bytes from /proc/self/io, the fragments, each
+// one an fdatasync with fsync_fragments 1, and the files left behind.
+#include <dirent.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fmp4.h"
+#include "log.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "fmp4_bench.c"
+
+#define BENCH_NAME_LEN 256
+#define BENCH_AUDIO_RATE 16000
+#define BENCH_AUDIO_FRAME 1024
+
+int enable_minilog = 0;
+int rkipc_log_level = LOG_LEVEL_WARN;
+
+static const char *g_dir = "/tmp/fmp4_bench";
+static int g_seconds = 600;
+static int g_segment = 60;
+static int g_main_kbps = 2048;
+static int g_sub_kbps = 512;
+static int g_fps = 25;
+static int g_gop = 50;
+static int g_fsync = 1;
+static int g_metadata;
+
+typedef struct {
+	const char *name;
+	int files;
+	int fragments;
+	int dropped;
+	double cpu_ms;
+	double wall_ms;
+	long long write_calls;
+	long long write_bytes;
+} bench_result_s;
+
+typedef struct {
+	unsigned char *data; // random bytes without zeros, no start code shows up in them
+	int size;
+	unsigned int seed;
+} bench_source_s;
+
+static const char short_options[] = "d:t:l:m:s:r:g:f:Mh";
+static const struct option long_options[] = {{"dir", required_argument, NULL, 'd'},
+                                             {"time", required_argument, NULL, 't'},
+                                             {"length", required_argument, NULL, 'l'},
+                                             {"main", required_argument, NULL, 'm'},
+                                             {"sub", required_argument, NULL, 's'},
+                                             {"fps", required_argument, NULL, 'r'},
+                                             {"gop", required_argument, NULL, 'g'},
+                                             {"fsync", required_argument, NULL, 'f'},
+                                             {"metadata", no_argument, NULL, 'M'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s [options]\n"
+	        "Options:\n"
+	        "-d | --dir       output folder, emptied first, default is /tmp/fmp4_bench\n"
+	        "-t | --time      seconds of recording, default is 600\n"
+	        "-l | --length    seconds per segment, default is 60\n"
+	        "-m | --main      main stream kbps, default is 2048\n"
+	        "-s | --sub       sub stream kbps, default is 512\n"
+	        "-r | --fps       frame rate of both streams, default is 25\n"
+	        "-g | --gop       frames from I frame to I frame, default is 50\n"
+	        "-f | --fsync     fdatasync every n fragments, default is 1\n"
+	        "-M | --metadata  a metadata sample per second in the multi-track file\n"
+	        "-h | --help      for help\n\n",
+	        argv[0]);
+}
+
+static int bench_source_init(bench_source_s *src, int size) {
+	src->data = malloc(size);
+	if (!src->data)
+		return -1;
+	src->size = size;
+	src->seed = 1;
+	for (int i = 0; i < size; i++)
+		src->data[i] = 1 + rand_r(&src->seed) % 255;
+
+	return 0;
+}
+
+// an Annex B frame of about size bytes, SPS and PPS in front of an I frame
+static int bench_frame(bench_source_s *src, unsigned char *out, int size, int key) {
+	static const unsigned char sps[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40,
+	                                    0x78, 0x02, 0x27, 0xe5, 0x84, 0x00, 0x00, 0x03, 0x00,
+	                                    0x04, 0x00, 0x00, 0x03, 0x00, 0xca, 0x3c, 0x60, 0xc6,
+	                                    0x58};
+	static const unsigned char pps[] = {0, 0, 0, 1, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+	int len = 0, offset;
+
+	if (size > src->size)
+		size = src->size;
+	if (key) {
+		memcpy(out, sps, sizeof(sps));
+		memcpy(out + sizeof(sps), pps, sizeof(pps));
+		len = sizeof(sps) + sizeof(pps);
+	}
+	memcpy(out + len, "\0\0\0\1", 4);
+	out[len + 4] = key ? 0x65 : 0x41;
+	offset = rand_r(&src->seed) % (src->size - size + 1);
+	memcpy(out + len + 5, src->data + offset, size - 5);
+
+	return len + size;
+}
+
+static long long bench_proc_io(const char *key) {
+	char line[128];
+	long long value = -1;
+	int len = strlen(key);
+	FILE *fp = fopen("/proc/self/io", "r");
+
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		if (!strncmp(line, key, len) && line[len] == ':')
+			value = atoll(line + len + 1);
+	}
+	fclose(fp);
+
+	return value;
+}
+
+static double bench_cpu_ms() {
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0 +
+	       usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+}
+
+static double bench_now_ms() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+static void bench_clean(const char *dir) {
+	char path[BENCH_NAME_LEN * 2];
+	struct dirent *entry;
+	DIR *d = opendir(dir);
+
+	if (!d)
+		return;
+	while ((entry = readdir(d)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		remove(path);
+	}
+	closedir(d);
+}
+
+// the top level moof boxes of the files in dir
+static int bench_count(const char *dir, int *files) {
+	char path[BENCH_NAME_LEN * 2];
+	unsigned char h[8];
+	struct dirent *entry;
+	int fragments = 0;
+	long long offset, size;
+	FILE *fp;
+	DIR *d = opendir(dir);
+
+	*files = 0;
+	if (!d)
+		return 0;
+	while ((entry = readdir(d)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		fp = fopen(path, "rb");
+		if (!fp)
+			continue;
+		(*files)++;
+		for (offset = 0; !fseeko(fp, offset, SEEK_SET) && fread(h, 8, 1, fp) == 1;
+		     offset += size) {
+			size = ((long long)h[0] << 24) | (h[1] << 16) | (h[2] << 8) | h[3];
+			if (size < 8)
+				break;
+			fragments += !memcmp(h + 4, "moof", 4);
+		}
+		fclose(fp);
+	}
+	closedir(d);
+
+	return fragments;
+}
+
+// multi 0 records main and sub in a file each, 1 records both in one file
+static int bench_run(int multi, bench_result_s *result) {
+	const int main_size = g_main_kbps * 1000 / 8 / g_fps, sub_size = g_sub_kbps * 1000 / 8 / g_fps;
+	rk_fmp4_t *main_fmp4 = NULL, *sub_fmp4 = NULL;
+	rk_fmp4_config_s config;
+	bench_source_s src;
+	unsigned char *frame, adts[400];
+	char path[BENCH_NAME_LEN * 2];
+	int64_t frames = (int64_t)g_seconds * g_fps, audio = 0, pts, audio_pts;
+	long long calls, bytes;
+	double cpu, wall;
+	int size, key;
+
+	// I frames are about four times the size of the average frame
+	if (bench_source_init(&src, main_size * 8 + 4096))
+		return -1;
+	frame = malloc(src.size + 64);
+	if (!frame) {
+		free(src.data);
+		return -1;
+	}
+	bench_clean(g_dir);
+	memset(result, 0, sizeof(*result));
+	result->name = multi ? "one multi-track file" : "two files";
+	memset(&config, 0, sizeof(config));
+	config.video_codec = "H.264";
+	config.audio_codec = "AAC";
+	config.sample_rate = BENCH_AUDIO_RATE;
+	config.channels = 1;
+	config.fsync_fragments = g_fsync;
+	config.queue_bytes = 64 * 1024 * 1024;
+	// ADTS of a 1 channel LC frame at 16 kHz, about 32 kbps
+	memset(adts, 0x21, sizeof(adts));
+	adts[0] = 0xff;
+	adts[1] = 0xf1;
+	adts[2] = 0x60;
+	adts[3] = 0x40 | (sizeof(adts) >> 11);
+	adts[4] = sizeof(adts) >> 3;
+	adts[5] = ((sizeof(adts) & 7) << 5) | 0x1f;
+	adts[6] = 0xfc;
+
+	cpu = bench_cpu_ms();
+	wall = bench_now_ms();
+	calls = bench_proc_io("syscw");
+	bytes = bench_proc_io("wchar");
+	for (int64_t i = 0; i < frames; i++) {
+		pts = i * 1000000 / g_fps;
+		if (i % ((int64_t)g_segment * g_fps) == 0) {
+			rk_fmp4_close(main_fmp4);
+			rk_fmp4_close(sub_fmp4);
+			sub_fmp4 = NULL;
+			config.width = 1920;
+			config.height = 1080;
+			config.sub_video_codec = multi ? "H.264" : NULL;
+			config.sub_width = 704;
+			config.sub_height = 576;
+			config.metadata_mime = multi && g_metadata ? "application/json" : NULL;
+			snprintf(path, sizeof(path), "%s/main_%05lld.mp4", g_dir,
+			         (long long)(i / g_fps));
+			main_fmp4 = rk_fmp4_open(path, &config);
+			if (!multi) {
+				config.width = 704;
+				config.height = 576;
+				snprintf(path, sizeof(path), "%s/sub_%05lld.mp4", g_dir,
+				         (long long)(i / g_fps));
+				sub_fmp4 = rk_fmp4_open(path, &config);
+			}
+			if (!main_fmp4 || (!multi && !sub_fmp4)) {
+				printf("can not record to %s\n", g_dir);
+				break;
+			}
+		}
+		key = i % g_gop == 0;
+		size = bench_frame(&src, frame, key ? main_size * 4 : main_size * 15 / 16, key);
+		result->dropped += rk_fmp4_write_video(main_fmp4, frame, size, pts, key) < 0;
+		size = bench_frame(&src, frame, key ? sub_size * 4 : sub_size * 15 / 16, key);
+		if (multi)
+			result->dropped += rk_fmp4_write_sub_video(main_fmp4, frame, size, pts, key) < 0;
+		else
+			result->dropped += rk_fmp4_write_video(sub_fmp4, frame, size, pts, key) < 0;
+		if (multi && g_metadata && i % g_fps == 0) {
+			size = snprintf((char *)frame, 64, "{\"objects\":[],\"frame\":%lld}", (long long)i);
+			rk_fmp4_write_metadata(main_fmp4, frame, size, pts);
+		}
+		for (; (audio_pts = audio * BENCH_AUDIO_FRAME * 1000000 / BENCH_AUDIO_RATE) <= pts;
+		     audio++) {
+			rk_fmp4_write_audio(main_fmp4, adts, sizeof(adts), audio_pts);
+			if (!multi)
+				rk_fmp4_write_audio(sub_fmp4, adts, sizeof(adts), audio_pts);
+		}
+	}
+	rk_fmp4_close(main_fmp4);
+	rk_fmp4_close(sub_fmp4);
+	result->wall_ms = bench_now_ms() - wall;
+	result->cpu_ms = bench_cpu_ms() - cpu;
+	result->write_calls = bench_proc_io("syscw") - calls;
+	result->write_bytes = bench_proc_io("wchar") - bytes;
+	result->fragments = bench_count(g_dir, &result->files);
+	free(frame);
+	free(src.data);
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	bench_result_s result[2];
+
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case 'd':
+			g_dir = optarg;
+			break;
+		case 't':
+			g_seconds = atoi(optarg);
+			break;
+		case 'l':
+			g_segment = atoi(optarg);
+			break;
+		case 'm':
+			g_main_kbps = atoi(optarg);
+			break;
+		case 's':
+			g_sub_kbps = atoi(optarg);
+			break;
+		case 'r':
+			g_fps = atoi(optarg);
+			break;
+		case 'g':
+			g_gop = atoi(optarg);
+			break;
+		case 'f':
+			g_fsync = atoi(optarg);
+			break;
+		case 'M':
+			g_metadata = 1;
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			return 0;
+		default:
+			usage_tip(stderr, argv);
+			return -1;
+		}
+	}
+	if (g_seconds < 1 || g_segment < 1 || g_main_kbps < 64 || g_sub_kbps < 64 || g_fps < 1 ||
+	    g_gop < 1 || g_fsync < 0) {
+		usage_tip(stderr, argv);
+		return -1;
+	}
+	if (mkdir(g_dir, 0755) && access(g_dir, W_OK)) {
+		printf("can not use %s\n", g_dir);
+		return -1;
+	}
+
+	printf("%d s of %d kbps main and %d kbps sub at %d fps, %d s segments, fsync %d\n",
+	       g_seconds, g_main_kbps, g_sub_kbps, g_fps, g_segment, g_fsync);
+	for (int multi = 0; multi < 2; multi++) {
+		if (bench_run(multi, &result[multi]))
+			return -1;
+	}
+	printf("%-22s %6s %9s %8s %9s %11s %12s %8s\n", "", "files", "fragments", "dropped",
+	       "cpu ms", "write calls", "written KiB", "wall ms");
+	for (int i = 0; i < 2; i++)
+		printf("%-22s %6d %9d %8d %9.0f %11lld %12lld %8.0f\n", result[i].name,
+		       result[i].files, result[i].fragments, result[i].dropped, result[i].cpu_ms,
+		       result[i].write_calls, result[i].write_bytes / 1024, result[i].wall_ms);
+	bench_clean(g_dir);
+
+	return 0;
+}
@@ -0,0 +1,264 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Reference consumer of the 3A statistics rkipc publishes with isp:stats_shm,
+// and a way to test consumers without a sensor:
+//   dump   - print a summary line per frame read from the shared memory
+//   record - append the records to a file
+//   replay - publish a recorded file to the shared memory, paced by the
+//            recorded timestamps, so consumers see it as rkipc output
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "isp_stats_shm.h"
+
+enum { CMD_DUMP, CMD_RECORD, CMD_REPLAY };
+
+static int g_cmd = CMD_DUMP;
+static int g_cam_id = 0;
+static int g_count = -1;
+static int g_loops = 1;
+static int g_slots = ISP_STATS_SHM_DEFAULT_SLOTS;
+static float g_speed = 1.0f;
+static char g_path[64];
+static const char *g_file;
+static volatile int g_quit;
+
+static const char short_options[] = "c:p:n:f:l:s:S:h";
+static const struct option long_options[] = {{"cam", required_argument, NULL, 'c'},
+                                             {"path", required_argument, NULL, 'p'},
+                                             {"count", required_argument, NULL, 'n'},
+                                             {"file", required_argument, NULL, 'f'},
+                                             {"loops", required_argument, NULL, 'l'},
+                                             {"speed", required_argument, NULL, 's'},
+                                             {"slots", required_argument, NULL, 'S'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s dump|record|replay [options]\n"
+	        "Options:\n"
+	        "-c | --cam      camera id, default is 0\n"
+	        "-p | --path     shared memory file, default is %s\n"
+	        "-n | --count    frames to dump or record, default is until ctrl-c\n"
+	        "-f | --file     stats file to record to or replay from\n"
+	        "-l | --loops    replay the file this many times, 0 for ever, default is 1\n"
+	        "-s | --speed    replay speed factor, default is 1.0\n"
+	        "-S | --slots    ring slots when replaying, default is %d\n"
+	        "-h | --help     for help\n\n",
+	        argv[0], ISP_STATS_SHM_PATH, ISP_STATS_SHM_DEFAULT_SLOTS);
+}
+
+static uint64_t now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sig_proc(int signo) {
+	(void)signo;
+	g_quit = 1;
+}
+
+static void print_record(const isp_stats_record_t *rec, uint32_t lost) {
+	uint64_t luma = 0;
+
+	for (int i = 0; i < rec->grid_w * rec->grid_h && i < ISP_STATS_GRID_NUM; i++)
+		luma += rec->luma[i];
+	if (rec->grid_w && rec->grid_h)
+		luma /= rec->grid_w * rec->grid_h;
+	printf("cam %u frame %u: exp %.6fs again %.2f dgain %.2f iso %d luma %llu, "
+	       "wb %.3f/%.3f/%.3f/%.3f cct %.0f%s, af fv %llu, lost %u\n",
+	       rec->cam_id, rec->frame_id, rec->integration_time, rec->analog_gain,
+	       rec->digital_gain, rec->iso, (unsigned long long)luma, rec->awb_gain[0],
+	       rec->awb_gain[1], rec->awb_gain[2], rec->awb_gain[3], rec->awb_cct,
+	       rec->awb_converged ? "" : " (converging)", (unsigned long long)rec->af_fv_sum, lost);
+}
+
+static int do_read(void) {
+	isp_stats_file_header_t header;
+	isp_stats_shm_t *shm = NULL;
+	isp_stats_record_t rec;
+	FILE *fp = NULL;
+	uint32_t lost = 0;
+	int frames = 0;
+
+	if (g_cmd == CMD_RECORD) {
+		fp = fopen(g_file, "wb");
+		if (!fp) {
+			fprintf(stderr, "open %s fail, %s\n", g_file, strerror(errno));
+			return -1;
+		}
+		memset(&header, 0, sizeof(header));
+		header.magic = ISP_STATS_FILE_MAGIC;
+		header.version = ISP_STATS_SHM_VERSION;
+		header.record_size = sizeof(rec);
+		fwrite(&header, sizeof(header), 1, fp);
+	}
+
+	while (!g_quit && (g_count < 0 || frames < g_count)) {
+		int ret;
+
+		if (!shm) {
+			shm = isp_stats_shm_open(g_path);
+			if (!shm) {
+				usleep(200 * 1000);
+				continue;
+			}
+		}
+		ret = isp_stats_shm_read(shm, &rec, &lost);
+		if (ret < 0) {
+			// publisher restarted, follow the new instance
+			isp_stats_shm_close(shm);
+			shm = NULL;
+			continue;
+		}
+		if (!ret) {
+			usleep(5 * 1000);
+			continue;
+		}
+		frames++;
+		if (fp)
+			fwrite(&rec, sizeof(rec), 1, fp);
+		else
+			print_record(&rec, lost);
+	}
+
+	printf("%d frames, %u lost\n", frames, lost);
+	isp_stats_shm_close(shm);
+	if (fp)
+		fclose(fp);
+
+	return 0;
+}
+
+static int do_replay(void) {
+	isp_stats_file_header_t header;
+	isp_stats_record_t rec;
+	isp_stats_shm_t *shm;
+	int frames = 0;
+	FILE *fp;
+
+	fp = fopen(g_file, "rb");
+	if (!fp) {
+		fprintf(stderr, "open %s fail, %s\n", g_file, strerror(errno));
+		return -1;
+	}
+	if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != ISP_STATS_FILE_MAGIC ||
+	    header.version != ISP_STATS_SHM_VERSION || !header.record_size) {
+		fprintf(stderr, "%s is not a stats file of version %d\n", g_file,
+		        ISP_STATS_SHM_VERSION);
+		fclose(fp);
+		return -1;
+	}
+	shm = isp_stats_shm_create(g_path, g_slots);
+	if (!shm) {
+		fprintf(stderr, "create %s fail, %s\n", g_path, strerror(errno));
+		fclose(fp);
+		return -1;
+	}
+
+	for (int loop = 0; !g_quit && (!g_loops || loop < g_loops); loop++) {
+		uint64_t first_ts = 0, start = now_us();
+
+		fseek(fp, sizeof(header), SEEK_SET);
+		while (!g_quit) {
+			size_t size = header.record_size < sizeof(rec) ? header.record_size : sizeof(rec);
+			uint64_t due;
+
+			memset(&rec, 0, sizeof(rec));
+			if (fread(&rec, size, 1, fp) != 1)
+				break;
+			if (header.record_size > size)
+				fseek(fp, header.record_size - size, SEEK_CUR);
+			if (!first_ts)
+				first_ts = rec.timestamp_us;
+			due = start + (uint64_t)((rec.timestamp_us - first_ts) / g_speed);
+			while (!g_quit && now_us() < due)
+				usleep(due - now_us() > 10000 ? 10000 : due - now_us());
+			rec.timestamp_us = now_us();
+			isp_stats_shm_publish(shm, &rec);
+			frames++;
+		}
+	}
+
+	printf("replayed %d frames to %s\n", frames, g_path);
+	isp_stats_shm_close(shm);
+	fclose(fp);
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *cmd = argc > 1 ? argv[1] : "";
+	char *path = NULL;
+
+	if (!strcmp(cmd, "dump")) {
+		g_cmd = CMD_DUMP;
+	} else if (!strcmp(cmd, "record")) {
+		g_cmd = CMD_RECORD;
+	} else if (!strcmp(cmd, "replay")) {
+		g_cmd = CMD_REPLAY;
+	} else {
+		usage_tip(stderr, argv);
+		return -1;
+	}
+	optind = 2;
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case 'c':
+			g_cam_id = atoi(optarg);
+			break;
+		case 'p':
+			path = optarg;
+			break;
+		case 'n':
+			g_count = atoi(optarg);
+			break;
+		case 'f':
+			g_file = optarg;
+			break;
+		case 'l':
+			g_loops = atoi(optarg);
+			break;
+		case 's':
+			g_speed = atof(optarg);
+			break;
+		case 'S':
+			g_slots = atoi(optarg);
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			return 0;
+		default:
+			usage_tip(stderr, argv);
+			return -1;
+		}
+	}
+	if ((g_cmd != CMD_DUMP && !g_file) || g_speed <= 0) {
+		usage_tip(stderr, argv);
+		return -1;
+	}
+	if (path)
+		snprintf(g_path, sizeof(g_path), "%s", path);
+	else
+		snprintf(g_path, sizeof(g_path), ISP_STATS_SHM_PATH, g_cam_id);
+
+	signal(SIGINT, sig_proc);
+	signal(SIGTERM, sig_proc);
+
+	return g_cmd == CMD_REPLAY ? do_replay() : do_read();
+}
@@ -0,0 +1,265 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Cost of a LOG_* call in each state it can be in:
+//   compiled out  - above RKIPC_LOG_COMPILE_LEVEL, LOG_DEBUG here
+//   disabled      - below rkipc_log_level
+//   rate limited  - dropped by the call site limiter
+//   sync          - fprintf to stderr, the behaviour without rkipc_log_init
+//   async         - encoded into the ring, formatted by the flush thread
+// and, with -c, a check that async lines come out as printf would print them.
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RKIPC_LOG_COMPILE_LEVEL LOG_LEVEL_INFO
+#include "log.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "log_bench.c"
+
+#define BENCH_BATCH 1024
+
+int enable_minilog = 0;
+int rkipc_log_level = LOG_LEVEL_INFO;
+
+static int g_count = 200000;
+static const char *g_file = "/dev/null";
+static int g_check;
+
+static const char short_options[] = "n:f:ch";
+static const struct option long_options[] = {{"count", required_argument, NULL, 'n'},
+                                             {"file", required_argument, NULL, 'f'},
+                                             {"check", no_argument, NULL, 'c'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s [options]\n"
+	        "Options:\n"
+	        "-n | --count    calls per case, default is 200000\n"
+	        "-f | --file     file the async and sync cases write to, default is /dev/null\n"
+	        "-c | --check    compare the async output with printf, file must be a real file\n"
+	        "-h | --help     for help\n\n",
+	        argv[0]);
+}
+
+static long long now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *name, long long ns, int calls) {
+	printf("%-14s %8.1f ns/call\n", name, (double)ns / calls);
+}
+
+static void bench_call(int i) {
+	LOG_INFO("frame %d pts %lld size %u chn %s\n", i, (long long)i * 33333, 4096u, "venc_0");
+}
+
+static long long bench_debug(int count) {
+	long long begin = now_ns();
+
+	for (volatile int i = 0; i < count; i++)
+		LOG_DEBUG("frame %d pts %lld size %u chn %s\n", i, (long long)i * 33333, 4096u,
+		          "venc_0");
+
+	return now_ns() - begin;
+}
+
+static long long bench_plain(int count) {
+	long long begin = now_ns();
+
+	for (int i = 0; i < count; i++)
+		bench_call(i);
+
+	return now_ns() - begin;
+}
+
+// the flush thread drains between batches and is not part of the timing
+static long long bench_async(int count, int flush_ms) {
+	long long total = 0;
+
+	for (int i = 0; i < count; i += BENCH_BATCH) {
+		long long begin = now_ns();
+
+		for (int j = i; j < i + BENCH_BATCH && j < count; j++)
+			bench_call(j);
+		total += now_ns() - begin;
+		usleep(flush_ms * 2000);
+	}
+
+	return total;
+}
+
+static int check_output(const char *file, int flush_ms) {
+	static const char bounded[4] = {'w', 'x', 'y', 'z'}; // not terminated
+	// NULL for %s is undefined for printf, only the ring is given one
+	static rkipc_log_site_t null_site = {LOG_TAG, __FUNCTION__, "null %s\n", LOG_LEVEL_INFO, 0, 0};
+	char expect[512], line[1024];
+	int failed = 0, lines = 0;
+	FILE *fp;
+
+	LOG_INFO("int %d %5d %-5d| %05d %+d %x %#X %o %c\n", -42, 7, 7, 7, 7, 255, 255, 8, 'z');
+	LOG_INFO("long %ld %lu %lld %llu %zu\n", -1L, 2UL, -3LL, 4ULL, (size_t)5);
+	LOG_INFO("short %hd %hhu\n", (short)-6, (unsigned char)7);
+	LOG_INFO("double %f %.2f %8.3f %e %g %%\n", 1.5, 2.25, -3.125, 12345.678, 0.0001);
+	LOG_INFO("star %*d|%-*d|%.*f|%.*s\n", 6, 1, 4, 2, 3, 3.14159, 2, "abcdef");
+	LOG_INFO("str %s|%10s|%-10s|%.3s\n", "hello", "right", "left", "truncate");
+	rkipc_log_write(&null_site, (char *)NULL);
+	LOG_INFO("bounded %.4s|%.*s\n", bounded, 2, bounded);
+	LOG_INFO("ptr %p\n", (void *)0x1234);
+	LOG_INFO("no args\n");
+	usleep(flush_ms * 5000);
+
+	fp = fopen(file, "r");
+	if (!fp) {
+		printf("open %s fail\n", file);
+		return -1;
+	}
+	// the file sink puts a date in front of every line
+	while (fgets(line, sizeof(line), fp)) {
+		const char *msg = strstr(line, "[log_bench.c]");
+
+		if (!msg)
+			continue;
+		switch (lines++) {
+		case 0:
+			snprintf(expect, sizeof(expect), "int %d %5d %-5d| %05d %+d %x %#X %o %c\n", -42, 7, 7,
+			         7, 7, 255, 255, 8, 'z');
+			break;
+		case 1:
+			snprintf(expect, sizeof(expect), "long %ld %lu %lld %llu %zu\n", -1L, 2UL, -3LL, 4ULL,
+			         (size_t)5);
+			break;
+		case 2:
+			snprintf(expect, sizeof(expect), "short %hd %hhu\n", (short)-6, (unsigned char)7);
+			break;
+		case 3:
+			snprintf(expect, sizeof(expect), "double %f %.2f %8.3f %e %g %%\n", 1.5, 2.25, -3.125,
+			         12345.678, 0.0001);
+			break;
+		case 4:
+			snprintf(expect, sizeof(expect), "star %*d|%-*d|%.*f|%.*s\n", 6, 1, 4, 2, 3, 3.14159,
+			         2, "abcdef");
+			break;
+		case 5:
+			snprintf(expect, sizeof(expect), "str %s|%10s|%-10s|%.3s\n", "hello", "right",
+			         "left", "truncate");
+			break;
+		case 6:
+			snprintf(expect, sizeof(expect), "null (null)\n");
+			break;
+		case 7:
+			snprintf(expect, sizeof(expect), "bounded %.4s|%.*s\n", bounded, 2, bounded);
+			break;
+		case 8:
+			snprintf(expect, sizeof(expect), "ptr %p\n", (void *)0x1234);
+			break;
+		default:
+			snprintf(expect, sizeof(expect), "no args\n");
+			break;
+		}
+		msg = strstr(msg, "]:") + 2;
+		if (strcmp(msg, expect)) {
+			printf("mismatch:\n  got    %s  expect %s", msg, expect);
+			failed++;
+		}
+	}
+	fclose(fp);
+	printf("check: %d lines, %d mismatches\n", lines, failed);
+
+	return failed || lines != 10 ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+	rkipc_log_config_t config;
+	int count, fd, err_fd, ret = 0;
+
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case 'n':
+			g_count = atoi(optarg);
+			break;
+		case 'f':
+			g_file = optarg;
+			break;
+		case 'c':
+			g_check = 1;
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			return 0;
+		default:
+			usage_tip(stderr, argv);
+			return -1;
+		}
+	}
+	count = g_count > 0 ? g_count : 1;
+
+	memset(&config, 0, sizeof(config));
+	config.sink = RKIPC_LOG_SINK_FILE;
+	config.file = g_file;
+	config.ring_size = 65536;
+	config.flush_ms = 5;
+
+	if (g_check) {
+		fd = open(g_file, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+		if (fd >= 0)
+			close(fd);
+		if (rkipc_log_init(&config))
+			return -1;
+		ret = check_output(g_file, config.flush_ms);
+		rkipc_log_deinit();
+		return ret;
+	}
+
+	report("compiled out", bench_debug(count), count);
+
+	rkipc_log_level = LOG_LEVEL_WARN;
+	report("disabled", bench_plain(count), count);
+	rkipc_log_level = LOG_LEVEL_INFO;
+
+	// sync prints to stderr, point it at the file for this case only
+	err_fd = dup(STDERR_FILENO);
+	fd = open(g_file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0 || err_fd < 0) {
+		printf("open %s fail\n", g_file);
+		return -1;
+	}
+	dup2(fd, STDERR_FILENO);
+	report("sync", bench_plain(count), count);
+	fflush(stderr);
+	dup2(err_fd, STDERR_FILENO);
+	close(fd);
+	close(err_fd);
+
+	if (rkipc_log_init(&config))
+		return -1;
+	report("async", bench_async(count, config.flush_ms), count);
+	rkipc_log_deinit();
+
+	// the limiter state is read at every call, a new init picks up the burst
+	config.rate_burst = 1;
+	config.rate_interval_ms = 3600 * 1000;
+	if (rkipc_log_init(&config))
+		return -1;
+	report("rate limited", bench_plain(count), count);
+	rkipc_log_deinit();
+
+	return ret;
+}
@@ -0,0 +1,696 @@
+// Copyright 2021 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Throughput/latency benchmark of the im2d operations used by rkipc, the
+// buffer setup follows rga_samples/im2d_slt. Every case is one operation on
+// one format, resolution and submit mode:
+//   sync  - one blocking call per operation
+//   async - non-blocking calls, up to --depth fences in flight
+//   batch - --batch tasks per im2d job, latency is the job time / tasks
+// The cpu backend runs common/rga/rga_cpu.c and only supports sync, so the
+// harness itself can be checked on a host without RGA (RGA_BENCH_CPU_ONLY).
+// DDR bytes are estimated from the raster size of what is read and written,
+// FBC reads are counted uncompressed.
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rga_cpu.h"
+
+#define BENCH_RECT_NUM 16
+#define BENCH_MAX_RES 8
+#define BENCH_DEFAULT_HEAP "/dev/rk_dma_heap/rk-dma-heap-cma"
+
+enum { OP_COPY, OP_RESIZE, OP_CROP, OP_CVTCOLOR, OP_FILL, OP_MOSAIC, OP_RECTANGLE, OP_NUM };
+enum { MODE_SYNC, MODE_ASYNC, MODE_BATCH, MODE_NUM };
+enum { FMT_NV12, FMT_RGBA8888, FMT_BGR888, FMT_FBC, FMT_NUM };
+enum { BACKEND_RGA, BACKEND_CPU };
+
+static const char *g_op_name[OP_NUM] = {"copy", "resize",  "crop",     "cvtcolor",
+                                        "fill", "mosaic", "rectangle"};
+static const char *g_mode_name[MODE_NUM] = {"sync", "async", "batch"};
+
+typedef struct bench_format {
+	const char *name;
+	int format;
+	int rd_mode;
+	int bytes_x2; // bytes per pixel * 2
+	int cvt_to;   // destination of cvtcolor
+} bench_format_s;
+
+static const bench_format_s g_formats[FMT_NUM] = {
+    {"nv12", RK_FORMAT_YCbCr_420_SP, 0, 3, FMT_BGR888},
+    {"rgba8888", RK_FORMAT_RGBA_8888, 0, 8, FMT_NV12},
+    {"bgr888", RK_FORMAT_BGR_888, 0, 6, FMT_NV12},
+    {"fbc", RK_FORMAT_YCbCr_420_SP, IM_RKFBC64x4_MODE, 3, FMT_BGR888},
+};
+
+typedef struct bench_buf {
+	void *va;
+	int fd;
+	size_t size;
+	rga_buffer_handle_t handle;
+} bench_buf_s;
+
+typedef struct bench_ctx {
+	int op;
+	int backend;
+	rga_buffer_t src;
+	rga_buffer_t dst;
+	im_rect rect;
+	im_rect rects[BENCH_RECT_NUM];
+	long long bytes; // estimated DDR bytes per operation
+} bench_ctx_s;
+
+typedef struct bench_result {
+	int op, fmt, mode, width, height;
+	const char *status;
+	long long ops;
+	double ops_per_sec;
+	double p50_us;
+	double p99_us;
+	long long bytes;
+} bench_result_s;
+
+static int g_backend = BACKEND_RGA;
+static unsigned int g_op_mask = (1 << OP_NUM) - 1;
+static unsigned int g_fmt_mask = (1 << FMT_NUM) - 1;
+static unsigned int g_mode_mask = (1 << MODE_NUM) - 1;
+static int g_res_num;
+static int g_res[BENCH_MAX_RES][2];
+static int g_iterations = 200;
+static int g_warmup = 10;
+static int g_depth = 4;
+static int g_batch = 8;
+static const char *g_heap_path = BENCH_DEFAULT_HEAP;
+static const char *g_json_path;
+
+static long long bench_now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* ---- buffers, dma heap like im2d_slt, malloc when there is none ---- */
+
+struct dma_heap_allocation_data {
+	unsigned long long len;
+	unsigned int fd;
+	unsigned int fd_flags;
+	unsigned long long heap_flags;
+};
+
+#define DMA_HEAP_IOCTL_ALLOC _IOWR('H', 0x0, struct dma_heap_allocation_data)
+
+static int bench_buf_alloc(bench_buf_s *buf, size_t size) {
+	struct dma_heap_allocation_data data;
+	int heap_fd = -1;
+
+	memset(buf, 0, sizeof(*buf));
+	buf->fd = -1;
+	buf->size = size;
+	if (g_backend == BACKEND_RGA)
+		heap_fd = open(g_heap_path, O_RDWR);
+	if (heap_fd >= 0) {
+		memset(&data, 0, sizeof(data));
+		data.len = size;
+		data.fd_flags = O_CLOEXEC | O_RDWR;
+		if (!ioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &data)) {
+			buf->va = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, data.fd, 0);
+			if (buf->va == MAP_FAILED) {
+				buf->va = NULL;
+				close(data.fd);
+			} else {
+				buf->fd = data.fd;
+			}
+		}
+		close(heap_fd);
+	}
+	if (!buf->va && posix_memalign(&buf->va, 64, size))
+		return -1;
+	memset(buf->va, 0x80, size);
+#ifndef RGA_BENCH_CPU_ONLY
+	if (g_backend == BACKEND_RGA) {
+		if (buf->fd >= 0)
+			buf->handle = importbuffer_fd(buf->fd, (int)size);
+		else
+			buf->handle = importbuffer_virtualaddr(buf->va, (int)size);
+		if (!buf->handle)
+			return -1;
+	}
+#endif
+
+	return 0;
+}
+
+static void bench_buf_free(bench_buf_s *buf) {
+#ifndef RGA_BENCH_CPU_ONLY
+	if (buf->handle)
+		releasebuffer_handle(buf->handle);
+#endif
+	if (buf->fd >= 0) {
+		munmap(buf->va, buf->size);
+		close(buf->fd);
+	} else {
+		free(buf->va);
+	}
+	memset(buf, 0, sizeof(*buf));
+	buf->fd = -1;
+}
+
+static long long bench_plane_bytes(int fmt, int width, int height) {
+	return (long long)width * height * g_formats[fmt].bytes_x2 / 2;
+}
+
+static rga_buffer_t bench_wrap(bench_buf_s *buf, int fmt, int width, int height) {
+	rga_buffer_t img;
+
+	memset(&img, 0, sizeof(img));
+#ifndef RGA_BENCH_CPU_ONLY
+	if (buf->handle)
+		img = wrapbuffer_handle(buf->handle, width, height, g_formats[fmt].format);
+#endif
+	if (g_backend == BACKEND_CPU)
+		img.vir_addr = buf->va;
+	img.width = width;
+	img.height = height;
+	img.wstride = width;
+	img.hstride = height;
+	img.format = g_formats[fmt].format;
+	if (g_formats[fmt].rd_mode)
+		img.rd_mode = g_formats[fmt].rd_mode;
+
+	return img;
+}
+
+/* ---- operations ---- */
+
+static IM_STATUS bench_op_cpu(bench_ctx_s *ctx) {
+	im_rect full = {0, 0, ctx->src.width, ctx->src.height};
+
+	switch (ctx->op) {
+	case OP_COPY:
+		return rga_cpu_crop(ctx->src, ctx->dst, full);
+	case OP_RESIZE:
+		return rga_cpu_resize(ctx->src, ctx->dst);
+	case OP_CROP:
+		return rga_cpu_crop(ctx->src, ctx->dst, ctx->rect);
+	case OP_CVTCOLOR:
+		return rga_cpu_cvtcolor(ctx->src, ctx->dst);
+	case OP_FILL:
+		return rga_cpu_fill(ctx->src, ctx->rect, 0xff0000ff);
+	case OP_MOSAIC:
+		return rga_cpu_mosaic(ctx->src, ctx->rect, IM_MOSAIC_16);
+	case OP_RECTANGLE:
+		return rga_cpu_rectangle_array(ctx->src, ctx->rects, BENCH_RECT_NUM, 0xff0000ff, 2);
+	default:
+		return IM_STATUS_NOT_SUPPORTED;
+	}
+}
+
+#ifndef RGA_BENCH_CPU_ONLY
+static IM_STATUS bench_op_rga(bench_ctx_s *ctx, int sync, int *fence) {
+	switch (ctx->op) {
+	case OP_COPY:
+		return imcopy(ctx->src, ctx->dst, sync, fence);
+	case OP_RESIZE:
+		return imresize(ctx->src, ctx->dst, 0, 0, INTER_LINEAR, sync, fence);
+	case OP_CROP:
+		return imcrop(ctx->src, ctx->dst, ctx->rect, sync, fence);
+	case OP_CVTCOLOR:
+		return imcvtcolor(ctx->src, ctx->dst, ctx->src.format, ctx->dst.format,
+		                  IM_COLOR_SPACE_DEFAULT, sync, fence);
+	case OP_FILL:
+		return imfill(ctx->src, ctx->rect, 0xff0000ff, sync, fence);
+	case OP_MOSAIC:
+		return immosaic(ctx->src, ctx->rect, IM_MOSAIC_16, sync, fence);
+	case OP_RECTANGLE:
+		return imrectangleArray(ctx->src, ctx->rects, BENCH_RECT_NUM, 0xff0000ff, 2, sync, fence);
+	default:
+		return IM_STATUS_NOT_SUPPORTED;
+	}
+}
+
+static IM_STATUS bench_op_task(bench_ctx_s *ctx, im_job_handle_t job) {
+	switch (ctx->op) {
+	case OP_COPY:
+		return imcopyTask(job, ctx->src, ctx->dst);
+	case OP_RESIZE:
+		return imresizeTask(job, ctx->src, ctx->dst, 0, 0, INTER_LINEAR);
+	case OP_CROP:
+		return imcropTask(job, ctx->src, ctx->dst, ctx->rect);
+	case OP_CVTCOLOR:
+		return imcvtcolorTask(job, ctx->src, ctx->dst, ctx->src.format, ctx->dst.format);
+	case OP_FILL:
+		return imfillTask(job, ctx->src, ctx->rect, 0xff0000ff);
+	case OP_MOSAIC:
+		return immosaicTask(job, ctx->src, ctx->rect, IM_MOSAIC_16);
+	case OP_RECTANGLE:
+		return imrectangleTaskArray(job, ctx->src, ctx->rects, BENCH_RECT_NUM, 0xff0000ff, 2);
+	default:
+		return IM_STATUS_NOT_SUPPORTED;
+	}
+}
+#endif
+
+static IM_STATUS bench_op_sync(bench_ctx_s *ctx) {
+#ifndef RGA_BENCH_CPU_ONLY
+	if (ctx->backend == BACKEND_RGA)
+		return bench_op_rga(ctx, 1, NULL);
+#endif
+	return bench_op_cpu(ctx);
+}
+
+/* ---- one case ---- */
+
+static int bench_cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double bench_percentile(const double *sorted, int num, int pct) {
+	int idx = (num * pct + 99) / 100 - 1;
+
+	if (num <= 0)
+		return 0;
+	return sorted[idx < 0 ? 0 : (idx >= num ? num - 1 : idx)];
+}
+
+// fills ctx from the case, returns the reason when it cannot run
+static const char *bench_setup(bench_ctx_s *ctx, const bench_result_s *res, bench_buf_s *src_buf,
+                               bench_buf_s *dst_buf) {
+	int fmt = res->fmt, w = res->width, h = res->height;
+	int dst_fmt = fmt == FMT_FBC ? FMT_NV12 : fmt;
+	int dw = w, dh = h;
+	size_t src_size = bench_plane_bytes(fmt, w, h);
+
+	if (fmt == FMT_FBC) {
+		if (res->op == OP_FILL || res->op == OP_MOSAIC || res->op == OP_RECTANGLE)
+			return "unsupported";
+		if (g_backend == BACKEND_CPU)
+			return "unsupported";
+		src_size = src_size * 3 / 2; // header + payload, as im2d_slt
+	}
+	if (g_backend == BACKEND_CPU && res->mode != MODE_SYNC)
+		return "unsupported";
+	if (res->op == OP_RESIZE || res->op == OP_CROP) {
+		dw = w / 2 & ~1;
+		dh = h / 2 & ~1;
+	}
+	if (res->op == OP_CVTCOLOR)
+		dst_fmt = g_formats[fmt].cvt_to;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->op = res->op;
+	ctx->backend = g_backend;
+	if (bench_buf_alloc(src_buf, src_size) ||
+	    bench_buf_alloc(dst_buf, bench_plane_bytes(dst_fmt, dw, dh)))
+		return "alloc failed";
+	ctx->src = bench_wrap(src_buf, fmt, w, h);
+	ctx->dst = bench_wrap(dst_buf, dst_fmt, dw, dh);
+
+	switch (res->op) {
+	case OP_COPY:
+	case OP_CVTCOLOR:
+		ctx->bytes = bench_plane_bytes(fmt, w, h) + bench_plane_bytes(dst_fmt, dw, dh);
+		break;
+	case OP_RESIZE:
+		ctx->bytes = bench_plane_bytes(fmt, w, h) + bench_plane_bytes(dst_fmt, dw, dh);
+		break;
+	case OP_CROP:
+		ctx->rect = {w / 4 & ~1, h / 4 & ~1, dw, dh};
+		ctx->bytes = bench_plane_bytes(fmt, dw, dh) * 2;
+		break;
+	case OP_FILL:
+		ctx->rect = {w / 4 & ~1, h / 4 & ~1, w / 2 & ~1, h / 2 & ~1};
+		ctx->bytes = bench_plane_bytes(fmt, ctx->rect.width, ctx->rect.height);
+		break;
+	case OP_MOSAIC:
+		ctx->rect = {w / 4 & ~1, h / 4 & ~1, w / 4 & ~1, h / 4 & ~1};
+		ctx->bytes = bench_plane_bytes(fmt, ctx->rect.width, ctx->rect.height) * 2;
+		break;
+	case OP_RECTANGLE:
+		// a 4x4 grid of boxes with 2 pixel borders, like the NN overlay
+		for (int i = 0; i < BENCH_RECT_NUM; i++) {
+			im_rect *r = &ctx->rects[i];
+			r->x = ((i % 4) * w / 4 + 8) & ~1;
+			r->y = ((i / 4) * h / 4 + 8) & ~1;
+			r->width = w / 8 & ~1;
+			r->height = h / 8 & ~1;
+			ctx->bytes += bench_plane_bytes(fmt, 2 * 2 * (r->width + r->height), 1);
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+static const char *bench_measure(bench_ctx_s *ctx, bench_result_s *res, double *lat) {
+	long long start, t0;
+	int num = 0;
+
+	for (int i = 0; i < g_warmup; i++) {
+		if (bench_op_sync(ctx) != IM_STATUS_SUCCESS)
+			return "failed";
+	}
+
+	start = bench_now_us();
+	if (res->mode == MODE_SYNC) {
+		for (int i = 0; i < g_iterations; i++) {
+			t0 = bench_now_us();
+			if (bench_op_sync(ctx) != IM_STATUS_SUCCESS)
+				return "failed";
+			lat[num++] = bench_now_us() - t0;
+		}
+		res->ops = num;
+	}
+#ifndef RGA_BENCH_CPU_ONLY
+	else if (res->mode == MODE_ASYNC) {
+		int *fence = (int *)malloc(g_depth * sizeof(int));
+		long long *submit_us = (long long *)malloc(g_depth * sizeof(long long));
+		int head = 0, inflight = 0;
+		const char *status = NULL;
+
+		for (int i = 0; i < g_iterations + g_depth && !status; i++) {
+			if (inflight == g_depth || (i >= g_iterations && inflight)) {
+				if (fence[head] >= 0 && imsync(fence[head]) != IM_STATUS_SUCCESS)
+					status = "failed";
+				lat[num++] = bench_now_us() - submit_us[head];
+				head = (head + 1) % g_depth;
+				inflight--;
+			}
+			if (i >= g_iterations || status)
+				continue;
+			int slot = (head + inflight) % g_depth;
+			fence[slot] = -1;
+			submit_us[slot] = bench_now_us();
+			if (bench_op_rga(ctx, 0, &fence[slot]) != IM_STATUS_SUCCESS)
+				status = "failed";
+			else
+				inflight++;
+		}
+		while (inflight--) {
+			if (fence[head] >= 0)
+				imsync(fence[head]);
+			head = (head + 1) % g_depth;
+		}
+		free(fence);
+		free(submit_us);
+		if (status)
+			return status;
+		res->ops = num;
+	} else {
+		for (int i = 0; i < g_iterations; i++) {
+			im_job_handle_t job = imbeginJob();
+			if (!job)
+				return "failed";
+			t0 = bench_now_us();
+			for (int k = 0; k < g_batch; k++) {
+				if (bench_op_task(ctx, job) != IM_STATUS_SUCCESS) {
+					imcancelJob(job);
+					return "failed";
+				}
+			}
+			if (imendJob(job, IM_SYNC) != IM_STATUS_SUCCESS)
+				return "failed";
+			lat[num++] = (double)(bench_now_us() - t0) / g_batch;
+		}
+		res->ops = (long long)num * g_batch;
+	}
+#endif
+	double total_s = (bench_now_us() - start) / 1000000.0;
+
+	qsort(lat, num, sizeof(double), bench_cmp_double);
+	res->ops_per_sec = total_s > 0 ? res->ops / total_s : 0;
+	res->p50_us = bench_percentile(lat, num, 50);
+	res->p99_us = bench_percentile(lat, num, 99);
+	res->bytes = ctx->bytes;
+
+	return "ok";
+}
+
+static void bench_run_case(bench_result_s *res, double *lat) {
+	bench_ctx_s ctx;
+	bench_buf_s src_buf, dst_buf;
+
+	memset(&src_buf, 0, sizeof(src_buf));
+	memset(&dst_buf, 0, sizeof(dst_buf));
+	src_buf.fd = dst_buf.fd = -1;
+	res->status = bench_setup(&ctx, res, &src_buf, &dst_buf);
+	if (!res->status)
+		res->status = bench_measure(&ctx, res, lat);
+	if (src_buf.va)
+		bench_buf_free(&src_buf);
+	if (dst_buf.va)
+		bench_buf_free(&dst_buf);
+}
+
+/* ---- report ---- */
+
+static void bench_print(const bench_result_s *res) {
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s/%s/%dx%d/%s", g_op_name[res->op], g_formats[res->fmt].name,
+	         res->width, res->height, g_mode_name[res->mode]);
+	if (strcmp(res->status, "ok")) {
+		printf("%-36s %s\n", name, res->status);
+		return;
+	}
+	printf("%-36s %10.1f %10.1f %10.1f %10.2f %10.1f\n", name, res->ops_per_sec, res->p50_us,
+	       res->p99_us, res->bytes / 1048576.0, res->ops_per_sec * res->bytes / 1048576.0);
+}
+
+static int bench_write_json(const char *path, const bench_result_s *res, int num) {
+	FILE *fp = fopen(path, "w");
+
+	if (!fp) {
+		fprintf(stderr, "open %s fail, %s\n", path, strerror(errno));
+		return -1;
+	}
+	fprintf(fp, "{\n  \"backend\": \"%s\",\n  \"iterations\": %d,\n  \"warmup\": %d,\n",
+	        g_backend == BACKEND_RGA ? "rga" : "cpu", g_iterations, g_warmup);
+	fprintf(fp, "  \"async_depth\": %d,\n  \"batch_size\": %d,\n  \"results\": [", g_depth,
+	        g_batch);
+	for (int i = 0; i < num; i++) {
+		const bench_result_s *r = &res[i];
+		fprintf(fp,
+		        "%s\n    {\"op\": \"%s\", \"format\": \"%s\", \"width\": %d, \"height\": %d, "
+		        "\"mode\": \"%s\", \"status\": \"%s\", \"ops\": %lld, \"ops_per_sec\": %.1f, "
+		        "\"p50_us\": %.1f, \"p99_us\": %.1f, \"ddr_bytes_per_op\": %lld}",
+		        i ? "," : "", g_op_name[r->op], g_formats[r->fmt].name, r->width, r->height,
+		        g_mode_name[r->mode], r->status, r->ops, r->ops_per_sec, r->p50_us, r->p99_us,
+		        r->bytes);
+	}
+	fprintf(fp, "\n  ]\n}\n");
+	fclose(fp);
+
+	return 0;
+}
+
+/* ---- options ---- */
+
+static const char short_options[] = "b:o:f:r:m:n:w:d:k:j:H:h";
+static const struct option long_options[] = {{"backend", required_argument, NULL, 'b'},
+                                             {"ops", required_argument, NULL, 'o'},
+                                             {"formats", required_argument, NULL, 'f'},
+                                             {"resolutions", required_argument, NULL, 'r'},
+                                             {"modes", required_argument, NULL, 'm'},
+                                             {"iterations", required_argument, NULL, 'n'},
+                                             {"warmup", required_argument, NULL, 'w'},
+                                             {"depth", required_argument, NULL, 'd'},
+                                             {"batch", required_argument, NULL, 'k'},
+                                             {"json", required_argument, NULL, 'j'},
+                                             {"heap", required_argument, NULL, 'H'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s [options]\n"
+	        "Options:\n"
+	        "-b | --backend      rga or cpu, default is rga\n"
+	        "-o | --ops          comma list of copy,resize,crop,cvtcolor,fill,mosaic,rectangle\n"
+	        "-f | --formats      comma list of nv12,rgba8888,bgr888,fbc\n"
+	        "-r | --resolutions  comma list of WxH, default is 640x360,1280x720,1920x1080\n"
+	        "-m | --modes        comma list of sync,async,batch\n"
+	        "-n | --iterations   measured operations (jobs in batch mode), default is 200\n"
+	        "-w | --warmup       untimed synchronous operations per case, default is 10\n"
+	        "-d | --depth        fences in flight in async mode, default is 4\n"
+	        "-k | --batch        tasks per job in batch mode, default is 8\n"
+	        "-j | --json         write the results to this file\n"
+	        "-H | --heap         dma heap, default is " BENCH_DEFAULT_HEAP "\n"
+	        "-h | --help         for help\n\n",
+	        argv[0]);
+}
+
+static int bench_parse_list(const char *arg, const char *const *names, int num,
+                            unsigned int *mask) {
+	char buf[256], *save = NULL;
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	*mask = 0;
+	for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		int i;
+		for (i = 0; i < num; i++) {
+			if (!strcmp(tok, names[i]))
+				break;
+		}
+		if (i == num) {
+			fprintf(stderr, "unknown value %s\n", tok);
+			return -1;
+		}
+		*mask |= 1 << i;
+	}
+
+	return 0;
+}
+
+static int bench_parse_res(const char *arg) {
+	char buf[256], *save = NULL;
+
+	snprintf(buf, sizeof(buf), "%s", arg);
+	g_res_num = 0;
+	for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		int w, h;
+		if (g_res_num >= BENCH_MAX_RES || sscanf(tok, "%dx%d", &w, &h) != 2 || w < 16 ||
+		    h < 16) {
+			fprintf(stderr, "bad resolution %s\n", tok);
+			return -1;
+		}
+		g_res[g_res_num][0] = w & ~1;
+		g_res[g_res_num][1] = h & ~1;
+		g_res_num++;
+	}
+
+	return 0;
+}
+
+static void bench_get_opt(int argc, char **argv) {
+	const char *fmt_names[FMT_NUM];
+	int ret = 0;
+
+	for (int i = 0; i < FMT_NUM; i++)
+		fmt_names[i] = g_formats[i].name;
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case 'b':
+			g_backend = strcmp(optarg, "cpu") ? BACKEND_RGA : BACKEND_CPU;
+			break;
+		case 'o':
+			ret = bench_parse_list(optarg, g_op_name, OP_NUM, &g_op_mask);
+			break;
+		case 'f':
+			ret = bench_parse_list(optarg, fmt_names, FMT_NUM, &g_fmt_mask);
+			break;
+		case 'r':
+			ret = bench_parse_res(optarg);
+			break;
+		case 'm':
+			ret = bench_parse_list(optarg, g_mode_name, MODE_NUM, &g_mode_mask);
+			break;
+		case 'n':
+			g_iterations = atoi(optarg);
+			break;
+		case 'w':
+			g_warmup = atoi(optarg);
+			break;
+		case 'd':
+			g_depth = atoi(optarg);
+			break;
+		case 'k':
+			g_batch = atoi(optarg);
+			break;
+		case 'j':
+			g_json_path = optarg;
+			break;
+		case 'H':
+			g_heap_path = optarg;
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			exit(EXIT_SUCCESS);
+		default:
+			usage_tip(stderr, argv);
+			exit(EXIT_FAILURE);
+		}
+		if (ret) {
+			usage_tip(stderr, argv);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (g_iterations < 1 || g_warmup < 0 || g_depth < 1 || g_batch < 1) {
+		usage_tip(stderr, argv);
+		exit(EXIT_FAILURE);
+	}
+#ifdef RGA_BENCH_CPU_ONLY
+	if (g_backend != BACKEND_CPU)
+		printf("built without librga, using the cpu backend\n");
+	g_backend = BACKEND_CPU;
+#endif
+}
+
+int main(int argc, char **argv) {
+	bench_result_s *results;
+	double *lat;
+	int num = 0, failed = 0;
+
+	g_res_num = 3;
+	g_res[0][0] = 640;
+	g_res[0][1] = 360;
+	g_res[1][0] = 1280;
+	g_res[1][1] = 720;
+	g_res[2][0] = 1920;
+	g_res[2][1] = 1080;
+	bench_get_opt(argc, argv);
+
+	results = (bench_result_s *)calloc(OP_NUM * FMT_NUM * BENCH_MAX_RES * MODE_NUM,
+	                                   sizeof(bench_result_s));
+	lat = (double *)malloc((g_iterations + g_depth) * sizeof(double));
+	if (!results || !lat)
+		return EXIT_FAILURE;
+
+	printf("%-36s %10s %10s %10s %10s %10s\n", "case", "ops/s", "p50 us", "p99 us", "MB/op",
+	       "MB/s");
+	for (int op = 0; op < OP_NUM; op++) {
+		for (int fmt = 0; fmt < FMT_NUM; fmt++) {
+			for (int r = 0; r < g_res_num; r++) {
+				for (int mode = 0; mode < MODE_NUM; mode++) {
+					bench_result_s *res = &results[num];
+					if (!(g_op_mask & 1 << op) || !(g_fmt_mask & 1 << fmt) ||
+					    !(g_mode_mask & 1 << mode))
+						continue;
+					res->op = op;
+					res->fmt = fmt;
+					res->mode = mode;
+					res->width = g_res[r][0];
+					res->height = g_res[r][1];
+					bench_run_case(res, lat);
+					bench_print(res);
+					if (!strcmp(res->status, "failed"))
+						failed++;
+					num++;
+				}
+			}
+		}
+	}
+	if (g_json_path && bench_write_json(g_json_path, results, num))
+		failed++;
+	free(lat);
+	free(results);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -94,6 +94,8 @@ int main(int argc, char **argv) {
 
 	// init
 	rk_param_init(rkipc_ini_path_);
+	rkipc_log_init_from_ini();
+	rkipc_metrics_init_from_ini();
 	rk_system_init();
 	rkipc_camera_id_ = rk_param_get_int("video.source:camera_id", 0); // need rk_param_init
 	rk_isp_init(rkipc_camera_id_, rkipc_iq_file_path_);
@@ -117,6 +119,8 @@ int main(int argc, char **argv) {
 	rk_video_deinit();
 	RK_MPI_SYS_Exit();
 	rk_isp_deinit(rkipc_camera_id_);
+	rkipc_metrics_deinit();
+	rkipc_log_deinit();
 	rk_param_deinit();
 
 	return 0;
@@ -0,0 +1,180 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Serves a folder of recordings with the RTSP playback of common/rtsp/playback.c, as
+// rkipc serves storage.0, to try clients and trick play on a host:
+//   rtsp_playback_tool -d /mnt/sdcard/video0 -p 8554
+//   ffplay "rtsp://127.0.0.1:8554/playback?start=20231019114600"
+// The segments are named by their local start time, YYYYmmddHHMMSS.mp4, and the folder is
+// looked at again on every lookup, so a segment still being recorded is followed.
+#include <dirent.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "param.h"
+#include "playback.h"
+#include "rtsp.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "rtsp_playback_tool.c"
+
+#define TOOL_NAME_LEN 256
+
+int enable_minilog = 0;
+int rkipc_log_level = LOG_LEVEL_INFO;
+
+static const char *g_dir = ".";
+static char *g_ini;
+static const char *g_addr = "127.0.0.1";
+static int g_port = 8554;
+static volatile int g_quit;
+
+static const char short_options[] = "d:a:p:c:vh";
+static const struct option long_options[] = {{"dir", required_argument, NULL, 'd'},
+                                             {"addr", required_argument, NULL, 'a'},
+                                             {"port", required_argument, NULL, 'p'},
+                                             {"config", required_argument, NULL, 'c'},
+                                             {"verbose", no_argument, NULL, 'v'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s [options]\n"
+	        "Options:\n"
+	        "-d | --dir      folder of YYYYmmddHHMMSS.mp4 segments, default is .\n"
+	        "-a | --addr     address to listen on, default is 127.0.0.1\n"
+	        "-p | --port     RTSP port, default is 8554\n"
+	        "-c | --config   rkipc.ini for the rtsp:playback_* settings\n"
+	        "-v | --verbose  log every request\n"
+	        "-h | --help     for help\n\n",
+	        argv[0]);
+}
+
+static void sig_handler(int sig) { g_quit = 1; }
+
+static int is_segment(const char *name) {
+	int len = strlen(name);
+
+	if (len < 18 || strcmp(name + len - 4, ".mp4"))
+		return 0;
+	for (int i = 0; i < 14; i++) {
+		if (name[i] < '0' || name[i] > '9')
+			return 0;
+	}
+
+	return 1;
+}
+
+static int64_t name_time(const char *name) {
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(name, "%4d%2d%2d%2d%2d%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour,
+	           &tm.tm_min, &tm.tm_sec) != 6)
+		return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	tm.tm_isdst = -1;
+
+	return (int64_t)mktime(&tm) * 1000;
+}
+
+// a linear walk, the folder of a test is small
+static int folder_find_segment(int id, int64_t wall_time_ms, int next, char *path, int len,
+                               int64_t *start_time_ms) {
+	char key[32], best[TOOL_NAME_LEN] = "";
+	struct dirent *entry;
+	struct tm tm;
+	time_t sec = wall_time_ms / 1000;
+	DIR *dir;
+	int cmp;
+
+	if (id)
+		return -1;
+	localtime_r(&sec, &tm);
+	strftime(key, sizeof(key), "%Y%m%d%H%M%S", &tm);
+	dir = opendir(g_dir);
+	if (!dir)
+		return -1;
+	while ((entry = readdir(dir)) != NULL) {
+		if (!is_segment(entry->d_name))
+			continue;
+		cmp = strncmp(entry->d_name, key, 14);
+		if (next ? cmp <= 0 || (best[0] && strcmp(entry->d_name, best) >= 0)
+		         : cmp > 0 || (best[0] && strcmp(entry->d_name, best) <= 0))
+			continue;
+		snprintf(best, sizeof(best), "%s", entry->d_name);
+	}
+	closedir(dir);
+	if (!best[0])
+		return -1;
+	snprintf(path, len, "%s/%s", g_dir, best);
+	*start_time_ms = name_time(best);
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case 'd':
+			g_dir = optarg;
+			break;
+		case 'a':
+			g_addr = optarg;
+			break;
+		case 'p':
+			g_port = atoi(optarg);
+			break;
+		case 'c':
+			g_ini = optarg;
+			break;
+		case 'v':
+			rkipc_log_level = LOG_LEVEL_DEBUG;
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			return 0;
+		default:
+			usage_tip(stderr, argv);
+			return -1;
+		}
+	}
+	if (g_port <= 0 || g_port > 65535) {
+		usage_tip(stderr, argv);
+		return -1;
+	}
+	// without an ini every setting is its default
+	if (g_ini && rk_param_init(g_ini))
+		return -1;
+
+	signal(SIGINT, sig_handler);
+	signal(SIGTERM, sig_handler);
+	rkipc_rtsp_playback_catalog_callback_register(folder_find_segment);
+	if (rkipc_rtsp_playback_init(g_addr, g_port))
+		return -1;
+	printf("serving %s on rtsp://%s:%d/playback?start=YYYYmmddHHMMSS\n", g_dir, g_addr, g_port);
+	while (!g_quit)
+		usleep(100 * 1000);
+	rkipc_rtsp_playback_deinit();
+	rkipc_rtsp_playback_catalog_callback_register(NULL);
+	if (g_ini)
+		rk_param_deinit();
+
+	return 0;
+}
@@ -4,6 +4,8 @@
 
 #include "video.h"
 #include "audio.h"
+#include "detections.h"
+#include "rga_draw.h"
 #include "rockiva.h"
 
 #define HAS_VO 0
@@ -62,6 +64,102 @@ static pthread_t vi_thread_1, venc_thread_0, venc_thread_1, venc_thread_2, jpeg_
 
 static MPP_CHN_S vi_chn, vpss_bgr_chn, vpss_rotate_chn, vo_chn, vpss_out_chn[4], venc_chn, ivs_chn;
 static VO_DEV VoLayer = RK3588_VOP_LAYER_CLUSTER0;
+typedef struct {
+	rkipc_metric_t *frames;
+	rkipc_metric_t *key_frames;
+	rkipc_metric_t *bytes;
+	rkipc_metric_t *timeouts;
+	rkipc_metric_t *queued;
+	rkipc_metric_t *fanout_us;
+} venc_metrics_s;
+
+static venc_metrics_s g_venc_metrics[2];
+
+static void rkipc_venc_metrics_register(int chn) {
+	venc_metrics_s *m = &g_venc_metrics[chn];
+	char labels[16];
+
+	snprintf(labels, sizeof(labels), "chn=\"%d\"", chn);
+	m->frames = rkipc_metric_counter("rkipc_venc_frames_total", labels, "Encoded frames");
+	m->key_frames = rkipc_metric_counter("rkipc_venc_key_frames_total", labels, "Encoded I frames");
+	m->bytes = rkipc_metric_counter("rkipc_venc_bytes_total", labels, "Encoded bytes");
+	m->timeouts = rkipc_metric_counter("rkipc_venc_get_stream_timeouts_total", labels,
+	                                   "RK_MPI_VENC_GetStream calls that returned no frame");
+	m->queued = rkipc_metric_gauge("rkipc_venc_queued_pictures", labels,
+	                               "Pictures waiting to be encoded, sampled every frame");
+	// rtsp, rtmp and storage are all fed from the VENC thread, a slow one delays the rest
+	m->fanout_us =
+	    rkipc_metric_histogram("rkipc_venc_fanout_us", labels, "Time to hand a frame to every sink",
+	                           rkipc_metric_us_bounds, RKIPC_METRIC_US_BOUNDS);
+}
+
+static void rkipc_venc_metrics_account(int chn, unsigned int len, int key_frame,
+                                       long long begin_us) {
+	venc_metrics_s *m = &g_venc_metrics[chn];
+	VENC_CHN_STATUS_S status;
+
+	if (!m->frames)
+		return;
+	rkipc_metric_inc(m->frames);
+	if (key_frame)
+		rkipc_metric_inc(m->key_frames);
+	rkipc_metric_add(m->bytes, len);
+	rkipc_metric_observe(m->fanout_us, rkipc_metrics_now_us() - begin_us);
+	if (RK_MPI_VENC_QueryStatus(chn, &status) == RK_SUCCESS)
+		rkipc_metric_set(m->queued, status.u32LeftPics);
+}
+
+typedef struct {
+	int sei; // video.N:detection_sei, off by default, the metadata track has the same results
+	int h265;
+	unsigned char payload[RKIPC_DETECTIONS_PAYLOAD_MAX];
+	int payload_size; // of the result that goes out with the current frame, 0 for none
+	unsigned char *frame;
+	int frame_cap;
+} venc_detections_s;
+
+static venc_detections_s g_venc_detections[2];
+
+static void rkipc_venc_detections_init(int chn) {
+	venc_detections_s *d = &g_venc_detections[chn];
+	char entry[128];
+
+	snprintf(entry, sizeof(entry), "video.%d:detection_sei", chn);
+	d->sei = rk_param_get_int(entry, 0);
+	snprintf(entry, sizeof(entry), "video.%d:output_data_type", chn);
+	d->h265 = !strcmp(rk_param_get_string(entry, "H.264"), "H.265");
+	d->payload_size = 0;
+}
+
+// An NPU result that came in since the last frame goes out with this one, as SEI in front
+// of its first slice. Returns the frame to send, *len is updated.
+static void *rkipc_venc_detections(int chn, void *data, unsigned int *len, int64_t pts) {
+	venc_detections_s *d = &g_venc_detections[chn];
+	int size;
+
+	d->payload_size = 0;
+	if (!enable_npu)
+		return data;
+	d->payload_size = rkipc_detections_take(chn, pts, d->payload, sizeof(d->payload));
+	if (d->payload_size <= 0 || !d->sei)
+		return data;
+	size = rkipc_detections_sei_frame(d->h265, data, *len, d->payload, d->payload_size,
+	                                  &d->frame, &d->frame_cap);
+	if (size < 0)
+		return data;
+	*len = size;
+
+	return d->frame;
+}
+
+// the same payload as a metadata sample at the time of the frame that carries it
+static void rkipc_venc_detections_record(int chn, int64_t pts) {
+	venc_detections_s *d = &g_venc_detections[chn];
+
+	if (d->payload_size > 0)
+		rk_storage_write_metadata(chn, d->payload, d->payload_size, pts);
+}
+
 typedef enum rkCOLOR_INDEX_E {
 	RGN_COLOR_LUT_INDEX_0 = 0,
 	RGN_COLOR_LUT_INDEX_1 = 1,
@@ -121,34 +219,33 @@ static void *rkipc_get_venc_0(void *arg) {
 	int ret = 0;
 	// FILE *fp = fopen("/data/venc.h265", "wb");
 	stFrame.pstPack = malloc(sizeof(VENC_PACK_S));
+	rkipc_venc_metrics_register(VIDEO_PIPE_0);
+	rkipc_venc_detections_init(VIDEO_PIPE_0);
 
 	while (g_video_run_) {
 		// 5.get the frame
 		ret = RK_MPI_VENC_GetStream(VIDEO_PIPE_0, &stFrame, 2500);
 		if (ret == RK_SUCCESS) {
+			long long begin_us = rkipc_metrics_now_us();
 			void *data = RK_MPI_MB_Handle2VirAddr(stFrame.pstPack->pMbBlk);
+			unsigned int len = stFrame.pstPack->u32Len;
+			int64_t pts = stFrame.pstPack->u64PTS;
+			int key_frame = (stFrame.pstPack->DataType.enH264EType == H264E_NALU_IDRSLICE) ||
+			                (stFrame.pstPack->DataType.enH264EType == H264E_NALU_ISLICE) ||
+			                (stFrame.pstPack->DataType.enH265EType == H265E_NALU_IDRSLICE) ||
+			                (stFrame.pstPack->DataType.enH265EType == H265E_NALU_ISLICE);
 			// fwrite(data, 1, stFrame.pstPack->u32Len, fp);
 			// fflush(fp);
 			// LOG_DEBUG("Count:%d, Len:%d, PTS is %" PRId64", enH264EType is %d\n", loopCount,
 			// stFrame.pstPack->u32Len, stFrame.pstPack->u64PTS,
 			// stFrame.pstPack->DataType.enH264EType);
-			rkipc_rtsp_write_video_frame(0, data, stFrame.pstPack->u32Len, stFrame.pstPack->u64PTS);
-			if ((stFrame.pstPack->DataType.enH264EType == H264E_NALU_IDRSLICE) ||
-			    (stFrame.pstPack->DataType.enH264EType == H264E_NALU_ISLICE) ||
-			    (stFrame.pstPack->DataType.enH265EType == H265E_NALU_IDRSLICE) ||
-			    (stFrame.pstPack->DataType.enH265EType == H265E_NALU_ISLICE)) {
-				rk_storage_write_video_frame(0, data, stFrame.pstPack->u32Len,
-				                             stFrame.pstPack->u64PTS, 1);
-				if (enable_rtmp)
-					rk_rtmp_write_video_frame(0, data, stFrame.pstPack->u32Len,
-					                          stFrame.pstPack->u64PTS, 1);
-			} else {
-				rk_storage_write_video_frame(0, data, stFrame.pstPack->u32Len,
-				                             stFrame.pstPack->u64PTS, 0);
-				if (enable_rtmp)
-					rk_rtmp_write_video_frame(0, data, stFrame.pstPack->u32Len,
-					                          stFrame.pstPack->u64PTS, 0);
-			}
+			data = rkipc_venc_detections(VIDEO_PIPE_0, data, &len, pts);
+			rkipc_rtsp_write_video_frame(0, data, len, pts);
+			rk_storage_write_video_frame(0, data, len, pts, key_frame);
+			rkipc_venc_detections_record(VIDEO_PIPE_0, pts);
+			if (enable_rtmp)
+				rk_rtmp_write_video_frame(0, data, len, pts, key_frame);
+			rkipc_venc_metrics_account(VIDEO_PIPE_0, len, key_frame, begin_us);
 			// 7.release the frame
 			ret = RK_MPI_VENC_ReleaseStream(VIDEO_PIPE_0, &stFrame);
 			if (ret != RK_SUCCESS) {
@@ -157,6 +254,7 @@ static void *rkipc_get_venc_0(void *arg) {
 			loopCount++;
 		} else {
 			LOG_ERROR("RK_MPI_VENC_GetStream timeout %x\n", ret);
+			rkipc_metric_inc(g_venc_metrics[VIDEO_PIPE_0].timeouts);
 		}
 	}
 	if (stFrame.pstPack)
@@ -167,19 +265,6 @@ static void *rkipc_get_venc_0(void *arg) {
 	return 0;
 }
 
-static int rga_nv12_border(rga_buffer_t buf, int x, int y, int width, int height, int line_pixel,
-                           int color) {
-	im_rect rect_up = {x, y, width, line_pixel};
-	im_rect rect_buttom = {x, y + height - line_pixel, width, line_pixel};
-	im_rect rect_left = {x, y, line_pixel, height};
-	im_rect rect_right = {x + width - line_pixel, y, line_pixel, height};
-	IM_STATUS STATUS = imfill(buf, rect_up, color);
-	STATUS |= imfill(buf, rect_buttom, color);
-	STATUS |= imfill(buf, rect_left, color);
-	STATUS |= imfill(buf, rect_right, color);
-	return STATUS == IM_STATUS_SUCCESS ? 0 : 1;
-}
-
 static void *rkipc_get_vi_draw_send_venc(void *arg) {
 	LOG_DEBUG("#Start %s thread, arg:%p\n", __func__, arg);
 	prctl(PR_SET_NAME, "RkipcVi2Venc", 0, 0, 0);
@@ -194,9 +279,12 @@ static void *rkipc_get_vi_draw_send_venc(void *arg) {
 	RockIvaBaObjectInfo *object;
 	rga_buffer_handle_t handle;
 	rga_buffer_t src;
+	rga_draw_list_s draw_list;
+	int release_fence_fd;
 
 	memset(&ba_result, 0, sizeof(ba_result));
 	memset(&param, 0, sizeof(im_handle_param_t));
+	rga_draw_init();
 	while (g_video_run_) {
 		// 5.get the frame
 		ret = RK_MPI_VI_GetChnFrame(pipe_id_, VIDEO_PIPE_1, &stViFrame, 1000);
@@ -213,8 +301,11 @@ static void *rkipc_get_vi_draw_send_venc(void *arg) {
 				src = wrapbuffer_handle_t(handle, stViFrame.stVFrame.u32Width,
 				                          stViFrame.stVFrame.u32Height, stViFrame.stVFrame.u32Width,
 				                          stViFrame.stVFrame.u32Height, RK_FORMAT_YCbCr_420_SP);
+				// lets rga_draw fall back to the CPU
+				src.vir_addr = RK_MPI_MB_Handle2VirAddr(stViFrame.stVFrame.pMbBlk);
 				if (!ret)
 					last_ba_result_time = rkipc_get_curren_time_ms();
+				rga_draw_list_reset(&draw_list, line_pixel);
 				for (int i = 0; i < ba_result.objNum; i++) {
 					int x, y, w, h;
 					object = &ba_result.triggerObjects[i];
@@ -243,7 +334,7 @@ static void *rkipc_get_vi_draw_send_venc(void *arg) {
 						h -= 8;
 					}
 					LOG_DEBUG("i is %d, x,y,w,h is %d,%d,%d,%d\n", i, x, y, w, h);
-					rga_nv12_border(src, x, y, w, h, line_pixel, 0x000000ff);
+					rga_draw_list_add_rect(&draw_list, x, y, w, h, 0x000000ff);
 					// LOG_INFO("draw rect time-consuming is %lld\n",(rkipc_get_curren_time_ms() -
 					// last_ba_result_time));
 					// LOG_INFO("triggerRules is %d, ruleID is %d, triggerType is %d\n",
@@ -251,6 +342,12 @@ static void *rkipc_get_vi_draw_send_venc(void *arg) {
 					//          object->firstTrigger.ruleID,
 					//          object->firstTrigger.triggerType);
 				}
+				// all boxes go out as one job, wait for it before the frame reaches venc
+				draw_list.object_num = ba_result.objNum;
+				if (!rga_draw_submit(src, &draw_list, &release_fence_fd))
+					rga_draw_wait(&draw_list, release_fence_fd);
+				if (draw_list.cpu_used)
+					RK_MPI_SYS_MmzFlushCache(stViFrame.stVFrame.pMbBlk, RK_FALSE);
 				releasebuffer_handle(handle);
 			}
 
@@ -281,32 +378,31 @@ static void *rkipc_get_venc_1(void *arg) {
 	int loopCount = 0;
 	int ret = 0;
 	stFrame.pstPack = malloc(sizeof(VENC_PACK_S));
+	rkipc_venc_metrics_register(VIDEO_PIPE_1);
+	rkipc_venc_detections_init(VIDEO_PIPE_1);
 
 	while (g_video_run_) {
 		// 5.get the frame
 		ret = RK_MPI_VENC_GetStream(VIDEO_PIPE_1, &stFrame, 2500);
 		if (ret == RK_SUCCESS) {
+			long long begin_us = rkipc_metrics_now_us();
 			void *data = RK_MPI_MB_Handle2VirAddr(stFrame.pstPack->pMbBlk);
+			unsigned int len = stFrame.pstPack->u32Len;
+			int64_t pts = stFrame.pstPack->u64PTS;
+			int key_frame = (stFrame.pstPack->DataType.enH264EType == H264E_NALU_IDRSLICE) ||
+			                (stFrame.pstPack->DataType.enH264EType == H264E_NALU_ISLICE) ||
+			                (stFrame.pstPack->DataType.enH265EType == H265E_NALU_IDRSLICE) ||
+			                (stFrame.pstPack->DataType.enH265EType == H265E_NALU_ISLICE);
 			// LOG_INFO("Count:%d, Len:%d, PTS is %" PRId64", enH264EType is %d\n", loopCount,
 			// stFrame.pstPack->u32Len, stFrame.pstPack->u64PTS,
 			// stFrame.pstPack->DataType.enH264EType);
-			rkipc_rtsp_write_video_frame(1, data, stFrame.pstPack->u32Len, stFrame.pstPack->u64PTS);
-			if ((stFrame.pstPack->DataType.enH264EType == H264E_NALU_IDRSLICE) ||
-			    (stFrame.pstPack->DataType.enH264EType == H264E_NALU_ISLICE) ||
-			    (stFrame.pstPack->DataType.enH265EType == H265E_NALU_IDRSLICE) ||
-			    (stFrame.pstPack->DataType.enH265EType == H265E_NALU_ISLICE)) {
-				rk_storage_write_video_frame(1, data, stFrame.pstPack->u32Len,
-				                             stFrame.pstPack->u64PTS, 1);
-				if (enable_rtmp)
-					rk_rtmp_write_video_frame(1, data, stFrame.pstPack->u32Len,
-					                          stFrame.pstPack->u64PTS, 1);
-			} else {
-				rk_storage_write_video_frame(1, data, stFrame.pstPack->u32Len,
-				                             stFrame.pstPack->u64PTS, 0);
-				if (enable_rtmp)
-					rk_rtmp_write_video_frame(1, data, stFrame.pstPack->u32Len,
-					                          stFrame.pstPack->u64PTS, 0);
-			}
+			data = rkipc_venc_detections(VIDEO_PIPE_1, data, &len, pts);
+			rkipc_rtsp_write_video_frame(1, data, len, pts);
+			rk_storage_write_video_frame(1, data, len, pts, key_frame);
+			rkipc_venc_detections_record(VIDEO_PIPE_1, pts);
+			if (enable_rtmp)
+				rk_rtmp_write_video_frame(1, data, len, pts, key_frame);
+			rkipc_venc_metrics_account(VIDEO_PIPE_1, len, key_frame, begin_us);
 			// 7.release the frame
 			ret = RK_MPI_VENC_ReleaseStream(VIDEO_PIPE_1, &stFrame);
 			if (ret != RK_SUCCESS)
@@ -314,6 +410,7 @@ static void *rkipc_get_venc_1(void *arg) {
 			loopCount++;
 		} else {
 			LOG_ERROR("RK_MPI_VENC_GetStream timeout %x\n", ret);
+			rkipc_metric_inc(g_venc_metrics[VIDEO_PIPE_1].timeouts);
 		}
 	}
 	if (stFrame.pstPack)
@@ -412,17 +509,20 @@ static void *rkipc_get_vi_2_send(void *arg) {
 	int ret;
 	int32_t loopCount = 0;
 	VIDEO_FRAME_INFO_S stViFrame;
-	int npu_cycle_time_ms = 1000 / rk_param_get_int("video.source:npu_fps", 10);
+	int npu_cycle_time_ms;
 
 	long long before_time, cost_time;
 	while (g_video_run_) {
 		before_time = rkipc_get_curren_time_ms();
+		// npu_fps with motion or objects, npu_idle_fps in an empty scene
+		npu_cycle_time_ms = rkipc_rockiva_frame_interval_ms();
 		ret = RK_MPI_VI_GetChnFrame(pipe_id_, VIDEO_PIPE_2, &stViFrame, 1000);
 		if (ret == RK_SUCCESS) {
-			void *data = RK_MPI_MB_Handle2VirAddr(stViFrame.stVFrame.pMbBlk);
 			uint8_t *phy_addr = (uint8_t *)RK_MPI_MB_Handle2PhysAddr(stViFrame.stVFrame.pMbBlk);
-			rkipc_rockiva_write_nv12_frame_by_phy_addr(
-			    stViFrame.stVFrame.u32Width, stViFrame.stVFrame.u32Height, loopCount, phy_addr);
+			rkipc_detections_frame_pts(loopCount, stViFrame.stVFrame.u64PTS);
+			rkipc_rockiva_write_nv12_frame_by_phy_addr(stViFrame.stVFrame.u32Width,
+			                                           stViFrame.stVFrame.u32Height, loopCount,
+			                                           phy_addr);
 			ret = RK_MPI_VI_ReleaseChnFrame(pipe_id_, VIDEO_PIPE_2, &stViFrame);
 			if (ret != RK_SUCCESS)
 				LOG_ERROR("RK_MPI_VI_ReleaseChnFrame fail %x", ret);
@@ -444,10 +544,16 @@ static void *rkipc_get_vpss_bgr(void *arg) {
 	VI_CHN_STATUS_S stChnStatus;
 	int32_t loopCount = 0;
 	int ret = 0;
+	long long last_push_time = 0;
 
 	while (g_video_run_) {
 		ret = RK_MPI_VPSS_GetChnFrame(VPSS_BGR, 0, &frame, 1000);
 		if (ret == RK_SUCCESS) {
+			if (rkipc_get_curren_time_ms() - last_push_time < rkipc_rockiva_frame_interval_ms()) {
+				RK_MPI_VPSS_ReleaseChnFrame(VPSS_BGR, 0, &frame);
+				continue;
+			}
+			last_push_time = rkipc_get_curren_time_ms();
 			void *data = RK_MPI_MB_Handle2VirAddr(frame.stVFrame.pMbBlk);
 			// LOG_INFO("data:%p, u32Width:%d, u32Height:%d, PTS is %" PRId64 "\n", data,
 			//          frame.stVFrame.u32Width, frame.stVFrame.u32Height, frame.stVFrame.u64PTS);
@@ -462,6 +568,7 @@ static void *rkipc_get_vpss_bgr(void *arg) {
 			exit(1);
 #endif
 			// long long last_nn_time = rkipc_get_curren_time_ms();
+			rkipc_detections_frame_pts(loopCount, frame.stVFrame.u64PTS);
 			rkipc_rockiva_write_rgb888_frame_by_fd(frame.stVFrame.u32Width,
 			                                       frame.stVFrame.u32Height, loopCount, fd);
 			// LOG_DEBUG("nn time-consuming is %lld\n",(rkipc_get_curren_time_ms() - last_nn_time));
@@ -490,6 +597,8 @@ static void *rkipc_ivs_get_results(void *arg) {
 	int width = rk_param_get_int("video.2:width", 960);
 	int height = rk_param_get_int("video.2:height", 540);
 	int md_area_threshold = width * height * 0.3;
+	// much lower than the alarm threshold, any real motion should wake the npu
+	int npu_md_area = width * height * rk_param_get_int("video.source:npu_md_area", 1) / 100;
 
 	while (g_video_run_) {
 		ret = RK_MPI_IVS_GetResults(0, &stResults, 1000);
@@ -499,7 +608,10 @@ static void *rkipc_ivs_get_results(void *arg) {
 				if (stResults.pstResults->stMdInfo.u32Square > md_area_threshold) {
 					LOG_INFO("MD: md_area is %d, md_area_threshold is %d\n",
 					         stResults.pstResults->stMdInfo.u32Square, md_area_threshold);
+					rk_storage_mark_event(RK_SEGMENT_EVENT_MOTION);
 				}
+				rkipc_rockiva_motion_update(stResults.pstResults->stMdInfo.u32Square >
+				                            npu_md_area);
 			}
 			if (od == 1) {
 				if (stResults.s32ResultNum > 0) {
@@ -2032,25 +2144,26 @@ int rk_video_get_max_rate(int stream_id, int *value) {
 	return 0;
 }
 
-int rk_video_set_max_rate(int stream_id, int value) {
+// applies a bitrate without saving it, for the rate control of RTMP and RTSP
+static int rkipc_venc_set_bitrate(int stream_id, int value) {
 	VENC_CHN_ATTR_S venc_chn_attr;
 	memset(&venc_chn_attr, 0, sizeof(venc_chn_attr));
 	RK_MPI_VENC_GetChnAttr(stream_id, &venc_chn_attr);
 	char entry[128] = {'\0'};
 	snprintf(entry, 127, "video.%d:output_data_type", stream_id);
-	tmp_output_data_type = rk_param_get_string(entry, "H.264");
+	const char *output_data_type = rk_param_get_string(entry, "H.264");
 	snprintf(entry, 127, "video.%d:rc_mode", stream_id);
-	tmp_rc_mode = rk_param_get_string(entry, "CBR");
-	if (!strcmp(tmp_output_data_type, "H.264")) {
-		if (!strcmp(tmp_rc_mode, "CBR")) {
+	const char *rc_mode = rk_param_get_string(entry, "CBR");
+	if (!strcmp(output_data_type, "H.264")) {
+		if (!strcmp(rc_mode, "CBR")) {
 			venc_chn_attr.stRcAttr.stH264Cbr.u32BitRate = value;
 		} else {
 			venc_chn_attr.stRcAttr.stH264Vbr.u32MinBitRate = value / 3;
 			venc_chn_attr.stRcAttr.stH264Vbr.u32BitRate = value / 3 * 2;
 			venc_chn_attr.stRcAttr.stH264Vbr.u32MaxBitRate = value;
 		}
-	} else if (!strcmp(tmp_output_data_type, "H.265")) {
-		if (!strcmp(tmp_rc_mode, "CBR")) {
+	} else if (!strcmp(output_data_type, "H.265")) {
+		if (!strcmp(rc_mode, "CBR")) {
 			venc_chn_attr.stRcAttr.stH265Cbr.u32BitRate = value;
 		} else {
 			venc_chn_attr.stRcAttr.stH265Vbr.u32MinBitRate = value / 3;
@@ -2058,16 +2171,125 @@ int rk_video_set_max_rate(int stream_id, int value) {
 			venc_chn_attr.stRcAttr.stH265Vbr.u32MaxBitRate = value;
 		}
 	} else {
-		LOG_ERROR("tmp_output_data_type is %s, not support\n", tmp_output_data_type);
+		LOG_ERROR("output_data_type is %s, not support\n", output_data_type);
 		return -1;
 	}
 	RK_MPI_VENC_SetChnAttr(stream_id, &venc_chn_attr);
+
+	return 0;
+}
+
+// RTMP and RTSP rate control and the card that is recorded to each ask for a bitrate,
+// the lowest one under video.N:max_rate is applied, 0 is no limit. The frame rate only
+// comes from RTSP.
+enum { VENC_LIMIT_RTMP, VENC_LIMIT_RTSP, VENC_LIMIT_STORAGE, VENC_LIMIT_NUM };
+static int g_venc_limit_kbps[2][VENC_LIMIT_NUM];
+static pthread_mutex_t g_venc_limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// called with g_venc_limit_mutex held
+static int rkipc_venc_apply_limit(int stream_id, int max_rate) {
+	int value = max_rate;
+
+	for (int i = 0; stream_id >= 0 && stream_id < 2 && i < VENC_LIMIT_NUM; i++) {
+		if (g_venc_limit_kbps[stream_id][i] > 0 && g_venc_limit_kbps[stream_id][i] < value)
+			value = g_venc_limit_kbps[stream_id][i];
+	}
+
+	return rkipc_venc_set_bitrate(stream_id, value);
+}
+
+static int rkipc_venc_set_limit(int stream_id, int source, int kbps) {
+	char entry[128] = {'\0'};
+	int ret;
+
+	if (stream_id < 0 || stream_id > 1)
+		return -1;
 	snprintf(entry, 127, "video.%d:max_rate", stream_id);
-	rk_param_set_int(entry, value);
-	snprintf(entry, 127, "video.%d:mid_rate", stream_id);
-	rk_param_set_int(entry, value / 3 * 2);
-	snprintf(entry, 127, "video.%d:min_rate", stream_id);
-	rk_param_set_int(entry, value / 3);
+	pthread_mutex_lock(&g_venc_limit_mutex);
+	g_venc_limit_kbps[stream_id][source] = kbps > 0 ? kbps : 0;
+	ret = rkipc_venc_apply_limit(stream_id, rk_param_get_int(entry, 1024));
+	pthread_mutex_unlock(&g_venc_limit_mutex);
+
+	return ret;
+}
+
+int rk_video_set_max_rate(int stream_id, int value) {
+	char entry[128] = {'\0'};
+	int ret;
+
+	// the limits in force stay in force under the new ceiling
+	pthread_mutex_lock(&g_venc_limit_mutex);
+	ret = rkipc_venc_apply_limit(stream_id, value);
+	if (!ret) {
+		snprintf(entry, 127, "video.%d:max_rate", stream_id);
+		rk_param_set_int(entry, value);
+		snprintf(entry, 127, "video.%d:mid_rate", stream_id);
+		rk_param_set_int(entry, value / 3 * 2);
+		snprintf(entry, 127, "video.%d:min_rate", stream_id);
+		rk_param_set_int(entry, value / 3);
+	}
+	pthread_mutex_unlock(&g_venc_limit_mutex);
+
+	return ret ? -1 : 0;
+}
+
+// VENC drops frames down to fps, at or above the configured rate it is restored
+static int rkipc_venc_set_fps(int stream_id, int fps) {
+	VENC_CHN_ATTR_S venc_chn_attr;
+	char entry[128] = {'\0'};
+	int num, den;
+
+	snprintf(entry, 127, "video.%d:dst_frame_rate_num", stream_id);
+	num = rk_param_get_int(entry, 30);
+	snprintf(entry, 127, "video.%d:dst_frame_rate_den", stream_id);
+	den = rk_param_get_int(entry, 1);
+	if (fps > 0 && fps * den < num) {
+		num = fps;
+		den = 1;
+	}
+	memset(&venc_chn_attr, 0, sizeof(venc_chn_attr));
+	RK_MPI_VENC_GetChnAttr(stream_id, &venc_chn_attr);
+	switch (venc_chn_attr.stRcAttr.enRcMode) {
+	case VENC_RC_MODE_H264CBR:
+		venc_chn_attr.stRcAttr.stH264Cbr.fr32DstFrameRateNum = num;
+		venc_chn_attr.stRcAttr.stH264Cbr.fr32DstFrameRateDen = den;
+		break;
+	case VENC_RC_MODE_H264VBR:
+		venc_chn_attr.stRcAttr.stH264Vbr.fr32DstFrameRateNum = num;
+		venc_chn_attr.stRcAttr.stH264Vbr.fr32DstFrameRateDen = den;
+		break;
+	case VENC_RC_MODE_H265CBR:
+		venc_chn_attr.stRcAttr.stH265Cbr.fr32DstFrameRateNum = num;
+		venc_chn_attr.stRcAttr.stH265Cbr.fr32DstFrameRateDen = den;
+		break;
+	case VENC_RC_MODE_H265VBR:
+		venc_chn_attr.stRcAttr.stH265Vbr.fr32DstFrameRateNum = num;
+		venc_chn_attr.stRcAttr.stH265Vbr.fr32DstFrameRateDen = den;
+		break;
+	default:
+		return -1;
+	}
+
+	return RK_MPI_VENC_SetChnAttr(stream_id, &venc_chn_attr);
+}
+
+static int rkipc_rtmp_set_bitrate(int stream_id, int kbps) {
+	return rkipc_venc_set_limit(stream_id, VENC_LIMIT_RTMP, kbps);
+}
+
+static int rkipc_rtmp_request_idr(int stream_id) {
+	return RK_MPI_VENC_RequestIDR(stream_id, RK_FALSE);
+}
+
+static int rkipc_storage_set_bitrate(int stream_id, int kbps) {
+	return rkipc_venc_set_limit(stream_id, VENC_LIMIT_STORAGE, kbps);
+}
+
+static int rkipc_rtsp_set_rate(int stream_id, int kbps, int fps) {
+	if (rkipc_venc_set_limit(stream_id, VENC_LIMIT_RTSP, kbps))
+		return -1;
+	if (rkipc_venc_set_fps(stream_id, fps))
+		LOG_WARN("%d: set fps %d fail\n", stream_id, fps);
 
 	return 0;
 }
@@ -3192,6 +3414,15 @@ int rk_video_init() {
 	// if (g_enable_vo)
 	// 	ret |= rkipc_pipe_vpss_vo_init();
 	rk_roi_set_callback_register(rk_roi_set);
+	// the new channels start at max_rate, the sources ask again, storage as it registers
+	pthread_mutex_lock(&g_venc_limit_mutex);
+	memset(g_venc_limit_kbps, 0, sizeof(g_venc_limit_kbps));
+	pthread_mutex_unlock(&g_venc_limit_mutex);
+	rk_rtmp_bitrate_set_callback_register(rkipc_rtmp_set_bitrate);
+	rk_rtmp_request_idr_callback_register(rkipc_rtmp_request_idr);
+	rk_storage_bitrate_set_callback_register(rkipc_storage_set_bitrate);
+	rkipc_rtsp_rate_set_callback_register(rkipc_rtsp_set_rate);
+	rkipc_rtsp_playback_catalog_callback_register(rk_storage_find_segment);
 	ret |= rk_roi_set_all();
 	// rk_region_clip_set_callback_register(rk_region_clip_set);
 	// rk_region_clip_set_all();
@@ -3215,6 +3446,11 @@ int rk_video_deinit() {
 		ret |= rkipc_pipe_2_deinit();
 	// rk_region_clip_set_callback_register(NULL);
 	rk_roi_set_callback_register(NULL);
+	rk_rtmp_bitrate_set_callback_register(NULL);
+	rk_rtmp_request_idr_callback_register(NULL);
+	rk_storage_bitrate_set_callback_register(NULL);
+	rkipc_rtsp_rate_set_callback_register(NULL);
+	rkipc_rtsp_playback_catalog_callback_register(NULL);
 	if (enable_osd)
 		ret |= rkipc_osd_deinit();
 	// if (g_enable_vo)
@@ -3227,6 +3463,11 @@ int rk_video_deinit() {
 		pthread_join(venc_thread_1, NULL);
 		ret |= rkipc_pipe_1_deinit();
 	}
+	for (int i = 0; i < 2; i++) {
+		free(g_venc_detections[i].frame);
+		g_venc_detections[i].frame = NULL;
+		g_venc_detections[i].frame_cap = 0;
+	}
 	if (enable_jpeg) {
 		if (rk_param_get_int("video.jpeg:enable_cycle_snapshot", 0)) {
 			cycle_snapshot_flag = 0;
@@ -90,6 +90,8 @@ int main(int argc, char **argv) {
 	// init
 	// rk_network_init(NULL);
 	rk_param_init(rkipc_ini_path_);
+	rkipc_log_init_from_ini();
+	rkipc_metrics_init_from_ini();
 	rk_system_init();
 	rkipc_read_venctype_from_meta();
 	if (rk_param_get_int("video.source:enable_aiq", 1)) {
@@ -121,6 +123,8 @@ int main(int argc, char **argv) {
 	RK_MPI_SYS_Exit();
 	if (rk_param_get_int("video.source:enable_npu", 0))
 		rkipc_rockiva_deinit();
+	rkipc_metrics_deinit();
+	rkipc_log_deinit();
 	rk_param_deinit();
 	// rk_network_deinit();
 
@@ -185,6 +185,8 @@ int main(int argc, char **argv) {
 
 	// init
 	rk_param_init(rkipc_ini_path_);
+	rkipc_log_init_from_ini();
+	rkipc_metrics_init_from_ini();
 	LOG_INFO("%s: rk_param_init over\n", get_time_string());
 	RK_MPI_SYS_Init();
 	LOG_INFO("%s: RK_MPI_SYS_Init over\n", get_time_string());
@@ -240,6 +242,8 @@ int main(int argc, char **argv) {
 	RK_MPI_SYS_Exit();
 	if (rk_param_get_int("video.1:enable_npu", 0))
 		rkipc_rockiva_deinit();
+	rkipc_metrics_deinit();
+	rkipc_log_deinit();
 	rk_param_deinit();
 
 	return 0;
@@ -24,6 +24,7 @@
 
 #include <rk_debug.h>
 #include <rk_mpi_mb.h>
+#include <rk_mpi_mmz.h>
 #include <rk_mpi_rgn.h>
 #include <rk_mpi_sys.h>
 #include <rk_mpi_venc.h>
@@ -175,6 +175,8 @@ int main(int argc, char **argv) {
 	int ret;
 
 	rkipc_get_opt(argc, argv);
+	// no ini here, the log:* defaults apply
+	rkipc_log_init_from_ini();
 	LOG_INFO("rkipc_iq_file_path_ is %s, rkipc_log_level is %d\n", rkipc_iq_file_path_,
 	         rkipc_log_level);
 	LOG_INFO("input_width is %d, input_height is %d\n", input_width, input_height);
@@ -369,6 +371,7 @@ int main(int argc, char **argv) {
 	rk_isp_deinit(0);
 	free(tmp_buffers);
 	//	fclose(pfile);
+	rkipc_log_deinit();
 
 	return 0;
 }
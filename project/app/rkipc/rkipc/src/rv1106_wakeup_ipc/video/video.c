@@ -4,6 +4,7 @@
 
 #include "video.h"
 #include "audio.h"
+#include "rga_draw.h"
 #include "rockiva.h"
 
 #define HAS_VO 0
@@ -293,19 +294,6 @@ static void *rkipc_get_vi_send_jpeg(void *arg) {
 	return NULL;
 }
 
-static int rga_nv12_border(rga_buffer_t buf, int x, int y, int width, int height, int line_pixel,
-                           int color) {
-	im_rect rect_up = {x, y, width, line_pixel};
-	im_rect rect_buttom = {x, y + height - line_pixel, width, line_pixel};
-	im_rect rect_left = {x, y, line_pixel, height};
-	im_rect rect_right = {x + width - line_pixel, y, line_pixel, height};
-	IM_STATUS STATUS = imfill(buf, rect_up, color);
-	STATUS |= imfill(buf, rect_buttom, color);
-	STATUS |= imfill(buf, rect_left, color);
-	STATUS |= imfill(buf, rect_right, color);
-	return STATUS == IM_STATUS_SUCCESS ? 0 : 1;
-}
-
 static void *rkipc_get_vi_draw_send_venc(void *arg) {
 	LOG_DEBUG("#Start %s thread, arg:%p\n", __func__, arg);
 	prctl(PR_SET_NAME, "RkipcVi2Venc", 0, 0, 0);
@@ -320,9 +308,12 @@ static void *rkipc_get_vi_draw_send_venc(void *arg) {
 	RockIvaBaObjectInfo *object;
 	rga_buffer_handle_t handle;
 	rga_buffer_t src;
+	rga_draw_list_s draw_list;
+	int release_fence_fd;
 
 	memset(&ba_result, 0, sizeof(ba_result));
 	memset(&param, 0, sizeof(im_handle_param_t));
+	rga_draw_init();
 	while (g_video_run_) {
 		// 5.get the frame
 		ret = RK_MPI_VI_GetChnFrame(pipe_id_, VIDEO_PIPE_1, &stViFrame, 1000);
@@ -339,8 +330,11 @@ static void *rkipc_get_vi_draw_send_venc(void *arg) {
 				src = wrapbuffer_handle_t(handle, stViFrame.stVFrame.u32Width,
 				                          stViFrame.stVFrame.u32Height, stViFrame.stVFrame.u32Width,
 				                          stViFrame.stVFrame.u32Height, RK_FORMAT_YCbCr_420_SP);
+				// lets rga_draw fall back to the CPU
+				src.vir_addr = RK_MPI_MB_Handle2VirAddr(stViFrame.stVFrame.pMbBlk);
 				if (!ret)
 					last_ba_result_time = rkipc_get_curren_time_ms();
+				rga_draw_list_reset(&draw_list, line_pixel);
 				for (int i = 0; i < ba_result.objNum; i++) {
 					int x, y, w, h;
 					object = &ba_result.triggerObjects[i];
@@ -369,7 +363,7 @@ static void *rkipc_get_vi_draw_send_venc(void *arg) {
 						h -= 8;
 					}
 					LOG_DEBUG("i is %d, x,y,w,h is %d,%d,%d,%d\n", i, x, y, w, h);
-					rga_nv12_border(src, x, y, w, h, line_pixel, 0x000000ff);
+					rga_draw_list_add_rect(&draw_list, x, y, w, h, 0x000000ff);
 					// LOG_INFO("draw rect time-consuming is %lld\n",(rkipc_get_curren_time_ms() -
 					// last_ba_result_time));
 					// LOG_INFO("triggerRules is %d, ruleID is %d, triggerType is %d\n",
@@ -377,6 +371,12 @@ static void *rkipc_get_vi_draw_send_venc(void *arg) {
 					//          object->firstTrigger.ruleID,
 					//          object->firstTrigger.triggerType);
 				}
+				// all boxes go out as one job, wait for it before the frame reaches venc
+				draw_list.object_num = ba_result.objNum;
+				if (!rga_draw_submit(src, &draw_list, &release_fence_fd))
+					rga_draw_wait(&draw_list, release_fence_fd);
+				if (draw_list.cpu_used)
+					RK_MPI_SYS_MmzFlushCache(stViFrame.stVFrame.pMbBlk, RK_FALSE);
 				releasebuffer_handle(handle);
 			}
 
@@ -96,6 +96,8 @@ int main(int argc, char **argv) {
 
 	// init
 	rk_param_init(rkipc_ini_path_);
+	rkipc_log_init_from_ini();
+	rkipc_metrics_init_from_ini();
 	rk_network_init(NULL);
 	rk_system_init();
 	if (rk_param_get_int("video.source:enable_npu", 0))
@@ -126,6 +128,8 @@ int main(int argc, char **argv) {
 	if (rk_param_get_int("video.source:enable_npu", 0))
 		rkipc_rockiva_deinit();
 	rk_network_deinit();
+	rkipc_metrics_deinit();
+	rkipc_log_deinit();
 	rk_param_deinit();
 	LOG_INFO("rkipc deinit finished.\n");
 
@@ -186,6 +186,8 @@ int main(int argc, char **argv) {
 	LOG_INFO("tb_start_wifi.sh over\n");
 	// init
 	rk_param_init(rkipc_ini_path_);
+	rkipc_log_init_from_ini();
+	rkipc_metrics_init_from_ini();
 	rk_isp_init(0, rkipc_iq_file_path_);
 	rk_isp_set_frame_rate_without_ini(0, rk_param_get_int("isp.0.adjustment:fps", 30));
 	rk_video_init();
@@ -201,6 +203,8 @@ int main(int argc, char **argv) {
 	rk_video_deinit();
 	rk_isp_deinit(0);
 	rk_audio_deinit();
+	rkipc_metrics_deinit();
+	rkipc_log_deinit();
 	rk_param_deinit();
 
 	return 0;
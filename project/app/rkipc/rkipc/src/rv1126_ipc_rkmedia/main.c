@@ -97,6 +97,8 @@ int main(int argc, char **argv) {
 
 	// init
 	rk_param_init(rkipc_ini_path_);
+	rkipc_log_init_from_ini();
+	rkipc_metrics_init_from_ini();
 	rk_system_init();
 	rk_isp_init(0, rkipc_iq_file_path_);
 	rk_video_init();
@@ -117,6 +119,8 @@ int main(int argc, char **argv) {
 	rkipc_audio_deinit();
 	rk_video_deinit();
 	rk_isp_deinit(0);
+	rkipc_metrics_deinit();
+	rkipc_log_deinit();
 	rk_param_deinit();
 
 	return 0;
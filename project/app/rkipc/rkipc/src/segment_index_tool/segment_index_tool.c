@@ -0,0 +1,539 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Keyframe index sidecars of recordings, see common/storage/segment_index.h:
+//   build - write the sidecars of recordings made without them, files or folders
+//   dump  - print the records of a recording's sidecar
+//   seek  - save the I frame of a folder at a local time as an Annex B file, -s takes it
+//           from the sub stream track of a multi-track recording
+//   bench - record a catalog of synthetic segments, index it and check that every
+//           seek lands on the right I frame, with the time a lookup takes
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fmp4.h"
+#include "log.h"
+#include "segment_index.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "segment_index_tool.c"
+
+#define TOOL_NAME_LEN 256
+
+enum { CMD_BUILD, CMD_DUMP, CMD_SEEK, CMD_BENCH };
+
+int enable_minilog = 0;
+int rkipc_log_level = LOG_LEVEL_WARN;
+
+static int g_cmd = -1;
+static int g_force;
+static int g_sub;
+static int g_quiet;
+static int g_count = 2000;
+static int g_length = 10;
+static int g_queries = 10000;
+static const char *g_time;
+static const char *g_file = "key_frame.h264";
+static const char *g_dir = "/tmp/segment_index_bench";
+
+static const char short_options[] = "Fsn:l:q:t:f:d:h";
+static const struct option long_options[] = {{"force", no_argument, NULL, 'F'},
+                                             {"sub", no_argument, NULL, 's'},
+                                             {"count", required_argument, NULL, 'n'},
+                                             {"length", required_argument, NULL, 'l'},
+                                             {"queries", required_argument, NULL, 'q'},
+                                             {"time", required_argument, NULL, 't'},
+                                             {"file", required_argument, NULL, 'f'},
+                                             {"dir", required_argument, NULL, 'd'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s build|dump|seek|bench [options] [files or folders]\n"
+	        "Options:\n"
+	        "-F | --force    build: replace sidecars that exist\n"
+	        "-t | --time     seek: local time, YYYYmmddHHMMSS[.mmm]\n"
+	        "-f | --file     seek: Annex B output, default is key_frame.h264\n"
+	        "-s | --sub      seek: from the sub stream track\n"
+	        "-d | --dir      bench: catalog folder, default is /tmp/segment_index_bench\n"
+	        "-n | --count    bench: segments, default is 2000\n"
+	        "-l | --length   bench: seconds per segment, default is 10\n"
+	        "-q | --queries  bench: seeks, default is 10000\n"
+	        "-h | --help     for help\n\n",
+	        argv[0]);
+}
+
+static long long now_us() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int is_mp4(const char *name) {
+	const char *ext = strrchr(name, '.');
+
+	return ext && !strcmp(ext, ".mp4");
+}
+
+static int build_file(const char *path) {
+	rk_segment_index_t *index;
+	char sidecar[512];
+	int64_t start;
+	struct stat st;
+	int keys;
+
+	if (rk_segment_index_path(path, sidecar, sizeof(sidecar)) || stat(path, &st))
+		return -1;
+	if (!g_force && !access(sidecar, F_OK))
+		return 0;
+	// recordings are named by their start, anything else starts at its modification
+	start = rk_segment_index_name_time(path);
+	if (start < 0)
+		start = (int64_t)st.st_mtime * 1000;
+	index = rk_segment_index_open(path, start);
+	if (!index)
+		return -1;
+	keys = rk_segment_index_build(index);
+	rk_segment_index_close(index);
+	if (keys < 0) {
+		rk_segment_index_remove(path);
+		printf("%s: not an MP4 with a video track\n", path);
+		return -1;
+	}
+	if (!g_quiet)
+		printf("%s: %d key frames\n", path, keys);
+
+	return 1;
+}
+
+static int cmd_build(int argc, char **argv) {
+	char path[TOOL_NAME_LEN * 2];
+	struct dirent *entry;
+	struct stat st;
+	int built = 0, failed = 0, ret;
+	DIR *dir;
+
+	for (int i = 0; i < argc; i++) {
+		if (stat(argv[i], &st)) {
+			printf("%s: %s\n", argv[i], strerror(errno));
+			failed++;
+			continue;
+		}
+		if (!S_ISDIR(st.st_mode)) {
+			ret = build_file(argv[i]);
+			built += ret > 0;
+			failed += ret < 0;
+			continue;
+		}
+		dir = opendir(argv[i]);
+		while (dir && (entry = readdir(dir)) != NULL) {
+			if (!is_mp4(entry->d_name))
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", argv[i], entry->d_name);
+			ret = build_file(path);
+			built += ret > 0;
+			failed += ret < 0;
+		}
+		if (dir)
+			closedir(dir);
+	}
+	if (!g_quiet)
+		printf("built %d, failed %d\n", built, failed);
+
+	return failed ? -1 : 0;
+}
+
+static int cmd_dump(int argc, char **argv) {
+	rk_segment_index_s index;
+
+	for (int i = 0; i < argc; i++) {
+		if (rk_segment_index_load(argv[i], &index)) {
+			printf("%s: no sidecar\n", argv[i]);
+			continue;
+		}
+		printf("%s: %s, start %lld ms, %d bytes of parameter sets, %d keys, %d events\n",
+		       argv[i], index.header.h265 ? "H.265" : "H.264",
+		       (long long)index.header.start_time_ms, index.header.param_size, index.key_num,
+		       index.event_num);
+		for (int j = 0; j < index.key_num; j++)
+			printf("  key   %lld ms  pts %lld us  offset %llu  size %u\n",
+			       (long long)index.key[j].wall_time_ms, (long long)index.key[j].pts_us,
+			       (unsigned long long)index.key[j].offset, index.key[j].size);
+		for (int j = 0; j < index.event_num; j++)
+			printf("  event %lld ms  flags 0x%x\n", (long long)index.event[j].wall_time_ms,
+			       index.event[j].flags);
+		rk_segment_index_free(&index);
+	}
+
+	return 0;
+}
+
+typedef struct {
+	char (*name)[TOOL_NAME_LEN];
+	int num;
+} catalog_s;
+
+static int name_compare(const void *a, const void *b) { return strcmp(a, b); }
+
+static int catalog_load(const char *folder, catalog_s *catalog) {
+	struct dirent *entry;
+	int cap = 0;
+	DIR *dir = opendir(folder);
+
+	memset(catalog, 0, sizeof(*catalog));
+	if (!dir)
+		return -1;
+	while ((entry = readdir(dir)) != NULL) {
+		if (!is_mp4(entry->d_name))
+			continue;
+		if (catalog->num == cap) {
+			cap = cap ? cap * 2 : 1024;
+			catalog->name = realloc(catalog->name, cap * TOOL_NAME_LEN);
+			if (!catalog->name)
+				break;
+		}
+		snprintf(catalog->name[catalog->num++], TOOL_NAME_LEN, "%s", entry->d_name);
+	}
+	closedir(dir);
+	if (!catalog->name)
+		return -1;
+	qsort(catalog->name, catalog->num, TOOL_NAME_LEN, name_compare);
+
+	return 0;
+}
+
+// the last segment starting at or before the time, as rk_storage_get_key_frame picks it
+static int catalog_find(const catalog_s *catalog, int64_t wall_time_ms) {
+	char name[32];
+	int low = 0, high = catalog->num - 1, mid;
+
+	if (!catalog->num || rk_segment_index_name(wall_time_ms, name, sizeof(name)))
+		return -1;
+	if (strncmp(catalog->name[0], name, 14) > 0)
+		return -1;
+	while (low < high) {
+		mid = (low + high + 1) / 2;
+		if (strncmp(catalog->name[mid], name, 14) <= 0)
+			low = mid;
+		else
+			high = mid - 1;
+	}
+
+	return low;
+}
+
+static int seek_key_frame(const char *folder, const catalog_s *catalog, int64_t wall_time_ms,
+                          unsigned char **buffer, int *size, rk_segment_index_record_s *record) {
+	char path[TOOL_NAME_LEN * 2];
+	int i = catalog_find(catalog, wall_time_ms);
+
+	if (i < 0)
+		return -1;
+	snprintf(path, sizeof(path), "%s/%s", folder, catalog->name[i]);
+	if (g_sub)
+		return rk_segment_index_scan_key_frame(path, 1, wall_time_ms, 1, buffer, size, record);
+
+	return rk_segment_index_read_key_frame(path, wall_time_ms, 1, buffer, size, record);
+}
+
+static int cmd_seek(int argc, char **argv) {
+	rk_segment_index_record_s record;
+	unsigned char *buffer;
+	catalog_s catalog;
+	int64_t wall_time_ms;
+	int size, ms = 0;
+	FILE *fp;
+
+	if (argc < 1 || !g_time) {
+		printf("seek needs a folder and -t\n");
+		return -1;
+	}
+	wall_time_ms = rk_segment_index_name_time(g_time);
+	if (wall_time_ms < 0) {
+		printf("bad time %s\n", g_time);
+		return -1;
+	}
+	if (strchr(g_time, '.'))
+		ms = atoi(strchr(g_time, '.') + 1);
+	wall_time_ms += ms;
+	if (catalog_load(argv[0], &catalog))
+		return -1;
+	if (seek_key_frame(argv[0], &catalog, wall_time_ms, &buffer, &size, &record)) {
+		printf("no key frame at %s\n", g_time);
+		free(catalog.name);
+		return -1;
+	}
+	free(catalog.name);
+	fp = fopen(g_file, "wb");
+	if (fp) {
+		fwrite(buffer, 1, size, fp);
+		fclose(fp);
+	}
+	printf("key frame %lld ms before, %d bytes to %s\n",
+	       (long long)(wall_time_ms - record.wall_time_ms), size, g_file);
+	free(buffer);
+
+	return fp ? 0 : -1;
+}
+
+// synthetic H.264, 25 fps, an I frame every second, each slice carries its time in the file
+#define BENCH_FPS 25
+#define BENCH_GOP 25
+
+static int bench_frame(unsigned char *buf, int n) {
+	static const unsigned char sps[] = {0x67, 0x42, 0x00, 0x1f, 0xe9, 0x02, 0xc1, 0x2c, 0x80};
+	static const unsigned char pps[] = {0x68, 0xce, 0x06, 0xe2};
+	int len = 0, ms = n * 1000 / BENCH_FPS, key = n % BENCH_GOP == 0;
+	int size = key ? 2000 : 200;
+
+	if (key) {
+		memcpy(buf, "\0\0\0\1", 4);
+		memcpy(buf + 4, sps, sizeof(sps));
+		memcpy(buf + 4 + sizeof(sps), "\0\0\0\1", 4);
+		memcpy(buf + 8 + sizeof(sps), pps, sizeof(pps));
+		len = 8 + sizeof(sps) + sizeof(pps);
+	}
+	memcpy(buf + len, "\0\0\0\1", 4);
+	buf[len + 4] = key ? 0x65 : 0x41;
+	len += 5;
+	memcpy(buf + len, &ms, sizeof(ms));
+	len += sizeof(ms);
+	memset(buf + len, 0x5a, size);
+	len += size;
+	buf[len++] = 0x80;
+
+	return len;
+}
+
+// time of the I frame in an Annex B buffer, -1 without one or without an SPS before it
+static int bench_frame_time(const unsigned char *buf, int size) {
+	int sps = 0, ms;
+
+	for (int i = 0; i + 4 < size; i++) {
+		if (buf[i] || buf[i + 1] || buf[i + 2] != 1)
+			continue;
+		if ((buf[i + 3] & 0x1f) == 7)
+			sps = 1;
+		if ((buf[i + 3] & 0x1f) == 5 && i + 8 <= size && sps) {
+			memcpy(&ms, buf + i + 4, sizeof(ms));
+			return ms;
+		}
+	}
+
+	return -1;
+}
+
+static int bench_record(const char *path, rk_segment_index_t *index) {
+	rk_fmp4_config_s config = {.video_codec = "H.264", .width = 1280, .height = 720,
+	                           .fragment_ms = 4000, .index = index};
+	static unsigned char buf[4096];
+	rk_fmp4_t *fmp4 = rk_fmp4_open(path, &config);
+
+	if (!fmp4)
+		return -1;
+	for (int n = 0; n < g_length * BENCH_FPS; n++)
+		rk_fmp4_write_video(fmp4, buf, bench_frame(buf, n), (int64_t)n * 1000000 / BENCH_FPS,
+		                    n % BENCH_GOP == 0);
+
+	return rk_fmp4_close(fmp4);
+}
+
+// a sidecar written while recording has to agree with one built from the file
+static int bench_compare(const char *path) {
+	rk_segment_index_s live, built;
+	rk_segment_index_t *index;
+	int ret = 0;
+
+	index = rk_segment_index_open(path, 0);
+	if (!index || bench_record(path, index)) {
+		rk_segment_index_close(index);
+		return -1;
+	}
+	rk_segment_index_close(index);
+	if (rk_segment_index_load(path, &live))
+		return -1;
+	g_force = 1;
+	build_file(path);
+	if (rk_segment_index_load(path, &built)) {
+		rk_segment_index_free(&live);
+		return -1;
+	}
+	if (live.key_num != built.key_num || live.header.param_size != built.header.param_size ||
+	    memcmp(live.header.param, built.header.param, live.header.param_size))
+		ret = -1;
+	for (int i = 0; !ret && i < live.key_num; i++) {
+		if (live.key[i].offset != built.key[i].offset || live.key[i].size != built.key[i].size ||
+		    live.key[i].pts_us != built.key[i].pts_us)
+			ret = -1;
+	}
+	printf("live and built sidecars: %d and %d keys, %s\n", live.key_num, built.key_num,
+	       ret ? "different" : "same");
+	rk_segment_index_free(&live);
+	rk_segment_index_free(&built);
+
+	return ret;
+}
+
+static int latency_compare(const void *a, const void *b) {
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int cmd_bench() {
+	char path[TOOL_NAME_LEN * 2], *argv[1] = {(char *)g_dir};
+	int64_t start, span, wall_time_ms, expect;
+	rk_segment_index_record_s record;
+	long long begin, *latency;
+	int size, wrong = 0, missed = 0, ms;
+	unsigned char *buffer;
+	catalog_s catalog;
+	struct tm tm = {0};
+
+	mkdir(g_dir, 0777);
+	// a fixed local start, the names then follow from the segment length
+	tm.tm_year = 2023 - 1900;
+	tm.tm_mday = 1;
+	tm.tm_isdst = -1;
+	start = (int64_t)mktime(&tm) * 1000;
+	span = (int64_t)g_length * 1000;
+	begin = now_us();
+	for (int i = 0; i < g_count; i++) {
+		char name[32];
+
+		rk_segment_index_name(start + i * span, name, sizeof(name));
+		snprintf(path, sizeof(path), "%s/%s.mp4", g_dir, name);
+		if (access(path, F_OK) && bench_record(path, NULL)) {
+			printf("record %s fail\n", path);
+			return -1;
+		}
+	}
+	printf("%d segments of %d s in %lld ms\n", g_count, g_length, (now_us() - begin) / 1000);
+	begin = now_us();
+	g_force = 1;
+	g_quiet = 1;
+	if (cmd_build(1, argv))
+		return -1;
+	printf("sidecars built in %lld ms\n", (now_us() - begin) / 1000);
+
+	snprintf(path, sizeof(path), "%s/compare.mp4", g_dir);
+	if (bench_compare(path))
+		return -1;
+	unlink(path);
+	rk_segment_index_remove(path);
+
+	if (catalog_load(g_dir, &catalog))
+		return -1;
+	latency = malloc(g_queries * sizeof(*latency));
+	if (!latency)
+		return -1;
+	srand(time(NULL));
+	for (int q = 0; q < g_queries; q++) {
+		wall_time_ms = start + (((int64_t)rand() << 16) ^ rand()) % (g_count * span);
+		// the I frame at or before the time, within its segment
+		expect = (wall_time_ms - start) % span / 1000 * 1000;
+		begin = now_us();
+		if (seek_key_frame(g_dir, &catalog, wall_time_ms, &buffer, &size, &record)) {
+			latency[q] = now_us() - begin;
+			missed++;
+			continue;
+		}
+		latency[q] = now_us() - begin;
+		ms = bench_frame_time(buffer, size);
+		if (ms != expect || record.wall_time_ms != wall_time_ms - (wall_time_ms - start) % 1000)
+			wrong++;
+		free(buffer);
+	}
+	qsort(latency, g_queries, sizeof(*latency), latency_compare);
+	printf("%d seeks in %d segments: %d wrong, %d missed, lookup %lld us median, %lld us p99, "
+	       "%lld us max\n",
+	       g_queries, catalog.num, wrong, missed, latency[g_queries / 2],
+	       latency[g_queries * 99 / 100], latency[g_queries - 1]);
+	free(latency);
+	free(catalog.name);
+
+	return wrong || missed ? -1 : 0;
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1 && argv[1][0] != '-') {
+		if (!strcmp(argv[1], "build"))
+			g_cmd = CMD_BUILD;
+		else if (!strcmp(argv[1], "dump"))
+			g_cmd = CMD_DUMP;
+		else if (!strcmp(argv[1], "seek"))
+			g_cmd = CMD_SEEK;
+		else if (!strcmp(argv[1], "bench"))
+			g_cmd = CMD_BENCH;
+		argc--;
+		argv++;
+	}
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case 'F':
+			g_force = 1;
+			break;
+		case 's':
+			g_sub = 1;
+			break;
+		case 'n':
+			g_count = atoi(optarg);
+			break;
+		case 'l':
+			g_length = atoi(optarg);
+			break;
+		case 'q':
+			g_queries = atoi(optarg);
+			break;
+		case 't':
+			g_time = optarg;
+			break;
+		case 'f':
+			g_file = optarg;
+			break;
+		case 'd':
+			g_dir = optarg;
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			return 0;
+		default:
+			usage_tip(stderr, argv);
+			return -1;
+		}
+	}
+	if (g_count < 1 || g_length < 1 || g_queries < 1) {
+		usage_tip(stderr, argv);
+		return -1;
+	}
+
+	switch (g_cmd) {
+	case CMD_BUILD:
+		return cmd_build(argc - optind, argv + optind);
+	case CMD_DUMP:
+		return cmd_dump(argc - optind, argv + optind);
+	case CMD_SEEK:
+		return cmd_seek(argc - optind, argv + optind);
+	case CMD_BENCH:
+		return cmd_bench();
+	default:
+		usage_tip(stderr, argv);
+		return -1;
+	}
+}
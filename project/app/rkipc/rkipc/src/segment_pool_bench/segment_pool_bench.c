@@ -0,0 +1,482 @@
+// Copyright 2023 Rockchip Electronics Co., Ltd. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Days of segment rotation of a main and a sub stream recorded side by side, as
+// storage.0 and storage.1 do, with the oldest segment deleted and the next one created,
+// then again with a recording pool of the same size:
+//   mount -o loop card.img /mnt/card && segment_pool_bench -d /mnt/card -D 7
+// The clock of the recordings runs as fast as the disk takes the synthetic H.264 frames,
+// a week is 10080 segments of a minute per stream. Printed per run are the histograms of
+// the time a fragment takes to reach the disk and of a segment switch, and the extents a
+// segment ends up in, from FIEMAP.
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fmp4.h"
+#include "log.h"
+#include "metrics.h"
+#include "segment_pool.h"
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "segment_pool_bench.c"
+
+#define BENCH_NAME_LEN 256
+#define BENCH_FPS 25
+#define BENCH_GOP 50
+#define BENCH_STREAMS 2
+#define BENCH_BOUNDS 12
+
+int enable_minilog = 0;
+int rkipc_log_level = LOG_LEVEL_WARN;
+
+static const char *g_dir = "/tmp/segment_pool_bench";
+static int g_days = 7;
+static int g_segment = 60;
+static int g_kbps[BENCH_STREAMS] = {2048, 512};
+static int g_slots;
+static int g_fsync = 1;
+
+// 1 ms to 5 s, a card that is busy erasing takes hundreds of ms
+static const long long g_bounds[BENCH_BOUNDS] = {1000,   2000,   5000,    10000,   20000,   50000,
+                                                 100000, 200000, 500000, 1000000, 2000000, 5000000};
+static const char *g_stream_name[BENCH_STREAMS] = {"main", "sub"};
+
+typedef struct {
+	const char *name;
+	int pool;
+	rkipc_metric_t *write_us;
+	rkipc_metric_t *switch_us;
+	int segments;
+	int dropped;
+	int files;
+	long long extents;
+	double fill_ms;
+	double wall_ms;
+} bench_result_s;
+
+typedef struct {
+	unsigned char *data; // random bytes without zeros, no start code shows up in them
+	int size;
+	unsigned int seed;
+} bench_source_s;
+
+typedef struct {
+	char folder[BENCH_NAME_LEN];
+	int64_t slot_bytes;
+	int frame_size;
+	rk_segment_pool_t *pool;
+	rk_fmp4_t *fmp4;
+	char (*names)[32]; // the segments on disk, oldest first, for delete and create
+	int first;
+	int count;
+} bench_stream_s;
+
+static const char short_options[] = "d:D:l:m:s:n:f:h";
+static const struct option long_options[] = {{"dir", required_argument, NULL, 'd'},
+                                             {"days", required_argument, NULL, 'D'},
+                                             {"length", required_argument, NULL, 'l'},
+                                             {"main", required_argument, NULL, 'm'},
+                                             {"sub", required_argument, NULL, 's'},
+                                             {"slots", required_argument, NULL, 'n'},
+                                             {"fsync", required_argument, NULL, 'f'},
+                                             {"help", no_argument, NULL, 'h'},
+                                             {0, 0, 0, 0}};
+
+static void usage_tip(FILE *fp, char **argv) {
+	fprintf(fp,
+	        "Usage: %s [options]\n"
+	        "Options:\n"
+	        "-d | --dir       folder on the card, emptied first, default is "
+	        "/tmp/segment_pool_bench\n"
+	        "-D | --days      days of recording, default is 7\n"
+	        "-l | --length    seconds per segment, default is 60\n"
+	        "-m | --main      main stream kbps, default is 2048\n"
+	        "-s | --sub       sub stream kbps, default is 512\n"
+	        "-n | --slots     segments kept per stream, default fills 90%% of the free space\n"
+	        "-f | --fsync     fdatasync every n fragments, default is 1\n"
+	        "-h | --help      for help\n\n",
+	        argv[0]);
+}
+
+static int bench_source_init(bench_source_s *src, int size) {
+	src->data = malloc(size);
+	if (!src->data)
+		return -1;
+	src->size = size;
+	src->seed = 1;
+	for (int i = 0; i < size; i++)
+		src->data[i] = 1 + rand_r(&src->seed) % 255;
+
+	return 0;
+}
+
+// an Annex B frame of about size bytes, SPS and PPS in front of an I frame
+static int bench_frame(bench_source_s *src, unsigned char *out, int size, int key) {
+	static const unsigned char sps[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40,
+	                                    0x78, 0x02, 0x27, 0xe5, 0x84, 0x00, 0x00, 0x03, 0x00,
+	                                    0x04, 0x00, 0x00, 0x03, 0x00, 0xca, 0x3c, 0x60, 0xc6,
+	                                    0x58};
+	static const unsigned char pps[] = {0, 0, 0, 1, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+	int len = 0, offset;
+
+	if (size > src->size)
+		size = src->size;
+	if (key) {
+		memcpy(out, sps, sizeof(sps));
+		memcpy(out + sizeof(sps), pps, sizeof(pps));
+		len = sizeof(sps) + sizeof(pps);
+	}
+	memcpy(out + len, "\0\0\0\1", 4);
+	out[len + 4] = key ? 0x65 : 0x41;
+	offset = rand_r(&src->seed) % (src->size - size + 1);
+	memcpy(out + len + 5, src->data + offset, size - 5);
+
+	return len + size;
+}
+
+static double bench_now_ms() {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// removes the files of the folder and of its hidden folders, the pool and the index
+static void bench_clean(const char *dir) {
+	char path[BENCH_NAME_LEN * 2];
+	struct dirent *entry;
+	DIR *d = opendir(dir);
+
+	if (!d)
+		return;
+	while ((entry = readdir(d)) != NULL) {
+		if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (entry->d_type == DT_DIR) {
+			bench_clean(path);
+			rmdir(path);
+		} else {
+			remove(path);
+		}
+	}
+	closedir(d);
+}
+
+static int bench_file_extents(const char *path) {
+	struct fiemap map;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	memset(&map, 0, sizeof(map));
+	map.fm_length = FIEMAP_MAX_OFFSET;
+	map.fm_flags = FIEMAP_FLAG_SYNC;
+	if (ioctl(fd, FS_IOC_FIEMAP, &map))
+		map.fm_mapped_extents = 0;
+	close(fd);
+
+	return map.fm_mapped_extents;
+}
+
+// the recordings left in every folder and the extents they take
+static void bench_count(bench_stream_s *stream, bench_result_s *result) {
+	char path[BENCH_NAME_LEN * 2];
+	struct dirent *entry;
+	DIR *d;
+
+	for (int i = 0; i < BENCH_STREAMS; i++) {
+		d = opendir(stream[i].folder);
+		while (d && (entry = readdir(d)) != NULL) {
+			if (entry->d_name[0] == '.')
+				continue;
+			if (snprintf(path, sizeof(path), "%s/%s", stream[i].folder, entry->d_name) >=
+			    (int)sizeof(path))
+				continue;
+			result->files++;
+			result->extents += bench_file_extents(path);
+		}
+		if (d)
+			closedir(d);
+	}
+}
+
+// the next segment of a stream, the rotation storage does at the end of file_duration
+static int bench_switch(bench_stream_s *stream, bench_result_s *result, int64_t start_s,
+                        const rk_fmp4_config_s *base) {
+	char path[BENCH_NAME_LEN * 2], name[32];
+	rk_fmp4_config_s config = *base;
+	time_t t = start_s;
+	struct tm tm;
+
+	rk_fmp4_close(stream->fmp4);
+	stream->fmp4 = NULL;
+	gmtime_r(&t, &tm);
+	strftime(name, sizeof(name), "%Y%m%d%H%M%S.mp4", &tm);
+	if (!result->pool) {
+		// the scan thread of storage deletes by the quota, here by the number of slots
+		while (stream->count >= g_slots) {
+			if (snprintf(path, sizeof(path), "%s/%s", stream->folder,
+			             stream->names[stream->first]) < (int)sizeof(path))
+				remove(path);
+			stream->first = (stream->first + 1) % g_slots;
+			stream->count--;
+		}
+		snprintf(stream->names[(stream->first + stream->count++) % g_slots], 32, "%s", name);
+	}
+	if (snprintf(path, sizeof(path), "%s/%s", stream->folder, name) >= (int)sizeof(path))
+		return -1;
+	if (result->pool && !rk_segment_pool_take(stream->pool, path))
+		config.slot_bytes = stream->slot_bytes;
+	stream->fmp4 = rk_fmp4_open(path, &config);
+
+	return stream->fmp4 ? 0 : -1;
+}
+
+static int bench_run(bench_stream_s *stream, bench_result_s *result) {
+	const int64_t start_s = 1672531200; // 2023-01-01, the names of the segments
+	int64_t frames = (int64_t)g_days * 86400 * BENCH_FPS, pts;
+	rk_fmp4_config_s config[BENCH_STREAMS];
+	long long begin_us;
+	bench_source_s src;
+	unsigned char *frame;
+	double fill;
+	int size, key;
+
+	if (bench_source_init(&src, stream[0].frame_size * 8 + 4096))
+		return -1;
+	frame = malloc(src.size + 64);
+	if (!frame) {
+		free(src.data);
+		return -1;
+	}
+	for (int i = 0; i < BENCH_STREAMS; i++) {
+		bench_clean(stream[i].folder);
+		stream[i].first = stream[i].count = 0;
+		memset(&config[i], 0, sizeof(config[i]));
+		config[i].video_codec = "H.264";
+		config[i].width = i ? 704 : 1920;
+		config[i].height = i ? 576 : 1080;
+		config[i].fsync_fragments = g_fsync;
+		config[i].queue_bytes = 64 * 1024 * 1024;
+		config[i].write_us = result->write_us;
+	}
+	fill = bench_now_ms();
+	if (result->pool) {
+		// the slots are allocated while the card is empty, as after a format
+		for (int i = 0; i < BENCH_STREAMS; i++) {
+			stream[i].pool = rk_segment_pool_open(stream[i].folder, g_slots,
+			                                      stream[i].slot_bytes);
+			if (!stream[i].pool || rk_segment_pool_fill(stream[i].pool) < g_slots)
+				printf("%s: only room for part of %d slots\n", stream[i].folder, g_slots);
+		}
+	}
+	result->fill_ms = bench_now_ms() - fill;
+
+	result->wall_ms = bench_now_ms();
+	for (int64_t i = 0; i < frames; i++) {
+		pts = i * 1000000 / BENCH_FPS;
+		if (i % ((int64_t)g_segment * BENCH_FPS) == 0) {
+			for (int j = 0; j < BENCH_STREAMS; j++) {
+				begin_us = rkipc_metrics_now_us();
+				if (bench_switch(&stream[j], result, start_s + i / BENCH_FPS, &config[j])) {
+					printf("can not record to %s\n", stream[j].folder);
+					frames = 0;
+					break;
+				}
+				rkipc_metric_observe(result->switch_us, rkipc_metrics_now_us() - begin_us);
+			}
+			result->segments++;
+		}
+		key = i % BENCH_GOP == 0;
+		for (int j = 0; j < BENCH_STREAMS && frames; j++) {
+			size = stream[j].frame_size;
+			size = bench_frame(&src, frame, key ? size * 4 : size * 15 / 16, key);
+			result->dropped += rk_fmp4_write_video(stream[j].fmp4, frame, size, pts, key) < 0;
+		}
+	}
+	for (int i = 0; i < BENCH_STREAMS; i++) {
+		rk_fmp4_close(stream[i].fmp4);
+		stream[i].fmp4 = NULL;
+		rk_segment_pool_close(stream[i].pool);
+		stream[i].pool = NULL;
+	}
+	result->wall_ms = bench_now_ms() - result->wall_ms;
+	bench_count(stream, result);
+	free(frame);
+	free(src.data);
+
+	return 0;
+}
+
+// the cumulative buckets of a histogram from the Prometheus text of the metrics
+static void bench_buckets(const char *dump, const char *name, const char *strategy,
+                          long long *count) {
+	char key[128];
+	const char *p = dump;
+	int len, i = 0;
+
+	len = snprintf(key, sizeof(key), "%s_bucket{strategy=\"%s\",le=\"", name, strategy);
+	while ((p = strstr(p, key)) && i <= BENCH_BOUNDS) {
+		p = strchr(p + len, '}');
+		if (!p)
+			break;
+		count[i++] = atoll(p + 1);
+	}
+}
+
+static void bench_print(const char *dump, const char *name, const char *title) {
+	long long count[2][BENCH_BOUNDS + 1] = {{0}};
+
+	bench_buckets(dump, name, "delete", count[0]);
+	bench_buckets(dump, name, "pool", count[1]);
+	printf("\n%s, cumulative\n%-12s %12s %12s\n", title, "<= ms", "delete", "pool");
+	for (int i = 0; i <= BENCH_BOUNDS; i++) {
+		if (i < BENCH_BOUNDS)
+			printf("%-12lld", g_bounds[i] / 1000);
+		else
+			printf("%-12s", "+Inf");
+		printf(" %12lld %12lld\n", count[0][i], count[1][i]);
+	}
+}
+
+int main(int argc, char **argv) {
+	rkipc_metrics_config_t metrics_config = {0};
+	bench_stream_s stream[BENCH_STREAMS];
+	bench_result_s result[2];
+	struct statvfs st;
+	char *dump;
+	int size;
+
+	for (;;) {
+		int idx;
+		int c = getopt_long(argc, argv, short_options, long_options, &idx);
+		if (-1 == c)
+			break;
+		switch (c) {
+		case 'd':
+			g_dir = optarg;
+			break;
+		case 'D':
+			g_days = atoi(optarg);
+			break;
+		case 'l':
+			g_segment = atoi(optarg);
+			break;
+		case 'm':
+			g_kbps[0] = atoi(optarg);
+			break;
+		case 's':
+			g_kbps[1] = atoi(optarg);
+			break;
+		case 'n':
+			g_slots = atoi(optarg);
+			break;
+		case 'f':
+			g_fsync = atoi(optarg);
+			break;
+		case 'h':
+			usage_tip(stdout, argv);
+			return 0;
+		default:
+			usage_tip(stderr, argv);
+			return -1;
+		}
+	}
+	if (g_days < 1 || g_segment < 1 || g_kbps[0] < 16 || g_kbps[1] < 16 || g_slots < 0 ||
+	    g_fsync < 0) {
+		usage_tip(stderr, argv);
+		return -1;
+	}
+	if (mkdir(g_dir, 0755) && access(g_dir, W_OK)) {
+		printf("can not use %s\n", g_dir);
+		return -1;
+	}
+
+	memset(stream, 0, sizeof(stream));
+	for (int i = 0; i < BENCH_STREAMS; i++) {
+		snprintf(stream[i].folder, sizeof(stream[i].folder), "%s/%s", g_dir,
+		         g_stream_name[i]);
+		mkdir(stream[i].folder, 0755);
+		bench_clean(stream[i].folder);
+		stream[i].frame_size = g_kbps[i] * 1000 / 8 / BENCH_FPS;
+		// as storage sizes a slot, the max bitrate for the segment plus a quarter
+		stream[i].slot_bytes =
+		    ((((int64_t)g_kbps[i] * 1000 / 8 * g_segment * 5 / 4) >> 20) + 1) << 20;
+	}
+	if (!g_slots) {
+		if (statvfs(g_dir, &st)) {
+			printf("can not use %s\n", g_dir);
+			return -1;
+		}
+		g_slots = (int64_t)st.f_bavail * st.f_frsize / 10 * 9 /
+		          (stream[0].slot_bytes + stream[1].slot_bytes);
+	}
+	if (g_slots < 2) {
+		printf("%s has no room for segments\n", g_dir);
+		return -1;
+	}
+	for (int i = 0; i < BENCH_STREAMS; i++) {
+		stream[i].names = calloc(g_slots, sizeof(*stream[i].names));
+		if (!stream[i].names)
+			return -1;
+	}
+
+	rkipc_metrics_init(&metrics_config);
+	memset(result, 0, sizeof(result));
+	for (int i = 0; i < 2; i++) {
+		const char *labels = i ? "strategy=\"pool\"" : "strategy=\"delete\"";
+
+		result[i].name = i ? "recording pool" : "delete and create";
+		result[i].pool = i;
+		result[i].write_us = rkipc_metric_histogram("bench_fragment_write_us", labels,
+		                                            "Time a fragment takes to reach the disk",
+		                                            g_bounds, BENCH_BOUNDS);
+		result[i].switch_us = rkipc_metric_histogram(
+		    "bench_switch_us", labels, "Time a segment switch takes", g_bounds, BENCH_BOUNDS);
+	}
+
+	printf("%d days of %d kbps main and %d kbps sub, %d s segments, %d per stream, fsync %d\n",
+	       g_days, g_kbps[0], g_kbps[1], g_segment, g_slots, g_fsync);
+	for (int i = 0; i < 2; i++) {
+		if (bench_run(stream, &result[i]))
+			return -1;
+	}
+	printf("%-18s %9s %8s %6s %12s %9s %10s\n", "", "segments", "dropped", "files",
+	       "extents/file", "fill ms", "wall ms");
+	for (int i = 0; i < 2; i++)
+		printf("%-18s %9d %8d %6d %12.1f %9.0f %10.0f\n", result[i].name, result[i].segments,
+		       result[i].dropped, result[i].files,
+		       result[i].files ? (double)result[i].extents / result[i].files : 0,
+		       result[i].fill_ms, result[i].wall_ms);
+	size = rkipc_metrics_dump(NULL, 0) + 1;
+	dump = malloc(size);
+	if (dump) {
+		rkipc_metrics_dump(dump, size);
+		bench_print(dump, "bench_fragment_write_us", "fragment write");
+		bench_print(dump, "bench_switch_us", "segment switch");
+		free(dump);
+	}
+	for (int i = 0; i < BENCH_STREAMS; i++) {
+		bench_clean(stream[i].folder);
+		rmdir(stream[i].folder);
+		free(stream[i].names);
+	}
+	rkipc_metrics_deinit();
+
+	return 0;
+}